@@ -156,6 +156,8 @@ storage_conf_type (char **name, void **val, int *len)
 		t = STORAGE_TYPE_AHCI;
 	else if (strcasecmp (*val, "AHCI_ATAPI") == 0)
 		t = STORAGE_TYPE_AHCI_ATAPI;
+	else if (strcasecmp (*val, "NVME") == 0)
+		t = STORAGE_TYPE_NVME;
 	else if (strcasecmp (*val, "ANY") == 0)
 		t = STORAGE_TYPE_ANY;
 	else {
@@ -412,6 +414,17 @@ setconfig (char *name, char *value, struct config_data *cfg)
 		     "storage.keys_conf[%d].keybits", i);
 		ssi (noconv, &name, &src, &len, "storage.conf%d.extend",
 		     "storage.keys_conf[%d].extend", i);
+		ssi (noconv, &name, &src, &len,
+		     "storage.conf%d.old_crypto_name",
+		     "storage.keys_conf[%d].old_crypto_name", i);
+		ssi (u8num, &name, &src, &len, "storage.conf%d.old_keyindex",
+		     "storage.keys_conf[%d].old_keyindex", i);
+		ssi (u16num, &name, &src, &len, "storage.conf%d.old_keybits",
+		     "storage.keys_conf[%d].old_keybits", i);
+		ssi (uintnum, &name, &src, &len, "storage.conf%d.rekey_devno",
+		     "storage.keys_conf[%d].rekey_devno", i);
+		ssi (u64num, &name, &src, &len, "storage.conf%d.lba_rekey",
+		     "storage.keys_conf[%d].lba_rekey", i);
 	}
 	/* vmm */
 	ss (uintnum, &name, &src, &len, "vmm.f11panic", "vmm.f11panic");
@@ -442,6 +455,8 @@ setconfig (char *name, char *value, struct config_data *cfg)
 	ss (uintnum, &name, &src, &len, "vmm.tty_x540", "vmm.tty_x540");
 	ss (uintnum, &name, &src, &len, "vmm.tty_ieee1394", "vmm.tty_ieee1394");
 	ss (uintnum, &name, &src, &len, "vmm.driver.ata", "vmm.driver.ata");
+	ss (uintnum, &name, &src, &len, "vmm.driver.ahci_vmm_tags",
+	    "vmm.driver.ahci_vmm_tags");
 	ss (uintnum, &name, &src, &len, "vmm.driver.usb.uhci", "vmm.driver.usb.uhci");
 	ss (uintnum, &name, &src, &len, "vmm.driver.usb.ehci", "vmm.driver.usb.ehci");
 	ss (uintnum, &name, &src, &len, "vmm.driver.concealEHCI",
@@ -464,6 +479,33 @@ setconfig (char *name, char *value, struct config_data *cfg)
 	    "vmm.iccard.enable");
 	ss (uintnum, &name, &src, &len, "vmm.iccard.status",
 	    "vmm.iccard.status");
+	ss (uintnum, &name, &src, &len, "vmm.checkpoint.enable",
+	    "vmm.checkpoint.enable");
+	ss (uintnum, &name, &src, &len, "vmm.checkpoint.devno",
+	    "vmm.checkpoint.devno");
+	ss (u64num, &name, &src, &len, "vmm.checkpoint.lba",
+	    "vmm.checkpoint.lba");
+	ss (u64num, &name, &src, &len, "vmm.checkpoint.sectors",
+	    "vmm.checkpoint.sectors");
+	ss (uintnum, &name, &src, &len, "vmm.checkpoint.interval",
+	    "vmm.checkpoint.interval");
+	ss (noconv, &name, &src, &len, "vmm.panic_dump.device",
+	    "vmm.panic_dump.device");
+	ss (u64num, &name, &src, &len, "vmm.panic_dump.lba",
+	    "vmm.panic_dump.lba");
+	ss (u64num, &name, &src, &len, "vmm.panic_dump.sectors",
+	    "vmm.panic_dump.sectors");
+	ss (uintnum, &name, &src, &len, "vmm.nicpoll.enable",
+	    "vmm.nicpoll.enable");
+	ss (uintnum, &name, &src, &len, "vmm.nicpoll.apic_id",
+	    "vmm.nicpoll.apic_id");
+	ss (uintnum, &name, &src, &len, "vmm.nicpoll.budget",
+	    "vmm.nicpoll.budget");
+	ss (uintnum, &name, &src, &len, "vmm.nicpoll.idle_rounds",
+	    "vmm.nicpoll.idle_rounds");
+	for (i = 0; i < NUM_OF_NICPOLL_QUEUES_CONF; i++)
+		ssi (uintnum, &name, &src, &len, "vmm.nicpoll.queue%d.budget",
+		     "vmm.nicpoll.queue_budget[%d]", i);
 	/* idman */
 	CONF (idman.crl01);
 	CONF (idman.crl02);
@@ -583,6 +625,16 @@ setconfig (char *name, char *value, struct config_data *cfg)
 		       cfg->storage.keys_conf[i].keybits);
 		CONF1 ("storage.keys_conf[%d].extend", i,
 		       cfg->storage.keys_conf[i].extend);
+		CONF1 ("storage.keys_conf[%d].old_crypto_name", i,
+		       cfg->storage.keys_conf[i].old_crypto_name);
+		CONF1 ("storage.keys_conf[%d].old_keyindex", i,
+		       cfg->storage.keys_conf[i].old_keyindex);
+		CONF1 ("storage.keys_conf[%d].old_keybits", i,
+		       cfg->storage.keys_conf[i].old_keybits);
+		CONF1 ("storage.keys_conf[%d].rekey_devno", i,
+		       cfg->storage.keys_conf[i].rekey_devno);
+		CONF1 ("storage.keys_conf[%d].lba_rekey", i,
+		       cfg->storage.keys_conf[i].lba_rekey);
 	}
 	/* vmm */
 	CONF (vmm.f11panic);
@@ -605,6 +657,7 @@ setconfig (char *name, char *value, struct config_data *cfg)
 	CONF (vmm.tty_x540);
 	CONF (vmm.tty_ieee1394);
 	CONF (vmm.driver.ata);
+	CONF (vmm.driver.ahci_vmm_tags);
 	CONF (vmm.driver.usb.uhci);
 	CONF (vmm.driver.usb.ehci);
 	CONF (vmm.driver.concealEHCI);
@@ -619,6 +672,21 @@ setconfig (char *name, char *value, struct config_data *cfg)
 	CONF (vmm.driver.pci);
 	CONF (vmm.iccard.enable);
 	CONF (vmm.iccard.status);
+	CONF (vmm.checkpoint.enable);
+	CONF (vmm.checkpoint.devno);
+	CONF (vmm.checkpoint.lba);
+	CONF (vmm.checkpoint.sectors);
+	CONF (vmm.checkpoint.interval);
+	CONF (vmm.panic_dump.device);
+	CONF (vmm.panic_dump.lba);
+	CONF (vmm.panic_dump.sectors);
+	CONF (vmm.nicpoll.enable);
+	CONF (vmm.nicpoll.apic_id);
+	CONF (vmm.nicpoll.budget);
+	CONF (vmm.nicpoll.idle_rounds);
+	for (i = 0; i < NUM_OF_NICPOLL_QUEUES_CONF; i++)
+		CONF1 ("vmm.nicpoll.queue_budget[%d]", i,
+		       cfg->vmm.nicpoll.queue_budget[i]);
 	if (!dst) {
 		fprintf (stderr, "unknown config \"%s\"\n", name);
 		exit (EXIT_FAILURE);
@@ -133,15 +133,27 @@ efi_main (EFI_HANDLE image, EFI_SYSTEM_TABLE *systab)
 		print (systab, L"FileSystemProtocol ", status);
 		return status;
 	}
-	create_file_path (loaded_image->FilePath, L"bitvisor.elf", file_path,
-			  sizeof file_path / sizeof file_path[0]);
 	fileio = tmp;
 	status = fileio->OpenVolume (fileio, &file);
 	if (EFI_ERROR (status)) {
 		print (systab, L"OpenVolume ", status);
 		return status;
 	}
+	status = EFI_NOT_FOUND;
+#ifdef LOADVMM_PACKED
+	/* built with PACKED=1: prefer the image packed by tools/vmmpack
+	 * so that a stale bitvisor.pak is never picked up by default */
+	create_file_path (loaded_image->FilePath, L"bitvisor.pak", file_path,
+			  sizeof file_path / sizeof file_path[0]);
 	status = file->Open (file, &file2, file_path, EFI_FILE_MODE_READ, 0);
+#endif
+	if (EFI_ERROR (status)) {
+		create_file_path (loaded_image->FilePath, L"bitvisor.elf",
+				  file_path,
+				  sizeof file_path / sizeof file_path[0]);
+		status = file->Open (file, &file2, file_path,
+				     EFI_FILE_MODE_READ, 0);
+	}
 	if (EFI_ERROR (status)) {
 		print (systab, L"Open ", status);
 		return status;
@@ -59,6 +59,17 @@
 #define MCFG_SIGNATURE		"MCFG"
 #define DMAR_SIGNATURE		"DMAR"
 #define SSDT_SIGNATURE		"SSDT"
+#define APIC_SIGNATURE		"APIC"
+#define SRAT_SIGNATURE		"SRAT"
+#define MADT_TYPE_LAPIC		0
+#define MADT_TYPE_X2APIC	9
+#define MADT_LAPIC_ENABLED	0x1
+#define SRAT_TYPE_APIC		0
+#define SRAT_TYPE_MEMORY	1
+#define SRAT_TYPE_X2APIC	2
+#define SRAT_TYPE_GENERIC	5
+#define SRAT_ENABLED		0x1
+#define SRAT_DEVICE_HANDLE_PCI	1
 #define PM1_CNT_SLP_TYPX_MASK	0x1C00
 #define PM1_CNT_SLP_TYPX_SHIFT	10
 #define PM1_CNT_SLP_EN_BIT	0x2000
@@ -195,6 +206,84 @@ struct mcfg {
 	} __attribute__ ((packed)) configs[1];
 } __attribute__ ((packed));
 
+struct madt {
+	struct description_header header;
+	u32 lapic_addr;
+	u32 flags;
+	u8 entries[];
+} __attribute__ ((packed));
+
+struct madt_lapic {
+	u8 type;
+	u8 length;
+	u8 processor_id;
+	u8 apic_id;
+	u32 flags;
+} __attribute__ ((packed));
+
+struct madt_x2apic {
+	u8 type;
+	u8 length;
+	u8 reserved[2];
+	u32 x2apic_id;
+	u32 flags;
+	u32 processor_uid;
+} __attribute__ ((packed));
+
+struct srat {
+	struct description_header header;
+	u32 reserved1;
+	u64 reserved2;
+	u8 entries[];
+} __attribute__ ((packed));
+
+struct srat_apic {
+	u8 type;
+	u8 length;
+	u8 proximity_domain_lo;
+	u8 apic_id;
+	u32 flags;
+	u8 sapic_eid;
+	u8 proximity_domain_hi[3];
+	u32 clock_domain;
+} __attribute__ ((packed));
+
+struct srat_memory {
+	u8 type;
+	u8 length;
+	u32 proximity_domain;
+	u16 reserved1;
+	u64 base;
+	u64 len;
+	u32 reserved2;
+	u32 flags;
+	u64 reserved3;
+} __attribute__ ((packed));
+
+struct srat_x2apic {
+	u8 type;
+	u8 length;
+	u16 reserved1;
+	u32 proximity_domain;
+	u32 x2apic_id;
+	u32 flags;
+	u32 clock_domain;
+	u32 reserved2;
+} __attribute__ ((packed));
+
+struct srat_generic {
+	u8 type;
+	u8 length;
+	u8 reserved1;
+	u8 device_handle_type;
+	u32 proximity_domain;
+	u16 seg_group;		/* PCI device handle */
+	u16 bdf;
+	u8 reserved2[12];
+	u32 flags;
+	u32 reserved3;
+} __attribute__ ((packed));
+
 static bool rsdp_found;
 static struct rsdpv2 rsdp_copy;
 static bool pm1a_cnt_found;
@@ -208,6 +297,7 @@ static u8 reset_value;
 static u32 dsdt_addr;
 #endif
 static struct mcfg *saved_mcfg;
+static struct srat *saved_srat;
 
 static u8
 acpi_checksum (void *p, int len)
@@ -395,6 +485,18 @@ save_mcfg (void)
 	}
 }
 
+static void
+save_srat (void)
+{
+	struct srat *d;
+
+	d = find_entry (SRAT_SIGNATURE);
+	if (d) {
+		saved_srat = alloc (d->header.length);
+		memcpy (saved_srat, d, d->header.length);
+	}
+}
+
 static void
 debug_dump (void *p, int len)
 {
@@ -714,6 +816,85 @@ acpi_read_mcfg (uint n, u64 *base, u16 *seg_group, u8 *bus_start,
 	return true;
 }
 
+/* find the next enabled SRAT entry of the type after *pos.  *pos
+   must be NULL at the first call. */
+static void *
+srat_next (u8 type, u8 len, void *pos)
+{
+	u8 *p, *end;
+
+	if (!saved_srat)
+		return NULL;
+	p = pos ? (u8 *)pos + ((u8 *)pos)[1] : saved_srat->entries;
+	end = (u8 *)saved_srat + saved_srat->header.length;
+	for (; p + 2 <= end && p[1] >= 2 && p + p[1] <= end; p += p[1])
+		if (p[0] == type && p[1] >= len)
+			return p;
+	return NULL;
+}
+
+/* the nth enabled memory range in SRAT */
+bool
+acpi_srat_memory (uint n, u64 *base, u64 *len, u32 *pxm)
+{
+	struct srat_memory *m = NULL;
+
+	while ((m = srat_next (SRAT_TYPE_MEMORY, sizeof *m, m))) {
+		if (!(m->flags & SRAT_ENABLED) || !m->len)
+			continue;
+		if (n--)
+			continue;
+		*base = m->base;
+		*len = m->len;
+		*pxm = m->proximity_domain;
+		return true;
+	}
+	return false;
+}
+
+bool
+acpi_srat_cpu (u32 apic_id, u32 *pxm)
+{
+	struct srat_apic *a = NULL;
+	struct srat_x2apic *x = NULL;
+
+	while ((x = srat_next (SRAT_TYPE_X2APIC, sizeof *x, x))) {
+		if ((x->flags & SRAT_ENABLED) && x->x2apic_id == apic_id) {
+			*pxm = x->proximity_domain;
+			return true;
+		}
+	}
+	while ((a = srat_next (SRAT_TYPE_APIC, sizeof *a, a))) {
+		if ((a->flags & SRAT_ENABLED) && a->apic_id == apic_id) {
+			*pxm = a->proximity_domain_lo |
+				a->proximity_domain_hi[0] << 8 |
+				a->proximity_domain_hi[1] << 16 |
+				a->proximity_domain_hi[2] << 24;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* PCI devices are found in generic initiator affinity structures
+   only.  _PXM objects in the DSDT are not evaluated. */
+bool
+acpi_srat_pci (u16 seg_group, u8 bus, u8 devfn, u32 *pxm)
+{
+	struct srat_generic *g = NULL;
+
+	while ((g = srat_next (SRAT_TYPE_GENERIC, sizeof *g, g))) {
+		if ((g->flags & SRAT_ENABLED) &&
+		    g->device_handle_type == SRAT_DEVICE_HANDLE_PCI &&
+		    g->seg_group == seg_group &&
+		    g->bdf == (bus << 8 | devfn)) {
+			*pxm = g->proximity_domain;
+			return true;
+		}
+	}
+	return false;
+}
+
 #ifdef ACPI_DSDT
 static void *
 call_ssdt_parse (void *data, u64 entry)
@@ -739,6 +920,51 @@ call_ssdt_parse (void *data, u64 entry)
 }
 #endif
 
+/* clear the enabled flag of the processor in MADT so that the guest
+   OS never tries to start it */
+bool
+acpi_disable_lapic (u32 apic_id)
+{
+	struct madt *m;
+	struct madt_lapic *l;
+	struct madt_x2apic *x;
+	u8 *p, *end;
+	bool found = false;
+
+	if (!rsdp_found)
+		return false;
+	m = find_entry (APIC_SIGNATURE);
+	if (!m)
+		return false;
+	p = m->entries;
+	end = (u8 *)m + m->header.length;
+	while (p + 2 <= end && p[1] >= 2 && p + p[1] <= end) {
+		switch (p[0]) {
+		case MADT_TYPE_LAPIC:
+			l = (void *)p;
+			if (l->length >= sizeof *l && l->apic_id == apic_id &&
+			    (l->flags & MADT_LAPIC_ENABLED)) {
+				l->flags &= ~MADT_LAPIC_ENABLED;
+				found = true;
+			}
+			break;
+		case MADT_TYPE_X2APIC:
+			x = (void *)p;
+			if (x->length >= sizeof *x &&
+			    x->x2apic_id == apic_id &&
+			    (x->flags & MADT_LAPIC_ENABLED)) {
+				x->flags &= ~MADT_LAPIC_ENABLED;
+				found = true;
+			}
+			break;
+		}
+		p += p[1];
+	}
+	if (found)
+		m->header.checksum -= acpi_checksum (m, m->header.length);
+	return found;
+}
+
 static void
 acpi_init_paral (void)
 {
@@ -859,6 +1085,7 @@ acpi_init_global (void)
 	}
 	pm1a_cnt_found = true;
 	save_mcfg ();
+	save_srat ();
 }
 
 INITFUNC ("global3", acpi_init_global);
@@ -42,5 +42,9 @@ void acpi_poweroff (void);
 bool get_acpi_time_raw (u32 *r);
 void acpi_smi_hook (void);
 void acpi_reset (void);
+bool acpi_disable_lapic (u32 apic_id);
+bool acpi_srat_memory (uint n, u64 *base, u64 *len, u32 *pxm);
+bool acpi_srat_cpu (u32 apic_id, u32 *pxm);
+bool acpi_srat_pci (u16 seg_group, u8 bus, u8 devfn, u32 *pxm);
 
 #endif
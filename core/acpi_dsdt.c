@@ -37,6 +37,8 @@
 
 #define PKGENDLEN 16
 #define DATALEN 64
+#define SCAN_DEPTH 64
+#define SCAN_BREAKS 8
 
 /* --- */
 enum elementid {
@@ -534,6 +536,23 @@ struct parsedatalist {
 	struct buflist *bufhead;
 };
 
+struct scanbreak {
+	char name[DATALEN];
+	int namelen;
+};
+
+struct scandata {
+	unsigned char *start, *end;
+	int breakfind;
+	int nbreak;
+	struct scanbreak breaks[SCAN_BREAKS];
+	int namelen, datalen;
+	unsigned char data[DATALEN];
+	unsigned char *datac;
+	unsigned char system_state[6][5];
+	unsigned char *system_state_name[6];
+};
+
 struct parsedata {
 	struct parsedatalist *head, *cur, *ok;
 	unsigned char *start, *end, *c;
@@ -566,9 +585,9 @@ error (char *str)
 }
 
 static void
-replace_byte (struct parsedata *d, unsigned char *p, unsigned char c)
+replace_byte (unsigned char *start, unsigned char *p, unsigned char c)
 {
-	d->start[9] += *p - c;
+	start[9] += *p - c;
 	*p = c;
 }
 
@@ -834,13 +853,13 @@ pathsearch (struct parsedata *d, enum elementid element, struct pathlist *end)
 }
 
 static int
-getname (struct parsedata *d, char *buf, int len)
+getname_sub (unsigned char *data, int datalen, char *buf, int len)
 {
 	char c;
 	int i, j;
 
-	for (i = j = 0; i < d->cur->datalen; i++) {
-		c = (char)d->cur->data[i];
+	for (i = j = 0; i < datalen; i++) {
+		c = (char)data[i];
 		switch (c) {
 		case '\\':
 			j = 0;
@@ -860,12 +879,16 @@ getname (struct parsedata *d, char *buf, int len)
 }
 
 static int
-namecmp_system_state (struct parsedata *d)
+getname (struct parsedata *d, char *buf, int len)
 {
-	int s, len;
-	char tmp[DATALEN];
+	return getname_sub (d->cur->data, d->cur->datalen, buf, len);
+}
+
+static int
+namecmp_system_state_sub (char *tmp, int len)
+{
+	int s;
 
-	len = getname (d, tmp, sizeof tmp);
 	if (len != 4)
 		s = -1;
 	else if (!memcmp (tmp, "_S0_", 4))
@@ -885,6 +908,16 @@ namecmp_system_state (struct parsedata *d)
 	return s;
 }
 
+static int
+namecmp_system_state (struct parsedata *d)
+{
+	int len;
+	char tmp[DATALEN];
+
+	len = getname (d, tmp, sizeof tmp);
+	return namecmp_system_state_sub (tmp, len);
+}
+
 static void
 save_system_state (struct parsedata *d, struct pathlist *path)
 {
@@ -972,7 +1005,7 @@ break_method (struct parsedata *d, struct pathlist *path)
 	len = getname (d, tmp, DATALEN);
 	for (p = d->breakhead; p; p = p->next) {
 		if (p->namelen == len && !memcmp (p->name, tmp, len)) {
-			replace_byte (d, d->c, 0xA3); /* 0xA3=noop */
+			replace_byte (d->start, d->c, 0xA3); /* 0xA3=noop */
 			break;
 		}
 	}
@@ -2520,17 +2553,466 @@ err:
 }
 
 static void
-parser (unsigned char *start, unsigned char *end, bool print_progress)
+set_system_state (unsigned char *start, unsigned char system_state[6][5],
+		  unsigned char *system_state_name[6])
 {
-	struct parsedata d;
-	struct parsedatalist *q;
 	int i, j;
-	int search_device;
 
-	search_device = 0;
-#ifdef TTY_SERIAL
-	search_device = 1;
+#ifdef DISABLE_SLEEP
+	if (system_state_name[2] && *system_state_name[2] == '_') {
+		replace_byte (start, system_state_name[2], 'D');
+		printf ("Disable ACPI S2\n");
+	}
+	if (system_state_name[3] && *system_state_name[3] == '_') {
+		replace_byte (start, system_state_name[3], 'D');
+		printf ("Disable ACPI S3\n");
+	}
 #endif
+	for (i = 0; i < 6; i++) {
+		if (!system_state[i][0])
+			continue;
+		for (j = 0; j < 5; j++)
+			acpi_dsdt_system_state[i][j] = system_state[i][j];
+	}
+}
+
+/* The scanner below walks the namespace-level structure of a table
+ * without building parse lists.  Bodies that are not interesting
+ * (methods, fields, buffers and packages other than _Sx) are skipped
+ * by PkgLength.  Everything the scanner needs lives in struct
+ * scandata, so no memory is allocated.  If it finds something it
+ * does not understand, e.g. an If() at the namespace level, it gives
+ * up before modifying the table and the full parser is used. */
+static int
+scan_pkglength (unsigned char **c, unsigned char *end,
+		unsigned char **pkgend)
+{
+	unsigned char *p;
+	unsigned int pkglen;
+	int i, n;
+
+	p = *c;
+	if (p >= end)
+		return -1;
+	n = *p >> 6;
+	if (p + n >= end)
+		return -1;
+	pkglen = n ? *p & 0xF : *p;
+	for (i = 1; i <= n; i++)
+		pkglen |= (unsigned int)p[i] << (i * 8 - 4);
+	if (pkglen > end - p || pkglen < n + 1)
+		return -1;
+	*pkgend = p + pkglen;
+	*c = p + n + 1;
+	return 0;
+}
+
+static int
+scan_nameseg (struct scandata *s, unsigned char **c, unsigned char *end)
+{
+	unsigned char *p;
+	int i;
+
+	p = *c;
+	if (end - p < 4)
+		return -1;
+	for (i = 0; i < 4; i++) {
+		if (!(p[i] == '_' || (p[i] >= 'A' && p[i] <= 'Z') ||
+		      (i && p[i] >= '0' && p[i] <= '9')))
+			return -1;
+		if (s->datalen < DATALEN - 2) {
+			s->data[s->datalen++] = p[i];
+			s->datac = &p[i];
+		}
+	}
+	*c = p + 4;
+	return 0;
+}
+
+static int
+scan_namestring (struct scandata *s, unsigned char **c, unsigned char *end)
+{
+	unsigned char *p;
+	int n;
+
+	p = *c;
+	s->datalen = s->namelen;
+	s->datac = NULL;
+	if (p < end && *p == '\\') {
+		if (s->datalen < DATALEN - 2)
+			s->data[s->datalen++] = *p;
+		p++;
+	} else {
+		while (p < end && *p == '^') {
+			if (s->datalen < DATALEN - 2)
+				s->data[s->datalen++] = *p;
+			p++;
+		}
+	}
+	if (p >= end)
+		return -1;
+	switch (*p) {
+	case 0x00:		/* NullName */
+		p++;
+		break;
+	case 0x2E:		/* DualNamePrefix */
+		p++;
+		if (scan_nameseg (s, &p, end) || scan_nameseg (s, &p, end))
+			return -1;
+		break;
+	case 0x2F:		/* MultiNamePrefix */
+		p++;
+		if (p >= end)
+			return -1;
+		for (n = *p++; n > 0; n--)
+			if (scan_nameseg (s, &p, end))
+				return -1;
+		break;
+	default:
+		if (scan_nameseg (s, &p, end))
+			return -1;
+	}
+	*c = p;
+	return 0;
+}
+
+/* skip a constant data object */
+static int
+scan_data (unsigned char **c, unsigned char *end)
+{
+	unsigned char *p, *pkgend;
+
+	p = *c;
+	if (p >= end)
+		return -1;
+	switch (*p++) {
+	case 0x00:		/* ZeroOp */
+	case 0x01:		/* OneOp */
+	case 0xFF:		/* OnesOp */
+		break;
+	case 0x0A:		/* BytePrefix */
+		p += 1;
+		break;
+	case 0x0B:		/* WordPrefix */
+		p += 2;
+		break;
+	case 0x0C:		/* DWordPrefix */
+		p += 4;
+		break;
+	case 0x0E:		/* QWordPrefix */
+		p += 8;
+		break;
+	case 0x0D:		/* StringPrefix */
+		while (p < end && *p >= 0x01 && *p <= 0x7F)
+			p++;
+		if (p >= end || *p != 0x00)
+			return -1;
+		p++;
+		break;
+	case 0x5B:		/* RevisionOp */
+		if (p >= end || *p != 0x30)
+			return -1;
+		p++;
+		break;
+	case 0x11:		/* BufferOp */
+	case 0x12:		/* PackageOp */
+	case 0x13:		/* VarPackageOp */
+		if (scan_pkglength (&p, end, &pkgend))
+			return -1;
+		p = pkgend;
+		break;
+	default:
+		return -1;
+	}
+	if (p > end)
+		return -1;
+	*c = p;
+	return 0;
+}
+
+static void
+scan_save_system_state (struct scandata *s, int n, unsigned char *p)
+{
+	if (s->breakfind)
+		return;
+	if (s->system_state[n][0] >= 5)
+		return;
+	s->system_state[n][0]++;
+	if (s->system_state[n][0] >= 5)
+		return;
+	s->system_state[n][s->system_state[n][0]] = *p;
+	s->system_state_name[n] = s->datac;
+}
+
+/* Package() of _Sx: every byte of integer elements is saved, the
+ * same as save_system_state() does */
+static int
+scan_system_state (struct scandata *s, int n, unsigned char **c,
+		   unsigned char *end)
+{
+	unsigned char *p, *pkgend;
+	int i, len;
+
+	p = *c;
+	if (p >= end || *p++ != 0x12)
+		return -1;
+	if (scan_pkglength (&p, end, &pkgend))
+		return -1;
+	if (p >= pkgend)
+		return -1;
+	p++;			/* NumElements */
+	while (p < pkgend) {
+		switch (*p) {
+		case 0x00:	/* ZeroOp */
+		case 0x01:	/* OneOp */
+		case 0xFF:	/* OnesOp */
+			scan_save_system_state (s, n, p++);
+			continue;
+		case 0x0A:	/* BytePrefix */
+			len = 1;
+			break;
+		case 0x0B:	/* WordPrefix */
+			len = 2;
+			break;
+		case 0x0C:	/* DWordPrefix */
+			len = 4;
+			break;
+		case 0x0E:	/* QWordPrefix */
+			len = 8;
+			break;
+		default:
+			return -1;
+		}
+		if (pkgend - p <= len)
+			return -1;
+		for (i = 1; i <= len; i++)
+			scan_save_system_state (s, n, &p[i]);
+		p += len + 1;
+	}
+	*c = p;
+	return 0;
+}
+
+static int
+scan_defname (struct scandata *s, unsigned char **c, unsigned char *end)
+{
+	int len, n;
+	char tmp[DATALEN];
+
+	if (scan_namestring (s, c, end))
+		return -1;
+	len = getname_sub (s->data, s->datalen, tmp, DATALEN);
+	n = namecmp_system_state_sub (tmp, len);
+	if (n >= 0 && *c < end && **c == 0x12)
+		return scan_system_state (s, n, c, end);
+	if (s->breakfind && len >= 4 && !memcmp (&tmp[len - 4], "_HID", 4) &&
+	    *c < end && **c == 0x0C && s->end - *c > 4 &&
+	    *(unsigned int *)(*c + 1) == 0x0105D041) { /* PNP0501 */
+		memcpy (&tmp[len - 4], "_DIS", 4);
+		for (n = 0; n < s->nbreak; n++)
+			if (s->breaks[n].namelen == len &&
+			    !memcmp (s->breaks[n].name, tmp, len))
+				break;
+		if (n == s->nbreak) {
+			if (s->nbreak >= SCAN_BREAKS)
+				return -1;
+			memcpy (s->breaks[n].name, tmp, len);
+			s->breaks[n].namelen = len;
+			s->nbreak++;
+		}
+	}
+	return scan_data (c, end);
+}
+
+static int
+scan_defmethod (struct scandata *s, unsigned char **c, unsigned char *end)
+{
+	unsigned char *p, *pkgend;
+	int i, len;
+	char tmp[DATALEN];
+
+	p = *c;
+	if (scan_pkglength (&p, end, &pkgend))
+		return -1;
+	if (scan_namestring (s, &p, pkgend))
+		return -1;
+	if (p >= pkgend)
+		return -1;
+	p++;			/* MethodFlags */
+	if (!s->breakfind && s->nbreak) {
+		len = getname_sub (s->data, s->datalen, tmp, DATALEN);
+		for (i = 0; i < s->nbreak; i++) {
+			if (s->breaks[i].namelen == len &&
+			    !memcmp (s->breaks[i].name, tmp, len)) {
+				for (; p < pkgend; p++)
+					replace_byte (s->start, p, 0xA3);
+				break;
+			}
+		}
+	}
+	*c = pkgend;
+	return 0;
+}
+
+static int
+scan (struct scandata *s)
+{
+	unsigned char *c, *end, *pkgend, *stack[SCAN_DEPTH];
+	int depth, skip, device, newdevice, append;
+	int devicestack[SCAN_DEPTH], namelenstack[SCAN_DEPTH];
+
+	if (s->end - s->start < 36) /* DefBlockHdr */
+		return -1;
+	c = s->start + 36;
+	end = s->end;
+	depth = 0;
+	device = 0;
+	s->namelen = 0;
+	for (;;) {
+		if (c == end) {
+			if (!depth)
+				return 0;
+			depth--;
+			end = stack[depth];
+			device = devicestack[depth];
+			s->namelen = namelenstack[depth];
+			continue;
+		}
+		skip = -1;
+		newdevice = device;
+		append = 0;
+		switch (*c++) {
+		case 0x00:	/* ZeroOp (workaround in ObjectList2) */
+		case 0xA3:	/* NoopOp */
+			continue;
+		case 0x06:	/* AliasOp */
+			if (scan_namestring (s, &c, end) ||
+			    scan_namestring (s, &c, end))
+				return -1;
+			continue;
+		case 0x08:	/* NameOp */
+			if (scan_defname (s, &c, end))
+				return -1;
+			continue;
+		case 0x10:	/* ScopeOp */
+			skip = 0;
+			append = !device;
+			break;
+		case 0x14:	/* MethodOp */
+			if (scan_defmethod (s, &c, end))
+				return -1;
+			continue;
+		case 0x5B:	/* ExtOpPrefix */
+			if (c >= end)
+				return -1;
+			switch (*c++) {
+			case 0x01: /* MutexOp */
+				if (scan_namestring (s, &c, end) || c >= end)
+					return -1;
+				c++;
+				continue;
+			case 0x02: /* EventOp */
+				if (scan_namestring (s, &c, end))
+					return -1;
+				continue;
+			case 0x80: /* OpRegionOp */
+				if (scan_namestring (s, &c, end) || c >= end)
+					return -1;
+				c++;
+				if (scan_data (&c, end) || scan_data (&c, end))
+					return -1;
+				continue;
+			case 0x81: /* FieldOp */
+			case 0x86: /* IndexFieldOp */
+			case 0x87: /* BankFieldOp */
+				if (scan_pkglength (&c, end, &pkgend))
+					return -1;
+				c = pkgend;
+				continue;
+			case 0x82: /* DeviceOp */
+				skip = 0;
+				newdevice = 1;
+				append = 1;
+				break;
+			case 0x85: /* ThermalZoneOp */
+				skip = 0;
+				break;
+			case 0x83: /* ProcessorOp */
+				skip = 6;
+				break;
+			case 0x84: /* PowerResOp */
+				skip = 3;
+				break;
+			case 0x88: /* DataRegionOp */
+				if (scan_namestring (s, &c, end) ||
+				    scan_data (&c, end) ||
+				    scan_data (&c, end) ||
+				    scan_data (&c, end))
+					return -1;
+				continue;
+			}
+			break;
+		}
+		if (skip < 0)
+			return -1;
+		/* enter the ObjectList or TermList of the block */
+		if (scan_pkglength (&c, end, &pkgend))
+			return -1;
+		if (scan_namestring (s, &c, pkgend))
+			return -1;
+		if (pkgend - c < skip)
+			return -1;
+		c += skip;
+		if (depth >= SCAN_DEPTH)
+			return -1;
+		stack[depth] = end;
+		devicestack[depth] = device;
+		namelenstack[depth] = s->namelen;
+		depth++;
+		end = pkgend;
+		device = newdevice;
+		if (append)
+			s->namelen = s->datalen;
+	}
+}
+
+static int
+scanner (unsigned char *start, unsigned char *end, int search_device)
+{
+	struct scandata s;
+	int i;
+
+	memset (&s, 0, sizeof s);
+	s.start = start;
+	s.end = end;
+	s.breakfind = search_device;
+	if (scan (&s))
+		return -1;
+	/* the first pass has checked the whole table so the second
+	 * pass never fails after it has started to modify the table */
+	if (s.breakfind) {
+		s.breakfind = 0;
+		if (scan (&s))
+			error ("scan");
+	}
+	set_system_state (start, s.system_state, s.system_state_name);
+	for (i = s.nbreak; i > 0; i--) {
+		printf ("Disable ");
+		printname (s.breaks[i - 1].name, s.breaks[i - 1].namelen);
+		printf ("\n");
+	}
+	return 0;
+}
+
+static int
+fullparser (unsigned char *start, unsigned char *end, bool print_progress,
+	    int search_device)
+{
+	struct parsedata d;
+	struct parsedatalist *q;
+	int i, j, r;
+
+	r = -1;
 	d.breakhead = NULL;
 	d.progress = print_progress ? ((end - start) + 25) / 50 : 0;
 	d.progresschar = 'o';
@@ -2594,28 +3076,29 @@ parser (unsigned char *start, unsigned char *end, bool print_progress)
 		printf ("%c\n", d.progresschar);
 	if (!q)
 		goto error;
-#ifdef DISABLE_SLEEP
-	if (q->system_state_name[2] && *q->system_state_name[2] == '_') {
-		replace_byte (&d, q->system_state_name[2], 'D');
-		printf ("Disable ACPI S2\n");
-	}
-	if (q->system_state_name[3] && *q->system_state_name[3] == '_') {
-		replace_byte (&d, q->system_state_name[3], 'D');
-		printf ("Disable ACPI S3\n");
-	}
-#endif
-	for (i = 0; i < 6; i++) {
-		if (!q->system_state[i][0])
-			continue;
-		for (j = 0; j < 5; j++)
-			acpi_dsdt_system_state[i][j] = q->system_state[i][j];
-	}
+	set_system_state (start, q->system_state, q->system_state_name);
 	parsefreepathlist (&q->pathhead);
 	parsefreebuflist (&q->bufhead);
 	parsefreelimitlist (&q->limithead);
 	parsefree (q);
+	r = 0;
 error:
 	parsefreebreaklist (&d.breakhead);
+	return r;
+}
+
+static void
+parser (unsigned char *start, unsigned char *end, bool print_progress)
+{
+	int search_device;
+
+	search_device = 0;
+#ifdef TTY_SERIAL
+	search_device = 1;
+#endif
+	if (!scanner (start, end, search_device))
+		return;
+	fullparser (start, end, print_progress, search_device);
 }
 
 void
@@ -790,6 +790,18 @@ asm_pause (void)
 	asm volatile ("pause" : : : "memory");
 }
 
+static inline void
+asm_monitor (volatile void *addr, u32 ecx, u32 edx)
+{
+	asm volatile ("monitor" : : "a" (addr), "c" (ecx), "d" (edx));
+}
+
+static inline void
+asm_mwait (u32 eax, u32 ecx)
+{
+	asm volatile ("mwait" : : "a" (eax), "c" (ecx) : "memory");
+}
+
 static inline void
 asm_rdrsp (ulong *rsp)
 {
@@ -806,6 +818,28 @@ asm_rdtsc (u32 *a, u32 *d)
 	asm volatile ("rdtsc" : "=a" (*a), "=d" (*d));
 }
 
+/* returns true if a random number was available (CF=1) */
+static inline bool
+asm_rdrand (ulong *value)
+{
+	u8 ok;
+
+	asm volatile ("rdrand %0 ; setc %1" : "=r" (*value), "=qm" (ok)
+		      : : "cc");
+	return !!ok;
+}
+
+/* returns true if a random seed was available (CF=1) */
+static inline bool
+asm_rdseed (ulong *value)
+{
+	u8 ok;
+
+	asm volatile ("rdseed %0 ; setc %1" : "=r" (*value), "=qm" (ok)
+		      : : "cc");
+	return !!ok;
+}
+
 static inline void
 asm_mul_and_div (u32 mul1, u32 mul2, u32 div1, u32 *quotient, u32 *remainder)
 {
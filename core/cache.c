@@ -986,6 +986,25 @@ make_pat_value (void)
 	}
 }
 
+/* Return PTE attributes selecting write-combining in the host PAT,
+ * or UC- if the processor does not support it. */
+u32
+cache_get_wc_attr (void)
+{
+	u8 pat_index;
+	u32 attr;
+
+	if (!currentcpu->cache.pat)
+		return PTE_PCD_BIT;
+	pat_index = currentcpu->cache.pat_index_from_type[CACHE_TYPE_WC];
+	if (currentcpu->cache.h.pat_data[pat_index] != CACHE_TYPE_WC)
+		return PTE_PCD_BIT;
+	attr  = (pat_index & 4) ? PTE_PAT_BIT : 0;
+	attr |= (pat_index & 2) ? PTE_PCD_BIT : 0;
+	attr |= (pat_index & 1) ? PTE_PWT_BIT : 0;
+	return attr;
+}
+
 static asmlinkage void
 read_syscfg (void *arg)
 {
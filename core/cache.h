@@ -63,6 +63,7 @@ void update_mtrr_and_pat (void);
 bool cache_get_gpat (u64 *pat);
 bool cache_set_gpat (u64 pat);
 u32 cache_get_attr (u64 gphys, u32 gattr);
+u32 cache_get_wc_attr (void);
 u8 cache_get_gmtrr_type (u64 gphys);
 u32 cache_get_gmtrr_attr (u64 gphys);
 u64 cache_get_gmtrrcap (void);
@@ -42,7 +42,11 @@
 #include "uefi.h"
 #include "vmmcall_boot.h"
 
+#define CALLREALMODE_BATCH_MAX	8
+#define READLBA_MAX_BLOCKS	127 /* limit of some BIOSes */
+
 static struct vcpu *callrealmode_vcpu;
+static bool callrealmode_vcpu_copied;
 
 u32
 callrealmode_endofcodeaddr (void)
@@ -54,11 +58,13 @@ static void
 callrealmode_clearvcpu (void)
 {
 	callrealmode_vcpu = NULL;
+	callrealmode_vcpu_copied = false;
 }
 
 static void
 callrealmode_init_global (void)
 {
+	ASSERT (sizeof (struct callrealmode_data) == CALLREALMODE_DATA_SIZE);
 	callrealmode_clearvcpu ();
 }
 
@@ -72,6 +78,7 @@ void
 callrealmode_usevcpu (struct vcpu *p)
 {
 	callrealmode_vcpu = p;
+	callrealmode_vcpu_copied = false;
 }
 
 static void
@@ -81,8 +88,9 @@ callrealmode_copy (void)
 		callrealmode_end - callrealmode_start);
 }
 
+/* d[0] to d[n - 1] are processed in one mode switch */
 static void
-callrealmode_call_vcpu (struct vcpu *c, struct callrealmode_data *d)
+callrealmode_call_vcpu (struct vcpu *c, struct callrealmode_data *d, int n)
 {
 	ulong sp16, ip;
 	void *p;
@@ -90,17 +98,22 @@ callrealmode_call_vcpu (struct vcpu *c, struct callrealmode_data *d)
 
 	ASSERT (c && c->vcpu0 == current->vcpu0);
 
-	/* copy code */
-	size = callrealmode_end - callrealmode_start;
-	p = mapmem_hphys (CALLREALMODE_OFFSET, size, MAPMEM_WRITE);
-	memcpy (p, callrealmode_start, size);
-	unmapmem (p, size);
+	/* copy code once; the area is not used by anything else
+	 * while the vcpu is used for real mode calls */
+	if (!callrealmode_vcpu_copied) {
+		size = callrealmode_end - callrealmode_start;
+		p = mapmem_hphys (CALLREALMODE_OFFSET, size, MAPMEM_WRITE);
+		memcpy (p, callrealmode_start, size);
+		unmapmem (p, size);
+		callrealmode_vcpu_copied = true;
+	}
 	ip = CALLREALMODE_OFFSET + (callrealmode_start2 - callrealmode_start);
 
 	/* copy stack */
-	sp16 = CALLREALMODE_OFFSET - sizeof *d;
-	p = mapmem_hphys (sp16, sizeof *d, MAPMEM_WRITE);
-	memcpy (p, d, sizeof *d);
+	size = sizeof *d * n;
+	sp16 = CALLREALMODE_OFFSET - size;
+	p = mapmem_hphys (sp16, size, MAPMEM_WRITE);
+	memcpy (p, d, size);
 	unmapmem (p, size);
 
 	/* set registers */
@@ -108,6 +121,7 @@ callrealmode_call_vcpu (struct vcpu *c, struct callrealmode_data *d)
 	c->vmctl.write_general_reg (GENERAL_REG_RAX, 0);
 	if (currentcpu->fullvirtualize == FULLVIRTUALIZE_VT)
 		c->vmctl.write_general_reg (GENERAL_REG_RAX, 1);
+	c->vmctl.write_general_reg (GENERAL_REG_RCX, n);
 	c->vmctl.write_general_reg (GENERAL_REG_RSP, sp16);
 	c->vmctl.write_ip (ip);
 	c->vmctl.write_flags (RFLAGS_ALWAYS1_BIT);
@@ -117,14 +131,14 @@ callrealmode_call_vcpu (struct vcpu *c, struct callrealmode_data *d)
 	vmmcall_boot_continue ();
 
 	/* copy stack */
-	p = mapmem_hphys (sp16, sizeof *d, 0);
-	memcpy (d, p, sizeof *d);
+	p = mapmem_hphys (sp16, size, 0);
+	memcpy (d, p, size);
 	unmapmem (p, size);
 }
 
 /* interrupts must be disabled */
 static void
-callrealmode_call_directly (struct callrealmode_data *d)
+callrealmode_call_directly (struct callrealmode_data *d, int n)
 {
 	ulong sp16;
 	u32 sp32;
@@ -136,8 +150,8 @@ callrealmode_call_directly (struct callrealmode_data *d)
 	asm_rdcr3 (&cr3);
 	asm_wrcr3 (vmm_base_cr3);
 	callrealmode_copy ();
-	sp16 = CALLREALMODE_OFFSET - sizeof *d;
-	memcpy ((u8 *)sp16, d, sizeof *d);
+	sp16 = CALLREALMODE_OFFSET - sizeof *d * n;
+	memcpy ((u8 *)sp16, d, sizeof *d * n);
 	asm_rdidtr (&idtr_base, &idtr_limit);
 	asm_wridtr (0, 0x3FF);
 	asm volatile (
@@ -210,6 +224,7 @@ callrealmode_call_directly (struct callrealmode_data *d)
 		, "S" ((u32)SEG_SEL_PCPU32)
 		, "i" (SEG_SEL_CODE32)
 		, "i" (SEG_SEL_CODE64)
+		, "D" ((u32)n)
 		: "cc", "memory");
 #ifdef __x86_64__
 	asm_wrds (SEG_SEL_DATA64);
@@ -219,21 +234,28 @@ callrealmode_call_directly (struct callrealmode_data *d)
 	asm_wrss (SEG_SEL_DATA64);
 #endif
 	asm_wridtr (idtr_base, idtr_limit);
-	memcpy (d, (u8 *)sp16, sizeof *d);
+	memcpy (d, (u8 *)sp16, sizeof *d * n);
 	asm_wrcr3 (cr3);
 	savemsr_load (&msr);
 }
 
 static void
-callrealmode_call (struct callrealmode_data *d)
+callrealmode_call_batch (struct callrealmode_data *d, int n)
 {
+	ASSERT (n > 0 && n <= CALLREALMODE_BATCH_MAX);
 	if (uefi_booted)
 		panic ("callrealmode_call is not allowed on UEFI systems:"
 		       " d->func=%d", d->func);
 	if (callrealmode_vcpu)
-		callrealmode_call_vcpu (callrealmode_vcpu, d);
+		callrealmode_call_vcpu (callrealmode_vcpu, d, n);
 	else
-		callrealmode_call_directly (d);
+		callrealmode_call_directly (d, n);
+}
+
+static void
+callrealmode_call (struct callrealmode_data *d)
+{
+	callrealmode_call_batch (d, 1);
 }
 
 void
@@ -316,24 +338,69 @@ callrealmode_disk_readmbr (u8 drive, u32 buf_phys)
 	return d.u.disk_readmbr.status;
 }
 
+static void
+callrealmode_set_readlba (struct callrealmode_data *d, u8 drive, u32 buf_phys,
+			  u64 lba, u16 num_of_blocks)
+{
+	u32 segoff;
+
+	segoff = (buf_phys & 0xF) | ((buf_phys >> 4) << 16);
+	d->func = CALLREALMODE_FUNC_DISK_READLBA;
+	d->u.disk_readlba.drive = drive;
+	d->u.disk_readlba.buffer_addr = segoff;
+	d->u.disk_readlba.lba = lba;
+	d->u.disk_readlba.num_of_blocks = num_of_blocks;
+}
+
 unsigned int
 callrealmode_disk_readlba (u8 drive, u32 buf_phys, u64 lba, u16 num_of_blocks)
 {
 	struct callrealmode_data d;
-	u32 segoff;
 
 	if (buf_phys >= 0x100000)
 		return 0x100;	/* address error */
-	segoff = (buf_phys & 0xF) | ((buf_phys >> 4) << 16);
-	d.func = CALLREALMODE_FUNC_DISK_READLBA;
-	d.u.disk_readlba.drive = drive;
-	d.u.disk_readlba.buffer_addr = segoff;
-	d.u.disk_readlba.lba = lba;
-	d.u.disk_readlba.num_of_blocks = num_of_blocks;
+	callrealmode_set_readlba (&d, drive, buf_phys, lba, num_of_blocks);
 	callrealmode_call (&d);
 	return d.u.disk_readlba.status;
 }
 
+/* read a large area which may span more than one 64KiB segment.  the
+ * request is split into pieces that fit in a segment and up to
+ * CALLREALMODE_BATCH_MAX pieces are read in one mode switch. */
+unsigned int
+callrealmode_disk_readlba_blocks (u8 drive, u32 buf_phys, u64 lba,
+				  u32 num_of_blocks, u32 block_size)
+{
+	struct callrealmode_data d[CALLREALMODE_BATCH_MAX];
+	u32 n, max;
+	int i, j;
+
+	if (!block_size || block_size > 0xFFF0)
+		return 0x100;
+	if (buf_phys >= 0x100000 ||
+	    num_of_blocks > (0x100000 - buf_phys) / block_size)
+		return 0x100;	/* address error */
+	max = 0xFFF0 / block_size;
+	if (max > READLBA_MAX_BLOCKS)
+		max = READLBA_MAX_BLOCKS;
+	while (num_of_blocks > 0) {
+		for (i = 0; i < CALLREALMODE_BATCH_MAX && num_of_blocks > 0;
+		     i++) {
+			n = num_of_blocks > max ? max : num_of_blocks;
+			callrealmode_set_readlba (&d[i], drive, buf_phys, lba,
+						  n);
+			buf_phys += n * block_size;
+			lba += n;
+			num_of_blocks -= n;
+		}
+		callrealmode_call_batch (d, i);
+		for (j = 0; j < i; j++)
+			if (d[j].u.disk_readlba.status)
+				return d[j].u.disk_readlba.status;
+	}
+	return 0;
+}
+
 bool
 callrealmode_bootcd_getstatus (u8 drive,
 			       struct bootcd_specification_packet *data)
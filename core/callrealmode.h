@@ -86,6 +86,9 @@ void callrealmode_reboot (void);
 unsigned int callrealmode_disk_readmbr (u8 drive, u32 buf_phys);
 unsigned int callrealmode_disk_readlba (u8 drive, u32 buf_phys, u64 lba,
 					u16 num_of_blocks);
+unsigned int callrealmode_disk_readlba_blocks (u8 drive, u32 buf_phys,
+					       u64 lba, u32 num_of_blocks,
+					       u32 block_size);
 bool callrealmode_bootcd_getstatus (u8 drive,
 				    struct bootcd_specification_packet *data);
 void callrealmode_setcursorpos (u8 page_num, u8 row, u8 column);
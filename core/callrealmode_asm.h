@@ -34,6 +34,7 @@
 #include "types.h"
 
 #define CALLREALMODE_OFFSET 0x5000
+#define CALLREALMODE_DATA_SIZE 0x40
 extern char callrealmode_start[], callrealmode_end[], callrealmode_start2[];
 
 enum callrealmode_func {
@@ -28,6 +28,7 @@
  */
 
 	CALLREALMODE_OFFSET = 0x5000
+	CALLREALMODE_DATA_SIZE = 0x40
 	CALLREALMODE_FUNC_PRINTMSG = 0x0
 	CALLREALMODE_FUNC_GETSYSMEMMAP = 0x1
 	CALLREALMODE_FUNC_GETSHIFTFLAGS = 0x2
@@ -71,7 +72,14 @@ callrealmode_start:
 	sub	$0x1C,%sp
 
 	call	paging_and_protection_off
+	push	%bp
+	pushl	OFF_EDI(%bp)	# Number of requests
+1:
 	call	callrealmode_switch
+	call	callrealmode_next
+	jne	1b
+	pop	%eax
+	pop	%bp
 	call	protection_and_paging_on
 
 	mov	%bp,%sp
@@ -82,7 +90,12 @@ callrealmode_start2:
 	sub	$0x2C,%sp
 	mov	%sp,%bp
 	push	%eax
+	push	%ecx		# Number of requests
+1:
 	call	callrealmode_switch
+	call	callrealmode_next
+	jne	1b
+	pop	%ecx
 	cli
 	mov	%cr0,%eax
 	lgdtw	%cs:(start2_gdtr-callrealmode_start+CALLREALMODE_OFFSET)
@@ -449,6 +462,16 @@ getfontinfo:
 
 # Subroutines
 #
+callrealmode_next:
+	# Restore segment registers and move %bp to the next request.
+	# ZF is set if no more requests exist.
+	xor	%ax,%ax
+	mov	%ax,%ds
+	mov	%ax,%es
+	add	$CALLREALMODE_DATA_SIZE,%bp
+	mov	%sp,%si
+	decl	2(%si)
+	ret
 paging_and_protection_off:
 	cli
 	mov	%cr0,%eax
@@ -33,9 +33,13 @@
 #define CPUID_1				0x1
 #define CPUID_1_EBX_NUMOFLP_MASK	0x00FF0000
 #define CPUID_1_EBX_NUMOFLP_1		0x00010000
+#define CPUID_1_EBX_APICID_MASK		0xFF000000
+#define CPUID_1_EBX_APICID_SHIFT	24
+#define CPUID_1_ECX_MONITOR_BIT		0x8
 #define CPUID_1_ECX_VMX_BIT		0x20
 #define CPUID_1_ECX_PCID_BIT		0x20000
 #define CPUID_1_ECX_X2APIC_BIT		0x200000
+#define CPUID_1_ECX_RDRAND_BIT		0x40000000
 #define CPUID_1_EDX_PSE_BIT		0x8
 #define CPUID_1_EDX_TSC_BIT		0x10
 #define CPUID_1_EDX_MSR_BIT		0x20
@@ -46,6 +50,8 @@
 #define CPUID_1_EDX_PAT_BIT		0x10000
 #define CPUID_4_EAX_NUMOFTHREADS_MASK	0x03FFC000
 #define CPUID_4_EAX_NUMOFCORES_MASK	0xFC000000
+#define CPUID_7				0x7
+#define CPUID_7_EBX_RDSEED_BIT		0x40000
 #define CPUID_EXT_0			0x80000000
 #define CPUID_EXT_1			0x80000001
 #define CPUID_EXT_1_ECX_SVM_BIT		0x4
@@ -131,6 +137,7 @@
 #define MSR_IA32_VMX_EPT_VPID_CAP_PAGEWALK_LENGTH_4_BIT	0x40
 #define MSR_IA32_VMX_EPT_VPID_CAP_EPTSTRUCT_WB_BIT	0x4000
 #define MSR_IA32_VMX_EPT_VPID_CAP_INVEPT_BIT	0x100000
+#define MSR_IA32_VMX_EPT_VPID_CAP_EPT_AD_BIT	0x200000
 #define MSR_IA32_VMX_EPT_VPID_CAP_INVEPT_ALL_CONTEXT_BIT	0x4000000
 #define MSR_IA32_VMX_EPT_VPID_CAP_INVVPID_BIT	0x100000000ULL
 #define MSR_IA32_VMX_EPT_VPID_CAP_INVVPID_SINGLE_CONTEXT_BIT 0x20000000000ULL
@@ -177,6 +184,7 @@
 #define VMCS_GUEST_GS_SEL		0x80A
 #define VMCS_GUEST_LDTR_SEL		0x80C
 #define VMCS_GUEST_TR_SEL		0x80E
+#define VMCS_GUEST_PML_INDEX		0x812
 
 /* 16-Bit Host-State Fields */
 #define VMCS_HOST_ES_SEL		0xC00
@@ -202,6 +210,8 @@
 #define VMCS_VMENTRY_MSRLOAD_ADDR_HIGH	0x200B
 #define VMCS_EXEC_VMCS_POINTER		0x200C
 #define VMCS_EXEC_VMCS_POINTER_HIGH	0x200D
+#define VMCS_PML_ADDR			0x200E
+#define VMCS_PML_ADDR_HIGH		0x200F
 #define VMCS_TSC_OFFSET			0x2010
 #define VMCS_TSC_OFFSET_HIGH		0x2011
 #define VMCS_VIRT_APIC_PAGE_ADDR	0x2012
@@ -372,6 +382,7 @@
 #define VMCS_PROC_BASED_VMEXEC_CTL_PAUSEEXIT_BIT	0x40000000
 #define VMCS_PROC_BASED_VMEXEC_CTL_ACTIVATECTLS2_BIT	0x80000000
 #define VMCS_VMEXIT_CTL_HOST_ADDRESS_SPACE_SIZE_BIT 0x200
+#define VMCS_VMEXIT_CTL_ACK_INTR_ON_EXIT_BIT	0x8000
 #define VMCS_VMEXIT_CTL_SAVE_IA32_PAT_BIT	0x40000
 #define VMCS_VMEXIT_CTL_LOAD_IA32_PAT_BIT	0x80000
 #define VMCS_VMEXIT_CTL_SAVE_IA32_EFER_BIT	0x100000
@@ -383,6 +394,7 @@
 #define VMCS_PROC_BASED_VMEXEC_CTL2_ENABLE_RDTSCP_BIT	0x8
 #define VMCS_PROC_BASED_VMEXEC_CTL2_ENABLE_VPID_BIT	0x20
 #define VMCS_PROC_BASED_VMEXEC_CTL2_UNRESTRICTED_GUEST_BIT	0x80
+#define VMCS_PROC_BASED_VMEXEC_CTL2_ENABLE_PML_BIT	0x20000
 #define VMCS_PROC_BASED_VMEXEC_CTL2_ENABLE_XSAVES_BIT	0x100000
 #define VMCS_GUEST_ACTIVITY_STATE_ACTIVE	0x0
 #define VMCS_GUEST_ACTIVITY_STATE_HLT		0x1
@@ -390,6 +402,7 @@
 #define VMCS_GUEST_ACTIVITY_STATE_WAIT_FOR_SIPI	0x3
 #define VMCS_EPT_POINTER_EPT_WB		0x6
 #define VMCS_EPT_PAGEWALK_LENGTH_4	0x18
+#define VMCS_EPT_POINTER_AD_BIT		0x40
 
 #define VMXON_REGION_SIZE		0x1000
 #define VMCS_REGION_SIZE		0x1000
@@ -465,6 +478,7 @@
 #define EXIT_REASON_RDRAND		0x39
 #define EXIT_REASON_INVPCID		0x3A
 #define EXIT_REASON_VMFUNC		0x3B
+#define EXIT_REASON_PML_FULL		0x3E
 
 #define VMEXIT_CR0_READ			0x0
 #define VMEXIT_CR1_READ			0x1
@@ -32,10 +32,26 @@
 #include "cpu_mmu.h"
 #include "current.h"
 #include "gmm_access.h"
+#include "initfunc.h"
 #include "mm.h"
 #include "panic.h"
 #include "printf.h"
 #include "string.h"
+#include "vcpu.h"
+#include "vmmcall_status.h"
+
+#define TLB_MODE_PG	0x1
+#define TLB_MODE_WP	0x2
+#define TLB_MODE_PSE	0x4
+#define TLB_MODE_PAE	0x8
+#define TLB_MODE_LME	0x10
+#define TLB_MODE_NXE	0x20
+#define TLB_MODE_KEY	0x3F
+#define TLB_MODE_WRITE	0x40
+#define TLB_MODE_USER	0x80
+#define TLB_MODE_EXEC	0x100
+#define TLB_MODE_ACCESS	0x1C0
+#define TLB_MODE_LARGE	0x200
 
 struct get_pte_data {
 	unsigned int pg : 1;	/* PG (Paging): CR0 bit 31 */
@@ -256,6 +272,65 @@ cpu_mmu_get_pte (ulong virt, ulong cr0, ulong cr3, ulong cr4, u64 efer,
 	return get_pte_sub (virt, cr3, d, entries, plevels);
 }
 
+void
+cpu_mmu_tlb_flush (void)
+{
+	struct cpu_mmu_tlb *tlb = &current->tlb;
+
+	STATUS_UPDATE (tlb->stat_flush++);
+	if (!++tlb->gen)
+		memset (tlb->entry, 0, sizeof tlb->entry);
+}
+
+/* INVLPG invalidates every translation containing the address,
+ * including large pages which are cached per 4KiB page here. */
+void
+cpu_mmu_tlb_invalidate (ulong linear)
+{
+	struct cpu_mmu_tlb *tlb = &current->tlb;
+	struct cpu_mmu_tlb_entry *e;
+	int i;
+
+	STATUS_UPDATE (tlb->stat_invlpg++);
+	linear &= ~PAGESIZE_MASK;
+	for (i = 0; i < CPU_MMU_TLB_ENTRIES; i++) {
+		e = &tlb->entry[i];
+		if (e->linear == linear || (e->mode & TLB_MODE_LARGE))
+			e->mode = 0;
+	}
+}
+
+static struct cpu_mmu_tlb_entry *
+tlb_entry (ulong linear)
+{
+	return &current->tlb.entry[(linear >> PAGESIZE_SHIFT) %
+				   CPU_MMU_TLB_ENTRIES];
+}
+
+static u32
+tlb_mode (ulong cr0, ulong cr4, u64 efer, bool wr, bool us, bool ex)
+{
+	u32 mode = TLB_MODE_PG;
+
+	if (cr0 & CR0_WP_BIT)
+		mode |= TLB_MODE_WP;
+	if (cr4 & CR4_PSE_BIT)
+		mode |= TLB_MODE_PSE;
+	if (cr4 & CR4_PAE_BIT)
+		mode |= TLB_MODE_PAE;
+	if (efer & MSR_IA32_EFER_LME_BIT)
+		mode |= TLB_MODE_LME;
+	if (efer & MSR_IA32_EFER_NXE_BIT)
+		mode |= TLB_MODE_NXE;
+	if (wr)
+		mode |= TLB_MODE_WRITE;
+	if (us)
+		mode |= TLB_MODE_USER;
+	if (ex)
+		mode |= TLB_MODE_EXEC;
+	return mode;
+}
+
 static enum vmmerr
 get_pte (ulong virt, bool wr, bool us, bool ex, u64 *pte)
 {
@@ -264,15 +339,45 @@ get_pte (ulong virt, bool wr, bool us, bool ex, u64 *pte)
 	u64 entries[5];
 	u64 efer;
 	ulong cr0, cr3, cr4;
+	u32 mode;
+	struct cpu_mmu_tlb_entry *e;
 
 	current->vmctl.read_control_reg (CONTROL_REG_CR0, &cr0);
 	current->vmctl.read_control_reg (CONTROL_REG_CR3, &cr3);
 	current->vmctl.read_control_reg (CONTROL_REG_CR4, &cr4);
 	current->vmctl.read_msr (MSR_IA32_EFER, &efer);
+	mode = tlb_mode (cr0, cr4, efer, wr, us, ex);
+	e = tlb_entry (virt);
+	if (!(cr0 & CR0_PG_BIT))
+		goto walk;
+	/* A cached entry is usable if it was filled by a walk that
+	 * checked at least the requested access rights (and set the
+	 * D bit for writes) in the same paging mode. */
+	if (e->gen == current->tlb.gen && e->cr3 == cr3 &&
+	    e->linear == (virt & ~PAGESIZE_MASK) &&
+	    !((e->mode ^ mode) & TLB_MODE_KEY) &&
+	    !(mode & TLB_MODE_ACCESS & ~e->mode)) {
+		STATUS_UPDATE (current->tlb.stat_hit++);
+		*pte = e->pte;
+		return VMMERR_SUCCESS;
+	}
+	STATUS_UPDATE (current->tlb.stat_miss++);
+walk:
 	r = cpu_mmu_get_pte (virt, cr0, cr3, cr4, efer, wr, us, ex, entries,
 			     &levels);
-	if (r == VMMERR_SUCCESS)
-		*pte = entries[0];
+	if (r != VMMERR_SUCCESS)
+		return r;
+	*pte = entries[0];
+	if (!(cr0 & CR0_PG_BIT))
+		return r;
+	if ((entries[1] & PDE_PS_BIT) ||
+	    (levels == 4 && (entries[2] & PDE_PS_BIT)))
+		mode |= TLB_MODE_LARGE;
+	e->linear = virt & ~PAGESIZE_MASK;
+	e->cr3 = cr3;
+	e->pte = entries[0];
+	e->mode = mode;
+	e->gen = current->tlb.gen;
 	return r;
 }
 
@@ -461,3 +566,38 @@ write_linearaddr_tss (ulong linear, void *tss, uint len)
 	unmapmem (p, len);
 	return VMMERR_SUCCESS;
 }
+
+static bool
+cpu_mmu_status_sum (struct vcpu *p, void *q)
+{
+	u32 *sum = q;
+
+	sum[0] += p->tlb.stat_hit;
+	sum[1] += p->tlb.stat_miss;
+	sum[2] += p->tlb.stat_flush;
+	sum[3] += p->tlb.stat_invlpg;
+	return false;
+}
+
+static char *
+cpu_mmu_status (void)
+{
+	static char buf[1024];
+	u32 sum[4] = { 0, 0, 0, 0 };
+
+	vcpu_list_foreach (cpu_mmu_status_sum, sum);
+	snprintf (buf, 1024,
+		  "Emulator TLB:\n"
+		  " Hit: %u Miss: %u\n"
+		  " Flush: %u INVLPG: %u\n"
+		  , sum[0], sum[1], sum[2], sum[3]);
+	return buf;
+}
+
+static void
+cpu_mmu_init_global (void)
+{
+	register_status_callback (cpu_mmu_status);
+}
+
+INITFUNC ("global4", cpu_mmu_init_global);
@@ -33,6 +33,29 @@
 #include "types.h"
 #include "vmmerr.h"
 
+/* Software TLB for the instruction emulator.  Entries cache guest
+ * linear-to-physical translations keyed by linear page, CR3 and
+ * paging mode.  Like a real TLB, it relies on the guest invalidating
+ * translations by INVLPG or CR3 writes; while those are not
+ * intercepted (EPT/NPT), it is flushed on every VM exit. */
+#define CPU_MMU_TLB_ENTRIES	64
+
+struct cpu_mmu_tlb_entry {
+	ulong linear;
+	ulong cr3;
+	u64 pte;
+	u32 mode;
+	u32 gen;
+};
+
+struct cpu_mmu_tlb {
+	struct cpu_mmu_tlb_entry entry[CPU_MMU_TLB_ENTRIES];
+	u32 gen;
+	u32 stat_hit, stat_miss, stat_flush, stat_invlpg; /* per vcpu */
+};
+
+void cpu_mmu_tlb_flush (void);
+void cpu_mmu_tlb_invalidate (ulong linear);
 enum vmmerr cpu_mmu_get_pte (ulong virt, ulong cr0, ulong cr3, ulong cr4,
 			     u64 efer, bool write, bool user, bool exec,
 			     u64 entries[5], int *plevels);
@@ -34,6 +34,7 @@
 #include "i386-stub.h"
 #include "int.h"
 #include "mm.h"
+#include "msg.h"
 #include "panic.h"
 #include "printf.h"
 #include "process.h"
@@ -42,7 +43,7 @@
 #include "types.h"
 #include "vmmerr.h"
 
-static int memdump, memfree;
+static int memdump, memfree, msgnames;
 
 enum memdump_type {
 	MEMDUMP_GPHYS,
@@ -207,6 +208,14 @@ memfree_msghandler (int m, int c)
 	return 0;
 }
 
+static int
+msgnames_msghandler (int m, int c)
+{
+	if (m == 0)
+		msg_dump ();
+	return 0;
+}
+
 void
 debug_gdb (void)
 {
@@ -236,6 +245,7 @@ debug_msgregister (void)
 {
 	memdump = msgregister ("memdump", memdump_msghandler);
 	memfree = msgregister ("free", memfree_msghandler);
+	msgnames = msgregister ("msgnames", msgnames_msghandler);
 }
 
 void
@@ -243,4 +253,5 @@ debug_msgunregister (void)
 {
 	msgunregister (memdump);
 	msgunregister (memfree);
+	msgunregister (msgnames);
 }
@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2007, 2008 University of Tsukuba
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the University of Tsukuba nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* per-processor deferred work queues.  works are run in priority
+   order before VM entry; each priority level has a budget of works
+   per entry and the rest wait for the next entry.  when the virtual
+   CPU is about to halt, the queues are drained with a larger
+   budget.  a work scheduled on a processor which does not run
+   deferred_run(), e.g. during initialization, goes to a shared
+   queue which every running processor drains as well.  a work may run on two processors at the same time if it
+   is scheduled again while running, so work functions take their own
+   locks.  the statistics are not locked */
+
+#include "asm.h"
+#include "deferred.h"
+#include "initfunc.h"
+#include "mm.h"
+#include "panic.h"
+#include "pcpu.h"
+#include "printf.h"
+#include "spinlock.h"
+#include "string.h"
+#include "time.h"
+#include "vmmcall_status.h"
+
+#define DEFERRED_MAXWORKS	32
+#define DEFERRED_NAMELEN	24
+#define DEFERRED_IDLE_BUDGET	256
+
+struct deferred {
+	struct deferred *next;
+	char name[DEFERRED_NAMELEN];
+	enum deferred_prio prio;
+	deferred_func_t *func;
+	void *data;
+	u32 pending;
+	u64 queued;		/* time when scheduled */
+	u64 scheduled;
+	u64 coalesced;		/* scheduled while pending */
+	u64 runs;
+	u64 latency;		/* total time from schedule to run */
+	u64 max_latency;
+	u64 time;		/* total running time */
+	uint max_depth;
+};
+
+static const uint deferred_budget[DEFERRED_NPRIO] = { 32, 8, 2 };
+static u32 deferred_exhausted[DEFERRED_NPRIO];
+static struct deferred *deferred_works[DEFERRED_MAXWORKS];
+static int deferred_nworks;
+static spinlock_t deferred_lock;
+static struct deferred_pcpu_data deferred_shared;
+
+struct deferred *
+deferred_new (char *name, enum deferred_prio prio, deferred_func_t *func,
+	      void *data)
+{
+	struct deferred *w;
+
+	if (prio < 0 || prio >= DEFERRED_NPRIO)
+		panic ("deferred_new: %s: bad priority %d", name, prio);
+	w = alloc (sizeof *w);
+	memset (w, 0, sizeof *w);
+	snprintf (w->name, sizeof w->name, "%s", name);
+	w->prio = prio;
+	w->func = func;
+	w->data = data;
+	spinlock_lock (&deferred_lock);
+	if (deferred_nworks < DEFERRED_MAXWORKS)
+		deferred_works[deferred_nworks++] = w;
+	spinlock_unlock (&deferred_lock);
+	return w;
+}
+
+void
+deferred_schedule (struct deferred *w)
+{
+	struct deferred_pcpu_data *q;
+	u32 old = 0;
+
+	if (asm_lock_cmpxchgl (&w->pending, &old, 1)) {
+		w->coalesced++;
+		return;
+	}
+	q = &currentcpu->deferred;
+	if (!q->drains)
+		q = &deferred_shared;
+	spinlock_lock (&q->lock);
+	w->queued = get_cpu_time ();
+	w->next = NULL;
+	if (q->tail[w->prio])
+		q->tail[w->prio]->next = w;
+	else
+		q->head[w->prio] = w;
+	q->tail[w->prio] = w;
+	if (++q->depth[w->prio] > w->max_depth)
+		w->max_depth = q->depth[w->prio];
+	w->scheduled++;
+	spinlock_unlock (&q->lock);
+}
+
+static struct deferred *
+deferred_dequeue (struct deferred_pcpu_data *q, int prio)
+{
+	struct deferred *w;
+
+	spinlock_lock (&q->lock);
+	w = q->head[prio];
+	if (w) {
+		q->head[prio] = w->next;
+		if (!w->next)
+			q->tail[prio] = NULL;
+		q->depth[prio]--;
+	}
+	spinlock_unlock (&q->lock);
+	return w;
+}
+
+static void
+deferred_call (struct deferred *w)
+{
+	u64 start, latency;
+
+	start = get_cpu_time ();
+	latency = start - w->queued;
+	/* a schedule after this point queues the work again */
+	asm_lock_xchgl (&w->pending, 0);
+	w->func (w->data);
+	w->time += get_cpu_time () - start;
+	w->latency += latency;
+	if (w->max_latency < latency)
+		w->max_latency = latency;
+	w->runs++;
+}
+
+static void
+deferred_run_queue (struct deferred_pcpu_data *q, bool idle)
+{
+	struct deferred *w;
+	uint n, budget;
+	int prio;
+
+	for (prio = 0; prio < DEFERRED_NPRIO; prio++) {
+		budget = idle ? DEFERRED_IDLE_BUDGET : deferred_budget[prio];
+		for (n = 0; q->head[prio]; n++) {
+			if (n >= budget) {
+				asm_lock_incl (&deferred_exhausted[prio]);
+				break;
+			}
+			w = deferred_dequeue (q, prio);
+			if (!w)
+				break;
+			deferred_call (w);
+		}
+	}
+}
+
+/* called by the virtual CPU loop before VM entry.  idle is true if
+   the virtual CPU is going to halt */
+void
+deferred_run (bool idle)
+{
+	struct deferred_pcpu_data *q = &currentcpu->deferred;
+
+	q->drains = true;
+	deferred_run_queue (q, idle);
+	deferred_run_queue (&deferred_shared, idle);
+}
+
+static char *
+deferred_status (void)
+{
+	static char buf[2048];
+	static const char *prioname[DEFERRED_NPRIO] = {
+		"high", "normal", "low",
+	};
+	struct deferred *w;
+	int i, n, len;
+
+	len = snprintf (buf, sizeof buf,
+			"Deferred work (budget/exhausted):"
+			" high %u/%u normal %u/%u low %u/%u\n",
+			deferred_budget[DEFERRED_PRIO_HIGH],
+			deferred_exhausted[DEFERRED_PRIO_HIGH],
+			deferred_budget[DEFERRED_PRIO_NORMAL],
+			deferred_exhausted[DEFERRED_PRIO_NORMAL],
+			deferred_budget[DEFERRED_PRIO_LOW],
+			deferred_exhausted[DEFERRED_PRIO_LOW]);
+	n = deferred_nworks;
+	for (i = 0; i < n && len < sizeof buf; i++) {
+		w = deferred_works[i];
+		len += snprintf (buf + len, sizeof buf - len,
+				 " %-20s %-6s scheduled %llu coalesced %llu"
+				 " runs %llu latency %llu/%llu us"
+				 " time %llu us max_depth %u\n",
+				 w->name, prioname[w->prio], w->scheduled,
+				 w->coalesced, w->runs, w->latency,
+				 w->max_latency, w->time, w->max_depth);
+	}
+	return buf;
+}
+
+static void
+deferred_init_global (void)
+{
+	spinlock_init (&deferred_lock);
+	spinlock_init (&deferred_shared.lock);
+	register_status_callback (deferred_status);
+}
+
+static void
+deferred_init_pcpu (void)
+{
+	struct deferred_pcpu_data *q = &currentcpu->deferred;
+
+	memset (q, 0, sizeof *q);
+	spinlock_init (&q->lock);
+}
+
+INITFUNC ("global4", deferred_init_global);
+INITFUNC ("pcpu0", deferred_init_pcpu);
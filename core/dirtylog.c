@@ -0,0 +1,326 @@
+/*
+ * Copyright (c) 2007, 2008 University of Tsukuba
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the University of Tsukuba nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* guest memory dirty page tracking.  each vcpu picks up a new
+   epoch before its next VM entry; see vt_ept_dirtylog() */
+
+#include "asm.h"
+#include "callrealmode.h"
+#include "constants.h"
+#include "current.h"
+#include "dirtylog.h"
+#include "initfunc.h"
+#include "mm.h"
+#include "pcpu.h"
+#include "printf.h"
+#include "spinlock.h"
+#include "string.h"
+#include "vcpu.h"
+#include "vmmcall_status.h"
+
+static spinlock_t dirtylog_lock;
+static bool dirtylog_on;
+static u32 dirtylog_cur_epoch;
+static u64 dirtylog_pages;
+static u32 *dirtylog_bitmap[2];	/* indexed by epoch & 1 */
+static u32 stat_harvests;
+static u32 stat_marks[DIRTYLOG_SOURCE_NUM];
+static struct dirtylog_range {
+	u64 start, end;		/* pfn of RAM pages [start, end) */
+} *dirtylog_ranges;
+static int dirtylog_nranges;
+
+static bool
+dirtylog_setbit (u32 *bitmap, u64 pfn)
+{
+	u32 *p, bit, old;
+
+	p = &bitmap[pfn / 32];
+	bit = 1 << (pfn % 32);
+	old = *p;
+	do {
+		if (old & bit)
+			return false;
+	} while (asm_lock_cmpxchgl (p, &old, old | bit));
+	return true;
+}
+
+static bool
+dirtylog_clearbit (u32 *bitmap, u64 pfn)
+{
+	u32 *p, bit, old;
+
+	p = &bitmap[pfn / 32];
+	bit = 1 << (pfn % 32);
+	old = *p;
+	do {
+		if (!(old & bit))
+			return false;
+	} while (asm_lock_cmpxchgl (p, &old, old & ~bit));
+	return true;
+}
+
+/* the RAM ranges of the guest memory map, the pages that
+   dirtylog_mark_ram() sets at start.  the map does not change after
+   boot, so it is read once instead of for every page marked */
+static void
+dirtylog_load_ranges (void)
+{
+	u32 n, nn, type;
+	u64 base, len;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		dirtylog_nranges = 0;
+		n = 0;
+		for (nn = 1; nn; n = nn) {
+			nn = getfakesysmemmap (n, &base, &len, &type);
+			if (type != SYSMEMMAP_TYPE_AVAILABLE ||
+			    len < PAGESIZE)
+				continue;
+			if (dirtylog_ranges) {
+				dirtylog_ranges[dirtylog_nranges].start =
+					base >> PAGESIZE_SHIFT;
+				dirtylog_ranges[dirtylog_nranges].end =
+					(base + len) >> PAGESIZE_SHIFT;
+			}
+			dirtylog_nranges++;
+		}
+		if (!dirtylog_ranges)
+			dirtylog_ranges = alloc (dirtylog_nranges *
+						 sizeof *dirtylog_ranges);
+	}
+}
+
+u32
+dirtylog_epoch (void)
+{
+	return *(volatile u32 *)&dirtylog_cur_epoch;
+}
+
+bool
+dirtylog_tracking (void)
+{
+	return *(volatile bool *)&dirtylog_on;
+}
+
+void
+dirtylog_mark_epoch (u32 epoch, u64 gphys, enum dirtylog_source source)
+{
+	u64 pfn;
+
+	pfn = gphys >> PAGESIZE_SHIFT;
+	if (pfn >= dirtylog_pages)
+		return;
+	if (dirtylog_setbit (dirtylog_bitmap[epoch & 1], pfn))
+		asm_lock_incl (&stat_marks[source]);
+}
+
+/* called for writes to guest memory which do not go through EPT,
+   and for pages that a consumer failed to save */
+void
+dirtylog_mark (u64 gphys, uint len)
+{
+	struct dirtylog_range *r;
+	u64 start, end, pfn;
+	u32 epoch;
+	int i;
+
+	if (!dirtylog_tracking () || !len)
+		return;
+	epoch = dirtylog_epoch ();
+	start = gphys >> PAGESIZE_SHIFT;
+	end = ((gphys + len - 1) >> PAGESIZE_SHIFT) + 1;
+	for (i = 0; i < dirtylog_nranges; i++) {
+		r = &dirtylog_ranges[i];
+		for (pfn = start > r->start ? start : r->start;
+		     pfn < end && pfn < r->end; pfn++)
+			dirtylog_mark_epoch (epoch, pfn << PAGESIZE_SHIFT,
+					     DIRTYLOG_SOURCE_VMM);
+	}
+}
+
+static void
+dirtylog_mark_ram (u32 *bitmap)
+{
+	u64 pfn;
+	int i;
+
+	for (i = 0; i < dirtylog_nranges; i++)
+		for (pfn = dirtylog_ranges[i].start;
+		     pfn < dirtylog_ranges[i].end; pfn++)
+			dirtylog_setbit (bitmap, pfn);
+}
+
+static u64
+dirtylog_ram_pages (void)
+{
+	u64 pages;
+	int i;
+
+	pages = 0;
+	for (i = 0; i < dirtylog_nranges; i++)
+		if (pages < dirtylog_ranges[i].end)
+			pages = dirtylog_ranges[i].end;
+	return pages;
+}
+
+/* start tracking with every RAM page dirty so that the first
+   harvest returns the whole guest memory */
+bool
+dirtylog_start (void)
+{
+	uint size;
+
+	if (currentcpu->fullvirtualize != FULLVIRTUALIZE_VT ||
+	    !current->u.vt.ept)
+		return false;
+	spinlock_lock (&dirtylog_lock);
+	if (dirtylog_on)
+		goto out;
+	if (!dirtylog_bitmap[0]) {
+		dirtylog_load_ranges ();
+		dirtylog_pages = dirtylog_ram_pages ();
+		size = (dirtylog_pages + 31) / 32 * sizeof (u32);
+		dirtylog_bitmap[0] = alloc (size);
+		dirtylog_bitmap[1] = alloc (size);
+		memset (dirtylog_bitmap[0], 0, size);
+		memset (dirtylog_bitmap[1], 0, size);
+	}
+	dirtylog_cur_epoch++;
+	dirtylog_mark_ram (dirtylog_bitmap[dirtylog_cur_epoch & 1]);
+	dirtylog_on = true;
+out:
+	spinlock_unlock (&dirtylog_lock);
+	return true;
+}
+
+void
+dirtylog_stop (void)
+{
+	spinlock_lock (&dirtylog_lock);
+	if (dirtylog_on) {
+		dirtylog_on = false;
+		dirtylog_cur_epoch++;
+	}
+	spinlock_unlock (&dirtylog_lock);
+}
+
+u64
+dirtylog_npages (void)
+{
+	return dirtylog_pages;
+}
+
+/* bits left over from an unfinished scan of the previous harvest
+   stay set and are returned again by a later one */
+void
+dirtylog_harvest (void)
+{
+	spinlock_lock (&dirtylog_lock);
+	if (dirtylog_on) {
+		dirtylog_cur_epoch++;
+		stat_harvests++;
+	}
+	spinlock_unlock (&dirtylog_lock);
+}
+
+static bool
+dirtylog_harvested_sub (struct vcpu *p, void *q)
+{
+	bool *done = q;
+
+	if (p->dirtylog_epoch != dirtylog_epoch ()) {
+		*done = false;
+		return true;
+	}
+	return false;
+}
+
+bool
+dirtylog_harvested (void)
+{
+	bool done = true;
+
+	vcpu_list_foreach (dirtylog_harvested_sub, &done);
+	return done;
+}
+
+/* returns the first page at or after pfn dirtied in the harvested
+   epoch and clears it, or dirtylog_npages() if there is none */
+u64
+dirtylog_next (u64 pfn)
+{
+	u32 *p, w;
+
+	p = dirtylog_bitmap[(dirtylog_epoch () - 1) & 1];
+	while (pfn < dirtylog_pages) {
+		w = p[pfn / 32] >> (pfn % 32);
+		if (!w) {
+			pfn = (pfn | 31) + 1;
+			continue;
+		}
+		while (!(w & 1)) {
+			w >>= 1;
+			pfn++;
+		}
+		if (pfn >= dirtylog_pages)
+			break;
+		/* a late vcpu may still be setting bits in this word */
+		if (dirtylog_clearbit (p, pfn))
+			return pfn;
+		pfn++;
+	}
+	return dirtylog_pages;
+}
+
+static char *
+dirtylog_status (void)
+{
+	static char buf[256];
+
+	snprintf (buf, sizeof buf,
+		  "Dirty log:\n"
+		  " tracking %d epoch %u harvests %u pages %llu\n"
+		  " marked: write-protect %u PML %u VMM %u\n",
+		  dirtylog_on, dirtylog_cur_epoch, stat_harvests,
+		  dirtylog_pages, stat_marks[DIRTYLOG_SOURCE_WP],
+		  stat_marks[DIRTYLOG_SOURCE_PML],
+		  stat_marks[DIRTYLOG_SOURCE_VMM]);
+	return buf;
+}
+
+static void
+dirtylog_init (void)
+{
+	spinlock_init (&dirtylog_lock);
+	register_status_callback (dirtylog_status);
+}
+
+INITFUNC ("global4", dirtylog_init);
@@ -97,9 +97,46 @@ exint_pass_intr_free (int num)
 	exint_pass_intr_set (NULL, NULL, num);
 }
 
+/* An interrupt acknowledged on VM exit is no longer pending in the
+ * local APIC.  It is held here until the guest can accept it.  More
+ * than one vector can be held, e.g. when the guest switches between
+ * real mode and protected mode before accepting the first one. */
+void
+exint_pass_hold (int num)
+{
+	current->exint_acked_vec[num / 32] |= 1U << (num % 32);
+	current->exint_acked = true;
+}
+
+/* Returns the held vector of the highest priority, like the local
+ * APIC dispatches from IRR, or -1 if no vectors are held. */
+int
+exint_pass_take (void)
+{
+	u32 *vec = current->exint_acked_vec;
+	int i, j, k;
+
+	if (!current->exint_acked)
+		return -1;
+	for (i = 256 / 32 - 1; i > 0 && !vec[i]; i--);
+	for (j = 31; j > 0 && !(vec[i] & (1U << j)); j--);
+	vec[i] &= ~(1U << j);
+	current->exint_acked = false;
+	for (k = i; k >= 0; k--)
+		if (vec[k])
+			current->exint_acked = true;
+	return i * 32 + j;
+}
+
 static void
 exint_pass_int_enabled (void)
 {
+	if (current->exint_acked) {
+		/* wait for an interrupt window to inject it */
+		current->vmctl.exint_pending (true);
+		current->vmctl.exint_pass (true);
+		return;
+	}
 	current->vmctl.exint_pending (false);
 	current->vmctl.exint_pass (!!config.vmm.no_intr_intercept);
 }
@@ -124,10 +161,19 @@ do_exint_pass (void)
 
 	current->vmctl.read_flags (&rflags);
 	if (rflags & RFLAGS_IF_BIT) { /* if interrupts are enabled */
-		num = do_externalint_enable ();
-		num = exint_pass_intr_call (num);
+		num = exint_pass_take ();
+		if (num < 0) {
+			num = do_externalint_enable ();
+			num = exint_pass_intr_call (num);
+		}
 		if (num >= 0)
 			current->exint.exintfunc_default (num);
+		if (current->exint_acked) {
+			/* the rest after the injected one */
+			current->vmctl.exint_pending (true);
+			current->vmctl.exint_pass (true);
+			return;
+		}
 		current->vmctl.exint_pending (false);
 		current->vmctl.exint_pass (!!config.vmm.no_intr_intercept);
 	} else {
@@ -136,6 +182,19 @@ do_exint_pass (void)
 	}
 }
 
+/* The vector has been read from the VM exit information.  Interrupts
+ * for exint_pass_intr_alloc() are dispatched regardless of the guest
+ * RFLAGS.IF. */
+void
+do_exint_pass_acked (int num)
+{
+	num = exint_pass_intr_call (num);
+	if (num < 0)
+		return;
+	exint_pass_hold (num);
+	do_exint_pass ();
+}
+
 static void
 exint_pass_init (void)
 {
@@ -33,5 +33,8 @@
 #include <core/exint_pass.h>
 
 void do_exint_pass (void);
+void do_exint_pass_acked (int num);
+void exint_pass_hold (int num);
+int exint_pass_take (void);
 
 #endif
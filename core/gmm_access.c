@@ -32,6 +32,7 @@
 #include "cache.h"
 #include "constants.h"
 #include "current.h"
+#include "dirtylog.h"
 #include "gmm_access.h"
 #include "mm.h"
 #include "mmio.h"
@@ -59,6 +60,7 @@ write_gphys_b (u64 phys, u32 data, u32 attr)
 	attr = cache_get_attr (phys, attr);
 	mmio_lock ();
 	if (!mmio_access_memory (phys, true, &data, 1, attr)) {
+		dirtylog_mark (phys, 1);
 		phys = current->gmm.gp2hp (phys, &fakerom);
 		if (fakerom)
 			panic ("write_gphys_b modifying VMM memory.");
@@ -97,6 +99,7 @@ write_gphys_w (u64 phys, u32 data, u32 attr)
 	attr = cache_get_attr (phys, attr);
 	mmio_lock ();
 	if (!mmio_access_memory (phys, true, &data, 2, attr)) {
+		dirtylog_mark (phys, 1);
 		phys = current->gmm.gp2hp (phys, &fakerom);
 		if (fakerom)
 			panic ("write_gphys_w modifying VMM memory.");
@@ -135,6 +138,7 @@ write_gphys_l (u64 phys, u32 data, u32 attr)
 	attr = cache_get_attr (phys, attr);
 	mmio_lock ();
 	if (!mmio_access_memory (phys, true, &data, 4, attr)) {
+		dirtylog_mark (phys, 1);
 		phys = current->gmm.gp2hp (phys, &fakerom);
 		if (fakerom)
 			printf ("write_gphys_l modifying VMM memory.");
@@ -173,6 +177,7 @@ write_gphys_q (u64 phys, u64 data, u32 attr)
 	attr = cache_get_attr (phys, attr);
 	mmio_lock ();
 	if (!mmio_access_memory (phys, true, &data, 8, attr)) {
+		dirtylog_mark (phys, 1);
 		phys = current->gmm.gp2hp (phys, &fakerom);
 		if (fakerom)
 			panic ("write_gphys_q modifying VMM memory.");
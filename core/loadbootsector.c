@@ -122,7 +122,8 @@ try_cdboot (u8 bios_boot_drive, u32 tmpbufaddr, u32 tmpbufsize)
 	jmpoff = 0;
 	if (loadsize > tmpbufsize)
 		panic ("Bootable CD-ROM error: too large");
-	if (callrealmode_disk_readlba (bios_boot_drive, tmpbufaddr, lba, nsec))
+	if (callrealmode_disk_readlba_blocks (bios_boot_drive, tmpbufaddr, lba,
+					      nsec, 2048))
 		panic ("CD-ROM read error");
 	return true;
 }
@@ -42,6 +42,7 @@
 #include "main.h"
 #include "mm.h"
 #include "multiboot.h"
+#include "nicpoll.h"
 #include "osloader.h"
 #include "panic.h"
 #include "pcpu.h"
@@ -321,6 +322,8 @@ bsp_init_thread (void *args)
 		memcpy (p, bios_data_area, 0xA0000);
 		unmapmem (p, 0xA0000);
 		clear_guest_pages ();
+		/* the restore overwrote the real mode call code */
+		callrealmode_usevcpu (current);
 		call_initfunc ("config0");
 		load_drivers ();
 		call_initfunc ("config1");
@@ -377,6 +380,8 @@ create_pass_vm (void)
 		for (;;)
 			asm_cli_and_hlt ();
 #endif
+	if (!bsp && nicpoll_dedicated ())
+		nicpoll_main ();
 	current->vmctl.start_vm ();
 	panic ("VM stopped.");
 }
@@ -407,6 +412,8 @@ resume_vm (u32 wake_addr)
 		for (;;)
 			asm_cli_and_hlt ();
 #endif
+		if (nicpoll_dedicated ())
+			nicpoll_main ();
 	}
 	current->vmctl.start_vm ();
 	panic ("VM stopped.");
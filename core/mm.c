@@ -27,13 +27,16 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include "acpi.h"
 #include "asm.h"
 #include "assert.h"
+#include "cache.h"
 #include "callrealmode.h"
 #include "calluefi.h"
 #include "comphappy.h"
 #include "constants.h"
 #include "current.h"
+#include "dirtylog.h"
 #include "entry.h"
 #include "gmm_access.h"
 #include "initfunc.h"
@@ -47,6 +50,7 @@
 #include "spinlock.h"
 #include "string.h"
 #include "uefi.h"
+#include "vmmcall_status.h"
 
 #define VMMSIZE_ALL		(128 * 1024 * 1024)
 #define NUM_OF_PAGES		(VMMSIZE_ALL >> PAGESIZE_SHIFT)
@@ -61,6 +65,13 @@
 				 ALLOCLIST_DATASIZE(n) - 1)
 #define MAXNUM_OF_SYSMEMMAP	256
 #define NUM_OF_PANICMEM_PAGES	256
+#define VMMSIZE_NODE		(32 * 1024 * 1024)
+#define VMMSIZE_NODE_ALIGN	(4096 << (NUM_OF_ALLOCSIZE - 1))
+#ifdef __x86_64__
+#	define MM_MAX_NODES		8
+#else
+#	define MM_MAX_NODES		1
+#endif
 
 #ifdef __x86_64__
 #	define PDPE_ATTR		(PDE_P_BIT | PDE_RW_BIT | PDE_US_BIT)
@@ -86,11 +97,25 @@ struct page {
 	int allocsize;
 	phys_t phys;
 	virt_t virt;
+	int node;
 };
 
 struct allocdata {
 	LIST1_DEFINE (struct allocdata);
-	u8 n, data[1];
+	u8 n, node, data[1];
+};
+
+/* Node 0 is the VMM region.  Other nodes are reserved from memory
+   of the other proximity domains and accessed through the hphys
+   mapping. */
+struct mm_node {
+	LIST1_DEFINE_HEAD (struct page, freepage[NUM_OF_ALLOCSIZE]);
+	u32 pxm;
+	phys_t phys;
+	virt_t virt;
+	int npages, usedpages;
+	struct page *pages;
+	u64 e820_base, e820_fake_len, e820_end;
 };
 
 struct sysmemmapdata {
@@ -135,8 +160,10 @@ static u64 e820_vmm_base, e820_vmm_fake_len, e820_vmm_end;
 u32 __attribute__ ((section (".data"))) vmm_start_phys;
 static spinlock_t mm_lock, mm_lock2;
 static spinlock_t mm_lock_process_virt_to_phys;
-static LIST1_DEFINE_HEAD (struct page, list1_freepage[NUM_OF_ALLOCSIZE]);
-static LIST1_DEFINE_HEAD (struct allocdata, alloclist[NUM_OF_ALLOCLIST]);
+static struct mm_node mm_nodes[MM_MAX_NODES];
+static int mm_num_nodes = 1;
+static LIST1_DEFINE_HEAD (struct allocdata,
+			  alloclist[MM_MAX_NODES][NUM_OF_ALLOCLIST]);
 static int allocsize[NUM_OF_ALLOCSIZE];
 static struct page pagestruct[NUM_OF_PAGES];
 static spinlock_t mapmem_lock;
@@ -192,6 +219,8 @@ u32
 getfakesysmemmap (u32 n, u64 *base, u64 *len, u32 *type)
 {
 	u32 r;
+	int i;
+	struct mm_node *nd;
 
 	r = getsysmemmap (n, base, len, type);
 	if (*type == SYSMEMMAP_TYPE_AVAILABLE) {
@@ -201,6 +230,15 @@ getfakesysmemmap (u32 n, u64 *base, u64 *len, u32 *type)
 			*len = e820_vmm_fake_len;
 		if (*base > e820_vmm_base && *base < e820_vmm_end)
 			*type = SYSMEMMAP_TYPE_RESERVED;
+		for (i = 1; i < mm_num_nodes; i++) {
+			nd = &mm_nodes[i];
+			if (!nd->e820_end)
+				continue;
+			if (*base == nd->e820_base)
+				*len = nd->e820_fake_len;
+			if (*base > nd->e820_base && *base < nd->e820_end)
+				*type = SYSMEMMAP_TYPE_RESERVED;
+		}
 	}
 	return r;
 }
@@ -495,15 +533,33 @@ static struct page *
 virt_to_page (virt_t virt)
 {
 	unsigned int i;
+	int j;
+	struct mm_node *nd;
 
 	i = (virt - VMM_START_VIRT) >> PAGESIZE_SHIFT;
-	ASSERT (i < NUM_OF_PAGES);
-	return &pagestruct[i];
+	if (i < NUM_OF_PAGES)
+		return &pagestruct[i];
+	for (j = 1; j < mm_num_nodes; j++) {
+		nd = &mm_nodes[j];
+		i = (virt - nd->virt) >> PAGESIZE_SHIFT;
+		if (virt >= nd->virt && i < nd->npages)
+			return &nd->pages[i];
+	}
+	panic ("virt_to_page: 0x%lX is not VMM memory", (ulong)virt);
 }
 
 virt_t
 phys_to_virt (phys_t phys)
 {
+	int i;
+	struct mm_node *nd;
+
+	for (i = 1; i < mm_num_nodes; i++) {
+		nd = &mm_nodes[i];
+		if (phys >= nd->phys &&
+		    phys < nd->phys + ((phys_t)nd->npages << PAGESIZE_SHIFT))
+			return (virt_t)(phys - nd->phys + nd->virt);
+	}
 	return (virt_t)(phys - vmm_start_phys + VMM_START_VIRT);
 }
 
@@ -535,29 +591,106 @@ u32 vmm_term_inf()
         return vmm_start_phys+VMMSIZE_ALL ;
 }
 
+/* the memory range of the node pool, for the crash dump */
+bool
+mm_node_range (int node, phys_t *phys, virt_t *virt, ulong *size)
+{
+	struct mm_node *nd;
+
+	if (node < 0 || node >= mm_num_nodes)
+		return false;
+	if (!node) {
+		*phys = vmm_start_phys;
+		*virt = VMM_START_VIRT;
+		*size = VMMSIZE_ALL;
+		return true;
+	}
+	nd = &mm_nodes[node];
+	*phys = nd->phys;
+	*virt = nd->virt;
+	*size = (ulong)nd->npages << PAGESIZE_SHIFT;
+	return true;
+}
+
+/* the node of the current processor, or 0 before the processor
+   node is known */
+int
+mm_node_current (void)
+{
+	if (mm_num_nodes < 2 || !currentcpu_available ())
+		return 0;
+	return currentcpu->numa_node;
+}
+
+/* returns the node of the proximity domain, or MM_NODE_LOCAL if VMM
+   has no memory on the domain */
+static int
+mm_node_of_pxm (u32 pxm)
+{
+	int i;
+
+	for (i = 0; i < mm_num_nodes; i++)
+		if (mm_nodes[i].pxm == pxm)
+			return i;
+	return MM_NODE_LOCAL;
+}
+
+int
+mm_node_of_pci (u16 seg_group, u8 bus, u8 devfn)
+{
+	u32 pxm;
+
+	if (mm_num_nodes < 2 || !acpi_srat_pci (seg_group, bus, devfn, &pxm))
+		return MM_NODE_LOCAL;
+	return mm_node_of_pxm (pxm);
+}
+
+/* mm_lock must be locked */
 static struct page *
-mm_page_alloc (int n)
+mm_page_alloc_sub (struct mm_node *nd, int n)
 {
-	int s;
-	virt_t virt;
+	int i;
 	struct page *p, *q;
+
+	for (i = n; i < NUM_OF_ALLOCSIZE; i++)
+		if ((p = LIST1_POP (nd->freepage[i])) != NULL)
+			goto found;
+	return NULL;
+found:
+	while (i > n) {
+		i--;
+		q = virt_to_page (page_to_virt (p) ^ allocsize[i]);
+		p->allocsize = i;
+		q->allocsize = i;
+		q->type = PAGE_TYPE_FREE;
+		LIST1_ADD (nd->freepage[i], q);
+	}
+	return p;
+}
+
+/* allocate from the node, or from the other nodes if the node is
+   exhausted.  MM_NODE_LOCAL means the node of the current
+   processor. */
+static struct page *
+mm_page_alloc (int n, int node)
+{
+	int i;
+	struct page *p;
 	enum page_type old_type;
 
 	ASSERT (n < NUM_OF_ALLOCSIZE);
-	s = allocsize[n];
+	if (node < 0 || node >= mm_num_nodes)
+		node = mm_node_current ();
 	spinlock_lock (&mm_lock);
-	while ((p = LIST1_POP (list1_freepage[n])) == NULL) {
+	p = mm_page_alloc_sub (&mm_nodes[node], n);
+	for (i = 0; !p && i < mm_num_nodes; i++)
+		if (i != node)
+			p = mm_page_alloc_sub (&mm_nodes[i], n);
+	if (!p) {
 		spinlock_unlock (&mm_lock);
-		p = mm_page_alloc (n + 1);
-		spinlock_lock (&mm_lock);
-		virt = page_to_virt (p);
-		q = virt_to_page (virt ^ s);
-		p->allocsize = n;
-		p->type = PAGE_TYPE_FREE;
-		q->type = PAGE_TYPE_FREE;
-		LIST1_ADD (list1_freepage[n], p);
-		LIST1_ADD (list1_freepage[n], q);
+		panic ("mm_page_alloc (%d) failed.", n);
 	}
+	mm_nodes[p->node].usedpages += 1 << n;
 	/* p->type must be set before unlock, because the
 	 * mm_page_free() function may merge blocks if the type is
 	 * PAGE_TYPE_FREE. */
@@ -577,11 +710,14 @@ mm_page_free (struct page *p)
 	int s, n;
 	struct page *q, *tmp;
 	virt_t virt;
+	struct mm_node *nd;
 
 	spinlock_lock (&mm_lock);
+	nd = &mm_nodes[p->node];
 	n = p->allocsize;
+	nd->usedpages -= 1 << n;
 	p->type = PAGE_TYPE_FREE;
-	LIST1_ADD (list1_freepage[n], p);
+	LIST1_ADD (nd->freepage[n], p);
 	s = allocsize[n];
 	virt = page_to_virt (p);
 	while (n < (NUM_OF_ALLOCSIZE - 1) &&
@@ -592,11 +728,11 @@ mm_page_free (struct page *p)
 			p = q;
 			q = tmp;
 		}
-		LIST1_DEL (list1_freepage[n], p);
-		LIST1_DEL (list1_freepage[n], q);
+		LIST1_DEL (nd->freepage[n], p);
+		LIST1_DEL (nd->freepage[n], q);
 		q->type = PAGE_TYPE_NOT_HEAD;
 		n = ++p->allocsize;
-		LIST1_ADD (list1_freepage[n], p);
+		LIST1_ADD (nd->freepage[n], p);
 		s = allocsize[n];
 		virt = page_to_virt (p);
 	}
@@ -607,16 +743,18 @@ mm_page_free (struct page *p)
 int
 num_of_available_pages (void)
 {
-	int i, r, n;
+	int i, j, r, n;
 	struct page *p;
 
 	spinlock_lock (&mm_lock);
 	r = 0;
-	for (i = 0; i < NUM_OF_ALLOCSIZE; i++) {
-		n = 0;
-		LIST1_FOREACH (list1_freepage[i], p)
-			n++;
-		r += n * (allocsize[i] >> PAGESIZE_SHIFT);
+	for (j = 0; j < mm_num_nodes; j++) {
+		for (i = 0; i < NUM_OF_ALLOCSIZE; i++) {
+			n = 0;
+			LIST1_FOREACH (mm_nodes[j].freepage[i], p)
+				n++;
+			r += n * (allocsize[i] >> PAGESIZE_SHIFT);
+		}
 	}
 	spinlock_unlock (&mm_lock);
 	return r;
@@ -825,17 +963,24 @@ mm_init_global (void)
 			VMMSIZE_ALL >> 20);
 		move_vmm ();
 	}
-	for (i = 0; i < NUM_OF_ALLOCLIST; i++)
-		LIST1_HEAD_INIT (alloclist[i]);
+	for (i = 0; i < MM_MAX_NODES * NUM_OF_ALLOCLIST; i++)
+		LIST1_HEAD_INIT (alloclist[i / NUM_OF_ALLOCLIST]
+				 [i % NUM_OF_ALLOCLIST]);
 	for (i = 0; i < NUM_OF_ALLOCSIZE; i++) {
 		allocsize[i] = 4096 << i;
-		LIST1_HEAD_INIT (list1_freepage[i]);
+		LIST1_HEAD_INIT (mm_nodes[0].freepage[i]);
 	}
+	mm_nodes[0].phys = vmm_start_phys;
+	mm_nodes[0].virt = VMM_START_VIRT;
+	mm_nodes[0].npages = NUM_OF_PAGES;
+	mm_nodes[0].usedpages = NUM_OF_PAGES;
+	mm_nodes[0].pages = pagestruct;
 	for (i = 0; i < NUM_OF_PAGES; i++) {
 		pagestruct[i].type = PAGE_TYPE_RESERVED;
 		pagestruct[i].allocsize = 0;
 		pagestruct[i].phys = vmm_start_phys + PAGESIZE * i;
 		pagestruct[i].virt = VMM_START_VIRT + PAGESIZE * i;
+		pagestruct[i].node = 0;
 	}
 	panicmem_start_page = ((u64)(virt_t)end + PAGESIZE - 1 -
 			       VMM_START_VIRT) >> PAGESIZE_SHIFT;
@@ -881,9 +1026,165 @@ mm_free_panicmem (void)
 		mm_page_free (&pagestruct[s + i]);
 }
 
-/* allocate n or more pages */
+#ifdef __x86_64__
+/* reserve VMMSIZE_NODE bytes of the proximity domain.  The area is
+   hidden from the guest by the UEFI memory map, or by the e820 map
+   in the same way as the VMM region. */
+static bool
+mm_node_reserve (struct mm_node *nd, u32 pxm)
+{
+	u64 base, len, sbase, slen, start, end, phys;
+	u32 n, nn, type, spxm;
+	uint i;
+	int j;
+
+	for (i = 0; acpi_srat_memory (i, &sbase, &slen, &spxm); i++) {
+		if (spxm != pxm)
+			continue;
+		for (n = 0, nn = 1; nn; n = nn) {
+			nn = getsysmemmap (n, &base, &len, &type);
+			if (type != SYSMEMMAP_TYPE_AVAILABLE)
+				continue;
+			start = base > sbase ? base : sbase;
+			end = base + len < sbase + slen ? base + len :
+				sbase + slen;
+			if (end > hphys_len)
+				end = hphys_len;
+			if (end < start + VMMSIZE_NODE)
+				continue;
+			phys = (end - VMMSIZE_NODE) &
+				~(u64)(VMMSIZE_NODE_ALIGN - 1);
+			if (phys < start)
+				continue;
+			if (uefi_booted) {
+				if (call_uefi_allocate_pages
+				    (2 /* AllocateAddress */,
+				     8 /* EfiUnusableMemory */,
+				     VMMSIZE_NODE >> PAGESIZE_SHIFT, &phys))
+					continue;
+				goto found;
+			}
+			/* the rest of the entry is hidden too */
+			if (base + len > sbase + slen ||
+			    base == e820_vmm_base)
+				continue;
+			for (j = 1; j < mm_num_nodes; j++)
+				if (base == mm_nodes[j].e820_base)
+					break;
+			if (j < mm_num_nodes)
+				continue;
+			nd->e820_base = base;
+			nd->e820_fake_len = phys - base;
+			nd->e820_end = base + len;
+			goto found;
+		}
+	}
+	return false;
+found:
+	nd->phys = phys;
+	return true;
+}
+
+static void
+mm_node_add (u32 pxm)
+{
+	struct mm_node *nd;
+	int i, node;
+
+	node = mm_num_nodes;
+	nd = &mm_nodes[node];
+	if (!mm_node_reserve (nd, pxm)) {
+		printf ("NUMA: no VMM memory on domain %u\n", pxm);
+		return;
+	}
+	nd->pxm = pxm;
+	nd->virt = HPHYS_ADDR + nd->phys;
+	nd->npages = VMMSIZE_NODE >> PAGESIZE_SHIFT;
+	nd->usedpages = nd->npages;
+	nd->pages = alloc (sizeof *nd->pages * nd->npages);
+	for (i = 0; i < NUM_OF_ALLOCSIZE; i++)
+		LIST1_HEAD_INIT (nd->freepage[i]);
+	for (i = 0; i < nd->npages; i++) {
+		nd->pages[i].type = PAGE_TYPE_RESERVED;
+		nd->pages[i].allocsize = 0;
+		nd->pages[i].phys = nd->phys + PAGESIZE * i;
+		nd->pages[i].virt = nd->virt + PAGESIZE * i;
+		nd->pages[i].node = node;
+	}
+	/* virt_to_page() needs the node while merging blocks */
+	mm_num_nodes++;
+	for (i = 0; i < nd->npages; i++)
+		mm_page_free (&nd->pages[i]);
+	printf ("NUMA: domain %u: VMM will use 0x%llX-0x%llX (%d MiB).\n",
+		pxm, nd->phys, nd->phys + VMMSIZE_NODE, VMMSIZE_NODE >> 20);
+}
+#endif
+
+static char *
+mm_status (void)
+{
+	static char buf[1024];
+	struct mm_node *nd;
+	int i, n;
+
+	n = snprintf (buf, sizeof buf, "NUMA:\n");
+	for (i = 0; i < mm_num_nodes && n < sizeof buf; i++) {
+		nd = &mm_nodes[i];
+		n += snprintf (buf + n, sizeof buf - n,
+			       " node %d domain %u phys 0x%llX"
+			       " pages %d used %d\n",
+			       i, nd->pxm, (u64)nd->phys, nd->npages,
+			       nd->usedpages);
+	}
+	return buf;
+}
+
+static void
+mm_init_pcpu (void)
+{
+	u32 a, b, c, d, apic_id, pxm;
+	int node;
+
+	asm_cpuid (CPUID_1, 0, &a, &b, &c, &d);
+	apic_id = (b & CPUID_1_EBX_APICID_MASK) >> CPUID_1_EBX_APICID_SHIFT;
+	asm_cpuid (0, 0, &a, &b, &c, &d);
+	if (a >= 0xB) {
+		asm_cpuid (0xB, 0, &a, &b, &c, &d);
+		if (b)
+			apic_id = d;
+	}
+	node = 0;
+	if (acpi_srat_cpu (apic_id, &pxm))
+		node = mm_node_of_pxm (pxm);
+	currentcpu->numa_node = node < 0 ? 0 : node;
+}
+
+/* VMM memory is reserved on each proximity domain in SRAT so that
+   allocations can be local to the processor or the device */
+static void
+mm_init_numa (void)
+{
+	u64 base, len;
+	u32 pxm;
+	uint n;
+
+	for (n = 0; acpi_srat_memory (n, &base, &len, &pxm); n++)
+		if (vmm_start_phys >= base && vmm_start_phys - base < len)
+			mm_nodes[0].pxm = pxm;
+#ifdef __x86_64__
+	if (n && uefi_booted)
+		getallsysmemmap_uefi ();
+	for (n = 0; mm_num_nodes < MM_MAX_NODES &&
+		     acpi_srat_memory (n, &base, &len, &pxm); n++)
+		if (mm_node_of_pxm (pxm) == MM_NODE_LOCAL)
+			mm_node_add (pxm);
+#endif
+	register_status_callback (mm_status);
+}
+
+/* allocate n or more pages on the node */
 int
-alloc_pages (void **virt, u64 *phys, int n)
+alloc_pages_node (void **virt, u64 *phys, int n, int node)
 {
 	struct page *p;
 	int i, s;
@@ -895,7 +1196,7 @@ alloc_pages (void **virt, u64 *phys, int n)
 	panic ("alloc_pages (%d) failed.", n);
 	return -1;
 found:
-	p = mm_page_alloc (i);
+	p = mm_page_alloc (i, node);
 	if (virt)
 		*virt = (void *)page_to_virt (p);
 	if (phys)
@@ -903,25 +1204,40 @@ found:
 	return 0;
 }
 
+/* allocate n or more pages */
+int
+alloc_pages (void **virt, u64 *phys, int n)
+{
+	return alloc_pages_node (virt, phys, n, MM_NODE_LOCAL);
+}
+
+/* allocate a page on the node */
+int
+alloc_page_node (void **virt, u64 *phys, int node)
+{
+	return alloc_pages_node (virt, phys, 1, node);
+}
+
 /* allocate a page */
 int
 alloc_page (void **virt, u64 *phys)
 {
-	return alloc_pages (virt, phys, 1);
+	return alloc_pages_node (virt, phys, 1, MM_NODE_LOCAL);
 }
 
 static struct allocdata *
-alloclist_new (int n)
+alloclist_new (int n, int node)
 {
 	struct allocdata *r;
 	uint i, headlen;
 	void *tmp;
 
-	alloc_page (&tmp, NULL);
+	alloc_page_node (&tmp, NULL, node);
 	r = tmp;
 	headlen = ALLOCLIST_HEADERSIZE (n);
 	memset (r, 0, headlen);
 	r->n = n;
+	r->node = node;
 	for (i = 0; i * ALLOCLIST_SIZE (n) < headlen; i++)
 		r->data[i / 8] |= 1 << (i % 8);
 	return r;
@@ -965,10 +1281,10 @@ alloclist_free (struct allocdata *p, int n, uint offset)
 	p->data[i] &= ~(1 << j);
 }
 
-/* allocate n bytes */
+/* allocate n bytes on the node */
 /* FIXME: bad implementation */
 void *
-alloc (uint len)
+alloc_node (uint len, int node)
 {
 	void *r;
 	int i;
@@ -979,32 +1295,41 @@ alloc (uint len)
 			goto found;
 	}
 	/* allocate pages if len is larger than 1024 */
-	alloc_pages (&r, NULL, (len + 4095) / 4096);
+	alloc_pages_node (&r, NULL, (len + 4095) / 4096, node);
 	return r;
 found:
+	if (node < 0 || node >= mm_num_nodes)
+		node = mm_node_current ();
 	spinlock_lock (&mm_lock2);
 	for (;;) {
-		p = LIST1_POP (alloclist[i]);
+		p = LIST1_POP (alloclist[node][i]);
 		if (p == NULL)
-			p = alloclist_new (i);
+			p = alloclist_new (i, node);
 		if (alloclist_alloc (p, i, &r))
 			break;
 		p->n |= 0x80;
 	}
-	LIST1_PUSH (alloclist[i], p);
+	LIST1_PUSH (alloclist[node][i], p);
 	spinlock_unlock (&mm_lock2);
 	return r;
 }
 
 /* allocate n bytes */
 void *
-alloc2 (uint len, u64 *phys)
+alloc (uint len)
+{
+	return alloc_node (len, MM_NODE_LOCAL);
+}
+
+/* allocate n bytes on the node */
+void *
+alloc2_node (uint len, u64 *phys, int node)
 {
 	void *r;
 	virt_t v;
 	struct page *p;
 
-	r = alloc (len);
+	r = alloc_node (len, node);
 	if (r) {
 		v = (virt_t)r;
 		p = virt_to_page (v);
@@ -1013,6 +1338,13 @@ alloc2 (uint len, u64 *phys)
 	return r;
 }
 
+/* allocate n bytes */
+void *
+alloc2 (uint len, u64 *phys)
+{
+	return alloc2_node (len, phys, MM_NODE_LOCAL);
+}
+
 /* free */
 void
 free (void *virt)
@@ -1029,7 +1361,7 @@ free (void *virt)
 	p = (struct allocdata *)((virt_t)virt & ~PAGESIZE_MASK);
 	if (p->n & 0x80) {
 		p->n &= ~0x80;
-		LIST1_PUSH (alloclist[p->n], p);
+		LIST1_PUSH (alloclist[p->node][p->n], p);
 	}
 	alloclist_free (p, p->n, offset);
 	spinlock_unlock (&mm_lock2);
@@ -1275,7 +1607,18 @@ sym_to_phys (void *sym)
 bool
 phys_in_vmm (u64 phys)
 {
-	return phys >= vmm_start_phys && phys < vmm_start_phys + VMMSIZE_ALL;
+	int i;
+	struct mm_node *nd;
+
+	if (phys >= vmm_start_phys && phys < vmm_start_phys + VMMSIZE_ALL)
+		return true;
+	for (i = 1; i < mm_num_nodes; i++) {
+		nd = &mm_nodes[i];
+		if (phys >= nd->phys &&
+		    phys < nd->phys + ((phys_t)nd->npages << PAGESIZE_SHIFT))
+			return true;
+	}
+	return false;
 }
 
 void
@@ -2179,6 +2522,8 @@ mapped_hphys_addr (u64 hphys, uint len, int flags)
 	u64 hphys_addr = HPHYS_ADDR;
 	u64 hphys_len_copy = hphys_len;
 
+	if (flags & MAPMEM_WC)
+		return NULL;
 #ifdef __x86_64__
 	if (flags & MAPMEM_PAT)
 		hphys_addr += hphys_len_copy * 4;
@@ -2294,6 +2639,8 @@ mapmem_domap (pmap_t *m, void *virt, int flags, u64 physaddr, uint len)
 			pte |= PTE_PCD_BIT;
 		if (flags & MAPMEM_PAT)
 			pte |= PTE_PAT_BIT;
+		if (flags & MAPMEM_WC)
+			pte |= cache_get_wc_attr ();
 		ASSERT (pmap_read (m) & PTE_P_BIT);
 		pmap_write (m, pte, PTE_P_BIT | PTE_RW_BIT | PTE_US_BIT |
 			    PTE_PWT_BIT | PTE_PCD_BIT | PTE_PAT_BIT);
@@ -2369,9 +2716,15 @@ mapmem_hphys (u64 physaddr, uint len, int flags)
 	return mapmem (MAPMEM_HPHYS | flags, physaddr, len);
 }
 
+/* a writable mapping marks the pages dirty for the current epoch
+   of the dirty log.  that covers writes before the next VM entry of
+   this CPU; a mapping kept longer must be marked again with
+   dirtylog_mark() after writing. */
 void *
 mapmem_gphys (u64 physaddr, uint len, int flags)
 {
+	if (flags & MAPMEM_WRITE)
+		dirtylog_mark (physaddr, len);
 	return mapmem (MAPMEM_GPHYS | flags, physaddr, len);
 }
 
@@ -2389,4 +2742,6 @@ mm_flush_wb_cache (void)
 }
 
 INITFUNC ("global2", mm_init_global);
+INITFUNC ("global4", mm_init_numa);
 INITFUNC ("ap0", unmap_user_area);
+INITFUNC ("pcpu0", mm_init_pcpu);
@@ -83,6 +83,9 @@ void __attribute__ ((section (".entry.text")))
 uefi_init_get_vmmsize (u32 *vmmsize, u32 *align);
 void *mm_get_panicmem (int *len);
 void mm_free_panicmem (void);
+u32 vmm_start_inf (void);
+u32 vmm_term_inf (void);
+bool mm_node_range (int node, phys_t *phys, virt_t *virt, ulong *size);
 
 /* process */
 int mm_process_alloc (phys_t *phys);
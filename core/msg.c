@@ -30,42 +30,75 @@
 #include "initfunc.h"
 #include "mm.h"
 #include "msg.h"
+#include "printf.h"
 #include "spinlock.h"
 #include "string.h"
 
+/* registered names are hashed into msg_data_used[].  msg_gen is
+   incremented whenever the registry changes so that cached
+   descriptors can be validated without a lookup. */
 static LIST1_DEFINE_HEAD (struct msg_data, msg_data_free);
-static LIST1_DEFINE_HEAD (struct msg_data, msg_data_used);
+static LIST1_DEFINE_HEAD (struct msg_data, msg_data_used[MSG_HASHSIZE]);
 static spinlock_t msg_lock;
+static u32 msg_gen;
+static int msg_count;
 
 static void
 msg_init_global (void)
 {
+	int i;
+
 	LIST1_HEAD_INIT (msg_data_free);
-	LIST1_HEAD_INIT (msg_data_used);
+	for (i = 0; i < MSG_HASHSIZE; i++)
+		LIST1_HEAD_INIT (msg_data_used[i]);
 	spinlock_init (&msg_lock);
+	msg_gen = 0;
+	msg_count = 0;
 	call_initfunc ("msg");
 }
 
+static u32
+msg_hash (char *name)
+{
+	u32 h = 2166136261U;
+	int i;
+
+	for (i = 0; i < MSG_NAMELEN && name[i]; i++)
+		h = (h ^ (u8)name[i]) * 16777619U;
+	return h;
+}
+
 static struct msg_data *
-_findname (char *name)
+_findname (char *name, u32 hash)
 {
 	struct msg_data *d;
 
-	LIST1_FOREACH (msg_data_used, d) {
-		if (!strcmp (name, d->name))
+	LIST1_FOREACH (msg_data_used[hash % MSG_HASHSIZE], d) {
+		if (d->hash == hash && !strcmp (name, d->name))
 			return d;
 	}
 	return NULL;
 }
 
+static void
+_delete (struct msg_data *d)
+{
+	LIST1_DEL (msg_data_used[d->hash % MSG_HASHSIZE], d);
+	LIST1_ADD (msg_data_free, d);
+	msg_count--;
+	msg_gen++;
+}
+
 int
 msg_findname (char *name, int *pid, int *gen, int *desc)
 {
 	struct msg_data *d;
+	u32 hash;
 	int r = -1;
 
+	hash = msg_hash (name);
 	spinlock_lock (&msg_lock);
-	d = _findname (name);
+	d = _findname (name, hash);
 	if (d) {
 		*pid = d->pid;
 		*gen = d->gen;
@@ -81,9 +114,11 @@ msg_register (char *name, int pid, int gen, int desc)
 {
 	int r = -1;
 	struct msg_data *d;
+	u32 hash;
 
+	hash = msg_hash (name);
 	spinlock_lock (&msg_lock);
-	if (_findname (name))
+	if (_findname (name, hash))
 		goto err;
 	d = LIST1_POP (msg_data_free);
 	if (d == NULL)
@@ -93,7 +128,10 @@ msg_register (char *name, int pid, int gen, int desc)
 	d->pid = pid;
 	d->gen = gen;
 	d->desc = desc;
-	LIST1_ADD (msg_data_used, d);
+	d->hash = msg_hash (d->name);
+	LIST1_ADD (msg_data_used[d->hash % MSG_HASHSIZE], d);
+	msg_count++;
+	msg_gen++;
 	r = 0;
 err:
 	spinlock_unlock (&msg_lock);
@@ -105,13 +143,14 @@ msg_unregister (char *name)
 {
 	int r = -1;
 	struct msg_data *d;
+	u32 hash;
 
+	hash = msg_hash (name);
 	spinlock_lock (&msg_lock);
-	d = _findname (name);
+	d = _findname (name, hash);
 	if (d == NULL)
 		goto err;
-	LIST1_DEL (msg_data_used, d);
-	LIST1_ADD (msg_data_free, d);
+	_delete (d);
 	r = 0;
 err:
 	spinlock_unlock (&msg_lock);
@@ -121,15 +160,14 @@ err:
 void
 msg_unregisterall (int pid)
 {
-	struct msg_data *d;
+	struct msg_data *d, *dn;
+	int i;
 
 	spinlock_lock (&msg_lock);
-retry:
-	LIST1_FOREACH (msg_data_used, d) {
-		if (d->pid == pid) {
-			LIST1_DEL (msg_data_used, d);
-			LIST1_ADD (msg_data_free, d);
-			goto retry;
+	for (i = 0; i < MSG_HASHSIZE; i++) {
+		LIST1_FOREACH_DELETABLE (msg_data_used[i], d, dn) {
+			if (d->pid == pid)
+				_delete (d);
 		}
 	}
 	spinlock_unlock (&msg_lock);
@@ -138,21 +176,43 @@ retry:
 int
 msg_unregister2 (int pid, int desc)
 {
-	struct msg_data *d;
-	int r = -1;
+	struct msg_data *d, *dn;
+	int i, r = -1;
 
 	spinlock_lock (&msg_lock);
-retry:
-	LIST1_FOREACH (msg_data_used, d) {
-		if (d->pid == pid && d->desc == desc) {
-			LIST1_DEL (msg_data_used, d);
-			LIST1_ADD (msg_data_free, d);
-			r = 0;
-			goto retry;
+	for (i = 0; i < MSG_HASHSIZE; i++) {
+		LIST1_FOREACH_DELETABLE (msg_data_used[i], d, dn) {
+			if (d->pid == pid && d->desc == desc) {
+				_delete (d);
+				r = 0;
+			}
 		}
 	}
 	spinlock_unlock (&msg_lock);
 	return r;
 }
 
+u32
+msg_generation (void)
+{
+	return msg_gen;
+}
+
+void
+msg_dump (void)
+{
+	struct msg_data *d;
+	int i;
+
+	spinlock_lock (&msg_lock);
+	printf ("%d names, generation %u\n", msg_count, msg_gen);
+	printf ("NAME             PID  GEN DESC BUCKET\n");
+	for (i = 0; i < MSG_HASHSIZE; i++) {
+		LIST1_FOREACH (msg_data_used[i], d)
+			printf ("%-16s %3d %4d %4d %6d\n", d->name, d->pid,
+				d->gen, d->desc, i);
+	}
+	spinlock_unlock (&msg_lock);
+}
+
 INITFUNC ("global4", msg_init_global);
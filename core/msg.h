@@ -36,11 +36,13 @@
 typedef int kmfunc_t (void *arg, void *data, unsigned int len);
 
 #define MSG_NAMELEN 16
+#define MSG_HASHSIZE 64
 
 struct msg_data {
 	LIST1_DEFINE (struct msg_data);
 	char name[MSG_NAMELEN];
 	int pid, gen, desc;
+	u32 hash;
 };
 
 int msg_register (char *name, int pid, int gen, int desc);
@@ -48,5 +50,7 @@ int msg_unregister (char *name);
 int msg_unregister2 (int pid, int desc);
 int msg_findname (char *name, int *pid, int *gen, int *desc);
 void msg_unregisterall (int pid);
+u32 msg_generation (void);
+void msg_dump (void);
 
 #endif
@@ -0,0 +1,341 @@
+/*
+ * Copyright (c) 2007, 2008 University of Tsukuba
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the University of Tsukuba nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* NIC polling on a processor hidden from the guest.  the processor
+   polls every registered receive queue with a per-queue budget, and
+   after idle_rounds empty rounds it waits with MWAIT on the
+   descriptor the device writes next */
+
+#include "acpi.h"
+#include "asm.h"
+#include "config.h"
+#include "constants.h"
+#include "current.h"
+#include "deferred.h"
+#include "initfunc.h"
+#include "nicpoll.h"
+#include "panic.h"
+#include "pcpu.h"
+#include "printf.h"
+#include "spinlock.h"
+#include "string.h"
+#include "thread.h"
+#include "vmmcall_status.h"
+
+#define NICPOLL_MAXQUEUES	NUM_OF_NICPOLL_QUEUES_CONF
+#define NICPOLL_NAMELEN		24
+#define NICPOLL_BACKOFF		64
+#define NICPOLL_DEFAULT_BUDGET	64
+#define CPUID_5			0x5
+#define CPUID_0B		0xB
+#define CPUID_5_ECX_INTBREAK_BIT 0x2
+#define MWAIT_ECX_INTBREAK	0x1
+
+struct nicpoll_queue {
+	char name[NICPOLL_NAMELEN];
+	nicpoll_func_t *poll;
+	nicpoll_monitor_t *monitor;
+	void *data;
+	uint budget;		/* packets per poll */
+	u64 packets;
+	u64 cycles;		/* spent in polls which got packets */
+	u64 polls;
+	u64 empty;
+	u64 exhausted;		/* polls which used up the budget */
+	u64 sleeps;
+};
+
+static struct nicpoll_queue nicpoll_queue[NICPOLL_MAXQUEUES];
+static int nicpoll_nqueues;
+static spinlock_t nicpoll_lock;
+static bool nicpoll_enabled;
+static bool nicpoll_running;
+static bool nicpoll_mwait;
+static u32 nicpoll_mwait_ecx;
+static u32 nicpoll_apic_id;
+static uint nicpoll_budget;
+static uint nicpoll_idle_rounds;
+static struct nicpoll_queue *volatile nicpoll_current;
+
+/* the x2APIC ID from CPUID leaf 0Bh if available, since the 8-bit
+   ID of leaf 1 cannot tell processors with IDs over 255 apart */
+static u32
+nicpoll_get_apic_id (void)
+{
+	u32 a, b, c, d;
+
+	asm_cpuid (0, 0, &a, &b, &c, &d);
+	if (a >= CPUID_0B) {
+		asm_cpuid (CPUID_0B, 0, &a, &b, &c, &d);
+		if (b)
+			return d;
+	}
+	asm_cpuid (CPUID_1, 0, &a, &b, &c, &d);
+	return (b & CPUID_1_EBX_APICID_MASK) >> CPUID_1_EBX_APICID_SHIFT;
+}
+
+static u64
+nicpoll_rdtsc (void)
+{
+	u32 a, d;
+
+	asm_rdtsc (&a, &d);
+	return ((u64)d << 32) | a;
+}
+
+/* a removed queue keeps its slot with this function until another
+   queue takes the slot over */
+static uint
+nicpoll_none (void *data, uint budget)
+{
+	return 0;
+}
+
+bool
+nicpoll_register (char *name, nicpoll_func_t *poll,
+		  nicpoll_monitor_t *monitor, void *data)
+{
+	struct nicpoll_queue *q;
+	int i;
+
+	if (!nicpoll_enabled)
+		return false;
+	spinlock_lock (&nicpoll_lock);
+	for (i = 0; i < nicpoll_nqueues; i++)
+		if (nicpoll_queue[i].poll == nicpoll_none)
+			break;
+	if (i >= NICPOLL_MAXQUEUES) {
+		spinlock_unlock (&nicpoll_lock);
+		printf ("nicpoll: too many queues, %s ignored\n", name);
+		return false;
+	}
+	q = &nicpoll_queue[i];
+	q->poll = nicpoll_none;
+	q->monitor = NULL;
+	asm volatile ("" : : : "memory");
+	snprintf (q->name, sizeof q->name, "%s", name);
+	q->data = data;
+	q->budget = nicpoll_budget;
+	if (config.vmm.nicpoll.queue_budget[i] > 0)
+		q->budget = config.vmm.nicpoll.queue_budget[i];
+	q->packets = q->cycles = q->polls = 0;
+	q->empty = q->exhausted = q->sleeps = 0;
+	/* the polling processor reads the entries without the lock;
+	   make the entry visible first */
+	asm volatile ("" : : : "memory");
+	q->monitor = monitor;
+	q->poll = poll;
+	if (i == nicpoll_nqueues)
+		nicpoll_nqueues++;
+	spinlock_unlock (&nicpoll_lock);
+	return true;
+}
+
+/* the data of the queue may be released after this returns */
+void
+nicpoll_unregister (void *data)
+{
+	struct nicpoll_queue *q;
+	int i;
+
+	spinlock_lock (&nicpoll_lock);
+	for (i = 0; i < nicpoll_nqueues; i++) {
+		q = &nicpoll_queue[i];
+		if (q->poll == nicpoll_none || q->data != data)
+			continue;
+		q->poll = nicpoll_none;
+		q->monitor = NULL;
+		/* wait for the polling processor to leave the queue */
+		asm volatile ("mfence" : : : "memory");
+		while (nicpoll_current == q)
+			asm_pause ();
+	}
+	spinlock_unlock (&nicpoll_lock);
+}
+
+bool
+nicpoll_dedicated (void)
+{
+	if (!nicpoll_enabled || currentcpu->cpunum == 0)
+		return false;
+	return nicpoll_get_apic_id () == nicpoll_apic_id;
+}
+
+static uint
+nicpoll_run (struct nicpoll_queue *q)
+{
+	u64 start;
+	uint n;
+
+	nicpoll_current = q;
+	asm volatile ("mfence" : : : "memory");
+	start = nicpoll_rdtsc ();
+	n = q->poll (q->data, q->budget);
+	nicpoll_current = NULL;
+	q->polls++;
+	if (!n) {
+		q->empty++;
+		return 0;
+	}
+	q->cycles += nicpoll_rdtsc () - start;
+	q->packets += n;
+	if (n >= q->budget)
+		q->exhausted++;
+	return n;
+}
+
+/* MONITOR needs a single address, so only a lone queue is waited
+   for.  the queue is polled again after arming the monitor to catch
+   a packet which arrived in between */
+static void
+nicpoll_sleep (int nqueues)
+{
+	struct nicpoll_queue *q;
+	nicpoll_monitor_t *monitor;
+	volatile void *addr;
+	int i;
+
+	q = &nicpoll_queue[0];
+	if (nicpoll_mwait && nqueues == 1 && q->monitor) {
+		nicpoll_current = q;
+		asm volatile ("mfence" : : : "memory");
+		monitor = *(nicpoll_monitor_t *volatile *)&q->monitor;
+		addr = monitor ? monitor (q->data) : NULL;
+		nicpoll_current = NULL;
+		if (addr) {
+			asm_monitor (addr, 0, 0);
+			if (nicpoll_run (q))
+				return;
+			q->sleeps++;
+			asm_mwait (0, nicpoll_mwait_ecx);
+			return;
+		}
+	}
+	for (i = 0; i < NICPOLL_BACKOFF; i++)
+		asm_pause ();
+}
+
+void
+nicpoll_main (void)
+{
+	uint total, idle;
+	int i, n;
+
+	printf ("Processor %d (APIC ID %u) is polling NICs\n",
+		currentcpu->cpunum, nicpoll_apic_id);
+	nicpoll_running = true;
+	idle = 0;
+	for (;;) {
+		panic_test ();
+		/* run threads and deferred work of this processor.
+		   there is no VM entry to wait for, so the deferred
+		   work is drained as on a halt */
+		schedule ();
+		deferred_run (true);
+		n = *(volatile int *)&nicpoll_nqueues;
+		total = 0;
+		for (i = 0; i < n; i++)
+			total += nicpoll_run (&nicpoll_queue[i]);
+		if (total) {
+			idle = 0;
+			continue;
+		}
+		if (idle < nicpoll_idle_rounds) {
+			idle++;
+			asm_pause ();
+			continue;
+		}
+		/* spin idle_rounds again after waking up */
+		nicpoll_sleep (n);
+		idle = 0;
+	}
+}
+
+static char *
+nicpoll_status (void)
+{
+	static char buf[1024];
+	struct nicpoll_queue *q;
+	int i, n, len;
+
+	len = snprintf (buf, sizeof buf,
+			"NIC polling:\n"
+			" apic_id %u running %d mwait %d budget %u"
+			" idle_rounds %u\n",
+			nicpoll_apic_id, nicpoll_running, nicpoll_mwait,
+			nicpoll_budget, nicpoll_idle_rounds);
+	n = nicpoll_nqueues;
+	for (i = 0; i < n && len < sizeof buf; i++) {
+		q = &nicpoll_queue[i];
+		len += snprintf (buf + len, sizeof buf - len,
+				 " %-20s budget %u packets %llu cycles %llu"
+				 " polls %llu empty %llu exhausted %llu"
+				 " sleeps %llu\n",
+				 q->name, q->budget, q->packets, q->cycles,
+				 q->polls,
+				 q->empty, q->exhausted, q->sleeps);
+	}
+	return buf;
+}
+
+static void
+nicpoll_init_global (void)
+{
+	u32 a, b, c, d;
+
+	spinlock_init (&nicpoll_lock);
+	if (!config.vmm.nicpoll.enable)
+		return;
+	nicpoll_apic_id = config.vmm.nicpoll.apic_id;
+	if (nicpoll_apic_id == nicpoll_get_apic_id ()) {
+		printf ("nicpoll: APIC ID %u is the bootstrap processor\n",
+			nicpoll_apic_id);
+		return;
+	}
+	if (!acpi_disable_lapic (nicpoll_apic_id)) {
+		printf ("nicpoll: APIC ID %u not found in MADT\n",
+			nicpoll_apic_id);
+		return;
+	}
+	nicpoll_budget = config.vmm.nicpoll.budget > 0 ?
+		config.vmm.nicpoll.budget : NICPOLL_DEFAULT_BUDGET;
+	if (config.vmm.nicpoll.idle_rounds > 0)
+		nicpoll_idle_rounds = config.vmm.nicpoll.idle_rounds;
+	asm_cpuid (CPUID_1, 0, &a, &b, &c, &d);
+	if (c & CPUID_1_ECX_MONITOR_BIT) {
+		nicpoll_mwait = true;
+		asm_cpuid (CPUID_5, 0, &a, &b, &c, &d);
+		if (c & CPUID_5_ECX_INTBREAK_BIT)
+			nicpoll_mwait_ecx = MWAIT_ECX_INTBREAK;
+	}
+	nicpoll_enabled = true;
+	register_status_callback (nicpoll_status);
+}
+
+INITFUNC ("global4", nicpoll_init_global);
@@ -585,6 +585,8 @@ panic (char *format, ...)
 	}
 	if (panic_reboot)
 		do_panic_reboot ();
+	if (panic_dump (panicmsg, cpunum))
+		do_panic_reboot ();
 	printf ("%s\n", panicmsg);
 	call_panic_shell ();
 }
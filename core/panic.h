@@ -44,5 +44,6 @@ struct panic_pcpu_data {
 
 void auto_reboot (void);
 void do_panic_reboot (void);
+bool panic_dump (char *msg, int cpunum);
 
 #endif
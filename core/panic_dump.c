@@ -0,0 +1,324 @@
+/*
+ * Copyright (c) 2007, 2008 University of Tsukuba
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the University of Tsukuba nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* crash dump to a reserved disk region.  the region starts with a
+   one-page header, followed by 64KiB chunks; each chunk carries
+   CHUNK_DATA bytes of the page stream and a crc32 of them.  every
+   VMM page in the stream is a u16 length followed by the data: 0
+   is a zero page, PAGESIZE is a raw page, otherwise it is LZSS
+   compressed.  the stream holds the VMM region followed by the
+   per-node pools listed in the header.  tools/crashdump extracts
+   the image. */
+
+#include <core/arith.h>
+#include "config.h"
+#include "constants.h"
+#include "mm.h"
+#include "panic.h"
+#include "printf.h"
+#include "string.h"
+#include "time.h"
+
+#define CHUNK_PAGES		16
+#define CHUNK_SIZE		(CHUNK_PAGES * PAGESIZE)
+#define CHUNK_DATA		(CHUNK_SIZE - 4)
+#define HEADER_SECTORS		(PAGESIZE / 512)
+#define LZSS_HASH_SIZE		4096
+#define LZSS_MINLEN		3
+#define LZSS_MAXLEN		(LZSS_MINLEN + 15)
+#define MAX_RANGES		8
+
+struct panic_dump_header {
+	char magic[8];		/* "VBCRASH1" */
+	u32 version;
+	u32 complete;		/* set after the last chunk is written */
+	u64 vmm_virt;
+	u64 vmm_phys;
+	u64 vmm_size;
+	u64 data_bytes;		/* length of the page stream */
+	u64 time;
+	u32 cpu;
+	u32 chunk_size;
+	u64 code, codeend;
+	char panicmsg[1024];
+	u32 nranges;		/* range[0] is the VMM region */
+	struct {
+		u64 virt, phys, size;
+	} __attribute__ ((packed)) range[MAX_RANGES];
+} __attribute__ ((packed));
+
+static struct {
+	char name[16];
+	panic_dump_write_t *write;
+	void *data;
+	int dev_no;
+	u8 *chunk;
+	phys_t chunk_phys;
+	struct panic_dump_header *header;
+	phys_t header_phys;
+} dumpdev;
+
+static uint chunk_len;
+static u64 next_lba, end_lba, data_bytes;
+static u16 lzss_hash[LZSS_HASH_SIZE];
+static u8 lzss_out[PAGESIZE + 8];
+
+bool
+panic_dump_register (char *name, panic_dump_write_t *write, void *data,
+		     int dev_no)
+{
+	int len;
+
+	if (dumpdev.write || !config.vmm.panic_dump.sectors)
+		return false;
+	len = strlen (name);
+	if (len >= sizeof dumpdev.name ||
+	    memcmp (name, config.vmm.panic_dump.device, len + 1))
+		return false;
+	/* buffers are allocated now since the allocator may be
+	 * locked by a frozen processor at panic time */
+	alloc_pages ((void **)&dumpdev.chunk, &dumpdev.chunk_phys,
+		     CHUNK_PAGES);
+	alloc_page ((void **)&dumpdev.header, &dumpdev.header_phys);
+	memcpy (dumpdev.name, name, len + 1);
+	dumpdev.data = data;
+	dumpdev.dev_no = dev_no;
+	dumpdev.write = write;
+	printf ("Crash dump device: %s LBA 0x%llX+0x%llX\n", name,
+		config.vmm.panic_dump.lba, config.vmm.panic_dump.sectors);
+	return true;
+}
+
+void
+panic_dump_unregister (void *data)
+{
+	if (!dumpdev.write || dumpdev.data != data)
+		return;
+	dumpdev.write = NULL;
+	free_page (dumpdev.chunk);
+	free_page (dumpdev.header);
+	printf ("Crash dump device: %s removed\n", dumpdev.name);
+}
+
+/* a set bit in the flag byte before every eight items is a two-byte
+   match (12-bit distance, 4-bit length - LZSS_MINLEN) and a clear bit
+   is a literal.  returns PAGESIZE if the page does not compress. */
+static uint
+lzss_compress (u8 *in, u8 *out)
+{
+	uint i, h, cand, dist, len, outlen, nitems, flagpos;
+
+	memset (lzss_hash, 0, sizeof lzss_hash);
+	i = outlen = nitems = flagpos = 0;
+	while (i < PAGESIZE) {
+		if (!(nitems & 7)) {
+			flagpos = outlen;
+			out[outlen++] = 0;
+		}
+		len = dist = 0;
+		if (i + LZSS_MINLEN <= PAGESIZE) {
+			h = ((in[i] << 4) ^ (in[i + 1] << 2) ^ in[i + 2] ^
+			     (in[i] >> 4)) & (LZSS_HASH_SIZE - 1);
+			cand = lzss_hash[h];
+			lzss_hash[h] = i + 1;
+			if (cand) {
+				cand--;
+				dist = i - cand;
+				while (len < LZSS_MAXLEN && i + len < PAGESIZE &&
+				       in[cand + len] == in[i + len])
+					len++;
+			}
+		}
+		if (len >= LZSS_MINLEN) {
+			out[flagpos] |= 1 << (nitems & 7);
+			out[outlen++] = dist;
+			out[outlen++] = ((dist >> 8) & 0xF) |
+				((len - LZSS_MINLEN) << 4);
+			i += len;
+		} else {
+			out[outlen++] = in[i++];
+		}
+		nitems++;
+		if (outlen >= PAGESIZE)
+			return PAGESIZE;
+	}
+	return outlen;
+}
+
+static bool
+panic_dump_zero_page (void *page)
+{
+	ulong *p;
+	int i;
+
+	p = page;
+	for (i = 0; i < PAGESIZE / sizeof *p; i++)
+		if (p[i])
+			return false;
+	return true;
+}
+
+static bool
+panic_dump_flush_chunk (void)
+{
+	u32 crc;
+
+	if (!chunk_len)
+		return true;
+	if (next_lba + CHUNK_SIZE / 512 > end_lba) {
+		printf ("Crash dump area is full\n");
+		return false;
+	}
+	memset (dumpdev.chunk + chunk_len, 0, CHUNK_DATA - chunk_len);
+	crc = crc32 (dumpdev.chunk, CHUNK_DATA);
+	memcpy (dumpdev.chunk + CHUNK_DATA, &crc, sizeof crc);
+	if (!dumpdev.write (dumpdev.data, dumpdev.dev_no, next_lba,
+			    dumpdev.chunk, dumpdev.chunk_phys,
+			    CHUNK_SIZE / 512))
+		return false;
+	next_lba += CHUNK_SIZE / 512;
+	chunk_len = 0;
+	return true;
+}
+
+static bool
+panic_dump_put (void *data, uint len)
+{
+	u8 *p;
+	uint n;
+
+	for (p = data; len > 0; p += n, len -= n) {
+		n = CHUNK_DATA - chunk_len;
+		if (n > len)
+			n = len;
+		memcpy (dumpdev.chunk + chunk_len, p, n);
+		chunk_len += n;
+		data_bytes += n;
+		if (chunk_len == CHUNK_DATA && !panic_dump_flush_chunk ())
+			return false;
+	}
+	return true;
+}
+
+static bool
+panic_dump_page (u8 *page)
+{
+	u16 len;
+
+	if (panic_dump_zero_page (page)) {
+		len = 0;
+		return panic_dump_put (&len, sizeof len);
+	}
+	len = lzss_compress (page, lzss_out);
+	if (!panic_dump_put (&len, sizeof len))
+		return false;
+	return panic_dump_put (len < PAGESIZE ? lzss_out : page, len);
+}
+
+static bool
+panic_dump_write_header (void)
+{
+	return dumpdev.write (dumpdev.data, dumpdev.dev_no,
+			      config.vmm.panic_dump.lba, dumpdev.header,
+			      dumpdev.header_phys, HEADER_SECTORS);
+}
+
+/* called by the last processor in panic().  the other processors
+   are spinning in reboot_test() and do not touch the disk */
+bool
+panic_dump (char *msg, int cpunum)
+{
+	static bool done;
+	struct panic_dump_header *h;
+	extern u8 code[], codeend[];
+	ulong off, size, total;
+	phys_t phys;
+	virt_t virt;
+	u64 start;
+	int i;
+
+	if (!dumpdev.write || done)
+		return false;
+	done = true;
+	start = get_time ();
+	h = dumpdev.header;
+	memset (h, 0, PAGESIZE);
+	total = 0;
+	for (i = 0; i < MAX_RANGES && mm_node_range (i, &phys, &virt, &size);
+	     i++) {
+		h->range[i].virt = virt;
+		h->range[i].phys = phys;
+		h->range[i].size = size;
+		total += size;
+	}
+	h->nranges = i;
+	printf ("Writing crash dump (%lu MiB) to %s\n", total >> 20,
+		dumpdev.name);
+	chunk_len = 0;
+	data_bytes = 0;
+	next_lba = config.vmm.panic_dump.lba + HEADER_SECTORS;
+	end_lba = config.vmm.panic_dump.lba + config.vmm.panic_dump.sectors;
+	memcpy (h->magic, "VBCRASH1", sizeof h->magic);
+	h->version = 2;
+	h->vmm_virt = h->range[0].virt;
+	h->vmm_phys = h->range[0].phys;
+	h->vmm_size = h->range[0].size;
+	h->time = start;
+	h->cpu = cpunum;
+	h->chunk_size = CHUNK_SIZE;
+	h->code = (ulong)code;
+	h->codeend = (ulong)codeend;
+	snprintf (h->panicmsg, sizeof h->panicmsg, "%s", msg);
+	if (!panic_dump_write_header ())
+		goto fail;
+	for (i = 0; i < h->nranges; i++) {
+		for (off = 0; off < h->range[i].size; off += PAGESIZE) {
+			if (!(off & 0xFFFFFF))
+				printf ("Crash dump: node %d %lu MiB\n", i,
+					off >> 20);
+			if (!panic_dump_page ((u8 *)(ulong)h->range[i].virt +
+					      off))
+				goto fail;
+		}
+	}
+	if (!panic_dump_flush_chunk ())
+		goto fail;
+	h->data_bytes = data_bytes;
+	h->complete = 1;
+	if (!panic_dump_write_header ())
+		goto fail;
+	if (!dumpdev.write (dumpdev.data, dumpdev.dev_no, 0, NULL, 0, 0))
+		goto fail;
+	printf ("Crash dump written: %llu bytes in %llu ms\n", data_bytes,
+		(get_time () - start) / 1000);
+	return true;
+fail:
+	printf ("Crash dump failed\n");
+	return false;
+}
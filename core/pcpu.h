@@ -32,8 +32,10 @@
 
 #include "asm.h"
 #include "cache.h"
+#include "deferred.h"
 #include "desc.h"
 #include "panic.h"
+#include "random.h"
 #include "seg.h"
 #include "spinlock.h"
 #include "svm.h"
@@ -63,9 +65,12 @@ struct pcpu {
 	struct svm_pcpu_data svm;
 	struct cache_pcpu_data cache;
 	struct panic_pcpu_data panic;
+	struct random_pcpu_data random;
+	struct deferred_pcpu_data deferred;
 	struct thread_pcpu_data thread;
 	enum fullvirtualize_type fullvirtualize;
 	int cpunum;
+	int numa_node;
 	int pid;
 	void *stackaddr;
 	u64 tsc, hz, timediff;
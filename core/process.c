@@ -642,6 +642,44 @@ sys_msgopen (ulong ip, ulong sp, ulong num, ulong si, ulong di)
 	return _msgopen (currentcpu->pid, name);
 }
 
+/* for kernel (VMM) */
+int
+msgcache_open (struct msgcache *c)
+{
+	int mpid, mgen, mdesc, r;
+	u32 gen;
+
+	gen = msg_generation ();
+	if (c->desc >= 0 && c->gen == gen)
+		return c->desc;
+	spinlock_lock (&c->lock);
+	r = c->desc;
+	if (r >= 0 && c->gen == gen)
+		goto ret;
+	if (msg_findname (c->name, &mpid, &mgen, &mdesc)) {
+		r = -1;
+		goto ret;
+	}
+	if (r < 0) {
+		r = _msgopen_2 (0, mpid, mgen, mdesc);
+		if (r < 0)
+			goto ret;
+		c->desc = r;
+	} else {
+		/* update the slot in place; it may be in use by other
+		 * processors */
+		spinlock_lock (&process_lock);
+		process[0].msgdsc[r].pid = mpid;
+		process[0].msgdsc[r].gen = mgen;
+		process[0].msgdsc[r].dsc = mdesc;
+		spinlock_unlock (&process_lock);
+	}
+	c->gen = gen;
+ret:
+	spinlock_unlock (&c->lock);
+	return r;
+}
+
 /* for internal use */
 static int
 _msgclose (int pid, int desc)
@@ -27,14 +27,50 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include "asm.h"
 #include "config.h"
+#include "constants.h"
 #include "convert.h"
 #include "initfunc.h"
 #include "mm.h"
+#include "panic.h"
+#include "pcpu.h"
 #include "printf.h"
+#include "process.h"
+#include "random.h"
+#include "spinlock.h"
 #include "string.h"
+#include "time.h"
 #include <tcg.h>
 
+/* Per-CPU ChaCha20 generator with fast key erasure.  Each CPU derives
+ * its key from a global pool keyed by the config seed, TPM bytes and
+ * RDSEED/RDRAND output, and reseeds when the pool changes or after
+ * RANDOM_RESEED_BYTES bytes. */
+#define RANDOM_RESEED_BYTES	(1 << 20)
+#define RANDOM_HW_RETRY		10
+#define RANDOM_HW_SEED_WORDS	8
+#define RANDOM_NONCE_MIX	0x78696DULL /* "mix" */
+#define RANDOM_NONCE_POOL	0x6C6F6F70ULL /* "pool" */
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+#define CHACHA_QR(a, b, c, d) do { \
+	a += b; d ^= a; d = ROTL32 (d, 16); \
+	c += d; b ^= c; b = ROTL32 (b, 12); \
+	a += b; d ^= a; d = ROTL32 (d, 8); \
+	c += d; b ^= c; b = ROTL32 (b, 7); \
+} while (0)
+
+static struct {
+	spinlock_t lock;
+	u32 key[8];
+	u64 counter;
+	unsigned int generation;
+} random_pool;
+
+static struct random_pcpu_data random_fallback;
+static spinlock_t random_fallback_lock;
+static bool random_use_rdrand, random_use_rdseed;
 static char *random_buf;
 
 #ifdef TCG_BIOS
@@ -114,6 +150,323 @@ tpm_getrandom (void *buf, unsigned int size)
 #endif
 }
 
+static void
+chacha20_block (u32 *key, u64 counter, u64 nonce, u32 *out)
+{
+	static const u32 sigma[4] = {
+		0x61707865, 0x3320646E, 0x79622D32, 0x6B206574
+	};
+	u32 x[16];
+	int i;
+
+	for (i = 0; i < 4; i++)
+		x[i] = sigma[i];
+	for (i = 0; i < 8; i++)
+		x[4 + i] = key[i];
+	x[12] = (u32)counter;
+	x[13] = (u32)(counter >> 32);
+	x[14] = (u32)nonce;
+	x[15] = (u32)(nonce >> 32);
+	memcpy (out, x, sizeof x);
+	for (i = 0; i < 10; i++) {
+		CHACHA_QR (x[0], x[4], x[8], x[12]);
+		CHACHA_QR (x[1], x[5], x[9], x[13]);
+		CHACHA_QR (x[2], x[6], x[10], x[14]);
+		CHACHA_QR (x[3], x[7], x[11], x[15]);
+		CHACHA_QR (x[0], x[5], x[10], x[15]);
+		CHACHA_QR (x[1], x[6], x[11], x[12]);
+		CHACHA_QR (x[2], x[7], x[8], x[13]);
+		CHACHA_QR (x[3], x[4], x[9], x[14]);
+	}
+	for (i = 0; i < 16; i++)
+		out[i] += x[i];
+	memset (x, 0, sizeof x);
+}
+
+/* Absorb data into a 256-bit key: XOR each 32-byte chunk into the key
+ * and replace the key with the first half of a ChaCha20 block. */
+static void
+random_mix (u32 *key, void *data, unsigned int len)
+{
+	u32 chunk[8], out[16];
+	u8 *p = data;
+	unsigned int n, i, index;
+
+	for (index = 0; index == 0 || len > 0; index++) {
+		n = len > sizeof chunk ? sizeof chunk : len;
+		memset (chunk, 0, sizeof chunk);
+		memcpy (chunk, p, n);
+		for (i = 0; i < 8; i++)
+			key[i] ^= chunk[i];
+		chacha20_block (key, ((u64)len << 32) | index,
+				RANDOM_NONCE_MIX, out);
+		memcpy (key, out, sizeof chunk);
+		p += n;
+		len -= n;
+	}
+	memset (chunk, 0, sizeof chunk);
+	memset (out, 0, sizeof out);
+}
+
+static void
+random_hw_failed (bool *use, char *name)
+{
+	if (*use) {
+		*use = false;
+		printf ("random: %s failed health test, disabled\n", name);
+	}
+}
+
+/* Continuous health test: reject stuck values and repeated outputs. */
+static bool
+random_hw_check (struct random_pcpu_data *r, ulong value)
+{
+	if (value == 0 || value == ~0UL || value == r->last_hw)
+		return false;
+	r->last_hw = value;
+	return true;
+}
+
+static bool
+random_hw_get (struct random_pcpu_data *r, ulong *value)
+{
+	int i;
+
+	if (random_use_rdseed) {
+		for (i = 0; i < RANDOM_HW_RETRY; i++) {
+			if (asm_rdseed (value)) {
+				if (random_hw_check (r, *value))
+					return true;
+				random_hw_failed (&random_use_rdseed,
+						  "RDSEED");
+				break;
+			}
+			asm_pause ();
+		}
+	}
+	if (random_use_rdrand) {
+		for (i = 0; i < RANDOM_HW_RETRY; i++) {
+			if (asm_rdrand (value)) {
+				if (random_hw_check (r, *value))
+					return true;
+				random_hw_failed (&random_use_rdrand,
+						  "RDRAND");
+				break;
+			}
+		}
+	}
+	return false;
+}
+
+static void
+random_pcpu_reseed (struct random_pcpu_data *r, int cpunum)
+{
+	struct {
+		u32 derived[16];
+		ulong hw[RANDOM_HW_SEED_WORDS];
+		u32 tsc[2];
+	} seed;
+	unsigned int generation;
+	int i;
+
+	spinlock_lock (&random_pool.lock);
+	chacha20_block (random_pool.key, random_pool.counter++,
+			RANDOM_NONCE_POOL ^ ((u64)cpunum << 32), seed.derived);
+	generation = random_pool.generation;
+	spinlock_unlock (&random_pool.lock);
+	for (i = 0; i < RANDOM_HW_SEED_WORDS; i++)
+		if (!random_hw_get (r, &seed.hw[i]))
+			seed.hw[i] = 0;
+	asm_rdtsc (&seed.tsc[0], &seed.tsc[1]);
+	random_mix (r->key, &seed, sizeof seed);
+	memset (&seed, 0, sizeof seed);
+	r->generation = generation;
+	r->bytes_since_reseed = 0;
+	r->bufpos = RANDOM_BUF_SIZE;
+}
+
+/* Fill the buffer and overwrite the key with its first 32 bytes, so
+ * earlier output cannot be recomputed from the current state. */
+static void
+random_pcpu_refill (struct random_pcpu_data *r)
+{
+	unsigned int i;
+
+	for (i = 0; i < RANDOM_BUF_SIZE; i += 64)
+		chacha20_block (r->key, r->counter++, 0,
+				(u32 *)&r->buf[i]);
+	memcpy (r->key, r->buf, sizeof r->key);
+	memset (r->buf, 0, sizeof r->key);
+	r->bufpos = sizeof r->key;
+}
+
+static void
+random_pcpu_bytes (struct random_pcpu_data *r, int cpunum, u8 *p,
+		   unsigned int len)
+{
+	unsigned int n;
+
+	if (!r->generation || r->generation != random_pool.generation ||
+	    r->bytes_since_reseed >= RANDOM_RESEED_BYTES)
+		random_pcpu_reseed (r, cpunum);
+	r->bytes_since_reseed += len;
+	while (len > 0) {
+		if (r->bufpos >= RANDOM_BUF_SIZE)
+			random_pcpu_refill (r);
+		n = RANDOM_BUF_SIZE - r->bufpos;
+		if (n > len)
+			n = len;
+		memcpy (p, &r->buf[r->bufpos], n);
+		memset (&r->buf[r->bufpos], 0, n);
+		r->bufpos += n;
+		p += n;
+		len -= n;
+	}
+}
+
+void
+random_bytes (void *buf, unsigned int len)
+{
+	struct random_pcpu_data *r;
+
+	if (!currentcpu_available ()) {
+		spinlock_lock (&random_fallback_lock);
+		random_pcpu_bytes (&random_fallback, -1, buf, len);
+		spinlock_unlock (&random_fallback_lock);
+		return;
+	}
+	r = &currentcpu->random;
+	if (r->owner != currentcpu) {
+		/* AP copies of pcpu_default must not share the BSP state */
+		memset (r, 0, sizeof *r);
+		r->owner = currentcpu;
+	}
+	random_pcpu_bytes (r, currentcpu->cpunum, buf, len);
+}
+
+u32
+random_u32 (void)
+{
+	u32 ret;
+
+	random_bytes (&ret, sizeof ret);
+	return ret;
+}
+
+u64
+random_u64 (void)
+{
+	u64 ret;
+
+	random_bytes (&ret, sizeof ret);
+	return ret;
+}
+
+/* Mix data into the global pool.  Every CPU reseeds on its next use. */
+void
+random_add_entropy (void *buf, unsigned int len)
+{
+	spinlock_lock (&random_pool.lock);
+	random_mix (random_pool.key, buf, len);
+	if (++random_pool.generation == 0)
+		random_pool.generation = 1;
+	spinlock_unlock (&random_pool.lock);
+}
+
+/* RFC 7539 2.3.2 block function test vector */
+static void
+random_selftest (void)
+{
+	static u8 expected[64] = {
+		0x10, 0xF1, 0xE7, 0xE4, 0xD1, 0x3B, 0x59, 0x15,
+		0x50, 0x0F, 0xDD, 0x1F, 0xA3, 0x20, 0x71, 0xC4,
+		0xC7, 0xD1, 0xF4, 0xC7, 0x33, 0xC0, 0x68, 0x03,
+		0x04, 0x22, 0xAA, 0x9A, 0xC3, 0xD4, 0x6C, 0x4E,
+		0xD2, 0x82, 0x64, 0x46, 0x07, 0x9F, 0xAA, 0x09,
+		0x14, 0xC2, 0xD7, 0x05, 0xD9, 0x8B, 0x02, 0xA2,
+		0xB5, 0x12, 0x9C, 0xD1, 0xDE, 0x16, 0x4E, 0xB9,
+		0xCB, 0xD0, 0x83, 0xE8, 0xA2, 0x50, 0x3C, 0x4E,
+	};
+	u32 key[8], out[16];
+	int i;
+
+	for (i = 0; i < 32; i++)
+		((u8 *)key)[i] = i;
+	chacha20_block (key, 0x0900000000000001ULL, 0x4A000000, out);
+	if (memcmp (out, expected, sizeof expected))
+		panic ("random: ChaCha20 self-test failed");
+}
+
+static void
+random_init_hw (void)
+{
+	u32 a, b, c, d;
+	u32 maxleaf;
+
+	asm_cpuid (0, 0, &maxleaf, &b, &c, &d);
+	asm_cpuid (CPUID_1, 0, &a, &b, &c, &d);
+	if (c & CPUID_1_ECX_RDRAND_BIT)
+		random_use_rdrand = true;
+	if (maxleaf >= CPUID_7) {
+		asm_cpuid (CPUID_7, 0, &a, &b, &c, &d);
+		if (b & CPUID_7_EBX_RDSEED_BIT)
+			random_use_rdseed = true;
+	}
+}
+
+static void
+random_init_pool (void)
+{
+	struct random_pcpu_data tmp;
+	ulong hw[RANDOM_HW_SEED_WORDS];
+	int i, n;
+
+	random_selftest ();
+	random_init_hw ();
+	memset (&tmp, 0, sizeof tmp);
+	for (i = n = 0; i < RANDOM_HW_SEED_WORDS; i++)
+		if (random_hw_get (&tmp, &hw[n]))
+			n++;
+	if (random_use_rdseed || random_use_rdrand)
+		printf ("random: %s available\n",
+			random_use_rdseed ? "RDSEED" : "RDRAND");
+	random_add_entropy (config.vmm.randomSeed,
+			    sizeof config.vmm.randomSeed);
+	if (n > 0)
+		random_add_entropy (hw, n * sizeof hw[0]);
+	memset (hw, 0, sizeof hw);
+}
+
+static int
+random_msghandler (int m, int c)
+{
+	static u8 buf[4096];
+	unsigned int sizes[] = { 16, 256, 4096 }, size, total;
+	u64 start, end;
+	int i, j;
+
+	if (m != 0)
+		return 0;
+	random_selftest ();
+	total = 1 << 22;
+	for (i = 0; i < sizeof sizes / sizeof sizes[0]; i++) {
+		size = sizes[i];
+		start = get_time ();
+		for (j = 0; j < total / size; j++)
+			random_bytes (buf, size);
+		end = get_time ();
+		printf ("random: %u bytes in %u-byte requests: %llu us\n",
+			total, size, end - start);
+	}
+	return 0;
+}
+
+static void
+random_init_msg (void)
+{
+	msgregister ("random", random_msghandler);
+}
+
 static void
 random_init_config0 (void)
 {
@@ -125,6 +478,8 @@ random_init_config0 (void)
 		free (random_buf);
 		random_buf = NULL;
 	}
+	random_add_entropy (config.vmm.randomSeed,
+			    sizeof config.vmm.randomSeed);
 }
 
 static void
@@ -165,4 +520,6 @@ random_init_global (void)
 }
 
 INITFUNC ("bsp0", random_init_global);
+INITFUNC ("bsp1", random_init_pool);
 INITFUNC ("config00", random_init_config0);
+INITFUNC ("msg0", random_init_msg);
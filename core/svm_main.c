@@ -33,6 +33,7 @@
 #include "cpu_emul.h"
 #include "cpu_mmu.h"
 #include "current.h"
+#include "deferred.h"
 #include "exint_pass.h"
 #include "mm.h"
 #include "panic.h"
@@ -571,6 +572,10 @@ svm_mainloop (void)
 	for (;;) {
 		schedule ();
 		panic_test ();
+		/* an emulated HLT is not performed on SVM, but the
+		   processor is going to be idle */
+		deferred_run (current->halt);
+		current->halt = false;
 		if (current->sx_init.get_init_count ())
 			svm_wait_for_sipi ();
 		svm_nmi ();
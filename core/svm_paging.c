@@ -28,6 +28,7 @@
  */
 
 #include "cpu.h"
+#include "cpu_mmu.h"
 #include "cpu_mmu_spt.h"
 #include "current.h"
 #include "mm.h"
@@ -136,17 +137,22 @@ void
 svm_paging_tlbflush (void)
 {
 #ifdef CPU_MMU_SPT_DISABLE
+	cpu_mmu_tlb_flush ();
 	return;
 #endif
-	if (current->u.svm.np)
+	if (current->u.svm.np) {
+		/* Guest INVLPG and CR3 writes are not intercepted */
+		cpu_mmu_tlb_flush ();
 		svm_np_tlbflush ();
-	else
+	} else {
 		cpu_mmu_spt_tlbflush ();
+	}
 }
 
 void
 svm_paging_invalidate (ulong addr)
 {
+	cpu_mmu_tlb_invalidate (addr);
 #ifdef CPU_MMU_SPT_DISABLE
 	panic ("invlpg while spt disabled");
 #endif
@@ -170,6 +176,7 @@ svm_paging_npf (bool write, u64 gphys)
 void
 svm_paging_updatecr3 (void)
 {
+	cpu_mmu_tlb_flush ();
 #ifdef CPU_MMU_SPT_DISABLE
 	return;
 #endif
@@ -193,6 +200,7 @@ svm_paging_spt_setcr3 (ulong cr3)
 void
 svm_paging_clear_all (void)
 {
+	cpu_mmu_tlb_flush ();
 #ifdef CPU_MMU_SPT_DISABLE
 	return;
 #endif
@@ -256,6 +264,7 @@ svm_paging_apply_fixed_cr4 (ulong val)
 void
 svm_paging_pg_change (void)
 {
+	cpu_mmu_tlb_flush ();
 }
 
 void
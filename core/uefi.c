@@ -35,9 +35,11 @@
 #include "entry.h"
 #include "mm.h"
 #include "uefi.h"
+#include "vmmpack.h"
 
 #define SECTION_ENTRY_TEXT __attribute__ ((section (".entry.text")))
 #define SECTION_ENTRY_DATA __attribute__ ((section (".entry.data")))
+#define VMMPACK_READSIZE 0x100000
 #define _PRINT(s) do { \
 	static char SECTION_ENTRY_DATA _p[] = \
 		(s); \
@@ -134,6 +136,83 @@ read_configuration_table (EFI_SYSTEM_TABLE *systab)
 	}
 }
 
+/* reads the blocks after the first VMMPACK_OFFSET bytes into the end
+   of the VMM area and decompresses them as they arrive */
+static int SECTION_ENTRY_TEXT
+uefi_load_packed (EFI_FILE_HANDLE file, u64 uefi_read, u8 *image,
+		  u8 *areaend, u32 loadsize)
+{
+	extern u8 dataend[];
+	struct vmmpack_header *h = &vmmpack_header;
+	struct vmmpack_block blk;
+	struct vmmpack_lz4 lz4;
+	u64 readsize, avail, parsed;
+	u8 *packed, *end;
+	u32 ret;
+
+	if (h->version != VMMPACK_VERSION || h->offset != loadsize ||
+	    h->offset + h->size != dataend - head) {
+		_PRINT ("\nBad packed image.\n");
+		return 0;
+	}
+	end = image + h->offset + h->size;
+	if (end > areaend || h->packed_size >= areaend - end) {
+		_PRINT ("\nPacked image too large.\n");
+		return 0;
+	}
+	packed = (u8 *)(((ulong)areaend - h->packed_size) & ~PAGESIZE_MASK);
+	if (packed < end) {
+		_PRINT ("\nPacked image too large.\n");
+		return 0;
+	}
+	lz4.base = image;
+	lz4.dst = image + h->offset;
+	avail = parsed = 0;
+	while (lz4.dst < image + h->offset + h->size) {
+		if (parsed + sizeof blk <= avail) {
+			uefi_entry_pcpy (uefi_entry_virttophys (&blk),
+					 packed + parsed, sizeof blk);
+			if (blk.usize > image + h->offset + h->size - lz4.dst ||
+			    blk.csize > h->packed_size - parsed - sizeof blk)
+				goto corrupt;
+			if (parsed + sizeof blk + blk.csize <= avail) {
+				lz4.src = packed + parsed + sizeof blk;
+				lz4.srcend = lz4.src + blk.csize;
+				lz4.dstend = lz4.dst + blk.usize;
+				if (!vmmpack_decode (&lz4))
+					goto corrupt;
+				parsed += sizeof blk + blk.csize;
+				continue;
+			}
+		}
+		if (avail >= h->packed_size)
+			goto corrupt;
+		_putchar ('.');
+		readsize = h->packed_size - avail;
+		if (readsize > VMMPACK_READSIZE)
+			readsize = VMMPACK_READSIZE;
+		ret = uefi_entry_call (uefi_read, 0, file,
+				       uefi_entry_virttophys (&readsize),
+				       packed + avail);
+		if (ret) {
+			_PRINT ("\nRead error.\n");
+			return 0;
+		}
+		if (!readsize)
+			goto corrupt;
+		avail += readsize;
+	}
+	_PRINT ("\n");
+	if (!vmmpack_verify (image)) {
+		_PRINT ("Packed image digest mismatch\n");
+		return 0;
+	}
+	return 1;
+corrupt:
+	_PRINT ("\nPacked image corrupted.\n");
+	return 0;
+}
+
 int SECTION_ENTRY_TEXT
 uefi_init (u32 loadaddr, u32 loadsize, EFI_SYSTEM_TABLE *systab,
 	   EFI_HANDLE image, EFI_FILE_HANDLE file)
@@ -205,6 +284,13 @@ uefi_init (u32 loadaddr, u32 loadsize, EFI_SYSTEM_TABLE *systab,
 	_PRINT ("ing ");
 	uefi_entry_pcpy ((u8 *)alloc_addr + 0x100000, (u8 *)(ulong)loadaddr,
 			 loadsize);
+	if (vmmpack_packed ()) {
+		if (!uefi_load_packed (file, uefi_read,
+				       (u8 *)alloc_addr + 0x100000,
+				       (u8 *)alloc_addr + vmmsize, loadsize))
+			return 0;
+		uefi_entry_start (alloc_addr);
+	}
 	loadedsize = loadsize;
 	blocksize = (((dataend - head) / 64 + 511) / 512) * 512;
 	do {
@@ -32,6 +32,7 @@
 
 #include "acpi.h"
 #include "cache.h"
+#include "cpu_mmu.h"
 #include "cpu_mmu_spt.h"
 #include "cpuid.h"
 #include "gmm.h"
@@ -71,9 +72,13 @@ struct vcpu {
 	u64 tsc_offset;
 	bool updateip;
 	u64 pte_addr_mask;
+	u32 dirtylog_epoch;
 	struct cpu_mmu_spt_data spt;
+	struct cpu_mmu_tlb tlb;
 	struct cpuid_data cpuid;
 	struct exint_func exint;
+	bool exint_acked;
+	u32 exint_acked_vec[256 / 32];
 	struct gmm_func gmm;
 	struct io_io_data io;
 	struct msr_data msr;
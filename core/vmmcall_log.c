@@ -29,6 +29,7 @@
 
 #ifdef LOG_TO_GUEST
 #include "current.h"
+#include "dirtylog.h"
 #include "initfunc.h"
 #include "mm.h"
 #include "putchar.h"
@@ -36,16 +37,18 @@
 
 static putchar_func_t old;
 static u8 *buf;
-static ulong bufsize, offset;
+static ulong bufphys, bufsize, offset;
 
 static void
 log_putchar (unsigned char c)
 {
 	if (buf) {
-		buf[offset++] = c;
-		if (offset >= bufsize)
+		buf[offset] = c;
+		dirtylog_mark (bufphys + offset, 1);
+		if (++offset >= bufsize)
 			offset = 4;
 		asm_lock_incl ((u32 *)(void *)buf);
+		dirtylog_mark (bufphys, 4);
 	}
 	old (c);
 }
@@ -68,6 +71,7 @@ log_set_buf (void)
 	if (physaddr == 0 || bufsize == 0)
 		return;
 	offset = 4;
+	bufphys = physaddr;
 	buf = mapmem_gphys (physaddr, bufsize, MAPMEM_WRITE);
 	if (old == NULL)
 		putchar_set_func (log_putchar, &old);
@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2007, 2008 University of Tsukuba
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the University of Tsukuba nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* decompression and verification of a packed VMM image in the UEFI
+   entry.  the LZ4 decoder and the SHA-256 block function are called
+   through uefi_entry_call() so that they run on the UEFI page tables
+   and can access the whole VMM area by physical addresses.  they use
+   no global variables for that reason */
+
+#include "entry.h"
+#include "vmmpack.h"
+
+#define SECTION_ENTRY_TEXT __attribute__ ((section (".entry.text")))
+#define SECTION_ENTRY_DATA __attribute__ ((section (".entry.data")))
+#define MS_ABI __attribute__ ((ms_abi))
+#define ROR32(x, n) ((x) >> (n) | (x) << (32 - (n)))
+
+struct vmmpack_header SECTION_ENTRY_DATA vmmpack_header;
+
+static char SECTION_ENTRY_DATA vmmpack_magic[] = VMMPACK_MAGIC;
+
+static u32 SECTION_ENTRY_DATA vmmpack_sha256_h0[8] = {
+	0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+	0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19,
+};
+
+static u32 SECTION_ENTRY_DATA vmmpack_sha256_k[64] = {
+	0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5,
+	0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+	0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3,
+	0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+	0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC,
+	0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+	0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7,
+	0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+	0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13,
+	0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+	0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3,
+	0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+	0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5,
+	0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+	0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208,
+	0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2,
+};
+
+/* the regions may overlap if dst - src is less than 8 */
+static inline void
+vmmpack_copy (u8 *dst, u8 *src, ulong len, ulong dist)
+{
+	if (dist >= 8) {
+		for (; len >= 8; len -= 8, dst += 8, src += 8)
+			*(u64 *)dst = *(u64 *)src;
+	}
+	while (len--)
+		*dst++ = *src++;
+}
+
+/* returns 1 if the block is decoded to exactly p->dstend */
+static u64 MS_ABI SECTION_ENTRY_TEXT
+vmmpack_lz4_decode (struct vmmpack_lz4 *p)
+{
+	u8 *src = p->src, *srcend = p->srcend;
+	u8 *dst = p->dst, *dstend = p->dstend;
+	ulong len, off;
+	u8 token, b;
+
+	while (src < srcend) {
+		token = *src++;
+		len = token >> 4;
+		if (len == 15) {
+			do {
+				if (src >= srcend)
+					return 0;
+				b = *src++;
+				len += b;
+			} while (b == 255);
+		}
+		if (len > (ulong)(srcend - src) || len > (ulong)(dstend - dst))
+			return 0;
+		vmmpack_copy (dst, src, len, 8);
+		dst += len;
+		src += len;
+		if (src == srcend)
+			break;	/* the last sequence has no match */
+		if (srcend - src < 2)
+			return 0;
+		off = src[0] | src[1] << 8;
+		src += 2;
+		if (!off || off > (ulong)(dst - p->base))
+			return 0;
+		len = token & 15;
+		if (len == 15) {
+			do {
+				if (src >= srcend)
+					return 0;
+				b = *src++;
+				len += b;
+			} while (b == 255);
+		}
+		len += 4;
+		if (len > (ulong)(dstend - dst))
+			return 0;
+		vmmpack_copy (dst, dst - off, len, off);
+		dst += len;
+	}
+	p->dst = dst;
+	return dst == dstend;
+}
+
+static u64 MS_ABI SECTION_ENTRY_TEXT
+vmmpack_sha256_blocks (u32 *state, u8 *data, u64 n, u32 *k)
+{
+	u32 w[64], a, b, c, d, e, f, g, h, s0, s1, t1, t2;
+	int i;
+
+	for (; n; n--, data += 64) {
+		for (i = 0; i < 16; i++)
+			w[i] = (u32)data[i * 4] << 24 |
+				(u32)data[i * 4 + 1] << 16 |
+				(u32)data[i * 4 + 2] << 8 | data[i * 4 + 3];
+		for (; i < 64; i++) {
+			s0 = ROR32 (w[i - 15], 7) ^ ROR32 (w[i - 15], 18) ^
+				(w[i - 15] >> 3);
+			s1 = ROR32 (w[i - 2], 17) ^ ROR32 (w[i - 2], 19) ^
+				(w[i - 2] >> 10);
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+		a = state[0]; b = state[1]; c = state[2]; d = state[3];
+		e = state[4]; f = state[5]; g = state[6]; h = state[7];
+		for (i = 0; i < 64; i++) {
+			t1 = h + (ROR32 (e, 6) ^ ROR32 (e, 11) ^ ROR32 (e, 25)) +
+				((e & f) ^ (~e & g)) + k[i] + w[i];
+			t2 = (ROR32 (a, 2) ^ ROR32 (a, 13) ^ ROR32 (a, 22)) +
+				((a & b) ^ (a & c) ^ (b & c));
+			h = g; g = f; f = e; e = d + t1;
+			d = c; c = b; b = a; a = t1 + t2;
+		}
+		state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+		state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+	}
+	return 0;
+}
+
+bool SECTION_ENTRY_TEXT
+vmmpack_packed (void)
+{
+	int i;
+
+	for (i = 0; i < sizeof vmmpack_header.magic; i++)
+		if (vmmpack_header.magic[i] != vmmpack_magic[i])
+			return false;
+	return true;
+}
+
+bool SECTION_ENTRY_TEXT
+vmmpack_decode (struct vmmpack_lz4 *p)
+{
+	return !!uefi_entry_call ((ulong)uefi_entry_virttophys
+				  (vmmpack_lz4_decode), 0,
+				  uefi_entry_virttophys (p));
+}
+
+static void SECTION_ENTRY_TEXT
+vmmpack_sha256 (u32 *state, u8 *data_phys, u64 n)
+{
+	uefi_entry_call ((ulong)uefi_entry_virttophys (vmmpack_sha256_blocks),
+			 0, uefi_entry_virttophys (state), data_phys, n,
+			 uefi_entry_virttophys (vmmpack_sha256_k));
+}
+
+/* image is the physical address of the decompressed image.  the
+   digest covers the whole image including the first VMMPACK_OFFSET
+   bytes, with the sha256 field of the header cleared */
+bool SECTION_ENTRY_TEXT
+vmmpack_verify (u8 *image)
+{
+	struct vmmpack_header *hdr = &vmmpack_header;
+	u64 len = hdr->offset + hdr->size;
+	u64 n = len / 64, bits;
+	u32 state[8], rest;
+	u8 buf[128];
+	int i, nb;
+
+	for (i = 0; i < sizeof hdr->sha256; i++)
+		buf[i] = 0;
+	uefi_entry_pcpy (image + (hdr->sha256 - head),
+			 uefi_entry_virttophys (buf), sizeof hdr->sha256);
+	for (i = 0; i < 8; i++)
+		state[i] = vmmpack_sha256_h0[i];
+	vmmpack_sha256 (state, image, n);
+	rest = len % 64;
+	uefi_entry_pcpy (uefi_entry_virttophys (buf), image + n * 64, rest);
+	nb = rest < 56 ? 1 : 2;
+	buf[rest] = 0x80;
+	for (i = rest + 1; i < nb * 64 - 8; i++)
+		buf[i] = 0;
+	bits = len * 8;
+	for (i = 0; i < 8; i++)
+		buf[nb * 64 - 1 - i] = bits >> (i * 8);
+	vmmpack_sha256 (state, uefi_entry_virttophys (buf), nb);
+	for (i = 0; i < 32; i++)
+		if (hdr->sha256[i] != (u8)(state[i / 4] >> (24 - i % 4 * 8)))
+			return false;
+	return true;
+}
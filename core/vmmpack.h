@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2007, 2008 University of Tsukuba
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the University of Tsukuba nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _CORE_VMMPACK_H
+#define _CORE_VMMPACK_H
+
+#include "types.h"
+
+/* packed VMM image made by tools/vmmpack.  the first VMMPACK_OFFSET
+   bytes are the same as bitvisor.elf except vmmpack_header, and the
+   rest of the image up to dataend follows as a sequence of
+   struct vmmpack_block and LZ4 block data.  matches may refer to
+   the output of previous blocks */
+
+#define VMMPACK_MAGIC		"BVMMPACK"
+#define VMMPACK_VERSION		2
+#define VMMPACK_OFFSET		0x10000
+#define VMMPACK_BLOCKSIZE	0x10000
+
+struct vmmpack_header {
+	u8 magic[8];
+	u32 version;
+	u32 offset;		/* start of the compressed part */
+	u64 size;		/* bytes after offset */
+	u64 packed_size;	/* bytes of the block sequence */
+	u8 sha256[32];		/* digest of the image, this field zero */
+} __attribute__ ((packed));
+
+struct vmmpack_block {
+	u32 csize;
+	u32 usize;
+} __attribute__ ((packed));
+
+/* physical addresses */
+struct vmmpack_lz4 {
+	u8 *src, *srcend;
+	u8 *base, *dst, *dstend;
+};
+
+extern struct vmmpack_header vmmpack_header;
+
+bool vmmpack_packed (void);
+bool vmmpack_decode (struct vmmpack_lz4 *p);
+bool vmmpack_verify (u8 *image);
+
+#endif
@@ -32,7 +32,10 @@
 #include "initfunc.h"
 #include "mm.h"
 #include "process.h"
+#include "spinlock.h"
 #include "string.h"
+#include "time.h"
+#include "timer.h"
 #include "types.h"
 #include "uefi.h"
 #include "vga.h"
@@ -40,6 +43,9 @@
 
 #define CRTC_SCROLL 0xC
 #define CRTC_CURSOR_POS 0xE
+#define CON_COLS 80
+#define CON_ROWS 25
+#define CON_FLUSH_INTERVAL 20000 /* usec */
 
 static u8 *vram_virtaddr;
 static u16 saved_cursor_pos;
@@ -48,6 +54,18 @@ static int fontx, fonty, fontlen;
 static bool fontcompressed;
 static u32 *scrollbuf;
 
+/* Graphics-mode console.  Characters are kept in a text shadow
+ * buffer, rotated by con_top on scrolling, and only the dirty columns
+ * of each screen row are drawn.  Drawing is done at most once per
+ * CON_FLUSH_INTERVAL; output in between is flushed by a timer. */
+static u8 con_text[CON_ROWS][CON_COLS];
+static int con_top, con_x, con_y;
+static u8 con_dirty_x0[CON_ROWS], con_dirty_x1[CON_ROWS];
+static bool con_dirty, con_sync, con_timer_set;
+static u64 con_flush_time;
+static void *con_timer;
+static spinlock_t con_lock = SPINLOCK_INITIALIZER;
+
 #ifdef TTY_VGA
 /* font data converted from mplus_f12r.bdf
 M+ BITMAP FONTS            Copyright 2002-2005  COZ <coz@users.sourceforge.jp>
@@ -414,73 +432,141 @@ vramwrite_clearscreen (void)
 	move_cursor_pos (0);
 }
 
-static int
-vramwrite_vga_putchar (unsigned char c)
+static void
+con_mark_dirty (int y, int x0, int x1)
+{
+	if (con_dirty_x0[y] >= con_dirty_x1[y]) {
+		con_dirty_x0[y] = x0;
+		con_dirty_x1[y] = x1;
+	} else {
+		if (con_dirty_x0[y] > x0)
+			con_dirty_x0[y] = x0;
+		if (con_dirty_x1[y] < x1)
+			con_dirty_x1[y] = x1;
+	}
+	con_dirty = true;
+}
+
+static void
+con_draw_glyph (u32 *dst, int stride, unsigned char c)
 {
-	static int x, y;
 	static u32 buf[16][8];
 	int i, j;
 	u8 *p, b;
 
+	p = &font[c * fontlen];
+	for (i = 0; i < fonty; i++) {
+		b = *p++;
+		for (j = 0; j < fontx; j++)
+			buf[i][j] = ((b << j) & 0x80) ? 0xFF00FF00 : 0;
+		if (fontcompressed) {
+			j = (i & 3) << 1;
+			buf[i | 3][j + 0] = (b & 2) ? 0xFF00FF00 : 0;
+			buf[i | 3][j + 1] = (b & 1) ? 0xFF00FF00 : 0;
+			if (i & 2)
+				i++;
+		}
+	}
+	for (i = 0; i < fonty; i++)
+		memcpy (&dst[i * stride], buf[i], fontx * sizeof buf[0][0]);
+}
+
+/* Called with con_lock held */
+static void
+con_flush (void)
+{
+	int x, y, x0, x1, stride;
+	u8 *line;
+
+	if (!con_dirty)
+		return;
+	con_dirty = false;
+	stride = fontx * CON_COLS;
+	for (y = 0; y < CON_ROWS; y++) {
+		x0 = con_dirty_x0[y];
+		x1 = con_dirty_x1[y];
+		if (x0 >= x1)
+			continue;
+		con_dirty_x0[y] = con_dirty_x1[y] = 0;
+		line = con_text[(con_top + y) % CON_ROWS];
+		for (x = x0; x < x1; x++)
+			con_draw_glyph (&scrollbuf[x * fontx], stride,
+					line[x]);
+		vga_transfer_image (VGA_FUNC_TRANSFER_DIR_PUT,
+				    &scrollbuf[x0 * fontx],
+				    VGA_FUNC_IMAGE_TYPE_BGRX_8888,
+				    stride * sizeof scrollbuf[0],
+				    (x1 - x0) * fontx, fonty, x0 * fontx,
+				    y * fonty);
+	}
+	con_flush_time = get_time ();
+}
+
+static void
+con_timer_callback (void *handle, void *data)
+{
+	spinlock_lock (&con_lock);
+	con_timer_set = false;
+	con_flush ();
+	spinlock_unlock (&con_lock);
+}
+
+static void
+con_scroll_up (void)
+{
+	int y;
+
+	memset (con_text[con_top], ' ', CON_COLS);
+	con_top = (con_top + 1) % CON_ROWS;
+	for (y = 0; y < CON_ROWS; y++)
+		con_mark_dirty (y, 0, CON_COLS);
+}
+
+static int
+vramwrite_vga_putchar (unsigned char c)
+{
+	u64 now;
+
 	if (!font)
 		return 0;
 	if (!vga_is_ready ())
 		return 0;
+	spinlock_lock (&con_lock);
 	switch (c) {
 	case '\b':
-		if (x)
-			x--;
-		else if (y)
-			x = 79, y--;
+		if (con_x)
+			con_x--;
+		else if (con_y)
+			con_x = CON_COLS - 1, con_y--;
 		break;
 	case '\r':
-		x = 0;
+		con_x = 0;
 		break;
 	default:
-		p = &font[c * fontlen];
-		for (i = 0; i < fonty; i++) {
-			b = *p++;
-			for (j = 0; j < fontx; j++)
-				buf[i][j] = ((b << j) & 0x80) ? 0xFF00FF00 : 0;
-			if (fontcompressed) {
-				j = (i & 3) << 1;
-				buf[i | 3][j + 0] = (b & 2) ? 0xFF00FF00 : 0;
-				buf[i | 3][j + 1] = (b & 1) ? 0xFF00FF00 : 0;
-				if (i & 2)
-					i++;
-			}
-		}
-		vga_transfer_image (VGA_FUNC_TRANSFER_DIR_PUT, buf,
-				    VGA_FUNC_IMAGE_TYPE_BGRX_8888,
-				    sizeof buf[0], fontx, fonty, x * fontx,
-				    y * fonty);
-		x++;
-		if (x <= 79)
+		con_text[(con_top + con_y) % CON_ROWS][con_x] = c;
+		con_mark_dirty (con_y, con_x, con_x + 1);
+		con_x++;
+		if (con_x < CON_COLS)
 			break;
 		/* fall through */
 	case '\n':
-		x = 0;
-		y++;
-		if (y <= 24)
+		con_x = 0;
+		con_y++;
+		if (con_y < CON_ROWS)
 			break;
-		for (i = 0; i < 24; i++) {
-			vga_transfer_image (VGA_FUNC_TRANSFER_DIR_GET,
-					    scrollbuf,
-					    VGA_FUNC_IMAGE_TYPE_BGRX_8888,
-					    sizeof scrollbuf[0] * fontx * 80,
-					    fontx * 80, fonty, 0,
-					    (i + 1) * fonty);
-			vga_transfer_image (VGA_FUNC_TRANSFER_DIR_PUT,
-					    scrollbuf,
-					    VGA_FUNC_IMAGE_TYPE_BGRX_8888,
-					    sizeof scrollbuf[0] * fontx * 80,
-					    fontx * 80, fonty, 0, i * fonty);
-		}
-		scrollbuf[0] = 0;
-		vga_fill_rect (scrollbuf, VGA_FUNC_IMAGE_TYPE_BGRX_8888,
-			       0, 24 * fonty, fontx * 80, fonty);
-		y = 24;
+		con_scroll_up ();
+		con_y = CON_ROWS - 1;
+	}
+	now = get_time ();
+	if (con_sync || !con_timer ||
+	    now - con_flush_time >= CON_FLUSH_INTERVAL) {
+		con_flush ();
+	} else if (!con_timer_set) {
+		con_timer_set = true;
+		timer_set (con_timer, CON_FLUSH_INTERVAL -
+			   (now - con_flush_time));
 	}
+	spinlock_unlock (&con_lock);
 	return 0;
 }
 
@@ -649,8 +735,31 @@ vramwrite_init_bsp (void)
 		if (!uefi_booted)
 			vramwrite_get_biosfont ();
 		scrollbuf = alloc (80 * fontx * fonty * sizeof scrollbuf[0]);
+		memset (con_text, ' ', sizeof con_text);
 	}
 }
 
+static void
+vramwrite_init_timer (void)
+{
+	if (font)
+		con_timer = timer_new (con_timer_callback, NULL);
+}
+
+/* Draw pending output at once and stop deferring, since the timer
+ * thread may not run any more. */
+static void
+vramwrite_panic (void)
+{
+	if (!font)
+		return;
+	spinlock_lock (&con_lock);
+	con_sync = true;
+	con_flush ();
+	spinlock_unlock (&con_lock);
+}
+
 INITFUNC ("msg0", vramwrite_init_msg);
 INITFUNC ("bsp0", vramwrite_init_bsp);
+INITFUNC ("driver0", vramwrite_init_timer);
+INITFUNC ("panic0", vramwrite_panic);
@@ -159,7 +159,9 @@ vt_update_exint (void)
 	pass = current->u.vt.exint_pass;
 	pending = current->u.vt.exint_pending;
 	if (pass && current->u.vt.vr.re) {
-		if (current->u.vt.exint_re_pending)
+		/* held vectors must be injected before external
+		   interrupts are exited on again */
+		if (current->u.vt.exint_re_pending || current->exint_acked)
 			pending = true;
 		else
 			pass = false;
@@ -31,6 +31,7 @@
 #include "constants.h"
 #include "convert.h"
 #include "current.h"
+#include "dirtylog.h"
 #include "gmm_access.h"
 #include "mm.h"
 #include "panic.h"
@@ -48,6 +49,7 @@
 #define EPTE_ATTR_MASK	0xFFF
 #define EPTE_MT_SHIFT	3
 #define EPT_LEVELS	4
+#define PML_ENTRIES	512
 
 struct vt_ept {
 	int cnt;
@@ -56,6 +58,9 @@ struct vt_ept {
 	phys_t ncr3tbl_phys;
 	void *tbl[NUM_OF_EPTBL];
 	phys_t tbl_phys[NUM_OF_EPTBL];
+	bool tracking;		/* dirty logging: no 2MiB pages */
+	u64 *pml;		/* page-modification log, NULL if unsupported */
+	phys_t pml_phys;
 	struct {
 		int level;
 		phys_t gphys;
@@ -67,6 +72,8 @@ void
 vt_ept_init (void)
 {
 	struct vt_ept *ept;
+	u32 ctls2_or, ctls2_and;
+	u64 ept_vpid_cap;
 	int i;
 
 	ept = alloc (sizeof *ept);
@@ -77,6 +84,13 @@ vt_ept_init (void)
 		alloc_page (&ept->tbl[i], &ept->tbl_phys[i]);
 	ept->cnt = 0;
 	ept->cur.level = EPT_LEVELS;
+	ept->tracking = false;
+	ept->pml = NULL;
+	asm_rdmsr32 (MSR_IA32_VMX_PROCBASED_CTLS2, &ctls2_or, &ctls2_and);
+	asm_rdmsr64 (MSR_IA32_VMX_EPT_VPID_CAP, &ept_vpid_cap);
+	if ((ctls2_and & VMCS_PROC_BASED_VMEXEC_CTL2_ENABLE_PML_BIT) &&
+	    (ept_vpid_cap & MSR_IA32_VMX_EPT_VPID_CAP_EPT_AD_BIT))
+		alloc_page ((void **)&ept->pml, &ept->pml_phys);
 	current->u.vt.ept = ept;
 	asm_vmwrite64 (VMCS_EPT_POINTER, ept->ncr3tbl_phys |
 		       VMCS_EPT_POINTER_EPT_WB | VMCS_EPT_PAGEWALK_LENGTH_4);
@@ -158,6 +172,14 @@ vt_ept_map_page_sub (struct vt_ept *ept, bool write, u64 gphys)
 		EPTE_READEXEC | EPTE_WRITE;
 	if (fakerom)
 		hattr &= ~EPTE_WRITE;
+	else if (ept->tracking && !ept->pml) {
+		/* write-protect until the first write in this epoch */
+		if (write)
+			dirtylog_mark_epoch (current->dirtylog_epoch, gphys,
+					     DIRTYLOG_SOURCE_WP);
+		else
+			hattr &= ~EPTE_WRITE;
+	}
 	*p = hphys | hattr;
 }
 
@@ -168,6 +190,8 @@ vt_ept_map_2mpage (struct vt_ept *ept, u64 gphys)
 	u32 hattr;
 	u64 *p;
 
+	if (ept->tracking)
+		return true;
 	cur_move (ept, gphys);
 	if (!ept->cur.level)
 		return true;
@@ -258,6 +282,92 @@ vt_ept_tlbflush (void)
 {
 }
 
+static void
+vt_ept_pml_drain (struct vt_ept *ept)
+{
+	ulong index;
+	int i;
+
+	asm_vmread (VMCS_GUEST_PML_INDEX, &index);
+	/* the index wraps to 0xFFFF when the log is full */
+	i = (index & 0xFFFF) >= PML_ENTRIES ? 0 : index + 1;
+	for (; i < PML_ENTRIES; i++)
+		dirtylog_mark_epoch (current->dirtylog_epoch, ept->pml[i],
+				     DIRTYLOG_SOURCE_PML);
+	asm_vmwrite (VMCS_GUEST_PML_INDEX, PML_ENTRIES - 1);
+}
+
+static void
+vt_ept_pml_enable (struct vt_ept *ept, bool enable)
+{
+	ulong ctl2;
+	u64 eptp;
+
+	asm_vmread (VMCS_PROC_BASED_VMEXEC_CTL2, &ctl2);
+	asm_vmread64 (VMCS_EPT_POINTER, &eptp);
+	if (enable) {
+		asm_vmwrite64 (VMCS_PML_ADDR, ept->pml_phys);
+		asm_vmwrite (VMCS_GUEST_PML_INDEX, PML_ENTRIES - 1);
+		/* PML requires EPT; see also vt_paging_pg_change() */
+		if (ctl2 & VMCS_PROC_BASED_VMEXEC_CTL2_ENABLE_EPT_BIT)
+			ctl2 |= VMCS_PROC_BASED_VMEXEC_CTL2_ENABLE_PML_BIT;
+		eptp |= VMCS_EPT_POINTER_AD_BIT;
+	} else {
+		ctl2 &= ~VMCS_PROC_BASED_VMEXEC_CTL2_ENABLE_PML_BIT;
+		eptp &= ~VMCS_EPT_POINTER_AD_BIT;
+	}
+	asm_vmwrite (VMCS_PROC_BASED_VMEXEC_CTL2, ctl2);
+	asm_vmwrite64 (VMCS_EPT_POINTER, eptp);
+}
+
+/* called before VM entry.  when the dirty log epoch has changed,
+   flush the log of the previous epoch and clear the EPT so that
+   the new epoch starts with write-protected (or clean) entries */
+void
+vt_ept_dirtylog (void)
+{
+	struct vt_ept *ept;
+	u32 epoch;
+	bool tracking;
+
+	epoch = dirtylog_epoch ();
+	if (current->dirtylog_epoch == epoch)
+		return;
+	ept = current->u.vt.ept;
+	tracking = dirtylog_tracking ();
+	if (ept->pml) {
+		if (ept->tracking)
+			vt_ept_pml_drain (ept);
+		if (ept->tracking != tracking)
+			vt_ept_pml_enable (ept, tracking);
+	}
+	ept->tracking = tracking;
+	current->dirtylog_epoch = epoch;
+	vt_ept_clear_all ();
+}
+
+ulong
+vt_ept_ctl2_pml (void)
+{
+	struct vt_ept *ept;
+
+	ept = current->u.vt.ept;
+	if (ept->pml && ept->tracking)
+		return VMCS_PROC_BASED_VMEXEC_CTL2_ENABLE_PML_BIT;
+	return 0;
+}
+
+void
+vt_ept_pml_full (void)
+{
+	struct vt_ept *ept;
+
+	ept = current->u.vt.ept;
+	if (!ept->pml)
+		panic ("%s: PML is not enabled", __func__);
+	vt_ept_pml_drain (ept);
+}
+
 void
 vt_ept_updatecr3 (void)
 {
@@ -41,5 +41,8 @@ void vt_ept_updatecr3 (void);
 void vt_ept_clear_all (void);
 bool vt_ept_extern_mapsearch (struct vcpu *p, phys_t start, phys_t end);
 void vt_ept_map_1mb (void);
+void vt_ept_dirtylog (void);
+ulong vt_ept_ctl2_pml (void);
+void vt_ept_pml_full (void);
 
 #endif
@@ -208,6 +208,9 @@ message_exitreason (int num)
 	case EXIT_REASON_VMFUNC:
 		m = "VMFUNC";
 		break;
+	case EXIT_REASON_PML_FULL:
+		m = "Page-modification log full";
+		break;
 	default:
 		m = "unknown error";
 	}
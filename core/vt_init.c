@@ -212,7 +212,7 @@ vt__vmcs_init (void)
 	u32 entry_ctls_or, entry_ctls_and;
 	ulong sysenter_cs, sysenter_esp, sysenter_eip;
 	ulong exitctl64;
-	ulong exitctl_efer = 0, entryctl_efer = 0;
+	ulong exitctl_efer = 0, entryctl_efer = 0, exitctl_ack = 0;
 	u64 host_efer;
 	u32 procbased_ctls2_or, procbased_ctls2_and = 0;
 	ulong procbased_ctls2 = 0;
@@ -254,6 +254,7 @@ vt__vmcs_init (void)
 	current->u.vt.save_load_efer_enable = false;
 	current->u.vt.exint_pass = true;
 	current->u.vt.exint_pending = false;
+	current->u.vt.exint_ack = false;
 	current->u.vt.cr3exit_controllable = vt_cr3exit_controllable ();
 	current->u.vt.cr3exit_off = false;
 	alloc_page (&current->u.vt.vi.vmcs_region_virt,
@@ -316,6 +317,12 @@ vt__vmcs_init (void)
 		exitctl_efer |= VMCS_VMEXIT_CTL_LOAD_IA32_EFER_BIT;
 		entryctl_efer |= VMCS_VMENTRY_CTL_LOAD_IA32_EFER_BIT;
 	}
+	/* get the vector of an external interrupt from the VM-exit
+	 * interruption information instead of taking it in VMM */
+	if (exit_ctls_and & VMCS_VMEXIT_CTL_ACK_INTR_ON_EXIT_BIT) {
+		current->u.vt.exint_ack = true;
+		exitctl_ack = VMCS_VMEXIT_CTL_ACK_INTR_ON_EXIT_BIT;
+	}
 
 	/* get current information */
 	vt_get_current_regs_in_vmcs (&host_riv);
@@ -379,7 +386,7 @@ vt__vmcs_init (void)
 	asm_vmwrite (VMCS_PAGEFAULT_ERRCODE_MATCH, 0);
 	asm_vmwrite (VMCS_CR3_TARGET_COUNT, 0);
 	asm_vmwrite (VMCS_VMEXIT_CTL, (exit_ctls_or & exit_ctls_and) |
-		     exitctl64 | exitctl_efer);
+		     exitctl64 | exitctl_efer | exitctl_ack);
 	asm_vmwrite (VMCS_VMEXIT_MSR_STORE_COUNT, 0);
 	asm_vmwrite (VMCS_VMEXIT_MSR_LOAD_COUNT, 0);
 	asm_vmwrite (VMCS_VMENTRY_CTL, (entry_ctls_or & entry_ctls_and) |
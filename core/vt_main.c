@@ -33,6 +33,7 @@
 #include "cpu_emul.h"
 #include "cpu_mmu.h"
 #include "current.h"
+#include "deferred.h"
 #include "exint_pass.h"
 #include "gmm_pass.h"
 #include "initfunc.h"
@@ -809,10 +810,12 @@ do_re_external_int (void)
 
 	vt_read_flags (&rflags);
 	if (rflags & RFLAGS_IF_BIT) {
-		num = do_externalint_enable ();
+		num = exint_pass_take ();
+		if (num < 0)
+			num = do_externalint_enable ();
 		if (num >= 0)
 			vt_generate_external_int (num);
-		current->u.vt.exint_re_pending = false;
+		current->u.vt.exint_re_pending = current->exint_acked;
 		current->u.vt.exint_update = true;
 	} else {
 		current->u.vt.exint_re_pending = true;
@@ -823,17 +826,32 @@ do_re_external_int (void)
 static void
 do_external_int (void)
 {
-	if (current->u.vt.vr.re && current->u.vt.exint_pass)
+	union {
+		struct intr_info s;
+		ulong v;
+	} vii;
+
+	vii.v = 0;
+	if (current->u.vt.exint_ack)
+		asm_vmread (VMCS_VMEXIT_INTR_INFO, &vii.v);
+	if (vii.s.valid != INTR_INFO_VALID_VALID) {
+		if (current->u.vt.vr.re && current->u.vt.exint_pass)
+			do_re_external_int ();
+		else
+			do_exint_pass ();
+	} else if (current->u.vt.vr.re && current->u.vt.exint_pass) {
+		exint_pass_hold (vii.s.vector);
 		do_re_external_int ();
-	else
-		do_exint_pass ();
+	} else {
+		do_exint_pass_acked (vii.s.vector);
+	}
 }
 
 static void
 do_interrupt_window (void)
 {
-	if (current->u.vt.exint_re_pending && current->u.vt.vr.re &&
-	    current->u.vt.exint_pass)
+	if ((current->u.vt.exint_re_pending || current->exint_acked) &&
+	    current->u.vt.vr.re && current->u.vt.exint_pass)
 		do_re_external_int ();
 	if (current->u.vt.exint_pending)
 		current->exint.hlt ();
@@ -902,6 +920,9 @@ vt__exit_reason (void)
 	case EXIT_REASON_NMI_WINDOW:
 		do_nmi_window ();
 		break;
+	case EXIT_REASON_PML_FULL:
+		vt_paging_pml_full ();
+		break;
 	default:
 		printf ("Fatal error: handler not implemented.\n");
 		printexitreason (exit_reason);
@@ -1011,6 +1032,8 @@ vt_mainloop (void)
 		schedule ();
 		vt_vmptrld (current->u.vt.vi.vmcs_region_phys);
 		panic_test ();
+		vt_paging_dirtylog ();
+		deferred_run (current->halt);
 		if (current->halt) {
 			vt__halt ();
 			current->halt = false;
@@ -28,6 +28,7 @@
  */
 
 #include "convert.h"
+#include "cpu_mmu.h"
 #include "cpu_mmu_spt.h"
 #include "current.h"
 #include "panic.h"
@@ -113,18 +114,23 @@ void
 vt_paging_tlbflush (void)
 {
 #ifdef CPU_MMU_SPT_DISABLE
-	if (current->u.vt.vr.pg)
+	if (current->u.vt.vr.pg) {
+		cpu_mmu_tlb_flush ();
 		return;
+	}
 #endif
-	if (ept_enabled ())
+	if (ept_enabled ()) {
+		/* Guest INVLPG and CR3 writes are not intercepted */
+		cpu_mmu_tlb_flush ();
 		vt_ept_tlbflush ();
-	else
+	} else
 		cpu_mmu_spt_tlbflush ();
 }
 
 void
 vt_paging_invalidate (ulong addr)
 {
+	cpu_mmu_tlb_invalidate (addr);
 #ifdef CPU_MMU_SPT_DISABLE
 	if (current->u.vt.vr.pg) {
 		vt_paging_flush_guest_tlb ();
@@ -137,6 +143,22 @@ vt_paging_invalidate (ulong addr)
 		cpu_mmu_spt_invalidate (addr);
 }
 
+void
+vt_paging_dirtylog (void)
+{
+	if (current->u.vt.ept)
+		vt_ept_dirtylog ();
+}
+
+void
+vt_paging_pml_full (void)
+{
+	if (ept_enabled ())
+		vt_ept_pml_full ();
+	else
+		panic ("PML full while ept disabled");
+}
+
 void
 vt_paging_npf (bool write, u64 gphys)
 {
@@ -162,6 +184,7 @@ vt_update_vmcs_guest_cr3 (void)
 void
 vt_paging_updatecr3 (void)
 {
+	cpu_mmu_tlb_flush ();
 #ifdef CPU_MMU_SPT_DISABLE
 	if (current->u.vt.vr.pg) {
 		vt_update_vmcs_guest_cr3 ();
@@ -192,6 +215,7 @@ vt_paging_spt_setcr3 (ulong cr3)
 void
 vt_paging_clear_all (void)
 {
+	cpu_mmu_tlb_flush ();
 	if (current->u.vt.ept)
 		vt_ept_clear_all ();
 	if (!current->u.vt.unrestricted_guest)
@@ -270,6 +294,7 @@ vt_paging_pg_change (void)
 	bool ept_enable, use_spt;
 	ulong cr3;
 
+	cpu_mmu_tlb_flush ();
 	ept_enable = ept_enabled ();
 	use_spt = !ept_enable;
 #ifdef CPU_MMU_SPT_DISABLE
@@ -302,9 +327,11 @@ vt_paging_pg_change (void)
 	if (current->u.vt.ept) {
 		asm_vmread (VMCS_PROC_BASED_VMEXEC_CTL2, &tmp);
 		tmp &= ~(VMCS_PROC_BASED_VMEXEC_CTL2_ENABLE_EPT_BIT |
-			 VMCS_PROC_BASED_VMEXEC_CTL2_UNRESTRICTED_GUEST_BIT);
+			 VMCS_PROC_BASED_VMEXEC_CTL2_UNRESTRICTED_GUEST_BIT |
+			 VMCS_PROC_BASED_VMEXEC_CTL2_ENABLE_PML_BIT);
 		tmp |= ept_enable ?
 			VMCS_PROC_BASED_VMEXEC_CTL2_ENABLE_EPT_BIT |
+			vt_ept_ctl2_pml () |
 			(current->u.vt.unrestricted_guest ?
 			 VMCS_PROC_BASED_VMEXEC_CTL2_UNRESTRICTED_GUEST_BIT :
 			 0) : 0;
@@ -46,11 +46,17 @@
 #define PxCMD_CR_BIT		0x8000
 #define PxSSTS_DET_MASK		0xF
 #define PxSSTS_DET_MASK_NODEV	0x0
+#define PxSSTS_DET_MASK_PRESENT	0x3
+#define PxIS_TFES_BIT		0x40000000
+#define PxTFD_ERR_ABRT		0x0451 /* ERR=ABRT, STS=DRDY|DSC|ERR */
+#define PxTFD_STS_ERR_BIT	0x1
+#define PANIC_DUMP_TIMEOUT	10000000
 #define NUM_OF_COMMAND_HEADER	32
 #define GLOBAL_CAP		0x00
 #define GLOBAL_CAP_SNCQ_BIT	0x40000000
 #define GLOBAL_CAP_NCS_MASK	0x1F00
 #define GLOBAL_CAP_NCS_SHIFT	8
+#define VMM_TAGS_WAIT_USEC	100000
 #define GLOBAL_CAP_NP_MASK	0x1F
 #define GLOBAL_GHC		0x04
 #define GLOBAL_GHC_AE_BIT	0x80000000
@@ -71,6 +77,7 @@ enum port_off {
 	PxIS   = 0x10, /* Port x Interrupt Status */
 	PxIE   = 0x14, /* Port x Interrupt Enable */
 	PxCMD  = 0x18, /* Port x Command and Status */
+	PxTFD  = 0x20, /* Port x Task File Data */
 	PxSSTS = 0x28, /* Port x Serial ATA Status (SCR0: SStatus) */
 	PxSACT = 0x34, /* Port x Serial ATA Active (SCR3: SActive) */
 	PxCI   = 0x38, /* Port x Command Issue */
@@ -194,6 +201,14 @@ struct ahci_port {
 	u32 shadowbit;
 	u32 myclb, myclbu;
 	struct command_list *mycmdlist;
+	bool ncq_seen;		/* the guest uses NCQ on this port */
+	u32 vmm_busy;		/* reserved slots issued by the VMM */
+	u32 vmm_stale;		/* timed out reserved slots */
+	u32 vmm_abort;		/* reserved slots aborted by the guest */
+	u32 vmm_deferred_ci;	/* guest PxCI write held back */
+	u64 vmm_deferred_time;
+	u32 guest_err_ci;	/* slots failed by the storage handler */
+	bool guest_err_tfes;	/* PxIS.TFES reported for them */
 	struct {
 		struct command_table *cmdtbl;
 		phys_t cmdtbl_p;
@@ -205,6 +220,7 @@ struct ahci_port {
 		u32 dmabuf_ssiz;
 		int dmabuf_rwflag;
 		enum identify_type dmabuf_identify;
+		bool dmabuf_ncqlog;
 	} my[NUM_OF_COMMAND_HEADER];
 };
 
@@ -278,6 +294,7 @@ struct ahci_command_list {
 	u64 start_time;
 	int port_no, dev_no;
 	int slot;
+	bool reserved;		/* issued on a reserved NCQ slot */
 };
 
 struct ahci_data {
@@ -293,13 +310,31 @@ struct ahci_data {
 	struct storage_hc_driver *hc;
 	u32 pi;
 	unsigned int ncs;	/* Number of command slots */
+	u32 vmm_slots;		/* NCQ slots hidden from the guest */
+	unsigned int vmm_tags;	/* number of bits in vmm_slots */
 	spinlock_t ahci_cmd_lock;
 	LIST2_DEFINE_HEAD (ahci_cmd_list, struct ahci_command_list, list);
 	bool ahci_cmd_thread;
+	bool removed;		/* the controller has been unplugged */
+	struct ahci_panic_dump *panic_dump;
 	u32 idp_index, idp_offset, idp_config;
 };
 
+struct ahci_panic_dump {
+	struct ahci_data *ad;
+	int port_num;
+	bool started;
+	void *fis;
+	phys_t fis_phys;
+};
+
 static void ahci_ae_bit_changed (struct ahci_data *ad);
+static void ahci_free (struct ahci_data *ad);
+static void ahci_command_fill (struct ahci_port *port, int slot,
+			       struct storage_hc_dev_atacmd *cmd);
+static void ahci_vmm_tags_abort (struct ahci_data *ad, int port_num);
+static void ahci_vmm_tags_resume (struct ahci_data *ad, int port_num,
+				  bool abort);
 
 /************************************************************/
 /* I/O functions */
@@ -393,49 +428,66 @@ ahci_get_dmalen (struct command_table *cmdtbl, u16 prdtl, unsigned int *intr)
 	return totalsize;
 }
 
-static void
+/* copy between the guest buffers in the PRDT and the shadow buffer.
+   sectors of a read/write command are encrypted or decrypted on the
+   way without another pass over the shadow buffer.  false is
+   returned if the storage handler could not handle the sectors. */
+static bool
 ahci_copy_dmabuf (struct ahci_port *port, int cmdhdr_index, bool wr,
 		  struct command_table *cmdtbl, u16 prdtl)
 {
 	u8 *mybuf = port->my[cmdhdr_index].dmabuf;
 	u32 dba, dbau, dbc;
 	phys_t db_phys;
-	void *gbuf;
+	struct storage_iovec *iov, shadow;
+	struct storage_access access;
 	int i;
 	u32 remain;
+	bool ok = true;
 
 	ASSERT (mybuf);
 	remain = port->my[cmdhdr_index].dmabuflen;
-	if (wr) {
-		/* copy guest buffer to shadow buffer */
-		for (i = 0; i < prdtl; i++) {
-			dba = cmdtbl->prdt[i].dba;
-			dbau = cmdtbl->prdt[i].dbau;
-			dbc = (cmdtbl->prdt[i].dbc & 0x3FFFFE) + 2;
-			ASSERT (remain >= dbc);
-			remain -= dbc;
-			db_phys = ahci_get_phys (dba & ~1, dbau);
-			gbuf = mapmem_gphys (db_phys, dbc, 0);
-			memcpy (mybuf, gbuf, dbc);
-			mybuf += dbc;
-			unmapmem (gbuf, dbc);
-		}
+	iov = alloc (sizeof *iov * prdtl);
+	for (i = 0; i < prdtl; i++) {
+		dba = cmdtbl->prdt[i].dba;
+		dbau = cmdtbl->prdt[i].dbau;
+		dbc = (cmdtbl->prdt[i].dbc & 0x3FFFFE) + 2;
+		ASSERT (remain >= dbc);
+		remain -= dbc;
+		db_phys = ahci_get_phys (dba & ~1, dbau);
+		iov[i].base = mapmem_gphys (db_phys, dbc,
+					    wr ? 0 : MAPMEM_WRITE);
+		iov[i].len = dbc;
+	}
+	ASSERT (remain == 0);
+	if (port->my[cmdhdr_index].dmabuf_rwflag) {
+		access.rw = wr ? STORAGE_WRITE : STORAGE_READ;
+		access.lba = port->my[cmdhdr_index].dmabuf_lba;
+		access.count = port->my[cmdhdr_index].dmabuf_nsec;
+		access.sector_size = port->my[cmdhdr_index].dmabuf_ssiz;
+		shadow.base = mybuf;
+		shadow.len = port->my[cmdhdr_index].dmabuflen;
+		if (wr)
+			ok = !storage_handle_sectors_iov
+				(port->storage_device, &access, iov, prdtl,
+				 &shadow, 1);
+		else
+			ok = !storage_handle_sectors_iov
+				(port->storage_device, &access, &shadow, 1,
+				 iov, prdtl);
 	} else {
-		/* copy shadow buffer to guest buffer */
 		for (i = 0; i < prdtl; i++) {
-			dba = cmdtbl->prdt[i].dba;
-			dbau = cmdtbl->prdt[i].dbau;
-			dbc = (cmdtbl->prdt[i].dbc & 0x3FFFFE) + 2;
-			ASSERT (remain >= dbc);
-			remain -= dbc;
-			db_phys = ahci_get_phys (dba & ~1, dbau);
-			gbuf = mapmem_gphys (db_phys, dbc, MAPMEM_WRITE);
-			memcpy (gbuf, mybuf, dbc);
-			mybuf += dbc;
-			unmapmem (gbuf, dbc);
+			if (wr)
+				memcpy (mybuf, iov[i].base, iov[i].len);
+			else
+				memcpy (iov[i].base, mybuf, iov[i].len);
+			mybuf += iov[i].len;
 		}
 	}
-	ASSERT (remain == 0);
+	for (i = 0; i < prdtl; i++)
+		unmapmem (iov[i].base, iov[i].len);
+	free (iov);
+	return ok;
 }
 
 static bool
@@ -478,7 +530,7 @@ err:
 static bool
 ahci_probe (struct ahci_data *ad, bool wrote_ghc, u32 value)
 {
-	int n;
+	int n, i;
 	u32 cap, ghc, pi;
 	unsigned int num_of_ports;
 
@@ -528,6 +580,16 @@ ahci_probe (struct ahci_data *ad, bool wrote_ghc, u32 value)
 	ad->hc_addr.num_ports = num_of_ports;
 	ad->hc_addr.ncq = !!(cap & GLOBAL_CAP_SNCQ_BIT);
 	ad->ncs = ((cap & GLOBAL_CAP_NCS_MASK) >> GLOBAL_CAP_NCS_SHIFT) + 1;
+	/* reserve the highest slots for VMM-originated NCQ commands */
+	ad->vmm_slots = 0;
+	ad->vmm_tags = 0;
+	n = config.vmm.driver.ahci_vmm_tags;
+	if (ad->hc_addr.ncq && n > 0 && n < ad->ncs) {
+		for (i = ad->ncs - n; i < ad->ncs; i++)
+			ad->vmm_slots |= 1 << i;
+		ad->vmm_tags = n;
+		printf ("AHCI: %d NCQ tags reserved\n", n);
+	}
 	ahci_ae_bit_changed (ad);
 	return true;
 not_ahci:
@@ -584,6 +646,138 @@ wait_for_pxcmd (struct ahci_data *ad, int port_num, u32 mask, u32 value)
 	return i;
 }
 
+/************************************************************/
+/* Crash dump */
+
+/* The other processors are frozen when this is called.  Take the
+   port over with a private FIS area and issue commands on slot 0 by
+   polling; the guest state is not restored since the system is
+   rebooted after the dump. */
+static bool
+ahci_panic_dump_start (struct ahci_panic_dump *pd)
+{
+	struct ahci_data *ad = pd->ad;
+	int pno = pd->port_num;
+	struct ahci_port *port = &ad->port[pno];
+	u32 pxcmd;
+
+	if ((ahci_port_read (ad, pno, PxSSTS) & PxSSTS_DET_MASK) !=
+	    PxSSTS_DET_MASK_PRESENT)
+		return false;
+	pxcmd = ahci_port_read (ad, pno, PxCMD);
+	ahci_port_write (ad, pno, PxCMD, pxcmd & ~PxCMD_ST_BIT);
+	if (!wait_for_pxcmd (ad, pno, PxCMD_CR_BIT, 0))
+		return false;
+	ahci_port_write (ad, pno, PxCMD, pxcmd & ~PxCMD_ST_BIT &
+			 ~PxCMD_FRE_BIT);
+	if (!wait_for_pxcmd (ad, pno, PxCMD_FR_BIT, 0))
+		return false;
+	ahci_port_write (ad, pno, PxCLB, port->myclb);
+	ahci_port_write (ad, pno, PxCLBU, port->myclbu);
+	ahci_port_write (ad, pno, PxFB, pd->fis_phys);
+	ahci_port_write (ad, pno, PxFBU, pd->fis_phys >> 32);
+	ahci_port_write (ad, pno, PxIE, 0);
+	ahci_port_write (ad, pno, PxIS, ahci_port_read (ad, pno, PxIS));
+	ahci_port_write (ad, pno, PxCMD, (pxcmd & ~PxCMD_ST_BIT) |
+			 PxCMD_FRE_BIT);
+	if (!wait_for_pxcmd (ad, pno, PxCMD_FR_BIT, PxCMD_FR_BIT))
+		return false;
+	ahci_port_write (ad, pno, PxCMD, pxcmd | PxCMD_ST_BIT | PxCMD_FRE_BIT);
+	if (!wait_for_pxcmd (ad, pno, PxCMD_CR_BIT, PxCMD_CR_BIT))
+		return false;
+	return true;
+}
+
+static bool
+ahci_panic_dump_write (void *data, int dev_no, u64 lba, void *buf,
+		       phys_t buf_phys, uint nsec)
+{
+	struct ahci_panic_dump *pd = data;
+	struct ahci_data *ad = pd->ad;
+	int pno = pd->port_num;
+	struct ahci_port *port = &ad->port[pno];
+	struct storage_hc_dev_atacmd cmd;
+	u32 pxis;
+	u64 time;
+
+	if (!pd->started) {
+		if (!ahci_panic_dump_start (pd)) {
+			printf ("AHCI %d:%d crash dump: port not ready\n",
+				ad->host_id, pno);
+			return false;
+		}
+		pd->started = true;
+	}
+	memset (&cmd, 0, sizeof cmd);
+	cmd.dev_head = 0x40;
+	if (nsec) {
+		cmd.command_status = 0x35; /* WRITE DMA EXT */
+		cmd.sector_number = lba;
+		cmd.cyl_low = lba >> 8;
+		cmd.cyl_high = lba >> 16;
+		cmd.sector_number_exp = lba >> 24;
+		cmd.cyl_low_exp = lba >> 32;
+		cmd.cyl_high_exp = lba >> 40;
+		cmd.sector_count = nsec;
+		cmd.sector_count_exp = nsec >> 8;
+		cmd.buf = buf;
+		cmd.buf_phys = buf_phys;
+		cmd.buf_len = nsec * 512;
+		cmd.write = true;
+	} else {
+		/* no data; pass the FIS page to avoid a bounce buffer */
+		cmd.command_status = 0xEA; /* FLUSH CACHE EXT */
+		cmd.buf = pd->fis;
+		cmd.buf_phys = pd->fis_phys;
+		cmd.buf_len = 512;
+	}
+	ahci_command_fill (port, 0, &cmd);
+	if (!nsec)
+		port->mycmdlist->cmdhdr[0].prdtl = 0;
+	ahci_port_write (ad, pno, PxCI, 1);
+	time = get_time ();
+	while (ahci_port_read (ad, pno, PxCI) & 1) {
+		if (ahci_port_read (ad, pno, PxIS) & PxIS_TFES_BIT)
+			break;
+		if (get_time () - time >= PANIC_DUMP_TIMEOUT) {
+			printf ("AHCI %d:%d crash dump: timeout\n",
+				ad->host_id, pno);
+			pd->started = false;
+			return false;
+		}
+	}
+	pxis = ahci_port_read (ad, pno, PxIS);
+	ahci_port_write (ad, pno, PxIS, pxis);
+	if ((pxis & PxIS_TFES_BIT) ||
+	    (ahci_port_read (ad, pno, PxTFD) & PxTFD_STS_ERR_BIT)) {
+		printf ("AHCI %d:%d crash dump: error PxTFD=0x%X\n",
+			ad->host_id, pno, ahci_port_read (ad, pno, PxTFD));
+		pd->started = false;
+		return false;
+	}
+	return true;
+}
+
+static void
+ahci_panic_dump_init (struct ahci_data *ad, int port_num)
+{
+	struct ahci_panic_dump *pd;
+	char name[16];
+
+	snprintf (name, sizeof name, "ahci%d:%d", ad->host_id, port_num);
+	pd = alloc (sizeof *pd);
+	pd->ad = ad;
+	pd->port_num = port_num;
+	pd->started = false;
+	if (!panic_dump_register (name, ahci_panic_dump_write, pd, 0)) {
+		free (pd);
+		return;
+	}
+	alloc_page (&pd->fis, &pd->fis_phys);
+	memset (pd->fis, 0, PAGESIZE);
+	ad->panic_dump = pd;
+}
+
 /************************************************************/
 /* Initialize */
 
@@ -597,13 +791,13 @@ ahci_port_data_init (struct ahci_data *ad, int port_num)
 	struct ahci_port *port;
 
 	port = &ad->port[port_num];
-	alloc_page (&virt, &phys);
+	alloc_page_node (&virt, &phys, ad->pci->node);
 	memset (virt, 0, PAGESIZE);
 	port->mycmdlist = virt;
 	port->myclb = phys;
 	port->myclbu = phys >> 32;
 	for (i = 0; i < NUM_OF_COMMAND_HEADER; i++) {
-		alloc_page (&virt, &phys);
+		alloc_page_node (&virt, &phys, ad->pci->node);
 		port->my[i].cmdtbl = virt;
 		port->my[i].cmdtbl_p = phys;
 		port->my[i].dmabuf = NULL;
@@ -632,6 +826,7 @@ ahci_port_data_init (struct ahci_data *ad, int port_num)
 				ad->host_id, port_num);
 	}
 	printf ("AHCI %d:%d initialized\n", ad->host_id, port_num);
+	ahci_panic_dump_init (ad, port_num);
 }
 
 /************************************************************/
@@ -652,8 +847,32 @@ ahci_handle_cmd_through (struct ahci_data *ad, struct ahci_port *port,
 			 int cmdhdr_index, union cmdfis *cfis, unsigned int rw,
 			 unsigned int ext)
 {
+	u8 command = cfis->fis_0x27.command;
+
 	port->my[cmdhdr_index].dmabuf_rwflag = 0;
 	port->my[cmdhdr_index].dmabuf_identify = IDENTIFY_NONE;
+	/* READ LOG (DMA) EXT of the NCQ Command Error log */
+	port->my[cmdhdr_index].dmabuf_ncqlog = ad->vmm_slots &&
+		(command == 0x2F || command == 0x47) &&
+		cfis->fis_0x27.sector_number == 0x10 &&
+		port->my[cmdhdr_index].dmabuflen >= 512;
+}
+
+/* The tag of a failed NCQ command issued on a reserved slot means
+   nothing to the guest.  Report the error as that of a non-queued
+   command (NQ=1) and fix the checksum of the log page. */
+static void
+ahci_ncqlog_check (struct ahci_data *ad, struct ahci_port *port,
+		   int cmdhdr_index)
+{
+	u8 *log = port->my[cmdhdr_index].dmabuf;
+
+	if (log[0] & 0x80)
+		return;
+	if (!(ad->vmm_slots & (1 << (log[0] & 0x1F))))
+		return;
+	log[511] -= 0x80;
+	log[0] |= 0x80;
 }
 
 static void
@@ -748,6 +967,7 @@ ahci_handle_cmd_rw_ncq (struct ahci_data *ad, struct ahci_port *port,
 	ASSERT (cfis->fis_0x27.dev_head & 0x40); /* must be LBA */
 	ASSERT ((port->my[cmdhdr_index].dmabuflen % 512) == 0);
 	ASSERT ((!port->mycmdlist->cmdhdr[cmdhdr_index].w) == (!rw));
+	port->ncq_seen = true;
 	lba = cfis->fis_0x27.cyl_high_exp;
 	lba = (lba << 8) | cfis->fis_0x27.cyl_low_exp;
 	lba = (lba << 8) | cfis->fis_0x27.sector_number_exp;
@@ -822,10 +1042,10 @@ ahci_cmd_prehook (struct ahci_data *ad, struct ahci_port *port,
 	u8 *acmd;
 	union cmdfis *cfis;
 	ata_cmd_type_t type;
-	struct storage_access access;
 
 	cfis = &port->my[cmdhdr_index].cmdtbl->cfis;
 	acmd = port->my[cmdhdr_index].cmdtbl->acmd;
+	port->my[cmdhdr_index].dmabuf_ncqlog = false;
 	if (port->mycmdlist->cmdhdr[cmdhdr_index].a) {
 		ASSERT (cfis->fis_type == 0x27);
 		type = ata_get_cmd_type (cfis->fis_0x27.command);
@@ -841,41 +1061,19 @@ ahci_cmd_prehook (struct ahci_data *ad, struct ahci_port *port,
 							    type.rw, type.ext);
 		ASSERT (!port->my[cmdhdr_index].dmabuf_rwflag || !port->atapi);
 	}
-	if (!port->my[cmdhdr_index].dmabuf_rwflag)
-		return;
-	if (!port->mycmdlist->cmdhdr[cmdhdr_index].w) /* read */
-		return;
-	access.rw = 1;
-	access.lba = port->my[cmdhdr_index].dmabuf_lba;
-	access.count = port->my[cmdhdr_index].dmabuf_nsec;
-	access.sector_size = port->my[cmdhdr_index].dmabuf_ssiz;
-	storage_handle_sectors (port->storage_device, &access,
-				port->my[cmdhdr_index].dmabuf,
-				port->my[cmdhdr_index].dmabuf);
 }
 
 static void
 ahci_cmd_posthook (struct ahci_data *ad, struct ahci_port *port,
 		   int cmdhdr_index)
 {
-	struct storage_access access;
-
 	if (port->my[cmdhdr_index].dmabuf_identify) {
 		/* check atapi or not */
 		ahci_identity_check (ad, port, cmdhdr_index);
 		return;
 	}
-	if (!port->my[cmdhdr_index].dmabuf_rwflag)
-		return;
-	if (port->mycmdlist->cmdhdr[cmdhdr_index].w) /* write */
-		return;
-	access.rw = 0;
-	access.lba = port->my[cmdhdr_index].dmabuf_lba;
-	access.count = port->my[cmdhdr_index].dmabuf_nsec;
-	access.sector_size = port->my[cmdhdr_index].dmabuf_ssiz;
-	storage_handle_sectors (port->storage_device, &access,
-				port->my[cmdhdr_index].dmabuf,
-				port->my[cmdhdr_index].dmabuf);
+	if (port->my[cmdhdr_index].dmabuf_ncqlog)
+		ahci_ncqlog_check (ad, port, cmdhdr_index);
 }
 
 /************************************************************/
@@ -901,6 +1099,19 @@ ahci_cmd_cancel (struct ahci_port *port)
 	}
 }
 
+/* The guest sees a command the storage handler failed as a task
+   file error: PxIS.TFES, PxTFD.STS.ERR with ABRT, and the slot left
+   in PxCI until the guest stops the port to recover, like the
+   controller reports a device error. */
+static void
+ahci_cmd_fail (struct ahci_data *ad, struct ahci_port *port, int slot)
+{
+	printf ("AHCI %d: storage handler failed, slot %d aborted\n",
+		ad->host_id, slot);
+	port->guest_err_ci |= 1 << slot;
+	port->guest_err_tfes = true;
+}
+
 static void
 ahci_cmd_complete (struct ahci_data *ad, struct ahci_port *port, u32 pxsact,
 		   u32 pxci)
@@ -929,9 +1140,10 @@ ahci_cmd_complete (struct ahci_data *ad, struct ahci_port *port, u32 pxsact,
 			cmdtbl = mapmem_gphys (ctphys, cmdtbl_size (prdtl),
 					       MAPMEM_WRITE);
 			ahci_cmd_posthook (ad, port, i);
-			if (!(port->mycmdlist->cmdhdr[i].w)) /* read */
-				ahci_copy_dmabuf (port, i, false, cmdtbl,
-						  prdtl);
+			if (!(port->mycmdlist->cmdhdr[i].w) && /* read */
+			    !ahci_copy_dmabuf (port, i, false, cmdtbl,
+					       prdtl))
+				ahci_cmd_fail (ad, port, i);
 			unmapmem (cmdtbl, cmdtbl_size (prdtl));
 			free (port->my[i].dmabuf);
 			port->my[i].dmabuf = NULL;
@@ -943,7 +1155,8 @@ ahci_cmd_complete (struct ahci_data *ad, struct ahci_port *port, u32 pxsact,
 	unmapmem (cmdlist, sizeof *cmdlist);
 }
 
-static void
+/* Returns the slots that must not be issued to the controller */
+static u32
 ahci_cmd_start (struct ahci_data *ad, struct ahci_port *pt, u32 pxci)
 {
 	struct command_list *cmdlist;
@@ -953,6 +1166,7 @@ ahci_cmd_start (struct ahci_data *ad, struct ahci_port *pt, u32 pxci)
 	phys_t ctphys;
 	u32 totalsize;
 	unsigned int intrflag;
+	u32 failed = 0;
 
 	cmdlist = mapmem_gphys (ahci_get_phys (pt->clb, pt->clbu),
 				sizeof *cmdlist, MAPMEM_WRITE);
@@ -973,8 +1187,9 @@ ahci_cmd_start (struct ahci_data *ad, struct ahci_port *pt, u32 pxci)
 			if (pt->my[i].dmabuf != NULL)
 				panic ("pt->my[i].dmabuf=%p is not NULL!",
 				       pt->my[i].dmabuf);
-			pt->my[i].dmabuf = alloc2 (totalsize,
-						   &pt->my[i].dmabuf_p);
+			pt->my[i].dmabuf = alloc2_node (totalsize,
+							&pt->my[i].dmabuf_p,
+							ad->pci->node);
 			pt->my[i].dmabuflen = totalsize;
 			pt->mycmdlist->cmdhdr[i].ctba = pt->my[i].cmdtbl_p;
 			pt->mycmdlist->cmdhdr[i].ctbau =
@@ -988,9 +1203,15 @@ ahci_cmd_start (struct ahci_data *ad, struct ahci_port *pt, u32 pxci)
 			pt->my[i].cmdtbl->prdt[0].dbc = (totalsize - 2) | 1;
 			pt->my[i].cmdtbl->prdt[0].i = intrflag;
 			pt->mycmdlist->cmdhdr[i].prdtl = 1;
-			if (pt->mycmdlist->cmdhdr[i].w) /* write */
-				ahci_copy_dmabuf (pt, i, true, cmdtbl, prdtl);
 			ahci_cmd_prehook (ad, pt, i);
+			if (pt->mycmdlist->cmdhdr[i].w && /* write */
+			    !ahci_copy_dmabuf (pt, i, true, cmdtbl, prdtl)) {
+				/* do not write the unprocessed sectors.
+				   the slot completes without being
+				   issued and fails like a read. */
+				ahci_cmd_fail (ad, pt, i);
+				failed |= 1 << i;
+			}
 			unmapmem (cmdtbl, cmdtbl_size (prdtl));
 		} else {
 			ASSERT (pt->my[i].dmabuf == NULL);
@@ -999,6 +1220,42 @@ ahci_cmd_start (struct ahci_data *ad, struct ahci_port *pt, u32 pxci)
 		pt->shadowbit |= (1 << i);
 	}
 	unmapmem (cmdlist, sizeof *cmdlist);
+	return failed;
+}
+
+/* Reserved slots with a VMM command the guest still has to wait
+   for.  Timed out and aborted commands are not waited for. */
+static u32
+ahci_vmm_tags_busy (struct ahci_port *port)
+{
+	return port->vmm_busy & ~port->vmm_stale & ~port->vmm_abort;
+}
+
+/* The guest must not issue a non-NCQ command while VMM commands are
+   using reserved slots.  Such a write is held back here and replayed
+   by the command thread when the slots are free, instead of waiting
+   in the MMIO handler.  The wait is kept well below the command
+   timeouts of guests, e.g. 500 ms of Linux before it resets the
+   port. */
+static void
+ahci_vmm_tags_defer (struct ahci_port *port)
+{
+	if (!port->vmm_deferred_ci)
+		port->vmm_deferred_time = get_time ();
+}
+
+/* Called by the command thread with the AHCI lock held */
+static void
+ahci_vmm_tags_check (struct ahci_data *ad, int port_num, u64 time)
+{
+	struct ahci_port *port = &ad->port[port_num];
+
+	if (!port->vmm_deferred_ci)
+		return;
+	if (!ahci_vmm_tags_busy (port))
+		ahci_vmm_tags_resume (ad, port_num, false);
+	else if (time - port->vmm_deferred_time >= VMM_TAGS_WAIT_USEC)
+		ahci_vmm_tags_resume (ad, port_num, true);
 }
 
 /************************************************************/
@@ -1050,10 +1307,12 @@ mmhandler2 (struct ahci_data *ad, u32 offset, bool wr, u32 *buf32, uint len,
 		if (!wr && port_num == i) {
 			/* Read */
 			if (ahci_port_eq (port_off, len, PxSACT)) {
-				*buf32 = pxsact;
+				*buf32 = pxsact & ~ad->vmm_slots;
 				r = 1;
 			} else if (ahci_port_eq (port_off, len, PxCI)) {
-				*buf32 = pxci;
+				*buf32 = (pxci & ~ad->vmm_slots) |
+					port->vmm_deferred_ci |
+					port->guest_err_ci;
 				r = 1;
 			}
 		}
@@ -1082,6 +1341,17 @@ mmhandler2 (struct ahci_data *ad, u32 offset, bool wr, u32 *buf32, uint len,
 			return;
 		}
 		if (port && ahci_port_eq (port_off, len, PxCMD)) {
+			if (!(*buf32 & PxCMD_ST_BIT)) {
+				/* the guest stops the port to recover
+				   and does not wait for the reserved
+				   slots.  stopping the port clears PxCI,
+				   losing the VMM commands, the held
+				   back guest commands and the error */
+				ahci_vmm_tags_abort (ad, port_num);
+				port->vmm_deferred_ci = 0;
+				port->guest_err_ci = 0;
+				port->guest_err_tfes = false;
+			}
 			if (port->shadowbit && !(*buf32 & PxCMD_ST_BIT)) {
 				pxcmd = ahci_port_read (ad, port_num, PxCMD);
 				if (pxcmd & PxCMD_ST_BIT)
@@ -1109,8 +1379,20 @@ mmhandler2 (struct ahci_data *ad, u32 offset, bool wr, u32 *buf32, uint len,
 			/* PxCI is written before PxCMD.ST is set to 1
 			   in some BIOSes */
 			ASSERT (port->storage_device);
-			ahci_cmd_start (ad, port, *buf32);
+			/* commands without a PxSACT bit are not NCQ */
+			if ((port->vmm_deferred_ci ||
+			     (*buf32 & ~ahci_port_read (ad, port_num,
+							PxSACT))) &&
+			    ahci_vmm_tags_busy (port)) {
+				ahci_vmm_tags_defer (port);
+				port->vmm_deferred_ci |= *buf32;
+				return;
+			}
+			*buf32 &= ~ahci_cmd_start (ad, port, *buf32);
 		}
+		if (port && ahci_port_eq (port_off, len, PxIS) &&
+		    (*buf32 & PxIS_TFES_BIT))
+			port->guest_err_tfes = false;
 		if (ahci_port_eq (offset, len, GLOBAL_GHC)) {
 			ahci_write (ad, GLOBAL_GHC, *buf32);
 			ahci_probe (ad, true, *buf32);
@@ -1136,6 +1418,61 @@ mmhandler2 (struct ahci_data *ad, u32 offset, bool wr, u32 *buf32, uint len,
 		}
 	}
 	ahci_readwrite (ad, offset, wr, buf32, len);
+	if (!wr && port && port->guest_err_ci) {
+		if (ahci_port_eq (port_off, len, PxIS) &&
+		    port->guest_err_tfes)
+			*buf32 |= PxIS_TFES_BIT;
+		else if (ahci_port_eq (port_off, len, PxTFD))
+			*buf32 = PxTFD_ERR_ABRT;
+		else if (ahci_port_eq (port_off, len, PxCI))
+			*buf32 |= port->guest_err_ci;
+	}
+	if (wr || !ad->vmm_slots)
+		return;
+	/* hide the reserved slots from the guest */
+	if (offset == GLOBAL_CAP && len == 4) {
+		*buf32 &= ~GLOBAL_CAP_NCS_MASK;
+		*buf32 |= (ad->ncs - ad->vmm_tags - 1) <<
+			GLOBAL_CAP_NCS_SHIFT;
+	} else if (port && ahci_port_eq (port_off, len, PxSACT)) {
+		*buf32 &= ~ad->vmm_slots;
+	} else if (port && ahci_port_eq (port_off, len, PxCI)) {
+		*buf32 &= ~ad->vmm_slots;
+		*buf32 |= port->vmm_deferred_ci;
+	}
+}
+
+/* The VMM commands on the reserved slots are reported as failed
+   since the port stop loses them. */
+static void
+ahci_vmm_tags_abort (struct ahci_data *ad, int port_num)
+{
+	struct ahci_port *port = &ad->port[port_num];
+
+	if (ahci_vmm_tags_busy (port)) {
+		printf ("AHCI %d:%d warning: reserved slots busy\n",
+			ad->host_id, port_num);
+		port->vmm_abort |= ahci_vmm_tags_busy (port);
+	}
+}
+
+/* Replay the guest write held back by ahci_vmm_tags_defer().  If the
+   reserved slots did not drain in time, the VMM commands on them are
+   aborted. */
+static void
+ahci_vmm_tags_resume (struct ahci_data *ad, int port_num, bool abort)
+{
+	struct ahci_port *port = &ad->port[port_num];
+	u32 offset = (port_num + 2) << 7;
+	u32 val;
+
+	if (abort)
+		ahci_vmm_tags_abort (ad, port_num);
+	if (port->vmm_deferred_ci) {
+		val = port->vmm_deferred_ci;
+		port->vmm_deferred_ci = 0;
+		mmhandler2 (ad, offset + PxCI, true, &val, sizeof val, 0);
+	}
 }
 
 static int
@@ -1228,6 +1565,12 @@ ahci_command_fill (struct ahci_port *port, int slot,
 		cfis->sector_count |= slot << 3;
 	cfis->sector_count_exp = cmd->sector_count_exp;
 	cfis->control = cmd->control;
+	if (!cmd->buf_len) {
+		/* non-data command such as FLUSH CACHE */
+		cmdhdr->prdtl = 0;
+		port->my[slot].dmabuf = NULL;
+		return;
+	}
 	if (cmd->buf_phys && !(cmd->buf_phys & 0x7F) && !(cmd->buf_len & 1) &&
 	    cmd->buf_len >= 2) {
 		port->my[slot].dmabuf = NULL;
@@ -1251,6 +1594,102 @@ ahci_command_fill (struct ahci_port *port, int slot,
 	}
 }
 
+static bool
+ahci_command_reservable (struct ahci_data *ad, struct ahci_command_list *p)
+{
+	struct storage_hc_dev_atacmd *cmd;
+
+	cmd = p->cmd;
+	if (!ad->vmm_slots || !ad->port[p->port_no].ncq_seen)
+		return false;
+	if (cmd->ncq || cmd->pio || cmd->atapi_len)
+		return false;
+	/* READ DMA EXT and WRITE DMA EXT are sent as FPDMA QUEUED */
+	return cmd->command_status == 0x25 || cmd->command_status == 0x35;
+}
+
+/* Issue a command on a reserved slot while guest NCQ commands are
+   running.  NCQ commands complete in any order, so wait for guest
+   commands that access the same sectors. */
+static enum ahci_command_do_ret
+ahci_command_do_reserved (struct ahci_data *ad, struct ahci_command_list *p)
+{
+	struct storage_hc_dev_atacmd *cmd;
+	struct ahci_port *port;
+	u32 pxsact, pxci, slots;
+	int pno, slot, i;
+	u64 lba;
+	u32 nsec;
+
+	cmd = p->cmd;
+	pno = p->port_no;
+	port = &ad->port[pno];
+	if (!(ahci_port_read (ad, pno, PxCMD) & PxCMD_ST_BIT))
+		goto not_ready;
+	/* let the reserved slots drain for the held back guest write */
+	if (port->vmm_deferred_ci)
+		goto not_ready;
+	pxsact = ahci_port_read (ad, pno, PxSACT);
+	pxci = ahci_port_read (ad, pno, PxCI);
+	if (port->shadowbit)
+		ahci_cmd_complete (ad, port, pxsact, pxci);
+	/* a legacy guest command is running */
+	if ((pxsact ^ pxci) & pxci)
+		goto not_ready;
+	lba = cmd->cyl_high_exp;
+	lba = (lba << 8) | cmd->cyl_low_exp;
+	lba = (lba << 8) | cmd->sector_number_exp;
+	lba = (lba << 8) | cmd->cyl_high;
+	lba = (lba << 8) | cmd->cyl_low;
+	lba = (lba << 8) | cmd->sector_number;
+	nsec = (cmd->sector_count_exp << 8) | cmd->sector_count;
+	if (!nsec)
+		nsec = 65536;
+	for (i = 0; i < NUM_OF_COMMAND_HEADER; i++) {
+		if (!(port->shadowbit & (1 << i)))
+			continue;
+		if (port->my[i].dmabuf_rwflag &&
+		    port->my[i].dmabuf_lba < lba + nsec &&
+		    lba < port->my[i].dmabuf_lba + port->my[i].dmabuf_nsec)
+			goto not_ready;
+	}
+	slots = port->vmm_stale & ~(pxsact | pxci);
+	port->vmm_busy &= ~slots;
+	port->vmm_stale &= ~slots;
+	slots = ad->vmm_slots & ~port->vmm_busy & ~(pxsact | pxci);
+	for (slot = 0; slot < NUM_OF_COMMAND_HEADER; slot++)
+		if (slots & (1 << slot))
+			goto found;
+not_ready:
+	if (ad->removed ||
+	    get_time () - p->start_time >= cmd->timeout_ready) {
+		cmd->timeout_ready = -1;
+		return COMMAND_FAILED;
+	} else {
+		return COMMAND_SKIPPED;
+	}
+found:
+	if (cmd->command_status == 0x35)
+		cmd->command_status = 0x61; /* WRITE FPDMA QUEUED */
+	else
+		cmd->command_status = 0x60; /* READ FPDMA QUEUED */
+	cmd->features_error = nsec;
+	cmd->features_exp = nsec >> 8;
+	cmd->sector_count = 0;
+	cmd->sector_count_exp = 0;
+	cmd->dev_head = 0x40;
+	cmd->ncq = ad->ncs;
+	ahci_command_fill (port, slot, cmd);
+	port->vmm_busy |= 1 << slot;
+	port->vmm_abort &= ~(1 << slot);
+	ahci_port_write (ad, pno, PxSACT, 1 << slot);
+	ahci_port_write (ad, pno, PxCI, 1 << slot);
+	p->slot = slot;
+	p->reserved = true;
+	p->start_time = get_time ();
+	return COMMAND_QUEUED;
+}
+
 static enum ahci_command_do_ret
 ahci_command_do (struct ahci_data *ad, struct ahci_command_list *p,
 		 struct ahci_command_data *data)
@@ -1267,6 +1706,8 @@ ahci_command_do (struct ahci_data *ad, struct ahci_command_list *p,
 		pxcmd = ahci_port_read (ad, pno, PxCMD);
 		if (!(pxcmd & PxCMD_ST_BIT))
 			goto not_ready;
+		if (port->vmm_deferred_ci)
+			goto not_ready;
 		pxsact = ahci_port_read (ad, pno, PxSACT);
 		pxci = ahci_port_read (ad, pno, PxCI);
 		if (port->shadowbit)
@@ -1304,7 +1745,8 @@ ahci_command_do (struct ahci_data *ad, struct ahci_command_list *p,
 			goto found;
 	}
 not_ready:
-	if (get_time () - p->start_time >= p->cmd->timeout_ready) {
+	if (ad->removed ||
+	    get_time () - p->start_time >= p->cmd->timeout_ready) {
 		p->cmd->timeout_ready = -1;
 		return COMMAND_FAILED;
 	} else {
@@ -1333,7 +1775,8 @@ found:
 		}
 		data->port[pno].orig_fb = ahci_port_read (ad, pno, PxFB);
 		data->port[pno].orig_fbu = ahci_port_read (ad, pno, PxFBU);
-		alloc_page (&data->port[pno].fis, &phys);
+		alloc_page_node (&data->port[pno].fis, &phys,
+				 ad->pci->node);
 		pxfb = phys;
 		pxfbu = phys >> 32;
 		ahci_port_write (ad, pno, PxFB, pxfb);
@@ -1390,7 +1833,8 @@ ahci_command_completion (struct ahci_data *ad, struct ahci_command_list *p,
 	}
 	slot = p->slot;
 	if ((pxsact | pxci) & (1 << slot)) {
-		if (time - p->start_time >= p->cmd->timeout_complete)
+		if (ad->removed ||
+		    time - p->start_time >= p->cmd->timeout_complete)
 			p->cmd->timeout_complete = -1;
 		else
 			return false;
@@ -1458,6 +1902,47 @@ ahci_command_completion (struct ahci_data *ad, struct ahci_command_list *p,
 	return true;
 }
 
+/* called with the AHCI lock held */
+static bool
+ahci_command_completion_reserved (struct ahci_data *ad,
+				  struct ahci_command_list *p, u64 time)
+{
+	struct storage_hc_dev_atacmd *cmd;
+	struct ahci_port *port;
+	int pno, slot;
+	bool done = true;
+
+	cmd = p->cmd;
+	pno = p->port_no;
+	port = &ad->port[pno];
+	slot = p->slot;
+	if ((ahci_port_read (ad, pno, PxSACT) |
+	     ahci_port_read (ad, pno, PxCI)) & (1 << slot)) {
+		if (time - p->start_time < cmd->timeout_complete) {
+			done = false;
+			goto out;
+		}
+		/* the buffer may still be written by the device, so
+		   leave it and the slot until the port is restarted */
+		cmd->timeout_complete = -1;
+		port->my[slot].dmabuf = NULL;
+		port->vmm_stale |= 1 << slot;
+		goto out;
+	}
+	if (port->vmm_abort & (1 << slot))
+		cmd->timeout_complete = -1;
+	if (port->my[slot].dmabuf) {
+		if (!cmd->write && cmd->timeout_complete >= 0)
+			memcpy (cmd->buf, port->my[slot].dmabuf, cmd->buf_len);
+		free (port->my[slot].dmabuf);
+		port->my[slot].dmabuf = NULL;
+	}
+	port->vmm_busy &= ~(1 << slot);
+out:
+	ahci_vmm_tags_check (ad, pno, time);
+	return done;
+}
+
 static void
 ahci_command_thread (void *arg)
 {
@@ -1465,8 +1950,10 @@ ahci_command_thread (void *arg)
 	struct ahci_command_list *p, *pn, *q = NULL, *head = NULL;
 	LIST2_DEFINE_HEAD (working, struct ahci_command_list, list);
 	struct ahci_command_data data;
-	int count = 0;
+	int count = 0, reserved = 0;
+	enum ahci_command_do_ret ret;
 	u64 time;
+	bool done;
 
 	ad = arg;
 	LIST2_HEAD_INIT (working, list);
@@ -1479,11 +1966,15 @@ ahci_command_thread (void *arg)
 			q = NULL;
 		}
 		p = LIST2_POP (ad->ahci_cmd_list, list);
-		if (!p && !count)
+		if (!p && !count && !reserved)
 			ad->ahci_cmd_thread = false;
 		spinlock_unlock (&ad->ahci_cmd_lock);
-		if (!p && !count)
+		if (!p && !count && !reserved) {
+			/* ahci_remove() left the release to this thread */
+			if (ad->removed)
+				ahci_free (ad);
 			break;
+		}
 		if (p) {
 			if (p == head) {
 				schedule ();
@@ -1493,9 +1984,20 @@ ahci_command_thread (void *arg)
 				data.init = 0;
 				ahci_lock_lowpri (ad);
 			}
-			switch (ahci_command_do (ad, p, &data)) {
+			/* reserved slots are used only if no other
+			   command of this thread is running */
+			if (count == 1 && ahci_command_reservable (ad, p))
+				ret = ahci_command_do_reserved (ad, p);
+			else
+				ret = ahci_command_do (ad, p, &data);
+			switch (ret) {
 			case COMMAND_QUEUED:
 				LIST2_ADD (working, list, p);
+				if (p->reserved) {
+					/* the guest may run meanwhile */
+					reserved++;
+					break;
+				}
 				/* keep ahci lock until finished */
 				continue;
 			case COMMAND_FAILED:
@@ -1516,8 +2018,22 @@ ahci_command_thread (void *arg)
 		LIST2_FOREACH_DELETABLE (working, list, p, pn) {
 			if (!time)
 				time = get_time ();
-			if (ahci_command_completion (ad, p, &data, time)) {
-				if (!--count)
+			if (p->reserved) {
+				/* the lock is held while count is non-zero */
+				if (!count)
+					ahci_lock_lowpri (ad);
+				done = ahci_command_completion_reserved (ad, p,
+									 time);
+				if (!count)
+					ahci_unlock (ad);
+			} else {
+				done = ahci_command_completion (ad, p, &data,
+								time);
+			}
+			if (done) {
+				if (p->reserved)
+					reserved--;
+				else if (!--count)
 					ahci_unlock (ad);
 				p->cmd->callback (p->cmd->data, p->cmd);
 				LIST2_DEL (working, list, p);
@@ -1593,8 +2109,14 @@ ahci_command (void *drvdata, int port_no, int dev_no,
 	p->cmd = cmd;
 	p->port_no = port_no;
 	p->dev_no = dev_no;
+	p->reserved = false;
 	p->start_time = get_time ();
 	spinlock_lock (&ad->ahci_cmd_lock);
+	if (ad->removed) {
+		spinlock_unlock (&ad->ahci_cmd_lock);
+		free (p);
+		return false;
+	}
 	LIST2_ADD (ad->ahci_cmd_list, list, p);
 	if (!ad->ahci_cmd_thread) {
 		ad->ahci_cmd_thread = true;
@@ -1788,6 +2310,68 @@ ahci_new (struct pci_device *pci_device)
 	return ad;
 }
 
+static void
+ahci_free (struct ahci_data *ad)
+{
+	struct ahci_port *port;
+	int i, j;
+
+	for (i = 0; i < NUM_OF_AHCI_PORTS; i++) {
+		port = &ad->port[i];
+		if (!port->storage_device)
+			continue;
+		for (j = 0; j < NUM_OF_COMMAND_HEADER; j++) {
+			if (port->my[j].dmabuf)
+				free (port->my[j].dmabuf);
+			free_page (port->my[j].cmdtbl);
+		}
+		free_page (port->mycmdlist);
+		storage_free (port->storage_device);
+	}
+	if (ad->panic_dump) {
+		panic_dump_unregister (ad->panic_dump);
+		free_page (ad->panic_dump->fis);
+		free (ad->panic_dump);
+	}
+	if (ad->ahci_mem.map)
+		unmapmem (ad->ahci_mem.map, ad->ahci_mem.maplen);
+	printf ("AHCI %d: removed\n", ad->host_id);
+	free (ad);
+}
+
+/* The controller has been unplugged.  The hooks are released now.
+   Commands of the VMM still queued or running fail, and the memory
+   is released when the command thread has finished them, since the
+   thread reads the registers through the mapping. */
+void
+ahci_remove (void *ahci_data)
+{
+	struct ahci_data *ad = ahci_data;
+	bool running;
+
+	if (!ad)
+		return;
+	ahci_lock (ad);
+	if (ad->hc)
+		storage_hc_unregister (ad->hc);
+	ad->hc = NULL;
+	unreghook (&ad->ahci_io);
+	/* the mapping is kept for the command thread */
+	if (ad->ahci_mem.e) {
+		mmio_unregister (ad->ahci_mem.h);
+		ad->ahci_mem.e = 0;
+	} else {
+		ad->ahci_mem.map = NULL;
+	}
+	ahci_unlock (ad);
+	spinlock_lock (&ad->ahci_cmd_lock);
+	ad->removed = true;
+	running = ad->ahci_cmd_thread;
+	spinlock_unlock (&ad->ahci_cmd_lock);
+	if (!running)
+		ahci_free (ad);
+}
+
 bool
 ahci_config_read (void *ahci_data, struct pci_device *pci_device,
 		  u8 iosize, u16 offset, union mem *data)
@@ -31,6 +31,7 @@
 #define _ATA_AHCI_H
 
 void *ahci_new (struct pci_device *pci_device);
+void ahci_remove (void *ahci_data);
 bool ahci_config_read (void *ahci_data, struct pci_device *pci_device,
 		       u8 iosize, u16 offset, union mem *data);
 bool ahci_config_write (void *ahci_data, struct pci_device *pci_device,
@@ -272,6 +272,7 @@ struct ata_host {
 	LIST1_DEFINE_HEAD (struct ata_command_list, ata_cmd_list);
 	spinlock_t ata_cmd_lock;
 	bool ata_cmd_thread;
+	bool removed;		/* the controller has been unplugged */
 };
 
 typedef int (*ata_reg_handler_t)(struct ata_channel *channel, core_io_t io, union mem *data);
@@ -432,6 +433,7 @@ extern int ata_bm_handle_device_specific(struct ata_channel *channel, core_io_t
 
 // defined in ata_init.c
 extern int ata_init_io_handler(ioport_t start, size_t num, core_io_handler_t handler, void *arg);
+void ata_host_free (struct ata_host *host);
 
 /* ata_core.c */
 void ata_ahci_mode (struct pci_device *pci_device, bool ahci_enabled);
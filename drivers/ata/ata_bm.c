@@ -44,49 +44,90 @@
  * ATA Bus Master
  *********************************************************************************************************************/
 /* PRD handlers */
-static void ata_dma_handle_rw_sectors(struct ata_channel *channel, int rw)
+static bool ata_dma_rw_sectors_access(struct ata_channel *channel, int rw,
+				      struct storage_access *access)
 {
-	struct storage_access access;
-
-	access.rw = rw;
-	access.lba = channel->lba;
-	access.count = channel->sector_count;
-	access.sector_size = ata_get_ata_device(channel)->storage_sector_size;
+	access->rw = rw;
+	access->lba = channel->lba;
+	access->count = channel->sector_count;
+	access->sector_size = ata_get_ata_device(channel)->storage_sector_size;
 	if (channel->atapi_device->atapi_flag != 0 && 
 			channel->atapi_device->dma_state != ATA_STATE_DMA_READY)
-		goto end;
+		return false;
+	return true;
+}
+
+static void ata_dma_handle_rw_sectors(struct ata_channel *channel, int rw)
+{
+	struct storage_access access;
 
+	if (!ata_dma_rw_sectors_access(channel, rw, &access))
+		return;
 	storage_premap_handle_sectors (ata_get_storage_device(channel),
 				       &access, channel->shadow_buf,
 				       channel->shadow_buf,
 				       channel->shadow_buf_premap,
 				       channel->shadow_buf_premap);
 	channel->atapi_device->dma_state = ATA_STATE_DMA_THROUGH;
-
- end:	return;
 }
 
+/* copy between the guest PRD buffers and the shadow buffer.  the
+   sectors are encrypted or decrypted on the way unless the guest
+   buffers are shorter than the transfer */
 static int ata_copy_shadow_buf(struct ata_channel *channel, int dir)
 {
-	int count, total_count = 0;
+	int i, num, count, total_count = 0;
 	phys_t guest_prd_phys = channel->guest_prd_phys;
 	u8 *shadow_buf = channel->shadow_buf;
 	ata_prd_table_t guest_prd;
-	phys_t (*copy)(phys_t phys, void *buf, int len);
+	struct storage_iovec *iov, shadow;
+	struct storage_access access;
+	int flags = (dir == STORAGE_READ) ? MAPMEM_WRITE : 0;
+	bool handled = false;
 
-	// To optimize:
-	// 1. cache the result of mapmem()
-	// 2. eliminate extra copy between the guest and the vmm by integrating encryption
-	copy = (dir == STORAGE_READ) ? core_mm_write_guest_phys : core_mm_read_guest_phys;
+	num = 0;
 	do {
-		guest_prd.value = core_mm_read_guest_phys64(guest_prd_phys);
+		guest_prd.value = core_mm_read_guest_phys64(guest_prd_phys + num * sizeof(guest_prd));
+		num++;
+	} while (guest_prd.eot == 0);
+	iov = alloc(sizeof *iov * num);
+	for (i = 0; i < num; i++) {
+		guest_prd.value = core_mm_read_guest_phys64(guest_prd_phys + i * sizeof(guest_prd));
 		count = ata_get_16bit_count(guest_prd.count);
 		total_count += count;
 		if (total_count > ATA_BM_TOTAL_BUFSIZE)
 			panic("DMA buffer size too small\n");
-		copy(guest_prd.base, shadow_buf, count);
-		shadow_buf += count; guest_prd_phys += sizeof(guest_prd);
-	} while (guest_prd.eot == 0);
+		iov[i].base = mapmem_gphys(guest_prd.base, count, flags);
+		iov[i].len = count;
+	}
+	if (ata_dma_rw_sectors_access(channel, dir, &access)) {
+		shadow.base = shadow_buf;
+		shadow.len = total_count;
+		if (dir == STORAGE_WRITE)
+			handled = storage_handle_sectors_iov(ata_get_storage_device(channel),
+							     &access, iov, num, &shadow, 1) == 0;
+		else
+			handled = storage_handle_sectors_iov(ata_get_storage_device(channel),
+							     &access, &shadow, 1, iov, num) == 0;
+		if (handled)
+			channel->atapi_device->dma_state = ATA_STATE_DMA_THROUGH;
+	}
+	if (!handled) {
+		if (dir == STORAGE_READ)
+			ata_dma_handle_rw_sectors(channel, dir);
+		for (i = 0; i < num; i++) {
+			if (dir == STORAGE_READ)
+				memcpy(iov[i].base, shadow_buf, iov[i].len);
+			else
+				memcpy(shadow_buf, iov[i].base, iov[i].len);
+			shadow_buf += iov[i].len;
+		}
+		if (dir == STORAGE_WRITE)
+			ata_dma_handle_rw_sectors(channel, dir);
+	}
+	for (i = 0; i < num; i++)
+		unmapmem(iov[i].base, iov[i].len);
+	free(iov);
 	return total_count;
 }
 
@@ -141,7 +182,6 @@ int ata_bm_handle_command(struct ata_channel *channel, core_io_t io, union mem *
 	} else {
 		channel->state = ATA_STATE_DMA_WRITE;
 		count = ata_copy_shadow_buf(channel, STORAGE_WRITE);
-		ata_dma_handle_rw_sectors (channel, STORAGE_WRITE);
 	}
 	ata_set_shadow_prd(channel, count);
  end:	return CORE_IO_RET_DEFAULT;
@@ -167,7 +207,6 @@ int ata_bm_handle_status(struct ata_channel *channel, core_io_t io, union mem *d
 		goto done;
 
 	if (channel->state == ATA_STATE_DMA_READ) {
-		ata_dma_handle_rw_sectors (channel, STORAGE_READ);
 		ata_copy_shadow_buf (channel, STORAGE_READ);
 	}
 	channel->state = ATA_STATE_READY;
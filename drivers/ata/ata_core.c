@@ -566,7 +566,7 @@ ata_command_do_wait_for_ready (struct ata_channel *channel, u64 start_time,
 
 	for (;;) {
 		time = get_time ();
-		if (time - start_time >= timeout)
+		if (time - start_time >= timeout || channel->host->removed)
 			return false;
 		if (channel->state == ATA_STATE_READY) {
 			/* Check BM Status if necessary */
@@ -628,7 +628,7 @@ ata_command_do_wait_for_drq (struct ata_channel *channel, u64 start_time,
 
 	for (;;) {
 		time = get_time ();
-		if (time - start_time >= timeout)
+		if (time - start_time >= timeout || channel->host->removed)
 			return false;
 		status = ata_read_status (channel);
 		if (!status.bsy && status.drq)
@@ -647,7 +647,7 @@ ata_command_do_wait_for_dma (struct ata_channel *channel, u64 start_time,
 
 	for (;;) {
 		time = get_time ();
-		if (time - start_time >= timeout)
+		if (time - start_time >= timeout || channel->host->removed)
 			return false;
 		status = ata_read_status (channel);
 		if ((!status.drq) || (!status.drq))
@@ -1091,8 +1091,12 @@ ata_command_thread (void *arg)
 		if (!p)
 			host->ata_cmd_thread = false;
 		spinlock_unlock (&host->ata_cmd_lock);
-		if (!p)
+		if (!p) {
+			/* ata_remove() left the release to this thread */
+			if (host->removed)
+				ata_host_free (host);
 			break;
+		}
 		channel = host->channel[p->port_no];
 		ata_command_do (host, channel, p);
 		free (p);
@@ -1143,6 +1147,11 @@ ata_command (void *drvdata, int port_no, int dev_no,
 	p->dev_no = dev_no;
 	p->start_time = get_time ();
 	spinlock_lock (&host->ata_cmd_lock);
+	if (host->removed) {
+		spinlock_unlock (&host->ata_cmd_lock);
+		free (p);
+		return false;
+	}
 	LIST1_ADD (host->ata_cmd_list, p);
 	if (!host->ata_cmd_thread) {
 		host->ata_cmd_thread = true;
@@ -34,6 +34,7 @@
  */
 
 #include <core.h>
+#include <core/time.h>
 #include "ata.h"
 #include "atapi.h"
 #include "ata_init.h"
@@ -52,6 +53,8 @@ static const char ahci_driver_longname[] = "Generic AHCI para pass-through drive
 static const char raid_driver_name[] = "raid";
 static const char raid_driver_longname[] = "Generic RAID para pass-through driver";
 
+#define ATA_PANIC_DUMP_TIMEOUT	10000000
+
 static unsigned int host_id = 0;
 static unsigned int device_id = 0;
 
@@ -134,6 +137,85 @@ static void ata_init_ata_device(struct ata_device *ata_device)
 	device_id++;
 }
 
+// crash dump: polled PIO writes, the other processors are frozen
+static bool ata_panic_dump_wait(struct ata_channel *channel, bool drq)
+{
+	ata_status_t status;
+	u64 time;
+
+	time = get_time();
+	for (;;) {
+		status = ata_read_status(channel);
+		if (!status.bsy) {
+			if (status.err)
+				return false;
+			if (!drq || status.drq)
+				return true;
+		}
+		if (get_time() - time >= ATA_PANIC_DUMP_TIMEOUT)
+			return false;
+	}
+}
+
+static bool ata_panic_dump_write(void *data, int dev_no, u64 lba, void *buf,
+				 phys_t buf_phys, uint nsec)
+{
+	struct ata_channel *channel = data;
+	ata_dev_ctl_t dev_ctl;
+	ata_device_reg_t device;
+	u8 *p;
+	uint i;
+
+	dev_ctl.value = 0;
+	dev_ctl.nien = 1;
+	ata_ctl_out(channel, dev_ctl);
+	device.value = 0;
+	device.is_lba = 1;
+	device.dev = dev_no;
+	ata_write_reg(channel, ATA_Device, device.value);
+	if (!ata_panic_dump_wait(channel, false))
+		goto error;
+	if (!nsec) {
+		ata_write_reg(channel, ATA_Command, 0xEA); // FLUSH CACHE EXT
+		ata_read_status(channel);
+		if (!ata_panic_dump_wait(channel, false))
+			goto error;
+		return true;
+	}
+	// previous content (HOB) first, then current content
+	ata_write_reg(channel, ATA_SectorCount, nsec >> 8);
+	ata_write_reg(channel, ATA_LBA_Low, lba >> 24);
+	ata_write_reg(channel, ATA_LBA_Mid, lba >> 32);
+	ata_write_reg(channel, ATA_LBA_High, lba >> 40);
+	ata_write_reg(channel, ATA_SectorCount, nsec);
+	ata_write_reg(channel, ATA_LBA_Low, lba);
+	ata_write_reg(channel, ATA_LBA_Mid, lba >> 8);
+	ata_write_reg(channel, ATA_LBA_High, lba >> 16);
+	ata_write_reg(channel, ATA_Command, 0x34); // WRITE SECTORS EXT
+	ata_read_status(channel);
+	for (p = buf, i = 0; i < nsec; i++, p += 512) {
+		if (!ata_panic_dump_wait(channel, true))
+			goto error;
+		outs16(channel->base[ATA_ID_CMD] + ATA_Data, (u16 *)p, 256);
+	}
+	if (!ata_panic_dump_wait(channel, false))
+		goto error;
+	return true;
+
+error:
+	printf("ATA %d crash dump: error status=0x%02X\n", dev_no,
+	       ata_read_status(channel).value);
+	return false;
+}
+
+static void ata_panic_dump_init(struct ata_channel *channel, int dev_no)
+{
+	char name[16];
+
+	snprintf(name, sizeof name, "ata%u:%d", host_id, dev_no);
+	panic_dump_register(name, ata_panic_dump_write, channel, dev_no);
+}
+
 static struct ata_channel *ata_new_channel(struct ata_host* host)
 {
 	struct ata_channel *channel;
@@ -149,6 +231,8 @@ static struct ata_channel *ata_new_channel(struct ata_host* host)
 	channel->hd[ATA_ID_BM] = -1;
 	ata_init_ata_device(&channel->device[0]);
 	ata_init_ata_device(&channel->device[1]);
+	ata_panic_dump_init(channel, 0);
+	ata_panic_dump_init(channel, 1);
 	channel->host = host;
 	channel->state = ATA_STATE_READY;
 	ata_init_prd(channel);
@@ -184,6 +268,7 @@ static void ata_new(struct pci_device *pci_device, bool ahci_flag)
 	spinlock_init (&host->ata_cmd_lock);
 	LIST1_HEAD_INIT (host->ata_cmd_list);
 	host->ata_cmd_thread = false;
+	host->removed = false;
 	pci_device->host = host;
 
 	/* initialize primary and secondary channels */
@@ -247,12 +332,68 @@ ata_new_ahci (struct pci_device *pci_device)
 	ata_new (pci_device, true);
 }
 
+static void
+ata_free_channel (struct ata_channel *channel)
+{
+	int i;
+
+	panic_dump_unregister (channel);
+	for (i = 0; i < 2; i++)
+		storage_free (channel->device[i].storage_device);
+	free_page (channel->shadow_buf);
+	free_page (channel->shadow_prd);
+	free_page (channel->pio_buf);
+	free (channel->atapi_device);
+	free (channel);
+}
+
+void
+ata_host_free (struct ata_host *host)
+{
+	ata_free_channel (host->channel[0]);
+	ata_free_channel (host->channel[1]);
+	free (host);
+}
+
+/* The controller has been unplugged.  The I/O handlers and the
+   storage interface are released now; the memory is released when
+   the command thread has failed the commands still queued. */
+static void
+ata_remove (struct pci_device *pci_device)
+{
+	struct ata_host *host = pci_device->host;
+	struct ata_channel *channel;
+	int i, id;
+	bool running;
+
+	for (i = 0; i < 2; i++) {
+		channel = host->channel[i];
+		for (id = 0; id < 3; id++) {
+			if (channel->hd[id] >= 0)
+				core_io_unregister_handler (channel->hd[id]);
+			channel->hd[id] = -1;
+		}
+	}
+	ahci_remove (host->ahci_data);
+	host->ahci_data = NULL;
+	if (host->hc)
+		storage_hc_unregister (host->hc);
+	host->hc = NULL;
+	spinlock_lock (&host->ata_cmd_lock);
+	host->removed = true;
+	running = host->ata_cmd_thread;
+	spinlock_unlock (&host->ata_cmd_lock);
+	if (!running)
+		ata_host_free (host);
+}
+
 static struct pci_driver ata_driver = {
 	.name		= ata_driver_name,
 	.longname	= ata_driver_longname,
 	.device		= "class=0101",
 				/* class = Mass Storage, subclass = IDE */
 	.new		= ata_new_ata,		/* called when a new PCI ATA device is found */
+	.remove		= ata_remove,		/* called when the device is unplugged */
 	.config_read	= ata_config_read,	/* called when a config register is read */
 	.config_write	= ata_config_write,	/* called when a config register is written */
 };
@@ -264,6 +405,7 @@ static struct pci_driver ahci_driver = {
 				/* class = Mass Storage, subclass = SATA, */
 				/* programming interface = AHCI 1.0 */
 	.new		= ata_new_ahci,		/* called when a new PCI ATA device is found */
+	.remove		= ata_remove,		/* called when the device is unplugged */
 	.config_read	= ata_config_read,	/* called when a config register is read */
 	.config_write	= ata_config_write,	/* called when a config register is written */
 };
@@ -274,6 +416,7 @@ static struct pci_driver raid_driver = {
 	.device		= "class=0104",
 				/* class = Mass Storage, subclass = RAID */
 	.new		= ata_new_ahci,		/* called when a new PCI ATA device is found */
+	.remove		= ata_remove,		/* called when the device is unplugged */
 	.config_read	= ata_config_read,	/* called when a config register is read */
 	.config_write	= ata_config_write,	/* called when a config register is written */
 };
@@ -647,6 +647,10 @@ static int remap_preconf()
 	return cnt;
 }
 
+#ifdef VTD_TRANS
+static int remap_enabled;
+#endif // of VTD_TRANS
+
 void iommu_setup(void) __initcode__
 {
 #ifdef VTD_TRANS
@@ -670,7 +674,7 @@ void iommu_setup(void) __initcode__
 	
 	printf("(IOMMU) dom 0(PT Devs.) ");
 	for (i = 0; i <= 0xfffff; i++) 
-		dmar_map_page(dom_io[0], i, ((i>=vmm_start_inf() >> 12 && i<vmm_term_inf() >> 12) ? PERM_DMA_NO : PERM_DMA_RW));
+		dmar_map_page(dom_io[0], i, (phys_in_vmm((u64)i << 12) ? PERM_DMA_NO : PERM_DMA_RW));
 	for (dom=1; dom<ndom ; dom++) {
 		printf("%x",dom);
 		for (i=0; i<num_remap ; i++) {
@@ -705,6 +709,7 @@ void iommu_setup(void) __initcode__
 	
 	flush_all();
 	enable_dma_remapping();
+	remap_enabled = 1;
 	
 	return;
 	
@@ -733,6 +738,72 @@ int add_remap(int bus, int dev, int func, int phys, int num_pages, int perm)
 	return 1;
 }
 
+// DMA remapping information of a device is removed when the device is
+//      unplugged.
+// 
+void del_remap(int bus, int dev, int func)
+{
+	int i, j;
+#ifdef VTD_TRANS
+	struct acpi_drhd_u *drhd;
+	struct context_entry *context;
+	u8 devfn = (dev << 3) | func ;
+#endif // of VTD_TRANS
+	
+	if (!iommu_detected)
+		return;
+	
+	for (i=j=0; i<num_remap; i++) {
+		if (rem[i].bus==bus && rem[i].df.dev_no==dev && rem[i].df.func_no==func)
+			continue;
+		rem[j++]=rem[i];
+	}
+	num_remap=j;
+	
+#ifdef VTD_TRANS
+	drhd = matched_drhd_u((u8)bus, devfn) ;
+	if (!drhd)
+		return;
+	context = devid_to_context(drhd->iommu, (u8)bus, devfn) ;
+	if (!context || !context_entry_present(*context))
+		return;
+	
+	// block DMA from whatever is inserted next until it is set up
+	spinlock_lock(&drhd->iommu->unit_lock);
+	memset(context, 0, sizeof(*context));
+	inval_cache_dw(drhd->iommu, context);
+	gcmd_wbf(drhd->iommu);
+	spinlock_unlock(&drhd->iommu->unit_lock);
+	invalidate_context_cache(drhd->iommu);
+	flush_iotlb_global(drhd->iommu);
+#endif // of VTD_TRANS
+}
+
+// A device found after DMA remapping has been enabled gets the
+//      pass-through domain, since del_remap() has blocked its context.
+// 
+void attach_remap(int bus, int dev, int func)
+{
+#ifdef VTD_TRANS
+	struct acpi_drhd_u *drhd;
+	u8 devfn = (dev << 3) | func ;
+	
+	if (!iommu_detected || !remap_enabled)
+		return;
+	if (search_remap(bus, dev, func) != 0)
+		return;
+	drhd = matched_drhd_u((u8)bus, devfn) ;
+	if (!drhd)
+		return;
+	if (reg_context_entry(dom_io[0], drhd->iommu, (u8)bus, devfn) != 0) {
+		printf("reg_context_entry failed\n");
+		return;
+	}
+	invalidate_context_cache(drhd->iommu);
+	flush_iotlb_global(drhd->iommu);
+#endif // of VTD_TRANS
+}
+
 struct domain *dom_io[MAX_IO_DOM];
 int num_dom;
 
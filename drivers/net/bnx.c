@@ -30,7 +30,9 @@
  */
 
 #include <core.h>
+#include <core/deferred.h>
 #include <core/mmio.h>
+#include <core/nicpoll.h>
 #include <net/netapi.h>
 #include "pci.h"
 #include "virtio_net.h"
@@ -56,6 +58,7 @@ static const char driver_longname[] =
 #define HOST_TX_RING_LEN 512
 #define HOST_RX_PROD_RING_LEN 512
 #define HOST_RX_RETR_RING_LEN 512
+#define BNX_RECV_BUDGET 16
 
 struct bnx_tx_desc {
 	u32 addr_high;
@@ -129,6 +132,7 @@ struct bnx {
 	struct netdata *nethandle;
 	net_recv_callback_t *recvphys_func;
 	void *recvphys_param;
+	struct deferred *recv_work;
 
 	void *virtio_net;
 	u8 config_override[0x100];
@@ -457,7 +461,7 @@ bnx_call_recv (struct bnx *bnx, void *buf, int buflen)
 				    bnx->recvphys_param, NULL);
 }
 
-static void bnx_handle_recv (struct bnx *bnx);
+static uint bnx_handle_recv (struct bnx *bnx, uint budget);
 
 static void
 bnx_handle_link_state (struct bnx *bnx)
@@ -476,10 +480,12 @@ bnx_handle_error (struct bnx *bnx)
 	printw ("BNX: Error occurred.\n");
 }
 
-static void
-bnx_handle_status (struct bnx *bnx)
+/* called with status_lock held */
+static uint
+bnx_process_status (struct bnx *bnx, uint budget)
 {
-	spinlock_lock (&bnx->status_lock);
+	uint n = 0;
+
 	if (bnx->status_enabled) {
 		if (bnx->status->status & 1) {
 			if (bnx->status->status & 2) {
@@ -498,27 +504,55 @@ bnx_handle_status (struct bnx *bnx)
 			bnx->rx_prod_consumer =
 				bnx->status->rx_producer_consumer;
 			bnx->rx_retr_producer = bnx->status->rx_producer;
-			bnx_handle_recv (bnx);
+			n = bnx_handle_recv (bnx, budget);
 
 			bnx->status->status &= ~1;
 		}
 	}
+	return n;
+}
+
+/* packets beyond the budget are received by bnx_recv_work() before
+   the next VM entry instead of on the exit path */
+static void
+bnx_handle_status (struct bnx *bnx)
+{
+	uint n;
+
+	spinlock_lock (&bnx->status_lock);
+	n = bnx_process_status (bnx, BNX_RECV_BUDGET);
 	spinlock_unlock (&bnx->status_lock);
+	if (n >= BNX_RECV_BUDGET)
+		deferred_schedule (bnx->recv_work);
 }
 
 static void
-bnx_handle_recv (struct bnx *bnx)
+bnx_recv_work (void *data)
 {
-	int i;
-	int num;
+	struct bnx *bnx = data;
+	uint n = 0;
+
+	spinlock_lock (&bnx->status_lock);
+	if (bnx->status_enabled)
+		n = bnx_handle_recv (bnx, BNX_RECV_BUDGET);
+	spinlock_unlock (&bnx->status_lock);
+	if (n >= BNX_RECV_BUDGET)
+		deferred_schedule (bnx->recv_work);
+}
+
+static uint
+bnx_handle_recv (struct bnx *bnx, uint budget)
+{
+	uint i;
+	uint num;
 	struct bnx_rx_desc desc;
 	void *buf;
 	int buf_len;
 
 	if (!bnx->rx_enabled)
-		return;
+		return 0;
 
-	for (i = 0; i < 16; i++) {
+	for (i = 0; i < budget; i++) {
 		if (bnx_ring_is_empty (bnx->rx_retr_producer,
 				       bnx->rx_retr_consumer))
 			break;
@@ -546,17 +580,20 @@ bnx_handle_recv (struct bnx *bnx)
 				 bnx->rx_prod_ring_len);
 	}
 	num = i;
-	spinlock_lock (&bnx->reg_lock);
-	bnx_mmiowrite32 (bnx, BNXREG_HMBOX_RX_CONS0, bnx->rx_retr_consumer);
-	bnx_mmiowrite32 (bnx, BNXREG_HMBOX_RX_PROD,  bnx->rx_prod_producer);
-	spinlock_unlock (&bnx->reg_lock);
 	if (num) {
+		spinlock_lock (&bnx->reg_lock);
+		bnx_mmiowrite32 (bnx, BNXREG_HMBOX_RX_CONS0,
+				 bnx->rx_retr_consumer);
+		bnx_mmiowrite32 (bnx, BNXREG_HMBOX_RX_PROD,
+				 bnx->rx_prod_producer);
+		spinlock_unlock (&bnx->reg_lock);
 		printd (15, "Received %d packets ("
 			"Return Producer: %d, Consumer: %d / "
 			"Producer Producer: %d, Consumer: %d)\n",
 			num, bnx->rx_retr_producer, bnx->rx_retr_consumer,
 			bnx->rx_prod_producer, bnx->rx_prod_consumer);
 	}
+	return num;
 }
 
 static void
@@ -599,10 +636,9 @@ bnx_xmit (struct bnx *bnx, void *buf, int buflen)
 {
 	if (buflen > 4096)
 		return;
-	if (!bnx->tx_enabled)
-		return;
 	spinlock_lock (&bnx->tx_lock);
-	if ((bnx->tx_producer + 1) % bnx->tx_ring_len != bnx->tx_consumer) {
+	if (bnx->tx_enabled &&
+	    (bnx->tx_producer + 1) % bnx->tx_ring_len != bnx->tx_consumer) {
 		memcpy (bnx->tx_buf[bnx->tx_producer], buf, buflen);
 		bnx->tx_ring[bnx->tx_producer].len_flags = buflen << 16 | 0x84;
 		bnx->tx_ring[bnx->tx_producer].vlan_tag = 0;
@@ -818,6 +854,32 @@ poll_physnic (void *handle)
 	bnx_handle_status (bnx);
 }
 
+/* packets beyond the budget stay in the return ring until the next
+   call even if the status block is not updated again */
+static uint
+bnx_nicpoll (void *data, uint budget)
+{
+	struct bnx *bnx = data;
+	uint n;
+
+	spinlock_lock (&bnx->status_lock);
+	n = bnx_process_status (bnx, budget);
+	if (bnx->status_enabled && n < budget)
+		n += bnx_handle_recv (bnx, budget - n);
+	spinlock_unlock (&bnx->status_lock);
+	return n;
+}
+
+static volatile void *
+bnx_nicpoll_monitor (void *data)
+{
+	struct bnx *bnx = data;
+
+	if (!bnx->status_enabled)
+		return NULL;
+	return &bnx->status->status;
+}
+
 static struct nicfunc phys_func = {
 	.get_nic_info = getinfo_physnic,
 	.send = send_physnic,
@@ -942,6 +1004,7 @@ bnx_new (struct pci_device *pci_device)
 	bool option_virtio = false;
 	bool option_multifunction = false;
 	struct nicfunc *virtio_net_func;
+	char name[24];
 
 	printi ("[%02x:%02x.%01x] A Broadcom NetXtreme GbE found.\n",
 		pci_device->address.bus_no, pci_device->address.device_no,
@@ -959,6 +1022,11 @@ bnx_new (struct pci_device *pci_device)
 		return;
 	}
 	memset (bnx, 0, sizeof *bnx);
+	snprintf (name, sizeof name, "bnx %02x:%02x.%01x",
+		  pci_device->address.bus_no, pci_device->address.device_no,
+		  pci_device->address.func_no);
+	bnx->recv_work = deferred_new (name, DEFERRED_PRIO_NORMAL,
+				       bnx_recv_work, bnx);
 	if (pci_device->driver_options[0] &&
 	    pci_driver_option_get_bool (pci_device->driver_options[0], NULL))
 		option_tty = true;
@@ -996,6 +1064,7 @@ bnx_new (struct pci_device *pci_device)
 	pci_device->host = bnx;
 	bnx_reset (bnx);
 	net_start (bnx->nethandle);
+	nicpoll_register (name, bnx_nicpoll, bnx_nicpoll_monitor, bnx);
 }
 
 static int
@@ -1069,6 +1138,26 @@ bnx_config_write (struct pci_device *pci_device, u8 iosize,
 	return CORE_IO_RET_DONE;
 }
 
+/* The adapter has been unplugged.  The polling queue is released
+   and the rings are stopped.  The structure stays since the network
+   stack keeps the handle. */
+static void
+bnx_remove (struct pci_device *pci_device)
+{
+	struct bnx *bnx = pci_device->host;
+
+	if (!bnx)
+		return;
+	nicpoll_unregister (bnx);
+	spinlock_lock (&bnx->status_lock);
+	bnx->status_enabled = false;
+	bnx->rx_enabled = false;
+	spinlock_unlock (&bnx->status_lock);
+	spinlock_lock (&bnx->tx_lock);
+	bnx->tx_enabled = false;
+	spinlock_unlock (&bnx->tx_lock);
+}
+
 static struct pci_driver bnx_driver = {
 	.name		= driver_name,
 	.longname	= driver_longname,
@@ -1081,6 +1170,7 @@ static struct pci_driver bnx_driver = {
 			  "14e4:1691|" /* BCM57788 */
 			  "14e4:16b4", /* BCM57765 */
 	.new		= bnx_new,
+	.remove		= bnx_remove,
 	.config_read	= bnx_config_read,
 	.config_write	= bnx_config_write,
 };
@@ -28,9 +28,11 @@
  */
 
 #include <core.h>
+#include <core/deferred.h>
 #include <core/initfunc.h>
 #include <core/list.h>
 #include <core/mmio.h>
+#include <core/nicpoll.h>
 #include <net/netapi.h>
 #include "pci.h"
 #include "virtio_net.h"
@@ -192,6 +194,13 @@ struct desc_shadow {
 };
 
 struct data;
+struct data2;
+
+struct pro1000_pollq {
+	struct data2 *d2;
+	int n;			/* receive queue number */
+	bool registered;
+};
 
 struct data2 {
 	spinlock_t lock;
@@ -205,6 +214,7 @@ struct data2 {
 	bool tse_first, tse_tcpfin, tse_tcppsh;
 	u16 tse_iplen, tse_ipchecksum, tse_tcpchecksum;
 	struct desc_shadow tdesc[2], rdesc[2];
+	struct pro1000_pollq pollq[2];
 	struct data *d1;
 	struct netdata *nethandle;
 	bool initialized;
@@ -221,6 +231,8 @@ struct data2 {
 	void *virtio_net;
 	char virtio_net_bar_emul;
 	struct pci_msi *virtio_net_msi;
+	struct deferred *recv_work;
+	bool removed;		/* the adapter has been unplugged */
 };
 
 struct data {
@@ -238,8 +250,8 @@ struct data {
 
 static LIST1_DEFINE_HEAD (struct data2, d2list);
 
-static void receive_physnic (struct desc_shadow *s, struct data2 *d2,
-			     uint off2);
+static uint receive_physnic (struct desc_shadow *s, struct data2 *d2,
+			     uint off2, uint budget);
 
 static int
 iohandler (core_io_t io, union mem *data, void *arg)
@@ -317,6 +329,8 @@ send_physnic_sub (struct data2 *d2, UINT num_packets, void **packets,
 
 	if (d2->d1->disable)	/* PCI config reg is disabled */
 		return;
+	if (d2->removed)
+		return;
 	if (!(d2->tctl & 2))	/* !EN: Transmit Enable */
 		return;
 	s = &d2->tdesc[0];	/* FIXME: 0 only */
@@ -392,10 +406,13 @@ poll_physnic (void *handle)
 	struct data2 *d2 = handle;
 
 	spinlock_lock (&d2->lock);
+	if (d2->removed)
+		goto out;
 	if (d2->rdesc[0].initialized)
-		receive_physnic (&d2->rdesc[0], d2, 0x2800);
+		receive_physnic (&d2->rdesc[0], d2, 0x2800, 0);
 	if (d2->rdesc[1].initialized)
-		receive_physnic (&d2->rdesc[1], d2, 0x2900);
+		receive_physnic (&d2->rdesc[1], d2, 0x2900, 0);
+out:
 	spinlock_unlock (&d2->lock);
 }
 
@@ -983,14 +1000,18 @@ guest_is_transmitting (struct desc_shadow *s, struct data2 *d2)
 	*(u32 *)(void *)((u8 *)d2->d1[0].map + 0xC8) |= 0x1; /* interrupt */
 }
 
-static void
-receive_physnic (struct desc_shadow *s, struct data2 *d2, uint off2)
+/* budget 0 means no limit.  returns the number of descriptors
+   consumed */
+static uint
+receive_physnic (struct desc_shadow *s, struct data2 *d2, uint off2,
+		 uint budget)
 {
 	u32 *head, *tail, h, t, nt;
 	void *pkt[16];
 	UINT pktsize[16];
 	long pkt_premap[16];
 	int i = 0, num = 16;
+	uint count = 0;
 	struct rdesc *rd;
 
 	write_mydesc (s, d2, off2, false);
@@ -1004,16 +1025,17 @@ receive_physnic (struct desc_shadow *s, struct data2 *d2, uint off2)
 		nt = t + 1;
 		if (nt >= NUM_OF_RDESC)
 			nt = 0;
-		if (h == nt || i == num) {
+		if (h == nt || i == num || (budget && count == budget)) {
 			if (d2->recvphys_func)
 				d2->recvphys_func (d2, i, pkt, pktsize,
 						   d2->recvphys_param,
 						   pkt_premap);
-			if (h == nt)
+			if (h == nt || (budget && count == budget))
 				break;
 			i = 0;
 		}
 		t = nt;
+		count++;
 		rd = &s->u.r.rd[t];
 		pkt[i] = s->u.r.rbuf[t];
 		pktsize[i] = rd->len;
@@ -1039,6 +1061,60 @@ receive_physnic (struct desc_shadow *s, struct data2 *d2, uint off2)
 		i++;
 	}
 	*tail = t;
+	return count;
+}
+
+static uint
+pro1000_nicpoll (void *data, uint budget)
+{
+	struct pro1000_pollq *q = data;
+	struct data2 *d2 = q->d2;
+	uint n = 0;
+
+	spinlock_lock (&d2->lock);
+	if (d2->rdesc[q->n].initialized)
+		n = receive_physnic (&d2->rdesc[q->n], d2,
+				     0x2800 + q->n * 0x100, budget);
+	spinlock_unlock (&d2->lock);
+	return n;
+}
+
+/* the device writes back the descriptor at the hardware head next */
+static volatile void *
+pro1000_nicpoll_monitor (void *data)
+{
+	struct pro1000_pollq *q = data;
+	struct data2 *d2 = q->d2;
+	struct desc_shadow *s = &d2->rdesc[q->n];
+	u32 h;
+
+	if (!s->initialized)
+		return NULL;
+	h = *(u32 *)(void *)((u8 *)d2->d1[0].map + 0x2800 + q->n * 0x100 +
+			     0x10);
+	if (h >= NUM_OF_RDESC)
+		return NULL;
+	return &s->u.r.rd[h];
+}
+
+/* a receive queue is polled once its ring is set up, so a queue the
+   guest never uses does not cost a poll in every round */
+static void
+pro1000_nicpoll_add (struct data2 *d2, int n)
+{
+	struct pro1000_pollq *q = &d2->pollq[n];
+	struct pci_device *pci_device = d2->pci_device;
+	char name[24];
+
+	if (q->registered || !d2->rdesc[n].initialized)
+		return;
+	q->registered = true;
+	q->d2 = d2;
+	q->n = n;
+	snprintf (name, sizeof name, "pro1000 %02x:%02x.%01x/%d",
+		  pci_device->address.bus_no, pci_device->address.device_no,
+		  pci_device->address.func_no, n);
+	nicpoll_register (name, pro1000_nicpoll, pro1000_nicpoll_monitor, q);
 }
 
 static bool
@@ -1085,6 +1161,8 @@ handle_desc (uint off1, uint len1, bool wr, union mem *buf, bool recv,
 	} else {
 		return false;
 	}
+	if (recv)
+		pro1000_nicpoll_add (d2, s - d2->rdesc);
 	return true;
 }
 
@@ -1151,9 +1229,9 @@ mmhandler2 (struct data *d1, struct data2 *d2, phys_t gphys, bool wr,
 	if (rangecheck (gphys - d1->mapaddr, len, 0xC0, 4)) {
 		/* Interrupt Cause Read Register */
 		if (d2->rdesc[0].initialized)
-			receive_physnic (&d2->rdesc[0], d2, 0x2800);
+			receive_physnic (&d2->rdesc[0], d2, 0x2800, 0);
 		if (d2->rdesc[1].initialized)
-			receive_physnic (&d2->rdesc[1], d2, 0x2900);
+			receive_physnic (&d2->rdesc[1], d2, 0x2900, 0);
 	}
 skip:
 	q = (union mem *)(void *)((u8 *)d1->map + (gphys - d1->mapaddr));
@@ -1366,6 +1444,7 @@ seize_pro1000 (struct data2 *d2)
 	{
 		init_desc_receive (&d2->rdesc[0], d2, 0x2800);
 		d2->rdesc[0].initialized = true;
+		pro1000_nicpoll_add (d2, 0);
 	}
 	{
 		/* Receive Control Register */
@@ -1412,7 +1491,9 @@ pro1000_intr_clear (void *param)
 	volatile u32 *icr = (void *)(u8 *)d2->d1[0].map + 0xC0;
 
 	*icr |= 0xFFFFFFFF;
-	poll_physnic (d2);
+	/* received packets raise an interrupt with pro1000_intr_set()
+	   so the guest does not need them in this read */
+	deferred_schedule (d2->recv_work);
 }
 
 static void
@@ -1469,6 +1550,7 @@ vpn_pro1000_new (struct pci_device *pci_device, bool option_tty,
 	void *tmp;
 	struct pci_bar_info bar_info;
 	struct nicfunc *virtio_net_func;
+	char name[24];
 
 	if ((pci_device->config_space.base_address[0] &
 	     PCI_CONFIG_BASE_ADDRESS_SPACEMASK) !=
@@ -1513,6 +1595,12 @@ vpn_pro1000_new (struct pci_device *pci_device, bool option_tty,
 	d2->pci_device = pci_device;
 	d2->virtio_net = NULL;
 	if (option_virtio) {
+		snprintf (name, sizeof name, "pro1000 %02x:%02x.%01x",
+			  pci_device->address.bus_no,
+			  pci_device->address.device_no,
+			  pci_device->address.func_no);
+		d2->recv_work = deferred_new (name, DEFERRED_PRIO_NORMAL,
+					      poll_physnic, d2);
 		d2->virtio_net = virtio_net_init (&virtio_net_func,
 						  d2->macaddr,
 						  pro1000_intr_clear,
@@ -1670,6 +1758,39 @@ pro1000_config_write (struct pci_device *pci_device, u8 iosize,
 	return CORE_IO_RET_DONE;
 }
 
+/* The adapter has been unplugged.  The hooks and the polling
+   queues are released and sending and receiving stop.  The data
+   stays since the network stack keeps the handle, and so does the
+   mapping of BAR 0 which a sender may be reading. */
+static void
+pro1000_remove (struct pci_device *pci_device)
+{
+	struct data *d = pci_device->host;
+	struct data2 *d2;
+	int i;
+
+	if (!d)			/* vpn_pro1000_new() gave up */
+		return;
+	d2 = d->d;
+	for (i = 0; i < 2; i++)
+		if (d2->pollq[i].registered)
+			nicpoll_unregister (&d2->pollq[i]);
+	spinlock_lock (&d2->lock);
+	d2->removed = true;
+	spinlock_unlock (&d2->lock);
+	if (d2->virtio_net_msi)
+		pci_msi_disable (d2->virtio_net_msi);
+	for (i = 0; i < 6; i++) {
+		if (!i && d[i].e && !d[i].io) {
+			mmio_unregister (d[i].h);
+			d[i].e = 0;
+		} else {
+			unreghook (&d[i]);
+		}
+	}
+	LIST1_DEL (d2list, d2);
+}
+
 static struct pci_driver pro1000_driver = {
 	.name		= driver_name,
 	.longname	= driver_longname,
@@ -1817,6 +1938,7 @@ static struct pci_driver pro1000_driver = {
 			  "8086:1f45|"
 			  "8086:15b7",
 	.new		= pro1000_new,	
+	.remove		= pro1000_remove,
 	.config_read	= pro1000_config_read,
 	.config_write	= pro1000_config_write,
 };
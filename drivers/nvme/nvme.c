@@ -0,0 +1,1742 @@
+/*
+ * Copyright (c) 2007, 2008 University of Tsukuba
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the University of Tsukuba nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* NVM Express controller shadowing driver.  Admin and I/O queues of
+ * the guest are copied to VMM queues so that read and write commands
+ * go through the storage encryption.  Every guest queue pair has its
+ * own lock and is serviced on the processor that rings its doorbell
+ * or receives its interrupt. */
+
+#include <core.h>
+#include <core/dirtylog.h>
+#include <core/exint_pass.h>
+#include <core/mmio.h>
+#include <core/timer.h>
+#include <storage.h>
+#include "pci.h"
+#include "nvme.h"
+
+#define NVME_MAX_QUEUES		64 /* including the admin queue */
+#define NVME_MAX_QSIZE		1024
+#define NVME_MAX_TAGS		64
+#define NVME_MAX_NS		16
+#define NVME_MAX_MDTS		5
+#define NVME_MAX_XFER_PAGES	(1 << NVME_MAX_MDTS)
+#define NVME_MAX_SEGS		64
+#define NVME_MSIX_VECTORS	8
+#define NVME_POLL_USEC		1000
+
+enum nvme_req_type {
+	NVME_REQ_PASS,
+	NVME_REQ_RW,
+	NVME_REQ_CREATE_SQ,
+	NVME_REQ_CREATE_CQ,
+	NVME_REQ_DELETE_SQ,
+	NVME_REQ_DELETE_CQ,
+	NVME_REQ_IDENTIFY,
+	NVME_REQ_NS_CHANGE,
+};
+
+struct nvme_seg {
+	phys_t addr;
+	u32 len;
+};
+
+struct nvme_req {
+	bool used;
+	enum nvme_req_type type;
+	u16 cid;		/* command identifier of the guest */
+	u16 status;		/* status reported instead if not zero */
+	u16 qid;
+	u8 cns;
+	u32 nsid;
+	struct storage_device *storage;
+	int sector_size;
+	bool wr;
+	lba_t lba;
+	u32 count;
+	u32 len;
+	int nseg;
+	struct nvme_seg seg[NVME_MAX_SEGS];
+	int npages;
+	void *page[NVME_MAX_XFER_PAGES];
+	phys_t page_phys[NVME_MAX_XFER_PAGES];
+	u64 *prplist;
+	phys_t prplist_phys;
+};
+
+struct nvme_sq {
+	spinlock_t lock;
+	struct nvme_data *nd;
+	u16 qid;
+	u16 cqid;
+	bool active;
+	bool waiting;
+	bool deleting;		/* nothing is submitted after deletion */
+	u32 size;
+	struct nvme_sqe *gsq;
+	struct nvme_sqe *sq;
+	phys_t sq_phys;
+	u32 gtail;		/* tail written by the guest */
+	u32 tail;		/* tail written to the controller */
+	int ntags;
+	int tag_next;
+	struct nvme_req *req;
+};
+
+struct nvme_cq {
+	spinlock_t lock;
+	struct nvme_data *nd;
+	u16 qid;
+	bool active;
+	bool ien;
+	u16 iv;
+	u32 size;
+	struct nvme_cqe *gcq;
+	phys_t gcq_phys;
+	struct nvme_cqe *cq;
+	phys_t cq_phys;
+	u32 head;
+	u16 phase;
+};
+
+struct nvme_ns {
+	u32 nsid;
+	int sector_size;	/* 0 means not identified */
+	bool extended;
+	struct storage_device *storage;
+};
+
+struct nvme_msix {
+	struct nvme_data *nd;
+	int index;
+	int vector;
+	u32 addr;
+	u32 upper;
+	u32 data;
+	u32 ctrl;
+};
+
+struct nvme_data {
+	struct pci_device *pci;
+	int host_id;
+	spinlock_t lock;
+	phys_t mapaddr;
+	uint maplen;
+	u8 *map;
+	void *h_regs;
+	void *h_db;
+	u64 cap;
+	uint dstrd;
+	uint db_len;
+	int maxq;
+	u32 aqa;
+	u64 asq;
+	u64 acq;
+	struct nvme_sq *sq[NVME_MAX_QUEUES];
+	struct nvme_cq *cq[NVME_MAX_QUEUES];
+	spinlock_t ns_lock;
+	struct nvme_ns ns[NVME_MAX_NS];
+	u8 msix_cap;
+	int msix_bir;
+	u32 msix_off;
+	int msix_num;
+	int msix_vecnum;
+	u16 msix_ctrl;
+	phys_t msix_addr;
+	u32 *msix_map;
+	bool msix_in_regs;	/* table in the controller register page */
+	void *h_msix;
+	struct nvme_msix *msix;
+	void *timer;
+	bool removed;
+};
+
+static const char driver_name[] = "nvme";
+static int nvme_host_id = 0;
+
+static void nvme_sq_submit (struct nvme_sq *sq);
+static int nvme_cq_process (struct nvme_cq *cq);
+
+/************************************************************/
+/* Registers */
+
+static u32
+nvme_read32 (struct nvme_data *nd, uint offset)
+{
+	volatile u32 *p = (volatile u32 *)(nd->map + offset);
+
+	return *p;
+}
+
+static void
+nvme_write32 (struct nvme_data *nd, uint offset, u32 data)
+{
+	volatile u32 *p = (volatile u32 *)(nd->map + offset);
+
+	asm ("" : : : "memory");
+	*p = data;
+}
+
+static void
+nvme_write64 (struct nvme_data *nd, uint offset, u64 data)
+{
+	nvme_write32 (nd, offset, data);
+	nvme_write32 (nd, offset + 4, data >> 32);
+}
+
+static void
+nvme_readwrite (struct nvme_data *nd, uint offset, bool wr, void *buf,
+		uint len)
+{
+	u8 *p;
+
+	asm ("" : : : "memory");
+	p = nd->map + offset;
+	if (wr)
+		memcpy (p, buf, len);
+	else
+		memcpy (buf, p, len);
+	asm ("" : : : "memory");
+}
+
+static void
+nvme_ring (struct nvme_data *nd, u16 qid, bool cq, u32 value)
+{
+	nvme_write32 (nd, NVME_DOORBELL + (qid * 2 + cq) * nd->dstrd, value);
+}
+
+/* copy bytes of a register value overlapping an access to the buffer */
+static bool
+nvme_copy_out (uint offset, void *buf, uint len, uint reg, void *val,
+	       uint vlen)
+{
+	uint s, e;
+
+	s = offset > reg ? offset : reg;
+	e = offset + len < reg + vlen ? offset + len : reg + vlen;
+	if (s >= e)
+		return false;
+	memcpy ((u8 *)buf + (s - offset), (u8 *)val + (s - reg), e - s);
+	return true;
+}
+
+/* copy bytes of the buffer overlapping a register to the value */
+static bool
+nvme_copy_in (uint offset, void *buf, uint len, uint reg, void *val,
+	      uint vlen)
+{
+	uint s, e;
+
+	s = offset > reg ? offset : reg;
+	e = offset + len < reg + vlen ? offset + len : reg + vlen;
+	if (s >= e)
+		return false;
+	memcpy ((u8 *)val + (s - reg), (u8 *)buf + (s - offset), e - s);
+	return true;
+}
+
+/* CAP seen by the guest.  Queues are shadowed in contiguous VMM
+ * memory of 4KiB pages, and a controller memory buffer would let
+ * the guest bypass the shadow queues. */
+static u64
+nvme_cap (struct nvme_data *nd)
+{
+	u64 cap = nd->cap;
+
+	if ((cap & NVME_CAP_MQES_MASK) > NVME_MAX_QSIZE - 1)
+		cap = (cap & ~NVME_CAP_MQES_MASK) | (NVME_MAX_QSIZE - 1);
+	cap |= NVME_CAP_CQR_BIT;
+	cap &= ~(NVME_CAP_MPS_MASK << NVME_CAP_MPSMAX_SHIFT);
+	cap &= ~(NVME_CAP_CMBS_BIT | NVME_CAP_PMRS_BIT);
+	return cap;
+}
+
+/************************************************************/
+/* Namespaces */
+
+static bool
+nvme_ns_get (struct nvme_data *nd, u32 nsid, struct nvme_req *req,
+	     bool *extended)
+{
+	int i;
+	bool ret = false;
+
+	spinlock_lock (&nd->ns_lock);
+	for (i = 0; i < NVME_MAX_NS; i++) {
+		if (nd->ns[i].nsid == nsid && nd->ns[i].sector_size) {
+			req->storage = nd->ns[i].storage;
+			req->sector_size = nd->ns[i].sector_size;
+			*extended = nd->ns[i].extended;
+			ret = true;
+			break;
+		}
+	}
+	spinlock_unlock (&nd->ns_lock);
+	return ret;
+}
+
+static void
+nvme_ns_set (struct nvme_data *nd, u32 nsid, int sector_size, bool extended)
+{
+	struct nvme_ns *ns = NULL;
+	int i;
+
+	/* namespaces are changed only by admin completions, so the
+	   entry found here does not move while storage_new() runs */
+	spinlock_lock (&nd->ns_lock);
+	for (i = 0; i < NVME_MAX_NS; i++) {
+		if (nd->ns[i].nsid == nsid) {
+			ns = &nd->ns[i];
+			break;
+		}
+		if (!ns && !nd->ns[i].nsid)
+			ns = &nd->ns[i];
+	}
+	if (ns)
+		ns->nsid = nsid;
+	spinlock_unlock (&nd->ns_lock);
+	if (!ns) {
+		printf ("NVMe %d: too many namespaces, nsid %u ignored\n",
+			nd->host_id, nsid);
+		return;
+	}
+	if (!ns->storage)
+		ns->storage = storage_new (STORAGE_TYPE_NVME, nd->host_id,
+					   nsid, NULL, NULL);
+	spinlock_lock (&nd->ns_lock);
+	ns->sector_size = sector_size;
+	ns->extended = extended;
+	spinlock_unlock (&nd->ns_lock);
+}
+
+static void
+nvme_ns_invalidate (struct nvme_data *nd, u32 nsid)
+{
+	int i;
+
+	spinlock_lock (&nd->ns_lock);
+	for (i = 0; i < NVME_MAX_NS; i++)
+		if (nsid == 0 || nsid == 0xFFFFFFFF || nd->ns[i].nsid == nsid)
+			nd->ns[i].sector_size = 0;
+	spinlock_unlock (&nd->ns_lock);
+}
+
+/************************************************************/
+/* Data pointers */
+
+static bool
+nvme_seg_add (struct nvme_req *req, phys_t addr, u32 len)
+{
+	struct nvme_seg *s;
+
+	if (req->nseg > 0) {
+		s = &req->seg[req->nseg - 1];
+		if (s->addr + s->len == addr) {
+			s->len += len;
+			return true;
+		}
+	}
+	if (req->nseg >= NVME_MAX_SEGS)
+		return false;
+	s = &req->seg[req->nseg++];
+	s->addr = addr;
+	s->len = len;
+	return true;
+}
+
+/* build the segment list of the guest buffer described by PRPs */
+static bool
+nvme_prp_segs (struct nvme_req *req, u64 prp1, u64 prp2, u32 len)
+{
+	u64 *list;
+	u32 n, i, entries;
+	int nlists = 0;
+
+	req->nseg = 0;
+	n = NVME_PAGESIZE - (prp1 & (NVME_PAGESIZE - 1));
+	if (n > len)
+		n = len;
+	if (!nvme_seg_add (req, prp1, n))
+		return false;
+	len -= n;
+	if (!len)
+		return true;
+	if (len <= NVME_PAGESIZE) {
+		if (prp2 & (NVME_PAGESIZE - 1))
+			return false;
+		return nvme_seg_add (req, prp2, len);
+	}
+	while (len) {
+		if ((prp2 & 7) || ++nlists > NVME_MAX_SEGS)
+			return false;
+		entries = (NVME_PAGESIZE - (prp2 & (NVME_PAGESIZE - 1))) /
+			sizeof *list;
+		list = mapmem_gphys (prp2, entries * sizeof *list, 0);
+		for (i = 0; i < entries && len; i++) {
+			if (i == entries - 1 && len > NVME_PAGESIZE) {
+				/* the last entry points to the next list */
+				prp2 = list[i];
+				break;
+			}
+			n = len < NVME_PAGESIZE ? len : NVME_PAGESIZE;
+			if ((list[i] & (NVME_PAGESIZE - 1)) ||
+			    !nvme_seg_add (req, list[i], n)) {
+				unmapmem (list, entries * sizeof *list);
+				return false;
+			}
+			len -= n;
+		}
+		unmapmem (list, entries * sizeof *list);
+	}
+	return true;
+}
+
+/* build the segment list of the guest buffer described by an SGL */
+static bool
+nvme_sgl_segs (struct nvme_req *req, struct nvme_sgl *sgl1, u32 len)
+{
+	struct nvme_sgl d, *list = NULL;
+	u32 n, i = 0, listlen = 0;
+	int nlists = 0;
+	bool ret = false;
+
+	req->nseg = 0;
+	d = *sgl1;
+	for (;;) {
+		switch (NVME_SGL_TYPE (d.id)) {
+		case NVME_SGL_TYPE_DATA:
+			n = d.len < len ? d.len : len;
+			if (n && !nvme_seg_add (req, d.addr, n))
+				goto out;
+			len -= n;
+			if (!len) {
+				ret = true;
+				goto out;
+			}
+			break;
+		case NVME_SGL_TYPE_SEGMENT:
+		case NVME_SGL_TYPE_LAST_SEGMENT:
+			/* a longer list has more data descriptors than
+			   a request can hold */
+			if (!d.len || d.len % sizeof *list ||
+			    d.len > (NVME_MAX_SEGS + 1) * sizeof *list ||
+			    ++nlists > NVME_MAX_SEGS)
+				goto out;
+			if (list)
+				unmapmem (list, listlen * sizeof *list);
+			listlen = d.len / sizeof *list;
+			list = mapmem_gphys (d.addr, d.len, 0);
+			i = 0;
+			break;
+		default:
+			/* bit buckets and keyed descriptors are not
+			   supported */
+			goto out;
+		}
+		if (!list || i >= listlen)
+			goto out;
+		d = list[i++];
+	}
+out:
+	if (list)
+		unmapmem (list, listlen * sizeof *list);
+	return ret;
+}
+
+static void
+nvme_seg_copy (struct nvme_req *req, u8 *buf, bool wr)
+{
+	void *p;
+	int i;
+
+	for (i = 0; i < req->nseg; i++) {
+		p = mapmem_gphys (req->seg[i].addr, req->seg[i].len,
+				  wr ? MAPMEM_WRITE : 0);
+		if (wr)
+			memcpy (p, buf, req->seg[i].len);
+		else
+			memcpy (buf, p, req->seg[i].len);
+		unmapmem (p, req->seg[i].len);
+		buf += req->seg[i].len;
+	}
+}
+
+/************************************************************/
+/* Shadow buffers */
+
+static void
+nvme_req_free_pages (struct nvme_req *req)
+{
+	int i;
+
+	for (i = 0; i < req->npages; i++)
+		free_page (req->page[i]);
+	req->npages = 0;
+}
+
+/* allocate VMM pages for the data and point the command at them */
+static void
+nvme_req_alloc_pages (struct nvme_req *req, struct nvme_sqe *sqe, int node)
+{
+	int i;
+
+	req->npages = (req->len + NVME_PAGESIZE - 1) / NVME_PAGESIZE;
+	for (i = 0; i < req->npages; i++)
+		alloc_page_node (&req->page[i], &req->page_phys[i], node);
+	sqe->flags &= ~NVME_SQE_FLAGS_PSDT_MASK;
+	sqe->dptr[0] = req->page_phys[0];
+	sqe->dptr[1] = 0;
+	if (req->npages == 2) {
+		sqe->dptr[1] = req->page_phys[1];
+	} else if (req->npages > 2) {
+		if (!req->prplist)
+			alloc_page_node ((void **)&req->prplist,
+					 &req->prplist_phys, node);
+		for (i = 1; i < req->npages; i++)
+			req->prplist[i - 1] = req->page_phys[i];
+		sqe->dptr[1] = req->prplist_phys;
+	}
+}
+
+/* encrypt the guest buffer to the shadow buffer, or decrypt the
+ * shadow buffer to the guest buffer */
+static int
+nvme_crypt (struct nvme_req *req, bool wr)
+{
+	struct storage_iovec giov[NVME_MAX_SEGS];
+	struct storage_iovec siov[NVME_MAX_XFER_PAGES];
+	struct storage_access access;
+	u32 len = req->len;
+	int i, ret;
+
+	for (i = 0; i < req->npages; i++) {
+		siov[i].base = req->page[i];
+		siov[i].len = len < NVME_PAGESIZE ? len : NVME_PAGESIZE;
+		len -= siov[i].len;
+	}
+	for (i = 0; i < req->nseg; i++) {
+		giov[i].base = mapmem_gphys (req->seg[i].addr, req->seg[i].len,
+					     wr ? 0 : MAPMEM_WRITE);
+		giov[i].len = req->seg[i].len;
+	}
+	access.rw = wr ? STORAGE_WRITE : STORAGE_READ;
+	access.lba = req->lba;
+	access.count = req->count;
+	access.sector_size = req->sector_size;
+	if (wr)
+		ret = storage_handle_sectors_iov (req->storage, &access,
+						  giov, req->nseg,
+						  siov, req->npages);
+	else
+		ret = storage_handle_sectors_iov (req->storage, &access,
+						  siov, req->npages,
+						  giov, req->nseg);
+	for (i = 0; i < req->nseg; i++)
+		unmapmem (giov[i].base, giov[i].len);
+	return ret;
+}
+
+/************************************************************/
+/* Queues */
+
+static int
+nvme_queue_pages (u32 len)
+{
+	return (len + PAGESIZE - 1) / PAGESIZE;
+}
+
+static bool
+nvme_cq_create (struct nvme_data *nd, u16 qid, u32 size, phys_t gphys,
+		u16 iv, bool ien)
+{
+	struct nvme_cq *cq = nd->cq[qid];
+	void *virt;
+	u32 len;
+
+	if (!cq) {
+		cq = alloc (sizeof *cq);
+		memset (cq, 0, sizeof *cq);
+		spinlock_init (&cq->lock);
+		cq->nd = nd;
+		cq->qid = qid;
+		asm ("" : : : "memory");
+		nd->cq[qid] = cq;
+	}
+	spinlock_lock (&cq->lock);
+	if (cq->cq) {
+		spinlock_unlock (&cq->lock);
+		return false;
+	}
+	len = size * sizeof *cq->cq;
+	alloc_pages_node (&virt, &cq->cq_phys, nvme_queue_pages (len),
+			  nd->pci->node);
+	memset (virt, 0, len);
+	cq->cq = virt;
+	cq->gcq = mapmem_gphys (gphys, len, MAPMEM_WRITE);
+	cq->gcq_phys = gphys;
+	cq->size = size;
+	cq->iv = iv;
+	cq->ien = ien;
+	cq->head = 0;
+	cq->phase = NVME_CQE_PHASE_BIT;
+	cq->active = true;
+	spinlock_unlock (&cq->lock);
+	return true;
+}
+
+static void
+nvme_cq_release (struct nvme_cq *cq)
+{
+	spinlock_lock (&cq->lock);
+	cq->active = false;
+	if (cq->cq) {
+		free_page (cq->cq);
+		unmapmem (cq->gcq, cq->size * sizeof *cq->gcq);
+		cq->cq = NULL;
+		cq->gcq = NULL;
+	}
+	spinlock_unlock (&cq->lock);
+}
+
+static bool
+nvme_sq_create (struct nvme_data *nd, u16 qid, u32 size, phys_t gphys,
+		u16 cqid)
+{
+	struct nvme_sq *sq = nd->sq[qid];
+	void *virt;
+	u32 len;
+	int i;
+
+	if (!sq) {
+		sq = alloc (sizeof *sq);
+		memset (sq, 0, sizeof *sq);
+		spinlock_init (&sq->lock);
+		sq->nd = nd;
+		sq->qid = qid;
+		sq->req = alloc (sizeof *sq->req * NVME_MAX_TAGS);
+		for (i = 0; i < NVME_MAX_TAGS; i++) {
+			sq->req[i].used = false;
+			sq->req[i].npages = 0;
+			sq->req[i].prplist = NULL;
+		}
+		asm ("" : : : "memory");
+		nd->sq[qid] = sq;
+	}
+	spinlock_lock (&sq->lock);
+	if (sq->sq) {
+		spinlock_unlock (&sq->lock);
+		return false;
+	}
+	len = size * sizeof *sq->sq;
+	alloc_pages_node (&virt, &sq->sq_phys, nvme_queue_pages (len),
+			  nd->pci->node);
+	memset (virt, 0, len);
+	sq->sq = virt;
+	sq->gsq = mapmem_gphys (gphys, len, 0);
+	sq->size = size;
+	sq->cqid = cqid;
+	sq->gtail = 0;
+	sq->tail = 0;
+	sq->ntags = size < NVME_MAX_TAGS ? size : NVME_MAX_TAGS;
+	sq->tag_next = 0;
+	sq->waiting = false;
+	sq->deleting = false;
+	sq->active = true;
+	spinlock_unlock (&sq->lock);
+	return true;
+}
+
+static void
+nvme_sq_release (struct nvme_sq *sq)
+{
+	int i;
+
+	spinlock_lock (&sq->lock);
+	sq->active = false;
+	if (sq->sq) {
+		for (i = 0; i < NVME_MAX_TAGS; i++) {
+			nvme_req_free_pages (&sq->req[i]);
+			sq->req[i].used = false;
+		}
+		free_page (sq->sq);
+		unmapmem (sq->gsq, sq->size * sizeof *sq->gsq);
+		sq->sq = NULL;
+		sq->gsq = NULL;
+	}
+	spinlock_unlock (&sq->lock);
+}
+
+static struct nvme_req *
+nvme_req_get (struct nvme_sq *sq, u16 tag)
+{
+	struct nvme_req *req = NULL;
+
+	spinlock_lock (&sq->lock);
+	if (sq->active && tag < sq->ntags && sq->req[tag].used)
+		req = &sq->req[tag];
+	spinlock_unlock (&sq->lock);
+	return req;
+}
+
+static void
+nvme_req_put (struct nvme_sq *sq, struct nvme_req *req)
+{
+	bool waiting;
+
+	spinlock_lock (&sq->lock);
+	req->used = false;
+	waiting = sq->waiting;
+	spinlock_unlock (&sq->lock);
+	if (waiting)
+		nvme_sq_submit (sq);
+}
+
+/* called with sq->lock held */
+static struct nvme_req *
+nvme_req_alloc (struct nvme_sq *sq)
+{
+	struct nvme_req *req;
+	int i, tag;
+
+	for (i = 0; i < sq->ntags; i++) {
+		tag = (sq->tag_next + i) % sq->ntags;
+		req = &sq->req[tag];
+		if (!req->used) {
+			sq->tag_next = (tag + 1) % sq->ntags;
+			req->used = true;
+			req->type = NVME_REQ_PASS;
+			req->status = 0;
+			req->nseg = 0;
+			req->npages = 0;
+			return req;
+		}
+	}
+	return NULL;
+}
+
+static bool
+nvme_cq_intercepted (struct nvme_data *nd, struct nvme_cq *cq)
+{
+	return cq->ien && (nd->msix_ctrl & NVME_MSIX_CTRL_ENABLE_BIT) &&
+		cq->iv < nd->msix_vecnum && nd->msix[cq->iv].vector >= 0;
+}
+
+static void
+nvme_reset_queues (struct nvme_data *nd)
+{
+	int i;
+
+	for (i = 0; i < NVME_MAX_QUEUES; i++) {
+		if (nd->sq[i])
+			nvme_sq_release (nd->sq[i]);
+		if (nd->cq[i])
+			nvme_cq_release (nd->cq[i]);
+	}
+}
+
+/************************************************************/
+/* Commands */
+
+/* The controller runs a harmless command instead of a command that
+ * cannot be shadowed, and its completion reports the status. */
+static void
+nvme_cmd_reject (struct nvme_sqe *sqe, struct nvme_req *req, bool admin,
+		 u16 status)
+{
+	u32 nsid = sqe->nsid;
+
+	nvme_req_free_pages (req);
+	memset (sqe, 0, sizeof *sqe);
+	if (admin) {
+		sqe->opcode = NVME_ADMIN_GET_FEATURES;
+		sqe->cdw10 = NVME_FEAT_ARBITRATION;
+	} else {
+		sqe->opcode = NVME_CMD_FLUSH;
+		sqe->nsid = nsid;
+	}
+	req->type = NVME_REQ_PASS;
+	req->status = status;
+}
+
+static void
+nvme_rw_prehook (struct nvme_data *nd, struct nvme_sqe *sqe,
+		 struct nvme_req *req)
+{
+	bool extended, ok;
+
+	if (!nvme_ns_get (nd, sqe->nsid, req, &extended)) {
+		/* the guest retries after identifying the namespace */
+		nvme_cmd_reject (sqe, req, false, NVME_SC_NS_NOT_READY);
+		return;
+	}
+	if (extended) {
+		/* metadata interleaved with data is not supported */
+		nvme_cmd_reject (sqe, req, false, NVME_SC_INVALID_FORMAT |
+				 NVME_STATUS_DNR_BIT);
+		return;
+	}
+	req->wr = sqe->opcode != NVME_CMD_READ;
+	req->lba = sqe->cdw10 | (u64)sqe->cdw11 << 32;
+	req->count = (sqe->cdw12 & 0xFFFF) + 1;
+	req->len = req->count * req->sector_size;
+	if (req->len > NVME_MAX_XFER_PAGES * NVME_PAGESIZE) {
+		nvme_cmd_reject (sqe, req, false, NVME_SC_INVALID_FIELD |
+				 NVME_STATUS_DNR_BIT);
+		return;
+	}
+	if (sqe->flags & NVME_SQE_FLAGS_PSDT_MASK)
+		ok = nvme_sgl_segs (req, (struct nvme_sgl *)sqe->dptr,
+				    req->len);
+	else
+		ok = nvme_prp_segs (req, sqe->dptr[0], sqe->dptr[1],
+				    req->len);
+	if (!ok) {
+		nvme_cmd_reject (sqe, req, false, NVME_SC_INVALID_FIELD |
+				 NVME_STATUS_DNR_BIT);
+		return;
+	}
+	nvme_req_alloc_pages (req, sqe, nd->pci->node);
+	if (req->wr && nvme_crypt (req, true) < 0) {
+		nvme_cmd_reject (sqe, req, false, NVME_SC_INTERNAL);
+		return;
+	}
+	req->type = NVME_REQ_RW;
+}
+
+static void
+nvme_io_prehook (struct nvme_data *nd, struct nvme_sqe *sqe,
+		 struct nvme_req *req)
+{
+	switch (sqe->opcode) {
+	case NVME_CMD_READ:
+	case NVME_CMD_WRITE:
+	case NVME_CMD_COMPARE:
+		nvme_rw_prehook (nd, sqe, req);
+		break;
+	case NVME_CMD_FLUSH:
+	case NVME_CMD_WRITE_UNCOR:
+	case NVME_CMD_DSM:
+	case NVME_CMD_VERIFY:
+	case NVME_CMD_RESV_REGISTER:
+	case NVME_CMD_RESV_REPORT:
+	case NVME_CMD_RESV_ACQUIRE:
+	case NVME_CMD_RESV_RELEASE:
+		/* no sector data is transferred */
+		break;
+	default:
+		/* write zeroes, copy, zone append and vendor specific
+		   commands would access sector data without
+		   encryption.  the first two are also hidden in the
+		   identify controller data. */
+		nvme_cmd_reject (sqe, req, false, NVME_SC_INVALID_OPCODE |
+				 NVME_STATUS_DNR_BIT);
+	}
+}
+
+static void
+nvme_admin_prehook (struct nvme_data *nd, struct nvme_sqe *sqe,
+		    struct nvme_req *req)
+{
+	u16 qid = sqe->cdw10 & 0xFFFF;
+	u32 qsize = (sqe->cdw10 >> 16) + 1;
+	u32 nsq, ncq;
+
+	switch (sqe->opcode) {
+	case NVME_ADMIN_CREATE_CQ:
+		if (!qid || qid >= nd->maxq) {
+			nvme_cmd_reject (sqe, req, true, NVME_SC_INVALID_QID |
+					 NVME_STATUS_DNR_BIT);
+		} else if (qsize > NVME_MAX_QSIZE ||
+			   !(sqe->cdw11 & NVME_QUEUE_PC_BIT)) {
+			nvme_cmd_reject (sqe, req, true,
+					 NVME_SC_INVALID_QSIZE |
+					 NVME_STATUS_DNR_BIT);
+		} else if (nd->msix_vecnum &&
+			   (sqe->cdw11 & NVME_QUEUE_IEN_BIT) &&
+			   sqe->cdw11 >> 16 >= nd->msix_vecnum) {
+			/* the entry is not remapped, so the controller
+			   would interrupt the guest before the
+			   completions are copied */
+			nvme_cmd_reject (sqe, req, true, NVME_SC_INVALID_IV |
+					 NVME_STATUS_DNR_BIT);
+		} else if (!nvme_cq_create (nd, qid, qsize, sqe->dptr[0],
+					    sqe->cdw11 >> 16,
+					    !!(sqe->cdw11 &
+					       NVME_QUEUE_IEN_BIT))) {
+			nvme_cmd_reject (sqe, req, true, NVME_SC_INVALID_QID |
+					 NVME_STATUS_DNR_BIT);
+		} else {
+			sqe->dptr[0] = nd->cq[qid]->cq_phys;
+			req->type = NVME_REQ_CREATE_CQ;
+			req->qid = qid;
+		}
+		break;
+	case NVME_ADMIN_CREATE_SQ:
+		if (!qid || qid >= nd->maxq) {
+			nvme_cmd_reject (sqe, req, true, NVME_SC_INVALID_QID |
+					 NVME_STATUS_DNR_BIT);
+		} else if (qsize > NVME_MAX_QSIZE ||
+			   !(sqe->cdw11 & NVME_QUEUE_PC_BIT)) {
+			nvme_cmd_reject (sqe, req, true,
+					 NVME_SC_INVALID_QSIZE |
+					 NVME_STATUS_DNR_BIT);
+		} else if (!nvme_sq_create (nd, qid, qsize, sqe->dptr[0],
+					    sqe->cdw11 >> 16)) {
+			nvme_cmd_reject (sqe, req, true, NVME_SC_INVALID_QID |
+					 NVME_STATUS_DNR_BIT);
+		} else {
+			sqe->dptr[0] = nd->sq[qid]->sq_phys;
+			req->type = NVME_REQ_CREATE_SQ;
+			req->qid = qid;
+		}
+		break;
+	case NVME_ADMIN_DELETE_SQ:
+		/* commands waiting for a tag are dropped like the
+		   commands the controller has not fetched, because
+		   the doorbell of a deleted queue must not be
+		   written */
+		if (qid && qid < nd->maxq && nd->sq[qid]) {
+			spinlock_lock (&nd->sq[qid]->lock);
+			nd->sq[qid]->deleting = true;
+			spinlock_unlock (&nd->sq[qid]->lock);
+		}
+		/* fall through */
+	case NVME_ADMIN_DELETE_CQ:
+		req->type = sqe->opcode == NVME_ADMIN_DELETE_SQ ?
+			NVME_REQ_DELETE_SQ : NVME_REQ_DELETE_CQ;
+		req->qid = qid;
+		break;
+	case NVME_ADMIN_IDENTIFY:
+		if (!nvme_prp_segs (req, sqe->dptr[0], sqe->dptr[1],
+				    NVME_IDENTIFY_LEN))
+			break;
+		req->type = NVME_REQ_IDENTIFY;
+		req->cns = sqe->cdw10 & 0xFF;
+		req->nsid = sqe->nsid;
+		break;
+	case NVME_ADMIN_SET_FEATURES:
+		if ((sqe->cdw10 & 0xFF) != NVME_FEAT_NUM_QUEUES)
+			break;
+		/* the values are 0's based */
+		nsq = sqe->cdw11 & 0xFFFF;
+		ncq = sqe->cdw11 >> 16;
+		if (nsq > nd->maxq - 2)
+			nsq = nd->maxq - 2;
+		if (ncq > nd->maxq - 2)
+			ncq = nd->maxq - 2;
+		sqe->cdw11 = nsq | ncq << 16;
+		break;
+	case NVME_ADMIN_DBBUF_CONFIG:
+		/* shadow doorbells would bypass the doorbell registers */
+		nvme_cmd_reject (sqe, req, true, NVME_SC_INVALID_OPCODE |
+				 NVME_STATUS_DNR_BIT);
+		break;
+	case NVME_ADMIN_FORMAT_NVM:
+	case NVME_ADMIN_SANITIZE:
+	case NVME_ADMIN_NS_MGMT:
+	case NVME_ADMIN_NS_ATTACH:
+		req->type = NVME_REQ_NS_CHANGE;
+		req->nsid = sqe->opcode == NVME_ADMIN_SANITIZE ? 0 :
+			sqe->nsid;
+		break;
+	}
+}
+
+static void
+nvme_identify_posthook (struct nvme_data *nd, struct nvme_req *req)
+{
+	u8 *buf;
+	u16 v16;
+	u32 lbaf;
+	int lbads;
+
+	buf = alloc (NVME_IDENTIFY_LEN);
+	nvme_seg_copy (req, buf, false);
+	if (req->cns == NVME_IDENTIFY_CNS_CTRL) {
+		if (!buf[NVME_ID_CTRL_MDTS] ||
+		    buf[NVME_ID_CTRL_MDTS] > NVME_MAX_MDTS)
+			buf[NVME_ID_CTRL_MDTS] = NVME_MAX_MDTS;
+		memcpy (&v16, &buf[NVME_ID_CTRL_OACS], sizeof v16);
+		v16 &= ~NVME_ID_CTRL_OACS_DBBUF_BIT;
+		memcpy (&buf[NVME_ID_CTRL_OACS], &v16, sizeof v16);
+		memcpy (&v16, &buf[NVME_ID_CTRL_ONCS], sizeof v16);
+		v16 &= ~(NVME_ID_CTRL_ONCS_WRITE_ZEROES_BIT |
+			 NVME_ID_CTRL_ONCS_COPY_BIT);
+		memcpy (&buf[NVME_ID_CTRL_ONCS], &v16, sizeof v16);
+		nvme_seg_copy (req, buf, true);
+	} else if (req->cns == NVME_IDENTIFY_CNS_NS && req->nsid &&
+		   req->nsid != 0xFFFFFFFF) {
+		memcpy (&lbaf, &buf[NVME_ID_NS_LBAF + 4 *
+				    (buf[NVME_ID_NS_FLBAS] &
+				     NVME_ID_NS_FLBAS_INDEX_MASK)],
+			sizeof lbaf);
+		lbads = (lbaf >> NVME_ID_NS_LBAF_LBADS_SHIFT) & 0xFF;
+		if (lbads < 9 || lbads > 16)
+			/* an inactive namespace returns zeros */
+			nvme_ns_invalidate (nd, req->nsid);
+		else
+			nvme_ns_set (nd, req->nsid, 1 << lbads,
+				     (buf[NVME_ID_NS_FLBAS] &
+				      NVME_ID_NS_FLBAS_EXTENDED_BIT) &&
+				     (lbaf & NVME_ID_NS_LBAF_MS_MASK));
+	}
+	free (buf);
+}
+
+static void
+nvme_req_done (struct nvme_data *nd, struct nvme_req *req,
+	       struct nvme_cqe *cqe)
+{
+	bool ok = !(cqe->status & NVME_CQE_STATUS_MASK);
+	struct nvme_sq *sq;
+
+	switch (req->type) {
+	case NVME_REQ_PASS:
+		break;
+	case NVME_REQ_RW:
+		if (ok && !req->wr && nvme_crypt (req, false) < 0)
+			req->status = NVME_SC_INTERNAL;
+		nvme_req_free_pages (req);
+		break;
+	case NVME_REQ_CREATE_SQ:
+		if (!ok)
+			nvme_sq_release (nd->sq[req->qid]);
+		break;
+	case NVME_REQ_CREATE_CQ:
+		if (!ok)
+			nvme_cq_release (nd->cq[req->qid]);
+		break;
+	case NVME_REQ_DELETE_SQ:
+		if (!req->qid || req->qid >= nd->maxq)
+			break;
+		sq = nd->sq[req->qid];
+		if (!sq)
+			break;
+		if (!ok) {
+			spinlock_lock (&sq->lock);
+			sq->deleting = false;
+			spinlock_unlock (&sq->lock);
+			nvme_sq_submit (sq);
+			break;
+		}
+		/* the controller has posted completions of the
+		   aborted commands.  pass them to the guest before
+		   the shadow queue goes away. */
+		if (sq->cqid && sq->cqid < nd->maxq && nd->cq[sq->cqid])
+			nvme_cq_process (nd->cq[sq->cqid]);
+		nvme_sq_release (sq);
+		break;
+	case NVME_REQ_DELETE_CQ:
+		if (ok && req->qid && req->qid < nd->maxq &&
+		    nd->cq[req->qid])
+			nvme_cq_release (nd->cq[req->qid]);
+		break;
+	case NVME_REQ_IDENTIFY:
+		if (ok)
+			nvme_identify_posthook (nd, req);
+		break;
+	case NVME_REQ_NS_CHANGE:
+		if (ok)
+			nvme_ns_invalidate (nd, req->nsid);
+		break;
+	}
+}
+
+/* copy new completions from the shadow queue to the guest queue.
+ * both queues have the same size and the head doorbell of the guest
+ * is passed to the controller, so the guest queue never
+ * overflows. */
+static int
+nvme_cq_process (struct nvme_cq *cq)
+{
+	struct nvme_data *nd = cq->nd;
+	volatile struct nvme_cqe *p, *g;
+	struct nvme_cqe cqe;
+	struct nvme_req *req;
+	struct nvme_sq *sq;
+	int n = 0;
+
+	spinlock_lock (&cq->lock);
+	while (cq->active) {
+		p = &cq->cq[cq->head];
+		if ((p->status & NVME_CQE_PHASE_BIT) != cq->phase)
+			break;
+		asm ("" : : : "memory");
+		cqe.dw0 = p->dw0;
+		cqe.dw1 = p->dw1;
+		cqe.sqhd = p->sqhd;
+		cqe.sqid = p->sqid;
+		cqe.cid = p->cid;
+		cqe.status = p->status;
+		sq = cqe.sqid < nd->maxq ? nd->sq[cqe.sqid] : NULL;
+		req = sq ? nvme_req_get (sq, cqe.cid) : NULL;
+		if (req) {
+			nvme_req_done (nd, req, &cqe);
+			cqe.cid = req->cid;
+			if (req->status)
+				cqe.status = (cqe.status & NVME_CQE_PHASE_BIT)
+					| req->status;
+			nvme_req_put (sq, req);
+		} else {
+			printf ("NVMe %d: unknown completion sq %u cid %u\n",
+				nd->host_id, cqe.sqid, cqe.cid);
+		}
+		/* the phase tag is written last */
+		g = &cq->gcq[cq->head];
+		g->dw0 = cqe.dw0;
+		g->dw1 = cqe.dw1;
+		g->sqhd = cqe.sqhd;
+		g->sqid = cqe.sqid;
+		g->cid = cqe.cid;
+		asm ("" : : : "memory");
+		g->status = cqe.status;
+		/* the mapping outlives the dirty page mark of
+		   mapmem_gphys() */
+		dirtylog_mark (cq->gcq_phys + cq->head * sizeof *g,
+			       sizeof *g);
+		if (++cq->head == cq->size) {
+			cq->head = 0;
+			cq->phase ^= NVME_CQE_PHASE_BIT;
+		}
+		n++;
+	}
+	spinlock_unlock (&cq->lock);
+	return n;
+}
+
+/* copy new commands from the guest queue to the shadow queue.  both
+ * queues have the same size and the same positions, so the head
+ * reported by the controller is valid for the guest. */
+static void
+nvme_sq_submit (struct nvme_sq *sq)
+{
+	struct nvme_data *nd = sq->nd;
+	struct nvme_sqe sqe;
+	struct nvme_req *req;
+	int n = 0;
+
+	spinlock_lock (&sq->lock);
+	sq->waiting = false;
+	while (sq->active && !sq->deleting && sq->tail != sq->gtail) {
+		req = nvme_req_alloc (sq);
+		if (!req) {
+			/* resumed when a command completes */
+			sq->waiting = true;
+			break;
+		}
+		memcpy (&sqe, &sq->gsq[sq->tail], sizeof sqe);
+		req->cid = sqe.cid;
+		if (sq->qid)
+			nvme_io_prehook (nd, &sqe, req);
+		else
+			nvme_admin_prehook (nd, &sqe, req);
+		sqe.cid = req - sq->req;
+		memcpy (&sq->sq[sq->tail], &sqe, sizeof sqe);
+		if (++sq->tail == sq->size)
+			sq->tail = 0;
+		n++;
+	}
+	if (n)
+		nvme_ring (nd, sq->qid, false, sq->tail);
+	spinlock_unlock (&sq->lock);
+}
+
+/************************************************************/
+/* Controller */
+
+static void
+nvme_enable (struct nvme_data *nd)
+{
+	u32 asqs, acqs;
+
+	/* the controller was reset before it is enabled, so memory
+	   of the previous queues is not accessed any more */
+	nvme_reset_queues (nd);
+	asqs = (nd->aqa & NVME_AQA_ASQS_MASK) + 1;
+	acqs = ((nd->aqa >> NVME_AQA_ACQS_SHIFT) & NVME_AQA_ASQS_MASK) + 1;
+	nvme_cq_create (nd, 0, acqs, nd->acq, 0, true);
+	nvme_sq_create (nd, 0, asqs, nd->asq, 0);
+	nvme_write32 (nd, NVME_AQA, nd->aqa);
+	nvme_write64 (nd, NVME_ASQ, nd->sq[0]->sq_phys);
+	nvme_write64 (nd, NVME_ACQ, nd->cq[0]->cq_phys);
+}
+
+static void
+nvme_disable (struct nvme_data *nd)
+{
+	int i;
+
+	for (i = 0; i < NVME_MAX_QUEUES; i++) {
+		if (nd->sq[i]) {
+			spinlock_lock (&nd->sq[i]->lock);
+			nd->sq[i]->active = false;
+			spinlock_unlock (&nd->sq[i]->lock);
+		}
+		if (nd->cq[i]) {
+			spinlock_lock (&nd->cq[i]->lock);
+			nd->cq[i]->active = false;
+			spinlock_unlock (&nd->cq[i]->lock);
+		}
+	}
+}
+
+static void
+nvme_reg_read (struct nvme_data *nd, uint offset, void *buf, uint len)
+{
+	u64 cap, zero = 0;
+
+	nvme_readwrite (nd, offset, false, buf, len);
+	cap = nvme_cap (nd);
+	nvme_copy_out (offset, buf, len, NVME_CAP, &cap, sizeof cap);
+	nvme_copy_out (offset, buf, len, NVME_AQA, &nd->aqa, sizeof nd->aqa);
+	nvme_copy_out (offset, buf, len, NVME_ASQ, &nd->asq, sizeof nd->asq);
+	nvme_copy_out (offset, buf, len, NVME_ACQ, &nd->acq, sizeof nd->acq);
+	nvme_copy_out (offset, buf, len, NVME_CMBLOC, &zero, sizeof zero);
+}
+
+static void
+nvme_reg_write (struct nvme_data *nd, uint offset, void *buf, uint len)
+{
+	u32 cc, oldcc;
+	u64 dummy;
+
+	/* the admin queue registers are written to the controller
+	   when it is enabled */
+	if (nvme_copy_in (offset, buf, len, NVME_AQA, &nd->aqa,
+			  sizeof nd->aqa) |
+	    nvme_copy_in (offset, buf, len, NVME_ASQ, &nd->asq,
+			  sizeof nd->asq) |
+	    nvme_copy_in (offset, buf, len, NVME_ACQ, &nd->acq,
+			  sizeof nd->acq) |
+	    nvme_copy_in (offset, buf, len, NVME_CMBLOC, &dummy,
+			  sizeof dummy))
+		return;
+	if (offset != NVME_CC || len != sizeof cc) {
+		nvme_readwrite (nd, offset, true, buf, len);
+		return;
+	}
+	memcpy (&cc, buf, sizeof cc);
+	/* the controller may have been reset by a subsystem reset */
+	oldcc = nvme_read32 (nd, NVME_CC);
+	if ((cc & NVME_CC_EN_BIT) && !(oldcc & NVME_CC_EN_BIT))
+		nvme_enable (nd);
+	nvme_write32 (nd, NVME_CC, cc);
+	if (!(cc & NVME_CC_EN_BIT) && (oldcc & NVME_CC_EN_BIT))
+		nvme_disable (nd);
+}
+
+static void nvme_msix_access (struct nvme_data *nd, uint offset, bool wr,
+			      void *buf, uint len);
+
+static int
+nvme_reg_mmhandler (void *data, phys_t gphys, bool wr, void *buf, uint len,
+		    u32 flags)
+{
+	struct nvme_data *nd = data;
+	uint offset = gphys - nd->mapaddr;
+
+	spinlock_lock (&nd->lock);
+	if (nd->msix_in_regs && offset >= nd->msix_off &&
+	    offset < nd->msix_off + nd->msix_vecnum * NVME_MSIX_ENTRY_LEN)
+		nvme_msix_access (nd, offset - nd->msix_off, wr, buf, len);
+	else if (wr)
+		nvme_reg_write (nd, offset, buf, len);
+	else
+		nvme_reg_read (nd, offset, buf, len);
+	spinlock_unlock (&nd->lock);
+	return 1;
+}
+
+/* doorbells are handled without the mmio lock so that queues on
+ * different processors do not wait for each other */
+static int
+nvme_db_mmhandler (void *data, phys_t gphys, bool wr, void *buf, uint len,
+		   u32 flags)
+{
+	struct nvme_data *nd = data;
+	uint offset = gphys - nd->mapaddr - NVME_DOORBELL;
+	uint idx;
+	struct nvme_sq *sq;
+	struct nvme_cq *cq;
+	u32 value;
+
+	if (!wr) {
+		memset (buf, 0, len);
+		return 1;
+	}
+	idx = offset / nd->dstrd;
+	if (len != sizeof value || offset % nd->dstrd)
+		goto pass;
+	memcpy (&value, buf, sizeof value);
+	if (idx & 1) {
+		/* completion queue head */
+		nvme_ring (nd, idx / 2, true, value);
+		cq = nd->cq[idx / 2];
+		if (cq && cq->active && !nvme_cq_intercepted (nd, cq))
+			nvme_cq_process (cq);
+		return 1;
+	}
+	sq = nd->sq[idx / 2];
+	if (!sq || !sq->active || value >= sq->size)
+		goto pass;
+	spinlock_lock (&sq->lock);
+	sq->gtail = value;
+	spinlock_unlock (&sq->lock);
+	nvme_sq_submit (sq);
+	cq = sq->cqid < nd->maxq ? nd->cq[sq->cqid] : NULL;
+	if (cq && cq->active && !nvme_cq_intercepted (nd, cq))
+		nvme_cq_process (cq);
+	return 1;
+pass:
+	nvme_readwrite (nd, NVME_DOORBELL + offset, true, buf, len);
+	return 1;
+}
+
+/************************************************************/
+/* Interrupts */
+
+/* The controller raises a VMM vector at the destination of the guest
+ * entry.  Completions are copied before the vector of the guest is
+ * injected on that processor. */
+static int
+nvme_msix_intr (void *data, int num)
+{
+	struct nvme_msix *m = data;
+	struct nvme_data *nd = m->nd;
+	struct nvme_cq *cq;
+	int i;
+
+	for (i = 0; i < nd->maxq; i++) {
+		cq = nd->cq[i];
+		if (cq && cq->active && cq->ien && cq->iv == m->index)
+			nvme_cq_process (cq);
+	}
+	if (m->ctrl & NVME_MSIX_MASK_BIT)
+		return -1;
+	return m->data & 0xFF;
+}
+
+static void
+nvme_msix_rw32 (struct nvme_data *nd, uint offset, bool wr, u32 *val)
+{
+	struct nvme_msix *m = &nd->msix[offset / NVME_MSIX_ENTRY_LEN];
+	volatile u32 *hw = &nd->msix_map[offset / sizeof *val];
+	u32 *reg;
+
+	switch (offset % NVME_MSIX_ENTRY_LEN) {
+	case 0:
+		reg = &m->addr;
+		break;
+	case 4:
+		reg = &m->upper;
+		break;
+	case 8:
+		reg = &m->data;
+		break;
+	default:
+		reg = &m->ctrl;
+		break;
+	}
+	if (!wr) {
+		*val = *reg;
+		return;
+	}
+	*reg = *val;
+	if (m->vector < 0) {
+		m->vector = exint_pass_intr_alloc (nvme_msix_intr, m);
+		if (m->vector < 0)
+			printf ("NVMe %d: no vector for MSI-X entry %d\n",
+				nd->host_id, m->index);
+	}
+	if (reg == &m->data && m->vector >= 0)
+		*hw = (*val & ~0xFF) | m->vector;
+	else
+		*hw = *val;
+}
+
+static void
+nvme_msix_access (struct nvme_data *nd, uint offset, bool wr, void *buf,
+		  uint len)
+{
+	uint i;
+
+	if ((offset & 3) || (len & 3) ||
+	    offset + len > nd->msix_vecnum * NVME_MSIX_ENTRY_LEN) {
+		if (!wr)
+			memset (buf, 0, len);
+		return;
+	}
+	for (i = 0; i < len; i += 4)
+		nvme_msix_rw32 (nd, offset + i, wr, (u32 *)((u8 *)buf + i));
+}
+
+static int
+nvme_msix_mmhandler (void *data, phys_t gphys, bool wr, void *buf, uint len,
+		     u32 flags)
+{
+	struct nvme_data *nd = data;
+
+	spinlock_lock (&nd->lock);
+	nvme_msix_access (nd, gphys - nd->msix_addr, wr, buf, len);
+	spinlock_unlock (&nd->lock);
+	return 1;
+}
+
+/* release everything left after the hooks are unregistered */
+static void
+nvme_free (struct nvme_data *nd)
+{
+	int i, j;
+
+	nvme_reset_queues (nd);
+	for (i = 0; i < NVME_MAX_QUEUES; i++) {
+		if (nd->sq[i]) {
+			/* the PRP lists are kept while the queue is
+			   deleted and created again */
+			for (j = 0; j < NVME_MAX_TAGS; j++)
+				if (nd->sq[i]->req[j].prplist)
+					free_page (nd->sq[i]->req[j].prplist);
+			free (nd->sq[i]->req);
+			free (nd->sq[i]);
+		}
+		if (nd->cq[i])
+			free (nd->cq[i]);
+	}
+	for (i = 0; i < nd->msix_vecnum; i++)
+		if (nd->msix[i].vector >= 0)
+			exint_pass_intr_free (nd->msix[i].vector);
+	if (nd->msix)
+		free (nd->msix);
+	for (i = 0; i < NVME_MAX_NS; i++)
+		if (nd->ns[i].storage)
+			storage_free (nd->ns[i].storage);
+	printf ("NVMe %d: removed\n", nd->host_id);
+	free (nd);
+}
+
+/* queues not covered by a remapped vector are polled */
+static void
+nvme_timer (void *handle, void *data)
+{
+	struct nvme_data *nd = data;
+	struct nvme_cq *cq;
+	int i;
+
+	/* the queues are released here so that this does not race
+	   with nvme_remove() */
+	if (nd->removed) {
+		timer_free (handle);
+		nvme_free (nd);
+		return;
+	}
+	for (i = 0; i < nd->maxq; i++) {
+		cq = nd->cq[i];
+		if (cq && cq->active && !nvme_cq_intercepted (nd, cq))
+			nvme_cq_process (cq);
+	}
+	timer_set (handle, NVME_POLL_USEC);
+}
+
+static void
+nvme_msix_init (struct nvme_data *nd, int vectors)
+{
+	pci_config_address_t addr;
+	u8 cap;
+	u32 val, table;
+	int i;
+
+	addr = nd->pci->address;
+	addr.reg_no = 0x34 >> 2; /* CAP - Capabilities Pointer */
+	cap = pci_read_config_data8 (addr, 0);
+	while (cap >= 0x40) {
+		addr.reg_no = cap >> 2;
+		val = pci_read_config_data32 (addr, 0);
+		if ((val & 0xFF) == NVME_PCI_CAP_MSIX)
+			goto found;
+		cap = val >> 8;
+	}
+	return;
+found:
+	addr.reg_no = (cap + 4) >> 2;
+	table = pci_read_config_data32 (addr, 0);
+	nd->msix_cap = cap;
+	nd->msix_ctrl = val >> 16;
+	nd->msix_num = (nd->msix_ctrl & NVME_MSIX_CTRL_SIZE_MASK) + 1;
+	nd->msix_bir = table & NVME_MSIX_BIR_MASK;
+	nd->msix_off = table & ~NVME_MSIX_BIR_MASK;
+	nd->msix_vecnum = nd->msix_num < vectors ? nd->msix_num : vectors;
+	if (nd->msix_bir == 0 && nd->msix_off < NVME_REGS_LEN) {
+		/* the table in the controller register page is handled
+		   by the register handler */
+		nd->msix_in_regs = true;
+		if (nd->msix_vecnum > (NVME_REGS_LEN - nd->msix_off) /
+		    NVME_MSIX_ENTRY_LEN)
+			nd->msix_vecnum = (NVME_REGS_LEN - nd->msix_off) /
+				NVME_MSIX_ENTRY_LEN;
+	}
+	if (!nd->msix_vecnum)
+		return;
+	nd->msix = alloc (sizeof *nd->msix * nd->msix_vecnum);
+	for (i = 0; i < nd->msix_vecnum; i++) {
+		nd->msix[i].nd = nd;
+		nd->msix[i].index = i;
+		nd->msix[i].vector = -1;
+		nd->msix[i].addr = 0;
+		nd->msix[i].upper = 0;
+		nd->msix[i].data = 0;
+		nd->msix[i].ctrl = NVME_MSIX_MASK_BIT;
+	}
+}
+
+/************************************************************/
+/* PCI related functions */
+
+static void
+nvme_unreghook_msix (struct nvme_data *nd)
+{
+	if (nd->msix_in_regs)
+		return;
+	if (nd->h_msix) {
+		mmio_unregister (nd->h_msix);
+		unmapmem (nd->msix_map, nd->msix_vecnum * NVME_MSIX_ENTRY_LEN);
+		nd->h_msix = NULL;
+	}
+}
+
+static void
+nvme_reghook_msix (struct nvme_data *nd, struct pci_bar_info *bar)
+{
+	uint len = nd->msix_vecnum * NVME_MSIX_ENTRY_LEN;
+
+	nvme_unreghook_msix (nd);
+	if (!len || bar->type != PCI_BAR_INFO_TYPE_MEM ||
+	    bar->len < nd->msix_off + len)
+		return;
+	nd->msix_addr = bar->base + nd->msix_off;
+	if (nd->msix_in_regs) {
+		/* the register page is already mapped and hooked */
+		nd->msix_map = (u32 *)((u8 *)nd->map + nd->msix_off);
+		return;
+	}
+	nd->msix_map = mapmem_gphys (nd->msix_addr, len, MAPMEM_WRITE);
+	if (!nd->msix_map)
+		panic ("mapmem failed");
+	nd->h_msix = mmio_register (nd->msix_addr, len, nvme_msix_mmhandler,
+				    nd);
+	if (!nd->h_msix)
+		panic ("mmio_register failed");
+}
+
+static void
+nvme_unreghook (struct nvme_data *nd)
+{
+	if (nd->map) {
+		mmio_unregister (nd->h_regs);
+		mmio_unregister (nd->h_db);
+		unmapmem (nd->map, nd->maplen);
+		nd->map = NULL;
+	}
+}
+
+static void
+nvme_reghook (struct nvme_data *nd, struct pci_bar_info *bar)
+{
+	nvme_unreghook (nd);
+	nd->mapaddr = bar->base;
+	nd->maplen = bar->len;
+	nd->map = mapmem_gphys (bar->base, bar->len, MAPMEM_WRITE);
+	if (!nd->map)
+		panic ("mapmem failed");
+	nd->h_regs = mmio_register (bar->base, NVME_REGS_LEN,
+				    nvme_reg_mmhandler, nd);
+	if (!nd->h_regs)
+		panic ("mmio_register failed");
+	nd->h_db = mmio_register_unlocked (bar->base + NVME_DOORBELL,
+					   nd->db_len, nvme_db_mmhandler, nd);
+	if (!nd->h_db)
+		panic ("mmio_register failed");
+}
+
+static void
+nvme_new (struct pci_device *pci_device)
+{
+	struct nvme_data *nd;
+	struct pci_bar_info bar_info;
+	volatile u64 *cap;
+	uint db_len;
+	int vectors = NVME_MSIX_VECTORS;
+	char *option;
+
+	pci_get_bar_info (pci_device, 0, &bar_info);
+	if (bar_info.type != PCI_BAR_INFO_TYPE_MEM ||
+	    bar_info.len < NVME_DOORBELL + 8) {
+		printf ("NVMe: invalid BAR0\n");
+		return;
+	}
+	option = pci_device->driver_options[0];
+	if (option)
+		vectors = pci_driver_option_get_int (option, NULL, 10);
+	nd = alloc (sizeof *nd);
+	memset (nd, 0, sizeof *nd);
+	nd->pci = pci_device;
+	spinlock_init (&nd->lock);
+	spinlock_init (&nd->ns_lock);
+	cap = mapmem_gphys (bar_info.base, sizeof *cap, 0);
+	nd->cap = *cap;
+	unmapmem ((void *)cap, sizeof *cap);
+	if ((nd->cap >> NVME_CAP_MPSMIN_SHIFT) & NVME_CAP_MPS_MASK) {
+		printf ("NVMe: minimum memory page size is not 4KiB\n");
+		free (nd);
+		return;
+	}
+	nvme_msix_init (nd, vectors);
+	nd->dstrd = 4 << ((nd->cap >> NVME_CAP_DSTRD_SHIFT) &
+			  NVME_CAP_DSTRD_MASK);
+	db_len = NVME_MAX_QUEUES * 2 * nd->dstrd;
+	if (db_len > bar_info.len - NVME_DOORBELL)
+		db_len = bar_info.len - NVME_DOORBELL;
+	if (nd->msix_vecnum && nd->msix_bir == 0 &&
+	    db_len > nd->msix_off - NVME_DOORBELL)
+		db_len = nd->msix_off - NVME_DOORBELL;
+	nd->db_len = db_len;
+	nd->maxq = db_len / (2 * nd->dstrd);
+	if (nd->maxq < 2) {
+		printf ("NVMe: no room for doorbells\n");
+		free (nd);
+		return;
+	}
+	nvme_reghook (nd, &bar_info);
+	if (nd->msix_vecnum) {
+		pci_get_bar_info (pci_device, nd->msix_bir, &bar_info);
+		nvme_reghook_msix (nd, &bar_info);
+	}
+	nd->aqa = nvme_read32 (nd, NVME_AQA);
+	nd->asq = nvme_read32 (nd, NVME_ASQ) |
+		(u64)nvme_read32 (nd, NVME_ASQ + 4) << 32;
+	nd->acq = nvme_read32 (nd, NVME_ACQ) |
+		(u64)nvme_read32 (nd, NVME_ACQ + 4) << 32;
+	nd->host_id = nvme_host_id++;
+	if (nvme_read32 (nd, NVME_CC) & NVME_CC_EN_BIT)
+		printf ("NVMe %d: controller is enabled, shadowing starts"
+			" after reset\n", nd->host_id);
+	nd->timer = timer_new (nvme_timer, nd);
+	timer_set (nd->timer, NVME_POLL_USEC);
+	pci_device->host = nd;
+	pci_device->driver->options.use_base_address_mask_emulation = 1;
+	printf ("NVMe %d: %02x:%02x.%01x initialized, %d queues,"
+		" %d/%d MSI-X vectors\n", nd->host_id,
+		pci_device->address.bus_no, pci_device->address.device_no,
+		pci_device->address.func_no, nd->maxq, nd->msix_vecnum,
+		nd->msix_num);
+}
+
+/* The controller has been unplugged.  Commands in flight are lost
+ * as the guest OS loses them. */
+static void
+nvme_remove (struct pci_device *pci_device)
+{
+	struct nvme_data *nd = pci_device->host;
+
+	if (!nd)
+		return;
+	spinlock_lock (&nd->lock);
+	nvme_unreghook_msix (nd);
+	nvme_unreghook (nd);
+	nd->removed = true;
+	spinlock_unlock (&nd->lock);
+	timer_set (nd->timer, 0);
+}
+
+static int
+nvme_config_read (struct pci_device *pci_device, u8 iosize, u16 offset,
+		  union mem *data)
+{
+	struct nvme_data *nd = pci_device->host;
+	u16 ctrl;
+
+	if (!nd || !nd->msix_vecnum ||
+	    !nvme_copy_in (offset, data, iosize, nd->msix_cap + 2, &ctrl,
+			   sizeof ctrl))
+		return CORE_IO_RET_DEFAULT;
+	/* advertise only the vectors that are remapped */
+	pci_handle_default_config_read (pci_device, iosize, offset, data);
+	ctrl = nd->msix_ctrl;
+	nvme_copy_in (offset, data, iosize, nd->msix_cap + 2, &ctrl,
+		      sizeof ctrl);
+	ctrl = (ctrl & ~NVME_MSIX_CTRL_SIZE_MASK) | (nd->msix_vecnum - 1);
+	nvme_copy_out (offset, data, iosize, nd->msix_cap + 2, &ctrl,
+		       sizeof ctrl);
+	return CORE_IO_RET_DONE;
+}
+
+static int
+nvme_config_write (struct pci_device *pci_device, u8 iosize, u16 offset,
+		   union mem *data)
+{
+	struct nvme_data *nd = pci_device->host;
+	struct pci_bar_info bar_info;
+	int i;
+
+	if (!nd)
+		return CORE_IO_RET_DEFAULT;
+	if (nd->msix_cap)
+		nvme_copy_in (offset, data, iosize, nd->msix_cap + 2,
+			      &nd->msix_ctrl, sizeof nd->msix_ctrl);
+	i = pci_get_modifying_bar_info (pci_device, &bar_info, iosize, offset,
+					data);
+	if (i < 0)
+		return CORE_IO_RET_DEFAULT;
+	spinlock_lock (&nd->lock);
+	if (i == 0)
+		nvme_reghook (nd, &bar_info);
+	if (i == nd->msix_bir && nd->msix_vecnum)
+		nvme_reghook_msix (nd, &bar_info);
+	spinlock_unlock (&nd->lock);
+	return CORE_IO_RET_DEFAULT;
+}
+
+static struct pci_driver nvme_driver = {
+	.name		= driver_name,
+	.longname	= "NVM Express controller shadowing driver",
+	.device		= "class_code=010802",
+	.new		= nvme_new,
+	.remove		= nvme_remove,
+	.config_read	= nvme_config_read,
+	.config_write	= nvme_config_write,
+	.driver_options	= "vectors",
+};
+
+static void
+nvme_init (void)
+{
+	pci_register_driver (&nvme_driver);
+}
+
+PCI_DRIVER_INIT (nvme_init);
@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2007, 2008 University of Tsukuba
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the University of Tsukuba nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _NVME_H
+#define _NVME_H
+
+/* controller registers */
+#define NVME_CAP			0x00
+#define NVME_CAP_MQES_MASK		0xFFFFULL
+#define NVME_CAP_CQR_BIT		(1ULL << 16)
+#define NVME_CAP_DSTRD_SHIFT		32
+#define NVME_CAP_DSTRD_MASK		0xFULL
+#define NVME_CAP_MPSMIN_SHIFT		48
+#define NVME_CAP_MPSMAX_SHIFT		52
+#define NVME_CAP_MPS_MASK		0xFULL
+#define NVME_CAP_CMBS_BIT		(1ULL << 57)
+#define NVME_CAP_PMRS_BIT		(1ULL << 56)
+#define NVME_CC				0x14
+#define NVME_CC_EN_BIT			0x1
+#define NVME_AQA			0x24
+#define NVME_AQA_ASQS_MASK		0xFFF
+#define NVME_AQA_ACQS_SHIFT		16
+#define NVME_ASQ			0x28
+#define NVME_ACQ			0x30
+#define NVME_CMBLOC			0x38
+#define NVME_CMBSZ			0x3C
+#define NVME_REGS_LEN			0x1000
+#define NVME_DOORBELL			0x1000
+
+#define NVME_PAGESIZE			4096
+
+/* submission queue entry */
+struct nvme_sqe {
+	u8 opcode;
+	u8 flags;
+	u16 cid;
+	u32 nsid;
+	u32 cdw2;
+	u32 cdw3;
+	u64 mptr;
+	u64 dptr[2];		/* PRP1 and PRP2, or SGL1 */
+	u32 cdw10;
+	u32 cdw11;
+	u32 cdw12;
+	u32 cdw13;
+	u32 cdw14;
+	u32 cdw15;
+} __attribute__ ((packed));
+
+#define NVME_SQE_FLAGS_PSDT_MASK	0xC0
+
+/* SGL descriptor identifier in the last byte of a descriptor */
+#define NVME_SGL_TYPE(id)		((id) >> 4)
+#define NVME_SGL_TYPE_DATA		0x0
+#define NVME_SGL_TYPE_SEGMENT		0x2
+#define NVME_SGL_TYPE_LAST_SEGMENT	0x3
+
+struct nvme_sgl {
+	u64 addr;
+	u32 len;
+	u8 reserved[3];
+	u8 id;
+} __attribute__ ((packed));
+
+/* completion queue entry */
+struct nvme_cqe {
+	u32 dw0;
+	u32 dw1;
+	u16 sqhd;
+	u16 sqid;
+	u16 cid;
+	u16 status;
+} __attribute__ ((packed));
+
+#define NVME_CQE_PHASE_BIT		0x1
+#define NVME_CQE_STATUS_MASK		0xFFFE
+#define NVME_STATUS(sct, sc)		(((sct) << 9) | ((sc) << 1))
+#define NVME_STATUS_DNR_BIT		0x8000
+
+#define NVME_SC_INVALID_OPCODE		NVME_STATUS (0, 0x01)
+#define NVME_SC_INVALID_FIELD		NVME_STATUS (0, 0x02)
+#define NVME_SC_INTERNAL		NVME_STATUS (0, 0x06)
+#define NVME_SC_INVALID_NS		NVME_STATUS (0, 0x0B)
+#define NVME_SC_NS_NOT_READY		NVME_STATUS (0, 0x82)
+#define NVME_SC_INVALID_QID		NVME_STATUS (1, 0x01)
+#define NVME_SC_INVALID_QSIZE		NVME_STATUS (1, 0x02)
+#define NVME_SC_INVALID_IV		NVME_STATUS (1, 0x08)
+#define NVME_SC_INVALID_FORMAT		NVME_STATUS (1, 0x0A)
+
+/* admin command set */
+#define NVME_ADMIN_DELETE_SQ		0x00
+#define NVME_ADMIN_CREATE_SQ		0x01
+#define NVME_ADMIN_DELETE_CQ		0x04
+#define NVME_ADMIN_CREATE_CQ		0x05
+#define NVME_ADMIN_IDENTIFY		0x06
+#define NVME_ADMIN_SET_FEATURES		0x09
+#define NVME_ADMIN_GET_FEATURES		0x0A
+#define NVME_ADMIN_NS_MGMT		0x0D
+#define NVME_ADMIN_NS_ATTACH		0x15
+#define NVME_ADMIN_DBBUF_CONFIG		0x7C
+#define NVME_ADMIN_FORMAT_NVM		0x80
+#define NVME_ADMIN_SANITIZE		0x84
+
+#define NVME_QUEUE_PC_BIT		0x1
+#define NVME_QUEUE_IEN_BIT		0x2
+
+#define NVME_FEAT_ARBITRATION		0x01
+#define NVME_FEAT_NUM_QUEUES		0x07
+
+#define NVME_IDENTIFY_CNS_NS		0x00
+#define NVME_IDENTIFY_CNS_CTRL		0x01
+#define NVME_IDENTIFY_LEN		4096
+
+/* identify controller data */
+#define NVME_ID_CTRL_MDTS		77
+#define NVME_ID_CTRL_OACS		256
+#define NVME_ID_CTRL_OACS_DBBUF_BIT	0x100
+#define NVME_ID_CTRL_ONCS		520
+#define NVME_ID_CTRL_ONCS_WRITE_ZEROES_BIT 0x8
+#define NVME_ID_CTRL_ONCS_COPY_BIT	0x100
+
+/* identify namespace data */
+#define NVME_ID_NS_FLBAS		26
+#define NVME_ID_NS_FLBAS_INDEX_MASK	0xF
+#define NVME_ID_NS_FLBAS_EXTENDED_BIT	0x10
+#define NVME_ID_NS_LBAF			128
+#define NVME_ID_NS_LBAF_MS_MASK		0xFFFF
+#define NVME_ID_NS_LBAF_LBADS_SHIFT	16
+
+/* NVM command set */
+#define NVME_CMD_FLUSH			0x00
+#define NVME_CMD_WRITE			0x01
+#define NVME_CMD_READ			0x02
+#define NVME_CMD_WRITE_UNCOR		0x04
+#define NVME_CMD_COMPARE		0x05
+#define NVME_CMD_WRITE_ZEROES		0x08
+#define NVME_CMD_DSM			0x09
+#define NVME_CMD_VERIFY			0x0C
+#define NVME_CMD_RESV_REGISTER		0x0D
+#define NVME_CMD_RESV_REPORT		0x0E
+#define NVME_CMD_RESV_ACQUIRE		0x11
+#define NVME_CMD_RESV_RELEASE		0x15
+#define NVME_CMD_COPY			0x19
+
+/* MSI-X capability */
+#define NVME_PCI_CAP_MSIX		0x11
+#define NVME_MSIX_CTRL_SIZE_MASK	0x7FF
+#define NVME_MSIX_CTRL_ENABLE_BIT	0x8000
+#define NVME_MSIX_BIR_MASK		0x7
+#define NVME_MSIX_ENTRY_LEN		16
+#define NVME_MSIX_MASK_BIT		0x1
+
+#endif
@@ -140,9 +140,15 @@ struct pci_device {
 		int yes;
 		int initial_secondary_bus_no;
 		u8 secondary_bus_no, subordinate_bus_no;
+		u8 slot_cap;	/* PCIe capability of a hot-plug slot */
+		bool slot_dllla, slot_power, slot_present;
 	} bridge;
 	struct pci_device *parent_bridge;
 	int disconnect;
+	int removed;		/* unplugged; drivers have been unbound */
+	u64 allones_time;	/* when the vendor ID first read all ones */
+	int virtfn;		/* SR-IOV virtual function */
+	int node;		/* VMM memory node near the device */
 	u8 fake_command_mask, fake_command_fixed, fake_command_virtual;
 };
 
@@ -150,6 +156,9 @@ struct pci_driver {
 	LIST_DEFINE(pci_driver_list);
 	char *device;
 	void (*new)(struct pci_device *dev);
+	/* optional: release everything new() set up when the device
+	 * is unplugged.  drivers without it cannot be unbound. */
+	void (*remove)(struct pci_device *dev);
 	int (*config_read) (struct pci_device *dev, u8 iosize, u16 offset,
 			    union mem *data);
 	int (*config_write) (struct pci_device *dev, u8 iosize, u16 offset,
@@ -193,6 +202,9 @@ extern void pci_write_config_data32(pci_config_address_t addr, int offset, u32 d
 
 struct pci_device *pci_possible_new_device (pci_config_address_t addr,
 					    struct pci_config_mmio_data *mmio);
+struct pci_device *pci_new_vf_device (pci_config_address_t addr,
+				      struct pci_device *pf);
+int pci_sriov_enable (struct pci_device *pf, int numvfs);
 void pci_readwrite_config_mmio (struct pci_config_mmio_data *p, bool wr,
 				uint bus_no, uint device_no, uint func_no,
 				uint offset, uint iosize, void *data);
@@ -216,6 +228,10 @@ struct pci_device *pci_get_bridge_from_bus_no (u8 bus_no);
 void pci_set_bridge_from_bus_no (u8 bus_no, struct pci_device *bridge);
 int pci_reconnect_device (struct pci_device *dev, pci_config_address_t addr,
 			  struct pci_config_mmio_data *mmio);
+void pci_bind_driver (struct pci_device *dev);
+void pci_unbind_driver (struct pci_device *dev);
+void pci_remove_device (struct pci_device *dev);
+void pci_rescan_bridge (struct pci_device *bridge);
 void pci_set_bridge_io (struct pci_device *pci_device);
 void pci_set_bridge_fake_command (struct pci_device *pci_device, u8 mask,
 				  u8 fixed);
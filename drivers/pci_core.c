@@ -39,7 +39,9 @@
 #include <core/process.h>
 #include <core/strtol.h>
 #include <token.h>
+#include "passthrough/vtd.h"
 #include "pci.h"
+#include "pci_init.h"
 #include "pci_internal.h"
 #include "pci_match.h"
 
@@ -264,6 +266,121 @@ device_disconnect (struct pci_device *dev)
 	}
 }
 
+void
+pci_bind_driver (struct pci_device *dev)
+{
+	struct pci_driver *driver;
+
+	printf ("[%02X:%02X.%X] New PCI device found.\n",
+		dev->address.bus_no, dev->address.device_no,
+		dev->address.func_no);
+	attach_remap (dev->address.bus_no, dev->address.device_no,
+		      dev->address.func_no);
+	driver = pci_find_driver_for_device (dev);
+	if (driver) {
+		dev->driver = driver;
+		driver->new (dev);
+	}
+}
+
+/* Release the driver of an unplugged device.  The driver must not
+ * touch the device because it is not there any more. */
+void
+pci_unbind_driver (struct pci_device *dev)
+{
+	struct pci_driver *driver = dev->driver;
+
+	if (!driver)
+		return;
+	if (!driver->remove) {
+		printf ("[%02X:%02X.%X] %s: driver cannot be unbound\n",
+			dev->address.bus_no, dev->address.device_no,
+			dev->address.func_no, driver->name);
+		return;
+	}
+	driver->remove (dev);
+	dev->driver = NULL;
+	dev->host = NULL;
+	del_remap (dev->address.bus_no, dev->address.device_no,
+		   dev->address.func_no);
+	printf ("[%02X:%02X.%X] %s: driver unbound\n",
+		dev->address.bus_no, dev->address.device_no,
+		dev->address.func_no, driver->name);
+}
+
+/* Unbind drivers of a device and devices behind it, deepest
+ * first.  The entries remain in the list as disconnected devices
+ * and are rebound by pci_reconnect_device() if a device appears
+ * at the same address. */
+void
+pci_remove_device (struct pci_device *dev)
+{
+	struct pci_device *p;
+
+	if (dev->bridge.yes) {
+		LIST_FOREACH (pci_device_list, p) {
+			if (p->parent_bridge == dev)
+				pci_remove_device (p);
+		}
+	}
+	if (dev->removed)
+		return;
+	printf ("[%02X:%02X.%X] %06X: %04X:%04X removed\n",
+		dev->address.bus_no,
+		dev->address.device_no,
+		dev->address.func_no,
+		dev->config_space.class_code,
+		dev->config_space.vendor_id,
+		dev->config_space.device_id);
+	dev->disconnect = 1;
+	dev->removed = 1;
+	pci_unbind_driver (dev);
+}
+
+/* Look for devices on the secondary bus of a bridge and bind
+ * drivers before the guest OS scans the bus.  Devices that are not
+ * ready yet are found on the first access of the guest OS. */
+void
+pci_rescan_bridge (struct pci_device *bridge)
+{
+	struct pci_config_mmio_data *mmio;
+	struct pci_device *dev, *new_dev;
+	pci_config_address_t addr;
+	int dn, fn;
+
+	addr = bridge->address;
+	addr.reserved = addr.reg_no = addr.type = 0;
+	addr.bus_no = bridge->bridge.secondary_bus_no;
+	if (!addr.bus_no)
+		return;		/* not configured yet */
+	mmio = pci_search_config_mmio (0, addr.bus_no);
+	for (dn = 0; dn < PCI_MAX_DEVICES; dn++) {
+		for (fn = 0; fn < PCI_MAX_FUNCS; fn++) {
+			addr.device_no = dn;
+			addr.func_no = fn;
+			new_dev = NULL;
+			spinlock_lock (&pci_config_lock);
+			LIST_FOREACH (pci_device_list, dev) {
+				if (dev->address.value == addr.value)
+					break;
+			}
+			if (!dev)
+				dev = new_dev = pci_possible_new_device (addr,
+									 mmio);
+			else if (dev->disconnect &&
+				 pci_reconnect_device (dev, addr, mmio))
+				new_dev = dev;
+			pci_restore_config_addr ();
+			spinlock_unlock (&pci_config_lock);
+			if (new_dev)
+				pci_bind_driver (new_dev);
+			if (fn == 0 && (!dev || dev->disconnect ||
+					!dev->config_space.multi_function))
+				break;
+		}
+	}
+}
+
 static void
 pci_handle_bridge_config_write (struct pci_device *bridge, u8 iosize,
 				u16 offset, union mem *data)
@@ -372,21 +489,24 @@ new_device:
 	pci_restore_config_addr ();
 	spinlock_unlock (&pci_config_lock);
 	if (dev) {
-		struct pci_driver *driver;
-
-		printf ("[%02X:%02X.%X] New PCI device found.\n",
-			caddr.bus_no, caddr.device_no, caddr.func_no);
-		driver = pci_find_driver_for_device (dev);
-		if (driver) {
-			dev->driver = driver;
-			driver->new (dev);
+		pci_bind_driver (dev);
+		if (dev->driver)
 			goto found;
-		}
 	}
 	goto ret;
 found:
+	if (pci_hotplug_check_removal (dev, io.dir == CORE_IO_DIR_OUT,
+				       offset)) {
+		if (io.dir == CORE_IO_DIR_IN)
+			memset (data, 0xFF, io.size);
+		ioret = CORE_IO_RET_DONE;
+		goto ret;
+	}
 	if (dev->bridge.yes && io.dir == CORE_IO_DIR_OUT)
 		pci_handle_bridge_config_write (dev, io.size, offset, data);
+	if (dev->bridge.slot_cap)
+		pci_hotplug_config_access (dev, io.dir == CORE_IO_DIR_OUT,
+					   offset, io.size, data);
 	if (dev->driver == NULL)
 		goto ret;
 	if (dev->driver->options.use_base_address_mask_emulation) {
@@ -814,24 +934,25 @@ pci_config_mmio_handler (void *data, phys_t gphys, bool wr, void *buf,
 new_device:
 	spinlock_unlock (&pci_config_lock);
 	if (dev) {
-		struct pci_driver *driver;
-
-		printf ("[%02X:%02X.%X] New PCI device found.\n",
-			addr.s.bus_no, addr.s.dev_no, addr.s.func_no);
-		driver = pci_find_driver_for_device (dev);
-		if (driver) {
-			dev->driver = driver;
-			driver->new (dev);
+		pci_bind_driver (dev);
+		if (dev->driver)
 			goto found;
-		}
 	}
 	if (!wr)
 		memset (buf, 0xFF, len);
 	return 1;
 found:
+	if (pci_hotplug_check_removal (dev, wr, addr.s.reg_offset)) {
+		if (!wr)
+			memset (buf, 0xFF, len);
+		return 1;
+	}
 	if (dev->bridge.yes && wr)
 		pci_handle_bridge_config_write (dev, len, addr.s.reg_offset,
 						buf);
+	if (dev->bridge.slot_cap)
+		pci_hotplug_config_access (dev, wr, addr.s.reg_offset, len,
+					   buf);
 	if (dev->driver == NULL)
 		goto def;
 	if (dev->driver->options.use_base_address_mask_emulation) {
@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2007, 2008 University of Tsukuba
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the University of Tsukuba nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* PCI hot-plug support.  Devices are found by guest accesses and
+   bus rescans; this file notices devices going away, either by slot
+   events of PCI Express hot-plug slots or by the guest OS reading
+   all ones from a device that has been present, e.g. after an ACPI
+   eject. */
+
+#include <core.h>
+#include <core/time.h>
+#include "pci.h"
+#include "pci_internal.h"
+
+static u16
+pci_hotplug_read16 (struct pci_device *dev, u16 offset)
+{
+	pci_config_address_t addr;
+	u16 data;
+
+	if (dev->config_mmio) {
+		pci_read_config_mmio (dev->config_mmio, dev->address.bus_no,
+				      dev->address.device_no,
+				      dev->address.func_no, offset,
+				      sizeof data, &data);
+		return data;
+	}
+	addr = dev->address;
+	addr.reg_no = offset >> 2;
+	return pci_read_config_data16 (addr, offset & 3);
+}
+
+/* A device reads all ones for a while during function level reset
+   and while it is in D3cold, so all ones alone does not mean the
+   device has gone.  Long enough for a reset to complete. */
+#define PCI_HOTPLUG_ALLONES_USEC 1000000
+
+static bool
+pci_hotplug_slot_present (struct pci_device *bridge)
+{
+	uint cap = bridge->bridge.slot_cap;
+	u16 sltsta, lnksta;
+
+	sltsta = pci_hotplug_read16 (bridge, cap + PCI_EXP_SLTSTA);
+	lnksta = pci_hotplug_read16 (bridge, cap + PCI_EXP_LNKSTA);
+	return (sltsta & PCI_EXP_SLTSTA_PDS) &&
+		(!bridge->bridge.slot_dllla || (lnksta & PCI_EXP_LNKSTA_DLLLA));
+}
+
+/* The guest OS reads the vendor ID when it scans the bus.  Returns
+   true if the device has gone.  Behind a hot-plug slot the slot
+   state decides; elsewhere the device must keep reading all ones
+   for PCI_HOTPLUG_ALLONES_USEC before it is removed. */
+bool
+pci_hotplug_check_removal (struct pci_device *dev, bool wr, u16 offset)
+{
+	struct pci_device *bridge = dev->parent_bridge;
+	u64 now;
+
+	/* virtual functions do not implement the vendor ID */
+	if (wr || offset >= 2 || dev->virtfn || dev->disconnect)
+		return false;
+	if (pci_hotplug_read16 (dev, 0) != 0xFFFF) {
+		dev->allones_time = 0;
+		return false;
+	}
+	if (bridge && bridge->bridge.slot_cap) {
+		if (pci_hotplug_slot_present (bridge))
+			return false;
+	} else {
+		now = get_time ();
+		if (!dev->allones_time) {
+			dev->allones_time = now ? now : 1;
+			return false;
+		}
+		if (now - dev->allones_time < PCI_HOTPLUG_ALLONES_USEC)
+			return false;
+	}
+	pci_remove_device (dev);
+	return true;
+}
+
+/* Link Status, Slot Control and Slot Status are read and written
+   by the hot-plug driver of the guest OS on slot events. */
+void
+pci_hotplug_config_access (struct pci_device *bridge, bool wr, u16 offset,
+			   uint iosize, void *data)
+{
+	struct pci_device *dev;
+	uint cap = bridge->bridge.slot_cap;
+	uint pcc = cap + PCI_EXP_SLTCTL + 1; /* the byte of PCC */
+	bool present, poweroff = false;
+
+	if (offset + iosize <= cap + PCI_EXP_LNKSTA ||
+	    offset >= cap + PCI_EXP_SLTSTA + 2)
+		return;
+	if (wr && bridge->bridge.slot_power && offset <= pcc &&
+	    offset + iosize > pcc)
+		poweroff = !!(((u8 *)data)[pcc - offset] &
+			      (PCI_EXP_SLTCTL_PCC >> 8));
+	present = !poweroff && pci_hotplug_slot_present (bridge);
+	if (present == bridge->bridge.slot_present)
+		return;
+	bridge->bridge.slot_present = present;
+	printf ("[%02X:%02X.%X] hot-plug slot %s\n",
+		bridge->address.bus_no, bridge->address.device_no,
+		bridge->address.func_no,
+		present ? "occupied" : poweroff ? "powered off" : "empty");
+	if (present) {
+		pci_rescan_bridge (bridge);
+		return;
+	}
+	LIST_FOREACH (pci_device_list, dev) {
+		if (dev->parent_bridge == bridge)
+			pci_remove_device (dev);
+	}
+}
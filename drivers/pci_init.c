@@ -36,6 +36,7 @@
 #include "pci_internal.h"
 #include "pci_init.h"
 #include <core/acpi.h>
+#include <core/mm.h>
 #include <core/mmio.h>
 
 static const char driver_name[] = "pci_driver";
@@ -138,7 +139,7 @@ static void pci_read_config_space(struct pci_device *dev)
 	}
 }
 
-static struct pci_config_mmio_data *
+struct pci_config_mmio_data *
 pci_search_config_mmio (u16 seg_group, u8 bus_no)
 {
 	struct pci_config_mmio_data *p;
@@ -150,11 +151,74 @@ pci_search_config_mmio (u16 seg_group, u8 bus_no)
 	return NULL;
 }
 
+/* The caller holds pci_config_lock. */
+static u32
+pci_read_config_reg32 (struct pci_device *dev, u8 offset)
+{
+	pci_config_address_t addr = dev->address;
+	u32 data;
+
+	if (dev->config_mmio) {
+		pci_read_config_mmio (dev->config_mmio, addr.bus_no,
+				      addr.device_no, addr.func_no,
+				      offset & ~3, sizeof data, &data);
+		return data;
+	}
+	addr.reg_no = offset >> 2;
+	return pci_read_config_data32_without_lock (addr, 0);
+}
+
+/* Find a hot-plug capable slot of a PCI Express root port or
+ * downstream port.  Slot events are monitored by
+ * pci_hotplug_config_access(). */
+static void
+pci_save_slot_info (struct pci_device *dev)
+{
+	u32 val, flags, sltcap, lnkcap;
+	u16 sltsta, lnksta;
+	u8 cap;
+	int n;
+
+	dev->bridge.slot_cap = 0;
+	if (!(dev->config_space.status & 0x10)) /* Capabilities List */
+		return;
+	cap = dev->config_space.regs8[0x34];
+	for (n = 0; cap >= 0x40 && n < 48; n++) {
+		val = pci_read_config_reg32 (dev, cap);
+		if ((val & 0xFF) == PCI_CAP_ID_EXP)
+			goto found;
+		cap = (val >> 8) & 0xFC;
+	}
+	return;
+found:
+	flags = val >> 16;
+	if ((PCI_EXP_FLAGS_TYPE (flags) != PCI_EXP_TYPE_ROOT_PORT &&
+	     PCI_EXP_FLAGS_TYPE (flags) != PCI_EXP_TYPE_DOWNSTREAM) ||
+	    !(flags & PCI_EXP_FLAGS_SLOT))
+		return;
+	sltcap = pci_read_config_reg32 (dev, cap + PCI_EXP_SLTCAP);
+	if (!(sltcap & PCI_EXP_SLTCAP_HPC))
+		return;
+	lnkcap = pci_read_config_reg32 (dev, cap + PCI_EXP_LNKCAP);
+	lnksta = pci_read_config_reg32 (dev, cap + PCI_EXP_LNKSTA) >> 16;
+	sltsta = pci_read_config_reg32 (dev, cap + PCI_EXP_SLTSTA) >> 16;
+	dev->bridge.slot_cap = cap;
+	dev->bridge.slot_dllla = !!(lnkcap & PCI_EXP_LNKCAP_DLLLARC);
+	dev->bridge.slot_power = !!(sltcap & PCI_EXP_SLTCAP_PCP);
+	dev->bridge.slot_present = (sltsta & PCI_EXP_SLTSTA_PDS) &&
+		(!dev->bridge.slot_dllla || (lnksta & PCI_EXP_LNKSTA_DLLLA));
+	printf ("[%02X:%02X.%X] hot-plug slot, %s\n",
+		dev->address.bus_no, dev->address.device_no,
+		dev->address.func_no,
+		dev->bridge.slot_present ? "occupied" : "empty");
+}
+
 static void
 pci_save_bridge_info (struct pci_device *dev)
 {
 	dev->bridge.yes = 0;
 	dev->bridge.initial_secondary_bus_no = -1;
+	dev->bridge.slot_cap = 0;
 	if ((dev->config_space.class_code & 0xFFFF00) == 0x060400) {
 		/* The dev is a PCI bridge. */
 		dev->bridge.yes = 1;
@@ -162,6 +226,7 @@ pci_save_bridge_info (struct pci_device *dev)
 			dev->config_space.base_address[2] >> 8;
 		dev->bridge.subordinate_bus_no =
 			dev->config_space.base_address[2] >> 16;
+		pci_save_slot_info (dev);
 	}
 }
 
@@ -226,9 +291,12 @@ pci_reconnect_device (struct pci_device *dev, pci_config_address_t addr,
 	}
 	dev->config_mmio = pci_search_config_mmio (0, dev->address.bus_no);
 	/* Compare the read data with data stored in the dev
-	 * structure. */
+	 * structure.  A removed device has lost its driver, so it is
+	 * handled as a new device even if the same one is inserted
+	 * again. */
 	if (dev->config_space.regs32[0] == data0 &&
-	    dev->config_space.regs32[2] == data8) {
+	    dev->config_space.regs32[2] == data8 &&
+	    (!dev->removed || dev->driver)) {
 		printf ("[%02X:%02X.%X] %06X: %04X:%04X reconnected\n",
 			dev->address.bus_no,
 			dev->address.device_no,
@@ -237,21 +305,26 @@ pci_reconnect_device (struct pci_device *dev, pci_config_address_t addr,
 			dev->config_space.vendor_id,
 			dev->config_space.device_id);
 		dev->disconnect = 0;
+		dev->removed = 0;
+		return 0;
+	}
+	/* The device has been changed.  Unbind the driver of the old
+	 * device.  If the driver cannot be unbound, keep the new
+	 * device hidden from the guest since the driver still holds
+	 * the resources of the old one. */
+	pci_unbind_driver (dev);
+	if (dev->driver) {
+		printf ("[%02X:%02X.%X] cannot handle device change"
+			" %06X: %04X:%04X -> %06X: %04X:%04X\n",
+			dev->address.bus_no,
+			dev->address.device_no,
+			dev->address.func_no,
+			dev->config_space.class_code,
+			dev->config_space.vendor_id,
+			dev->config_space.device_id,
+			data8 >> 8, data0 & 0xFFFF, data0 >> 16);
 		return 0;
 	}
-	/* The device has been changed.  If a driver has been loaded
-	 * for the device, panic, because there is no unloading driver
-	 * function. */
-	if (dev->driver)
-		panic ("[%02X:%02X.%X] cannot handle device change"
-		       " %06X: %04X:%04X -> %06X: %04X:%04X",
-		       dev->address.bus_no,
-		       dev->address.device_no,
-		       dev->address.func_no,
-		       dev->config_space.class_code,
-		       dev->config_space.vendor_id,
-		       dev->config_space.device_id,
-		       data8 >> 8, data0 & 0xFFFF, data0 >> 16);
 	/* New device! */
 	printf ("[%02X:%02X.%X] device change"
 		" %06X: %04X:%04X -> %06X: %04X:%04X\n",
@@ -263,6 +336,7 @@ pci_reconnect_device (struct pci_device *dev, pci_config_address_t addr,
 		dev->config_space.device_id,
 		data8 >> 8, data0 & 0xFFFF, data0 >> 16);
 	dev->disconnect = 0;
+	dev->removed = 0;
 	pci_read_config_space (dev);
 	pci_save_base_address_masks (dev);
 	pci_save_bridge_info (dev);
@@ -291,6 +365,48 @@ static struct pci_device *pci_new_device(pci_config_address_t addr)
 	return dev;
 }
 
+/* SR-IOV virtual functions do not respond to vendor ID reads so they
+ * are created by the physical function driver.  The caller fills
+ * the header fields that virtual functions do not implement.  The
+ * entry of a virtual function of an unplugged physical function is
+ * reused, because it cannot be reconnected. */
+struct pci_device *
+pci_new_vf_device (pci_config_address_t addr, struct pci_device *pf)
+{
+	struct pci_device *dev;
+	struct list next;
+	bool reused;
+
+	LIST_FOREACH (pci_device_list, dev) {
+		if (dev->virtfn && dev->removed &&
+		    dev->address.value == addr.value)
+			break;
+	}
+	reused = !!dev;
+	if (reused) {
+		next = dev->pci_device_list;
+		memset (dev, 0, sizeof *dev);
+		dev->pci_device_list = next;
+	} else {
+		dev = alloc_pci_device ();
+		memset (dev, 0, sizeof *dev);
+	}
+	dev->address = addr;
+	if (pf->initial_bus_no < 0)
+		dev->initial_bus_no = -1;
+	else
+		dev->initial_bus_no = pf->initial_bus_no + addr.bus_no -
+			pf->address.bus_no;
+	dev->config_mmio = pci_search_config_mmio (0, addr.bus_no);
+	pci_read_config_space (dev);
+	dev->parent_bridge = pf->parent_bridge;
+	dev->node = pf->node;
+	dev->virtfn = 1;
+	if (!reused)
+		pci_append_device (dev);
+	return dev;
+}
+
 struct pci_device *
 pci_possible_new_device (pci_config_address_t addr,
 			 struct pci_config_mmio_data *mmio)
@@ -311,6 +427,11 @@ pci_possible_new_device (pci_config_address_t addr,
 		if (ret->parent_bridge)
 			ret->initial_bus_no = ret->parent_bridge->bridge.
 				initial_secondary_bus_no;
+		ret->node = mm_node_of_pci (0, addr.bus_no,
+					    addr.device_no << 3 |
+					    addr.func_no);
+		if (ret->node == MM_NODE_LOCAL && ret->parent_bridge)
+			ret->node = ret->parent_bridge->node;
 	}
 	return ret;
 }
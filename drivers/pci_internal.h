@@ -47,6 +47,25 @@ struct pci_config_mmio_data {
 #define PCI_CONFIG_ADDR_PORT	0x0CF8
 #define PCI_CONFIG_DATA_PORT	0x0CFC
 
+/* PCI Express capability registers for hot-plug slots */
+#define PCI_CAP_ID_EXP			0x10
+#define PCI_EXP_FLAGS			0x02
+#define PCI_EXP_FLAGS_TYPE(f)		(((f) >> 4) & 0xF)
+#define PCI_EXP_FLAGS_SLOT		0x0100
+#define PCI_EXP_TYPE_ROOT_PORT		0x4
+#define PCI_EXP_TYPE_DOWNSTREAM		0x6
+#define PCI_EXP_LNKCAP			0x0C
+#define PCI_EXP_LNKCAP_DLLLARC		0x00100000
+#define PCI_EXP_LNKSTA			0x12
+#define PCI_EXP_LNKSTA_DLLLA		0x2000
+#define PCI_EXP_SLTCAP			0x14
+#define PCI_EXP_SLTCAP_PCP		0x00000002
+#define PCI_EXP_SLTCAP_HPC		0x00000040
+#define PCI_EXP_SLTCTL			0x18
+#define PCI_EXP_SLTCTL_PCC		0x0400
+#define PCI_EXP_SLTSTA			0x1A
+#define PCI_EXP_SLTSTA_PDS		0x0040
+
 #define DEFINE_pci_read_config_data_without_lock(size)		\
 static inline u##size pci_read_config_data##size##_without_lock(pci_config_address_t addr, int offset) \
 {								\
@@ -78,6 +97,12 @@ extern int pci_config_addr_handler(core_io_t io, union mem *data, void *arg);
 void pci_save_config_addr(void);
 void pci_restore_config_addr(void);
 extern void pci_append_device(struct pci_device *dev);
+struct pci_config_mmio_data *pci_search_config_mmio (u16 seg_group,
+						     u8 bus_no);
+bool pci_hotplug_check_removal (struct pci_device *dev, bool wr,
+				u16 offset);
+void pci_hotplug_config_access (struct pci_device *bridge, bool wr,
+				u16 offset, uint iosize, void *data);
 int pci_config_mmio_handler (void *data, phys_t gphys, bool wr, void *buf,
 			     uint len, u32 flags);
 
@@ -164,6 +164,10 @@ pci_match_compat_init (void)
 	if (config.vmm.driver.ata)
 		pci_match_add_compat ("driver=ata,and,driver=ahci,and,"
 				      "driver=raid");
+#ifdef NVME_DRIVER
+	if (config.vmm.driver.ata)
+		pci_match_add_compat ("driver=nvme");
+#endif
 	pci_match_compat_init_pro1000 ();
 	if (config.vmm.driver.vpn.PRO100)
 		pci_match_add_compat ("driver=pro100,net=vpn");
@@ -0,0 +1,345 @@
+/*
+ * Copyright (c) 2007, 2008 University of Tsukuba
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the University of Tsukuba nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* SR-IOV physical function support.  Virtual functions are enabled
+   by the driver of the physical function and given to the guest as
+   ordinary PCI functions. */
+
+#include <core.h>
+#include <core/time.h>
+#include "pci.h"
+#include "pci_internal.h"
+
+#define PCI_EXT_CAP_START	0x100
+#define PCI_EXT_CAP_END		0x1000
+#define PCI_EXT_CAP_ID_SRIOV	0x10
+#define SRIOV_CTRL		0x08
+#define SRIOV_CTRL_VFE		0x1
+#define SRIOV_CTRL_VF_MSE	0x8
+#define SRIOV_TOTAL_VFS		0x0E
+#define SRIOV_NUM_VFS		0x10
+#define SRIOV_VF_OFFSET		0x14
+#define SRIOV_VF_STRIDE		0x16
+#define SRIOV_VF_DID		0x1A
+#define SRIOV_SUP_PGSIZE	0x1C
+#define SRIOV_SYS_PGSIZE	0x20
+#define SRIOV_BAR		0x24
+#define SRIOV_PGSIZE_4K		0x1
+#define SRIOV_ENABLE_WAIT	(100 * 1000)
+#define PCI_COMMAND_MEMORY	0x2
+#define PCI_CONFIG_VF_END	0x28
+
+struct pci_sriov_vf {
+	struct pci_device *pf;
+	int index;
+	u16 device_id;
+	u32 bar[PCI_CONFIG_BASE_ADDRESS_NUMS];
+};
+
+static const char driver_name[] = "sriov_vf";
+static const char driver_longname[] = "SR-IOV virtual function";
+
+static u32
+pci_sriov_read (struct pci_device *pf, int offset, int size)
+{
+	u32 data = 0;
+
+	pci_read_config_mmio (pf->config_mmio, pf->address.bus_no,
+			      pf->address.device_no, pf->address.func_no,
+			      offset, size, &data);
+	return data;
+}
+
+static void
+pci_sriov_write (struct pci_device *pf, int offset, int size, u32 data)
+{
+	pci_write_config_mmio (pf->config_mmio, pf->address.bus_no,
+			       pf->address.device_no, pf->address.func_no,
+			       offset, size, &data);
+}
+
+static int
+pci_sriov_find_cap (struct pci_device *pf)
+{
+	int offset, n;
+	u32 hdr;
+
+	offset = PCI_EXT_CAP_START;
+	for (n = 0; n < (PCI_EXT_CAP_END - PCI_EXT_CAP_START) / 8; n++) {
+		hdr = pci_sriov_read (pf, offset, 4);
+		if (!hdr || hdr == 0xFFFFFFFF)
+			break;
+		if ((hdr & 0xFFFF) == PCI_EXT_CAP_ID_SRIOV)
+			return offset;
+		offset = hdr >> 20;
+		if (offset < PCI_EXT_CAP_START)
+			break;
+	}
+	return 0;
+}
+
+static void
+pci_sriov_usleep (u32 usec)
+{
+	u64 time1, time2;
+
+	time1 = get_time ();
+	do
+		time2 = get_time ();
+	while (time2 - time1 < usec);
+}
+
+/* read VF BAR n and its mask.  returns the number of registers used
+   by the BAR */
+static int
+pci_sriov_read_bar (struct pci_device *pf, int cap, int n, u64 *base,
+		    u64 *mask)
+{
+	int offset = cap + SRIOV_BAR + n * 4;
+	u32 low, high, lowmask, highmask;
+
+	low = pci_sriov_read (pf, offset, 4);
+	pci_sriov_write (pf, offset, 4, 0xFFFFFFFF);
+	lowmask = pci_sriov_read (pf, offset, 4);
+	pci_sriov_write (pf, offset, 4, low);
+	high = 0;
+	highmask = 0xFFFFFFFF;
+	if ((lowmask & PCI_CONFIG_BASE_ADDRESS_TYPEMASK) ==
+	    PCI_CONFIG_BASE_ADDRESS_TYPE64 &&
+	    n + 1 < PCI_CONFIG_BASE_ADDRESS_NUMS) {
+		high = pci_sriov_read (pf, offset + 4, 4);
+		pci_sriov_write (pf, offset + 4, 4, 0xFFFFFFFF);
+		highmask = pci_sriov_read (pf, offset + 4, 4);
+		pci_sriov_write (pf, offset + 4, 4, high);
+		*base = low | (u64)high << 32;
+		*mask = lowmask | (u64)highmask << 32;
+		return 2;
+	}
+	*base = low;
+	*mask = lowmask | 0xFFFFFFFF00000000ULL;
+	return 1;
+}
+
+static int
+pci_sriov_vf_config_read (struct pci_device *dev, u8 iosize, u16 offset,
+			  union mem *data)
+{
+	struct pci_sriov_vf *vf = dev->host;
+	u32 reg;
+	int i = offset >> 2;
+
+	if (offset >= PCI_CONFIG_VF_END || (offset & 3) + iosize > 4)
+		return CORE_IO_RET_DEFAULT;
+	switch (i) {
+	case 0:
+		reg = vf->pf->config_space.vendor_id | vf->device_id << 16;
+		break;
+	case 3:
+		/* functions other than 0 are scanned only if function 0
+		   is a multi-function device */
+		pci_handle_default_config_read (dev, 4, offset & ~3,
+						(union mem *)&reg);
+		reg |= 0x800000;
+		break;
+	case 4 ... 9:
+		reg = vf->bar[i - 4];
+		break;
+	default:
+		return CORE_IO_RET_DEFAULT;
+	}
+	memcpy (data, (u8 *)&reg + (offset & 3), iosize);
+	return CORE_IO_RET_DONE;
+}
+
+/* VF BARs are placed by the VF BARs of the physical function and
+   cannot be moved one by one */
+static int
+pci_sriov_vf_config_write (struct pci_device *dev, u8 iosize, u16 offset,
+			   union mem *data)
+{
+	if (offset >= 0x10 && offset < PCI_CONFIG_VF_END)
+		return CORE_IO_RET_DONE;
+	return CORE_IO_RET_DEFAULT;
+}
+
+static void
+pci_sriov_vf_remove (struct pci_device *dev)
+{
+	free (dev->host);
+}
+
+static struct pci_driver pci_sriov_vf_driver = {
+	.name		= driver_name,
+	.longname	= driver_longname,
+	.remove		= pci_sriov_vf_remove,
+	.config_read	= pci_sriov_vf_config_read,
+	.config_write	= pci_sriov_vf_config_write,
+	.options	= {
+		.use_base_address_mask_emulation = 1,
+	},
+};
+
+static void
+pci_sriov_add_vf (struct pci_device *pf, int index, u16 rid, u16 device_id,
+		  u32 *base, u32 *mask)
+{
+	struct pci_sriov_vf *vf;
+	struct pci_device *dev;
+	pci_config_address_t addr;
+	u64 size, bar64;
+	int i;
+
+	addr.value = 0;
+	addr.bus_no = rid >> 8;
+	addr.device_no = rid >> 3 & 0x1F;
+	addr.func_no = rid & 7;
+	vf = alloc (sizeof *vf);
+	memset (vf, 0, sizeof *vf);
+	vf->pf = pf;
+	vf->index = index;
+	vf->device_id = device_id;
+	dev = pci_new_vf_device (addr, pf);
+	for (i = 0; i < PCI_CONFIG_BASE_ADDRESS_NUMS; i++) {
+		dev->base_address_mask[i] = mask[i];
+		vf->bar[i] = base[i];
+		if (!(mask[i] & PCI_CONFIG_BASE_ADDRESS_MEMMASK))
+			continue;
+		if ((mask[i] & PCI_CONFIG_BASE_ADDRESS_TYPEMASK) ==
+		    PCI_CONFIG_BASE_ADDRESS_TYPE64 &&
+		    i + 1 < PCI_CONFIG_BASE_ADDRESS_NUMS) {
+			size = ~((u64)mask[i + 1] << 32 |
+				 (mask[i] & PCI_CONFIG_BASE_ADDRESS_MEMMASK)) + 1;
+			bar64 = ((u64)base[i + 1] << 32 | base[i]) +
+				size * index;
+			vf->bar[i] = bar64;
+			i++;
+			dev->base_address_mask[i] = mask[i];
+			vf->bar[i] = bar64 >> 32;
+		} else {
+			size = (u32)~(mask[i] & PCI_CONFIG_BASE_ADDRESS_MEMMASK)
+				+ 1;
+			vf->bar[i] = base[i] + (u32)size * index;
+		}
+	}
+	for (i = 0; i < PCI_CONFIG_BASE_ADDRESS_NUMS; i++)
+		dev->config_space.base_address[i] = vf->bar[i];
+	dev->config_space.vendor_id = pf->config_space.vendor_id;
+	dev->config_space.device_id = device_id;
+	dev->config_space.multi_function = 1;
+	/* the memory space of VFs is enabled by VF MSE of the
+	   physical function */
+	dev->fake_command_mask = PCI_COMMAND_MEMORY;
+	dev->fake_command_virtual = PCI_COMMAND_MEMORY;
+	dev->host = vf;
+	dev->driver = &pci_sriov_vf_driver;
+	printf ("[%02X:%02X.%X] SR-IOV VF %d of [%02X:%02X.%X]\n",
+		addr.bus_no, addr.device_no, addr.func_no, index,
+		pf->address.bus_no, pf->address.device_no,
+		pf->address.func_no);
+}
+
+/* enable numvfs virtual functions of the physical function.  the VF
+   BARs must have been assigned by firmware.  returns the number of
+   enabled virtual functions, or 0 on error */
+int
+pci_sriov_enable (struct pci_device *pf, int numvfs)
+{
+	int cap, i, n, total, lastbus;
+	u16 ctrl, offset, stride, device_id, rid;
+	u64 base64, mask64;
+	u32 base[PCI_CONFIG_BASE_ADDRESS_NUMS];
+	u32 mask[PCI_CONFIG_BASE_ADDRESS_NUMS];
+	bool assigned;
+
+	if (!pf->config_mmio || numvfs <= 0)
+		return 0;
+	cap = pci_sriov_find_cap (pf);
+	if (!cap)
+		return 0;
+	ctrl = pci_sriov_read (pf, cap + SRIOV_CTRL, 2);
+	if (ctrl & SRIOV_CTRL_VFE) {
+		printf ("SR-IOV: VFs are already enabled\n");
+		return 0;
+	}
+	total = pci_sriov_read (pf, cap + SRIOV_TOTAL_VFS, 2);
+	if (numvfs > total)
+		numvfs = total;
+	if (pci_sriov_read (pf, cap + SRIOV_SUP_PGSIZE, 4) & SRIOV_PGSIZE_4K)
+		pci_sriov_write (pf, cap + SRIOV_SYS_PGSIZE, 4,
+				 SRIOV_PGSIZE_4K);
+	/* the offset and the stride depend on NumVFs */
+	pci_sriov_write (pf, cap + SRIOV_NUM_VFS, 2, numvfs);
+	offset = pci_sriov_read (pf, cap + SRIOV_VF_OFFSET, 2);
+	stride = pci_sriov_read (pf, cap + SRIOV_VF_STRIDE, 2);
+	device_id = pci_sriov_read (pf, cap + SRIOV_VF_DID, 2);
+	lastbus = pf->parent_bridge ?
+		pf->parent_bridge->bridge.subordinate_bus_no :
+		pf->address.bus_no;
+	rid = pf->address.bus_no << 8 | pf->address.device_no << 3 |
+		pf->address.func_no;
+	for (n = 0; n < numvfs; n++)
+		if (((rid + offset + stride * n) >> 8) > lastbus)
+			break;
+	if (n < numvfs) {
+		printf ("SR-IOV: bus numbers for %d VFs only\n", n);
+		numvfs = n;
+		pci_sriov_write (pf, cap + SRIOV_NUM_VFS, 2, numvfs);
+		offset = pci_sriov_read (pf, cap + SRIOV_VF_OFFSET, 2);
+		stride = pci_sriov_read (pf, cap + SRIOV_VF_STRIDE, 2);
+	}
+	if (!numvfs)
+		return 0;
+	assigned = false;
+	for (i = 0; i < PCI_CONFIG_BASE_ADDRESS_NUMS; i += n) {
+		n = pci_sriov_read_bar (pf, cap, i, &base64, &mask64);
+		base[i] = base64;
+		mask[i] = mask64;
+		if (n == 2) {
+			base[i + 1] = base64 >> 32;
+			mask[i + 1] = mask64 >> 32;
+		}
+		if (!(mask[i] & PCI_CONFIG_BASE_ADDRESS_MEMMASK))
+			continue;
+		if (!(base64 & ~(u64)~PCI_CONFIG_BASE_ADDRESS_MEMMASK)) {
+			printf ("SR-IOV: VF BAR%d is not assigned\n", i);
+			pci_sriov_write (pf, cap + SRIOV_NUM_VFS, 2, 0);
+			return 0;
+		}
+		assigned = true;
+	}
+	if (!assigned)
+		return 0;
+	pci_sriov_write (pf, cap + SRIOV_CTRL, 2,
+			 ctrl | SRIOV_CTRL_VFE | SRIOV_CTRL_VF_MSE);
+	pci_sriov_usleep (SRIOV_ENABLE_WAIT);
+	for (n = 0; n < numvfs; n++)
+		pci_sriov_add_vf (pf, n, rid + offset + stride * n, device_id,
+				  base, mask);
+	return numvfs;
+}
@@ -506,8 +506,11 @@ ehci_config_write (struct pci_device *pci_device, u8 iosize, u16 offset,
 			 "with %08x\n", iobase);
 		if (iobase < 0xffffffdeU) {
 			host->iobase = iobase;
-			mmio_register (iobase, 0x80, ehci_register_handler,
-				       (void *)host);
+			if (host->mmio)
+				mmio_unregister (host->mmio);
+			host->mmio = mmio_register (iobase, 0x80,
+						    ehci_register_handler,
+						    (void *)host);
 		}
 		break;
 	case 0x61:
@@ -524,11 +527,33 @@ ehci_config_write (struct pci_device *pci_device, u8 iosize, u16 offset,
 	return CORE_IO_RET_DEFAULT;
 }
 
+/* The host controller has been unplugged.  The async list monitor
+   is stopped as on a host controller reset, and it releases the
+   shadows and the devices when it exits.  The host stays registered
+   to the USB core which has no way to drop it. */
+static void
+ehci_remove (struct pci_device *pci_device)
+{
+	struct ehci_host *host = pci_device->host;
+	bool monitoring;
+
+	if (host->mmio)
+		mmio_unregister (host->mmio);
+	host->mmio = NULL;
+	usb_sc_lock(host->usb_host);
+	monitoring = !!host->headqh_phys[1];
+	host->hcreset = 1;
+	usb_sc_unlock(host->usb_host);
+	if (!monitoring)
+		usb_unregister_devices (host->usb_host);
+}
+
 static struct pci_driver ehci_driver = {
 	.name		= driver_name,
 	.longname	= driver_longname,
 	.device		= "class_code=0c0320",
 	.new		= ehci_new,	
+	.remove		= ehci_remove,
 	.config_read	= ehci_config_read,
 	.config_write	= ehci_config_write,
 };
@@ -136,6 +136,7 @@ struct ehci_host {
 	int usb_stopped;
 	int running;
 	int intr;
+	void *mmio;
 };
 	
 struct urb_private_ehci {
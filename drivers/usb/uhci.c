@@ -346,6 +346,30 @@ notset_iobase:
 	return CORE_IO_RET_DEFAULT;
 }
 
+/* The host controller has been unplugged.  The frame list monitor
+   is stopped as on a stop of the guest, and it releases the shadows
+   and the devices when it exits.  The host stays registered to the
+   USB core which has no way to drop it. */
+static void
+uhci_remove (struct pci_device *pci_device)
+{
+	struct uhci_host *host = pci_device->host;
+	bool monitoring;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (host->iohandle_desc[i])
+			core_io_unregister_handler(host->iohandle_desc[i]);
+		host->iohandle_desc[i] = 0;
+	}
+	spinlock_lock(&host->lock_hc);
+	monitoring = !!host->gframelist;
+	host->usb_stopped = 1;
+	spinlock_unlock(&host->lock_hc);
+	if (!monitoring)
+		usb_unregister_devices (host->hc);
+}
+
 static struct pci_driver uhci_driver = {
 	.name		= driver_name,
 	.longname	= driver_longname,
@@ -353,6 +377,8 @@ static struct pci_driver uhci_driver = {
 	.device		= "class_code=0c0300",
 	/* called when a new PCI ATA device is found */
 	.new		= uhci_new,		
+	/* called when the host controller is unplugged */
+	.remove		= uhci_remove,
 	/* called when a config register is read */
 	.config_read	= uhci_config_read,	
 	/* called when a config register is written */
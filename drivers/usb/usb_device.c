@@ -119,9 +119,12 @@ free_interface_descriptors(struct usb_interface_descriptor *idesc, int n)
 	for (i = 0; i < n; i++) {
 		if (idesc[i].extra)
 			free(idesc[i].extra);
+		/* an entry for endpoint-0 may be prepended */
 		if (idesc[i].endpoint)
 			free_endpoint_descriptors(idesc[i].endpoint,
-						  idesc[i].bNumEndpoints);
+						  idesc[i].bNumEndpoints +
+						  (idesc[i].endpoint->bLength ?
+						   0 : 1));
 	}
 	free(idesc);
 	return;
@@ -324,13 +327,13 @@ device_iface_change(struct usb_host *usbhc,
 
 	if (dev && dev->config && dev->config->interface &&
 		dev->config->interface->cur_altsettings) {
-		if (iface > dev->config->bNumInterfaces) {
+		/* wIndex is an interface number starting from 0 */
+		if (iface >= dev->config->bNumInterfaces) {
 			dprintf(1,
 				"%u, Invalid interface specification, %u)\n",
 				devadr, iface);
 			return USB_HOOK_PASS;
 		}
-		iface--;
 		dev->config->interface->cur_altsettings[iface] = alt;
 	}
 
@@ -489,7 +492,8 @@ extract_config_descriptors(struct usb_host *host, virt_t buf, size_t len,
 					idescp->extralen += deschead->bLength;
 				break;
 			case USB_DT_ENDPOINT: 
-				break;
+				/* class-specific endpoint descriptors,
+				   e.g. UAS Pipe Usage */
 				edescp->extra = (unsigned char *)
 					tack_on((virt_t)edescp->extra, 
 						edescp->extralen, 
@@ -497,6 +501,7 @@ extract_config_descriptors(struct usb_host *host, virt_t buf, size_t len,
 						deschead->bLength, 1);
 				if (edescp->extra)
 					edescp->extralen += deschead->bLength;
+				break;
 			default:
 				*odesc = (unsigned char *)
 					tack_on((virt_t)*odesc, odesclen,
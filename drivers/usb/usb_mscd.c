@@ -62,6 +62,7 @@
 
 DEFINE_ZALLOC_FUNC(usbmsc_device);
 DEFINE_ZALLOC_FUNC(usbmsc_unit);
+DEFINE_GET_U16_FROM_SETUP_FUNC(wIndex);
 
 static inline u32 bswap32(u32 x)
 {
@@ -76,121 +77,53 @@ static inline u16 bswap16(u16 x)
         return (x << 8) | ( x >> 8);
 }
 
-static size_t
-prepare_buffers(struct usb_buffer_list *src_ub, 
-		struct usb_buffer_list *dest_ub, 
-		size_t block_len, virt_t *src_vadr, virt_t *dest_vadr)
+/* map a buffer of the list unless it is a shadow buffer */
+static void *
+map_buffer(struct usb_buffer_list *ub, int flags)
 {
-	size_t len;
-
-	if (src_ub->len % block_len) {
-		/* source is unaligned */
-		struct usb_buffer_list *ub;
-		int i, concat;
-		virt_t buf_p, vadr;
-
-		/* sum up buffers length until aligned */
-		ub = src_ub;
-		len = 0;
-		concat = 0;
-		do {
-			if (!ub) {
-				dprintft(0, "MSCD(  : ): "
-					 "WARNING : unalinged(%x) "
-					 "buffer(%x) found.\n",
-					 block_len, len);
-				break;
-			}
-			len += ub->len;
-			ub = ub->next;
-			concat++;
-		} while (len % block_len);
-			
-		/* allocate a temporary buffer for source */
-		*src_vadr = buf_p = (virt_t)alloc(len);
-
-		/* copy source buffer data 
-		   into the source temporary buffer */
-		for (i = 0; i < concat; i++) {
-			if (src_ub->vadr)
-				vadr = src_ub->vadr;
-			else
-				vadr = (virt_t)
-					mapmem_gphys(src_ub->padr, 
-						     src_ub->len, 0);
-			memcpy((void *)buf_p, (void *)vadr, src_ub->len);
-			if (!src_ub->vadr)
-				unmapmem((void *)vadr, src_ub->len);
-			buf_p += src_ub->len;
-			src_ub = src_ub->next;
-		}
-
-		/* allocate a temporary buffer for destination */
-		*dest_vadr = (virt_t)alloc(len);
-
-	} else if (src_ub->vadr) {
-		/* source is shadow buffer */
-		*src_vadr = src_ub->vadr;
-		*dest_vadr = (virt_t)
-			mapmem_gphys(dest_ub->padr, dest_ub->len, 0);
-		len = src_ub->len;
-	} else {
-		/* source is guest buffer */
-		*src_vadr = (virt_t)
-			mapmem_gphys(src_ub->padr, src_ub->len, 0);
-		*dest_vadr = dest_ub->vadr;
-		len = src_ub->len;
-	}
-
-	ASSERT(*src_vadr);
-	ASSERT(*dest_vadr);
-	ASSERT(len > 0);
+	if (ub->vadr)
+		return (void *)ub->vadr;
+	return mapmem_gphys(ub->padr, ub->len, flags);
+}
 
-	return len;
+static void
+unmap_buffer(struct usb_buffer_list *ub, void *vadr)
+{
+	if (!ub->vadr)
+		unmapmem(vadr, ub->len);
 }
 
-static int
-windup_buffers(virt_t src_vadr, virt_t dest_vadr, 
-		struct usb_buffer_list *dest_ub, size_t len)
+/* copy bytes from off to off + len between two segment lists */
+static void
+copy_tail(struct storage_iovec *dst, struct storage_iovec *src, int n,
+	  size_t off, size_t len)
 {
-	int adv;
-
-	if (dest_vadr == dest_ub->vadr) {
-		/* destination is shadow buffer, 
-		   so source must be mapped guest buffer */
-		unmapmem((void *)src_vadr, len);
-		adv = 1;
-	} else if (len == dest_ub->len) {
-		/* destination is guest buffer */
-		unmapmem((void *)dest_vadr, len);
-		adv = 1;
-	} else {
-		/* distribute the coded data 
-		   in the temporary buffer into each buffer */
-		virt_t vadr, buf_p;
-		size_t dest_len;
-
-		buf_p = dest_vadr;
-		for (adv = 0; len > 0; adv++) {
-			dest_len = (len > dest_ub->len) ? dest_ub->len : len;
-			if (dest_ub->vadr)
-				vadr = dest_ub->vadr;
-			else
-				vadr = (virt_t)
-					mapmem_gphys(dest_ub->padr,
-						     dest_len, 0);
-			memcpy((void *)vadr, (void *)buf_p, dest_len);
-			buf_p += dest_len;
-			len -= dest_len;
-			dest_ub = dest_ub->next;
-		}
+	size_t soff, doff, sn, dn, c;
+	int i, j;
 
-		/* deallocate the temporary buffers */
-		free((void *)src_vadr);
-		free((void *)dest_vadr);
+	for (i = 0, soff = off; i < n && soff >= src[i].len; i++)
+		soff -= src[i].len;
+	for (j = 0, doff = off; j < n && doff >= dst[j].len; j++)
+		doff -= dst[j].len;
+	while (len > 0 && i < n && j < n) {
+		sn = src[i].len - soff;
+		dn = dst[j].len - doff;
+		c = (sn < dn) ? sn : dn;
+		if (c > len)
+			c = len;
+		memcpy((u8 *)dst[j].base + doff, (u8 *)src[i].base + soff, c);
+		len -= c;
+		soff += c;
+		doff += c;
+		if (soff == src[i].len) {
+			i++;
+			soff = 0;
+		}
+		if (doff == dst[j].len) {
+			j++;
+			doff = 0;
+		}
 	}
-
-	return adv;
 }
 
 static int
@@ -201,9 +134,10 @@ usbmsc_code_buffers(struct usbmsc_device *mscdev,
 {
 	struct usbmsc_unit *mscunit;
 	struct storage_access access;
-	virt_t src_vadr, dest_vadr;
+	struct storage_iovec *src_iov, *dest_iov;
+	struct usb_buffer_list *sub, *dub;
 	size_t len, block_len;
-	int adv, n_blocks = 0;
+	int i, n;
 
 	mscunit = mscdev->unit[mscdev->lun];
 	ASSERT(mscunit->storage != NULL);
@@ -218,90 +152,94 @@ usbmsc_code_buffers(struct usbmsc_device *mscdev,
 	block_len = mscunit->storage_sector_size;
 	ASSERT(block_len > 0);
 
+	/* the shadow and guest lists have the same layout.  pass them
+	   to the storage handler as they are, so that no buffer is
+	   concatenated even if a sector straddles two buffers */
+	len = 0;
+	n = 0;
+	for (sub = src_ub, dub = dest_ub; sub && dub && len < length;
+	     sub = sub->next, dub = dub->next) {
+		if ((sub->len == 0) || (sub->pid != pid))
+			break;
+		len += (sub->len < dub->len) ? sub->len : dub->len;
+		n++;
+	}
+	if (n == 0)
+		return 0;
+	src_iov = alloc(sizeof *src_iov * n);
+	dest_iov = alloc(sizeof *dest_iov * n);
+	len = 0;
+	for (i = 0, sub = src_ub, dub = dest_ub; i < n;
+	     i++, sub = sub->next, dub = dub->next) {
+		src_iov[i].base = map_buffer(sub, 0);
+		src_iov[i].len = (sub->len < dub->len) ? sub->len : dub->len;
+		dest_iov[i].base = map_buffer(dub, MAPMEM_WRITE);
+		dest_iov[i].len = src_iov[i].len;
+		len += src_iov[i].len;
+	}
+
 	/* set up an access attribute for storage handler */
 	access.rw = rw;
 	access.lba = mscunit->lba;
 	access.sector_size = block_len;
+	access.count = len / block_len;
+	if (len % block_len)
+		dprintft(0, "MSCD(  : ): "
+			 "WARNING : unalinged(%x) "
+			 "buffer(%x) found.\n",
+			 block_len, len);
+	if (length < len)
+		dprintft(2, "MSCD(  :%d): WARNING : "
+			 "%d bytes over coded\n",
+			 mscdev->lun, len - length);
+
+	/* encode/decode buffer data.  the command is failed at the
+	   status phase if the data could not be handled */
+	if (storage_handle_sectors_iov(mscunit->storage, &access,
+				       src_iov, n, dest_iov, n))
+		mscunit->failed = true;
+	copy_tail(dest_iov, src_iov, n, access.count * block_len,
+		  len - access.count * block_len);
+
+	dprintft(3, "MSCD(  :%d):           "
+		 "%d blocks(LBA:%08x) encoded\n", 
+		 mscdev->lun, access.count, access.lba);
+
+	for (i = 0, sub = src_ub, dub = dest_ub; i < n;
+	     i++, sub = sub->next, dub = dub->next) {
+		unmap_buffer(sub, src_iov[i].base);
+		unmap_buffer(dub, dest_iov[i].base);
+	}
+	free(src_iov);
+	free(dest_iov);
 
-	do {
-		if ((src_ub->len == 0) || (src_ub->pid != pid))
-			break;
-
-		/* prepare buffers (concat or mapmem) */
-		len = prepare_buffers(src_ub, dest_ub, 
-				      block_len, &src_vadr, &dest_vadr);
-
-		/* count up coded sectors */
-		access.count = len / block_len;
-
-		/* encode/decode buffer data */
-		storage_handle_sectors(mscunit->storage, &access, 
-				       (u8 *)src_vadr, (u8 *)dest_vadr);
-
-		dprintft(3, "MSCD(  :%d):           "
-			 "%d blocks(LBA:%08x) encoded\n", 
-			 mscdev->lun, access.count, access.lba);
-
-		/* increment lba for the next */
-		access.lba += access.count;
-		n_blocks += access.count;
-		if (length < (block_len * access.count)) {
-			dprintft(2, "MSCD(  :%d): WARNING : "
-				 "%d bytes over coded\n",
-				 mscdev->lun,
-				 block_len * access.count - length);
-			length = 0;
-		} else {
-			length -= block_len * access.count;
-		}
-
-		/* wind up buffers (distribute or unmapmem) */
-		adv = windup_buffers(src_vadr, dest_vadr, dest_ub, len);
-
-		/* advance both buffer lists for the next */
-		do {
-			src_ub = src_ub->next;
-			dest_ub = dest_ub->next;
-		} while (--adv > 0);
-		
-	} while (src_ub && dest_ub && (length > 0));
-
-	return n_blocks;
+	return access.count;
 }
 
 /***
  *** funtions for BULK OUT pre-hook
  ***/
+/* parse a CDB shared by a CBW and a UAS command IU */
 static void
-usbmsc_cbw_parser(u8 devadr, 
-		  struct usbmsc_device *mscdev, struct usb_msc_cbw *cbw)
+usbmsc_cdb_parser(u8 devadr, struct usbmsc_device *mscdev, u32 tag,
+		  u8 *cdb)
 {
 	static const unsigned char opstr[] = "STRANGE OPID";
 	struct usbmsc_unit *mscunit;
 
-	/* read a CBW(Command Block Wrapper) */
-	mscdev->tag = cbw->dCBWTag;
-	mscdev->lun = cbw->bCBWLUN & 0x0fU;
-	if (mscdev->lun > mscdev->lun_max) {
-		dprintft(0, "MSCD(%02x: ): %08x: "
-			 "WARNING: INVALID LUN(%u)\n",
-			 devadr, cbw->dCBWTag, mscdev->lun);
-		mscdev->lun = 0;
-	}
 	mscunit = mscdev->unit[mscdev->lun];
-	mscunit->command = cbw->CBWCB[0];
-	mscunit->length = (size_t)cbw->dCBWDataTransferLength;
+	mscunit->command = cdb[0];
 	dprintft(2, "MSCD(%02x:%u): %08x: %s\n",
-		 devadr, mscdev->lun, cbw->dCBWTag,
-		 (cbw->CBWCB[0] < SCSI_OPID_MAX) ? 
-		 scsi_op2str[cbw->CBWCB[0]] : opstr);
-	switch (cbw->CBWCB[0]) {
+		 devadr, mscdev->lun, tag,
+		 (cdb[0] < SCSI_OPID_MAX) ? 
+		 scsi_op2str[cdb[0]] : opstr);
+	switch (cdb[0]) {
 	case 0x28: /* READ(10) */
 	case 0x2a: /* WRITE(10) */
 		mscunit->lba = 
-			bswap32(*(u32 *)&cbw->CBWCB[2]); /* big endian */
+			bswap32(*(u32 *)&cdb[2]); /* big endian */
 		mscunit->n_blocks = 
-			bswap16(*(u16 *)&cbw->CBWCB[7]); /* big endian */
+			bswap16(*(u16 *)&cdb[7]); /* big endian */
 		dprintft(2, "MSCD(%02x:%u):          ",
 			 devadr, mscdev->lun);
 		dprintf(2, "[LBA=%08x, NBLK=%04x]\n", 
@@ -310,9 +248,9 @@ usbmsc_cbw_parser(u8 devadr,
 	case 0xa8: /* READ(12)  */
 	case 0xaa: /* WRITE(12) */
 		mscunit->lba =
-			bswap32(*(u32 *)&cbw->CBWCB[2]); /* big endian */
+			bswap32(*(u32 *)&cdb[2]); /* big endian */
 		mscunit->n_blocks =
-			bswap32(*(u32 *)&cbw->CBWCB[6]); /* big endian */
+			bswap32(*(u32 *)&cdb[6]); /* big endian */
 		dprintft(2, "MSCD(%02x:%u):          ",
 			 devadr, mscdev->lun);
 		dprintf(2, "[LBA=%08x, NBLK=%04x]\n",
@@ -328,6 +266,29 @@ usbmsc_cbw_parser(u8 devadr,
 	return;
 }
 
+static void
+usbmsc_cbw_parser(u8 devadr, 
+		  struct usbmsc_device *mscdev, struct usb_msc_cbw *cbw)
+{
+	struct usbmsc_unit *mscunit;
+
+	/* read a CBW(Command Block Wrapper) */
+	mscdev->tag = cbw->dCBWTag;
+	mscdev->lun = cbw->bCBWLUN & 0x0fU;
+	if (mscdev->lun > mscdev->lun_max) {
+		dprintft(0, "MSCD(%02x: ): %08x: "
+			 "WARNING: INVALID LUN(%u)\n",
+			 devadr, cbw->dCBWTag, mscdev->lun);
+		mscdev->lun = 0;
+	}
+	mscunit = mscdev->unit[mscdev->lun];
+	mscunit->length = (size_t)cbw->dCBWDataTransferLength;
+	mscunit->failed = false;
+	usbmsc_cdb_parser(devadr, mscdev, cbw->dCBWTag, cbw->CBWCB);
+
+	return;
+}
+
 static void
 usbmsc_copy_buffer(struct usb_buffer_list *dest,
 		   struct usb_buffer_list *src, size_t len)
@@ -344,7 +305,8 @@ usbmsc_copy_buffer(struct usb_buffer_list *dest,
 		if (dest->vadr)
 			dest_vadr = dest->vadr;
 		else
-			dest_vadr = (virt_t)mapmem_gphys(dest->padr, clen, 0);
+			dest_vadr = (virt_t)mapmem_gphys(dest->padr, clen,
+							 MAPMEM_WRITE);
 		memcpy((void *)dest_vadr, (void *)src_vadr, clen);
 		if (!dest->vadr)
 			unmapmem((void *)dest_vadr, clen);
@@ -358,6 +320,31 @@ usbmsc_copy_buffer(struct usb_buffer_list *dest,
 	return;
 }
 
+/* copy the head of a shadow buffer list into buf or back.  a guest
+   may split an IU or a CBW at a page boundary. */
+static size_t
+usbmsc_gather_buffer(void *buf, struct usb_buffer_list *ub, size_t len)
+{
+	size_t clen, off;
+
+	for (off = 0; ub && off < len; ub = ub->next, off += clen) {
+		clen = (len - off < ub->len) ? len - off : ub->len;
+		memcpy((u8 *)buf + off, (void *)ub->vadr, clen);
+	}
+	return off;
+}
+
+static void
+usbmsc_scatter_buffer(struct usb_buffer_list *ub, void *buf, size_t len)
+{
+	size_t clen, off;
+
+	for (off = 0; ub && off < len; ub = ub->next, off += clen) {
+		clen = (len - off < ub->len) ? len - off : ub->len;
+		memcpy((void *)ub->vadr, (u8 *)buf + off, clen);
+	}
+}
+
 static void
 usbmsc_outbuf_halt_uhci (struct usb_host *usbhc, struct usb_request_block *urb,
 			 struct usbmsc_device *mscdev,
@@ -407,32 +394,614 @@ usbmsc_outbuf_halt_ehci (struct usb_host *usbhc, struct usb_request_block *urb,
 	URB_EHCI (gurb)->qh_copy = *URB_EHCI (gurb)->qh;
 }
 
-static void
-usbmsc_outbuf_halt (struct usb_host *usbhc, struct usb_request_block *urb,
-		    struct usbmsc_device *mscdev, struct usbmsc_unit *mscunit)
+static void
+usbmsc_outbuf_halt (struct usb_host *usbhc, struct usb_request_block *urb,
+		    struct usbmsc_device *mscdev, struct usbmsc_unit *mscunit)
+{
+	switch (usbhc->type) {
+	case USB_HOST_TYPE_UHCI:
+		usbmsc_outbuf_halt_uhci (usbhc, urb, mscdev, mscunit,
+					 usbhc->private);
+		break;
+	case USB_HOST_TYPE_EHCI:
+		usbmsc_outbuf_halt_ehci (usbhc, urb, mscdev, mscunit,
+					 usbhc->private);
+		break;
+	}
+}
+
+/* encode or copy OUT data of the current command.  called with
+   mscdev->lock held */
+static int
+usbmsc_shadow_data(u8 devadr, struct usbmsc_device *mscdev,
+		   struct usbmsc_unit *mscunit,
+		   struct usb_buffer_list *hub, struct usb_buffer_list *gub)
+{
+	int n_blocks;
+
+	switch (mscunit->command) {
+	case 0x2a: /* WRITE(10) */
+	case 0xaa: /* WRITE(12) */
+		/* encode buffers */
+		n_blocks = usbmsc_code_buffers(mscdev, hub, gub, USB_PID_OUT,
+					       mscunit->length, STORAGE_WRITE);
+
+		if (mscunit->n_blocks < n_blocks) {
+			dprintft(0, "MSCD(%02x:%d): WARNING: "
+				 "over %d block(s) wrote.\n", devadr,
+				 mscdev->lun,
+				 n_blocks - mscunit->n_blocks);
+			n_blocks = mscunit->n_blocks;
+		}
+
+		mscunit->length -= 
+			mscunit->storage_sector_size * n_blocks;
+		mscunit->n_blocks -= n_blocks;
+		mscunit->lba += n_blocks;
+
+		return USB_HOOK_PASS;
+
+	case 0xb6: /* SET STREAMING (For Vista CD format) */
+	case 0x55: /* MODE SELECT (For setting the device param to CD ) */
+	case 0x5d: /* SEND CUE SHEET (For writing CD as DAO )*/
+	case 0x04: /* FORMAT UNIT (For formatting CD as the packet writing ) */
+	case 0x1b: /* START/STOP UNIT */
+	case 0xff: /* vendor specific, especially for HIBUN-LE */
+		/* pass though */
+		usbmsc_copy_buffer(hub, gub, mscunit->length);
+		mscunit->length = 0;
+		return USB_HOOK_PASS;
+	default:
+		dprintft(0, "MSCD(%02x:%d): WARNING: "
+			 "%d bytes OUT data dropped "
+			 "because of unknown command(%02x).\n",
+			 devadr, mscdev->lun,
+			 mscunit->length, mscunit->command);
+		mscunit->length = 0;
+		break;
+	}
+	
+	/* unknown transfer should be denied */
+	return USB_HOOK_DISCARD;
+}
+
+/* decode or copy IN data of the current command.  called with
+   mscdev->lock held */
+static void
+usbmsc_copyback_data(struct usb_request_block *urb, u8 devadr,
+		     struct usbmsc_device *mscdev,
+		     struct usbmsc_unit *mscunit,
+		     struct usb_buffer_list *hub, struct usb_buffer_list *gub)
+{
+	u32 cap[2] = { 0, 0 };
+	u16 cur_prf, hdr[4] = { 0, 0, 0, 0 };
+	int i, n_blocks;
+
+	switch (mscunit->command) {
+	case 0x46: /* GET CONFIGURATION */
+		/* the header may be split at a page boundary */
+		usbmsc_gather_buffer(hdr, hub, sizeof hdr);
+		cur_prf = bswap16(hdr[3]);
+		if ( cur_prf != USBMSC_PROF_NOPROF ) {
+			mscunit->profile = cur_prf;
+		}
+	/* through */
+	case 0x03: /* REQUEST SENSE */
+	case 0x12: /* INQUIRY */
+	case 0x1a: /* MOSE SENSE(6) */
+	case 0x23: /* READ FORMAT CAPACITIES */
+	case 0x3c: /* READ BUFFER */
+	case 0x4a: /* GET EVENT/STATUS NOTIFICATION */
+	case 0x42: /* READ SUBCHANNEL */
+	case 0x43: /* READ TOC/PMA/ATIP */
+	case 0x51: /* READ DISC INFORMATION */
+	case 0x52: /* READ TRACK INFORMATION */
+	case 0x5a: /* MODE SENSE(10) */
+	case 0x5c: /* READ BUFFER CAPACITY */
+ 	case 0xa4: /* REPORT KEY */
+ 	case 0xac: /* GET PERFORMANCE */
+	case 0xad: /* READ DISC STRUCTURE */
+	case 0xb9: /* READ CD MSF */
+	case 0xbe: /* READ CD */
+		dprintft(2, "MSCD(%02x:%d):           [",
+			 devadr, mscdev->lun);
+		for (i = 0; i < urb->actlen; i++)
+			dprintf(2, "%02x", *(u8 *)(hub->vadr + i));
+		dprintf(2, "]\n");
+	case 0x06: /* vendor specific, especially for HIBUN-LE */
+	case 0xd4: /* vendor specific, especially for HIBUN-LE */
+	case 0xd5: /* vendor specific, especially for HIBUN-LE */
+	case 0xd8: /* vendor specific, especially for HIBUN-LE */
+	case 0xd9: /* vendor specific, especially for HIBUN-LE */
+	case 0xff: /* vendor specific, especially for HIBUN-LE */
+ 		usbmsc_copy_buffer(gub, hub, mscunit->length);
+ 		mscunit->length = 0;
+		break;
+	case 0x25: /* READ CAPABILITY(10) */
+		usbmsc_gather_buffer(cap, hub, sizeof cap);
+		mscunit->lba_max = bswap32(cap[0]);
+		ASSERT(mscunit->storage != NULL);
+		mscunit->storage_sector_size = bswap32(cap[1]);
+		dprintft(2, "MSCD(%02x:%d):           "
+			 "[LBAMAX=%08x, BLKLEN=%08x]\n",
+			 devadr, mscdev->lun, mscunit->lba_max, 
+			 mscunit->storage_sector_size);
+		usbmsc_copy_buffer(gub, hub, mscunit->length);
+		mscunit->length = 0;
+		break;
+	case 0x28: /* READ(10) */
+	case 0xa8: /* READ(12) */
+		/* DATA */
+		n_blocks = usbmsc_code_buffers(mscdev, gub, hub, 
+					       USB_PID_IN, 
+					       urb->actlen,
+					       STORAGE_READ);
+
+		if (mscunit->n_blocks < n_blocks) {
+			dprintft(0, "MSCD(%02x:%d): WARNING: "
+				 "over %d block(s) read.\n",
+				 devadr, mscdev->lun,
+				 n_blocks - mscunit->n_blocks);
+			n_blocks = mscunit->n_blocks;
+		}
+
+		mscunit->length -= 
+			mscunit->storage_sector_size * n_blocks;
+		mscunit->n_blocks -= n_blocks;
+		mscunit->lba += n_blocks;
+
+		break;
+	default:
+		dprintft(0, "MSCD(%02x:%d): WARNING: "
+			 "%d bytes IN data dropped "
+			 "because of unknown command(%02x).\n",
+			 devadr, mscdev->lun,
+			 mscunit->length, mscunit->command);
+		mscunit->length = 0;
+		break;
+	}
+}
+
+/* undo parameters, maybe wrong, if a command failed */
+static void
+usbmsc_command_failed(struct usbmsc_unit *mscunit)
+{
+	switch (mscunit->command) {
+	case 0x25: /* READ CAPACITY(10) */
+		mscunit->lba_max = 0;
+		ASSERT(mscunit->storage != NULL);
+		mscunit->storage_sector_size = 0;
+		break;
+	case 0x46: /* GET CONFIGURATION */
+		mscunit->profile = USBMSC_PROF_NOPROF;
+		break;
+	default:
+		break;
+	}
+}
+
+static inline struct usbmsc_unit *
+usbmsc_create_unit(struct usb_host *usbhc, struct usb_device *dev)
+{
+	struct usbmsc_unit *mscunit;
+	unsigned int usb_host_id, usb_device_id;
+	u64 hostport;
+	char usb_vendor_id[5], usb_product_id[5];
+	struct storage_extend usb_extend[] = {
+		{ "usb_vendor_id", usb_vendor_id },
+		{ "usb_product_id", usb_product_id },
+		{ NULL, NULL }
+	};
+
+	mscunit = zalloc_usbmsc_unit();
+	usb_host_id = usbhc->host_id;
+	hostport = dev->portno;
+	while (hostport > USB_PORT_MASK)
+		hostport >>= USB_HUB_SHIFT;
+	usb_device_id = (unsigned int)hostport;
+	snprintf (usb_vendor_id, sizeof usb_vendor_id, "%04x",
+		  dev->descriptor.idVendor);
+	snprintf (usb_product_id, sizeof usb_product_id, "%04x",
+		  dev->descriptor.idProduct);
+	mscunit->storage =
+		storage_new(STORAGE_TYPE_USB, usb_host_id,
+		    usb_device_id, NULL, usb_extend);
+	ASSERT(mscunit->storage != NULL);
+
+	return mscunit;
+}
+
+/***
+ *** functions for USB Attached SCSI (UAS)
+ ***/
+/* returns the UAS pipe of an endpoint, or -1 unless the UAS
+   interface is currently selected.  called with mscdev->lock held */
+static int
+usbmsc_uas_pipe(struct usb_device *dev, struct usbmsc_device *mscdev,
+		u8 epadr)
+{
+	struct usbmsc_uas *uas;
+	bool active;
+	int i;
+
+	uas = mscdev->uas;
+	if (!uas)
+		return -1;
+	active = dev->config && dev->config->interface &&
+		dev->config->interface->cur_altsettings &&
+		uas->ifnum < dev->config->bNumInterfaces &&
+		dev->config->interface->cur_altsettings[uas->ifnum] ==
+		uas->alt;
+	if (active != uas->active) {
+		/* commands in flight are lost on SetInterface() */
+		dprintft(1, "MSCD(%02x: ): %s protocol selected\n",
+			 dev->devnum, active ? "UAS" : "Bulk-only");
+		memset(uas->cmd, 0, sizeof uas->cmd);
+		uas->datain = uas->dataout = NULL;
+		uas->active = active;
+	}
+	if (!active)
+		return -1;
+	for (i = 0; i < USBMSC_UAS_PIPE_NUM; i++)
+		if (uas->pipe[i] == epadr)
+			return i;
+	return -1;
+}
+
+static struct usbmsc_uas_cmd *
+usbmsc_uas_find_cmd(struct usbmsc_uas *uas, u16 tag)
+{
+	int i;
+
+	for (i = 0; i < USBMSC_UAS_TAG_MAX; i++)
+		if (uas->cmd[i].used && uas->cmd[i].tag == tag)
+			return &uas->cmd[i];
+	return NULL;
+}
+
+static void
+usbmsc_uas_put_cmd(struct usbmsc_uas *uas, struct usbmsc_uas_cmd *cmd)
+{
+	if (uas->datain == cmd)
+		uas->datain = NULL;
+	if (uas->dataout == cmd)
+		uas->dataout = NULL;
+	cmd->used = false;
+}
+
+static struct usbmsc_uas_cmd *
+usbmsc_uas_get_cmd(u8 devadr, struct usbmsc_uas *uas, u16 tag)
+{
+	struct usbmsc_uas_cmd *cmd, *oldest;
+	int i;
+
+	/* a tag reused without status is overwritten */
+	cmd = usbmsc_uas_find_cmd(uas, tag);
+	if (cmd)
+		goto found;
+	oldest = &uas->cmd[0];
+	for (i = 0; i < USBMSC_UAS_TAG_MAX; i++) {
+		if (!uas->cmd[i].used) {
+			cmd = &uas->cmd[i];
+			goto found;
+		}
+		if ((int)(uas->cmd[i].seq - oldest->seq) < 0)
+			oldest = &uas->cmd[i];
+	}
+	dprintft(0, "MSCD(%02x: ): WARNING: "
+		 "too many commands, tag %04x dropped.\n",
+		 devadr, oldest->tag);
+	cmd = oldest;
+found:
+	usbmsc_uas_put_cmd(uas, cmd);
+	memset(cmd, 0, sizeof *cmd);
+	cmd->used = true;
+	cmd->tag = tag;
+	cmd->seq = uas->seq++;
+	return cmd;
+}
+
+/* make the unit of a command current */
+static struct usbmsc_unit *
+usbmsc_uas_load(struct usbmsc_device *mscdev, struct usbmsc_uas_cmd *cmd,
+		size_t length)
+{
+	struct usbmsc_unit *mscunit;
+
+	mscdev->lun = cmd->lun;
+	mscunit = mscdev->unit[cmd->lun];
+	mscunit->command = cmd->command;
+	mscunit->lba = cmd->lba;
+	mscunit->n_blocks = cmd->n_blocks;
+	mscunit->length = length;
+	mscunit->failed = cmd->failed;
+	return mscunit;
+}
+
+static void
+usbmsc_uas_save(struct usbmsc_uas_cmd *cmd, struct usbmsc_unit *mscunit)
+{
+	cmd->lba = mscunit->lba;
+	cmd->n_blocks = mscunit->n_blocks;
+	cmd->failed = mscunit->failed;
+}
+
+/* a task management IU: remember the task it manages until the
+   response IU */
+static void
+usbmsc_uas_task_mgmt(u8 devadr, struct usbmsc_device *mscdev,
+		     struct usb_buffer_list *hub)
+{
+	struct usb_uas_task_mgmt_iu iu;
+	struct usbmsc_uas_cmd *cmd;
+
+	if (usbmsc_gather_buffer(&iu, hub, sizeof iu) < sizeof iu ||
+	    iu.bIUID != USB_UAS_IU_TASK_MGMT)
+		return;
+	cmd = usbmsc_uas_get_cmd(devadr, mscdev->uas, bswap16(iu.wTag));
+	cmd->lun = (iu.LUN[0] || iu.LUN[1] > USBMSC_LUN_MAX) ? 0 : iu.LUN[1];
+	cmd->function = iu.bFunction;
+	cmd->task = bswap16(iu.wTaskTag);
+}
+
+/* a response IU of a task management function.  the tasks it
+   aborted get no status. */
+static void
+usbmsc_uas_response(struct usbmsc_uas *uas, struct usbmsc_uas_cmd *cmd,
+		    u8 code)
+{
+	struct usbmsc_uas_cmd *task;
+	int i;
+
+	if (code != 0x00 && code != 0x08) /* COMPLETE or SUCCEEDED */
+		return;
+	switch (cmd->function) {
+	case 0x01: /* ABORT TASK */
+		task = usbmsc_uas_find_cmd(uas, cmd->task);
+		if (task && !task->function)
+			usbmsc_uas_put_cmd(uas, task);
+		break;
+	case 0x02: /* ABORT TASK SET */
+	case 0x04: /* CLEAR TASK SET */
+	case 0x08: /* LOGICAL UNIT RESET */
+	case 0x10: /* I_T NEXUS RESET */
+		for (i = 0; i < USBMSC_UAS_TAG_MAX; i++) {
+			task = &uas->cmd[i];
+			if (task->used && !task->function &&
+			    (cmd->function == 0x10 || task->lun == cmd->lun))
+				usbmsc_uas_put_cmd(uas, task);
+		}
+		break;
+	}
+}
+
+/* a command IU: copy it into the shadow and parse the CDB */
+static int
+usbmsc_uas_command(struct usb_host *usbhc, struct usb_request_block *urb,
+		   struct usbmsc_device *mscdev)
+{
+	struct usb_buffer_list *gub, *hub, *ub;
+	struct usb_uas_command_iu iu;
+	struct usbmsc_uas_cmd *cmd;
+	struct usbmsc_unit *mscunit;
+	size_t length;
+	u8 devadr, lun;
+	u16 tag;
+
+	devadr = urb->address;
+	gub = urb->shadow->buffers;
+	hub = urb->buffers;
+	if (!gub || !hub)
+		return USB_HOOK_PASS;
+	length = 0;
+	for (ub = gub; ub; ub = ub->next)
+		length += ub->len;
+	usbmsc_copy_buffer(hub, gub, length);
+	if (usbmsc_gather_buffer(&iu, hub, sizeof iu) < sizeof iu ||
+	    iu.bIUID != USB_UAS_IU_COMMAND) {
+		usbmsc_uas_task_mgmt(devadr, mscdev, hub);
+		return USB_HOOK_PASS;
+	}
+
+	tag = bswap16(iu.wTag);
+	lun = iu.LUN[1];
+	if (iu.LUN[0] || lun > USBMSC_LUN_MAX) {
+		dprintft(0, "MSCD(%02x: ): %04x: "
+			 "WARNING: INVALID LUN(%02x%02x)\n",
+			 devadr, tag, iu.LUN[0], iu.LUN[1]);
+		lun = 0;
+	}
+	if (!mscdev->unit[lun])
+		mscdev->unit[lun] = usbmsc_create_unit(usbhc, urb->dev);
+	if (mscdev->lun_max < lun)
+		mscdev->lun_max = lun;
+
+	cmd = usbmsc_uas_get_cmd(devadr, mscdev->uas, tag);
+	cmd->lun = lun;
+	mscdev->lun = lun;
+	mscunit = mscdev->unit[lun];
+	mscunit->length = 0;
+	usbmsc_cdb_parser(devadr, mscdev, tag, iu.CDB);
+	cmd->command = mscunit->command;
+	cmd->lba = mscunit->lba;
+	cmd->n_blocks = mscunit->n_blocks;
+
+	switch (cmd->command) {
+	case 0xA2:      /* SECURITY PROTOCOL IN */
+	case 0xB5:      /* SECURITY PROTOCOL OUT */
+		dprintft (0, "MSCD(%02x:%d): WARNING: "
+			  "ignoring command %02X.\n",
+			  devadr, lun, cmd->command);
+		usbmsc_uas_put_cmd(mscdev->uas, cmd);
+		usbmsc_outbuf_halt (usbhc, urb, mscdev, mscunit);
+		return USB_HOOK_DISCARD;
+	}
+	return USB_HOOK_PASS;
+}
+
+/* a status IU: track data phases and complete commands */
+static void
+usbmsc_uas_status(struct usb_request_block *urb,
+		  struct usbmsc_device *mscdev)
+{
+	struct usb_buffer_list *gub, *hub;
+	union {
+		struct usb_uas_iu_header header;
+		struct usb_uas_sense_iu sense;
+		struct usb_uas_response_iu response;
+	} iu;
+	struct usbmsc_uas *uas;
+	struct usbmsc_uas_cmd *cmd;
+	struct usbmsc_unit *mscunit;
+	size_t len;
+	u8 devadr, status;
+	u16 tag;
+
+	devadr = urb->address;
+	gub = urb->shadow->buffers;
+	hub = urb->buffers;
+	uas = mscdev->uas;
+	len = (urb->actlen < sizeof iu) ? urb->actlen : sizeof iu;
+	if (usbmsc_gather_buffer(&iu, hub, len) < sizeof iu.header)
+		goto copyback;
+	tag = bswap16(iu.header.wTag);
+	cmd = usbmsc_uas_find_cmd(uas, tag);
+	if (!cmd) {
+		dprintft(2, "MSCD(%02x: ): %04x: IU(%02x) for unknown tag\n",
+			 devadr, tag, iu.header.bIUID);
+		goto copyback;
+	}
+
+	switch (iu.header.bIUID) {
+	case USB_UAS_IU_READ_READY:
+		uas->datain = cmd;
+		break;
+	case USB_UAS_IU_WRITE_READY:
+		uas->dataout = cmd;
+		break;
+	case USB_UAS_IU_SENSE:
+		status = 0;
+		if (len >= sizeof iu.sense)
+			status = iu.sense.bStatus;
+		dprintft(2, "MSCD(%02x:%u): %04x: ==> status %02x\n",
+			 devadr, cmd->lun, tag, status);
+		mscunit = usbmsc_uas_load(mscdev, cmd, 0);
+		if (!status && mscunit->failed && len >= sizeof iu.sense) {
+			/* BUSY needs no sense data and makes the
+			   host retry the command */
+			dprintft(0, "MSCD(%02x:%d): %04x: "
+				 "storage handler failed, BUSY\n",
+				 devadr, cmd->lun, tag);
+			status = 0x08;
+			iu.sense.bStatus = status;
+			usbmsc_scatter_buffer(hub, &iu, len);
+		}
+		/* undo parameters, maybe wrong, if command failed */
+		if (status)
+			usbmsc_command_failed(mscunit);
+		else if (cmd->n_blocks > 0)
+			dprintft(0, "MSCD(%02x:%d): WARNING: "
+				 "%d block(s) not transferred.\n", 
+				 devadr, cmd->lun, cmd->n_blocks);
+		mscunit->command = 0x00U;
+		mscunit->lba = 0U;
+		mscunit->n_blocks = 0U;
+		usbmsc_uas_put_cmd(uas, cmd);
+		break;
+	case USB_UAS_IU_RESPONSE:
+		if (len >= sizeof iu.response)
+			usbmsc_uas_response(uas, cmd,
+					    iu.response.bResponseCode);
+		usbmsc_uas_put_cmd(uas, cmd);
+		break;
+	default:
+		break;
+	}
+
+copyback:
+	usbmsc_copy_buffer(gub, hub, urb->actlen);
+}
+
+/* BULK OUT pre-hook for the command and data-out pipes */
+static int
+usbmsc_uas_outbuf(struct usb_host *usbhc, struct usb_request_block *urb,
+		  struct usbmsc_device *mscdev, int pipe)
+{
+	struct usb_buffer_list *gub, *hub, *ub;
+	struct usbmsc_uas_cmd *cmd;
+	struct usbmsc_unit *mscunit;
+	size_t length;
+	u8 devadr;
+	int ret;
+
+	if (pipe == USBMSC_UAS_PIPE_CMD)
+		return usbmsc_uas_command(usbhc, urb, mscdev);
+	if (pipe != USBMSC_UAS_PIPE_DATAOUT)
+		return USB_HOOK_DISCARD;
+
+	devadr = urb->address;
+	gub = urb->shadow->buffers;
+	hub = urb->buffers;
+	if (!gub || !hub)
+		return USB_HOOK_PASS;
+	cmd = mscdev->uas->dataout;
+	if (!cmd) {
+		dprintft(0, "MSCD(%02x: ): WARNING: "
+			 "OUT data dropped without WRITE READY.\n", devadr);
+		return USB_HOOK_DISCARD;
+	}
+	length = 0;
+	for (ub = gub; ub; ub = ub->next)
+		length += ub->len;
+	mscunit = usbmsc_uas_load(mscdev, cmd, length);
+	ret = usbmsc_shadow_data(devadr, mscdev, mscunit, hub, gub);
+	usbmsc_uas_save(cmd, mscunit);
+	return ret;
+}
+
+/* BULK IN post-hook for the status and data-in pipes */
+static int
+usbmsc_uas_copyback(struct usb_request_block *urb,
+		    struct usbmsc_device *mscdev, int pipe)
 {
-	switch (usbhc->type) {
-	case USB_HOST_TYPE_UHCI:
-		usbmsc_outbuf_halt_uhci (usbhc, urb, mscdev, mscunit,
-					 usbhc->private);
-		break;
-	case USB_HOST_TYPE_EHCI:
-		usbmsc_outbuf_halt_ehci (usbhc, urb, mscdev, mscunit,
-					 usbhc->private);
-		break;
+	struct usbmsc_uas_cmd *cmd;
+	struct usbmsc_unit *mscunit;
+	u8 devadr;
+
+	if (pipe == USBMSC_UAS_PIPE_STATUS) {
+		usbmsc_uas_status(urb, mscdev);
+		return USB_HOOK_PASS;
+	}
+	if (pipe != USBMSC_UAS_PIPE_DATAIN)
+		return USB_HOOK_DISCARD;
+
+	devadr = urb->address;
+	cmd = mscdev->uas->datain;
+	if (!cmd) {
+		dprintft(0, "MSCD(%02x: ): WARNING: "
+			 "%d bytes IN data dropped without READ READY.\n",
+			 devadr, urb->actlen);
+		return USB_HOOK_PASS;
 	}
+	mscunit = usbmsc_uas_load(mscdev, cmd, urb->actlen);
+	usbmsc_copyback_data(urb, devadr, mscdev, mscunit,
+			     urb->buffers, urb->shadow->buffers);
+	usbmsc_uas_save(cmd, mscunit);
+	return USB_HOOK_PASS;
 }
 
 static int
 usbmsc_shadow_outbuf(struct usb_host *usbhc, 
 		     struct usb_request_block *urb, void *arg)
 {
-	struct usb_buffer_list *gub, *hub;
+	struct usb_buffer_list *gub, *hub, *ub;
+	struct usb_msc_cbw cbw;
 	u8 devadr;
 	struct usb_device *dev;
 	struct usbmsc_device *mscdev;
 	struct usbmsc_unit *mscunit;
-	int n_blocks;
+	size_t len;
+	int ret, pipe;
 
 	devadr = urb->address;
 	dev = urb->dev;
@@ -457,38 +1026,37 @@ usbmsc_shadow_outbuf(struct usb_host *usbhc,
 	}
 
 	spinlock_lock(&mscdev->lock);
+	pipe = usbmsc_uas_pipe(dev, mscdev, (u8)(ulong)arg);
+	if (pipe >= 0) {
+		ret = usbmsc_uas_outbuf(usbhc, urb, mscdev, pipe);
+		spinlock_unlock(&mscdev->lock);
+		return ret;
+	}
 	mscunit = mscdev->unit[mscdev->lun];
 	gub = urb->shadow->buffers;
 	hub = urb->buffers;
 
-	/* the 1st buffer may be a CBW */
-	if (gub && (gub->len == sizeof(struct usb_msc_cbw))) {
-		virt_t vadr;
-
-		/* map a guest buffer into the vm area */
-		vadr = (virt_t)mapmem_gphys(gub->padr, gub->len, 0);
-		ASSERT(vadr);
+	/* the 1st buffers may be a CBW, split at a page boundary */
+	len = 0;
+	for (ub = gub; ub && len < sizeof cbw; ub = ub->next)
+		len += ub->len;
+	if (gub && len == sizeof cbw) {
+		/* copy the cbw into a shadow */
+		usbmsc_copy_buffer(hub, gub, sizeof cbw);
+		usbmsc_gather_buffer(&cbw, hub, sizeof cbw);
 
 		/* double check */
-		if (memcmp((char *)vadr, "USBC", 4) != 0) {
-			unmapmem((void *)vadr, gub->len);
+		if (memcmp(&cbw, "USBC", 4) != 0)
 			goto shadow_data;
-		}
-
-		/* copy the cbw into a shadow */
-		memcpy((void *)hub->vadr, (void *)vadr, 
-		       sizeof(struct usb_msc_cbw));
 
 		/* parse the cbw */
-		usbmsc_cbw_parser(devadr, mscdev, 
-				  (struct usb_msc_cbw *)hub->vadr);
-		
-		/* unmap th guest buffer */
-		unmapmem((void *)vadr, gub->len);
+		usbmsc_cbw_parser(devadr, mscdev, &cbw);
+		mscunit = mscdev->unit[mscdev->lun];
 
 		/* walk to the next */
-		gub = gub->next;
-		hub = hub->next;
+		for (len = 0; len < sizeof cbw;
+		     gub = gub->next, hub = hub->next)
+			len += gub->len;
 
 		switch (mscunit->command) {
 		case 0xA2:      /* SECURITY PROTOCOL IN */
@@ -509,53 +1077,9 @@ usbmsc_shadow_outbuf(struct usb_host *usbhc,
 	}
 
 shadow_data:
-	switch (mscunit->command) {
-	case 0x2a: /* WRITE(10) */
-	case 0xaa: /* WRITE(12) */
-		/* encode buffers */
-		n_blocks = usbmsc_code_buffers(mscdev, hub, gub, USB_PID_OUT,
-					       mscunit->length, STORAGE_WRITE);
-
-		if (mscunit->n_blocks < n_blocks) {
-			dprintft(0, "MSCD(%02x:%d): WARNING: "
-				 "over %d block(s) wrote.\n", devadr,
-				 mscdev->lun,
-				 n_blocks - mscunit->n_blocks);
-			n_blocks = mscunit->n_blocks;
-		}
-
-		mscunit->length -= 
-			mscunit->storage_sector_size * n_blocks;
-		mscunit->n_blocks -= n_blocks;
-		mscunit->lba += n_blocks;
-
-		spinlock_unlock(&mscdev->lock);
-		return USB_HOOK_PASS;
-
-	case 0xb6: /* SET STREAMING (For Vista CD format) */
-	case 0x55: /* MODE SELECT (For setting the device param to CD ) */
-	case 0x5d: /* SEND CUE SHEET (For writing CD as DAO )*/
-	case 0x04: /* FORMAT UNIT (For formatting CD as the packet writing ) */
-	case 0x1b: /* START/STOP UNIT */
-	case 0xff: /* vendor specific, especially for HIBUN-LE */
-		/* pass though */
-		usbmsc_copy_buffer(hub, gub, mscunit->length);
-		mscunit->length = 0;
-		spinlock_unlock(&mscdev->lock);
-		return USB_HOOK_PASS;
-	default:
-		dprintft(0, "MSCD(%02x:%d): WARNING: "
-			 "%d bytes OUT data dropped "
-			 "because of unknown command(%02x).\n",
-			 devadr, mscdev->lun,
-			 mscunit->length, mscunit->command);
-		mscunit->length = 0;
-		break;
-	}
-	
-	/* unknown transfer should be denied */
+	ret = usbmsc_shadow_data(devadr, mscdev, mscunit, hub, gub);
 	spinlock_unlock(&mscdev->lock);
-	return USB_HOOK_DISCARD;
+	return ret;
 }
 
 /***
@@ -626,11 +1150,12 @@ usbmsc_copyback_shadow(struct usb_host *usbhc,
 		       struct usb_request_block *urb, void *arg)
 {
 	struct usb_buffer_list *gub, *hub;
+	struct usb_msc_csw csw;
 	u8 devadr;
 	struct usb_device *dev;
 	struct usbmsc_device *mscdev;
 	struct usbmsc_unit *mscunit;
-	int i, ret, n_blocks;
+	int ret, pipe;
 
 	devadr = urb->address;
 	dev = urb->dev;
@@ -651,13 +1176,20 @@ usbmsc_copyback_shadow(struct usb_host *usbhc,
 		return USB_HOOK_PASS;
 
 	spinlock_lock(&mscdev->lock);
+	pipe = usbmsc_uas_pipe(dev, mscdev, (u8)(ulong)arg);
+	if (pipe >= 0) {
+		ret = usbmsc_uas_copyback(urb, mscdev, pipe);
+		spinlock_unlock(&mscdev->lock);
+		return ret;
+	}
 	mscunit = mscdev->unit[mscdev->lun];
 
-	/* The extra buffer may be a CSW */
-	if (memcmp((void *)hub->vadr, "USBS", 4) == 0) {
+	/* The extra buffers may be a CSW, split at a page boundary */
+	if (usbmsc_gather_buffer(&csw, hub, sizeof csw) >= 4 &&
+	    memcmp(&csw, "USBS", 4) == 0) {
 
 		/* double check */
-		if (urb->actlen != sizeof(struct usb_msc_csw))
+		if (urb->actlen != sizeof csw)
 			goto copyback_data;
 
 		if (mscunit->length > 0)
@@ -666,24 +1198,20 @@ usbmsc_copyback_shadow(struct usb_host *usbhc,
 				 devadr, mscdev->lun, mscunit->length);
 
 		/* extract command status */
-		ret = usbmsc_csw_parser(devadr, mscdev, 
-					(struct usb_msc_csw *)hub->vadr);
+		ret = usbmsc_csw_parser(devadr, mscdev, &csw);
+		if (ret == 0 && mscunit->failed) {
+			dprintft(0, "MSCD(%02x:%d): %08x: "
+				 "storage handler failed\n",
+				 devadr, mscdev->lun, mscdev->tag);
+			ret = 0x01; /* Command Failed */
+			csw.bCSWStatus = ret;
+			usbmsc_scatter_buffer(hub, &csw, sizeof csw);
+		}
+		mscunit->failed = false;
 
 		/* undo parameters, maybe wrong, if command failed */
-		if (ret) {
-			switch (mscunit->command) {
-			case 0x25: /* READ CAPACITY(10) */
-				mscunit->lba_max = 0;
-				ASSERT(mscunit->storage != NULL);
-				mscunit->storage_sector_size = 0;
-				break;
-			case 0x46: /* GET CONFIGURATION */
-				mscunit->profile = USBMSC_PROF_NOPROF;
-				break;
-			default:
-				break;
-			}
-		}
+		if (ret)
+			usbmsc_command_failed(mscunit);
 
 		/* reset the state */
 		mscunit->command = 0x00U;
@@ -695,132 +1223,16 @@ usbmsc_copyback_shadow(struct usb_host *usbhc,
 		mscunit->n_blocks = 0U;
 
 		/* copyback */
-		usbmsc_copy_buffer(gub, hub, hub->len);
-
-		ASSERT(gub->next == NULL);
-		ASSERT(hub->next == NULL);
+		usbmsc_copy_buffer(gub, hub, sizeof csw);
 	} else {
 	copyback_data:
-		switch (mscunit->command) {
-		case 0x46: /* GET CONFIGURATION */
-		{
-			u16 cur_prf = bswap16(*(u16 *)(hub->vadr + 6));
-			if ( cur_prf != USBMSC_PROF_NOPROF ) {
-				mscunit->profile = cur_prf;
-			}
-		}
-		/* through */
-		case 0x03: /* REQUEST SENSE */
-		case 0x12: /* INQUIRY */
-		case 0x1a: /* MOSE SENSE(6) */
-		case 0x23: /* READ FORMAT CAPACITIES */
-		case 0x3c: /* READ BUFFER */
-		case 0x4a: /* GET EVENT/STATUS NOTIFICATION */
-		case 0x42: /* READ SUBCHANNEL */
-		case 0x43: /* READ TOC/PMA/ATIP */
-		case 0x51: /* READ DISC INFORMATION */
-		case 0x52: /* READ TRACK INFORMATION */
-		case 0x5a: /* MODE SENSE(10) */
-		case 0x5c: /* READ BUFFER CAPACITY */
- 		case 0xa4: /* REPORT KEY */
- 		case 0xac: /* GET PERFORMANCE */
-		case 0xad: /* READ DISC STRUCTURE */
-		case 0xb9: /* READ CD MSF */
-		case 0xbe: /* READ CD */
-			dprintft(2, "MSCD(%02x:%d):           [",
-				 devadr, mscdev->lun);
-			for (i = 0; i < urb->actlen; i++)
-				dprintf(2, "%02x", *(u8 *)(hub->vadr + i));
-			dprintf(2, "]\n");
-		case 0x06: /* vendor specific, especially for HIBUN-LE */
-		case 0xd4: /* vendor specific, especially for HIBUN-LE */
-		case 0xd5: /* vendor specific, especially for HIBUN-LE */
-		case 0xd8: /* vendor specific, especially for HIBUN-LE */
-		case 0xd9: /* vendor specific, especially for HIBUN-LE */
-		case 0xff: /* vendor specific, especially for HIBUN-LE */
- 			usbmsc_copy_buffer(gub, hub, mscunit->length);
- 			mscunit->length = 0;
-			break;
-		case 0x25: /* READ CAPABILITY(10) */
-			mscunit->lba_max = bswap32(*(u32 *)hub->vadr);
-			ASSERT(mscunit->storage != NULL);
-			mscunit->storage_sector_size = 
-				bswap32(*(u32 *)(hub->vadr + 4));
-			dprintft(2, "MSCD(%02x:%d):           "
-				 "[LBAMAX=%08x, BLKLEN=%08x]\n",
-				 devadr, mscdev->lun, mscunit->lba_max, 
-				 mscunit->storage_sector_size);
-			usbmsc_copy_buffer(gub, hub, mscunit->length);
-			mscunit->length = 0;
-			break;
-		case 0x28: /* READ(10) */
-		case 0xa8: /* READ(12) */
-			/* DATA */
-			n_blocks = usbmsc_code_buffers(mscdev, gub, hub, 
-						       USB_PID_IN, 
-						       urb->actlen,
-						       STORAGE_READ);
-
-			if (mscunit->n_blocks < n_blocks) {
-				dprintft(0, "MSCD(%02x:%d): WARNING: "
-					 "over %d block(s) read.\n",
-					 devadr, mscdev->lun,
-					 n_blocks - mscunit->n_blocks);
-				n_blocks = mscunit->n_blocks;
-			}
-
-			mscunit->length -= 
-				mscunit->storage_sector_size * n_blocks;
-			mscunit->n_blocks -= n_blocks;
-			mscunit->lba += n_blocks;
-
-			break;
-		default:
-			dprintft(0, "MSCD(%02x:%d): WARNING: "
-				 "%d bytes IN data dropped "
-				 "because of unknown command(%02x).\n",
-				 devadr, mscdev->lun,
-				 mscunit->length, mscunit->command);
-			mscunit->length = 0;
-			break;
-		}
+		usbmsc_copyback_data(urb, devadr, mscdev, mscunit, hub, gub);
 	}
 			
 	spinlock_unlock(&mscdev->lock);
 	return USB_HOOK_PASS;
 }
 
-static inline struct usbmsc_unit *
-usbmsc_create_unit(struct usb_host *usbhc, struct usb_device *dev)
-{
-	struct usbmsc_unit *mscunit;
-	unsigned int usb_host_id, usb_device_id;
-	u64 hostport;
-	char usb_vendor_id[5], usb_product_id[5];
-	struct storage_extend usb_extend[] = {
-		{ "usb_vendor_id", usb_vendor_id },
-		{ "usb_product_id", usb_product_id },
-		{ NULL, NULL }
-	};
-
-	mscunit = zalloc_usbmsc_unit();
-	usb_host_id = usbhc->host_id;
-	hostport = dev->portno;
-	while (hostport > USB_PORT_MASK)
-		hostport >>= USB_HUB_SHIFT;
-	usb_device_id = (unsigned int)hostport;
-	snprintf (usb_vendor_id, sizeof usb_vendor_id, "%04x",
-		  dev->descriptor.idVendor);
-	snprintf (usb_product_id, sizeof usb_product_id, "%04x",
-		  dev->descriptor.idProduct);
-	mscunit->storage =
-		storage_new(STORAGE_TYPE_USB, usb_host_id,
-		    usb_device_id, NULL, usb_extend);
-	ASSERT(mscunit->storage != NULL);
-
-	return mscunit;
-}
-
 static void
 usbmsc_remove_unit (struct usbmsc_unit *mscunit)
 {
@@ -871,6 +1283,34 @@ usbmsc_getmaxlun(struct usb_host *usbhc,
 	return USB_HOOK_PASS;
 }
 
+/* SetInterface() resets the interface.  the device forgets the UAS
+   commands in flight even if the setting does not change. */
+static int
+usbmsc_setinterface(struct usb_host *usbhc,
+		    struct usb_request_block *urb, void *arg)
+{
+	struct usb_device *dev;
+	struct usbmsc_device *mscdev;
+	struct usbmsc_uas *uas;
+
+	dev = urb->dev;
+	if (!dev || !dev->handle)
+		return USB_HOOK_PASS;
+	mscdev = (struct usbmsc_device *)dev->handle->private_data;
+	if (!mscdev || !mscdev->uas)
+		return USB_HOOK_PASS;
+	uas = mscdev->uas;
+	if (get_wIndex_from_setup(urb->shadow->buffers) != uas->ifnum)
+		return USB_HOOK_PASS;
+
+	spinlock_lock(&mscdev->lock);
+	memset(uas->cmd, 0, sizeof uas->cmd);
+	uas->datain = uas->dataout = NULL;
+	spinlock_unlock(&mscdev->lock);
+
+	return USB_HOOK_PASS;
+}
+
 static void
 usbmsc_remove(struct usb_device *dev)
 {
@@ -885,6 +1325,8 @@ usbmsc_remove(struct usb_device *dev)
 	for (i = 0; i <= USBMSC_LUN_MAX; i++)
 		if (mscdev->unit[i])
 			usbmsc_remove_unit (mscdev->unit[i]);
+	if (mscdev->uas)
+		free(mscdev->uas);
 	free(dev->handle->private_data);
 	free(dev->handle);
 	dev->handle = NULL;
@@ -905,18 +1347,134 @@ static const unsigned char subcls2str[0x07][32] = {
 	"SCSI Transparent"
 };
 
+/* endpoint-0 is prepended to the endpoints of the first interface
+   descriptor only */
+static struct usb_endpoint_descriptor *
+usbmsc_iface_endpoints(struct usb_device *dev,
+		       struct usb_interface_descriptor *iface)
+{
+	if (iface == dev->config->interface->altsetting)
+		return iface->endpoint + 1;
+	return iface->endpoint;
+}
+
+/* find pipes of a UAS interface by the Pipe Usage descriptors */
+static struct usbmsc_uas *
+usbmsc_uas_new(struct usb_device *dev, struct usb_interface_descriptor *iface)
+{
+	struct usbmsc_uas *uas;
+	struct usb_endpoint_descriptor *epdesc;
+	unsigned char *p;
+	int i, j;
+
+	uas = alloc(sizeof *uas);
+	memset(uas, 0, sizeof *uas);
+	uas->ifnum = iface->bInterfaceNumber;
+	uas->alt = iface->bAlternateSetting;
+	epdesc = usbmsc_iface_endpoints(dev, iface);
+	for (i = 0; i < iface->bNumEndpoints; i++) {
+		p = epdesc[i].extra;
+		for (j = 0; p && j + 3 <= epdesc[i].extralen && p[j];
+		     j += p[j]) {
+			if (p[j + 1] != USB_DT_UAS_PIPE_USAGE ||
+			    p[j + 2] < USB_UAS_PIPE_ID_CMD ||
+			    p[j + 2] > USB_UAS_PIPE_ID_DATAOUT)
+				continue;
+			uas->pipe[p[j + 2] - USB_UAS_PIPE_ID_CMD] =
+				epdesc[i].bEndpointAddress;
+		}
+	}
+
+	/* fall back on the order of the endpoint descriptors */
+	for (i = 0; i < USBMSC_UAS_PIPE_NUM; i++)
+		if (!uas->pipe[i])
+			break;
+	if (i < USBMSC_UAS_PIPE_NUM) {
+		dprintft(1, "MSCD(%02x: ): no Pipe Usage descriptors\n",
+			 dev->devnum);
+		for (i = 0; i < USBMSC_UAS_PIPE_NUM; i++)
+			uas->pipe[i] = epdesc[i].bEndpointAddress;
+	}
+	for (i = 0; i < USBMSC_UAS_PIPE_NUM; i++)
+		dprintft(1, "MSCD(%02x: ): UAS pipe %d: endpoint %02x\n",
+			 dev->devnum, i, uas->pipe[i]);
+	return uas;
+}
+
+/* register hooks for bulk endpoints of an interface.  an endpoint
+   shared by the Bulk-only and UAS interfaces is hooked only once */
+static void
+usbmsc_register_bulk(struct usb_host *usbhc, struct usb_device *dev,
+		     u8 devadr, struct usb_interface_descriptor *iface,
+		     u8 *hooked, int *n_hooked)
+{
+	struct usb_endpoint_descriptor *epdesc;
+	u8 epadr, type;
+	int i, j;
+
+	epdesc = usbmsc_iface_endpoints(dev, iface);
+	for (i = 0; i < iface->bNumEndpoints; i++) {
+		type = epdesc[i].bmAttributes & USB_ENDPOINT_TYPE_MASK;
+			
+		if (type != USB_ENDPOINT_TYPE_BULK)
+			continue;
+
+		epadr = epdesc[i].bEndpointAddress;
+		for (j = 0; j < *n_hooked; j++)
+			if (hooked[j] == epadr)
+				break;
+		if (j < *n_hooked)
+			continue;
+		hooked[(*n_hooked)++] = epadr;
+
+		if (epadr & USB_ENDPOINT_IN) {
+			/* register a hook for BULK IN transfers */
+			spinlock_lock(&usbhc->lock_hk);
+			usb_hook_register(usbhc, USB_HOOK_REQUEST,
+					  USB_HOOK_MATCH_DEV |
+					  USB_HOOK_MATCH_ENDP,
+					  devadr, epadr,
+					  NULL,
+					  usbmsc_shadow_inbuf,
+					  (void *)(ulong)epadr, dev);
+			usb_hook_register(usbhc, USB_HOOK_REPLY,
+					  USB_HOOK_MATCH_DEV |
+					  USB_HOOK_MATCH_ENDP,
+					  devadr, epadr,
+					  NULL,
+					  usbmsc_copyback_shadow,
+					  (void *)(ulong)epadr, 
+					  dev);
+			spinlock_unlock(&usbhc->lock_hk);
+		} else {
+			/* register a hook for BULK OUT transfers */
+			spinlock_lock(&usbhc->lock_hk);
+			usb_hook_register(usbhc, USB_HOOK_REQUEST,
+					  USB_HOOK_MATCH_DEV |
+					  USB_HOOK_MATCH_ENDP,
+					  devadr, epadr,
+					  NULL,
+					  usbmsc_shadow_outbuf,
+					  (void *)(ulong)epadr,
+					  dev);
+			spinlock_unlock(&usbhc->lock_hk);
+		}
+	}
+}
+
 static int 
 usbmsc_init_bulkmon(struct usb_host *usbhc, 
 		    struct usb_request_block *urb, void *arg)
 {
 	struct usb_device *dev;
-	struct usb_endpoint_descriptor *epdesc;
 	struct usbmsc_device *mscdev;
 	struct usb_device_handle *handler;
-	u8 devadr, type, cls, subcls, proto;
-	int i, j;
+	u8 devadr, cls, subcls, proto;
+	u8 hooked[32];		/* 16 IN and 16 OUT endpoints */
+	int j, n_hooked;
 	int ret;
 	struct usb_interface_descriptor *iface = NULL;
+	struct usb_interface_descriptor *bot = NULL, *uas = NULL;
 	static const struct usb_hook_pattern pat_getmaxlun = {
 		.pid = USB_PID_SETUP,
 		.mask = 0x000000000000ffffULL,
@@ -924,6 +1482,13 @@ usbmsc_init_bulkmon(struct usb_host *usbhc,
 		.offset = 0,
 		.next = NULL
 	};
+	static const struct usb_hook_pattern pat_setinf = {
+		.pid = USB_PID_SETUP,
+		.mask = 0x000000000000ffffULL,
+		.pattern = 0x0000000000000B01ULL,
+		.offset = 0,
+		.next = NULL
+	};
 
 	devadr = urb->address;
 	dev = urb->dev;
@@ -936,7 +1501,7 @@ usbmsc_init_bulkmon(struct usb_host *usbhc,
 		return USB_HOOK_PASS;
 	}
 	
-	/* search for a interface that we can use on this device */
+	/* search for interfaces that we can use on this device */
 	ret  = USB_HOOK_PASS;
 	for (j = 0; j < dev->config->interface->num_altsetting; j++) {
 		iface = dev->config->interface->altsetting + j;
@@ -968,12 +1533,23 @@ usbmsc_init_bulkmon(struct usb_host *usbhc,
 		case 0x50:
 			dprintf(1, "Bulk-only");
 			break;
+		case 0x62:
+			dprintf(1, "UAS");
+			break;
 		default:
 			dprintf(1, "0x%02x", proto);
 			break;
 		}
 		dprintf(1, " transfer protocol\n");
 
+		/* UAS with SCSI transparent command set */
+		if ((proto == 0x62) && (subcls == 0x06) &&
+		    (iface->bNumEndpoints >= USBMSC_UAS_PIPE_NUM)) {
+			if (!uas)
+				uas = iface;
+			continue;
+		}
+
 		/* SCSI transparent command set and SFF-8020i are supported */
 		if ((proto != 0x50) ||			  /* Bulk only */
 		    ((subcls != 0x06) && (subcls != 0x02) &&  /* 8020 & SCSI */
@@ -981,17 +1557,17 @@ usbmsc_init_bulkmon(struct usb_host *usbhc,
 			ret = USB_HOOK_DISCARD;
 			continue;
 		}
-	
-		if (dev->handle) {
-			dprintft(1, "MSCD(%02x: ): maybe reset.\n",  devadr);
-			continue;
-		}
-		break;
+		if (!bot)
+			bot = iface;
 	}
 
 	/* exit if no suitable interfaces were found */
-	if (j == dev->config->interface->num_altsetting)
+	if (!bot && !uas)
+		return ret;
+	if (dev->handle) {
+		dprintft(1, "MSCD(%02x: ): maybe reset.\n",  devadr);
 		return ret;
+	}
 
 	/* create msc device entry */
 	mscdev = zalloc_usbmsc_device();
@@ -999,6 +1575,8 @@ usbmsc_init_bulkmon(struct usb_host *usbhc,
 	spinlock_lock(&mscdev->lock);
 	
 	mscdev->unit[0] = usbmsc_create_unit(usbhc, dev);
+	if (uas)
+		mscdev->uas = usbmsc_uas_new(dev, uas);
 
 	handler = usb_new_dev_handle (usbhc, dev);
 	handler->remove = usbmsc_remove;
@@ -1014,52 +1592,21 @@ usbmsc_init_bulkmon(struct usb_host *usbhc,
 			  USB_HOOK_MATCH_ENDP | USB_HOOK_MATCH_DATA,
 			  devadr, 0, &pat_getmaxlun,
 			  usbmsc_getmaxlun, NULL, dev);
+	/* and one for SetInterface if UAS is there */
+	if (uas)
+		usb_hook_register(usbhc, USB_HOOK_REPLY,
+				  USB_HOOK_MATCH_DEV |
+				  USB_HOOK_MATCH_ENDP | USB_HOOK_MATCH_DATA,
+				  devadr, 0, &pat_setinf,
+				  usbmsc_setinterface, NULL, dev);
 	spinlock_unlock(&usbhc->lock_hk);
 
-	/* register a hook for BULK IN transfers */
-	for (i = 1; i <= iface->bNumEndpoints; i++) {
-		epdesc = &iface->endpoint[i];
-		type = epdesc->bmAttributes & USB_ENDPOINT_TYPE_MASK;
-			
-		if (type != USB_ENDPOINT_TYPE_BULK)
-			continue;
-
-		if (epdesc->bEndpointAddress & USB_ENDPOINT_IN) {
-			/* register a hook for BULK IN transfers */
-			spinlock_lock(&usbhc->lock_hk);
-			usb_hook_register(usbhc, USB_HOOK_REQUEST,
-					  USB_HOOK_MATCH_DEV |
-					  USB_HOOK_MATCH_ENDP,
-					  devadr, 
-					  epdesc->bEndpointAddress,
-					  NULL,
-					  usbmsc_shadow_inbuf,
-					  NULL, dev);
-			usb_hook_register(usbhc, USB_HOOK_REPLY,
-					  USB_HOOK_MATCH_DEV |
-					  USB_HOOK_MATCH_ENDP,
-					  devadr, 
-					  epdesc->bEndpointAddress,
-					  NULL,
-					  usbmsc_copyback_shadow,
-					  NULL, 
-					  dev);
-			spinlock_unlock(&usbhc->lock_hk);
-		} else {
-			/* register a hook for BULK OUT transfers */
-			spinlock_lock(&usbhc->lock_hk);
-			usb_hook_register(usbhc, USB_HOOK_REQUEST,
-					  USB_HOOK_MATCH_DEV |
-					  USB_HOOK_MATCH_ENDP,
-					  devadr, 
-					  epdesc->bEndpointAddress,
-					  NULL,
-					  usbmsc_shadow_outbuf,
-					  NULL,
-					  dev);
-			spinlock_unlock(&usbhc->lock_hk);
-		}
-	}
+	/* register hooks for BULK transfers */
+	n_hooked = 0;
+	if (bot)
+		usbmsc_register_bulk(usbhc, dev, devadr, bot, hooked, &n_hooked);
+	if (uas)
+		usbmsc_register_bulk(usbhc, dev, devadr, uas, hooked, &n_hooked);
 
 	return USB_HOOK_PASS;
 }
@@ -33,12 +33,45 @@
 
 #define USBMSC_LUN_MAX		15
 
+/* USB Attached SCSI (UAS) */
+#define USBMSC_UAS_TAG_MAX	64
+#define USBMSC_UAS_PIPE_CMD	0
+#define USBMSC_UAS_PIPE_STATUS	1
+#define USBMSC_UAS_PIPE_DATAIN	2
+#define USBMSC_UAS_PIPE_DATAOUT	3
+#define USBMSC_UAS_PIPE_NUM	4
+
+struct usbmsc_uas_cmd {
+	bool       used;
+	u16        tag;
+	u8         lun;
+	u8         command;
+	u32        n_blocks;
+	u32        lba;
+	size_t     length;
+	u32        seq;
+	bool       failed;	/* the storage handler failed */
+	u8         function;	/* of a task management IU */
+	u16        task;	/* the tag the function manages */
+};
+
+struct usbmsc_uas {
+	u8         ifnum;
+	u8         alt;
+	bool       active;
+	u8         pipe[USBMSC_UAS_PIPE_NUM]; /* endpoint addresses */
+	struct usbmsc_uas_cmd *datain, *dataout; /* READ/WRITE READY */
+	u32        seq;
+	struct usbmsc_uas_cmd cmd[USBMSC_UAS_TAG_MAX];
+};
+
 struct usbmsc_device {
 	spinlock_t lock;
 	u32        tag;
 	u8	   lun_max;
 	u8	   lun;
 	struct usbmsc_unit *unit[USBMSC_LUN_MAX + 1];
+	struct usbmsc_uas *uas;	/* NULL unless a UAS interface exists */
 };
 
 struct usbmsc_unit {
@@ -50,6 +83,7 @@ struct usbmsc_unit {
 	size_t     length;
 	struct storage_device *storage;
 	int        storage_sector_size;
+	bool       failed;	/* the storage handler failed */
 };
 
 #define SCSI_OPID_MAX 0xc0
@@ -274,6 +308,67 @@ struct usb_msc_csw {
 	u8  bCSWStatus;
 } __attribute__ ((packed));
 
+/* UAS information units (all fields are big endian) */
+#define USB_UAS_IU_COMMAND	0x01
+#define USB_UAS_IU_SENSE	0x03
+#define USB_UAS_IU_RESPONSE	0x04
+#define USB_UAS_IU_TASK_MGMT	0x05
+#define USB_UAS_IU_READ_READY	0x06
+#define USB_UAS_IU_WRITE_READY	0x07
+
+struct usb_uas_iu_header {
+	u8  bIUID;
+	u8  reserved;
+	u16 wTag;
+} __attribute__ ((packed));
+
+struct usb_uas_command_iu {
+	u8  bIUID;
+	u8  reserved1;
+	u16 wTag;
+	u8  bPrioAttr;
+	u8  reserved5;
+	u8  bAddCDBLength;	/* bits 7:2 in dwords */
+	u8  reserved7;
+	u8  LUN[8];
+	u8  CDB[16];
+} __attribute__ ((packed));
+
+struct usb_uas_task_mgmt_iu {
+	u8  bIUID;
+	u8  reserved1;
+	u16 wTag;
+	u8  bFunction;
+	u8  reserved5;
+	u16 wTaskTag;
+	u8  LUN[8];
+} __attribute__ ((packed));
+
+struct usb_uas_sense_iu {
+	u8  bIUID;
+	u8  reserved1;
+	u16 wTag;
+	u16 wStatusQualifier;
+	u8  bStatus;
+	u8  reserved7[7];
+	u16 wLength;
+} __attribute__ ((packed));
+
+struct usb_uas_response_iu {
+	u8  bIUID;
+	u8  reserved1;
+	u16 wTag;
+	u8  bAddResponseInfo[3];
+	u8  bResponseCode;
+} __attribute__ ((packed));
+
+/* Pipe Usage class-specific endpoint descriptor */
+#define USB_DT_UAS_PIPE_USAGE	0x24
+#define USB_UAS_PIPE_ID_CMD	0x01
+#define USB_UAS_PIPE_ID_STATUS	0x02
+#define USB_UAS_PIPE_ID_DATAIN	0x03
+#define USB_UAS_PIPE_ID_DATAOUT	0x04
+
 
 /* media profile name */
 #define	USBMSC_PROF_NOPROF	0x0000
@@ -251,7 +251,8 @@ vga_intel_is_ready (struct vga_func_data *data)
 	if (data->vram_mapped_len > data->vram_len - off)
 		data->vram_mapped_len = data->vram_len - off;
 	data->vram = mapmem_gphys (data->vram_base + off,
-				   data->vram_mapped_len, MAPMEM_WRITE);
+				   data->vram_mapped_len,
+				   MAPMEM_WRITE | MAPMEM_WC);
 	if (!data->vram)
 		return 0;
 	data->nfence = 0;
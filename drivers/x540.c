@@ -31,8 +31,10 @@
 #include <core.h>
 #include <core/initfunc.h>
 #include <core/mmio.h>
+#include <core/nicpoll.h>
 #include <core/time.h>
-#include <core/tty.h>
+#include <core/timer.h>
+#include <net/netapi.h>
 #include "pci.h"
 
 /******** X540 configuration ********/
@@ -44,10 +46,14 @@ struct x540_config {
 	int bufsize;
 	int num_tdesc;
 	int num_rdesc;
+	int num_txq;
+	int num_rxq;
 
 	int use_flowcontrol;
 	int use_jumboframe;
 	int jumboframe_size;
+
+	int num_vfs;
 };
 
 static const struct x540_config x540_default_config = {
@@ -55,13 +61,27 @@ static const struct x540_config x540_default_config = {
 	.iscontroled = 1,
 	.use_fortty = 1,
 	.bufsize = 2048,
-	.num_tdesc = 256,
-	.num_rdesc = 256,
-	.use_flowcontrol = 0,
+	.num_tdesc = 1024,
+	.num_rdesc = 1024,
+	.num_txq = 4,
+	.num_rxq = 4,
+	.use_flowcontrol = 1,
 	.use_jumboframe = 0,
 	.jumboframe_size = 9000,
+	.num_vfs = 0,
 };
 
+#define X540_MAX_QUEUES		16
+/* queues of a pool in 32 pool mode */
+#define X540_POOL_QUEUES	4
+/* the queues of the physical function, placed after the pools of
+   the virtual functions, must be in the first 64 queues */
+#define X540_MAX_VFS		15
+#define X540_VF_POLL_USEC	(10 * 1000)
+#define X540_MIN_DESC		64
+#define X540_MAX_DESC		8192
+#define X540_RECV_BATCH		16
+
 /* #define DODBG */
 #define LOG(X...) do { printf (X); } while (0)
 #ifdef DODBG
@@ -151,8 +171,29 @@ struct x540_hook_context {
 	u32 baseaddr;
 };
 
+/******** Queues ********/
+struct x540_txq {
+	struct x540 *x540;
+	int index;
+	spinlock_t lock;
+	struct x540_tdesc *ring;
+	phys_t ring_phys;
+	void **buf;
+};
+
+struct x540_rxq {
+	struct x540 *x540;
+	int index;
+	spinlock_t lock;
+	struct x540_rdesc *ring;
+	phys_t ring_phys;
+	void **buf;
+	long *buf_premap;
+};
+
 struct x540 {
 	u8 macaddr[6];
+	u64 link_speed;
 
 	spinlock_t lock;
 
@@ -161,19 +202,29 @@ struct x540 {
 	/* configuration */
 	struct x540_config config;
 
+	/* virtualization.  the physical function uses pool and its
+	   queues start at qbase */
+	struct pci_device *pci;
+	int pool;
+	int qbase;
+	int num_vfs;
+	u32 vf_cts;
+	void *vf_timer;
+
+	/* network API */
+	struct netdata *nethandle;
+	net_recv_callback_t *recv_func;
+	void *recv_param;
+
 	/* transmission */
 	bool xmit_enabled;
-	int num_tdesc;
-	struct x540_tdesc *tdesc_ring;
-	phys_t tdesc_ring_phys;
-	void **tdesc_buf;
+	struct x540_txq txq[X540_MAX_QUEUES];
 
 	/* reception */
 	bool recv_enabled;
-	int num_rdesc;
-	struct x540_rdesc *rdesc_ring;
-	phys_t rdesc_ring_phys;
-	void **rdesc_buf;
+	struct x540_rxq rxq[X540_MAX_QUEUES];
+
+	bool removed;		/* the adapter has been unplugged */
 };
 
 static void
@@ -208,7 +259,9 @@ enum {
 	X540_REG_FCRTL = 0x3220,
 	X540_REG_FCRTH = 0x3260,
 	X540_REG_FCRTV = 0x32A0,
+	X540_REG_RXPBSIZE = 0x3C00,
 	X540_REG_FCCFG = 0x3D00,
+	X540_REG_MFLCN = 0x4294,
 
 	X540_REG_MSCA = 0x425C,
 	X540_REG_LINKS = 0x42A4,
@@ -228,6 +281,7 @@ enum {
 	X540_REG_RDBAL = 0x1000,
 	X540_REG_RDBAH = 0x1004,
 	X540_REG_RDLEN = 0x1008,
+	X540_REG_SRRCTL = 0x1014,
 	X540_REG_RDH = 0x1010,
 	X540_REG_RDT = 0x1018,
 	X540_REG_RXDCTL = 0x1028,
@@ -235,8 +289,90 @@ enum {
 
 	X540_REG_HLREG0 = 0x4240,
 	X540_REG_MAXFRS = 0x4268,
+
+	X540_REG_RXCSUM = 0x5000,
+	X540_REG_MRQC = 0x5818,
+	X540_REG_RETA = 0x5C00,
+	X540_REG_RSSRK = 0x5C80,
+
+	X540_REG_GCR_EXT = 0x11050,
+	X540_REG_RTTDCS = 0x4900,
+	X540_REG_MTQC = 0x8120,
+	X540_REG_PFVTCTL = 0x51B0,
+	X540_REG_VFRE = 0x51E0,
+	X540_REG_VFTE = 0x8110,
+	X540_REG_PFDTXGSWC = 0x8220,
+	X540_REG_PFVFSPOOF = 0x8200,
+	X540_REG_VMOLR = 0xF000,
+	X540_REG_PSRTYPE = 0xEA00,
+	X540_REG_MPSAR_LO = 0xA600,
+	X540_REG_MPSAR_HI = 0xA604,
+	X540_REG_PFMAILBOX = 0x4B00,
+	X540_REG_PFMBMEM = 0x13000,
+	X540_REG_PFMBICR = 0x710,
+	X540_REG_VFLREC = 0x700,
 };
 
+/* per-queue registers of queue 0-63 are 0x40 bytes apart */
+#define X540_QREG(reg, n)	((reg) + (n) * 0x40)
+
+/* flow control */
+#define X540_FCRTH_FCEN		0x80000000
+#define X540_FCRTL_XONE		0x80000000
+#define X540_FCCFG_TFCE_802_3X	0x8
+#define X540_MFLCN_RFCE		0x8
+#define X540_FC_PAUSE_TIME	0xFFFF
+/* room left above the high water mark for frames in flight while the
+   pause frame takes effect at 10Gbps */
+#define X540_FC_HEADROOM	(32 * 1024)
+#define X540_FC_HYSTERESIS	(16 * 1024)
+
+/* multiple receive queues */
+#define X540_SRRCTL_DROP_EN	0x10000000
+#define X540_RXCSUM_PCSD	0x2000
+#define X540_MRQC_RSSEN		0x1
+#define X540_MRQC_TCPIPV4	0x10000
+#define X540_MRQC_IPV4		0x20000
+#define X540_MRQC_IPV6		0x100000
+#define X540_MRQC_TCPIPV6	0x200000
+#define X540_RETA_ENTRIES	128
+#define X540_RSSRK_WORDS	10
+
+/* virtualization */
+#define X540_MRQC_VMDQRSS32	0xA
+#define X540_GCR_EXT_VT_MODE_32	0x2
+#define X540_GCR_EXT_MSIX_EN	0x80000000
+#define X540_RTTDCS_ARBDIS	0x40
+#define X540_MTQC_VT_ENA	0x2
+#define X540_MTQC_32VF		0x8
+#define X540_PFVTCTL_VT_ENA	0x1
+#define X540_PFVTCTL_DEF_PL_SHIFT 7
+#define X540_PFVTCTL_REPLEN	0x40000000
+#define X540_PFDTXGSWC_LBEN	0x1
+#define X540_VMOLR_AUPE		0x01000000
+#define X540_VMOLR_BAM		0x08000000
+#define X540_VMOLR_MPE		0x10000000
+#define X540_PSRTYPE_RQPL_SHIFT	29
+#define X540_RAH_AV		0x80000000
+
+/* PF/VF mailbox */
+#define X540_PFMAILBOX_STS	0x1
+#define X540_PFMAILBOX_ACK	0x2
+#define X540_PFMAILBOX_PFU	0x8
+#define X540_MBX_WORDS		16
+#define X540_VF_RESET		0x01
+#define X540_VF_SET_MAC_ADDR	0x02
+#define X540_VF_SET_MULTICAST	0x03
+#define X540_VF_SET_VLAN	0x04
+#define X540_VF_SET_LPE		0x05
+#define X540_VF_API_NEGOTIATE	0x08
+#define X540_VF_GET_QUEUES	0x09
+#define X540_VT_MSGTYPE_ACK	0x80000000
+#define X540_VT_MSGTYPE_NACK	0x40000000
+#define X540_VT_MSGTYPE_CTS	0x20000000
+#define X540_MBOX_API_10	0
+#define X540_MBOX_API_11	2
+
 enum {
 	X540_RET_OK = 0,
 	X540_RET_ERR = -1,
@@ -326,21 +462,22 @@ x540_phywrite (struct x540 *x540, u16 phyoffset, u16 value)
 
 /******** Transmission functions ********/
 static int
-x540_send_frames (struct x540 *x540, int num_frames, void **frames,
-		  int *frame_sizes, int *error)
+x540_send_frames (struct x540_txq *txq, int num_frames, void **frames,
+		  unsigned int *frame_sizes, int *error)
 {
+	struct x540 *x540 = txq->x540;
 	int i, errstate = 0;
 	u32 head, tail, nt;
 	struct x540_tdesc *tdesc;
 
-	spinlock_lock (&x540->lock);
+	spinlock_lock (&txq->lock);
 	if (!x540->xmit_enabled) {
 		errstate |= X540_RET_XMTDIS;
 		goto end;
 	}
 
-	head = x540_read32 (x540, X540_REG_TDH);
-	tail = x540_read32 (x540, X540_REG_TDT);
+	head = x540_read32 (x540, X540_QREG (X540_REG_TDH, txq->index));
+	tail = x540_read32 (x540, X540_QREG (X540_REG_TDT, txq->index));
 
 	if (head == 0xFFFFFFFF || tail == 0xFFFFFFFF) {
 		errstate |= X540_RET_XMTDIS;
@@ -355,8 +492,7 @@ x540_send_frames (struct x540 *x540, int num_frames, void **frames,
 
 		if (head == nt) {
 			errstate |= X540_RET_XMTFULL;
-			x540_write32 (x540, X540_REG_TDT, tail);
-			goto end;
+			break;
 		}
 
 		if (frame_sizes[i] >= x540->config.bufsize) {
@@ -364,18 +500,19 @@ x540_send_frames (struct x540 *x540, int num_frames, void **frames,
 			continue;
 		}
 
-		memcpy (x540->tdesc_buf[tail], frames[i], frame_sizes[i]);
-		tdesc = &x540->tdesc_ring[tail];
+		memcpy (txq->buf[tail], frames[i], frame_sizes[i]);
+		tdesc = &txq->ring[tail];
 		tdesc->len = frame_sizes[i];
 		tdesc->cmd_eop = 1;
 		tdesc->cmd_ifcs = 1;
 
 		tail = nt;
 	}
-	x540_write32 (x540, X540_REG_TDT, tail);
+	/* one tail update for the whole batch */
+	x540_write32 (x540, X540_QREG (X540_REG_TDT, txq->index), tail);
 
 end:
-	spinlock_unlock (&x540->lock);
+	spinlock_unlock (&txq->lock);
 
 	if (errstate) {
 		if (error)
@@ -386,10 +523,33 @@ end:
 	return X540_RET_OK;
 }
 
+/* keep each flow on one queue so that its frames are not reordered */
+static int
+x540_select_txq (struct x540 *x540, u8 *frame, unsigned int frame_size)
+{
+	u32 hash;
+	int ihl;
+
+	if (x540->config.num_txq == 1)
+		return 0;
+	if (frame_size < 34 || frame[12] != 0x08 || frame[13] != 0x00)
+		return 0;	/* not IPv4 */
+	hash = *(u32 *)&frame[26] ^ *(u32 *)&frame[30];
+	ihl = (frame[14] & 0xF) * 4;
+	if ((frame[23] == 6 || frame[23] == 17) &&
+	    frame_size >= 14 + ihl + 4)
+		hash ^= *(u32 *)&frame[14 + ihl]; /* TCP/UDP ports */
+	hash ^= hash >> 16;
+	hash ^= hash >> 8;
+	return (hash & 0xFF) % x540->config.num_txq;
+}
+
 static void
-x540_alloc_tdesc (struct x540 *x540)
+x540_alloc_tdesc (struct x540_txq *txq)
 {
-	if (x540->tdesc_ring)
+	struct x540 *x540 = txq->x540;
+
+	if (txq->ring)
 		return;
 
 	int i;
@@ -402,55 +562,80 @@ x540_alloc_tdesc (struct x540 *x540)
 	void *vaddr;
 	phys_t paddr;
 
-	DBG ("Make xmit descriptor "
+	DBG ("Make xmit descriptor %d "
 	     "(num_tdesc: %d, "
 	     "tdesc_size: %ld, "
 	     "tdesc_bufsize: %d (%d pages), "
 	     "tdesc_ring_size: %d (%d pages))\n",
-	     num_tdesc,
+	     txq->index, num_tdesc,
 	     sizeof (struct x540_tdesc),
 	     bufsize, num_tdesc_buf_pages,
 	     tdesc_ring_size, num_tdesc_ring_pages);
 
 	alloc_pages (&vaddr, &paddr, num_tdesc_ring_pages);
-	x540->tdesc_ring = vaddr;
-	x540->tdesc_ring_phys = paddr;
-	memset (x540->tdesc_ring, 0, tdesc_ring_size);
+	txq->ring = vaddr;
+	txq->ring_phys = paddr;
+	memset (txq->ring, 0, tdesc_ring_size);
 
-	x540->tdesc_buf = alloc (num_tdesc * sizeof (void *));
+	txq->buf = alloc (num_tdesc * sizeof (void *));
 	for (i = 0; i < num_tdesc; i++) {
 		alloc_pages (&vaddr, &paddr, num_tdesc_buf_pages);
-		x540->tdesc_buf[i] = vaddr;
-		x540->tdesc_ring[i].bufaddr = paddr;
+		txq->buf[i] = vaddr;
+		txq->ring[i].bufaddr = paddr;
 	}
 }
 
 static void
-x540_write_tdesc (struct x540 *x540)
+x540_write_tdesc (struct x540_txq *txq)
 {
+	struct x540 *x540 = txq->x540;
+	int n = txq->index;
 	int num_tdesc = x540->config.num_tdesc;
 	int tdesc_ring_size = num_tdesc * sizeof (struct x540_tdesc);
 
-	DBG ("Writing xmit descriptor ring... "
+	DBG ("Writing xmit descriptor ring %d... "
 	     "(size: %d, header: 0, tail: 0, phys: %llx)\n",
-	     tdesc_ring_size, x540->tdesc_ring_phys);
+	     n, tdesc_ring_size, txq->ring_phys);
 
 	/* write base address */
-	x540_write32 (x540, X540_REG_TDBAL, x540->tdesc_ring_phys);
-	x540_write32 (x540, X540_REG_TDBAH, 0);
+	x540_write32 (x540, X540_QREG (X540_REG_TDBAL, n), txq->ring_phys);
+	x540_write32 (x540, X540_QREG (X540_REG_TDBAH, n),
+		      (u64)txq->ring_phys >> 32);
 
 	/* write header/tail */
-	x540_write32 (x540, X540_REG_TDT, 0);
-	x540_write32 (x540, X540_REG_TDH, 0);
+	x540_write32 (x540, X540_QREG (X540_REG_TDT, n), 0);
+	x540_write32 (x540, X540_QREG (X540_REG_TDH, n), 0);
 
 	/* write size of descriptor ring */
-	x540_write32 (x540, X540_REG_TDLEN, tdesc_ring_size);
+	x540_write32 (x540, X540_QREG (X540_REG_TDLEN, n), tdesc_ring_size);
 }
 
 static int
-x540_setup_xmit (struct x540 *x540)
+x540_enable_txq (struct x540_txq *txq)
 {
+	struct x540 *x540 = txq->x540;
 	int timeout;
+	u32 reg = X540_QREG (X540_REG_TXDCTL, txq->index);
+
+	x540_write32 (x540, reg, x540_read32 (x540, reg) | 1 << 25);
+	timeout = 3 * 1000;
+	while (1) {
+		x540_usleep (1000);
+		if (timeout-- < 0) {
+			LOG ("failed to enable transmission queue %d\n",
+			     txq->index);
+			return X540_RET_ERR;
+		}
+		if (x540_check32 (x540, reg, 1 << 25))
+			break;
+	}
+	return X540_RET_OK;
+}
+
+static int
+x540_setup_xmit (struct x540 *x540)
+{
+	int i;
 	u32 regvalue;
 
 	DBG ("Setting up transmission...\n");
@@ -463,31 +648,20 @@ x540_setup_xmit (struct x540 *x540)
 		x540_write32 (x540, X540_REG_HLREG0, regvalue & ~0x4);
 	}
 
-	if (x540->config.use_flowcontrol) {
-		/* FIXME: do something to enable flow control */
-	} else {
-		/* FIXME: do something to disbale flow control */
-	}
-
 	/* setup descriptors */
-	x540_alloc_tdesc (x540);
-	x540_write_tdesc (x540);
+	for (i = 0; i < x540->config.num_txq; i++) {
+		x540->txq[i].x540 = x540;
+		x540->txq[i].index = x540->qbase + i;
+		x540_alloc_tdesc (&x540->txq[i]);
+		x540_write_tdesc (&x540->txq[i]);
+	}
 
 	/* transmit enable */
 	regvalue = x540_read32 (x540, X540_REG_DMATXCTL);
 	x540_write32 (x540, X540_REG_DMATXCTL, regvalue | 0x1);
-	regvalue = x540_read32 (x540, X540_REG_TXDCTL);
-	x540_write32 (x540, X540_REG_TXDCTL, regvalue | 1 << 25);
-	timeout = 3 * 1000;
-	while (1) {
-		x540_usleep (1000);
-		if (timeout-- < 0) {
-			LOG ("failed to enable transmission\n");
+	for (i = 0; i < x540->config.num_txq; i++)
+		if (x540_enable_txq (&x540->txq[i]) != X540_RET_OK)
 			return X540_RET_ERR;
-		}
-		if (x540_check32 (x540, X540_REG_TXDCTL, 1 << 25))
-			break;
-	}
 	DBG ("Transmission enabled.\n");
 
 	x540->xmit_enabled = true;
@@ -496,30 +670,29 @@ x540_setup_xmit (struct x540 *x540)
 }
 
 /******** Receive functions ********/
-#ifdef DODBG
+/* budget 0 means no limit.  returns the number of descriptors
+   consumed */
 static int
-x540_recv_frames (struct x540 *x540, void (*callback) (int num_frames,
-						       void **frames,
-						       int *frame_sizes,
-						       void *arg),
-		  void *arg, int *error)
+x540_recv_frames (struct x540_rxq *rxq, int budget, int *error)
 {
+	struct x540 *x540 = rxq->x540;
 	u32 head, tail, nt;
-	void *frames[16];
-	int frame_sizes[16];
-	int i = 0, num = 16, errstate = 0;
+	void *frames[X540_RECV_BATCH];
+	unsigned int frame_sizes[X540_RECV_BATCH];
+	long premap[X540_RECV_BATCH];
+	int i = 0, num = X540_RECV_BATCH, count = 0, errstate = 0;
 	struct x540_rdesc *rdesc;
 
-	spinlock_lock (&x540->lock);
+	spinlock_lock (&rxq->lock);
 	if (!x540->recv_enabled) {
 		errstate |= X540_RET_RCVDIS;
 		goto end;
 	}
 
-	head = x540_read32 (x540, X540_REG_RDH);
-	tail = x540_read32 (x540, X540_REG_RDT);
-	if (head < 0 || head > x540->config.num_rdesc ||
-	    tail < 0 || tail > x540->config.num_rdesc) {
+	head = x540_read32 (x540, X540_QREG (X540_REG_RDH, rxq->index));
+	tail = x540_read32 (x540, X540_QREG (X540_REG_RDT, rxq->index));
+	if (head >= x540->config.num_rdesc ||
+	    tail >= x540->config.num_rdesc) {
 		errstate |= X540_RET_RCVDIS;
 		LOG ("Out of range (header: %d, tail:%d)\n", head, tail);
 		goto end;
@@ -529,58 +702,56 @@ x540_recv_frames (struct x540 *x540, void (*callback) (int num_frames,
 		nt = tail + 1;
 		if (nt >= x540->config.num_rdesc)
 			nt = 0;
-		if (head == nt || i == num) {
-			callback (i, frames, frame_sizes, arg);
-			if (head == nt)
+		if (head == nt || i == num || (budget && count == budget)) {
+			if (i && x540->recv_func)
+				x540->recv_func (x540, i, frames, frame_sizes,
+						 x540->recv_param, premap);
+			if (head == nt || (budget && count == budget))
 				break;
 			i = 0;
 		}
 		tail = nt;
-		rdesc = &x540->rdesc_ring[tail];
-		frames[i] = x540->rdesc_buf[tail];
+		count++;
+		rdesc = &rxq->ring[tail];
+		frames[i] = rxq->buf[tail];
 		frame_sizes[i] = rdesc->len;
+		premap[i] = rxq->buf_premap[tail];
 
 		if (!rdesc->status_eop) {
-			LOG ("Status is not EOP\n");
 			errstate |= X540_RET_RCVEOP;
 			continue;
 		}
 		if (rdesc->err_ipe) {
-			LOG ("Reception IP error\n");
 			errstate |= X540_RET_RCVIPE;
 			continue;
 		}
 		if (rdesc->err_tcpe) {
-			LOG ("Reception TCP/UDP error\n");
 			errstate |= X540_RET_RCVTCPE;
 			continue;
 		}
 		if (rdesc->err_rxe) {
-			LOG ("Reception RX data error\n");
 			errstate |= X540_RET_RCVRXE;
 			continue;
 		}
 		i++;
 	}
-	x540_write32 (x540, X540_REG_RDT, tail);
+	x540_write32 (x540, X540_QREG (X540_REG_RDT, rxq->index), tail);
 
 end:
-	spinlock_unlock (&x540->lock);
+	spinlock_unlock (&rxq->lock);
 
-	if (errstate) {
-		if (error)
-			*error = errstate;
-		return X540_RET_ERR;
-	}
+	if (errstate && error)
+		*error = errstate;
 
-	return X540_RET_OK;
+	return count;
 }
-#endif	/* DODBG */
 
 static void
-x540_alloc_rdesc (struct x540 *x540)
+x540_alloc_rdesc (struct x540_rxq *rxq)
 {
-	if (x540->rdesc_ring)
+	struct x540 *x540 = rxq->x540;
+
+	if (rxq->ring)
 		return;
 
 	int i;
@@ -593,55 +764,131 @@ x540_alloc_rdesc (struct x540 *x540)
 	void *vaddr;
 	phys_t paddr;
 
-	DBG ("Make recv descriptor "
+	DBG ("Make recv descriptor %d "
 	     "(num_rdesc: %d, "
 	     "rdesc_size: %ld, "
 	     "rdesc_bufsize: %d (%d pages), "
 	     "rdesc_ring_size: %d (%d pages))\n",
-	     num_rdesc,
+	     rxq->index, num_rdesc,
 	     sizeof (struct x540_rdesc),
 	     bufsize, num_rdesc_buf_pages,
 	     rdesc_ring_size, num_rdesc_ring_pages);
 
 	alloc_pages (&vaddr, &paddr, num_rdesc_ring_pages);
-	x540->rdesc_ring = vaddr;
-	x540->rdesc_ring_phys = paddr;
-	memset (x540->rdesc_ring, 0, rdesc_ring_size);
+	rxq->ring = vaddr;
+	rxq->ring_phys = paddr;
+	memset (rxq->ring, 0, rdesc_ring_size);
 
-	x540->rdesc_buf = alloc (num_rdesc * sizeof (void *));
+	rxq->buf = alloc (num_rdesc * sizeof (void *));
+	rxq->buf_premap = alloc (num_rdesc * sizeof (long));
 	for (i = 0; i < num_rdesc; i++) {
 		alloc_pages (&vaddr, &paddr, num_rdesc_buf_pages);
-		x540->rdesc_buf[i] = vaddr;
-		x540->rdesc_ring[i].bufaddr = paddr;
+		rxq->buf[i] = vaddr;
+		rxq->buf_premap[i] = net_premap_recvbuf (x540->nethandle,
+							 vaddr, bufsize);
+		rxq->ring[i].bufaddr = paddr;
 	}
 }
 
 static void
-x540_write_rdesc (struct x540 *x540)
+x540_write_rdesc (struct x540_rxq *rxq)
 {
+	struct x540 *x540 = rxq->x540;
+	int n = rxq->index;
 	int num_rdesc = x540->config.num_rdesc;
 	int rdesc_ring_size = num_rdesc * sizeof (struct x540_rdesc);
+	u32 srrctl;
 
-	DBG ("Writing recv descriptor ring... "
+	DBG ("Writing recv descriptor ring %d... "
 	     "(size: %d, header: 0, tail: 0, phys: %llx)\n",
-	     rdesc_ring_size, x540->rdesc_ring_phys);
+	     n, rdesc_ring_size, rxq->ring_phys);
 
 	/* write base address */
-	x540_write32 (x540, X540_REG_RDBAL, x540->rdesc_ring_phys);
-	x540_write32 (x540, X540_REG_RDBAH, 0);
+	x540_write32 (x540, X540_QREG (X540_REG_RDBAL, n), rxq->ring_phys);
+	x540_write32 (x540, X540_QREG (X540_REG_RDBAH, n),
+		      (u64)rxq->ring_phys >> 32);
 
 	/* write header/tail */
-	x540_write32 (x540, X540_REG_RDT, 0);
-	x540_write32 (x540, X540_REG_RDH, 0);
+	x540_write32 (x540, X540_QREG (X540_REG_RDT, n), 0);
+	x540_write32 (x540, X540_QREG (X540_REG_RDH, n), 0);
 
 	/* write size of descriptor ring */
-	x540_write32 (x540, X540_REG_RDLEN, rdesc_ring_size);
+	x540_write32 (x540, X540_QREG (X540_REG_RDLEN, n), rdesc_ring_size);
+
+	/* legacy descriptors with bufsize buffers.  without flow
+	   control a full queue drops its frames instead of blocking
+	   the packet buffer shared with the other queues */
+	srrctl = x540->config.bufsize / 1024;
+	if (!x540->config.use_flowcontrol && x540->config.num_rxq > 1)
+		srrctl |= X540_SRRCTL_DROP_EN;
+	x540_write32 (x540, X540_QREG (X540_REG_SRRCTL, n), srrctl);
 }
 
 static int
-x540_setup_recv (struct x540 *x540)
+x540_enable_rxq (struct x540_rxq *rxq)
 {
+	struct x540 *x540 = rxq->x540;
 	int timeout;
+	u32 reg = X540_QREG (X540_REG_RXDCTL, rxq->index);
+
+	x540_write32 (x540, reg, x540_read32 (x540, reg) | 1 << 25);
+	timeout = 3 * 1000;
+	while (1) {
+		x540_usleep (1000);
+		if (timeout-- < 0) {
+			LOG ("failed to enable reception queue %d\n",
+			     rxq->index);
+			return X540_RET_ERR;
+		}
+		if (x540_check32 (x540, reg, 1 << 25))
+			break;
+	}
+
+	/* bump up the value of receive descriptor tail */
+	x540_write32 (x540, X540_QREG (X540_REG_RDT, rxq->index),
+		      x540->config.num_rdesc - 1);
+	return X540_RET_OK;
+}
+
+/* spread received flows over the queues by the RSS hash */
+static void
+x540_setup_rss (struct x540 *x540)
+{
+	static const u32 rsskey[X540_RSSRK_WORDS] = {
+		0xDA565A6D, 0xC20E5B25, 0x3D256741, 0xB08FA343, 0xCB2BCAD0,
+		0xB4307BAE, 0xA32DCB77, 0x0CF23080, 0x3BB7426A, 0xFA01ACBE,
+	};
+	u32 reta;
+	int i;
+
+	if (x540->config.num_rxq == 1 && !x540->config.num_vfs) {
+		x540_write32 (x540, X540_REG_MRQC, 0);
+		return;
+	}
+	for (i = 0; i < X540_RSSRK_WORDS; i++)
+		x540_write32 (x540, X540_REG_RSSRK + i * 4, rsskey[i]);
+	reta = 0;
+	for (i = 0; i < X540_RETA_ENTRIES; i++) {
+		/* in VT mode, the index of a queue in the pool */
+		reta |= (i % x540->config.num_rxq) << (i % 4 * 8);
+		if (i % 4 == 3) {
+			x540_write32 (x540, X540_REG_RETA + i / 4 * 4, reta);
+			reta = 0;
+		}
+	}
+	x540_write32 (x540, X540_REG_RXCSUM,
+		      x540_read32 (x540, X540_REG_RXCSUM) | X540_RXCSUM_PCSD);
+	x540_write32 (x540, X540_REG_MRQC, (x540->config.num_vfs ?
+					    X540_MRQC_VMDQRSS32 :
+					    X540_MRQC_RSSEN) |
+		      X540_MRQC_TCPIPV4 | X540_MRQC_IPV4 |
+		      X540_MRQC_IPV6 | X540_MRQC_TCPIPV6);
+}
+
+static int
+x540_setup_recv (struct x540 *x540)
+{
+	int i;
 	u32 regvalue;
 
 	DBG ("Setting up reception...\n");
@@ -657,32 +904,19 @@ x540_setup_recv (struct x540 *x540)
 		x540_write32 (x540, X540_REG_HLREG0, regvalue & ~0x4);
 	}
 
-	if (x540->config.use_flowcontrol) {
-		/* FIXME: do something to enable flow control */
-	} else {
-		/* FIXME: do something to disbale flow control */
-	}
-
 	/* setup descriptors */
-	x540_alloc_rdesc (x540);
-	x540_write_rdesc (x540);
-
-	/* enable the reception queue */
-	regvalue = x540_read32 (x540, X540_REG_RXDCTL);
-	x540_write32 (x540, X540_REG_RXDCTL, regvalue | 1 << 25);
-	timeout = 3 * 1000;
-	while (1) {
-		x540_usleep (1000);
-		if (timeout-- < 0) {
-			LOG ("failed to enable reception\n");
-			return X540_RET_ERR;
-		}
-		if (x540_check32 (x540, X540_REG_RXDCTL, 1 << 25))
-			break;
+	for (i = 0; i < x540->config.num_rxq; i++) {
+		x540->rxq[i].x540 = x540;
+		x540->rxq[i].index = x540->qbase + i;
+		x540_alloc_rdesc (&x540->rxq[i]);
+		x540_write_rdesc (&x540->rxq[i]);
 	}
+	x540_setup_rss (x540);
 
-	/* bump up the value of receive descriptor tail */
-	x540_write32 (x540, X540_REG_RDT, x540->config.num_rdesc - 1);
+	/* enable the reception queues */
+	for (i = 0; i < x540->config.num_rxq; i++)
+		if (x540_enable_rxq (&x540->rxq[i]) != X540_RET_OK)
+			return X540_RET_ERR;
 
 	/* start reception */
 	regvalue = x540_read32 (x540, X540_REG_RXCTRL);
@@ -695,6 +929,44 @@ x540_setup_recv (struct x540 *x540)
 	return X540_RET_OK;
 }
 
+/******** Flow control functions ********/
+/* 802.3x link flow control.  a pause frame is sent when the packet
+   buffer fills up to the high water mark, and an XON frame when it
+   drains to the low water mark.  received pause frames stop
+   transmission */
+static void
+x540_setup_flowcontrol (struct x540 *x540)
+{
+	u32 pbsize, high, low;
+
+	if (!x540->config.use_flowcontrol) {
+		/* disable all */
+		x540_write32 (x540, X540_REG_FCTTV, 0);
+		x540_write32 (x540, X540_REG_FCRTL, 0);
+		x540_write32 (x540, X540_REG_FCRTH, 0);
+		x540_write32 (x540, X540_REG_FCRTV, 0);
+		x540_write32 (x540, X540_REG_FCCFG, 0);
+		x540_write32 (x540, X540_REG_MFLCN,
+			      x540_read32 (x540, X540_REG_MFLCN) &
+			      ~X540_MFLCN_RFCE);
+		return;
+	}
+	pbsize = (x540_read32 (x540, X540_REG_RXPBSIZE) >> 10 & 0x3FF) * 1024;
+	high = pbsize - X540_FC_HEADROOM;
+	low = high - X540_FC_HYSTERESIS;
+	DBG ("Flow control (packet buffer: %u, high: %u, low: %u)\n",
+	     pbsize, high, low);
+	x540_write32 (x540, X540_REG_FCTTV, X540_FC_PAUSE_TIME);
+	x540_write32 (x540, X540_REG_FCRTV, X540_FC_PAUSE_TIME / 2);
+	x540_write32 (x540, X540_REG_FCRTL, (low & 0x7FFE0) |
+		      X540_FCRTL_XONE);
+	x540_write32 (x540, X540_REG_FCRTH, (high & 0x7FFE0) |
+		      X540_FCRTH_FCEN);
+	x540_write32 (x540, X540_REG_FCCFG, X540_FCCFG_TFCE_802_3X);
+	x540_write32 (x540, X540_REG_MFLCN,
+		      x540_read32 (x540, X540_REG_MFLCN) | X540_MFLCN_RFCE);
+}
+
 /******** Status functions ********/
 static void
 x540_get_macaddr (struct x540 *x540, u8 *macaddr)
@@ -706,6 +978,239 @@ x540_get_macaddr (struct x540 *x540, u8 *macaddr)
 	*(u16 *)(macaddr + 4) = rah;
 }
 
+/******** SR-IOV functions ********/
+/* with virtual functions, the X540 runs in 32 pool mode.  VF n owns
+   pool n and its queues.  the physical function uses the pool next
+   to the pools of the VFs */
+static void
+x540_setup_vt (struct x540 *x540)
+{
+	int pool = x540->pool;
+	u32 rttdcs, psrtype;
+	int i;
+
+	x540_write32 (x540, X540_REG_GCR_EXT,
+		      X540_GCR_EXT_MSIX_EN | X540_GCR_EXT_VT_MODE_32);
+
+	/* MTQC can be changed only while the arbiter is disabled */
+	rttdcs = x540_read32 (x540, X540_REG_RTTDCS);
+	x540_write32 (x540, X540_REG_RTTDCS, rttdcs | X540_RTTDCS_ARBDIS);
+	x540_write32 (x540, X540_REG_MTQC, X540_MTQC_VT_ENA | X540_MTQC_32VF);
+	x540_write32 (x540, X540_REG_RTTDCS, rttdcs);
+
+	x540_write32 (x540, X540_REG_PFVTCTL, X540_PFVTCTL_VT_ENA |
+		      X540_PFVTCTL_REPLEN |
+		      pool << X540_PFVTCTL_DEF_PL_SHIFT);
+
+	/* the pools of VFs are enabled when the VFs reset */
+	x540_write32 (x540, X540_REG_VFRE, 1 << pool);
+	x540_write32 (x540, X540_REG_VFTE, 1 << pool);
+	x540_write32 (x540, X540_REG_PFDTXGSWC, X540_PFDTXGSWC_LBEN);
+	x540_write32 (x540, X540_REG_VMOLR + pool * 4, X540_VMOLR_AUPE |
+		      X540_VMOLR_BAM | X540_VMOLR_MPE);
+
+	/* the address of the physical function goes to its pool */
+	x540_write32 (x540, X540_REG_MPSAR_LO, 1 << pool);
+	x540_write32 (x540, X540_REG_MPSAR_HI, 0);
+
+	psrtype = 0;
+	if (x540->config.num_rxq > 2)
+		psrtype = 2 << X540_PSRTYPE_RQPL_SHIFT;
+	else if (x540->config.num_rxq > 1)
+		psrtype = 1 << X540_PSRTYPE_RQPL_SHIFT;
+	x540_write32 (x540, X540_REG_PSRTYPE + pool * 4, psrtype);
+
+	/* VFs cannot send frames with other MAC addresses */
+	for (i = 0; i < pool; i += 8)
+		x540_write32 (x540, X540_REG_PFVFSPOOF + i / 8 * 4,
+			      pool - i >= 8 ? 0xFF : (1 << (pool - i)) - 1);
+}
+
+static void
+x540_vf_macaddr (struct x540 *x540, int vf, u8 *macaddr)
+{
+	memcpy (macaddr, x540->macaddr, 6);
+	macaddr[0] |= 0x02;	/* locally administered */
+	/* the two ports of an adapter usually differ only in the last
+	   byte, so the VF number and the PCI function go above it */
+	macaddr[3] ^= x540->pci->address.func_no << 5;
+	macaddr[4] ^= vf + 1;
+}
+
+static void
+x540_vf_disable (struct x540 *x540, int vf)
+{
+	x540_write32 (x540, X540_REG_VFRE,
+		      x540_read32 (x540, X540_REG_VFRE) & ~(1 << vf));
+	x540_write32 (x540, X540_REG_VFTE,
+		      x540_read32 (x540, X540_REG_VFTE) & ~(1 << vf));
+	x540->vf_cts &= ~(1 << vf);
+}
+
+static void
+x540_vf_reset (struct x540 *x540, int vf)
+{
+	u8 macaddr[6];
+	int rar = vf + 1;
+
+	x540_vf_disable (x540, vf);
+	x540_vf_macaddr (x540, vf, macaddr);
+	x540_write32 (x540, X540_REG_RAL + rar * 8, *(u32 *)macaddr);
+	x540_write32 (x540, X540_REG_RAH + rar * 8,
+		      *(u16 *)(macaddr + 4) | X540_RAH_AV);
+	x540_write32 (x540, X540_REG_MPSAR_LO + rar * 8, 1 << vf);
+	x540_write32 (x540, X540_REG_MPSAR_HI + rar * 8, 0);
+	x540_write32 (x540, X540_REG_VMOLR + vf * 4, X540_VMOLR_AUPE |
+		      X540_VMOLR_BAM | X540_VMOLR_MPE);
+	x540_write32 (x540, X540_REG_VFRE,
+		      x540_read32 (x540, X540_REG_VFRE) | 1 << vf);
+	x540_write32 (x540, X540_REG_VFTE,
+		      x540_read32 (x540, X540_REG_VFTE) | 1 << vf);
+	x540->vf_cts |= 1 << vf;
+}
+
+/* the VF may hold the mailbox for a while */
+static bool
+x540_vf_lock (struct x540 *x540, int vf)
+{
+	u32 reg = X540_REG_PFMAILBOX + vf * 4;
+	int timeout;
+
+	for (timeout = 100; timeout > 0; timeout--) {
+		x540_write32 (x540, reg, X540_PFMAILBOX_PFU);
+		if (x540_check32 (x540, reg, X540_PFMAILBOX_PFU))
+			return true;
+		x540_usleep (10);
+	}
+	return false;
+}
+
+static void
+x540_vf_reply (struct x540 *x540, int vf, u32 *msg, int len)
+{
+	int i;
+
+	if (!x540_vf_lock (x540, vf)) {
+		LOG ("X540: VF %d mailbox is busy\n", vf);
+		return;
+	}
+	for (i = 0; i < len; i++)
+		x540_write32 (x540, X540_REG_PFMBMEM + vf * 64 + i * 4,
+			      msg[i]);
+	/* writing STS without PFU releases the mailbox */
+	x540_write32 (x540, X540_REG_PFMAILBOX + vf * 4, X540_PFMAILBOX_STS);
+}
+
+static void
+x540_vf_message (struct x540 *x540, int vf)
+{
+	u32 msg[X540_MBX_WORDS];
+	u8 macaddr[6];
+	int i, len;
+
+	if (!x540_vf_lock (x540, vf))
+		return;
+	for (i = 0; i < X540_MBX_WORDS; i++)
+		msg[i] = x540_read32 (x540, X540_REG_PFMBMEM + vf * 64 + i * 4);
+	x540_write32 (x540, X540_REG_PFMAILBOX + vf * 4, X540_PFMAILBOX_ACK);
+	if (msg[0] & (X540_VT_MSGTYPE_ACK | X540_VT_MSGTYPE_NACK))
+		return;
+
+	len = 1;
+	if ((msg[0] & 0xFFFF) == X540_VF_RESET) {
+		x540_vf_reset (x540, vf);
+		x540_vf_macaddr (x540, vf, macaddr);
+		msg[0] = X540_VF_RESET | X540_VT_MSGTYPE_ACK;
+		memcpy (&msg[1], macaddr, 6);
+		msg[3] = 0;	/* multicast filter type */
+		x540_vf_reply (x540, vf, msg, 4);
+		return;
+	}
+	if (!(x540->vf_cts & 1 << vf)) {
+		msg[0] |= X540_VT_MSGTYPE_NACK;
+		x540_vf_reply (x540, vf, msg, 1);
+		return;
+	}
+	switch (msg[0] & 0xFFFF) {
+	case X540_VF_SET_MAC_ADDR:
+		/* the address is given by the physical function */
+		x540_vf_macaddr (x540, vf, macaddr);
+		if (memcmp (&msg[1], macaddr, 6))
+			msg[0] |= X540_VT_MSGTYPE_NACK;
+		else
+			msg[0] |= X540_VT_MSGTYPE_ACK;
+		break;
+	case X540_VF_SET_MULTICAST:
+	case X540_VF_SET_LPE:
+		/* the pool receives all multicast frames.  the frame
+		   size limit is shared with the physical function */
+		msg[0] |= X540_VT_MSGTYPE_ACK;
+		break;
+	case X540_VF_API_NEGOTIATE:
+		if (msg[1] == X540_MBOX_API_10 || msg[1] == X540_MBOX_API_11)
+			msg[0] |= X540_VT_MSGTYPE_ACK;
+		else
+			msg[0] |= X540_VT_MSGTYPE_NACK;
+		break;
+	case X540_VF_GET_QUEUES:
+		msg[0] |= X540_VT_MSGTYPE_ACK;
+		msg[1] = X540_POOL_QUEUES;	/* transmit queues */
+		msg[2] = X540_POOL_QUEUES;	/* receive queues */
+		msg[3] = 0;			/* transparent VLAN */
+		msg[4] = 0;			/* default queue */
+		len = 5;
+		break;
+	case X540_VF_SET_VLAN:
+	default:
+		msg[0] |= X540_VT_MSGTYPE_NACK;
+		break;
+	}
+	msg[0] |= X540_VT_MSGTYPE_CTS;
+	x540_vf_reply (x540, vf, msg, len);
+}
+
+static void
+x540_vf_timer (void *handle, void *data)
+{
+	struct x540 *x540 = data;
+	u32 flr, icr;
+	int vf;
+
+	if (x540->removed) {
+		timer_free (handle);
+		return;
+	}
+	/* a VF function level reset stops its pool */
+	flr = x540_read32 (x540, X540_REG_VFLREC);
+	if (flr) {
+		x540_write32 (x540, X540_REG_VFLREC, flr);
+		for (vf = 0; vf < x540->num_vfs; vf++)
+			if (flr & 1 << vf)
+				x540_vf_disable (x540, vf);
+	}
+
+	/* PFMBICR has a request bit of VF 0-15 */
+	icr = x540_read32 (x540, X540_REG_PFMBICR);
+	if (icr) {
+		x540_write32 (x540, X540_REG_PFMBICR, icr);
+		for (vf = 0; vf < x540->num_vfs; vf++)
+			if (icr & 1 << vf)
+				x540_vf_message (x540, vf);
+	}
+	timer_set (handle, X540_VF_POLL_USEC);
+}
+
+static void
+x540_enable_vfs (struct x540 *x540)
+{
+	x540->num_vfs = pci_sriov_enable (x540->pci, x540->config.num_vfs);
+	LOG ("X540: %d virtual functions enabled\n", x540->num_vfs);
+	if (!x540->num_vfs)
+		return;
+	x540->vf_timer = timer_new (x540_vf_timer, x540);
+	timer_set (x540->vf_timer, X540_VF_POLL_USEC);
+}
+
 /********* Linkup functions *********/
 static int
 x540_linkup (struct x540 *x540)
@@ -775,12 +1280,15 @@ x540_linkup (struct x540 *x540)
 			switch (regvalue >> 28 & 3) {
 			case 1:
 				LOG ("100Mbps");
+				x540->link_speed = 100000000ULL;
 				break;
 			case 2:
 				LOG ("1Gbps");
+				x540->link_speed = 1000000000ULL;
 				break;
 			case 3:
 				LOG ("10Gbps");
+				x540->link_speed = 10000000000ULL;
 				break;
 			default:
 				LOG ("(Unkown)");
@@ -793,21 +1301,11 @@ x540_linkup (struct x540 *x540)
 	}
 
 	/* setup flow control registers */
-	if (x540->config.use_flowcontrol) {
-		/* FIXME: implement flow control initialization */
-		x540_write32 (x540, X540_REG_FCTTV, 0);
-		x540_write32 (x540, X540_REG_FCRTL, 0);
-		x540_write32 (x540, X540_REG_FCRTH, 0);
-		x540_write32 (x540, X540_REG_FCRTV, 0);
-		x540_write32 (x540, X540_REG_FCCFG, 0);
-	} else {
-		/* disable all */
-		x540_write32 (x540, X540_REG_FCTTV, 0);
-		x540_write32 (x540, X540_REG_FCRTL, 0);
-		x540_write32 (x540, X540_REG_FCRTH, 0);
-		x540_write32 (x540, X540_REG_FCRTV, 0);
-		x540_write32 (x540, X540_REG_FCCFG, 0);
-	}
+	x540_setup_flowcontrol (x540);
+
+	/* pools must be set up before the queues are enabled */
+	if (x540->config.num_vfs)
+		x540_setup_vt (x540);
 
 	/* transmission setup */
 	if (x540_setup_xmit (x540) != X540_RET_OK) {
@@ -824,19 +1322,91 @@ x540_linkup (struct x540 *x540)
 	return X540_RET_OK;
 }
 
-/******** Logging functions ********/
+/******** Network API functions ********/
 static void
-x540_tty_send (void *handle, void *packet, unsigned int packet_size)
+x540_getinfo_physnic (void *handle, struct nicinfo *info)
 {
 	struct x540 *x540 = handle;
-	void *frames[1];
-	int frame_sizes[1];
-
-	memcpy (packet, config.vmm.tty_mac_address, 6);
-	memcpy (packet + 6, x540->macaddr, 6);
-	frames[0] = packet;
-	frame_sizes[0] = packet_size;
-	x540_send_frames (x540, 1, frames, frame_sizes, NULL);
+
+	info->mtu = 1500;
+	info->media_speed = x540->link_speed;
+	memcpy (info->mac_address, x540->macaddr, sizeof x540->macaddr);
+}
+
+/* consecutive frames of the same flow go to the queue in one batch */
+static void
+x540_send_physnic (void *handle, unsigned int num_packets, void **packets,
+		   unsigned int *packet_sizes, bool print_ok)
+{
+	struct x540 *x540 = handle;
+	unsigned int i, j;
+	int q, nq;
+
+	if (!num_packets)
+		return;
+	q = x540_select_txq (x540, packets[0], packet_sizes[0]);
+	for (i = 0; i < num_packets; i = j, q = nq) {
+		nq = q;
+		for (j = i + 1; j < num_packets; j++) {
+			nq = x540_select_txq (x540, packets[j],
+					      packet_sizes[j]);
+			if (nq != q)
+				break;
+		}
+		x540_send_frames (&x540->txq[q], j - i, &packets[i],
+				  &packet_sizes[i], NULL);
+	}
+}
+
+static void
+x540_setrecv_physnic (void *handle, net_recv_callback_t *callback,
+		      void *param)
+{
+	struct x540 *x540 = handle;
+
+	x540->recv_param = param;
+	x540->recv_func = callback;
+}
+
+static void
+x540_poll_physnic (void *handle)
+{
+	struct x540 *x540 = handle;
+	int i;
+
+	for (i = 0; i < x540->config.num_rxq; i++)
+		x540_recv_frames (&x540->rxq[i], 0, NULL);
+}
+
+static struct nicfunc phys_func = {
+	.get_nic_info = x540_getinfo_physnic,
+	.send = x540_send_physnic,
+	.set_recv_callback = x540_setrecv_physnic,
+	.poll = x540_poll_physnic,
+};
+
+static uint
+x540_nicpoll (void *data, uint budget)
+{
+	struct x540_rxq *rxq = data;
+
+	return x540_recv_frames (rxq, budget, NULL);
+}
+
+/* the device writes back the descriptor at the head next */
+static volatile void *
+x540_nicpoll_monitor (void *data)
+{
+	struct x540_rxq *rxq = data;
+	struct x540 *x540 = rxq->x540;
+	u32 head;
+
+	if (!x540->recv_enabled)
+		return NULL;
+	head = x540_read32 (x540, X540_QREG (X540_REG_RDH, rxq->index));
+	if (head >= x540->config.num_rdesc)
+		return NULL;
+	return &rxq->ring[head];
 }
 
 /******** MMIO handler ********/
@@ -941,48 +1511,6 @@ x540_reghook (struct x540_hook_context *context, struct pci_bar_info *bar)
 	context->ishooked = true;
 }
 
-/******** Reception tester ********/
-#ifdef DODBG
-#include <core/thread.h>
-
-static void
-test_recv_callback (int num_frames, void **frames, int *frame_sizes, void *arg)
-{
-	static int recv_num = 0;
-	int i;
-	u8 *frame;
-
-	for (i = 0; i < num_frames; i++) {
-		frame = frames[i];
-		printf ("RCV: %d bytes (%02X:%02X:%02X:%02X:%02X:%02X ->"
-			" %02X:%02X:%02X:%02X:%02X:%02X)\n",
-			frame_sizes[i],
-			frame[6], frame[7], frame[8], frame[9],
-			frame[10], frame[11],
-			frame[0], frame[1], frame[2], frame[3],
-			frame[4], frame[5]);
-		recv_num++;
-		if (recv_num % 50 == 0)
-			printf ("%d packets received totally\n", recv_num);
-	}
-}
-
-static void
-test_thread (void *arg)
-{
-	struct x540 *x540 = arg;
-	int error;
-
-	while (1) {
-		schedule ();
-		error = 0;
-		x540_recv_frames (x540, test_recv_callback, NULL, &error);
-		if (error)
-			printf ("RECV ERR: %08X\n", error);
-	}
-}
-#endif	/* DODBG */
-
 /******** Config read/write handler ********/
 static int
 x540_config_read (struct pci_device *pci_device, u8 iosize, u16 offset,
@@ -1023,6 +1551,56 @@ x540_config_write (struct pci_device *pci_device, u8 iosize, u16 offset,
 	return CORE_IO_RET_DEFAULT;
 }
 
+/******** Driver options ********/
+static int
+x540_option_int (struct pci_device *pci_device, int index, int value,
+		 int min, int max)
+{
+	char *option = pci_device->driver_options[index];
+
+	if (!option)
+		return value;
+	value = pci_driver_option_get_int (option, NULL, 10);
+	if (value < min)
+		return min;
+	if (value > max)
+		return max;
+	return value;
+}
+
+static void
+x540_get_options (struct x540 *x540, struct pci_device *pci_device)
+{
+	struct x540_config *config = &x540->config;
+
+	if (pci_device->driver_options[0])
+		config->use_fortty =
+			pci_driver_option_get_bool (pci_device->
+						    driver_options[0], NULL);
+	config->num_rxq = x540_option_int (pci_device, 2, config->num_rxq,
+					   1, X540_MAX_QUEUES);
+	config->num_txq = x540_option_int (pci_device, 3, config->num_txq,
+					   1, X540_MAX_QUEUES);
+	/* the ring length must be a multiple of 128 bytes */
+	config->num_rdesc = x540_option_int (pci_device, 4, config->num_rdesc,
+					     X540_MIN_DESC, X540_MAX_DESC) & ~7;
+	config->num_tdesc = x540_option_int (pci_device, 5, config->num_tdesc,
+					     X540_MIN_DESC, X540_MAX_DESC) & ~7;
+	if (pci_device->driver_options[6])
+		config->use_flowcontrol =
+			pci_driver_option_get_bool (pci_device->
+						    driver_options[6], NULL);
+	config->num_vfs = x540_option_int (pci_device, 7, config->num_vfs,
+					   0, X540_MAX_VFS);
+	/* the physical function has one pool */
+	if (config->num_vfs) {
+		if (config->num_rxq > X540_POOL_QUEUES)
+			config->num_rxq = X540_POOL_QUEUES;
+		if (config->num_txq > X540_POOL_QUEUES)
+			config->num_txq = X540_POOL_QUEUES;
+	}
+}
+
 static void
 x540_new (struct pci_device *pci_device)
 {
@@ -1030,6 +1608,7 @@ x540_new (struct pci_device *pci_device)
 	struct x540 *x540;
 	struct x540_hook_context *context;
 	struct pci_bar_info bar_info;
+	char name[24];
 
 	LOG ("X540: Initializing...\n");
 
@@ -1041,7 +1620,15 @@ x540_new (struct pci_device *pci_device)
 	memset (x540, 0, sizeof *x540);
 
 	x540->config = x540_default_config;
+	x540_get_options (x540, pci_device);
+	x540->pci = pci_device;
+	x540->pool = x540->config.num_vfs;
+	x540->qbase = x540->pool * X540_POOL_QUEUES;
 	spinlock_init (&x540->lock);
+	for (i = 0; i < X540_MAX_QUEUES; i++) {
+		spinlock_init (&x540->txq[i].lock);
+		spinlock_init (&x540->rxq[i].lock);
+	}
 	for (i = 0; i < 6; i++) {
 		/* bind x540 to each context */
 		context = x540->context + i;
@@ -1055,6 +1642,8 @@ x540_new (struct pci_device *pci_device)
 	}
 
 	if (x540->config.iscontroled) {
+		x540->nethandle = net_new_nic (pci_device->driver_options[1],
+					       x540->config.use_fortty);
 		x540_linkup (x540);
 		x540_get_macaddr (x540, x540->macaddr);
 
@@ -1070,13 +1659,60 @@ x540_new (struct pci_device *pci_device)
 	pci_device->host = x540;
 	pci_device->driver->options.use_base_address_mask_emulation = 1;
 
-	/* register for tty */
-	if (x540->config.use_fortty)
-		tty_udp_register (x540_tty_send, x540);
+	if (!x540->config.iscontroled)
+		return;
+	if (!net_init (x540->nethandle, x540, &phys_func, NULL, NULL))
+		panic ("x540: passthrough mode is not supported");
+	net_start (x540->nethandle);
+	if (x540->config.num_vfs)
+		x540_enable_vfs (x540);
+	for (i = 0; i < x540->config.num_rxq; i++) {
+		snprintf (name, sizeof name, "x540 %02x:%02x.%01x/%d",
+			  pci_device->address.bus_no,
+			  pci_device->address.device_no,
+			  pci_device->address.func_no, i);
+		nicpoll_register (name, x540_nicpoll, x540_nicpoll_monitor,
+				  &x540->rxq[i]);
+	}
+}
 
-#ifdef DODBG
-	thread_new (test_thread, x540, VMM_STACKSIZE);
-#endif	/* DODBG */
+/* The adapter has been unplugged.  The hooks and the polling
+   queues are released and the queues are stopped.  The structure
+   stays since the network stack keeps the handle, and so does the
+   mapping of BAR 0 which the VF timer may be reading. */
+static void
+x540_remove (struct pci_device *pci_device)
+{
+	struct x540 *x540 = pci_device->host;
+	struct x540_hook_context *context;
+	int i;
+
+	if (!x540)
+		return;
+	if (x540->config.iscontroled)
+		for (i = 0; i < x540->config.num_rxq; i++)
+			nicpoll_unregister (&x540->rxq[i]);
+	x540->removed = true;
+	x540->xmit_enabled = false;
+	x540->recv_enabled = false;
+	/* wait for senders and receivers which saw them enabled */
+	for (i = 0; i < X540_MAX_QUEUES; i++) {
+		spinlock_lock (&x540->txq[i].lock);
+		spinlock_unlock (&x540->txq[i].lock);
+		spinlock_lock (&x540->rxq[i].lock);
+		spinlock_unlock (&x540->rxq[i].lock);
+	}
+	for (i = 0; i < 6; i++) {
+		context = x540->context + i;
+		if (!context->ishooked)
+			continue;
+		if (!i && !context->isio) {
+			mmio_unregister (context->mmhandle);
+			context->ishooked = false;
+		} else {
+			x540_unreghook (context);
+		}
+	}
 }
 
 static struct pci_driver x540_driver = {
@@ -1084,13 +1720,156 @@ static struct pci_driver x540_driver = {
 	.longname	= driver_longname,
 	.device		= "id=8086:1528,class_code=020000",
 	.new		= x540_new,
+	.remove		= x540_remove,
+	.driver_options	= "tty,net,rxqueues,txqueues,rdesc,tdesc,flowcontrol"
+			  ",vfs",
 	.config_read	= x540_config_read,
 	.config_write	= x540_config_write,
 };
 
+/******** Descriptor ring self-test ********/
+#ifdef X540_SELFTEST
+/* x540_send_frames() and x540_recv_frames() run against a register
+   model: BAR 0 is plain memory and the test plays the device by
+   moving the head registers and filling receive descriptors.  built
+   only with CONFIG_X540_SELFTEST since it panics on a failure */
+#define X540_MODEL_DESC		8
+#define X540_MODEL_BUFSIZE	64
+#define X540_MODEL_REGSIZE	0x7000
+
+static unsigned int x540_model_recv_calls, x540_model_recv_frames;
+
+static void
+x540_model_recv (void *handle, unsigned int num_packets, void **packets,
+		 unsigned int *packet_sizes, void *param, long *premap)
+{
+	x540_model_recv_calls++;
+	x540_model_recv_frames += num_packets;
+}
+
+static void
+x540_model_fill (struct x540_rdesc *ring, int start, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		memset (&ring[(start + i) % X540_MODEL_DESC], 0,
+			sizeof *ring);
+		ring[(start + i) % X540_MODEL_DESC].len = 60;
+		ring[(start + i) % X540_MODEL_DESC].status_dd = 1;
+		ring[(start + i) % X540_MODEL_DESC].status_eop = 1;
+	}
+}
+
+static void
+x540_ring_selftest (void)
+{
+	static struct x540 model;
+	static struct x540_tdesc tring[X540_MODEL_DESC];
+	static struct x540_rdesc rring[X540_MODEL_DESC];
+	static u8 buf[2][X540_MODEL_DESC][X540_MODEL_BUFSIZE];
+	static void *tbuf[X540_MODEL_DESC], *rbuf[X540_MODEL_DESC];
+	static long premap[X540_MODEL_DESC];
+	void *frames[X540_MODEL_DESC + 2];
+	unsigned int sizes[X540_MODEL_DESC + 2];
+	u8 frame[X540_MODEL_BUFSIZE];
+	int i, ret, err, count;
+	void *regs;
+
+	regs = alloc (X540_MODEL_REGSIZE);
+	memset (regs, 0, X540_MODEL_REGSIZE);
+	memset (&model, 0, sizeof model);
+	model.context[0].mappedaddr = regs;
+	model.config.bufsize = X540_MODEL_BUFSIZE;
+	model.config.num_tdesc = X540_MODEL_DESC;
+	model.config.num_rdesc = X540_MODEL_DESC;
+	model.config.num_txq = 1;
+	model.config.num_rxq = 1;
+	model.xmit_enabled = true;
+	model.recv_enabled = true;
+	model.recv_func = x540_model_recv;
+	for (i = 0; i < X540_MODEL_DESC; i++) {
+		tbuf[i] = buf[0][i];
+		rbuf[i] = buf[1][i];
+	}
+	model.txq[0].x540 = &model;
+	model.txq[0].ring = tring;
+	model.txq[0].buf = tbuf;
+	spinlock_init (&model.txq[0].lock);
+	model.rxq[0].x540 = &model;
+	model.rxq[0].ring = rring;
+	model.rxq[0].buf = rbuf;
+	model.rxq[0].buf_premap = premap;
+	spinlock_init (&model.rxq[0].lock);
+	memset (tring, 0, sizeof tring);
+	memset (frame, 0xAA, sizeof frame);
+	for (i = 0; i < X540_MODEL_DESC + 2; i++) {
+		frames[i] = frame;
+		sizes[i] = 60;
+	}
+
+	/* a batch larger than the ring stops one short of the head */
+	err = 0;
+	ret = x540_send_frames (&model.txq[0], X540_MODEL_DESC + 2, frames,
+				sizes, &err);
+	if (ret != X540_RET_ERR || err != X540_RET_XMTFULL ||
+	    x540_read32 (&model, X540_REG_TDT) != X540_MODEL_DESC - 1 ||
+	    tring[0].len != 60 || !tring[0].cmd_eop ||
+	    tring[X540_MODEL_DESC - 1].len)
+		panic ("x540: transmit ring self-test failed (full)");
+
+	/* the device consumes five; the tail wraps */
+	x540_write32 (&model, X540_REG_TDH, 5);
+	ret = x540_send_frames (&model.txq[0], 3, frames, sizes, NULL);
+	if (ret != X540_RET_OK || x540_read32 (&model, X540_REG_TDT) != 2)
+		panic ("x540: transmit ring self-test failed (wrap)");
+
+	/* an oversized frame is skipped */
+	sizes[0] = X540_MODEL_BUFSIZE;
+	err = 0;
+	ret = x540_send_frames (&model.txq[0], 1, frames, sizes, &err);
+	if (ret != X540_RET_ERR || err != X540_RET_XMTBIG ||
+	    x540_read32 (&model, X540_REG_TDT) != 2)
+		panic ("x540: transmit ring self-test failed (size)");
+
+	/* all receive buffers are given to the device as at init */
+	x540_write32 (&model, X540_REG_RDT, X540_MODEL_DESC - 1);
+	count = x540_recv_frames (&model.rxq[0], 0, NULL);
+	if (count || x540_model_recv_calls)
+		panic ("x540: receive ring self-test failed (empty)");
+
+	/* five frames, one with a MAC error */
+	x540_model_fill (rring, 0, 5);
+	rring[2].err_rxe = 1;
+	x540_write32 (&model, X540_REG_RDH, 5);
+	err = 0;
+	count = x540_recv_frames (&model.rxq[0], 0, &err);
+	if (count != 5 || err != X540_RET_RCVRXE ||
+	    x540_model_recv_calls != 1 || x540_model_recv_frames != 4 ||
+	    x540_read32 (&model, X540_REG_RDT) != 4)
+		panic ("x540: receive ring self-test failed (batch)");
+
+	/* six more across the end of the ring, taken with a budget */
+	x540_model_fill (rring, 5, 6);
+	x540_write32 (&model, X540_REG_RDH, 3);
+	count = x540_recv_frames (&model.rxq[0], 2, NULL);
+	if (count != 2 || x540_read32 (&model, X540_REG_RDT) != 6)
+		panic ("x540: receive ring self-test failed (budget)");
+	count = x540_recv_frames (&model.rxq[0], 0, NULL);
+	if (count != 4 || x540_model_recv_frames != 10 ||
+	    x540_read32 (&model, X540_REG_RDT) != 2)
+		panic ("x540: receive ring self-test failed (wrap)");
+	free (regs);
+	printf ("x540: descriptor ring self-test passed\n");
+}
+#endif
+
 static void
 x540_init (void)
 {
+#ifdef X540_SELFTEST
+	x540_ring_selftest ();
+#endif
 	pci_register_driver (&x540_driver);
 }
 
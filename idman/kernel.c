@@ -29,6 +29,7 @@
 
 #include <core.h>
 #include <core/process.h>
+#include <core/random.h>
 #include <IDMan.h>
 #include <usb.h>
 #include <usb_device.h>
@@ -42,7 +43,8 @@ struct devlist {
 	struct usb_device *kernel, *user;
 };
 
-static int desc, usb_desc;
+static int usb_desc;
+static struct msgcache idman_msg = MSGCACHE_INITIALIZER ("idman");
 static struct mempool *mp;
 static usb_dev_handle *handle[NUM_OF_HANDLE];
 static struct devlist *devlist_head;
@@ -52,10 +54,11 @@ static char usbbuf[65536];
 static void
 callsub (int c, struct msgbuf *buf, int bufcnt)
 {
-	int r;
+	int d, r;
 
 	for (;;) {
-		r = msgsendbuf (desc, c, buf, bufcnt);
+		d = msgcache_open (&idman_msg);
+		r = d >= 0 ? msgsendbuf (d, c, buf, bufcnt) : -1;
 		if (r == 0)
 			break;
 		printf ("ret %d\n", r);
@@ -688,6 +691,7 @@ ret:
 static void
 idman_kernel_init (void)
 {
+	char *seed;
 #ifdef IDMAN_PD
 	int i;
 
@@ -699,12 +703,15 @@ idman_kernel_init (void)
 	if (usb_desc < 0)
 		panic ("register usb");
 #endif /* IDMAN_PD */
-	if (idman_user_init (&config.idman, config.vmm.randomSeed,
+	seed = alloc (sizeof config.vmm.randomSeed);
+	random_bytes (seed, sizeof config.vmm.randomSeed);
+	if (idman_user_init (&config.idman, seed,
 			     sizeof config.vmm.randomSeed) < 0)
 		panic ("idman_user_init");
+	memset (seed, 0, sizeof config.vmm.randomSeed);
+	free (seed);
 #ifdef IDMAN_PD
-	desc = msgopen ("idman");
-	if (desc < 0)
+	if (msgcache_open (&idman_msg) < 0)
 		panic ("open idman");
 #endif /* IDMAN_PD */
 }
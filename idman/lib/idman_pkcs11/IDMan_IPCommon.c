@@ -36,6 +36,133 @@
 /* 作成ライブラリ関数名 */
 #include "IDMan_IPCommon.h"
 
+#define  SESSION_POOL_MAX		4				//セッションプール件数
+
+/**
+* ログアウト後も開いたままにしておくセッションのプール
+* （IDMan_IPInitializeのたびにトークン情報取得、セッション確立を行わないようにする）
+* （カードのシリアル番号はセッション確立時に一度だけ取得し、カードが抜かれたら消す）
+*/
+static struct {
+	int						valid;								//有効フラグ
+	int						busy;								//ログイン中フラグ
+	int						serialValid;						//シリアル番号有効フラグ
+	CK_SLOT_ID				SlotID;								//スロットID
+	CK_SESSION_HANDLE		SessionHandle;						//セッションハンドル
+	CK_CHAR					SerialNumber[16];					//カードのシリアル番号
+} SessionPool[SESSION_POOL_MAX];
+
+
+/**
+* セッションプール検索関数
+* @param SessionHandle セッションハンドル
+* @return int プールの添字 -1:該当なし
+*/
+static int IDMan_IPSessionFind( CK_SESSION_HANDLE SessionHandle )
+{
+	int						i;
+
+	for (i = 0; i < SESSION_POOL_MAX; i++)
+	{
+		if (SessionPool[i].valid &&
+			SessionPool[i].SessionHandle == SessionHandle)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+/**
+* セッションプール削除関数
+* （セッションを切断し、秘密鍵オブジェクトハンドルキャッシュも削除する）
+* @param i プールの添字
+*/
+static void IDMan_IPSessionDrop( int i )
+{
+	IDMan_IPKeyCacheClear(SessionPool[i].SessionHandle);
+	C_CloseSession(SessionPool[i].SessionHandle);
+	memset(&SessionPool[i], 0x00, sizeof(SessionPool[i]));
+}
+
+/**
+* セッションプール登録関数
+* （空きがない場合は登録しない。IDMan_IPFinalizeでセッションを切断する）
+* @param SlotID スロットID
+* @param SessionHandle セッションハンドル
+* @param SerialNumber カードのシリアル番号
+*/
+static void IDMan_IPSessionAdd( CK_SLOT_ID SlotID,
+								CK_SESSION_HANDLE SessionHandle,
+								CK_CHAR* SerialNumber )
+{
+	int						i;
+
+	for (i = 0; i < SESSION_POOL_MAX; i++)
+	{
+		if (!SessionPool[i].valid)
+		{
+			SessionPool[i].SlotID = SlotID;
+			SessionPool[i].SessionHandle = SessionHandle;
+			memcpy(SessionPool[i].SerialNumber, SerialNumber,
+				   sizeof(SessionPool[i].SerialNumber));
+			SessionPool[i].serialValid = 1;
+			SessionPool[i].busy = 1;
+			SessionPool[i].valid = 1;
+			return;
+		}
+	}
+}
+
+/**
+* セッション確立時に取得したカードのシリアル番号を返す関数
+* （署名のたびにAPDUを送らないよう、C_GetTokenInfoは呼ばない）
+* @param SessionHandle セッションハンドル
+* @param SerialNumber カードのシリアル番号
+* @return int 0:正常 -6:シリアル番号なし
+*/
+int IDMan_IPSessionSerial( CK_SESSION_HANDLE SessionHandle,
+						   CK_CHAR* SerialNumber )
+{
+	int						i;
+
+	i = IDMan_IPSessionFind(SessionHandle);
+	if (i < 0 || !SessionPool[i].busy || !SessionPool[i].serialValid)
+	{
+		return RET_IPNG;
+	}
+	memcpy(SerialNumber, SessionPool[i].SerialNumber,
+		   sizeof(SessionPool[i].SerialNumber));
+	return RET_IPOK;
+}
+
+/**
+* カードが抜かれた場合にシリアル番号と秘密鍵オブジェクトハンドルキャッシュを消す関数
+* （ログアウト済みのセッションはプールから削除する）
+* @param SessionHandle セッションハンドル
+*/
+void IDMan_IPSessionCardRemoved( CK_SESSION_HANDLE SessionHandle )
+{
+	int						i;
+
+	IDMan_IPKeyCacheClear(SessionHandle);
+	for (i = 0; i < SESSION_POOL_MAX; i++)
+	{
+		if (!SessionPool[i].valid)
+		{
+			continue;
+		}
+		if (SessionPool[i].SessionHandle == SessionHandle)
+		{
+			SessionPool[i].serialValid = 0;
+		}
+		else if (!SessionPool[i].busy)
+		{
+			IDMan_IPSessionDrop(i);
+		}
+	}
+}
+
 
 /**
 * ID/パスワードを保存するリストの初期領域確保関数
@@ -154,6 +281,7 @@ int IDMan_IPInitialize( char* PIN,unsigned long int* SessionHandle)
 	CK_BBOOL			tokenPresent;		
 	CK_ULONG			lSlotCnt;			
 	CK_SLOT_ID			slotID[12];			//スロットID
+	int					i;
 
 	DEBUG_OutPut("IDMan_IPInitialize start\n");
 
@@ -181,6 +309,43 @@ int IDMan_IPInitialize( char* PIN,unsigned long int* SessionHandle)
 		return ret;
 	}
 
+	/**プールにログアウト済みのセッションがある場合、 */
+	for (i = 0; i < SESSION_POOL_MAX; i++)
+	{
+		if (!SessionPool[i].valid || SessionPool[i].busy ||
+			SessionPool[i].SlotID != slotID[0])
+		{
+			continue;
+		}
+		/**−カードが抜かれていればセッションを削除する。 */
+		if (C_GetCardStatus(SessionPool[i].SessionHandle) != CKR_OK)
+		{
+			IDMan_IPSessionDrop(i);
+			continue;
+		}
+		/**−カードにログインを行う。 */
+		PINLen = (CK_ULONG) strlen((char*)PIN);
+		rv = C_Login(SessionPool[i].SessionHandle,CKU_USER,(CK_UTF8CHAR_PTR)PIN,PINLen);
+		/**−PINが誤りの場合、セッションは残したまま異常リターンする。 */
+		if (rv == CKR_PIN_INCORRECT || rv == CKR_PIN_LOCKED)
+		{
+			DEBUG_OutPut("IDMan_IPInitialize カードログイン エラー C_Login\n");
+			ret = IDMan_IPRetJudgment(rv);
+			return ret;
+		}
+		/**−その他のエラーの場合、セッションを削除して新しいセッションを確立する。 */
+		if (rv != CKR_OK)
+		{
+			IDMan_IPSessionDrop(i);
+			continue;
+		}
+		/**−プールのセッションを使用し、正常リターンする。 */
+		SessionPool[i].busy = 1;
+		(*SessionHandle) = SessionPool[i].SessionHandle;
+		DEBUG_OutPut("IDMan_IPInitialize end\n");
+		return RET_IPOK;
+	}
+
 	/**トークン情報を取得する。 */
 	rv = C_GetTokenInfo(slotID[0],&tokenInfo);
 	/**トークン情報取得エラーの場合、 */
@@ -216,6 +381,9 @@ int IDMan_IPInitialize( char* PIN,unsigned long int* SessionHandle)
 		return ret;
 	}
 
+	/**セッションとカードのシリアル番号をプールに登録する。 */
+	IDMan_IPSessionAdd(slotID[0], (*SessionHandle), tokenInfo.serialNumber);
+
 	/**正常リターンする。 */
 	DEBUG_OutPut("IDMan_IPInitialize end\n");
 	return RET_IPOK;
@@ -237,9 +405,47 @@ int IDMan_IPFinalize(unsigned long int SessionHandle)
 
 	CK_RV				rv;
 	int					ret;
+	int					i;
 
 	DEBUG_OutPut("IDMan_IPFinalize start\n");
 
+	/**プールのセッションの場合、 */
+	i = IDMan_IPSessionFind(SessionHandle);
+	if (i >= 0)
+	{
+		/**−ログアウト済みの場合、異常リターンする。 */
+		if (!SessionPool[i].busy)
+		{
+			DEBUG_OutPut("IDMan_IPFinalize ログアウト済み\n");
+			return RET_IPNG;
+		}
+		/**−カードからログアウトを行う。 */
+		rv = C_Logout(SessionHandle);
+		/**−カードログアウトエラーの場合、セッションを削除して異常リターンする。 */
+		if (rv != CKR_OK)
+		{
+			DEBUG_OutPut("IDMan_IPFinalize カードログアウト エラー C_Logout\n");
+			IDMan_IPSessionDrop(i);
+			ret = IDMan_IPRetJudgment(rv);
+			return ret;
+		}
+		/**−カードが抜かれていればセッションを削除し、挿入されたままであればプールに残す。 */
+		if (!SessionPool[i].serialValid ||
+			C_GetCardStatus(SessionHandle) != CKR_OK)
+		{
+			IDMan_IPSessionDrop(i);
+		}
+		else
+		{
+			SessionPool[i].busy = 0;
+		}
+		DEBUG_OutPut("IDMan_IPFinalize end\n");
+		return RET_IPOK;
+	}
+
+	/**秘密鍵オブジェクトハンドルキャッシュを削除する。 */
+	IDMan_IPKeyCacheClear(SessionHandle);
+
 	/**カードからログアウトを行う。 */
 	rv = C_Logout(SessionHandle);
 	/**カードログアウトエラーの場合、 */
@@ -283,9 +489,19 @@ int IDMan_IPFinalizeReader(void)
 
 	CK_RV				rv;
 	int					ret;
+	int					i;
 
 	DEBUG_OutPut("IDMan_IPFinalizeReader start\n");
 
+	/**プールのセッションを全て切断する。 */
+	for (i = 0; i < SESSION_POOL_MAX; i++)
+	{
+		if (SessionPool[i].valid)
+		{
+			IDMan_IPSessionDrop(i);
+		}
+	}
+
 	/**PKCS#11ライブラリを終了する。 */
 	rv = C_Finalize((CK_VOID_PTR)0x00);
 	/**PKCS#11ライブラリ終了エラーの場合、 */
@@ -1470,6 +1686,7 @@ int IDMan_CheckCardStatus(CK_SESSION_HANDLE Sessinhandle)
 			iReturn = RET_IPNG_TOKEN_NOT_PRESENT;
 		else
 			iReturn = RET_IPNG; 
+		IDMan_IPSessionCardRemoved(Sessinhandle);
 	}
 
         return iReturn;
@@ -93,6 +93,10 @@ int IDMan_IPgetCertIdxPKCS (CK_SESSION_HANDLE Sessinhandle, int iPkcIndex,
 			    long *lKeyID, int getCert);
 int IDMan_IPIdPassListMalloc (idPasswordList **list, unsigned long int IDLen,
 			      unsigned long int passwordLen);
+void IDMan_IPKeyCacheClear (CK_SESSION_HANDLE SessionHandle);
+int IDMan_IPSessionSerial (CK_SESSION_HANDLE SessionHandle,
+			   CK_CHAR *SerialNumber);
+void IDMan_IPSessionCardRemoved (CK_SESSION_HANDLE SessionHandle);
 int IDMan_IPCheckPKC (CK_SESSION_HANDLE Sessinhandle, unsigned char *pPKC,
 		      unsigned short int PKCLen, int Algorithm,
 		      CK_OBJECT_HANDLE *pKeyObjectHandle);
@@ -41,6 +41,22 @@ int IDMan_IPgetPrivateKey( CK_SESSION_HANDLE , char*, long, CK_OBJECT_HANDLE* );
 int IDMan_IPgetHash( CK_SESSION_HANDLE , int, unsigned char*, unsigned short int, CK_BYTE_PTR*, CK_ULONG* );
 int IDMan_IPCrSignature ( CK_SESSION_HANDLE, CK_OBJECT_HANDLE, int, CK_BYTE_PTR, CK_ULONG ,int, unsigned char*, unsigned short int* );
 
+#define  KEY_CACHE_MAX			4				//秘密鍵オブジェクトハンドルキャッシュ件数
+
+/**
+* PkcxIndexに対応する秘密鍵オブジェクトハンドルのキャッシュ
+* （署名のたびに証明書と秘密鍵をカードから検索しないようにする）
+* （カードのシリアル番号ごとに保持し、カードが差し替えられた場合は使わない）
+*/
+static struct {
+	int						valid;								//有効フラグ
+	CK_SESSION_HANDLE		SessionHandle;						//セッションハンドル
+	CK_CHAR					SerialNumber[16];					//カードのシリアル番号
+	int						PkcxIndex;							//証明書インデックス
+	CK_OBJECT_HANDLE		KeyObjectHandle;					//秘密鍵オブジェクトハンドル
+} KeyCache[KEY_CACHE_MAX];
+static int KeyCacheNext;
+
 
 /**
 * 電子署名生成の内部関数でパラメータチェック関数
@@ -742,6 +758,78 @@ int IDMan_IPCrSignature (	CK_SESSION_HANDLE Sessinhandle,
 }
 
 
+/**
+* 秘密鍵オブジェクトハンドルキャッシュ検索関数
+* @param SessionHandle セッションハンドル
+* @param SerialNumber カードのシリアル番号
+* @param PkcxIndex 証明書インデックス
+* @param pKeyObjectHandle 秘密鍵オブジェクトハンドル
+* @return int 1:キャッシュあり 0:キャッシュなし
+*/
+static int IDMan_IPKeyCacheLookup( CK_SESSION_HANDLE SessionHandle,
+								   CK_CHAR* SerialNumber,
+								   int PkcxIndex,
+								   CK_OBJECT_HANDLE* pKeyObjectHandle )
+{
+	int						i;
+
+	for (i = 0; i < KEY_CACHE_MAX; i++)
+	{
+		if (KeyCache[i].valid &&
+			KeyCache[i].SessionHandle == SessionHandle &&
+			KeyCache[i].PkcxIndex == PkcxIndex &&
+			memcmp( KeyCache[i].SerialNumber, SerialNumber,
+					sizeof(KeyCache[i].SerialNumber) ) == 0)
+		{
+			*pKeyObjectHandle = KeyCache[i].KeyObjectHandle;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+* 秘密鍵オブジェクトハンドルキャッシュ登録関数
+* @param SessionHandle セッションハンドル
+* @param SerialNumber カードのシリアル番号
+* @param PkcxIndex 証明書インデックス
+* @param KeyObjectHandle 秘密鍵オブジェクトハンドル
+*/
+static void IDMan_IPKeyCacheAdd( CK_SESSION_HANDLE SessionHandle,
+								 CK_CHAR* SerialNumber,
+								 int PkcxIndex,
+								 CK_OBJECT_HANDLE KeyObjectHandle )
+{
+	int						i;
+
+	i = KeyCacheNext;
+	KeyCacheNext = (KeyCacheNext + 1) % KEY_CACHE_MAX;
+	KeyCache[i].SessionHandle = SessionHandle;
+	memcpy( KeyCache[i].SerialNumber, SerialNumber,
+			sizeof(KeyCache[i].SerialNumber) );
+	KeyCache[i].PkcxIndex = PkcxIndex;
+	KeyCache[i].KeyObjectHandle = KeyObjectHandle;
+	KeyCache[i].valid = 1;
+}
+
+/**
+* 秘密鍵オブジェクトハンドルキャッシュ削除関数
+* （セッション終了時、署名エラー時に呼び出す）
+* @param SessionHandle セッションハンドル
+*/
+void IDMan_IPKeyCacheClear( CK_SESSION_HANDLE SessionHandle )
+{
+	int						i;
+
+	for (i = 0; i < KEY_CACHE_MAX; i++)
+	{
+		if (KeyCache[i].SessionHandle == SessionHandle)
+		{
+			KeyCache[i].valid = 0;
+		}
+	}
+}
+
 /**
 * 電子署名生成（未ハッシュ版）関数Index指定版
 * （署名対象データをICカード内の秘密鍵で署名をする。署名に利用する鍵ペアは、PkcxIndexで公開鍵証明書を指定する。）
@@ -780,6 +868,8 @@ int IDMan_IPCrSignature (	CK_SESSION_HANDLE Sessinhandle,
 	void					*Cert;								//証明書確保領域ポインタ
 	long					lCert;								//証明書レングス
 	CK_OBJECT_HANDLE		KeyObjectHandle;	
+	CK_CHAR					SerialNumber[16];					//カードのシリアル番号
+	int						useCache;							//キャッシュ使用フラグ
 	/*CK_BYTE_PTR				pSignature;*/							//署名データポインタ
 	unsigned char			SignatureData[2048];				//パディング後署名対象データ
 	long					SignatureDataLen;					//パディング後署名対象データレングス
@@ -799,29 +889,43 @@ int IDMan_IPCrSignature (	CK_SESSION_HANDLE Sessinhandle,
 		return iReturn;
 	}
 
-	/**PkcxIndexに対応する公開鍵証明書PKC(ｘ)の鍵ペアIDを取得する。 */
-	iret = IDMan_IPgetCertIdxPKCS( SessionHandle, PkcxIndex,&Cert,&lCert, &KeyId, &lKeyId,0);
-	/**PkcxIndexに対応する公開鍵証明書PKC(ｘ)の鍵ペアID取得エラーの場合、 */
-	if (iret != RET_IPOK) 
-	{
-		/**−異常リターンする。 */
-		iReturn = iret;
-		DEBUG_OutPut("IDMan_EncryptByIndex PkcxIndexに対応する公開鍵証明書PKC(ｘ)の鍵ペアID取得 エラー IDMan_IPgetCertIdxPKCS\n");
-		return iReturn;
-	}
+	/**セッション確立時に取得したカードのシリアル番号を取得する。取得できない場合はキャッシュを使用しない。 */
+	useCache = (IDMan_IPSessionSerial( SessionHandle, SerialNumber ) == RET_IPOK);
 
-	/**公開鍵証明書PKC(ｘ)に対応する秘密鍵オブジェクトハンドルを取得する。 */
-	iret = IDMan_IPgetPrivateKey( SessionHandle, KeyId, lKeyId, &KeyObjectHandle );
-	/**−公開鍵証明書PKC(ｘ)に対応する秘密鍵オブジェクトハンドル取得エラーの場合、 */
-	if (iret != RET_IPOK) 
+	/**キャッシュにPkcxIndexに対応する秘密鍵オブジェクトハンドルがない場合、 */
+	if (!useCache ||
+		!IDMan_IPKeyCacheLookup( SessionHandle, SerialNumber, PkcxIndex, &KeyObjectHandle ))
 	{
-		/**−異常リターンする。 */
+		/**−PkcxIndexに対応する公開鍵証明書PKC(ｘ)の鍵ペアIDを取得する。 */
+		iret = IDMan_IPgetCertIdxPKCS( SessionHandle, PkcxIndex,&Cert,&lCert, &KeyId, &lKeyId,0);
+		/**−PkcxIndexに対応する公開鍵証明書PKC(ｘ)の鍵ペアID取得エラーの場合、 */
+		if (iret != RET_IPOK) 
+		{
+			/**−−異常リターンする。 */
+			iReturn = iret;
+			DEBUG_OutPut("IDMan_EncryptByIndex PkcxIndexに対応する公開鍵証明書PKC(ｘ)の鍵ペアID取得 エラー IDMan_IPgetCertIdxPKCS\n");
+			return iReturn;
+		}
+
+		/**−公開鍵証明書PKC(ｘ)に対応する秘密鍵オブジェクトハンドルを取得する。 */
+		iret = IDMan_IPgetPrivateKey( SessionHandle, KeyId, lKeyId, &KeyObjectHandle );
+		/**−公開鍵証明書PKC(ｘ)に対応する秘密鍵オブジェクトハンドル取得エラーの場合、 */
+		if (iret != RET_IPOK) 
+		{
+			/**−−異常リターンする。 */
+			IDMan_StFree (KeyId);
+			iReturn = iret;
+			DEBUG_OutPut("IDMan_EncryptByIndex 公開鍵証明書PKC(ｘ)に対応する秘密鍵オブジェクトハンドル取得 エラー IDMan_IPgetPrivateKey\n");
+			return iReturn;
+		}
 		IDMan_StFree (KeyId);
-		iReturn = iret;
-		DEBUG_OutPut("IDMan_EncryptByIndex 公開鍵証明書PKC(ｘ)に対応する秘密鍵オブジェクトハンドル取得 エラー IDMan_IPgetPrivateKey\n");
-		return iReturn;
+
+		/**−秘密鍵オブジェクトハンドルをキャッシュに登録する。 */
+		if (useCache)
+		{
+			IDMan_IPKeyCacheAdd( SessionHandle, SerialNumber, PkcxIndex, KeyObjectHandle );
+		}
 	}
-	IDMan_StFree (KeyId);
 
 	/**−パディング実施の場合、署名対象データ（ハッシュ値）にパディング追加を行う。 */
 	memset(SignatureData,0x00, sizeof(SignatureData));
@@ -840,7 +944,13 @@ int IDMan_IPCrSignature (	CK_SESSION_HANDLE Sessinhandle,
 	/**−署名生成エラーの場合、 */
 	if (iret != RET_IPOK) 
 	{
-		/**−異常リターンする。 */
+		/**−キャッシュを削除し、異常リターンする。 */
+		IDMan_IPKeyCacheClear( SessionHandle );
+		/**−カードが抜かれた場合はシリアル番号も削除する。 */
+		if (iret == RET_IPNG_TOKEN_NOT_PRESENT || iret == RET_IPNG_DEVICE_REMOVED)
+		{
+			IDMan_IPSessionCardRemoved( SessionHandle );
+		}
 		iReturn = iret;
 		DEBUG_OutPut("IDMan_EncryptByIndex 署名生成 エラー IDMan_IPCrSignature\n");
 		return iReturn;
@@ -45,6 +45,11 @@
 
 static unsigned char DATA_CDFZV[] = "\x30\x82\x04\x66\x30\x82\x03\xCF\xA0\x03\x02\x01\x02\x02\x09\x00\xDA\xDE\xD6\x1E\x18\x65\x57\x8F\x30\x0D\x06\x09\x2A\x86\x48\x86\xF7\x0D\x01\x01\x05\x05\x00\x30\x81\xD3\x31\x0B\x30\x09\x06\x03\x55\x04\x06\x13\x02\x4A\x50\x31\x0E\x30\x0C\x06\x03\x55\x04\x08\x13\x05\x41\x69\x63\x68\x69\x31\x0F\x30\x0D\x06\x03\x55\x04\x07\x13\x06\x54\x6F\x79\x6F\x74\x61\x31\x2E\x30\x2C\x06\x03\x55\x04\x0A\x13\x25\x54\x6F\x79\x6F\x74\x61\x20\x4E\x61\x74\x69\x6F\x6E\x61\x6C\x20\x43\x6F\x6C\x6C\x65\x67\x65\x20\x6F\x66\x20\x54\x65\x63\x68\x6E\x6F\x6C\x6F\x67\x79\x31\x27\x30\x25\x06\x03\x55\x04\x0B\x13\x1E\x49\x6E\x66\x6F\x6D\x61\x74\x69\x6F\x6E\x20\x45\x6E\x67\x69\x6E\x65\x65\x72\x69\x6E\x67\x20\x53\x65\x63\x74\x69\x6F\x6E\x31\x21\x30\x1F\x06\x03\x55\x04\x03\x13\x18\x53\x65\x63\x75\x72\x65\x20\x54\x72\x75\x73\x74\x41\x6E\x63\x68\x6F\x72\x43\x65\x72\x74\x30\x30\x31\x27\x30\x25\x06\x09\x2A\x86\x48\x86\xF7\x0D\x01\x09\x01\x16\x18\x73\x65\x63\x75\x72\x65\x63\x61\x40\x74\x6F\x79\x6F\x74\x61\x2D\x63\x74\x2E\x61\x63\x2E\x6A\x70\x30\x1E\x17\x0D\x30\x37\x30\x31\x32\x36\x31\x33\x33\x38\x34\x38\x5A\x17\x0D\x30\x38\x30\x31\x32\x36\x31\x33\x33\x38\x34\x38\x5A\x30\x81\xD3\x31\x0B\x30\x09\x06\x03\x55\x04\x06\x13\x02\x4A\x50\x31\x0E\x30\x0C\x06\x03\x55\x04\x08\x13\x05\x41\x69\x63\x68\x69\x31\x0F\x30\x0D\x06\x03\x55\x04\x07\x13\x06\x54\x6F\x79\x6F\x74\x61\x31\x2E\x30\x2C\x06\x03\x55\x04\x0A\x13\x25\x54\x6F\x79\x6F\x74\x61\x20\x4E\x61\x74\x69\x6F\x6E\x61\x6C\x20\x43\x6F\x6C\x6C\x65\x67\x65\x20\x6F\x66\x20\x54\x65\x63\x68\x6E\x6F\x6C\x6F\x67\x79\x31\x27\x30\x25\x06\x03\x55\x04\x0B\x13\x1E\x49\x6E\x66\x6F\x6D\x61\x74\x69\x6F\x6E\x20\x45\x6E\x67\x69\x6E\x65\x65\x72\x69\x6E\x67\x20\x53\x65\x63\x74\x69\x6F\x6E\x31\x21\x30\x1F\x06\x03\x55\x04\x03\x13\x18\x53\x65\x63\x75\x72\x65\x20\x54\x72\x75\x73\x74\x41\x6E\x63\x68\x6F\x72\x43\x65\x72\x74\x30\x30\x31\x27\x30\x25\x06\x09\x2A\x86\x48\x86\xF7\x0D\x01\x09\x01\x16\x18\x73\x65\x63\x75\x72\x65\x63\x61\x40\x74\x6F\x79\x6F\x74\x61\x2D\x63\x74\x2E\x61\x63\x2E\x6A\x70\x30\x81\x9F\x30\x0D\x06\x09\x2A\x86\x48\x86\xF7\x0D\x01\x01\x01\x05\x00\x03\x81\x8D\x00\x30\x81\x89\x02\x81\x81\x00\xB2\x0B\xED\xC2\x5C\xBE\xEC\x85\xA2\x10\x15\x2A\xAD\xDA\x4A\x54\xDA\x30\x0B\x47\xB9\x3F\xDF\x19\x1A\x98\xEC\x8D\x53\xCE\xC9\xE0\x39\x02\x1F\x9C\x6D\x75\x13\xD2\x77\x8F\x1D\x69\x2E\xE6\xDC\x6B\xA0\xC2\xEF\xBC\xC8\x6C\xBA\x81\xE6\xF8\x71\x8F\xEF\x47\xCF\xDB\x63\x5C\xF0\xCA\x14\xFB\x64\x55\x68\x78\x65\xDA\xCC\x17\x0D\xDA\x9F\x48\x97\x18\x01\x6A\xDA\x57\x1D\xCA\xB6\x36\xCC\xDE\x92\xD1\xB6\x7F\x0B\xC1\xD0\x4F\xCB\xCB\x99\xC7\x08\xDE\x79\xA0\x8C\x13\xD5\x4E\x49\x5D\x84\xA0\x1D\x4D\x7F\x70\x22\xA7\x3C\x4D\x62\xA9\x02\x03\x01\x00\x01\xA3\x82\x01\x3E\x30\x82\x01\x3A\x30\x1D\x06\x03\x55\x1D\x0E\x04\x16\x04\x14\x01\xBF\xDA\xC7\xE9\x81\x80\xB2\xE4\xFE\x0D\xE9\x75\x71\xA1\xAC\x42\xFF\xA9\x8A\x30\x82\x01\x09\x06\x03\x55\x1D\x23\x04\x82\x01\x00\x30\x81\xFD\x80\x14\x01\xBF\xDA\xC7\xE9\x81\x80\xB2\xE4\xFE\x0D\xE9\x75\x71\xA1\xAC\x42\xFF\xA9\x8A\xA1\x81\xD9\xA4\x81\xD6\x30\x81\xD3\x31\x0B\x30\x09\x06\x03\x55\x04\x06\x13\x02\x4A\x50\x31\x0E\x30\x0C\x06\x03\x55\x04\x08\x13\x05\x41\x69\x63\x68\x69\x31\x0F\x30\x0D\x06\x03\x55\x04\x07\x13\x06\x54\x6F\x79\x6F\x74\x61\x31\x2E\x30\x2C\x06\x03\x55\x04\x0A\x13\x25\x54\x6F\x79\x6F\x74\x61\x20\x4E\x61\x74\x69\x6F\x6E\x61\x6C\x20\x43\x6F\x6C\x6C\x65\x67\x65\x20\x6F\x66\x20\x54\x65\x63\x68\x6E\x6F\x6C\x6F\x67\x79\x31\x27\x30\x25\x06\x03\x55\x04\x0B\x13\x1E\x49\x6E\x66\x6F\x6D\x61\x74\x69\x6F\x6E\x20\x45\x6E\x67\x69\x6E\x65\x65\x72\x69\x6E\x67\x20\x53\x65\x63\x74\x69\x6F\x6E\x31\x21\x30\x1F\x06\x03\x55\x04\x03\x13\x18\x53\x65\x63\x75\x72\x65\x20\x54\x72\x75\x73\x74\x41\x6E\x63\x68\x6F\x72\x43\x65\x72\x74\x30\x30\x31\x27\x30\x25\x06\x09\x2A\x86\x48\x86\xF7\x0D\x01\x09\x01\x16\x18\x73\x65\x63\x75\x72\x65\x63\x61\x40\x74\x6F\x79\x6F\x74\x61\x2D\x63\x74\x2E\x61\x63\x2E\x6A\x70\x82\x09\x00\xDA\xDE\xD6\x1E\x18\x65\x57\x8F\x30\x0C\x06\x03\x55\x1D\x13\x04\x05\x30\x03\x01\x01\xFF\x30\x0D\x06\x09\x2A\x86\x48\x86\xF7\x0D\x01\x01\x05\x05\x00\x03\x81\x81\x00\x2B\xA7\x46\x5B\x64\x5D\xC9\x97\x95\x6E\x2B\x34\x91\xA0\x71\xB4\xB4\xB8\x6A\x91\x9B\x8E\x97\xD6\xDD\x4F\xA1\x0C\x90\xC1\xF2\x56\x1E\x3E\x50\x93\x29\x49\x83\x99\x0F\xCB\xCE\x7C\x73\xFD\xDC\xEE\x81\x14\xDB\xE9\xFF\x34\x01\xBB\xE7\xA0\x04\xD6\xF9\xFB\xA0\xBA\xEF\x6C\xBC\x40\xE7\x3B\x65\x16\x7C\x77\x92\x6A\x64\x15\xCD\x83\x3B\x2E\xF7\x58\x77\x28\xAD\xD8\x75\xC0\x76\xFF\x43\xE3\xEA\x08\xC7\xB4\x99\xF4\x19\xA3\xBB\x84\x66\xC0\xF0\x05\x07\x3A\x1D\xD0\x82\x8E\xBC\x6E\xDC\xA5\xC6\xBF\x4D\x9B\x7E\x29\x77\xC3\x0B\x65";
 
+#ifdef CARD_ACCESS
+/* 拡張APDUを受け付けないカードの場合TRUE（カード接続時にクリアする） */
+static CK_BBOOL extLenNG = CK_FALSE;
+#endif
+
 /**
  * カードリーダと接続する関数
  * @author University of Tsukuba
@@ -159,6 +164,8 @@ CK_RV CardConnect(CK_ULONG hContext, CK_BYTE_PTR reader, CK_ULONG_PTR phCard, CK
 #ifdef CARD_ACCESS
 	/** ICカード管理層のIDMan_SCardConnectを呼び、カードに接続する。*/
 	scRv = IDMan_SCardConnect(hContext, (char*)reader, SCARD_SHARE_SHARED, phCard, dwActiveProtocol);
+	/** 拡張APDUが使用できるものとする。*/
+	extLenNG = CK_FALSE;
 	/** リーダが利用不可能の場合、*/
 	if (scRv == SCARD_E_READER_UNAVAILABLE)
 	{
@@ -308,6 +315,214 @@ CK_RV CardTransmit(CK_ULONG hCard, CK_ULONG_PTR dwActiveProtocol, CK_BYTE_PTR se
 }
 
 
+#ifdef CARD_ACCESS
+/**
+ * APDUコマンドを実行し、レスポンスの連鎖を処理する関数
+ * （61xxの場合はGET RESPONSEで残りを取得し、6Cxxの場合は正しいLeで再実行する）
+ * @param hCard カードハンドル
+ * @param dwActiveProtocol カード接続プロトコル
+ * @param sendBuf 送信データ
+ * @param sendLen 送信データ長
+ * @param rcvBuf 受信データ
+ * @param rcvLen 受信データ長
+ * @return CK_RV CKR_OK:成功 CKR_FUNCTION_FAILED:失敗
+ */
+static CK_RV CardTransmitResponse(CK_ULONG hCard, CK_ULONG_PTR dwActiveProtocol, CK_BYTE_PTR sendBuf, CK_ULONG sendLen, CK_BYTE_PTR rcvBuf, CK_ULONG_PTR rcvLen)
+{
+	CK_RV rv = CKR_OK;
+	CK_BYTE getResp[5];
+	CK_ULONG bufLen, dataLen, len;
+	
+	bufLen = *rcvLen;
+	len = bufLen;
+	/** APDUコマンドを実行する。*/
+	rv = CardTransmit(hCard, dwActiveProtocol, sendBuf, sendLen, rcvBuf, &len);
+	if (rv != CKR_OK)
+	{
+		return rv;
+	}
+	/** Leが誤っている（6Cxx）短いAPDUの場合、Leを置き換えて再実行する。*/
+	if (len == 2 && rcvBuf[0] == 0x6C &&
+		(sendLen == 5 || (sendBuf[4] != 0x00 && sendLen == 6 + (CK_ULONG)sendBuf[4])))
+	{
+		sendBuf[sendLen - 1] = rcvBuf[1];
+		len = bufLen;
+		rv = CardTransmit(hCard, dwActiveProtocol, sendBuf, sendLen, rcvBuf, &len);
+		if (rv != CKR_OK)
+		{
+			return rv;
+		}
+	}
+	/** 残りのデータがある（61xx）間、GET RESPONSEを実行してデータを連結する。*/
+	dataLen = 0;
+	while (len >= 2 && rcvBuf[dataLen + len - 2] == 0x61)
+	{
+		memcpy(getResp, GET_RESP_BASE, sizeof(GET_RESP_BASE) - 1);
+		getResp[4] = rcvBuf[dataLen + len - 1];
+		dataLen += len - 2;
+		len = bufLen - dataLen;
+		/** −受信バッファに収まらない場合、*/
+		if (len < 2)
+		{
+			/** −−戻り値に失敗（CKR_FUNCTION_FAILED）を設定し処理を抜ける。*/
+			return CKR_FUNCTION_FAILED;
+		}
+		rv = CardTransmit(hCard, dwActiveProtocol, getResp, sizeof(getResp), &rcvBuf[dataLen], &len);
+		if (rv != CKR_OK)
+		{
+			return rv;
+		}
+	}
+	*rcvLen = dataLen + len;
+	
+	return CKR_OK;
+}
+
+
+
+/**
+ * 短いAPDUに収まらないデータをコマンド連鎖（CLAのb5）で送信する関数
+ * （最後のブロック以外で90 00以外が返された場合は、そのレスポンスを返す）
+ * @param hCard カードハンドル
+ * @param dwActiveProtocol カード接続プロトコル
+ * @param base APDUヘッダ（CLA INS P1 P2）
+ * @param data 送信するデータ
+ * @param dataLen 送信するデータ長
+ * @param useLe Leを付加する場合TRUE
+ * @param le 最後のブロックに付加するLe
+ * @param rcvBuf 受信データ
+ * @param rcvLen 受信データ長
+ * @return CK_RV CKR_OK:成功 CKR_FUNCTION_FAILED:失敗
+ */
+static CK_RV CardTransmitChain(CK_ULONG hCard, CK_ULONG_PTR dwActiveProtocol, CK_BYTE_PTR base, CK_BYTE_PTR data, CK_ULONG dataLen, CK_BBOOL useLe, CK_BYTE le, CK_BYTE_PTR rcvBuf, CK_ULONG_PTR rcvLen)
+{
+	CK_RV rv = CKR_OK;
+	CK_BYTE sendBuf[5 + APDU_CHAIN_SIZE + 1];
+	CK_ULONG sendLen, blockLen, offset, len;
+	
+	offset = 0;
+	for (;;)
+	{
+		/** −次のブロックのAPDUコマンドを作成する。*/
+		blockLen = dataLen - offset;
+		if (blockLen > APDU_CHAIN_SIZE)
+		{
+			blockLen = APDU_CHAIN_SIZE;
+		}
+		memcpy(sendBuf, base, 4);
+		sendBuf[4] = (CK_BYTE)blockLen;
+		memcpy(&sendBuf[5], &data[offset], blockLen);
+		sendLen = 5 + blockLen;
+		offset += blockLen;
+		/** −最後のブロックの場合、Leを付加して実行し、レスポンスの連鎖を処理する。*/
+		if (offset >= dataLen)
+		{
+			if (useLe == CK_TRUE)
+			{
+				sendBuf[sendLen++] = le;
+			}
+			return CardTransmitResponse(hCard, dwActiveProtocol, sendBuf, sendLen, rcvBuf, rcvLen);
+		}
+		/** −後続のブロックがある場合、CLAに連鎖ビットを設定して実行する。*/
+		sendBuf[0] |= CLA_CHAIN;
+		len = *rcvLen;
+		rv = CardTransmit(hCard, dwActiveProtocol, sendBuf, sendLen, rcvBuf, &len);
+		if (rv != CKR_OK)
+		{
+			return rv;
+		}
+		if (len < 2 || rcvBuf[len-2] != 0x90 || rcvBuf[len-1] != 0x00)
+		{
+			*rcvLen = len;
+			return CKR_OK;
+		}
+	}
+}
+
+
+
+/**
+ * カレントファイルをオフセット指定のREAD BINARYで分割して読み出す関数
+ * （拡張APDUを受け付けないカード用。ファイル終端に達した場合も90 00を返す）
+ * @param hCard カードハンドル
+ * @param dwActiveProtocol カード接続プロトコル
+ * @param readLen 読み出すデータ長
+ * @param rcvBuf 受信データ
+ * @param rcvLen 受信データ長
+ * @return CK_RV CKR_OK:成功 CKR_FUNCTION_FAILED:失敗
+ */
+static CK_RV ReadBinaryChain(CK_ULONG hCard, CK_ULONG_PTR dwActiveProtocol, CK_ULONG readLen, CK_BYTE_PTR rcvBuf, CK_ULONG_PTR rcvLen)
+{
+	CK_RV rv = CKR_OK;
+	CK_BYTE sendBuf[5];
+	CK_ULONG bufLen, dataLen, blockLen, len;
+	
+	bufLen = *rcvLen;
+	dataLen = 0;
+	while (dataLen < readLen)
+	{
+		/** −オフセットを指定したAPDUコマンドを作成する。*/
+		blockLen = readLen - dataLen;
+		if (blockLen > APDU_READ_SIZE)
+		{
+			blockLen = APDU_READ_SIZE;
+		}
+		memcpy(sendBuf, READ_BASE, 2);
+		sendBuf[2] = (CK_BYTE)((dataLen >> 8) & 0x7F);
+		sendBuf[3] = (CK_BYTE)(dataLen & 0xFF);
+		sendBuf[4] = (CK_BYTE)(blockLen & 0xFF);
+		/** −受信バッファに収まらない場合、*/
+		if (bufLen - dataLen < blockLen + 2)
+		{
+			/** −−戻り値に失敗（CKR_FUNCTION_FAILED）を設定し処理を抜ける。*/
+			return CKR_FUNCTION_FAILED;
+		}
+		len = bufLen - dataLen;
+		rv = CardTransmitResponse(hCard, dwActiveProtocol, sendBuf, sizeof(sendBuf), &rcvBuf[dataLen], &len);
+		if (rv != CKR_OK)
+		{
+			return rv;
+		}
+		if (len < 2)
+		{
+			return CKR_FUNCTION_FAILED;
+		}
+		/** −正常の場合、短いレスポンスはファイル終端とする。*/
+		if (rcvBuf[dataLen+len-2] == 0x90 && rcvBuf[dataLen+len-1] == 0x00)
+		{
+			dataLen += len - 2;
+			if (len - 2 < blockLen)
+			{
+				break;
+			}
+			continue;
+		}
+		/** −ファイル終端に達した（62 82）場合、*/
+		if (rcvBuf[dataLen+len-2] == 0x62 && rcvBuf[dataLen+len-1] == 0x82)
+		{
+			dataLen += len - 2;
+			break;
+		}
+		/** −オフセットがファイル終端を超えた（6B 00）場合、*/
+		if (dataLen > 0 && rcvBuf[dataLen+len-2] == 0x6B && rcvBuf[dataLen+len-1] == 0x00)
+		{
+			break;
+		}
+		/** −その他のエラーの場合、そのレスポンスを返す。*/
+		rcvBuf[0] = rcvBuf[dataLen+len-2];
+		rcvBuf[1] = rcvBuf[dataLen+len-1];
+		*rcvLen = 2;
+		return CKR_OK;
+	}
+	rcvBuf[dataLen] = 0x90;
+	rcvBuf[dataLen+1] = 0x00;
+	*rcvLen = dataLen + 2;
+	
+	return CKR_OK;
+}
+#endif
+
+
 
 /**
  * DFへSELECT FILEコマンドを実行する関数
@@ -502,6 +717,9 @@ CK_RV InternalAuth(CK_ULONG hCard, CK_ULONG_PTR dwActiveProtocol, CK_BYTE_PTR da
 	CK_RV rv = CKR_OK;
 	CK_BYTE sendBuf[4096];
 	CK_ULONG sendLen;
+#ifdef CARD_ACCESS
+	CK_ULONG rcvBufLen;
+#endif
 	
 	/** バッファを初期化する。*/
 	memset(sendBuf, 0, sizeof(sendBuf));
@@ -527,8 +745,24 @@ CK_RV InternalAuth(CK_ULONG hCard, CK_ULONG_PTR dwActiveProtocol, CK_BYTE_PTR da
 	sendBuf[sendLen++] = 0x80;
 	
 #ifdef CARD_ACCESS
-	/** APDUコマンドを実行する。*/
-	rv = CardTransmit(hCard, dwActiveProtocol, sendBuf, sendLen, rcvBuf, rcvLen);
+	/** 拡張APDUを受け付けないカードの場合、コマンド連鎖で実行する。*/
+	if (dataLen > 0xFF && extLenNG == CK_TRUE)
+	{
+		rv = CardTransmitChain(hCard, dwActiveProtocol, (CK_BYTE_PTR)INT_BASE, data, dataLen, CK_TRUE, 0x00, rcvBuf, rcvLen);
+	}
+	else
+	{
+		/** APDUコマンドを実行する。*/
+		rcvBufLen = *rcvLen;
+		rv = CardTransmitResponse(hCard, dwActiveProtocol, sendBuf, sendLen, rcvBuf, rcvLen);
+		/** 拡張APDUがLc誤り（67 00）となった場合、コマンド連鎖で再実行する。*/
+		if (rv == CKR_OK && dataLen > 0xFF && *rcvLen == 2 && rcvBuf[0] == 0x67 && rcvBuf[1] == 0x00)
+		{
+			extLenNG = CK_TRUE;
+			*rcvLen = rcvBufLen;
+			rv = CardTransmitChain(hCard, dwActiveProtocol, (CK_BYTE_PTR)INT_BASE, data, dataLen, CK_TRUE, 0x00, rcvBuf, rcvLen);
+		}
+	}
 	/** 失敗の場合、*/
 	if (rv != CKR_OK)
 	{
@@ -566,6 +800,9 @@ CK_RV ReadBinary(CK_ULONG hCard, CK_ULONG_PTR dwActiveProtocol, CK_ULONG efType,
 	CK_RV rv = CKR_OK;
 	CK_BYTE sendBuf[4096];
 	CK_ULONG sendLen;
+#ifdef CARD_ACCESS
+	CK_ULONG rcvBufLen;
+#endif
 	CK_ULONG readLen = 0;
 	CK_BYTE dummy[4096];
 	CK_ULONG dummyLen = 0;
@@ -659,8 +896,24 @@ CK_RV ReadBinary(CK_ULONG hCard, CK_ULONG_PTR dwActiveProtocol, CK_ULONG efType,
 	sendBuf[sendLen++] = (CK_BYTE)(readLen & 0xFF);
 	
 #ifdef CARD_ACCESS
-	/** APDUコマンドを実行する。*/
-	rv = CardTransmit(hCard, dwActiveProtocol, sendBuf, sendLen, rcvBuf, rcvLen);
+	/** 拡張APDUを受け付けないカードの場合、オフセットを指定して分割して読み出す。*/
+	if (readLen > 0xFF && extLenNG == CK_TRUE)
+	{
+		rv = ReadBinaryChain(hCard, dwActiveProtocol, readLen, rcvBuf, rcvLen);
+	}
+	else
+	{
+		/** APDUコマンドを実行する。*/
+		rcvBufLen = *rcvLen;
+		rv = CardTransmitResponse(hCard, dwActiveProtocol, sendBuf, sendLen, rcvBuf, rcvLen);
+		/** 拡張APDUがLe誤り（67 00）となった場合、分割して読み出す。*/
+		if (rv == CKR_OK && readLen > 0xFF && *rcvLen == 2 && rcvBuf[0] == 0x67 && rcvBuf[1] == 0x00)
+		{
+			extLenNG = CK_TRUE;
+			*rcvLen = rcvBufLen;
+			rv = ReadBinaryChain(hCard, dwActiveProtocol, readLen, rcvBuf, rcvLen);
+		}
+	}
 	/** 失敗の場合、*/
 	if (rv != CKR_OK)
 	{
@@ -703,6 +956,9 @@ CK_RV UpdateBinary(CK_ULONG hCard, CK_ULONG_PTR dwActiveProtocol, CK_BYTE_PTR da
 	CK_RV rv = CKR_OK;
 	CK_BYTE sendBuf[4096];
 	CK_ULONG sendLen;
+#ifdef CARD_ACCESS
+	CK_ULONG rcvBufLen;
+#endif
 	
 	/** バッファを初期化する。*/
 	memset(sendBuf, 0, sizeof(sendBuf));
@@ -722,8 +978,24 @@ CK_RV UpdateBinary(CK_ULONG hCard, CK_ULONG_PTR dwActiveProtocol, CK_BYTE_PTR da
 	sendLen += dataLen;
 	
 #ifdef CARD_ACCESS
-	/** APDUコマンドを実行する。*/
-	rv = CardTransmit(hCard, dwActiveProtocol, sendBuf, sendLen, rcvBuf, rcvLen);
+	/** 拡張APDUを受け付けないカードの場合、コマンド連鎖で実行する。*/
+	if (dataLen > 0xFF && extLenNG == CK_TRUE)
+	{
+		rv = CardTransmitChain(hCard, dwActiveProtocol, (CK_BYTE_PTR)UPD_BASE, data, dataLen, CK_FALSE, 0x00, rcvBuf, rcvLen);
+	}
+	else
+	{
+		/** APDUコマンドを実行する。*/
+		rcvBufLen = *rcvLen;
+		rv = CardTransmit(hCard, dwActiveProtocol, sendBuf, sendLen, rcvBuf, rcvLen);
+		/** 拡張APDUがLc誤り（67 00）となった場合、コマンド連鎖で再実行する。*/
+		if (rv == CKR_OK && dataLen > 0xFF && *rcvLen == 2 && rcvBuf[0] == 0x67 && rcvBuf[1] == 0x00)
+		{
+			extLenNG = CK_TRUE;
+			*rcvLen = rcvBufLen;
+			rv = CardTransmitChain(hCard, dwActiveProtocol, (CK_BYTE_PTR)UPD_BASE, data, dataLen, CK_FALSE, 0x00, rcvBuf, rcvLen);
+		}
+	}
 	/** 失敗の場合、*/
 	if (rv != CKR_OK)
 	{
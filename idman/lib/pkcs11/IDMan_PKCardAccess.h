@@ -63,6 +63,12 @@
 #define INT_BASE "\x00\x88\x00\x80"
 #define READ_BASE "\x00\xB0\x80\x00"
 #define UPD_BASE "\x00\xD6\x80\x00"
+#define GET_RESP_BASE "\x00\xC0\x00\x00"
+
+/* APDU連鎖定義 */
+#define CLA_CHAIN 0x10
+#define APDU_CHAIN_SIZE 255
+#define APDU_READ_SIZE 256
 
 /* EFタイプ定義 */
 #define EF_DIR 0
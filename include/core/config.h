@@ -34,6 +34,7 @@
 
 #define NUM_OF_STORAGE_KEYS 16
 #define NUM_OF_STORAGE_KEYS_CONF 16
+#define NUM_OF_NICPOLL_QUEUES_CONF 16
 #define STORAGE_GUID_NULL {0, 0, 0, {0, 0, 0 ,0 ,0, 0, 0, 0}}
 #define STORAGE_GUID_ANY {0xFFFFFFFF, 0xFFFF, 0xFFFF, \
 			  {0xFF, 0xFF, 0xFF ,0xFF ,0xFF, 0xFF, 0xFF, 0xFF}}
@@ -47,6 +48,7 @@ enum storage_type {
 	STORAGE_TYPE_USB,
 	STORAGE_TYPE_AHCI,
 	STORAGE_TYPE_AHCI_ATAPI,
+	STORAGE_TYPE_NVME,
 	STORAGE_TYPE_ANY = 0xFF,
 };
 
@@ -169,6 +171,12 @@ struct storage_keys_conf {
 	u8 keyindex;
 	u16 keybits;
 	char extend[256];
+	/* re-encryption from the old key to the key above */
+	char old_crypto_name[8];
+	u8 old_keyindex;
+	u16 old_keybits;
+	u32 rekey_devno;	/* storage_io device number */
+	u64 lba_rekey;		/* metadata and journal area, 0 if unused */
 } __attribute__ ((packed));
 
 struct config_data_storage {
@@ -190,6 +198,7 @@ struct config_data_vmm_driver_usb {
 
 struct config_data_vmm_driver {
 	int ata;
+	int ahci_vmm_tags;	/* NCQ tags reserved for the VMM */
 	struct config_data_vmm_driver_usb usb;
 	int concealEHCI;
 	int conceal1394;
@@ -211,6 +220,29 @@ struct config_data_vmm_tty_syslog {
 	u8 dst_ipaddr[4];
 };
 
+struct config_data_vmm_checkpoint {
+	int enable;
+	u32 devno;		/* storage_io device number */
+	u64 lba;		/* header sector followed by the page image */
+	u64 sectors;		/* size of the reserved area */
+	int interval;		/* seconds between checkpoints */
+} __attribute__ ((packed));
+
+struct config_data_vmm_panic_dump {
+	char device[16];	/* e.g. "ahci0:1" or "ata0:0" */
+	u64 lba;		/* header sector followed by the dump */
+	u64 sectors;		/* size of the reserved area */
+} __attribute__ ((packed));
+
+struct config_data_vmm_nicpoll {
+	int enable;
+	u32 apic_id;		/* processor dedicated to NIC polling */
+	int budget;		/* packets per queue per round */
+	int idle_rounds;	/* empty rounds before sleeping */
+	/* budget of each queue in registration order, 0 for budget */
+	int queue_budget[NUM_OF_NICPOLL_QUEUES_CONF];
+};
+
 struct config_data_ip {
 	u8 ipaddr[4];
 	u8 netmask[4];
@@ -239,6 +271,9 @@ struct config_data_vmm {
 	struct config_data_vmm_driver driver;
 	struct config_data_vmm_iccard iccard;
 	struct config_data_vmm_tty_syslog tty_syslog;
+	struct config_data_vmm_checkpoint checkpoint;
+	struct config_data_vmm_panic_dump panic_dump;
+	struct config_data_vmm_nicpoll nicpoll;
 };
 
 struct config_data {
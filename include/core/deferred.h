@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2007, 2008 University of Tsukuba
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the University of Tsukuba nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __CORE_DEFERRED_H
+#define __CORE_DEFERRED_H
+
+#include <core/types.h>
+
+/* deferred work (bottom halves).  a work scheduled with
+   deferred_schedule() runs on the same processor before the next VM
+   entry, or right away when the virtual CPU is about to halt.  a work
+   scheduled on a processor which does not run deferred work yet runs
+   on the next processor that does.  a work scheduled again while
+   pending runs only once */
+
+enum deferred_prio {
+	DEFERRED_PRIO_HIGH,
+	DEFERRED_PRIO_NORMAL,
+	DEFERRED_PRIO_LOW,
+	DEFERRED_NPRIO,
+};
+
+typedef void deferred_func_t (void *data);
+
+struct deferred;
+
+struct deferred *deferred_new (char *name, enum deferred_prio prio,
+			       deferred_func_t *func, void *data);
+void deferred_schedule (struct deferred *w);
+
+#endif
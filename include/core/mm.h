@@ -37,12 +37,21 @@
 #define MAPMEM_WRITE			0x4
 #define MAPMEM_PWT			0x8
 #define MAPMEM_PCD			0x10
+#define MAPMEM_WC			0x20
 #define MAPMEM_PAT			0x80
 
+#define MM_NODE_LOCAL			-1
+
 struct mempool;
 
 int alloc_pages (void **virt, u64 *phys, int n);
 int alloc_page (void **virt, u64 *phys);
+int alloc_pages_node (void **virt, u64 *phys, int n, int node);
+int alloc_page_node (void **virt, u64 *phys, int node);
+void *alloc_node (uint len, int node);
+void *alloc2_node (uint len, u64 *phys, int node);
+int mm_node_current (void);
+int mm_node_of_pci (u16 seg_group, u8 bus, u8 devfn);
 void free_page (void *virt);
 void free_page_phys (phys_t phys);
 void *alloc (uint len);
@@ -30,6 +30,15 @@
 #ifndef __CORE_PANIC_H
 #define __CORE_PANIC_H
 
+#include <core/types.h>
+
+/* nsec == 0 means flush cache */
+typedef bool panic_dump_write_t (void *data, int dev_no, u64 lba, void *buf,
+				 phys_t buf_phys, uint nsec);
+
+bool panic_dump_register (char *name, panic_dump_write_t *write, void *data,
+			  int dev_no);
+void panic_dump_unregister (void *data);
 void panic_test (void);
 void panic (char *format, ...)
 	__attribute__ ((format (printf, 1, 2), noreturn));
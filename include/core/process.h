@@ -30,11 +30,24 @@
 #ifndef __CORE_PROCESS_H
 #define __CORE_PROCESS_H
 
+#include <core/spinlock.h>
+
 enum msgcode {
 	MSG_INT,
 	MSG_BUF,
 };
 
+/* a descriptor opened by name once and re-resolved when the message
+   registry changes, e.g. after the service process is restarted */
+struct msgcache {
+	char *name;
+	int desc;
+	u32 gen;
+	spinlock_t lock;
+};
+
+#define MSGCACHE_INITIALIZER(name) { name, -1, 0, 0 }
+
 struct msgbuf {
 	void *base;
 	unsigned int len;
@@ -61,6 +74,7 @@ setmsgbuf (struct msgbuf *mbuf, void *base, unsigned int len, int rw)
 void *msgsetfunc (int desc, void *func);
 int msgregister (char *name, void *func);
 int msgopen (char *name);
+int msgcache_open (struct msgcache *c);
 int msgclose (int desc);
 int msgsendint (int desc, int data);
 int msgsenddesc (int desc, int data);
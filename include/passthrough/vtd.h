@@ -36,6 +36,8 @@ extern u8 iommu_detected;
 
 int parse_dmar_bios_report() ;
 void iommu_setup() ;
+void del_remap(int bus, int dev, int func) ;
+void attach_remap(int bus, int dev, int func) ;
 
 #define DRHD_STRUCT 0
 #define RMRR_STRUCT 1
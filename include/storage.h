@@ -52,6 +52,12 @@ struct storage_access {
 	int	rw;
 };
 
+/* a scatter-gather segment in the address space of the caller */
+struct storage_iovec {
+	void *base;
+	unsigned int len;
+};
+
 struct storage_extend {
 	char *name;		/* NULL means end of array */
 	char *value;
@@ -60,10 +66,15 @@ struct storage_extend {
 struct storage_device;
 
 int storage_handle_sectors(struct storage_device *device, struct storage_access *access, u8 *src, u8 *dst);
+int storage_handle_sectors_iov (struct storage_device *storage,
+				struct storage_access *access,
+				struct storage_iovec *src, int srccnt,
+				struct storage_iovec *dst, int dstcnt);
 struct storage_device *storage_new (int type, int host_id, int device_id,
 				    struct guid *guid,
 				    struct storage_extend *extend);
 void storage_free (struct storage_device *storage);
+void storage_rekey_poll (u64 now);
 void storage_init (struct config_data_storage *config_storage);
 long storage_premap_buf (void *buf, unsigned int len);
 int storage_premap_handle_sectors (struct storage_device *storage,
@@ -79,6 +79,7 @@ print_help (char *buf)
 	printf ("h value1(hex) value2(hex) : add/sub\n");
 	printf ("r [register-name register-value(hex)]: print/set guest registers\n");
 	printf ("n : get next guest state from log\n");
+	printf ("m : list message names\n");
 	printf ("! command : call external command\n");
 	printf ("q : quit\n");
 }
@@ -393,6 +394,19 @@ callprog (char *buf)
 		printf ("%s not found.\n", buf);
 }
 
+void
+msgnames (void)
+{
+	int d;
+
+	d = msgopen ("msgnames");
+	if (d >= 0) {
+		msgsendint (d, 0);
+		msgclose (d);
+	} else
+		printf ("msgnames not found.\n");
+}
+
 int
 _start (int a1, int a2)
 {
@@ -429,6 +443,9 @@ _start (int a1, int a2)
 		case 'n':
 			getnextstate ();
 			break;
+		case 'm':
+			msgnames ();
+			break;
 		case '!':
 			callprog (buf);
 			break;
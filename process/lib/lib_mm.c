@@ -39,6 +39,44 @@ extern int heap[], heaplen;	/* defined like: int heap[100], heaplen=100; */
 static int initialized = 0;
 static spinlock_t lock = 0;
 
+/* Small blocks come from slabs of per-size-class blocks, each class
+   with its own lock.  A slab is taken from the boundary-tag heap
+   below, which also serves large blocks, and is returned to it when
+   all of its blocks are freed.  Every block is preceded by a header
+   word telling which one it is; a small block header also tells
+   whether the block is free, its class and its index in the slab, so
+   that a double or bad free is caught. */
+#define HDR_MAGIC_MASK	0xFFF00000
+#define HDR_SMALL	0x6DA00000 /* | size class << 16 | index */
+#define HDR_SMALL_FREE	0x6DF00000 /* | size class << 16 | index */
+#define HDR_CLASS(hdr)	(((hdr) >> 16) & 0xF)
+#define HDR_INDEX(hdr)	((hdr) & 0xFFFF)
+#define HDR_BIG		0x6D6DFFFF
+#define SLAB_SIZE	4096
+
+static const unsigned int class_size[] = {
+	32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024,
+};
+#define NUM_OF_CLASS	(sizeof class_size / sizeof class_size[0])
+
+struct slab {
+	struct slab *next, *prev; /* slabs with free blocks */
+	void *freelist;
+	unsigned int nused;
+	int c;
+};
+
+static struct {
+	spinlock_t lock;
+	struct slab *partial;
+	unsigned int nused, nfree, nslab;
+} class[NUM_OF_CLASS];
+
+static struct {
+	unsigned int nalloc, nfree, maxwalk;
+	unsigned int used;	/* in ints */
+} heapstat;
+
 static void
 prepare (void)
 {
@@ -78,23 +116,55 @@ TST (char *msg)
 #endif
 }
 
-void *
-alloc (unsigned int size)
+/* Print allocator statistics when running out of memory.  Called
+   with the heap lock held; the class counters are read without their
+   locks since the caller may hold one of them. */
+static void
+heap_dump_stat (void)
+{
+	int i, *p, largest, total;
+
+	for (i = 0; i < NUM_OF_CLASS; i++)
+		if (class[i].nslab)
+			printf ("class %4u: used %u free %u slabs %u\n",
+				class_size[i], class[i].nused, class[i].nfree,
+				class[i].nslab);
+	largest = 0;
+	total = 0;
+	p = heap + heaplen - 1;
+	while (*p) {
+		if (*p < 0) {
+			total -= *p;
+			if (largest < -*p)
+				largest = -*p;
+			p += *p - 1;
+		} else {
+			p -= *p + 1;
+		}
+	}
+	printf ("heap: size %u used %u free %u largest free %u\n",
+		heaplen * (unsigned int)sizeof *p,
+		heapstat.used * (unsigned int)sizeof *p,
+		total * (unsigned int)sizeof *p,
+		largest * (unsigned int)sizeof *p);
+	printf ("heap: alloc %u free %u max walk %u\n", heapstat.nalloc,
+		heapstat.nfree, heapstat.maxwalk);
+}
+
+static int *
+heap_alloc (unsigned int size)
 {
 	int *p, len;
-	int total;
+	unsigned int walk = 0;
 
-	if (!size)
-		return NULL;
 	spinlock_lock (&lock);
 	if (!initialized)
 		prepare ();
 	TST ("alloc enter");
-	if (size < 32)
-		size = 32;
 	len = (size + sizeof (int) - 1) / sizeof (int);
 	p = heap + heaplen - 1;
 	while (*p) {
+		walk++;
 		if (*p < 0) {
 			if (-*p >= len)
 				goto found;
@@ -104,36 +174,30 @@ alloc (unsigned int size)
 		}
 	}
 	printf ("allocating %u\n", size);
-	total = 0;
-	p = heap + heaplen - 1;
-	while (*p) {
-		if (*p < 0) {
-			p += *p - 1;
-		} else {
-			total += *p + 1;
-			p -= *p + 1;
-		}
-	}
-	printf ("allocated %u\n", total * (unsigned int)sizeof (*p));
-	printf ("size of heap %u\n", heaplen * (unsigned int)sizeof (*p));
+	heap_dump_stat ();
 	panic ("out of memory");
 found:
 	if (-*p <= len + 1) {
 		*p = -*p;
-		p -= *p;
+		len = *p;
+		p -= len;
 	} else {
 		*p += len + 1;
 		p += *p - 1;
 		*p = len;
 		p -= len;
 	}
+	heapstat.nalloc++;
+	heapstat.used += len + 1;
+	if (heapstat.maxwalk < walk)
+		heapstat.maxwalk = walk;
 	TST ("alloc exit");
 	spinlock_unlock (&lock);
 	return p;
 }
 
-void
-free (void *m)
+static void
+heap_free (void *m)
 {
 	int *p, *q, len;
 
@@ -157,6 +221,8 @@ free (void *m)
 	}
 	panic ("freeing not allocated memory %p", m);
 found:
+	heapstat.nfree++;
+	heapstat.used -= *p + 1;
 	len = -*p;
 	while (p[len - 1] < 0)
 		len += p[len - 1] - 1;
@@ -171,10 +237,213 @@ found:
 	spinlock_unlock (&lock);
 }
 
+/* usable size of a block allocated by heap_alloc() */
+static unsigned int
+heap_size (void *m)
+{
+	int *p;
+	unsigned int r;
+
+	spinlock_lock (&lock);
+	p = heap + heaplen - 1;
+	while (*p) {
+		if (*p < 0)
+			p += *p - 1;
+		else if (p - *p == m)
+			goto found;
+		else
+			p -= *p + 1;
+	}
+	panic ("reallocating not allocated memory %p", m);
+found:
+	r = *p * sizeof *p;
+	spinlock_unlock (&lock);
+	return r;
+}
+
+static int
+size_to_class (unsigned int size)
+{
+	int i;
+
+	for (i = 0; i < NUM_OF_CLASS; i++)
+		if (size <= class_size[i])
+			return i;
+	return -1;
+}
+
+/* size of a small block with its header, in ints */
+static unsigned int
+class_blklen (int c)
+{
+	return 1 + class_size[c] / sizeof (int);
+}
+
+static unsigned int
+class_nblocks (int c)
+{
+	return (SLAB_SIZE - sizeof (struct slab)) / sizeof (int) /
+		class_blklen (c);
+}
+
+static void
+slab_link (struct slab *slab)
+{
+	int c = slab->c;
+
+	slab->prev = NULL;
+	slab->next = class[c].partial;
+	if (slab->next)
+		slab->next->prev = slab;
+	class[c].partial = slab;
+}
+
+static void
+slab_unlink (struct slab *slab)
+{
+	int c = slab->c;
+
+	if (slab->prev)
+		slab->prev->next = slab->next;
+	else
+		class[c].partial = slab->next;
+	if (slab->next)
+		slab->next->prev = slab->prev;
+}
+
+static struct slab *
+slab_new (int c)
+{
+	struct slab *slab;
+	int *p, *base;
+	unsigned int blklen, n, i;
+
+	slab = (struct slab *)heap_alloc (SLAB_SIZE);
+	slab->freelist = NULL;
+	slab->nused = 0;
+	slab->c = c;
+	base = (int *)(slab + 1);
+	blklen = class_blklen (c);
+	n = class_nblocks (c);
+	for (i = n; i-- > 0;) {
+		p = base + i * blklen;
+		*p = HDR_SMALL_FREE | c << 16 | i;
+		*(void **)(p + 1) = slab->freelist;
+		slab->freelist = p + 1;
+	}
+	class[c].nfree += n;
+	class[c].nslab++;
+	slab_link (slab);
+	return slab;
+}
+
+static void *
+class_alloc (int c)
+{
+	struct slab *slab;
+	int *p;
+
+	spinlock_lock (&class[c].lock);
+	slab = class[c].partial;
+	if (!slab)
+		slab = slab_new (c);
+	p = slab->freelist;
+	slab->freelist = *(void **)p;
+	if (!slab->freelist)
+		slab_unlink (slab);
+	slab->nused++;
+	p[-1] = HDR_SMALL | HDR_CLASS (p[-1]) << 16 | HDR_INDEX (p[-1]);
+	class[c].nfree--;
+	class[c].nused++;
+	spinlock_unlock (&class[c].lock);
+	return p;
+}
+
+/* An empty slab is returned to the heap unless it is the only one
+   with free blocks, so that a block allocated and freed repeatedly
+   does not take and return a slab every time. */
+static void
+class_free (int c, void *m)
+{
+	struct slab *slab;
+	int *p = m, *base;
+
+	base = p - 1 - HDR_INDEX (p[-1]) * class_blklen (c);
+	slab = (struct slab *)base - 1;
+	spinlock_lock (&class[c].lock);
+	if (slab->c != c || (p[-1] & HDR_MAGIC_MASK) != HDR_SMALL)
+		panic ("freeing not allocated memory %p", m);
+	p[-1] = HDR_SMALL_FREE | c << 16 | HDR_INDEX (p[-1]);
+	if (!slab->freelist)
+		slab_link (slab);
+	*(void **)m = slab->freelist;
+	slab->freelist = m;
+	slab->nused--;
+	class[c].nfree++;
+	class[c].nused--;
+	if (!slab->nused && (slab->next || slab->prev)) {
+		slab_unlink (slab);
+		class[c].nfree -= class_nblocks (c);
+		class[c].nslab--;
+		spinlock_unlock (&class[c].lock);
+		heap_free (slab);
+		return;
+	}
+	spinlock_unlock (&class[c].lock);
+}
+
+/* returns the size class, -1 for a large block */
+static int
+block_class (void *m)
+{
+	int hdr, c;
+
+	if (!m)
+		panic ("freeing not allocated memory %p", m);
+	hdr = ((int *)m)[-1];
+	if (hdr == HDR_BIG)
+		return -1;
+	c = HDR_CLASS (hdr);
+	if ((hdr & HDR_MAGIC_MASK) == HDR_SMALL_FREE && c < NUM_OF_CLASS)
+		panic ("freeing free memory %p", m);
+	if ((hdr & HDR_MAGIC_MASK) != HDR_SMALL || c >= NUM_OF_CLASS ||
+	    HDR_INDEX (hdr) >= class_nblocks (c))
+		panic ("freeing not allocated memory %p", m);
+	return c;
+}
+
+void *
+alloc (unsigned int size)
+{
+	int c, *p;
+
+	if (!size)
+		return NULL;
+	c = size_to_class (size);
+	if (c >= 0)
+		return class_alloc (c);
+	p = heap_alloc (size + sizeof *p);
+	*p = HDR_BIG;
+	return p + 1;
+}
+
+void
+free (void *m)
+{
+	int c;
+
+	c = block_class (m);
+	if (c >= 0)
+		class_free (c, m);
+	else
+		heap_free ((int *)m - 1);
+}
+
 void *
 realloc (void *virt, unsigned int len)
 {
-	int *p, alloclen, copylen;
+	int c;
+	unsigned int alloclen, copylen;
 	void *r;
 
 	if (!virt && !len)
@@ -185,25 +454,14 @@ realloc (void *virt, unsigned int len)
 		free (virt);
 		return NULL;
 	}
-	spinlock_lock (&lock);
-	if (!initialized)
-		prepare ();
-	TST ("realloc enter");
-	if (len < 32)
-		len = 32;
-	p = heap + heaplen - 1;
-	while (*p) {
-		if (*p < 0)
-			p += *p - 1;
-		else if (p - *p == virt)
-			goto found;
-		else
-			p -= *p + 1;
+	c = block_class (virt);
+	if (c >= 0) {
+		if (size_to_class (len) == c)
+			return virt;
+		alloclen = class_size[c];
+	} else {
+		alloclen = heap_size ((int *)virt - 1) - sizeof (int);
 	}
-	panic ("reallocating not allocated memory %p", virt);
-found:
-	alloclen = *p * sizeof *p;
-	spinlock_unlock (&lock);
 	if (alloclen > len)
 		copylen = len;
 	else
@@ -213,6 +471,5 @@ found:
 		memcpy (r, virt, copylen);
 		free (virt);
 	}
-	TST ("realloc exit");
 	return r;
 }
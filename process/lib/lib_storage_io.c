@@ -206,3 +206,30 @@ storage_io_awrite (int id, int devno, void *buf, int len, long long offset,
 	callsub (STORAGE_IO_AREADWRITE, mbuf, 2);
 	return arg.retval;
 }
+
+int
+storage_io_aflush (int id, int devno, void (*callback) (void *data, int len),
+		   void *data)
+{
+	struct storage_io_msg_areadwrite arg;
+	struct msgbuf mbuf[1];
+
+	arg.id = id;
+	arg.devno = devno;
+	arg.write = 1;
+	arg.callback = callback;
+	arg.data = data;
+	arg.buf = 0;
+	arg.len = 0;
+	if (!registered) {
+		rdesc = msgregister ("lib_storage_io",
+				    lib_storage_io_msghandler);
+		if (rdesc < 0)
+			return -1;
+		registered = 1;
+	}
+	memcpy (arg.msgname, "lib_storage_io", 15);
+	setmsgbuf (&mbuf[0], &arg, sizeof arg, 1);
+	callsub (STORAGE_IO_AFLUSH, mbuf, 1);
+	return arg.retval;
+}
@@ -32,7 +32,7 @@
 #include <lib_string.h>
 #include <lib_syscalls.h>
 
-int heap[4096], heaplen = 4096;
+int heap[65536], heaplen = 65536;
 
 int
 _start (int m, int c, struct msgbuf *buf, int bufcnt)
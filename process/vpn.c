@@ -62,6 +62,14 @@ vpn_GetTickCount (void)
 	return msg_vpn_GetTickCount ();
 }
 
+void
+vpn_GetRandom (void *buf, unsigned int size)
+{
+	void msg_vpn_GetRandom (void *buf, unsigned int size);
+
+	msg_vpn_GetRandom (buf, size);
+}
+
 void
 vpn_GetPhysicalNicInfo (void *nic_handle, void *info)
 {
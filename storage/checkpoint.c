@@ -0,0 +1,262 @@
+/*
+ * Copyright (c) 2007, 2008 University of Tsukuba
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the University of Tsukuba nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* incremental guest memory checkpoint.  the reserved area starts
+   with a header sector followed by an image of the guest physical
+   memory, one page every CHECKPOINT_PAGE_SECTORS sectors, so every
+   checkpoint after the first writes only the pages dirtied since
+   the previous harvest.  the guest keeps running while pages are
+   copied, so the image is consistent only for pages that are not
+   written during the copy; those are written again next time. */
+
+#include <core.h>
+#include <core/dirtylog.h>
+#include <core/time.h>
+#include <core/timer.h>
+#include "storage_io_msg.h"
+
+#define CHECKPOINT_MAGIC	0x544E504B48434256ULL /* "VBCHKPNT" */
+#define CHECKPOINT_SECTOR_SIZE	512
+#define CHECKPOINT_PAGE_SECTORS	(PAGESIZE / CHECKPOINT_SECTOR_SIZE)
+#define CHECKPOINT_BATCH	16 /* pages per write */
+#define CHECKPOINT_POLL_USEC	10000
+
+enum checkpoint_state {
+	CHECKPOINT_IDLE,
+	CHECKPOINT_HARVEST,
+	CHECKPOINT_BEGIN,
+	CHECKPOINT_COPY,
+	CHECKPOINT_END,
+};
+
+struct checkpoint_header {
+	u64 magic;
+	u64 npages;		/* pages in the image */
+	u32 epoch;		/* number of completed checkpoints */
+	u32 complete;		/* 0 while pages are being written */
+	u64 pages;		/* pages written by the last checkpoint */
+	u64 usec;		/* time taken by the last checkpoint */
+	u8 pad[CHECKPOINT_SECTOR_SIZE - 40];
+};
+
+static struct {
+	enum checkpoint_state state;
+	bool busy;
+	int io_id;
+	u32 epoch;
+	u64 npages;
+	u64 pfn, count;		/* pages in buf */
+	u64 pending;		/* dirty page found after a batch, or npages */
+	u64 start, pages;
+	struct checkpoint_header *header;
+	u8 *buf;
+} checkpoint;
+
+static void checkpoint_next (void);
+
+static void
+checkpoint_fail (char *msg)
+{
+	printf ("checkpoint: %s\n", msg);
+	if (checkpoint.count)
+		dirtylog_mark (checkpoint.pfn << PAGESHIFT,
+			       checkpoint.count * PAGESIZE);
+	if (checkpoint.pending < checkpoint.npages)
+		dirtylog_mark (checkpoint.pending << PAGESHIFT,
+			       PAGESIZE);
+	/* the remaining bits of the harvest are returned by a later
+	   one */
+	checkpoint.count = 0;
+	checkpoint.state = CHECKPOINT_IDLE;
+	checkpoint.io_id = 0;
+}
+
+static void
+checkpoint_done (void *data, int len)
+{
+	checkpoint.busy = false;
+	if (len < 0) {
+		checkpoint_fail ("write error");
+		return;
+	}
+	checkpoint.pages += checkpoint.count;
+	checkpoint.count = 0;
+	checkpoint_next ();
+}
+
+static void
+checkpoint_write (void *buf, int count, u64 lba)
+{
+	checkpoint.busy = true;
+	if (storage_io_awrite (checkpoint.io_id, config.vmm.checkpoint.devno,
+			       buf, count * CHECKPOINT_SECTOR_SIZE,
+			       (config.vmm.checkpoint.lba + lba) *
+			       CHECKPOINT_SECTOR_SIZE, checkpoint_done,
+			       NULL) < 0) {
+		checkpoint.busy = false;
+		checkpoint_fail ("cannot write");
+	}
+}
+
+static void
+checkpoint_header (bool complete)
+{
+	struct checkpoint_header *h = checkpoint.header;
+
+	memset (h, 0, sizeof *h);
+	h->magic = CHECKPOINT_MAGIC;
+	h->npages = checkpoint.npages;
+	h->epoch = checkpoint.epoch;
+	h->complete = complete;
+	h->pages = checkpoint.pages;
+	h->usec = get_time () - checkpoint.start;
+	checkpoint_write (h, 1, 0);
+}
+
+/* fill the buffer with a run of contiguous dirty pages */
+static void
+checkpoint_copy (void)
+{
+	u64 pfn;
+	void *p;
+
+	pfn = checkpoint.pending;
+	checkpoint.pfn = pfn;
+	checkpoint.count = 0;
+	while (pfn < checkpoint.npages) {
+		p = mapmem_gphys (pfn << PAGESHIFT, PAGESIZE, 0);
+		memcpy (checkpoint.buf + checkpoint.count * PAGESIZE, p,
+			PAGESIZE);
+		unmapmem (p, PAGESIZE);
+		checkpoint.count++;
+		pfn = dirtylog_next (pfn + 1);
+		if (pfn != checkpoint.pfn + checkpoint.count ||
+		    checkpoint.count == CHECKPOINT_BATCH)
+			break;
+	}
+	checkpoint.pending = pfn;
+}
+
+static void
+checkpoint_next (void)
+{
+	switch (checkpoint.state) {
+	case CHECKPOINT_IDLE:
+	case CHECKPOINT_HARVEST:
+		break;
+	case CHECKPOINT_BEGIN:
+		checkpoint.state = CHECKPOINT_COPY;
+		checkpoint.pending = dirtylog_next (0);
+		/* fall through */
+	case CHECKPOINT_COPY:
+		if (checkpoint.pending < checkpoint.npages) {
+			checkpoint_copy ();
+			checkpoint_write (checkpoint.buf, checkpoint.count *
+					  CHECKPOINT_PAGE_SECTORS, 1 +
+					  checkpoint.pfn *
+					  CHECKPOINT_PAGE_SECTORS);
+			break;
+		}
+		checkpoint.state = CHECKPOINT_END;
+		checkpoint.epoch++;
+		checkpoint_header (true);
+		break;
+	case CHECKPOINT_END:
+		checkpoint.state = CHECKPOINT_IDLE;
+		break;
+	}
+}
+
+static void
+checkpoint_start (u64 now)
+{
+	checkpoint.start = now;
+	if (!checkpoint.io_id) {
+		checkpoint.io_id = storage_io_init ();
+		storage_io_get_num_devices (checkpoint.io_id);
+	}
+	if (!dirtylog_start ()) {
+		printf ("checkpoint: dirty logging is not available\n");
+		return;
+	}
+	checkpoint.npages = dirtylog_npages ();
+	if (1 + checkpoint.npages * CHECKPOINT_PAGE_SECTORS >
+	    config.vmm.checkpoint.sectors) {
+		printf ("checkpoint: %llu sectors needed\n",
+			1 + checkpoint.npages * CHECKPOINT_PAGE_SECTORS);
+		dirtylog_stop ();
+		return;
+	}
+	checkpoint.pages = 0;
+	checkpoint.pending = checkpoint.npages;
+	dirtylog_harvest ();
+	checkpoint.state = CHECKPOINT_HARVEST;
+}
+
+static void
+checkpoint_timer (void *handle, void *data)
+{
+	u64 now, interval;
+
+	now = get_time ();
+	interval = config.vmm.checkpoint.interval * 1000000ULL;
+	if (checkpoint.busy)
+		;
+	else if (checkpoint.state == CHECKPOINT_IDLE) {
+		if (now - checkpoint.start >= interval)
+			checkpoint_start (now);
+	} else if (checkpoint.state == CHECKPOINT_HARVEST &&
+		   dirtylog_harvested ()) {
+		checkpoint.state = CHECKPOINT_BEGIN;
+		checkpoint_header (false);
+	}
+	if (checkpoint.state == CHECKPOINT_IDLE && !checkpoint.busy)
+		timer_set (handle, checkpoint.start + interval - now);
+	else
+		timer_set (handle, CHECKPOINT_POLL_USEC);
+}
+
+static void
+checkpoint_init (void)
+{
+	void *handle;
+
+	if (!config.vmm.checkpoint.enable)
+		return;
+	if (config.vmm.checkpoint.interval <= 0)
+		config.vmm.checkpoint.interval = 60;
+	checkpoint.state = CHECKPOINT_IDLE;
+	checkpoint.start = get_time ();
+	checkpoint.header = alloc (sizeof *checkpoint.header);
+	checkpoint.buf = alloc (CHECKPOINT_BATCH * PAGESIZE);
+	handle = timer_new (checkpoint_timer, NULL);
+	timer_set (handle, config.vmm.checkpoint.interval * 1000000ULL);
+}
+
+INITFUNC ("driver1", checkpoint_init);
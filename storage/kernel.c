@@ -29,10 +29,14 @@
 
 #include <core.h>
 #include <core/process.h>
+#include <core/time.h>
+#include <core/timer.h>
 #include <storage.h>
 #include "lib/storage_msg.h"
 
-static int desc;
+#define STORAGE_REKEY_POLL_USEC	10000
+
+static struct msgcache storage_msg = MSGCACHE_INITIALIZER ("storage");
 
 #ifdef STORAGE_PD
 
@@ -41,10 +45,11 @@ static struct mempool *mp;
 static void
 callsub (int c, struct msgbuf *buf, int bufcnt)
 {
-	int r;
+	int d, r;
 
 	for (;;) {
-		r = msgsendbuf (desc, c, buf, bufcnt);
+		d = msgcache_open (&storage_msg);
+		r = d >= 0 ? msgsendbuf (d, c, buf, bufcnt) : -1;
 		if (r == 0)
 			break;
 		panic ("msgsendbuf failed");
@@ -146,6 +151,79 @@ storage_handle_sectors (struct storage_device *storage,
 	return _storage_handle_sectors (storage, access, src, dst, 0, 0);
 }
 
+/* too many segments for one message are gathered into a bounce
+   buffer */
+static int
+storage_handle_sectors_bounce (struct storage_device *storage,
+			       struct storage_access *access,
+			       struct storage_iovec *src, int srccnt,
+			       struct storage_iovec *dst, int dstcnt)
+{
+	unsigned int size, n, off;
+	u8 *tmp;
+	int i, ret;
+
+	size = access->count * access->sector_size;
+	tmp = alloc (size);
+	for (i = 0, off = 0; i < srccnt && off < size; i++, off += n) {
+		n = min (src[i].len, size - off);
+		memcpy (tmp + off, src[i].base, n);
+	}
+	if (off < size) {
+		free (tmp);
+		return -1;
+	}
+	ret = _storage_handle_sectors (storage, access, tmp, tmp, 0, 0);
+	for (i = 0, off = 0; i < dstcnt && off < size; i++, off += n) {
+		n = min (dst[i].len, size - off);
+		memcpy (dst[i].base, tmp + off, n);
+	}
+	free (tmp);
+	return ret;
+}
+
+int
+storage_handle_sectors_iov (struct storage_device *storage,
+			    struct storage_access *access,
+			    struct storage_iovec *src, int srccnt,
+			    struct storage_iovec *dst, int dstcnt)
+{
+	struct storage_msg_handle_sectors_iov *arg;
+	struct msgbuf buf[STORAGE_MSG_MAXBUF];
+	int i, ret;
+
+	if (1 + srccnt + dstcnt > STORAGE_MSG_MAXBUF)
+		return storage_handle_sectors_bounce (storage, access, src,
+						      srccnt, dst, dstcnt);
+	arg = mempool_allocmem (mp, sizeof *arg);
+	arg->storage = storage;
+	memcpy (&arg->access, access, sizeof arg->access);
+	arg->srccnt = srccnt;
+	arg->dstcnt = dstcnt;
+	setmsgbuf (&buf[0], arg, sizeof *arg, 1);
+	for (i = 0; i < srccnt; i++)
+		setmsgbuf (&buf[1 + i], src[i].base, src[i].len, 0);
+	for (i = 0; i < dstcnt; i++)
+		setmsgbuf (&buf[1 + srccnt + i], dst[i].base, dst[i].len, 1);
+	callsub (STORAGE_MSG_HANDLE_SECTORS_IOV, buf, 1 + srccnt + dstcnt);
+	ret = arg->retval;
+	mempool_freemem (mp, arg);
+	return ret;
+}
+
+void
+storage_rekey_poll (u64 now)
+{
+	struct storage_msg_rekey_poll *arg;
+	struct msgbuf buf[1];
+
+	arg = mempool_allocmem (mp, sizeof *arg);
+	arg->now = now;
+	setmsgbuf (&buf[0], arg, sizeof *arg, 1);
+	callsub (STORAGE_MSG_REKEY_POLL, buf, 1);
+	mempool_freemem (mp, arg);
+}
+
 void
 storage_init (struct config_data_storage *config_storage)
 {
@@ -181,7 +259,7 @@ storage_premap_buf (void *buf, unsigned int len)
 	struct msgbuf mbuf;
 
 	setmsgbuf (&mbuf, buf, len, 1);
-	return msgpremapbuf (desc, &mbuf);
+	return msgpremapbuf (msgcache_open (&storage_msg), &mbuf);
 #endif /* STORAGE_PD */
 	return 0;
 }
@@ -198,13 +276,29 @@ storage_premap_handle_sectors (struct storage_device *storage,
 	return storage_handle_sectors (storage, access, src, dst);
 }
 
+static void
+storage_kernel_rekey_timer (void *handle, void *data)
+{
+	storage_rekey_poll (get_time ());
+	timer_set (handle, STORAGE_REKEY_POLL_USEC);
+}
+
 static void
 storage_kernel_init (void)
 {
+	int i;
+	void *handle;
+
 	storage_init (&config.storage);
-	desc = msgopen ("storage");
-	if (desc < 0)
+	if (msgcache_open (&storage_msg) < 0)
 		panic ("open storage");
+	for (i = 0; i < NUM_OF_STORAGE_KEYS_CONF; i++) {
+		if (config.storage.keys_conf[i].lba_rekey) {
+			handle = timer_new (storage_kernel_rekey_timer, NULL);
+			timer_set (handle, STORAGE_REKEY_POLL_USEC);
+			break;
+		}
+	}
 }
 
 INITFUNC ("driver1", storage_kernel_init);
@@ -34,6 +34,7 @@
 #include <token.h>
 #include "storage_msg.h"
 #include "crypto/crypto.h"
+#include "../storage_io_msg.h"
 
 /*
   FIXME: The key should be erased from memory before shutdown.
@@ -45,10 +46,86 @@ static struct guid anyguid = STORAGE_GUID_ANY;
 static struct config_data_storage *cfg;
 static int storage_desc;
 
+/* Re-encryption of a key range.  Sectors below the watermark use
+   the new key and the others use the old key.  The engine moves the
+   watermark one chunk at a time: it reads the chunk, saves the old
+   ciphertext in the journal, records the chunk in the metadata
+   sector, writes the chunk back with the new key and then stores the
+   new watermark, flushing the drive cache after each of the writes.
+   Guest writes to the chunk are merged into the plaintext copy, so
+   that the write-back never loses them.  They keep the old key until
+   the metadata sector naming the chunk is on the media and use the
+   new key after that; a sector of the chunk that equals the journal
+   has the old key.  If the guest writes to the chunk with the old key
+   after the journal was made, the chunk is journaled again before the
+   metadata is written.  Guest writes to the chunk fail while the
+   metadata write is in flight: the metadata may reach the media at
+   any time, and neither key would be right for both outcomes.  The
+   window is one write and one cache flush.  They also fail while the
+   write-back of the chunk is in flight, because the drive may
+   execute it after the guest write and a crash would leave the stale
+   sector.  The host controller drivers issue a storage_io command
+   only after the guest commands accessing the same sectors have
+   completed.
+
+   The key of a sector is unknown until the metadata sector has been
+   read, so guest reads and writes of the range fail until then.  A
+   write that was remembered and fixed up later would be lost by a
+   crash before the fixup. */
+#define REKEY_SECTOR_SIZE	512
+#define REKEY_CHUNK		128	/* sectors per step */
+#define REKEY_MAGIC		0x59454B4552564221ULL
+#define REKEY_IDLE_USEC		50000	/* guest idle time before a step */
+#define REKEY_BUSY_USEC		1000000	/* max delay under guest load */
+
+enum storage_rekey_state {
+	REKEY_LOAD,
+	REKEY_RECOVER,
+	REKEY_RECOVER_JOURNAL,
+	REKEY_IDLE,
+	REKEY_READ,
+	REKEY_JOURNAL,
+	REKEY_META,
+	REKEY_WRITE,
+	REKEY_COMMIT,
+	REKEY_DONE,
+};
+
+struct storage_rekey_meta {
+	u64 magic;
+	u64 lba_low, lba_high;
+	u64 mark;
+	u64 hot_lba;
+	u32 hot_count;		/* 0 if no chunk is in progress */
+} __attribute__ ((packed));
+
+struct storage_rekey {
+	spinlock_t	lock;
+	enum storage_rekey_state state;
+	bool		busy;	/* storage_io command in flight */
+	bool		flush;	/* cache flush after the write pending */
+	bool		loaded;	/* mark is valid */
+	bool		refused; /* sector size message printed */
+	lba_t		lba_low, lba_high, lba_meta;
+	lba_t		mark;
+	lba_t		hot_lba;
+	int		hot_count;
+	bool		published; /* guest writes to the chunk use new key */
+	bool		conflict;
+	u8		guestmap[REKEY_CHUNK / 8];
+	struct crypto	*crypto, *old_crypto;
+	void		*keyctx, *old_keyctx;
+	int		devno;
+	u8		*plain, *buf;
+	struct storage_rekey_meta *meta;
+	u64		last_io, last_step;
+};
+
 struct storage_keys {
 	lba_t		lba_low, lba_high;
 	struct crypto	*crypto;
 	void		*keyctx;
+	struct storage_rekey *rekey;
 };
 
 typedef	union {
@@ -128,6 +205,507 @@ storage_match_extend (struct storage_init *init,
 	return 1;
 }
 
+static int rekey_io_id;
+static u64 rekey_now;
+static struct storage_rekey *rekey_conf[NUM_OF_STORAGE_KEYS_CONF];
+
+static void storage_rekey_done (void *data, int len);
+
+static bool
+rekey_testbit (u8 *map, int i)
+{
+	return !!(map[i >> 3] & (1 << (i & 7)));
+}
+
+static void
+rekey_setbit (u8 *map, int i)
+{
+	map[i >> 3] |= 1 << (i & 7);
+}
+
+static void
+storage_rekey_io (struct storage_rekey *rekey, bool wr, void *buf,
+		  int count, lba_t lba)
+{
+	int r;
+
+	/* storage_io_get_num_devices() reopens every device and it
+	   finds nothing before the guest starts the host controller,
+	   so enumerate again until the metadata sector has been read */
+	if (!rekey_io_id) {
+		rekey_io_id = storage_io_init ();
+		storage_io_get_num_devices (rekey_io_id);
+	}
+	rekey->busy = true;
+	if (wr)
+		r = storage_io_awrite (rekey_io_id, rekey->devno, buf,
+				       count * REKEY_SECTOR_SIZE,
+				       lba * REKEY_SECTOR_SIZE,
+				       storage_rekey_done, rekey);
+	else
+		r = storage_io_aread (rekey_io_id, rekey->devno, buf,
+				      count * REKEY_SECTOR_SIZE,
+				      lba * REKEY_SECTOR_SIZE,
+				      storage_rekey_done, rekey);
+	if (r < 0) {
+		/* retried on the next tick */
+		rekey->busy = false;
+		if (!rekey->loaded)
+			rekey_io_id = 0;
+	}
+}
+
+static void
+storage_rekey_flush (struct storage_rekey *rekey)
+{
+	rekey->busy = true;
+	if (storage_io_aflush (rekey_io_id, rekey->devno, storage_rekey_done,
+			       rekey) < 0)
+		rekey->busy = false; /* retried on the next tick */
+}
+
+static void
+storage_rekey_setmeta (struct storage_rekey *rekey, lba_t mark,
+		       int hot_count)
+{
+	struct storage_rekey_meta *meta = rekey->meta;
+
+	meta->magic = REKEY_MAGIC;
+	meta->lba_low = rekey->lba_low;
+	meta->lba_high = rekey->lba_high;
+	meta->mark = mark;
+	meta->hot_lba = rekey->hot_lba;
+	meta->hot_count = hot_count;
+}
+
+static void
+storage_rekey_encrypt (struct storage_rekey *rekey, struct crypto *crypto,
+		       void *keyctx)
+{
+	int i;
+	u8 *p, *q;
+
+	p = rekey->plain;
+	q = rekey->buf;
+	for (i = 0; i < rekey->hot_count; i++) {
+		crypto->encrypt (q, p, keyctx, rekey->hot_lba + i,
+				 REKEY_SECTOR_SIZE);
+		p += REKEY_SECTOR_SIZE;
+		q += REKEY_SECTOR_SIZE;
+	}
+}
+
+/* issue the command for the current state */
+static void
+storage_rekey_next (struct storage_rekey *rekey)
+{
+	if (rekey->flush) {
+		storage_rekey_flush (rekey);
+		return;
+	}
+	switch (rekey->state) {
+	case REKEY_LOAD:
+		storage_rekey_io (rekey, false, rekey->meta, 1,
+				  rekey->lba_meta);
+		break;
+	case REKEY_RECOVER:
+		spinlock_lock (&rekey->lock);
+		rekey->conflict = false;
+		spinlock_unlock (&rekey->lock);
+		storage_rekey_io (rekey, false, rekey->buf, rekey->hot_count,
+				  rekey->hot_lba);
+		break;
+	case REKEY_RECOVER_JOURNAL:
+		storage_rekey_io (rekey, false, rekey->plain,
+				  rekey->hot_count, rekey->lba_meta + 1);
+		break;
+	case REKEY_READ:
+		storage_rekey_io (rekey, false, rekey->buf, rekey->hot_count,
+				  rekey->hot_lba);
+		break;
+	case REKEY_JOURNAL:
+		/* the encryption is deterministic, so this is what the
+		   disk has for the sectors with the old key */
+		spinlock_lock (&rekey->lock);
+		rekey->conflict = false;
+		storage_rekey_encrypt (rekey, rekey->old_crypto,
+				       rekey->old_keyctx);
+		spinlock_unlock (&rekey->lock);
+		storage_rekey_io (rekey, true, rekey->buf, rekey->hot_count,
+				  rekey->lba_meta + 1);
+		break;
+	case REKEY_META:
+		storage_rekey_setmeta (rekey, rekey->mark, rekey->hot_count);
+		storage_rekey_io (rekey, true, rekey->meta, 1,
+				  rekey->lba_meta);
+		break;
+	case REKEY_WRITE:
+		spinlock_lock (&rekey->lock);
+		rekey->conflict = false;
+		storage_rekey_encrypt (rekey, rekey->crypto, rekey->keyctx);
+		spinlock_unlock (&rekey->lock);
+		storage_rekey_io (rekey, true, rekey->buf, rekey->hot_count,
+				  rekey->hot_lba);
+		break;
+	case REKEY_COMMIT:
+		storage_rekey_setmeta (rekey, rekey->hot_lba +
+				       rekey->hot_count, 0);
+		storage_rekey_io (rekey, true, rekey->meta, 1,
+				  rekey->lba_meta);
+		break;
+	case REKEY_IDLE:
+	case REKEY_DONE:
+		break;
+	}
+}
+
+static void
+storage_rekey_loaded (struct storage_rekey *rekey)
+{
+	struct storage_rekey_meta *meta = rekey->meta;
+	bool valid;
+
+	valid = meta->magic == REKEY_MAGIC &&
+		meta->lba_low == rekey->lba_low &&
+		meta->lba_high == rekey->lba_high;
+	spinlock_lock (&rekey->lock);
+	rekey->mark = valid ? meta->mark : rekey->lba_low;
+	if (valid && meta->hot_count && meta->hot_count <= REKEY_CHUNK &&
+	    meta->hot_lba >= rekey->lba_low && meta->hot_lba <= meta->mark) {
+		rekey->hot_lba = meta->hot_lba;
+		rekey->hot_count = meta->hot_count;
+		rekey->state = REKEY_RECOVER;
+		spinlock_unlock (&rekey->lock);
+		printf ("storage: resuming re-encryption at LBA 0x%llX\n",
+			rekey->mark);
+		return;
+	}
+	rekey->loaded = true;
+	rekey->state = rekey->mark > rekey->lba_high ? REKEY_DONE :
+		REKEY_IDLE;
+	spinlock_unlock (&rekey->lock);
+}
+
+/* The chunk was interrupted.  A sector that differs from the
+   journal has already been written with the new key.  The chunk is
+   journaled again before the write-back. */
+static void
+storage_rekey_recovered (struct storage_rekey *rekey)
+{
+	int i;
+	u8 *p, *q;
+	lba_t lba;
+
+	spinlock_lock (&rekey->lock);
+	if (rekey->conflict) {
+		/* the guest wrote to the chunk after it was read */
+		rekey->state = REKEY_RECOVER;
+		spinlock_unlock (&rekey->lock);
+		return;
+	}
+	p = rekey->plain;
+	q = rekey->buf;
+	for (i = 0; i < rekey->hot_count; i++) {
+		lba = rekey->hot_lba + i;
+		if (memcmp (p, q, REKEY_SECTOR_SIZE))
+			rekey->crypto->decrypt (p, q, rekey->keyctx, lba,
+						REKEY_SECTOR_SIZE);
+		else
+			rekey->old_crypto->decrypt (p, q, rekey->old_keyctx,
+						    lba, REKEY_SECTOR_SIZE);
+		p += REKEY_SECTOR_SIZE;
+		q += REKEY_SECTOR_SIZE;
+	}
+	memset (rekey->guestmap, 0, sizeof rekey->guestmap);
+	rekey->published = true;
+	rekey->loaded = true;
+	rekey->state = REKEY_JOURNAL;
+	spinlock_unlock (&rekey->lock);
+}
+
+static void
+storage_rekey_read (struct storage_rekey *rekey)
+{
+	int i;
+	u8 *p, *q;
+
+	spinlock_lock (&rekey->lock);
+	p = rekey->plain;
+	q = rekey->buf;
+	for (i = 0; i < rekey->hot_count; i++) {
+		if (!rekey_testbit (rekey->guestmap, i))
+			rekey->old_crypto->decrypt (p, q, rekey->old_keyctx,
+						    rekey->hot_lba + i,
+						    REKEY_SECTOR_SIZE);
+		p += REKEY_SECTOR_SIZE;
+		q += REKEY_SECTOR_SIZE;
+	}
+	rekey->state = REKEY_JOURNAL;
+	spinlock_unlock (&rekey->lock);
+}
+
+/* the write of the current state is on the media */
+static void
+storage_rekey_flushed (struct storage_rekey *rekey)
+{
+	switch (rekey->state) {
+	case REKEY_JOURNAL:
+		/* journal again if the guest wrote to the chunk with the
+		   old key meanwhile.  once the metadata names the chunk
+		   (after recovery), guest writes use the new key and
+		   differ from the journal anyway. */
+		spinlock_lock (&rekey->lock);
+		if (rekey->published || !rekey->conflict)
+			rekey->state = REKEY_META;
+		spinlock_unlock (&rekey->lock);
+		break;
+	case REKEY_META:
+		/* the metadata names the chunk, so guest writes to it
+		   switch to the new key now */
+		spinlock_lock (&rekey->lock);
+		rekey->published = true;
+		rekey->state = REKEY_WRITE;
+		spinlock_unlock (&rekey->lock);
+		break;
+	case REKEY_WRITE:
+		rekey->state = REKEY_COMMIT;
+		break;
+	case REKEY_COMMIT:
+		spinlock_lock (&rekey->lock);
+		rekey->mark = rekey->hot_lba + rekey->hot_count;
+		rekey->hot_count = 0;
+		rekey->published = false;
+		rekey->state = rekey->mark > rekey->lba_high ? REKEY_DONE :
+			REKEY_IDLE;
+		spinlock_unlock (&rekey->lock);
+		rekey->last_step = rekey_now;
+		if (rekey->state == REKEY_DONE)
+			printf ("storage: re-encryption of LBA 0x%llX-0x%llX"
+				" completed\n", rekey->lba_low,
+				rekey->lba_high);
+		break;
+	default:
+		break;
+	}
+}
+
+static void
+storage_rekey_done (void *data, int len)
+{
+	struct storage_rekey *rekey = data;
+
+	rekey->busy = false;
+	if (len < 0)
+		return;
+	if (rekey->flush) {
+		rekey->flush = false;
+		storage_rekey_flushed (rekey);
+	} else {
+		switch (rekey->state) {
+		case REKEY_LOAD:
+			storage_rekey_loaded (rekey);
+			break;
+		case REKEY_RECOVER:
+			rekey->state = REKEY_RECOVER_JOURNAL;
+			break;
+		case REKEY_RECOVER_JOURNAL:
+			storage_rekey_recovered (rekey);
+			break;
+		case REKEY_READ:
+			storage_rekey_read (rekey);
+			break;
+		case REKEY_WRITE:
+			/* write the chunk again if the guest wrote to it
+			   while the write-back was in flight */
+			spinlock_lock (&rekey->lock);
+			if (!rekey->conflict)
+				rekey->flush = true;
+			spinlock_unlock (&rekey->lock);
+			break;
+		case REKEY_JOURNAL:
+		case REKEY_META:
+		case REKEY_COMMIT:
+			/* FLUSH CACHE before the next write */
+			rekey->flush = true;
+			break;
+		case REKEY_IDLE:
+		case REKEY_DONE:
+			return;
+		}
+	}
+	if (rekey->state != REKEY_IDLE && rekey->state != REKEY_DONE)
+		storage_rekey_next (rekey);
+}
+
+static void
+storage_rekey_tick (struct storage_rekey *rekey)
+{
+	if (rekey->busy)
+		return;
+	if (rekey->state == REKEY_IDLE || rekey->state == REKEY_DONE) {
+		if (rekey->state == REKEY_DONE)
+			return;
+		/* yield to the guest unless it has kept the disk busy
+		   for too long */
+		if (rekey_now - rekey->last_io < REKEY_IDLE_USEC &&
+		    rekey_now - rekey->last_step < REKEY_BUSY_USEC)
+			return;
+		spinlock_lock (&rekey->lock);
+		rekey->hot_lba = rekey->mark;
+		rekey->hot_count = REKEY_CHUNK;
+		if (rekey->lba_high - rekey->mark < REKEY_CHUNK)
+			rekey->hot_count = rekey->lba_high - rekey->mark + 1;
+		memset (rekey->guestmap, 0, sizeof rekey->guestmap);
+		rekey->state = REKEY_READ;
+		spinlock_unlock (&rekey->lock);
+	}
+	storage_rekey_next (rekey);
+}
+
+static struct storage_rekey *
+storage_rekey_new (struct storage_keys *keys,
+		   struct storage_keys_conf *keys_conf)
+{
+	struct storage_rekey *rekey;
+	struct crypto *old_crypto;
+
+	old_crypto = crypto_find (keys_conf->old_crypto_name);
+	if (old_crypto == NULL)
+		panic ("unknown crypto name: %s\n",
+		       keys_conf->old_crypto_name);
+	if (keys_conf->lba_rekey + REKEY_CHUNK >= keys_conf->lba_low &&
+	    keys_conf->lba_rekey <= keys_conf->lba_high)
+		panic ("storage: re-encryption area overlaps LBA 0x%llX-0x%llX",
+		       keys_conf->lba_low, keys_conf->lba_high);
+	rekey = alloc (sizeof *rekey);
+	memset (rekey, 0, sizeof *rekey);
+	spinlock_init (&rekey->lock);
+	rekey->state = REKEY_LOAD;
+	rekey->lba_low = keys_conf->lba_low;
+	rekey->lba_high = keys_conf->lba_high;
+	rekey->lba_meta = keys_conf->lba_rekey;
+	rekey->crypto = keys->crypto;
+	rekey->keyctx = keys->keyctx;
+	rekey->old_crypto = old_crypto;
+	rekey->old_keyctx = old_crypto->setkey
+		(cfg->keys[keys_conf->old_keyindex], keys_conf->old_keybits);
+	rekey->devno = keys_conf->rekey_devno;
+	rekey->plain = alloc (REKEY_CHUNK * REKEY_SECTOR_SIZE);
+	rekey->buf = alloc (REKEY_CHUNK * REKEY_SECTOR_SIZE);
+	rekey->meta = alloc (REKEY_SECTOR_SIZE);
+	memset (rekey->meta, 0, REKEY_SECTOR_SIZE);
+	return rekey;
+}
+
+static int
+storage_rekey_crypt (struct storage_keys *keys, struct storage_access *access,
+		     lba_t lba, int count, u8 *src, u8 *dst)
+{
+	struct storage_rekey *rekey = keys->rekey;
+	int sector_size = access->sector_size;
+	int ret = 0;
+	lba_t i;
+	u8 *p;
+
+	if (sector_size != REKEY_SECTOR_SIZE) {
+		/* storage_io reads and writes 512-byte sectors only, so
+		   the engine is not rewriting this device */
+		if (!rekey->refused) {
+			rekey->refused = true;
+			printf ("storage: %d-byte sectors are not re-encrypted"
+				"\n", sector_size);
+		}
+		for (; count > 0; count--) {
+			if (access->rw == STORAGE_READ)
+				rekey->old_crypto->decrypt (dst, src,
+							    rekey->old_keyctx,
+							    lba, sector_size);
+			else
+				rekey->old_crypto->encrypt (dst, src,
+							    rekey->old_keyctx,
+							    lba, sector_size);
+			lba++;
+			src += sector_size;
+			dst += sector_size;
+		}
+		return 0;
+	}
+	spinlock_lock (&rekey->lock);
+	rekey->last_io = rekey_now;
+	for (; count > 0; count--) {
+		i = lba - rekey->hot_lba;
+		if (!rekey->loaded) {
+			/* the caller fails the command.  a controller that
+			   writes the data anyway leaves the sector
+			   undefined, as for any failed write. */
+			if (access->rw == STORAGE_READ) {
+				memset (dst, 0, sector_size);
+			} else {
+				if (i < rekey->hot_count)
+					rekey->conflict = true;
+				rekey->old_crypto->encrypt (dst, src,
+							    rekey->old_keyctx,
+							    lba, sector_size);
+			}
+			ret = -1;
+		} else if (i < rekey->hot_count) {
+			p = &rekey->plain[i * REKEY_SECTOR_SIZE];
+			if (access->rw != STORAGE_READ &&
+			    ((rekey->state == REKEY_META &&
+			      !rekey->published) ||
+			     (rekey->state == REKEY_WRITE && rekey->busy &&
+			      !rekey->flush))) {
+				/* the metadata write or the write-back is in
+				   flight */
+				rekey->old_crypto->encrypt (dst, src,
+							    rekey->old_keyctx,
+							    lba, sector_size);
+				ret = -1;
+			} else if (access->rw != STORAGE_READ) {
+				memcpy (p, src, sector_size);
+				rekey_setbit (rekey->guestmap, i);
+				rekey->conflict = true;
+				if (rekey->published)
+					keys->crypto->encrypt (dst, src,
+							       keys->keyctx,
+							       lba,
+							       sector_size);
+				else
+					rekey->old_crypto->encrypt
+						(dst, src, rekey->old_keyctx,
+						 lba, sector_size);
+			} else if (rekey->published) {
+				memcpy (dst, p, sector_size);
+			} else {
+				rekey->old_crypto->decrypt (dst, src,
+							    rekey->old_keyctx,
+							    lba, sector_size);
+			}
+		} else if (lba < rekey->mark) {
+			if (access->rw == STORAGE_READ)
+				keys->crypto->decrypt (dst, src, keys->keyctx,
+						       lba, sector_size);
+			else
+				keys->crypto->encrypt (dst, src, keys->keyctx,
+						       lba, sector_size);
+		} else {
+			if (access->rw == STORAGE_READ)
+				rekey->old_crypto->decrypt (dst, src,
+							    rekey->old_keyctx,
+							    lba, sector_size);
+			else
+				rekey->old_crypto->encrypt (dst, src,
+							    rekey->old_keyctx,
+							    lba, sector_size);
+		}
+		lba++;
+		src += sector_size;
+		dst += sector_size;
+	}
+	spinlock_unlock (&rekey->lock);
+	return ret;
+}
+
 static void
 storage_set_keys (struct storage_device *storage, struct storage_init *init)
 {
@@ -154,6 +732,15 @@ storage_set_keys (struct storage_device *storage, struct storage_init *init)
 		storage->keys[keyindex].lba_high = keys_conf->lba_high;
 		storage->keys[keyindex].crypto = crypto;
 		storage->keys[keyindex].keyctx = crypto->setkey (key, bits);
+		storage->keys[keyindex].rekey = NULL;
+		if (keys_conf->lba_rekey) {
+			/* one engine per configuration entry even if the
+			   device is attached again */
+			if (!rekey_conf[i])
+				rekey_conf[i] = storage_rekey_new
+					(&storage->keys[keyindex], keys_conf);
+			storage->keys[keyindex].rekey = rekey_conf[i];
+		}
 		keyindex++;
 	}
 	storage->keynum = keyindex;
@@ -171,6 +758,7 @@ storage_handle_sectors (struct storage_device *storage,
 	struct crypto *crypto;
 	void (*crypt)(void *dst, void *src, void *keyctx, lba_t lba, int sector_size);
 	void *keyctx;
+	int ret = 0;
 
 	for (i = 0; count > 0 && i < storage->keynum; i++) {
 		// if lba < low then memcpy
@@ -202,6 +790,17 @@ storage_handle_sectors (struct storage_device *storage,
 			crypt = (access->rw == STORAGE_READ) ? crypto->decrypt : crypto->encrypt;
 			sub_count = min(count, sub_count);
 			count -= sub_count;
+			if (storage->keys[i].rekey) {
+				if (storage_rekey_crypt (&storage->keys[i],
+							 access, lba,
+							 sub_count, src, dst))
+					ret = -1;
+				lba += sub_count;
+				size = sub_count * sector_size;
+				src += size;
+				dst += size;
+				continue;
+			}
 			while (sub_count-- > 0) {
 				crypt(dst, src, keyctx, lba++, sector_size);
 				src += sector_size;
@@ -211,7 +810,142 @@ storage_handle_sectors (struct storage_device *storage,
 	}
 	if (count > 0 && dst != src)
 		memcpy(dst, src, count * sector_size);
-	return 0;
+	return ret;
+}
+
+struct storage_iov_pos {
+	struct storage_iovec *iov;
+	int cnt;
+	unsigned int off;
+};
+
+static void
+storage_iov_init (struct storage_iov_pos *p, struct storage_iovec *iov,
+		  int cnt)
+{
+	p->iov = iov;
+	p->cnt = cnt;
+	p->off = 0;
+}
+
+static unsigned long long int
+storage_iov_total (struct storage_iovec *iov, int cnt)
+{
+	unsigned long long int total = 0;
+
+	while (cnt-- > 0)
+		total += iov++->len;
+	return total;
+}
+
+/* returns the length of the contiguous part at the position */
+static unsigned int
+storage_iov_avail (struct storage_iov_pos *p)
+{
+	while (p->cnt > 0 && p->off == p->iov->len) {
+		p->iov++;
+		p->cnt--;
+		p->off = 0;
+	}
+	return p->cnt > 0 ? p->iov->len - p->off : 0;
+}
+
+static u8 *
+storage_iov_ptr (struct storage_iov_pos *p)
+{
+	return (u8 *)p->iov->base + p->off;
+}
+
+static void
+storage_iov_copy (struct storage_iov_pos *p, u8 *buf, unsigned int len,
+		  bool from_iov)
+{
+	unsigned int n;
+
+	while (len > 0) {
+		n = storage_iov_avail (p);
+		if (n > len)
+			n = len;
+		if (from_iov)
+			memcpy (buf, storage_iov_ptr (p), n);
+		else
+			memcpy (storage_iov_ptr (p), buf, n);
+		p->off += n;
+		buf += n;
+		len -= n;
+	}
+}
+
+/**
+ * handle sectors in scatter-gather lists
+ * @param storage	storage device
+ * @param access	access attribute
+ * @param src		source segments
+ * @param srccnt	number of source segments
+ * @param dst		destination segments
+ * @param dstcnt	number of destination segments
+ *
+ * Runs of whole sectors in a segment on both sides are handled in
+ * place.  Only a sector straddling a segment boundary goes through
+ * a bounce buffer.
+ */
+int
+storage_handle_sectors_iov (struct storage_device *storage,
+			    struct storage_access *access,
+			    struct storage_iovec *src, int srccnt,
+			    struct storage_iovec *dst, int dstcnt)
+{
+	struct storage_access sub;
+	struct storage_iov_pos s, d;
+	unsigned int sector_size = access->sector_size;
+	unsigned long long int size;
+	count_t done, n, sn, dn;
+	u8 *tmp = NULL, *sp, *dp;
+	int ret = 0;
+
+	size = (unsigned long long int)access->count * sector_size;
+	if (storage_iov_total (src, srccnt) < size ||
+	    storage_iov_total (dst, dstcnt) < size)
+		return -1;
+	storage_iov_init (&s, src, srccnt);
+	storage_iov_init (&d, dst, dstcnt);
+	sub = *access;
+	for (done = 0; done < access->count; done += sub.count) {
+		sub.lba = access->lba + done;
+		sn = storage_iov_avail (&s) / sector_size;
+		dn = storage_iov_avail (&d) / sector_size;
+		n = min (min (sn, dn), access->count - done);
+		if (n > 0) {
+			sub.count = n;
+			if (storage_handle_sectors (storage, &sub,
+						    storage_iov_ptr (&s),
+						    storage_iov_ptr (&d)))
+				ret = -1;
+			s.off += n * sector_size;
+			d.off += n * sector_size;
+			continue;
+		}
+		if (!tmp)
+			tmp = alloc (sector_size * 2);
+		sub.count = 1;
+		if (sn) {
+			sp = storage_iov_ptr (&s);
+			s.off += sector_size;
+		} else {
+			sp = tmp;
+			storage_iov_copy (&s, sp, sector_size, true);
+		}
+		dp = dn ? storage_iov_ptr (&d) : tmp + sector_size;
+		if (storage_handle_sectors (storage, &sub, sp, dp))
+			ret = -1;
+		if (dn)
+			d.off += sector_size;
+		else
+			storage_iov_copy (&d, dp, sector_size, false);
+	}
+	if (tmp)
+		free (tmp);
+	return ret;
 }
 
 /**
@@ -246,6 +980,21 @@ storage_free (struct storage_device *storage)
 	free (storage);
 }
 
+/**
+ * advance the re-encryption engines
+ * @param now		current time in microseconds
+ */
+void
+storage_rekey_poll (u64 now)
+{
+	int i;
+
+	rekey_now = now;
+	for (i = 0; i < NUM_OF_STORAGE_KEYS_CONF; i++)
+		if (rekey_conf[i])
+			storage_rekey_tick (rekey_conf[i]);
+}
+
 static int
 storage_msghandler (int m, int c, struct msgbuf *buf, int bufcnt)
 {
@@ -298,6 +1047,16 @@ storage_msghandler (int m, int c, struct msgbuf *buf, int bufcnt)
 		arg = buf[0].base;
 		storage_free (arg->storage);
 		return 0;
+	} else if (c == STORAGE_MSG_REKEY_POLL) {
+		struct storage_msg_rekey_poll *arg;
+
+		if (bufcnt != 1)
+			return -1;
+		if (buf[0].len != sizeof *arg)
+			return -1;
+		arg = buf[0].base;
+		storage_rekey_poll (arg->now);
+		return 0;
 	} else if (c == STORAGE_MSG_HANDLE_SECTORS) {
 		struct storage_msg_handle_sectors *arg;
 
@@ -311,6 +1070,31 @@ storage_msghandler (int m, int c, struct msgbuf *buf, int bufcnt)
 						      buf[1].base,
 						      buf[2].base);
 		return 0;
+	} else if (c == STORAGE_MSG_HANDLE_SECTORS_IOV) {
+		struct storage_msg_handle_sectors_iov *arg;
+		struct storage_iovec *iov;
+		int i;
+
+		if (bufcnt < 1)
+			return -1;
+		if (buf[0].len != sizeof *arg)
+			return -1;
+		arg = buf[0].base;
+		if (arg->srccnt < 0 || arg->dstcnt < 0 ||
+		    bufcnt != 1 + arg->srccnt + arg->dstcnt)
+			return -1;
+		iov = alloc (sizeof *iov * (bufcnt - 1));
+		for (i = 1; i < bufcnt; i++) {
+			iov[i - 1].base = buf[i].base;
+			iov[i - 1].len = buf[i].len;
+		}
+		arg->retval = storage_handle_sectors_iov (arg->storage,
+							  &arg->access,
+							  iov, arg->srccnt,
+							  iov + arg->srccnt,
+							  arg->dstcnt);
+		free (iov);
+		return 0;
 	} else {
 		return -1;
 	}
@@ -31,8 +31,13 @@ enum {
 	STORAGE_MSG_NEW,
 	STORAGE_MSG_FREE,
 	STORAGE_MSG_HANDLE_SECTORS,
+	STORAGE_MSG_REKEY_POLL,
+	STORAGE_MSG_HANDLE_SECTORS_IOV,
 };
 
+/* MAXNUM_OF_MSGBUF in core/process.h */
+#define STORAGE_MSG_MAXBUF	32
+
 struct storage_msg_new {
 	int type;
 	int host_id;
@@ -51,3 +56,14 @@ struct storage_msg_handle_sectors {
 	struct storage_access access;
 	int retval;
 };
+
+struct storage_msg_handle_sectors_iov {
+	struct storage_device *storage;
+	struct storage_access access;
+	int srccnt, dstcnt;
+	int retval;
+};
+
+struct storage_msg_rekey_poll {
+	u64 now;
+};
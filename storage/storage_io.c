@@ -614,6 +614,43 @@ storage_io_awrite (int id, int devno, void *buf, int len, long long offset,
 	return 0;
 }
 
+/* writes the volatile cache of the drive to the media */
+int
+storage_io_aflush (int id, int devno,
+		   void (*callback) (void *data, int len), void *data)
+{
+	struct storage_io_devices *d;
+	struct storage_hc_dev_atacmd *cmd;
+	struct storage_io_areadwrite_data *arg;
+
+	if (storage_io_id != id)
+		return -1;
+	LIST1_FOREACH (io_dev_list, d) {
+		if (d->devno == devno)
+			break;
+	}
+	if (!d)
+		return -1;
+	cmd = alloc (sizeof *cmd);
+	arg = alloc (sizeof *arg);
+	arg->callback = callback;
+	arg->data = data;
+	memset (cmd, 0, sizeof *cmd);
+	cmd->command_status = 0xEA; /* FLUSH CACHE EXT */
+	cmd->dev_head = 0x40;
+	cmd->pio = true;	/* no data */
+	cmd->callback = storage_io_areadwrite_sub;
+	cmd->data = arg;
+	cmd->timeout_ready = 1000000;
+	cmd->timeout_complete = 30000000;
+	if (!storage_hc_dev_atacommand (d->dev, cmd, sizeof *cmd)) {
+		free (arg);
+		free (cmd);
+		return -1;
+	}
+	return 0;
+}
+
 static void
 aget_size_callback (void *data, long long size)
 {
@@ -743,6 +780,23 @@ storage_io_msghandler (int m, int c, struct msgbuf *buf, int bufcnt)
 			free (arg);
 		}
 		return 0;
+	} else if (c == STORAGE_IO_AFLUSH) {
+		struct storage_io_msg_areadwrite *arg, *a;
+
+		if (bufcnt != 1)
+			return -1;
+		if (buf[0].len != sizeof *arg)
+			return -1;
+		a = buf[0].base;
+		arg = alloc (sizeof *arg);
+		memcpy (arg, a, sizeof *arg);
+		arg->write = 1;	/* no data to return */
+		arg->tmpbuf = NULL;
+		a->retval = storage_io_aflush (arg->id, arg->devno,
+					       areadwrite_callback, arg);
+		if (a->retval < 0)
+			free (arg);
+		return 0;
 	} else {
 		return -1;
 	}
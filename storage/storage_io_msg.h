@@ -33,6 +33,7 @@ enum {
 	STORAGE_IO_GET_NUM_DEVICES,
 	STORAGE_IO_AGET_SIZE,
 	STORAGE_IO_AREADWRITE,
+	STORAGE_IO_AFLUSH,
 };
 
 enum {
@@ -99,3 +100,5 @@ int storage_io_aread (int id, int devno, void *buf, int len, long long offset,
 		      void (*callback) (void *data, int len), void *data);
 int storage_io_awrite (int id, int devno, void *buf, int len, long long offset,
 		       void (*callback) (void *data, int len), void *data);
+int storage_io_aflush (int id, int devno,
+		       void (*callback) (void *data, int len), void *data);
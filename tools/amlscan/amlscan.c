@@ -0,0 +1,630 @@
+/*
+ * Copyright (c) 2007, 2008 University of Tsukuba
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the University of Tsukuba nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* userspace check and benchmark of the DSDT/SSDT scanner in
+   core/acpi_dsdt.c.  every table is run through the streaming
+   scanner and through the full grammar parser, and the results (the
+   _Sx values, the "Disable ..." messages and the patched table) must
+   be identical.  the time and the heap use of both are reported, and
+   with -f the tables are mutated at random to fuzz the scanner.
+
+   tables are raw dumps, e.g. /sys/firmware/acpi/tables/DSDT or the
+   .dat files written by "acpidump -b".  without arguments a small
+   built-in DSDT is used. */
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define OUT_SIZE	4096
+#define SAMPLE_SIZE	1024
+#define MAX_TABLES	64
+#define DEFAULT_ROUNDS	100
+#define DEFAULT_FUZZ	10000
+
+struct table {
+	char *name;
+	unsigned char *data;
+	unsigned int len;
+};
+
+/* the outcome of one run of the scanner or the parser */
+struct result {
+	int r;
+	unsigned char system_state[6][5];
+	char out[OUT_SIZE];
+	int outlen;
+	unsigned char *data;
+};
+
+/* allocations of the parser are kept on a list so that they can be
+   released after a panic */
+struct block {
+	struct block *next, *prev;
+	unsigned int len;
+	unsigned int pad;
+};
+
+extern unsigned char acpi_dsdt_system_state[6][5];
+int aml_scan (unsigned char *start, unsigned char *end, int search_device);
+int aml_parse (unsigned char *start, unsigned char *end, int search_device);
+
+static struct block blocks = { &blocks, &blocks, 0, 0 };
+static unsigned long long nalloc, live, peak;
+static jmp_buf panic_jmp;
+static char panic_msg[256];
+static char *out;
+static int *outlen;
+static unsigned long long rnd_state = 0x2545F4914F6CDD1DULL;
+static int verbose;
+
+static void
+fail (char *msg)
+{
+	fprintf (stderr, "amlscan: %s\n", msg);
+	exit (1);
+}
+
+void *
+aml_alloc (unsigned int len)
+{
+	struct block *b;
+
+	b = malloc (sizeof *b + len);
+	if (!b)
+		fail ("out of memory");
+	b->len = len;
+	b->next = blocks.next;
+	b->prev = &blocks;
+	blocks.next->prev = b;
+	blocks.next = b;
+	nalloc++;
+	live += len;
+	if (peak < live)
+		peak = live;
+	return b + 1;
+}
+
+void
+aml_free (void *p)
+{
+	struct block *b;
+
+	b = (struct block *)p - 1;
+	b->prev->next = b->next;
+	b->next->prev = b->prev;
+	live -= b->len;
+	free (b);
+}
+
+static void
+release_blocks (void)
+{
+	while (blocks.next != &blocks)
+		aml_free (blocks.next + 1);
+}
+
+int
+aml_printf (const char *format, ...)
+{
+	va_list ap;
+	int n;
+
+	if (!out)
+		return 0;
+	va_start (ap, format);
+	n = vsnprintf (out + *outlen, OUT_SIZE - *outlen, format, ap);
+	va_end (ap);
+	if (n > 0)
+		*outlen += n < OUT_SIZE - *outlen ? n : OUT_SIZE - 1 - *outlen;
+	return n;
+}
+
+void
+aml_panic (char *format, ...)
+{
+	va_list ap;
+
+	va_start (ap, format);
+	vsnprintf (panic_msg, sizeof panic_msg, format, ap);
+	va_end (ap);
+	longjmp (panic_jmp, 1);
+}
+
+/* acpi_dsdt_parse() is linked in but never called */
+void *
+mapmem_hphys (unsigned long long physaddr, unsigned int len, int flags)
+{
+	return NULL;
+}
+
+void
+unmapmem (void *virt, unsigned int len)
+{
+}
+
+static unsigned long long
+rnd (void)
+{
+	rnd_state ^= rnd_state >> 12;
+	rnd_state ^= rnd_state << 25;
+	rnd_state ^= rnd_state >> 27;
+	return rnd_state * 0x2545F4914F6CDD1DULL;
+}
+
+static unsigned long long
+now_ns (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* run the scanner (parse == 0) or the parser (parse != 0) over a
+   copy of len bytes of data.  res->data must be freed by the
+   caller.  the parser loses ZeroOp elements of a package that ends
+   the table, so a NoopOp is appended to its copy. */
+static void
+run (struct result *res, unsigned char *data, unsigned int len, int parse)
+{
+	memset (acpi_dsdt_system_state, 0, sizeof acpi_dsdt_system_state);
+	res->outlen = 0;
+	res->out[0] = '\0';
+	res->data = malloc (len + 1);
+	if (!res->data)
+		fail ("out of memory");
+	memcpy (res->data, data, len);
+	res->data[len] = 0xA3;
+	out = res->out;
+	outlen = &res->outlen;
+	if (setjmp (panic_jmp)) {
+		res->r = -2;
+		release_blocks ();
+	} else if (parse) {
+		res->r = aml_parse (res->data, res->data + len + 1, 1);
+	} else {
+		res->r = aml_scan (res->data, res->data + len, 1);
+	}
+	out = NULL;
+	memcpy (res->system_state, acpi_dsdt_system_state,
+		sizeof res->system_state);
+}
+
+/* the parser leaves the _Sx bytes after the saved elements
+   uninitialized, so only the counted ones are compared */
+static int
+same (struct result *a, struct result *b, unsigned int len)
+{
+	int i, n;
+
+	for (i = 0; i < 6; i++) {
+		n = a->system_state[i][0];
+		if (n > 4)
+			n = 4;
+		if (memcmp (a->system_state[i], b->system_state[i], n + 1))
+			return 0;
+	}
+	return a->outlen == b->outlen && !memcmp (a->out, b->out, a->outlen) &&
+		!memcmp (a->data, b->data, len);
+}
+
+static void
+print_result (char *name, struct result *res)
+{
+	int i, j;
+
+	printf ("%s: r=%d", name, res->r);
+	for (i = 0; i < 6; i++) {
+		if (!res->system_state[i][0])
+			continue;
+		printf (" S%d=", i);
+		for (j = 0; j < 5 && j <= res->system_state[i][0]; j++)
+			printf ("%02x", res->system_state[i][j]);
+	}
+	printf ("\n%.*s", res->outlen, res->out);
+}
+
+/* --- built-in sample table --- */
+
+struct aml {
+	unsigned char buf[SAMPLE_SIZE];
+	unsigned int len;
+	unsigned int pkg[16];
+	int depth;
+};
+
+static void
+emit (struct aml *a, char *bytes, unsigned int n)
+{
+	if (a->len + n > SAMPLE_SIZE)
+		fail ("sample too large");
+	memcpy (a->buf + a->len, bytes, n);
+	a->len += n;
+}
+
+#define EMIT(a, s) emit ((a), (s), sizeof (s) - 1)
+
+/* PkgLength is always encoded in two bytes and filled in by
+   pkg_end() */
+static void
+pkg_begin (struct aml *a)
+{
+	a->pkg[a->depth++] = a->len;
+	EMIT (a, "\x40\x00");
+}
+
+static void
+pkg_end (struct aml *a)
+{
+	unsigned int p, n;
+
+	p = a->pkg[--a->depth];
+	n = a->len - p;
+	a->buf[p] = 0x40 | (n & 0xF);
+	a->buf[p + 1] = n >> 4;
+}
+
+static void
+sample (struct table *t)
+{
+	static struct aml a;
+	unsigned char sum;
+	unsigned int i;
+
+	EMIT (&a, "DSDT\0\0\0\0\x02\0BITVSRAMLSCAN \x01\0\0\0INTL"
+	      "\x25\x09\x20\x20");
+	EMIT (&a, "\x08_S0_\x12");	/* Name (_S0, Package () {0, 0}) */
+	pkg_begin (&a);
+	EMIT (&a, "\x02\x00\x00");
+	pkg_end (&a);
+	EMIT (&a, "\x08_S3_\x12");	/* Name (_S3, Package () {5, 5, 0}) */
+	pkg_begin (&a);
+	EMIT (&a, "\x03\x0A\x05\x0A\x05\x00");
+	pkg_end (&a);
+	EMIT (&a, "\x08_S5_\x12");	/* Name (_S5, Package () {7, 7}) */
+	pkg_begin (&a);
+	EMIT (&a, "\x02\x0A\x07\x0A\x07");
+	pkg_end (&a);
+	EMIT (&a, "\x10");		/* Scope (\_PR) */
+	pkg_begin (&a);
+	EMIT (&a, "\\_PR_");
+	EMIT (&a, "\x5B\x83");		/* Processor (CPU0, 0, 0x410, 6) */
+	pkg_begin (&a);
+	EMIT (&a, "CPU0\x00\x10\x04\x00\x00\x06");
+	pkg_end (&a);
+	pkg_end (&a);
+	EMIT (&a, "\x10");		/* Scope (\_SB) */
+	pkg_begin (&a);
+	EMIT (&a, "\\_SB_");
+	EMIT (&a, "\x5B\x82");		/* Device (PCI0) */
+	pkg_begin (&a);
+	EMIT (&a, "PCI0");
+	EMIT (&a, "\x08_HID\x0C\x41\xD0\x0A\x03");
+	/* OperationRegion (GNVS, SystemMemory, 0x1000, 0x100) */
+	EMIT (&a, "\x5B\x80GNVS\x00\x0B\x00\x10\x0B\x00\x01");
+	EMIT (&a, "\x5B\x81");		/* Field (GNVS, AnyAcc, ...) */
+	pkg_begin (&a);
+	EMIT (&a, "GNVS\x00" "FOO_\x08");
+	pkg_end (&a);
+	EMIT (&a, "\x5B\x01MUT0\x00");	/* Mutex (MUT0, 0) */
+	EMIT (&a, "\x5B\x82");		/* Device (UAR1) */
+	pkg_begin (&a);
+	EMIT (&a, "UAR1");
+	EMIT (&a, "\x08_HID\x0C\x41\xD0\x05\x01"); /* PNP0501 */
+	EMIT (&a, "\x08_UID\x01");
+	EMIT (&a, "\x14");		/* Method (_STA) { Return (0x0F) } */
+	pkg_begin (&a);
+	EMIT (&a, "_STA\x00\xA4\x0A\x0F");
+	pkg_end (&a);
+	EMIT (&a, "\x14");		/* Method (_DIS) { Store (0, Local0) } */
+	pkg_begin (&a);
+	EMIT (&a, "_DIS\x00\x70\x00\x60");
+	pkg_end (&a);
+	pkg_end (&a);
+	pkg_end (&a);
+	pkg_end (&a);
+	EMIT (&a, "\x14");		/* Method (_PTS, 1) { Store (Arg0, ...) } */
+	pkg_begin (&a);
+	EMIT (&a, "_PTS\x01\x70\x68\x60");
+	pkg_end (&a);
+	EMIT (&a, "\x08" "BUF0\x11");	/* Name (BUF0, Buffer () {1, 2, 3}) */
+	pkg_begin (&a);
+	EMIT (&a, "\x0A\x03\x01\x02\x03");
+	pkg_end (&a);
+	EMIT (&a, "\x08STR0\x0D" "BitVisor\x00");
+	a.buf[4] = a.len;
+	a.buf[5] = a.len >> 8;
+	for (sum = 0, i = 0; i < a.len; i++)
+		sum += a.buf[i];
+	a.buf[9] = -sum;
+	t->name = "(built-in)";
+	t->data = a.buf;
+	t->len = a.len;
+}
+
+static void
+load (struct table *t, char *name)
+{
+	FILE *fp;
+	long len;
+
+	fp = fopen (name, "rb");
+	if (!fp) {
+		perror (name);
+		exit (1);
+	}
+	fseek (fp, 0, SEEK_END);
+	len = ftell (fp);
+	fseek (fp, 0, SEEK_SET);
+	if (len < 36) {
+		fprintf (stderr, "%s: too short for an ACPI table\n", name);
+		exit (1);
+	}
+	t->name = name;
+	t->len = len;
+	t->data = malloc (len);
+	if (!t->data || fread (t->data, len, 1, fp) != 1) {
+		perror (name);
+		exit (1);
+	}
+	fclose (fp);
+	if (memcmp (t->data, "DSDT", 4) && memcmp (t->data, "SSDT", 4))
+		fprintf (stderr, "%s: warning: not a DSDT or SSDT\n", name);
+}
+
+/* the scanner and the parser must agree on every table.  a table
+   the scanner does not handle is reported; the VMM parses it with
+   the full parser. */
+static int
+check (struct table *t)
+{
+	struct result s, p;
+	int r;
+
+	run (&s, t->data, t->len, 0);
+	run (&p, t->data, t->len, 1);
+	if (verbose) {
+		print_result ("scanner", &s);
+		print_result ("parser", &p);
+	}
+	r = 0;
+	if (p.r) {
+		fprintf (stderr, "%s: the parser fails (%d %s)\n", t->name,
+			 p.r, p.r == -2 ? panic_msg : "");
+		r = -1;
+	} else if (s.r == -2) {
+		fprintf (stderr, "%s: the scanner panics (%s)\n", t->name,
+			 panic_msg);
+		r = -1;
+	} else if (s.r) {
+		printf ("%s: the scanner falls back to the parser\n",
+			t->name);
+	} else if (!same (&s, &p, t->len)) {
+		fprintf (stderr, "%s: the scanner and the parser disagree\n",
+			 t->name);
+		print_result ("scanner", &s);
+		print_result ("parser", &p);
+		r = -1;
+	}
+	free (s.data);
+	free (p.data);
+	return r;
+}
+
+static void
+bench (struct table *t, int rounds)
+{
+	unsigned char *buf;
+	unsigned long long t0, ns[2], allocs[2], peaks[2];
+	int i, j;
+
+	buf = malloc (t->len);
+	if (!buf)
+		fail ("out of memory");
+	for (j = 0; j < 2; j++) {
+		ns[j] = 0;
+		nalloc = 0;
+		peak = live;
+		for (i = 0; i < rounds; i++) {
+			memcpy (buf, t->data, t->len);
+			if (setjmp (panic_jmp)) {
+				release_blocks ();
+				continue;
+			}
+			t0 = now_ns ();
+			if (j)
+				aml_parse (buf, buf + t->len, 1);
+			else
+				aml_scan (buf, buf + t->len, 1);
+			ns[j] += now_ns () - t0;
+		}
+		allocs[j] = nalloc / rounds;
+		peaks[j] = peak;
+	}
+	printf ("%-24s %8u %10.1f %10.1f %10llu %10llu\n", t->name, t->len,
+		ns[0] / 1000.0 / rounds, ns[1] / 1000.0 / rounds, allocs[1],
+		peaks[1]);
+	if (allocs[0] || peaks[0])
+		fail ("the scanner allocates memory");
+	free (buf);
+}
+
+static void
+mutate (unsigned char *data, unsigned int *len)
+{
+	static const unsigned char ops[] = {
+		0x00, 0x08, 0x10, 0x11, 0x12, 0x14, 0x2E, 0x2F, 0x5B, 0x5C,
+		0x5E, 0x80, 0x82, 0x83, 0xA3, 0xFF,
+	};
+	unsigned int pos;
+	int n;
+
+	for (n = 1 + rnd () % 4; n > 0; n--) {
+		pos = 36 + rnd () % (*len - 36);
+		switch (rnd () % 4) {
+		case 0:
+			data[pos] = rnd ();
+			break;
+		case 1:
+			data[pos] = ops[rnd () % sizeof ops];
+			break;
+		case 2:		/* PkgLength lead byte */
+			data[pos] = (rnd () % 4) << 6 | (rnd () & 0xF);
+			break;
+		case 3:
+			*len = pos + 1;
+			break;
+		}
+	}
+}
+
+/* random mutations of the tables.  the scanner must never panic or
+   read outside the table (build with -fsanitize=address to check
+   the latter), and where both accept a table they must agree. */
+static int
+fuzz (struct table *t, int ntables, int iterations)
+{
+	struct table *src;
+	struct result s, p;
+	unsigned char *data;
+	unsigned int len;
+	FILE *fp;
+	unsigned long long accepted, rejected, fallback;
+	int i;
+
+	accepted = rejected = fallback = 0;
+	for (i = 0; i < iterations; i++) {
+		src = &t[rnd () % ntables];
+		len = src->len;
+		data = malloc (len);
+		if (!data)
+			fail ("out of memory");
+		memcpy (data, src->data, len);
+		mutate (data, &len);
+		run (&s, data, len, 0);
+		if (s.r == -2) {
+			fprintf (stderr, "fuzz %d: the scanner panics (%s)\n",
+				 i, panic_msg);
+			goto failed;
+		}
+		if (s.r) {
+			fallback++;
+		} else {
+			run (&p, data, len, 1);
+			if (p.r) {
+				rejected++;
+			} else if (!same (&s, &p, len)) {
+				fprintf (stderr, "fuzz %d: the scanner and the"
+					 " parser disagree\n", i);
+				print_result ("scanner", &s);
+				print_result ("parser", &p);
+				free (p.data);
+				goto failed;
+			} else {
+				accepted++;
+			}
+			free (p.data);
+		}
+		free (s.data);
+		free (data);
+	}
+	printf ("fuzz: %d tables, %llu agree, %llu rejected by the parser,"
+		" %llu fall back\n", iterations, accepted, rejected,
+		fallback);
+	return 0;
+failed:
+	free (s.data);
+	fp = fopen ("amlscan-fail.aml", "wb");
+	if (fp) {
+		fwrite (data, len, 1, fp);
+		fclose (fp);
+		fprintf (stderr, "the table is saved to amlscan-fail.aml\n");
+	}
+	free (data);
+	return -1;
+}
+
+int
+main (int argc, char **argv)
+{
+	static struct table t[MAX_TABLES];
+	int c, i, n, rounds, iterations, r;
+
+	rounds = DEFAULT_ROUNDS;
+	iterations = DEFAULT_FUZZ;
+	while ((c = getopt (argc, argv, "n:f:s:v")) != -1) {
+		switch (c) {
+		case 'n':
+			rounds = atoi (optarg);
+			break;
+		case 'f':
+			iterations = atoi (optarg);
+			break;
+		case 's':
+			rnd_state = strtoull (optarg, NULL, 0) | 1;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			fprintf (stderr, "usage: amlscan [-v] [-n rounds]"
+				 " [-f iterations] [-s seed] [table...]\n");
+			return 1;
+		}
+	}
+	if (rounds < 1)
+		rounds = 1;
+	n = 0;
+	if (optind == argc)
+		sample (&t[n++]);
+	for (i = optind; i < argc; i++) {
+		if (n >= MAX_TABLES)
+			fail ("too many tables");
+		load (&t[n++], argv[i]);
+	}
+	r = 0;
+	for (i = 0; i < n; i++)
+		if (check (&t[i]))
+			r = 1;
+	if (r)
+		return r;
+	printf ("%-24s %8s %10s %10s %10s %10s\n", "table", "bytes",
+		"scan us", "parse us", "allocs", "peak heap");
+	for (i = 0; i < n; i++)
+		bench (&t[i], rounds);
+	if (iterations > 0 && fuzz (t, n, iterations))
+		return 1;
+	printf ("amlscan: ok\n");
+	return 0;
+}
@@ -0,0 +1,561 @@
+/*
+ * Copyright (c) 2007, 2008 University of Tsukuba
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the University of Tsukuba nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* IC card simulator for the IDMan PKCS#11 layer.  the pkcs11 and
+   idman_pkcs11 sources are built for the host as they are and the
+   ICCard layer (IDMan_SCard*) is replaced with a simulated reader
+   and card, so that the APDUs sent per signature and per session
+   can be counted and timed.  two cards are simulated: one that
+   accepts extended APDUs and one that only accepts short APDUs and
+   answers in 61xx pieces, which needs command chaining, GET
+   RESPONSE and offset READ BINARY. */
+
+#include <core/string.h>
+#include <stdio.h>
+#include <time.h>
+#include "IDMan_IPCommon.h"
+#include "IDMan_PKCardAccess.h"
+#include "IDMan_PcPcsclite.h"
+
+#define SIM_PIN		"123456789@ABCDEF"
+#define SIM_READER	"SimReader 00 00"
+#define SIM_FILE_SIZE	1500
+#define SIGN_ROUNDS	10000
+#define SESSION_ROUNDS	1000
+
+struct simcard {
+	int present;
+	int extlen;		/* accepts extended APDUs */
+	int verified;
+	unsigned long gen;	/* card handle, changes on reinsertion */
+	unsigned char file[SIM_FILE_SIZE];
+	unsigned char chain[4096];
+	unsigned long chainlen;
+	unsigned char resp[4096];
+	unsigned long resplen, respoff;
+};
+
+static struct simcard card;
+static unsigned long napdu, nchained, ngetresp, nextended;
+static unsigned long apdu_ins[256];
+
+static int
+fail (char *msg)
+{
+	fprintf (stderr, "cardsim: FAIL: %s\n", msg);
+	exit (1);
+}
+
+static void
+card_insert (int extlen)
+{
+	int i;
+
+	memset (&card.chain, 0, sizeof card.chain);
+	card.present = 1;
+	card.extlen = extlen;
+	card.verified = 0;
+	card.chainlen = 0;
+	card.resplen = card.respoff = 0;
+	card.gen++;
+	for (i = 0; i < SIM_FILE_SIZE; i++)
+		card.file[i] = (unsigned char)(i * 7 + 3);
+}
+
+static void
+card_remove (void)
+{
+	card.present = 0;
+}
+
+/* ICCard layer */
+
+long
+IDMan_SCardEstablishContext (unsigned long *phContext)
+{
+	*phContext = 1;
+	return SCARD_S_SUCCESS;
+}
+
+long
+IDMan_SCardReleaseContext (unsigned long hContext)
+{
+	return SCARD_S_SUCCESS;
+}
+
+long
+IDMan_SCardListReaders (unsigned long hContext, char *mszReaders,
+			unsigned long *pcchReaders)
+{
+	memcpy (mszReaders, SIM_READER "\0", sizeof SIM_READER + 1);
+	*pcchReaders = sizeof SIM_READER + 1;
+	return SCARD_S_SUCCESS;
+}
+
+long
+IDMan_SCardConnect (unsigned long hContext, const char *szReader,
+		    unsigned long dwShareMode, unsigned long *phCard,
+		    unsigned long *pdwActiveProtocol)
+{
+	if (!card.present)
+		return SCARD_E_NO_SMARTCARD;
+	*phCard = card.gen;
+	*pdwActiveProtocol = SCARD_PROTOCOL_T1;
+	return SCARD_S_SUCCESS;
+}
+
+long
+IDMan_SCardDisconnect (unsigned long hCard, unsigned long dwDisposition)
+{
+	return SCARD_S_SUCCESS;
+}
+
+long
+IDMan_SCardStatus (unsigned long hCard, char *mszReaderNames,
+		   unsigned long *pcchReaderLen, unsigned long *pdwState,
+		   unsigned long *pdwProtocol, unsigned char *pbAtr,
+		   unsigned long *pcbAtrLen)
+{
+	if (!card.present || hCard != card.gen)
+		return SCARD_W_REMOVED_CARD;
+	*pdwState = SCARD_PRESENT | SCARD_SPECIFIC;
+	*pdwProtocol = SCARD_PROTOCOL_T1;
+	*pcbAtrLen = 0;
+	return SCARD_S_SUCCESS;
+}
+
+/* queue a response; the short APDU card returns at most le bytes
+   (256 at most) at a time and announces the rest with 61xx */
+static void
+card_respond (unsigned char *data, unsigned long len, unsigned long le,
+	      unsigned char *rcv, unsigned long *rcvlen)
+{
+	unsigned long n, left;
+
+	if (data != card.resp) {
+		memcpy (card.resp, data, len);
+		card.resplen = len;
+	}
+	card.respoff = 0;
+	n = len;
+	if (!card.extlen && n > le)
+		n = le;
+	memcpy (rcv, card.resp, n);
+	card.respoff = n;
+	left = len - n;
+	if (left) {
+		rcv[n] = 0x61;
+		rcv[n + 1] = left > 0xFF ? 0x00 : left;
+	} else {
+		rcv[n] = 0x90;
+		rcv[n + 1] = 0x00;
+		card.resplen = 0;
+	}
+	*rcvlen = n + 2;
+}
+
+static void
+card_sw (unsigned char *rcv, unsigned long *rcvlen, int sw1, int sw2)
+{
+	rcv[0] = sw1;
+	rcv[1] = sw2;
+	*rcvlen = 2;
+}
+
+long
+IDMan_SCardTransmit (unsigned long hCard, unsigned long *pdwActiveProtocol,
+		     const unsigned char *snd, unsigned long sndlen,
+		     unsigned char *rcv, unsigned long *rcvlen)
+{
+	unsigned char data[4096], out[4096];
+	unsigned long lc = 0, le = 0, off, n, i;
+	int cla, ins, p1, p2;
+
+	if (!card.present || hCard != card.gen)
+		return SCARD_W_REMOVED_CARD;
+	if (sndlen < 4 || *rcvlen < 2)
+		return SCARD_F_INTERNAL_ERROR;
+	napdu++;
+	cla = snd[0];
+	ins = snd[1];
+	p1 = snd[2];
+	p2 = snd[3];
+	apdu_ins[ins]++;
+
+	/* parse the body: short or extended Lc/Le */
+	if (sndlen == 5) {
+		le = snd[4] ? snd[4] : 256;
+	} else if (sndlen > 5 && snd[4]) {
+		lc = snd[4];
+		if (sndlen == 5 + lc)
+			;
+		else if (sndlen == 6 + lc)
+			le = snd[5 + lc] ? snd[5 + lc] : 256;
+		else
+			goto wrong_length;
+		memcpy (data, &snd[5], lc);
+	} else if (sndlen >= 7) {
+		nextended++;
+		if (!card.extlen)
+			goto wrong_length;
+		n = (snd[5] << 8) | snd[6];
+		if (sndlen == 7) {
+			le = n ? n : 65536;
+		} else {
+			lc = n;
+			if (sndlen == 7 + lc)
+				;
+			else if (sndlen == 9 + lc)
+				le = (snd[7 + lc] << 8) | snd[8 + lc];
+			else
+				goto wrong_length;
+			memcpy (data, &snd[7], lc);
+		}
+	} else if (sndlen != 4) {
+		goto wrong_length;
+	}
+
+	/* command chaining */
+	if (cla & 0x10) {
+		nchained++;
+		if (card.chainlen + lc > sizeof card.chain)
+			goto wrong_length;
+		memcpy (&card.chain[card.chainlen], data, lc);
+		card.chainlen += lc;
+		card_sw (rcv, rcvlen, 0x90, 0x00);
+		return SCARD_S_SUCCESS;
+	}
+	if (card.chainlen) {
+		if (card.chainlen + lc > sizeof data)
+			goto wrong_length;
+		memmove (&data[card.chainlen], data, lc);
+		memcpy (data, card.chain, card.chainlen);
+		lc += card.chainlen;
+		card.chainlen = 0;
+	}
+	if (ins != 0xC0)
+		card.resplen = 0;
+
+	switch (ins) {
+	case 0xA4:		/* SELECT FILE */
+		card_sw (rcv, rcvlen, 0x90, 0x00);
+		break;
+	case 0x20:		/* VERIFY */
+		card.verified = lc == sizeof SIM_PIN - 1 &&
+			!memcmp (data, SIM_PIN, lc);
+		if (card.verified)
+			card_sw (rcv, rcvlen, 0x90, 0x00);
+		else
+			card_sw (rcv, rcvlen, 0x63, 0xC3);
+		break;
+	case 0x88:		/* INTERNAL AUTHENTICATE */
+		if (!card.verified) {
+			card_sw (rcv, rcvlen, 0x69, 0x82);
+			break;
+		}
+		for (i = 0; i < lc; i++)
+			out[i] = data[i] ^ 0x5A;
+		card_respond (out, lc, le, rcv, rcvlen);
+		break;
+	case 0xB0:		/* READ BINARY */
+		off = (p1 & 0x80) ? p2 : ((p1 & 0x7F) << 8) | p2;
+		if (off > SIM_FILE_SIZE) {
+			card_sw (rcv, rcvlen, 0x6B, 0x00);
+			break;
+		}
+		n = SIM_FILE_SIZE - off;
+		if (n > le)
+			n = le;
+		if (*rcvlen < n + 2)
+			return SCARD_E_INSUFFICIENT_BUFFER;
+		memcpy (rcv, &card.file[off], n);
+		rcv[n] = 0x90;
+		rcv[n + 1] = 0x00;
+		*rcvlen = n + 2;
+		break;
+	case 0xD6:		/* UPDATE BINARY */
+		off = (p1 & 0x80) ? p2 : ((p1 & 0x7F) << 8) | p2;
+		if (off + lc > SIM_FILE_SIZE) {
+			card_sw (rcv, rcvlen, 0x6B, 0x00);
+			break;
+		}
+		memcpy (&card.file[off], data, lc);
+		card_sw (rcv, rcvlen, 0x90, 0x00);
+		break;
+	case 0xC0:		/* GET RESPONSE */
+		ngetresp++;
+		if (!card.resplen || card.respoff >= card.resplen) {
+			card_sw (rcv, rcvlen, 0x6F, 0x00);
+			break;
+		}
+		n = card.resplen - card.respoff;
+		memmove (card.resp, &card.resp[card.respoff], n);
+		card_respond (card.resp, n, le, rcv, rcvlen);
+		break;
+	default:
+		card_sw (rcv, rcvlen, 0x6D, 0x00);
+		break;
+	}
+	return SCARD_S_SUCCESS;
+wrong_length:
+	card.chainlen = 0;
+	card_sw (rcv, rcvlen, 0x67, 0x00);
+	return SCARD_S_SUCCESS;
+}
+
+/* standard I/O layer */
+
+void *
+IDMan_StMalloc (unsigned long int size)
+{
+	return malloc (size);
+}
+
+void
+IDMan_StFree (void *p)
+{
+	free (p);
+}
+
+char *
+IDMan_StStrcpy (char *dst, const char *src)
+{
+	return memcpy (dst, src, strlen (src) + 1);
+}
+
+long int
+IDMan_StAtol (const char *s)
+{
+	return strtol (s, NULL, 10);
+}
+
+int
+IDMan_StReadSetData (char *pMemberName, char *pInfo, unsigned long int *len)
+{
+	char *val;
+
+	if (!strcmp (pMemberName, MAXPINLEN) ||
+	    !strcmp (pMemberName, MINPINLEN))
+		val = "16";
+	else
+		return -1;
+	memcpy (pInfo, val, strlen (val) + 1);
+	*len = strlen (val);
+	return 0;
+}
+
+/* the certificate and hash helpers are not used on the paths below */
+
+long
+IDMan_CmMkHash (void *data, long len, long algorithm, void *hash,
+		long *hashlen)
+{
+	return -1;
+}
+
+long
+IDMan_CmChgRSA (void *a, long alen, void *b, long blen, void *c, long *clen)
+{
+	return -1;
+}
+
+long
+IDMan_CmGetDN (void *cert, long len, char *subject, char *issuer)
+{
+	return -1;
+}
+
+long
+IDMan_CmGetCertificateSign (void *cert, long len, void *tbs, long *tbslen,
+			    void *sign, long *signlen)
+{
+	return -1;
+}
+
+static double
+now (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+reset_counters (void)
+{
+	napdu = nchained = ngetresp = nextended = 0;
+	memset (apdu_ins, 0, sizeof apdu_ins);
+}
+
+static void
+bench_sign (unsigned long session)
+{
+	unsigned char hash[20], sig[256];
+	unsigned short siglen;
+	double t;
+	int i, r;
+
+	memset (hash, 0x11, sizeof hash);
+	siglen = sizeof sig;
+	r = IDMan_EncryptByIndex (session, 1, hash, sizeof hash, sig,
+				  &siglen, ALGORITHM_SHA1);
+	if (r)
+		fail ("first signature");
+	reset_counters ();
+	t = now ();
+	for (i = 0; i < SIGN_ROUNDS; i++) {
+		siglen = sizeof sig;
+		r = IDMan_EncryptByIndex (session, 1, hash, sizeof hash, sig,
+					  &siglen, ALGORITHM_SHA1);
+		if (r)
+			fail ("signature");
+	}
+	t = now () - t;
+	printf ("sign: %d signatures, %.2f APDUs/signature,"
+		" %.2f us/signature\n", SIGN_ROUNDS,
+		(double)napdu / SIGN_ROUNDS, t * 1e6 / SIGN_ROUNDS);
+	/* SELECT of the key file and INTERNAL AUTHENTICATE only */
+	if (napdu != 2 * SIGN_ROUNDS || apdu_ins[0x88] != SIGN_ROUNDS ||
+	    apdu_ins[0xA4] != SIGN_ROUNDS)
+		fail ("cached signature sends more than SELECT and"
+		      " INTERNAL AUTHENTICATE");
+}
+
+static void
+bench_session (unsigned long *session)
+{
+	unsigned long first;
+	double t;
+	int i;
+
+	first = *session;
+	reset_counters ();
+	t = now ();
+	for (i = 0; i < SESSION_ROUNDS; i++) {
+		if (IDMan_IPFinalize (*session))
+			fail ("finalize");
+		if (IDMan_IPInitialize (SIM_PIN, session))
+			fail ("initialize");
+		if (*session != first)
+			fail ("pooled session not reused");
+	}
+	t = now () - t;
+	printf ("session: %d logout/login cycles, %.2f APDUs/cycle,"
+		" %.2f us/cycle\n", SESSION_ROUNDS,
+		(double)napdu / SESSION_ROUNDS, t * 1e6 / SESSION_ROUNDS);
+	if (apdu_ins[0xA4] != SESSION_ROUNDS ||
+	    apdu_ins[0x20] != SESSION_ROUNDS)
+		fail ("pooled login sends more than SELECT and VERIFY");
+}
+
+static void
+test_removal (unsigned long *session)
+{
+	unsigned char serial[16];
+
+	if (IDMan_IPSessionSerial (*session, serial))
+		fail ("no serial while logged in");
+	card_remove ();
+	if (!IDMan_CheckCardStatus (*session))
+		fail ("card removal not detected");
+	if (!IDMan_IPSessionSerial (*session, serial))
+		fail ("serial kept after card removal");
+	IDMan_IPFinalize (*session);
+	if (!IDMan_IPInitialize (SIM_PIN, session))
+		fail ("login without a card");
+	card_insert (1);
+	IDMan_IPFinalizeReader ();
+	if (IDMan_IPInitializeReader ())
+		fail ("reader reinitialize");
+	if (IDMan_IPInitialize (SIM_PIN, session))
+		fail ("login after reinsertion");
+	if (IDMan_IPSessionSerial (*session, serial))
+		fail ("no serial after reinsertion");
+	printf ("removal: serial and pooled session dropped,"
+		" login after reinsertion ok\n");
+}
+
+static void
+test_chaining (int extlen)
+{
+	CK_BYTE data[600], rcv[4096];
+	CK_ULONG rcvlen, dwprot = SCARD_PROTOCOL_T1, i;
+	CK_RV rv;
+
+	card_insert (extlen);
+	card.verified = 1;
+	for (i = 0; i < sizeof data; i++)
+		data[i] = (CK_BYTE)i;
+
+	reset_counters ();
+	rcvlen = sizeof rcv;
+	rv = InternalAuth (card.gen, &dwprot, data, 300, rcv, &rcvlen);
+	if (rv != CKR_OK || rcvlen != 302)
+		fail ("long INTERNAL AUTHENTICATE");
+	for (i = 0; i < 300; i++)
+		if (rcv[i] != (data[i] ^ 0x5A))
+			fail ("INTERNAL AUTHENTICATE response");
+
+	rcvlen = sizeof rcv;
+	rv = UpdateBinary (card.gen, &dwprot, data, sizeof data, rcv,
+			   &rcvlen);
+	if (rv != CKR_OK || memcmp (card.file, data, sizeof data))
+		fail ("long UPDATE BINARY");
+
+	rcvlen = sizeof rcv;
+	rv = ReadBinary (card.gen, &dwprot, EF_CDFZV, rcv, &rcvlen);
+	if (rv != CKR_OK || rcvlen != SIM_FILE_SIZE + 2 ||
+	    memcmp (rcv, card.file, SIM_FILE_SIZE))
+		fail ("long READ BINARY");
+	printf ("%s card: %lu APDUs, %lu extended, %lu chained,"
+		" %lu GET RESPONSE\n", extlen ? "extended" : "short",
+		napdu, nextended, nchained, ngetresp);
+}
+
+int
+main (int argc, char **argv)
+{
+	unsigned long session;
+
+	card_insert (1);
+	if (IDMan_IPInitializeReader ())
+		fail ("reader initialize");
+	if (IDMan_IPInitialize (SIM_PIN, &session))
+		fail ("initialize");
+	bench_sign (session);
+	bench_session (&session);
+	test_removal (&session);
+	IDMan_IPFinalize (session);
+	IDMan_IPFinalizeReader ();
+	test_chaining (1);
+	test_chaining (0);
+	printf ("cardsim: ok\n");
+	return 0;
+}
@@ -0,0 +1,288 @@
+/*
+ * Copyright (c) 2007, 2008 University of Tsukuba
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the University of Tsukuba nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* extract a crash dump written by core/panic_dump.c */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PAGESIZE	4096
+#define SECTORSIZE	512
+#define LZSS_MINLEN	3
+#define MAX_RANGES	8
+
+struct panic_dump_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t complete;
+	uint64_t vmm_virt;
+	uint64_t vmm_phys;
+	uint64_t vmm_size;
+	uint64_t data_bytes;
+	uint64_t time;
+	uint32_t cpu;
+	uint32_t chunk_size;
+	uint64_t code, codeend;
+	char panicmsg[1024];
+	uint32_t nranges;
+	struct {
+		uint64_t virt, phys, size;
+	} __attribute__ ((packed)) range[MAX_RANGES];
+} __attribute__ ((packed));
+
+static FILE *in;
+static unsigned char *chunk;
+static uint32_t chunk_size, chunk_pos, chunk_len;
+static uint64_t remain;
+
+static uint32_t
+crc32 (unsigned char *buf, uint32_t len)
+{
+	uint32_t crc = ~0U;
+	int i;
+
+	while (len--) {
+		crc ^= *buf++;
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+	}
+	return ~crc;
+}
+
+static int
+read_chunk (void)
+{
+	uint32_t crc;
+
+	if (fread (chunk, chunk_size, 1, in) != 1) {
+		fprintf (stderr, "short read\n");
+		return -1;
+	}
+	memcpy (&crc, chunk + chunk_size - 4, 4);
+	if (crc32 (chunk, chunk_size - 4) != crc) {
+		fprintf (stderr, "chunk checksum mismatch\n");
+		return -1;
+	}
+	chunk_pos = 0;
+	chunk_len = chunk_size - 4;
+	return 0;
+}
+
+static int
+get (void *buf, uint32_t len)
+{
+	unsigned char *p = buf;
+	uint32_t n;
+
+	if (len > remain) {
+		fprintf (stderr, "truncated stream\n");
+		return -1;
+	}
+	remain -= len;
+	while (len > 0) {
+		if (chunk_pos == chunk_len && read_chunk () < 0)
+			return -1;
+		n = chunk_len - chunk_pos;
+		if (n > len)
+			n = len;
+		memcpy (p, chunk + chunk_pos, n);
+		chunk_pos += n;
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int
+lzss_decompress (unsigned char *in, uint32_t len, unsigned char *out)
+{
+	uint32_t i = 0, o = 0, dist, n, nitems = 0;
+	unsigned char flags = 0;
+
+	while (o < PAGESIZE) {
+		if (!(nitems++ & 7)) {
+			if (i >= len)
+				return -1;
+			flags = in[i++];
+		}
+		if (flags & 1) {
+			if (i + 2 > len)
+				return -1;
+			dist = in[i] | (in[i + 1] & 0xF) << 8;
+			n = (in[i + 1] >> 4) + LZSS_MINLEN;
+			i += 2;
+			if (!dist || dist > o || o + n > PAGESIZE)
+				return -1;
+			for (; n > 0; n--, o++)
+				out[o] = out[o - dist];
+		} else {
+			if (i >= len)
+				return -1;
+			out[o++] = in[i++];
+		}
+		flags >>= 1;
+	}
+	return 0;
+}
+
+static void
+usage (char *name)
+{
+	fprintf (stderr, "usage: %s [-l lba] device-or-file [output]\n",
+		 name);
+	exit (2);
+}
+
+int
+main (int argc, char **argv)
+{
+	struct panic_dump_header h;
+	unsigned char page[PAGESIZE], buf[PAGESIZE];
+	unsigned long long lba = 0;
+	uint64_t off, total;
+	uint16_t len;
+	FILE *out = NULL;
+	uint32_t i;
+	int c;
+
+	while ((c = getopt (argc, argv, "l:")) != -1) {
+		switch (c) {
+		case 'l':
+			lba = strtoull (optarg, NULL, 0);
+			break;
+		default:
+			usage (argv[0]);
+		}
+	}
+	if (optind >= argc || argc - optind > 2)
+		usage (argv[0]);
+	in = fopen (argv[optind], "rb");
+	if (!in) {
+		perror (argv[optind]);
+		return 1;
+	}
+	if (fseeko (in, (off_t)lba * SECTORSIZE, SEEK_SET) ||
+	    fread (&h, sizeof h, 1, in) != 1 ||
+	    memcmp (h.magic, "VBCRASH1", sizeof h.magic)) {
+		fprintf (stderr, "no crash dump at LBA %llu\n", lba);
+		return 1;
+	}
+	h.panicmsg[sizeof h.panicmsg - 1] = '\0';
+	if (h.version < 2) {
+		h.nranges = 1;
+		h.range[0].virt = h.vmm_virt;
+		h.range[0].phys = h.vmm_phys;
+		h.range[0].size = h.vmm_size;
+	} else if (!h.nranges || h.nranges > MAX_RANGES) {
+		fprintf (stderr, "bad range count %u\n", h.nranges);
+		return 1;
+	}
+	printf ("version:   %u\n", h.version);
+	printf ("complete:  %s\n", h.complete ? "yes" : "no");
+	printf ("VMM:       virt 0x%llX phys 0x%llX size 0x%llX\n",
+		(unsigned long long)h.vmm_virt,
+		(unsigned long long)h.vmm_phys,
+		(unsigned long long)h.vmm_size);
+	total = 0;
+	for (i = 0; i < h.nranges; i++) {
+		printf ("node %u:    virt 0x%llX phys 0x%llX size 0x%llX"
+			" at output offset 0x%llX\n", i,
+			(unsigned long long)h.range[i].virt,
+			(unsigned long long)h.range[i].phys,
+			(unsigned long long)h.range[i].size,
+			(unsigned long long)total);
+		total += h.range[i].size;
+	}
+	printf ("code:      0x%llX-0x%llX\n", (unsigned long long)h.code,
+		(unsigned long long)h.codeend);
+	printf ("time:      %llu usec\n", (unsigned long long)h.time);
+	printf ("CPU:       %u\n", h.cpu);
+	printf ("message:   %s\n", h.panicmsg);
+	if (argc - optind < 2)
+		return 0;
+	if (!h.complete) {
+		fprintf (stderr, "crash dump is incomplete\n");
+		return 1;
+	}
+	if (h.chunk_size <= 4 || h.chunk_size % SECTORSIZE) {
+		fprintf (stderr, "bad chunk size %u\n", h.chunk_size);
+		return 1;
+	}
+	chunk_size = h.chunk_size;
+	chunk = malloc (chunk_size);
+	if (!chunk) {
+		perror ("malloc");
+		return 1;
+	}
+	remain = h.data_bytes;
+	if (fseeko (in, (off_t)lba * SECTORSIZE + PAGESIZE, SEEK_SET)) {
+		perror ("seek");
+		return 1;
+	}
+	out = fopen (argv[optind + 1], "wb");
+	if (!out) {
+		perror (argv[optind + 1]);
+		return 1;
+	}
+	for (off = 0; off < total; off += PAGESIZE) {
+		if (get (&len, sizeof len) < 0)
+			goto error;
+		if (!len) {
+			memset (page, 0, PAGESIZE);
+		} else if (len == PAGESIZE) {
+			if (get (page, PAGESIZE) < 0)
+				goto error;
+		} else if (len > PAGESIZE) {
+			fprintf (stderr, "bad page length %u\n", len);
+			goto error;
+		} else {
+			if (get (buf, len) < 0)
+				goto error;
+			if (lzss_decompress (buf, len, page) < 0) {
+				fprintf (stderr, "bad page at 0x%llX\n",
+					 (unsigned long long)off);
+				goto error;
+			}
+		}
+		if (fwrite (page, PAGESIZE, 1, out) != 1) {
+			perror (argv[optind + 1]);
+			goto error;
+		}
+	}
+	fclose (out);
+	printf ("wrote %llu bytes to %s\n", (unsigned long long)total,
+		argv[optind + 1]);
+	return 0;
+error:
+	fclose (out);
+	return 1;
+}
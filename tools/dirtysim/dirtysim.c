@@ -0,0 +1,459 @@
+/*
+ * Copyright (c) 2007, 2008 University of Tsukuba
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the University of Tsukuba nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* userspace test of the dirty page harvesting in core/dirtylog.c.
+   vcpu threads write random guest pages the way VT-x does while the
+   log is on: half of them take a write-protection fault on the first
+   write to a page in an epoch, the other half append the page to a
+   page-modification log that is drained when it is full and when the
+   vcpu picks up a new epoch before VM entry.  They also write pages
+   as the VMM does, marking them first.  The main thread harvests,
+   waits for every vcpu to switch, and copies the pages returned by
+   dirtylog_next() to an image; a copy sometimes fails and marks the
+   page dirty again, as storage/checkpoint.c does.  After a harvest
+   the image must have every page as new as it was when the harvest
+   started.  Once the vcpus stop writing and two more harvests are
+   done, the image must equal the guest memory. */
+
+#include <asm/prctl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define PAGESHIFT	12
+#define NPAGES		8192	/* 32MiB */
+#define PML_ENTRIES	512
+#define MAX_VCPUS	16
+#define DEFAULT_VCPUS	4
+#define DEFAULT_ROUNDS	2000
+#define FAIL_ODDS	50000	/* one in FAIL_ODDS page writes fails */
+#define HOT_PAGES	64
+
+enum phase {
+	PHASE_RUN,
+	PHASE_QUIET,
+	PHASE_EXIT,
+};
+
+struct vcpu;
+
+struct thread {
+	pthread_t t;
+	struct vcpu *v;
+	u_int32_t *epoch;
+	int pml;
+	int tracking;
+	int quiet;
+	unsigned long long rnd_state;
+	unsigned char mapped[NPAGES]; /* writable or dirty in the EPT */
+	unsigned long long log[PML_ENTRIES];
+	int nlog;
+	unsigned long long writes, faults, full, vmm;
+};
+
+void sim_setup (unsigned long long *map, int n);
+struct vcpu *sim_vcpu_new (void);
+u_int32_t *sim_vcpu_epoch (struct vcpu *p);
+void sim_mark_epoch (u_int32_t epoch, unsigned long long gphys, int pml);
+char *sim_status (void);
+extern char sim_gs[];
+
+int dirtylog_start (void);
+void dirtylog_stop (void);
+unsigned long long dirtylog_npages (void);
+void dirtylog_harvest (void);
+int dirtylog_harvested (void);
+unsigned long long dirtylog_next (unsigned long long pfn);
+void dirtylog_mark (unsigned long long gphys, unsigned int len);
+u_int32_t dirtylog_epoch (void);
+int dirtylog_tracking (void);
+
+/* as in core/pcpu.c.  they are not defined in dlog.c because the
+   assembler would resolve the %rip-relative references there */
+#define DEFINE_GS_OFFSET(name, offset) \
+	asm (".globl " #name "; " #name " = " #offset)
+
+DEFINE_GS_OFFSET (gs_currentcpu, 8);
+DEFINE_GS_OFFSET (gs_current, 24);
+
+/* RAM, a hole below 1MiB, RAM, a reserved range, RAM */
+static unsigned long long memmap[] = {
+	0x0, 0x9F000, 1,
+	0x9F000, 0x61000, 0,
+	0x100000, 0xF00000, 1,
+	0x1000000, 0x100000, 0,
+	0x1100000, 0xF00000, 1,
+};
+
+static unsigned long long mem[NPAGES];	/* version of each page */
+static unsigned long long image[NPAGES];
+static unsigned long long before[NPAGES];
+static unsigned long long version;
+static unsigned char is_ram[NPAGES];
+static unsigned int ram[NPAGES], nram;
+static volatile enum phase phase;
+static struct thread threads[MAX_VCPUS];
+static int nthreads = DEFAULT_VCPUS;
+static unsigned long long seed = 0x2545F4914F6CDD1DULL;
+static int verbose;
+
+static struct {
+	unsigned long long harvests, saved, failed, restarts;
+} stat;
+
+static unsigned long long
+rnd (unsigned long long *state)
+{
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static void
+fail (char *format, ...)
+{
+	va_list ap;
+
+	va_start (ap, format);
+	fprintf (stderr, "dirtysim: ");
+	vfprintf (stderr, format, ap);
+	fprintf (stderr, "\n");
+	va_end (ap);
+	exit (1);
+}
+
+void *
+dl_alloc (unsigned int len)
+{
+	void *p;
+
+	p = malloc (len);
+	if (!p)
+		fail ("out of memory");
+	return p;
+}
+
+int
+dl_printf (const char *format, ...)
+{
+	va_list ap;
+	int n;
+
+	va_start (ap, format);
+	n = vprintf (format, ap);
+	va_end (ap);
+	return n;
+}
+
+/* --- vcpus --- */
+
+static unsigned int
+guest_page (struct thread *t)
+{
+	if (rnd (&t->rnd_state) & 1)
+		return ram[nram / 2 + rnd (&t->rnd_state) % HOT_PAGES];
+	return ram[rnd (&t->rnd_state) % nram];
+}
+
+static void
+page_write (unsigned int pfn)
+{
+	__atomic_store_n (&mem[pfn], __atomic_add_fetch (&version, 1,
+							 __ATOMIC_RELAXED),
+			  __ATOMIC_RELEASE);
+}
+
+/* PML-full exit, or the epoch switch */
+static void
+pml_drain (struct thread *t)
+{
+	int i;
+
+	for (i = 0; i < t->nlog; i++)
+		sim_mark_epoch (*t->epoch, t->log[i] << PAGESHIFT, 1);
+	t->nlog = 0;
+}
+
+/* before VM entry; see vt_ept_dirtylog() */
+static void
+pickup (struct thread *t)
+{
+	u_int32_t epoch;
+
+	epoch = dirtylog_epoch ();
+	if (*t->epoch == epoch)
+		return;
+	if (t->pml && t->tracking)
+		pml_drain (t);
+	t->tracking = dirtylog_tracking ();
+	__atomic_store_n (t->epoch, epoch, __ATOMIC_RELEASE);
+	memset (t->mapped, 0, sizeof t->mapped);
+}
+
+static void
+guest_write (struct thread *t, unsigned int pfn)
+{
+	if (t->pml) {
+		page_write (pfn);
+		if (t->tracking && !t->mapped[pfn]) {
+			t->mapped[pfn] = 1;
+			t->log[t->nlog++] = pfn;
+			if (t->nlog == PML_ENTRIES) {
+				pml_drain (t);
+				t->full++;
+			}
+		}
+	} else {
+		if (t->tracking && !t->mapped[pfn]) {
+			/* EPT violation */
+			sim_mark_epoch (*t->epoch, pfn << PAGESHIFT, 0);
+			t->mapped[pfn] = 1;
+			t->faults++;
+		}
+		page_write (pfn);
+	}
+	t->writes++;
+}
+
+/* a VM exit handler writing guest memory, sometimes past the end of
+   a RAM range */
+static void
+vmm_write (struct thread *t)
+{
+	unsigned int pfn, n, i;
+
+	pfn = guest_page (t);
+	n = 1 + rnd (&t->rnd_state) % 3;
+	if (rnd (&t->rnd_state) % 4 == 0) {
+		while (pfn + 1 < NPAGES && is_ram[pfn + 1])
+			pfn++;
+		pfn -= n / 2;
+	}
+	dirtylog_mark (((unsigned long long)pfn << PAGESHIFT) + 100,
+		       (n - 1) * 4096 + 1);
+	for (i = 0; i < n && pfn + i < NPAGES; i++)
+		if (is_ram[pfn + i])
+			page_write (pfn + i);
+	t->vmm++;
+}
+
+static void *
+vcpu_main (void *arg)
+{
+	struct thread *t = arg;
+	int i, n;
+
+	while (phase != PHASE_EXIT) {
+		pickup (t);
+		if (phase != PHASE_RUN) {
+			__atomic_store_n (&t->quiet, 1, __ATOMIC_RELEASE);
+			sched_yield ();
+			continue;
+		}
+		n = 1 + rnd (&t->rnd_state) % 64;
+		for (i = 0; i < n; i++)
+			guest_write (t, guest_page (t));
+		if (rnd (&t->rnd_state) % 8 == 0)
+			vmm_write (t);
+		/* a VM exit now and then */
+		usleep (rnd (&t->rnd_state) % 200);
+	}
+	return NULL;
+}
+
+/* --- the consumer --- */
+
+/* a harvest returns every page written before it, unless the
+   previous scan failed and left the page in the other bitmap */
+static void
+harvest (int may_fail)
+{
+	static int failed;
+	unsigned long long pfn, npages;
+	int check;
+
+	for (pfn = 0; pfn < NPAGES; pfn++)
+		before[pfn] = __atomic_load_n (&mem[pfn], __ATOMIC_ACQUIRE);
+	dirtylog_harvest ();
+	while (!dirtylog_harvested ())
+		sched_yield ();
+	stat.harvests++;
+	check = !failed;
+	failed = 0;
+	npages = dirtylog_npages ();
+	for (pfn = dirtylog_next (0); pfn < npages;
+	     pfn = dirtylog_next (pfn + 1)) {
+		if (!is_ram[pfn])
+			fail ("page %llu is not RAM", pfn);
+		if (may_fail && rnd (&seed) % FAIL_ODDS == 0) {
+			/* the write failed; the remaining bits are
+			   returned by a later harvest */
+			dirtylog_mark (pfn << PAGESHIFT, 4096);
+			stat.failed++;
+			failed = 1;
+			break;
+		}
+		image[pfn] = __atomic_load_n (&mem[pfn], __ATOMIC_ACQUIRE);
+		stat.saved++;
+	}
+	if (!check || failed)
+		return;
+	for (pfn = 0; pfn < NPAGES; pfn++)
+		if (image[pfn] < before[pfn])
+			fail ("harvest %llu misses page %llu written before"
+			      " it", stat.harvests, pfn);
+}
+
+static void
+setup (void)
+{
+	unsigned long long base, end, pfn;
+	int i, n;
+
+	n = sizeof memmap / sizeof memmap[0] / 3;
+	for (i = 0; i < n; i++) {
+		if (!memmap[i * 3 + 2])
+			continue;
+		base = memmap[i * 3] >> PAGESHIFT;
+		end = (memmap[i * 3] + memmap[i * 3 + 1]) >> PAGESHIFT;
+		for (pfn = base; pfn < end && pfn < NPAGES; pfn++) {
+			is_ram[pfn] = 1;
+			ram[nram++] = pfn;
+		}
+	}
+	sim_setup (memmap, n);
+	/* dirtylog_start() looks at current and currentcpu */
+	if (syscall (SYS_arch_prctl, ARCH_SET_GS, sim_gs))
+		fail ("cannot set the %%gs base");
+	for (i = 0; i < nthreads; i++) {
+		threads[i].v = sim_vcpu_new ();
+		threads[i].epoch = sim_vcpu_epoch (threads[i].v);
+		threads[i].pml = i & 1;
+		threads[i].rnd_state = seed + (i + 1) * 0x9E3779B97F4A7C15ULL;
+	}
+}
+
+int
+main (int argc, char **argv)
+{
+	unsigned long long pfn, bad, writes, faults, full, vmm;
+	int c, i, rounds = DEFAULT_ROUNDS;
+
+	while ((c = getopt (argc, argv, "n:s:t:v")) != -1) {
+		switch (c) {
+		case 'n':
+			rounds = atoi (optarg);
+			break;
+		case 's':
+			seed = strtoull (optarg, NULL, 0) | 1;
+			break;
+		case 't':
+			nthreads = atoi (optarg);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			fprintf (stderr, "usage: dirtysim [-v] [-n rounds]"
+				 " [-s seed] [-t vcpus]\n");
+			return 1;
+		}
+	}
+	if (nthreads < 1 || nthreads > MAX_VCPUS) {
+		fprintf (stderr, "dirtysim: 1 to %d vcpus\n", MAX_VCPUS);
+		return 1;
+	}
+	setup ();
+	if (!dirtylog_start ())
+		fail ("dirtylog_start fails");
+	if (dirtylog_npages () != NPAGES)
+		fail ("%llu pages tracked", dirtylog_npages ());
+	phase = PHASE_RUN;
+	for (i = 0; i < nthreads; i++)
+		if (pthread_create (&threads[i].t, NULL, vcpu_main,
+				    &threads[i]))
+			fail ("pthread_create");
+	for (i = 0; i < rounds; i++) {
+		usleep (rnd (&seed) % 2000);
+		if (i == rounds / 2) {
+			/* stop and restart; every page is returned again */
+			dirtylog_stop ();
+			usleep (1000);
+			if (!dirtylog_start ())
+				fail ("dirtylog_start fails");
+			stat.restarts++;
+		}
+		harvest (1);
+	}
+	phase = PHASE_QUIET;
+	for (i = 0; i < nthreads; i++)
+		while (!__atomic_load_n (&threads[i].quiet, __ATOMIC_ACQUIRE))
+			sched_yield ();
+	/* one harvest for each of the two bitmaps */
+	harvest (0);
+	harvest (0);
+	phase = PHASE_EXIT;
+	writes = faults = full = vmm = 0;
+	for (i = 0; i < nthreads; i++) {
+		pthread_join (threads[i].t, NULL);
+		writes += threads[i].writes;
+		faults += threads[i].faults;
+		full += threads[i].full;
+		vmm += threads[i].vmm;
+	}
+	bad = 0;
+	for (pfn = 0; pfn < NPAGES; pfn++) {
+		if (image[pfn] != mem[pfn]) {
+			if (!bad)
+				fprintf (stderr, "dirtysim: page %llu is"
+					 " version %llu in the image, %llu in"
+					 " memory\n", pfn, image[pfn],
+					 mem[pfn]);
+			bad++;
+		}
+	}
+	printf ("vcpus %d harvests %llu restarts %llu\n", nthreads,
+		stat.harvests, stat.restarts);
+	printf ("guest writes %llu wp faults %llu pml full %llu vmm writes"
+		" %llu\n", writes, faults, full, vmm);
+	printf ("pages saved %llu failed scans %llu\n", stat.saved,
+		stat.failed);
+	if (verbose)
+		printf ("%s", sim_status ());
+	if (bad)
+		fail ("%llu pages differ", bad);
+	printf ("dirtysim: ok\n");
+	return 0;
+}
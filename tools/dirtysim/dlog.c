@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2007, 2008 University of Tsukuba
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the University of Tsukuba nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* core/dirtylog.c built for the host with the VMM headers.  alloc()
+   and printf() are renamed on the command line and supplied by
+   dirtysim.c.  current and currentcpu are %gs-relative as in the
+   VMM; dirtysim.c defines their offsets and points %gs of the
+   thread that starts the log at sim_gs. */
+
+#include "../../core/dirtylog.c"
+#include "../../core/pcpu.h"
+
+struct sim_ram {
+	u64 base, len;
+	u32 type;
+};
+
+static struct pcpu sim_pcpu;
+static struct vcpu sim_vcpu0;
+static struct vcpu *sim_vcpus;
+static struct sim_ram *sim_map;
+static int sim_nmap;
+struct pcpu_gs sim_gs;
+
+u32
+getfakesysmemmap (u32 n, u64 *base, u64 *len, u32 *type)
+{
+	*base = sim_map[n].base;
+	*len = sim_map[n].len;
+	*type = sim_map[n].type;
+	return n + 1 < sim_nmap ? n + 1 : 0;
+}
+
+void
+register_status_callback (char *(*func) (void))
+{
+}
+
+void
+vcpu_list_foreach (bool (*func) (struct vcpu *p, void *q), void *q)
+{
+	struct vcpu *p;
+
+	for (p = sim_vcpus; p; p = p->next)
+		if (func (p, q))
+			break;
+}
+
+/* the guest memory map: n entries of base, length and type, type 1
+   for RAM */
+void
+sim_setup (u64 *map, int n)
+{
+	int i;
+
+	sim_map = alloc (n * sizeof *sim_map);
+	for (i = 0; i < n; i++) {
+		sim_map[i].base = map[i * 3];
+		sim_map[i].len = map[i * 3 + 1];
+		sim_map[i].type = map[i * 3 + 2] ? SYSMEMMAP_TYPE_AVAILABLE :
+			SYSMEMMAP_TYPE_RESERVED;
+	}
+	sim_nmap = n;
+	sim_pcpu.fullvirtualize = FULLVIRTUALIZE_VT;
+	sim_vcpu0.u.vt.ept = (void *)&sim_vcpu0; /* not used */
+	sim_gs.currentcpu = &sim_pcpu;
+	sim_gs.current = &sim_vcpu0;
+	dirtylog_init ();
+}
+
+struct vcpu *
+sim_vcpu_new (void)
+{
+	struct vcpu *p;
+
+	p = alloc (sizeof *p);
+	memset (p, 0, sizeof *p);
+	p->dirtylog_epoch = dirtylog_epoch ();
+	p->next = sim_vcpus;
+	sim_vcpus = p;
+	return p;
+}
+
+u32 *
+sim_vcpu_epoch (struct vcpu *p)
+{
+	return &p->dirtylog_epoch;
+}
+
+void
+sim_mark_epoch (u32 epoch, u64 gphys, int pml)
+{
+	dirtylog_mark_epoch (epoch, gphys, pml ? DIRTYLOG_SOURCE_PML :
+			     DIRTYLOG_SOURCE_WP);
+}
+
+char *
+sim_status (void)
+{
+	return dirtylog_status ();
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2007, 2008 University of Tsukuba
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the University of Tsukuba nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* process/lib/lib_mm.c built for the host.  alloc(), free(),
+   realloc(), printf() and panic() are renamed on the command line;
+   mmbench.c supplies printf() and panic().  The heap is as large as
+   the one of the VPN process. */
+
+#include "../../process/lib/lib_mm.c"
+
+#define HEAP_INTS	1048576
+
+int heap[HEAP_INTS], heaplen = HEAP_INTS;
+
+/* start over with an empty heap */
+void
+mm_reset (void)
+{
+	memset (class, 0, sizeof class);
+	memset (&heapstat, 0, sizeof heapstat);
+	lock = 0;
+	initialized = 0;
+}
+
+/* panic() does not return in a process; the check longjmp()s out of
+   it with the lock held */
+void
+mm_unlock (void)
+{
+	int i;
+
+	lock = 0;
+	for (i = 0; i < NUM_OF_CLASS; i++)
+		class[i].lock = 0;
+}
+
+/* the boundary-tag heap alone, as every allocation used it before
+   the size classes */
+void *
+mm_heap_alloc (unsigned int size)
+{
+	return heap_alloc (size);
+}
+
+void
+mm_heap_free (void *m)
+{
+	heap_free (m);
+}
+
+/* free bytes of the heap, the largest free block and the longest
+   first-fit walk */
+void
+mm_heap_stat (unsigned int *total, unsigned int *largest,
+	      unsigned int *maxwalk)
+{
+	int *p;
+
+	spinlock_lock (&lock);
+	if (!initialized)
+		prepare ();
+	*total = 0;
+	*largest = 0;
+	p = heap + heaplen - 1;
+	while (*p) {
+		if (*p < 0) {
+			*total -= *p * sizeof *p;
+			if (*largest < -*p * sizeof *p)
+				*largest = -*p * sizeof *p;
+			p += *p - 1;
+		} else {
+			p -= *p + 1;
+		}
+	}
+	*maxwalk = heapstat.maxwalk;
+	spinlock_unlock (&lock);
+}
+
+/* blocks in the slabs of all classes, used and free */
+void
+mm_class_stat (unsigned int *used, unsigned int *nfree,
+	      unsigned int *slabs)
+{
+	int i;
+
+	*used = *nfree = *slabs = 0;
+	for (i = 0; i < NUM_OF_CLASS; i++) {
+		*used += class[i].nused * class_size[i];
+		*nfree += class[i].nfree * class_size[i];
+		*slabs += class[i].nslab;
+	}
+}
+
+void
+mm_dump_stat (void)
+{
+	spinlock_lock (&lock);
+	heap_dump_stat ();
+	spinlock_unlock (&lock);
+}
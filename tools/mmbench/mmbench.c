@@ -0,0 +1,451 @@
+/*
+ * Copyright (c) 2007, 2008 University of Tsukuba
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the University of Tsukuba nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* userspace check and benchmark of the process allocator in
+   process/lib/lib_mm.c.  The check allocates, reallocates and frees
+   random sizes, verifies the contents of every block and that a
+   double or bad free panics.  The benchmark runs a few allocation
+   patterns of the processes through the size classes and through the
+   boundary-tag heap alone, which is what every allocation used
+   before, and prints the time per operation, the longest first-fit
+   walk and the fragmentation of the heap.  The threaded run shows
+   how the per-class locks scale. */
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_LIVE	4096
+#define MAX_THREADS	16
+#define DEFAULT_OPS	1000000
+#define DEFAULT_THREADS	4
+
+struct live {
+	unsigned char *p;
+	unsigned int len;
+	unsigned char tag;
+};
+
+struct pattern {
+	char *name;
+	unsigned int nlive;
+	unsigned int (*size) (unsigned long long *rnd_state);
+};
+
+struct thread {
+	pthread_t t;
+	int heap_only;
+	unsigned long long rnd_state;
+	unsigned long long ops;
+};
+
+void mm_reset (void);
+void mm_unlock (void);
+void *mm_alloc (unsigned int size);
+void mm_free (void *m);
+void *mm_realloc (void *virt, unsigned int len);
+void *mm_heap_alloc (unsigned int size);
+void mm_heap_free (void *m);
+void mm_heap_stat (unsigned int *total, unsigned int *largest,
+		   unsigned int *maxwalk);
+void mm_class_stat (unsigned int *used, unsigned int *nfree,
+		    unsigned int *slabs);
+void mm_dump_stat (void);
+
+static unsigned long long seed = 0x2545F4914F6CDD1DULL;
+static int expect_panic;
+static jmp_buf panic_env;
+static struct live live[MAX_LIVE];
+
+static unsigned long long
+rnd (unsigned long long *state)
+{
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static double
+now_ns (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int
+mm_printf (const char *format, ...)
+{
+	va_list ap;
+	int n;
+
+	va_start (ap, format);
+	n = vprintf (format, ap);
+	va_end (ap);
+	return n;
+}
+
+void
+mm_panic (char *format, ...)
+{
+	va_list ap;
+
+	if (expect_panic) {
+		expect_panic = 0;
+		longjmp (panic_env, 1);
+	}
+	va_start (ap, format);
+	fprintf (stderr, "panic: ");
+	vfprintf (stderr, format, ap);
+	fprintf (stderr, "\n");
+	va_end (ap);
+	abort ();
+}
+
+static void
+fail (char *format, ...)
+{
+	va_list ap;
+
+	va_start (ap, format);
+	fprintf (stderr, "mmbench: ");
+	vfprintf (stderr, format, ap);
+	fprintf (stderr, "\n");
+	va_end (ap);
+	exit (1);
+}
+
+/* --- check --- */
+
+static void
+fill (struct live *l)
+{
+	unsigned int i;
+
+	for (i = 0; i < l->len; i++)
+		l->p[i] = l->tag + i;
+}
+
+static void
+verify (struct live *l, unsigned int len)
+{
+	unsigned int i;
+
+	for (i = 0; i < len; i++)
+		if (l->p[i] != (unsigned char)(l->tag + i))
+			fail ("block %p of %u bytes broken at %u", l->p,
+			      l->len, i);
+}
+
+static unsigned int
+check_size (unsigned long long *state)
+{
+	switch (rnd (state) % 8) {
+	case 0:
+		return 1 + rnd (state) % 8192;
+	case 1:
+	case 2:
+		return 1 + rnd (state) % 1024;
+	default:
+		return 1 + rnd (state) % 128;
+	}
+}
+
+static int
+panics (void (*func) (void *), void *arg)
+{
+	if (setjmp (panic_env)) {
+		mm_unlock ();
+		return 1;
+	}
+	expect_panic = 1;
+	func (arg);
+	expect_panic = 0;
+	return 0;
+}
+
+static void
+check (unsigned long long ops)
+{
+	unsigned long long st = seed, i;
+	unsigned int n, len, used, nfree, slabs;
+	struct live *l;
+	void *p;
+
+	mm_reset ();
+	memset (live, 0, sizeof live);
+	for (i = 0; i < ops; i++) {
+		l = &live[rnd (&st) % MAX_LIVE];
+		if (!l->p) {
+			l->len = check_size (&st);
+			l->tag = rnd (&st);
+			l->p = mm_alloc (l->len);
+			if (!l->p)
+				fail ("alloc %u returns NULL", l->len);
+			fill (l);
+		} else if (rnd (&st) % 4 == 0) {
+			len = check_size (&st);
+			p = mm_realloc (l->p, len);
+			if (!p)
+				fail ("realloc %u returns NULL", len);
+			l->p = p;
+			verify (l, len < l->len ? len : l->len);
+			l->len = len;
+			fill (l);
+		} else {
+			verify (l, l->len);
+			mm_free (l->p);
+			l->p = NULL;
+		}
+	}
+	for (n = 0; n < MAX_LIVE; n++) {
+		if (live[n].p) {
+			verify (&live[n], live[n].len);
+			mm_free (live[n].p);
+			live[n].p = NULL;
+		}
+	}
+	mm_class_stat (&used, &nfree, &slabs);
+	if (used)
+		fail ("%u bytes of small blocks in use after freeing all",
+		      used);
+	if (slabs > 11)
+		fail ("%u slabs kept after freeing all", slabs);
+
+	/* a double free and frees of pointers that alloc() did not
+	   return */
+	p = mm_alloc (40);
+	mm_free (p);
+	if (!panics (mm_free, p))
+		fail ("double free of a small block is not caught");
+	p = mm_alloc (4000);
+	mm_free (p);
+	if (!panics (mm_free, p))
+		fail ("double free of a large block is not caught");
+	p = mm_alloc (100);
+	if (!panics (mm_free, (char *)p + 8))
+		fail ("free of a pointer into a small block is not caught");
+	mm_free (p);
+	p = mm_alloc (4000);
+	if (!panics (mm_free, (char *)p + 64))
+		fail ("free of a pointer into a large block is not caught");
+	mm_free (p);
+	printf ("check: %llu operations ok\n", ops);
+}
+
+/* --- benchmark --- */
+
+/* requests and small buffers of the storage and IDMan processes */
+static unsigned int
+size_small (unsigned long long *state)
+{
+	return 16 + rnd (state) % 241;
+}
+
+/* packets of the VPN process */
+static unsigned int
+size_packet (unsigned long long *state)
+{
+	return 64 + rnd (state) % 1537;
+}
+
+static unsigned int
+size_mixed (unsigned long long *state)
+{
+	if (rnd (state) % 10)
+		return 8 + rnd (state) % 1017;
+	return 1025 + rnd (state) % 15360;
+}
+
+static struct pattern patterns[] = {
+	{ "small", 512, size_small },
+	{ "packet", 256, size_packet },
+	{ "mixed", 2048, size_mixed },
+};
+
+static void
+bench (struct pattern *pat, int heap_only, unsigned long long ops)
+{
+	unsigned long long st = seed, i;
+	unsigned int total, largest, maxwalk, used, nfree, slabs, n;
+	void **slot;
+	double t;
+
+	mm_reset ();
+	slot = calloc (pat->nlive, sizeof *slot);
+	if (!slot)
+		fail ("out of memory");
+	t = now_ns ();
+	for (i = 0; i < ops; i++) {
+		n = rnd (&st) % pat->nlive;
+		if (slot[n]) {
+			if (heap_only)
+				mm_heap_free (slot[n]);
+			else
+				mm_free (slot[n]);
+			slot[n] = NULL;
+		} else {
+			slot[n] = heap_only ? mm_heap_alloc (pat->size (&st))
+				: mm_alloc (pat->size (&st));
+		}
+	}
+	t = (now_ns () - t) / ops;
+	mm_heap_stat (&total, &largest, &maxwalk);
+	mm_class_stat (&used, &nfree, &slabs);
+	printf ("%-8s %-10s %8.1f %8u %8u %8u %8u %7.1f%%\n", pat->name,
+		heap_only ? "first-fit" : "classes", t, maxwalk, slabs,
+		nfree / 1024, total / 1024,
+		total ? 100.0 - 100.0 * largest / total : 0.0);
+	for (n = 0; n < pat->nlive; n++) {
+		if (slot[n]) {
+			if (heap_only)
+				mm_heap_free (slot[n]);
+			else
+				mm_free (slot[n]);
+		}
+	}
+	free (slot);
+}
+
+static void *
+thread_main (void *arg)
+{
+	struct thread *th = arg;
+	unsigned char *slot[256];
+	unsigned long long i;
+	unsigned int n, len;
+
+	memset (slot, 0, sizeof slot);
+	for (i = 0; i < th->ops; i++) {
+		n = rnd (&th->rnd_state) % 256;
+		if (slot[n]) {
+			if (slot[n][0] != n)
+				fail ("block of another thread");
+			if (th->heap_only)
+				mm_heap_free (slot[n]);
+			else
+				mm_free (slot[n]);
+			slot[n] = NULL;
+		} else {
+			len = size_small (&th->rnd_state);
+			slot[n] = th->heap_only ? mm_heap_alloc (len) :
+				mm_alloc (len);
+			slot[n][0] = n;
+		}
+	}
+	for (n = 0; n < 256; n++) {
+		if (slot[n]) {
+			if (th->heap_only)
+				mm_heap_free (slot[n]);
+			else
+				mm_free (slot[n]);
+		}
+	}
+	return NULL;
+}
+
+static void
+bench_threads (int nthreads, int heap_only, unsigned long long ops)
+{
+	struct thread th[MAX_THREADS];
+	double t;
+	int i;
+
+	mm_reset ();
+	t = now_ns ();
+	for (i = 0; i < nthreads; i++) {
+		th[i].heap_only = heap_only;
+		th[i].rnd_state = seed + i * 0x9E3779B97F4A7C15ULL;
+		th[i].ops = ops / nthreads;
+		if (pthread_create (&th[i].t, NULL, thread_main, &th[i]))
+			fail ("pthread_create");
+	}
+	for (i = 0; i < nthreads; i++)
+		pthread_join (th[i].t, NULL);
+	t = (now_ns () - t) / ops;
+	printf ("%-8s %-10s %8.1f   (%d threads)\n", "threads",
+		heap_only ? "first-fit" : "classes", t, nthreads);
+}
+
+int
+main (int argc, char **argv)
+{
+	unsigned long long ops = DEFAULT_OPS;
+	int c, i, nthreads = DEFAULT_THREADS, check_only = 0, dump = 0;
+
+	while ((c = getopt (argc, argv, "cdn:s:t:")) != -1) {
+		switch (c) {
+		case 'c':
+			check_only = 1;
+			break;
+		case 'd':
+			dump = 1;
+			break;
+		case 'n':
+			ops = strtoull (optarg, NULL, 0);
+			break;
+		case 's':
+			seed = strtoull (optarg, NULL, 0) | 1;
+			break;
+		case 't':
+			nthreads = atoi (optarg);
+			break;
+		default:
+			fprintf (stderr, "usage: mmbench [-cd] [-n ops]"
+				 " [-s seed] [-t threads]\n");
+			return 1;
+		}
+	}
+	if (!ops || nthreads < 1 || nthreads > MAX_THREADS) {
+		fprintf (stderr, "mmbench: bad -n or -t\n");
+		return 1;
+	}
+	check (ops);
+	if (check_only)
+		return 0;
+	printf ("%-8s %-10s %8s %8s %8s %8s %8s %8s\n", "pattern",
+		"allocator", "ns/op", "maxwalk", "slabs", "slackKB",
+		"freeKB", "frag");
+	for (i = 0; i < sizeof patterns / sizeof patterns[0]; i++) {
+		bench (&patterns[i], 1, ops);
+		bench (&patterns[i], 0, ops);
+		if (dump)
+			mm_dump_stat ();
+	}
+	bench_threads (nthreads, 1, ops);
+	bench_threads (nthreads, 0, ops);
+	return 0;
+}
@@ -0,0 +1,425 @@
+/*
+ * Copyright (c) 2007, 2008 University of Tsukuba
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the University of Tsukuba nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* drivers/nvme/nvme.c built for the host.  the VMM headers are used
+   as they are; alloc(), free(), printf() and panic() are renamed on
+   the command line.  the PCI, MMIO, timer, interrupt and memory
+   functions the driver calls are implemented here on top of the
+   physical memory and the controller of nvmesim.c, and the storage
+   functions apply the test cipher of nvmesim.c sector by sector. */
+
+#include "../../drivers/nvme/nvme.c"
+
+#define SIM_MAX_MMIO	8
+#define SIM_MAX_VECTORS	32
+#define SIM_VECTOR_BASE	0x80
+
+struct storage_device {
+	int nsid;
+};
+
+struct sim_mmio {
+	phys_t gphys;
+	uint len;
+	mmio_handler_t handler;
+	void *data;
+};
+
+struct sim_timer {
+	void (*callback) (void *handle, void *data);
+	void *data;
+	bool set;
+};
+
+struct sim_vector {
+	int (*callback) (void *data, int num);
+	void *data;
+};
+
+void *sim_map (u64 gphys, uint len, int write);
+void sim_unmap (void *virt, uint len);
+int sim_pages (int n, void **virt, u64 *phys);
+void sim_page_free (void *virt);
+u32 sim_config (uint offset, uint len);
+void sim_cipher (int nsid, u64 lba, int sector_size, u8 *buf);
+void sim_dirty (u64 gphys, uint len);
+
+static struct sim_mmio sim_mmio[SIM_MAX_MMIO];
+static struct sim_timer *sim_timer;
+static struct sim_vector sim_vector[SIM_MAX_VECTORS];
+static struct pci_driver *sim_driver;
+static struct pci_device sim_pci;
+static char *sim_options[2];
+static struct pci_bar_info sim_bar;
+static int sim_storages;
+
+/* --- memory --- */
+
+void *
+mapmem_gphys (u64 physaddr, uint len, int flags)
+{
+	return sim_map (physaddr, len, !!(flags & MAPMEM_WRITE));
+}
+
+void
+unmapmem (void *virt, uint len)
+{
+	sim_unmap (virt, len);
+}
+
+int
+alloc_pages_node (void **virt, u64 *phys, int n, int node)
+{
+	return sim_pages (n, virt, phys);
+}
+
+int
+alloc_page_node (void **virt, u64 *phys, int node)
+{
+	return sim_pages (1, virt, phys);
+}
+
+void
+free_page (void *virt)
+{
+	sim_page_free (virt);
+}
+
+void
+dirtylog_mark (u64 gphys, uint len)
+{
+	sim_dirty (gphys, len);
+}
+
+/* --- MMIO, timer and interrupts --- */
+
+static void *
+sim_mmio_register (phys_t gphys, uint len, mmio_handler_t handler,
+		   void *data)
+{
+	int i;
+
+	for (i = 0; i < SIM_MAX_MMIO; i++) {
+		if (!sim_mmio[i].handler) {
+			sim_mmio[i].gphys = gphys;
+			sim_mmio[i].len = len;
+			sim_mmio[i].handler = handler;
+			sim_mmio[i].data = data;
+			return &sim_mmio[i];
+		}
+	}
+	return NULL;
+}
+
+void *
+mmio_register (phys_t gphys, uint len, mmio_handler_t handler, void *data)
+{
+	return sim_mmio_register (gphys, len, handler, data);
+}
+
+void *
+mmio_register_unlocked (phys_t gphys, uint len, mmio_handler_t handler,
+			void *data)
+{
+	return sim_mmio_register (gphys, len, handler, data);
+}
+
+void
+mmio_unregister (void *handle)
+{
+	struct sim_mmio *m = handle;
+
+	if (!m || !m->handler)
+		panic ("mmio_unregister: bad handle");
+	m->handler = NULL;
+}
+
+void *
+timer_new (void (*callback) (void *handle, void *data), void *data)
+{
+	if (sim_timer)
+		panic ("timer_new: only one timer");
+	sim_timer = alloc (sizeof *sim_timer);
+	sim_timer->callback = callback;
+	sim_timer->data = data;
+	sim_timer->set = false;
+	return sim_timer;
+}
+
+/* every timer expires at the next sim_timer_fire() */
+void
+timer_set (void *handle, u64 interval_usec)
+{
+	struct sim_timer *t = handle;
+
+	t->set = true;
+}
+
+void
+timer_free (void *handle)
+{
+	if (handle != sim_timer)
+		panic ("timer_free: bad handle");
+	free (sim_timer);
+	sim_timer = NULL;
+}
+
+int
+exint_pass_intr_alloc (int (*callback) (void *data, int num), void *data)
+{
+	int i;
+
+	for (i = 0; i < SIM_MAX_VECTORS; i++) {
+		if (!sim_vector[i].callback) {
+			sim_vector[i].callback = callback;
+			sim_vector[i].data = data;
+			return SIM_VECTOR_BASE + i;
+		}
+	}
+	return -1;
+}
+
+void
+exint_pass_intr_free (int num)
+{
+	num -= SIM_VECTOR_BASE;
+	if (num < 0 || num >= SIM_MAX_VECTORS || !sim_vector[num].callback)
+		panic ("exint_pass_intr_free: bad vector");
+	sim_vector[num].callback = NULL;
+}
+
+/* --- PCI --- */
+
+void
+pci_register_driver (struct pci_driver *driver)
+{
+	sim_driver = driver;
+}
+
+void
+pci_get_bar_info (struct pci_device *pci_device, int n,
+		  struct pci_bar_info *bar_info)
+{
+	if (n == 0)
+		*bar_info = sim_bar;
+	else
+		bar_info->type = PCI_BAR_INFO_TYPE_NONE;
+}
+
+/* the BAR is never moved */
+int
+pci_get_modifying_bar_info (struct pci_device *pci_device,
+			    struct pci_bar_info *bar_info, u8 iosize,
+			    u16 offset, union mem *data)
+{
+	return -1;
+}
+
+u8
+pci_read_config_data8 (pci_config_address_t addr, int offset)
+{
+	return sim_config (addr.reg_no * 4 + offset, 1);
+}
+
+u32
+pci_read_config_data32 (pci_config_address_t addr, int offset)
+{
+	return sim_config (addr.reg_no * 4 + offset, 4);
+}
+
+void
+pci_handle_default_config_read (struct pci_device *pci_device, u8 iosize,
+				u16 offset, union mem *data)
+{
+	u32 v = sim_config (offset, iosize);
+
+	memcpy (data, &v, iosize);
+}
+
+int
+pci_driver_option_get_int (char *option, char **e, int base)
+{
+	return strtol (option, e, base);
+}
+
+/* --- storage --- */
+
+struct storage_device *
+storage_new (int type, int host_id, int device_id, struct guid *guid,
+	     struct storage_extend *extend)
+{
+	struct storage_device *storage;
+
+	if (type != STORAGE_TYPE_NVME)
+		panic ("storage_new: type %d", type);
+	storage = alloc (sizeof *storage);
+	storage->nsid = device_id;
+	sim_storages++;
+	return storage;
+}
+
+void
+storage_free (struct storage_device *storage)
+{
+	sim_storages--;
+	free (storage);
+}
+
+int
+storage_handle_sectors_iov (struct storage_device *storage,
+			    struct storage_access *access,
+			    struct storage_iovec *src, int srccnt,
+			    struct storage_iovec *dst, int dstcnt)
+{
+	u32 size = access->count * access->sector_size, n, off;
+	u8 *buf;
+	int i;
+
+	buf = alloc (size);
+	for (i = 0, off = 0; i < srccnt && off < size; i++, off += n) {
+		n = min (src[i].len, size - off);
+		memcpy (buf + off, src[i].base, n);
+	}
+	if (off < size)
+		panic ("storage_handle_sectors_iov: short source");
+	for (off = 0; off < size; off += access->sector_size)
+		sim_cipher (storage->nsid, access->lba +
+			    off / access->sector_size, access->sector_size,
+			    buf + off);
+	for (i = 0, off = 0; i < dstcnt && off < size; i++, off += n) {
+		n = min (dst[i].len, size - off);
+		memcpy (dst[i].base, buf + off, n);
+	}
+	if (off < size)
+		panic ("storage_handle_sectors_iov: short destination");
+	free (buf);
+	return 0;
+}
+
+/* --- called by nvmesim.c --- */
+
+/* a controller with BAR0 at bar.  vectors is the driver option or
+   NULL. */
+void
+sim_attach (u64 bar, u32 barlen, char *vectors)
+{
+	sim_bar.type = PCI_BAR_INFO_TYPE_MEM;
+	sim_bar.base = bar;
+	sim_bar.len = barlen;
+	sim_options[0] = vectors;
+	sim_options[1] = NULL;
+	memset (&sim_pci, 0, sizeof sim_pci);
+	sim_pci.driver_options = sim_options;
+	nvme_init ();
+	sim_pci.driver = sim_driver;
+	sim_driver->new (&sim_pci);
+	if (!sim_pci.host)
+		panic ("the driver did not attach");
+}
+
+void
+sim_remove (void)
+{
+	sim_driver->remove (&sim_pci);
+	sim_pci.host = NULL;
+}
+
+/* returns 0 if the address is not hooked and goes to the device */
+int
+sim_mmio_access (u64 gphys, int wr, void *buf, uint len)
+{
+	struct sim_mmio *m;
+	int i;
+
+	for (i = 0; i < SIM_MAX_MMIO; i++) {
+		m = &sim_mmio[i];
+		if (m->handler && gphys >= m->gphys &&
+		    gphys + len <= m->gphys + m->len) {
+			m->handler (m->data, gphys, !!wr, buf, len, 0);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* returns 0 if the register goes to the device */
+int
+sim_config_access (uint offset, int wr, u32 *val, uint len)
+{
+	union mem data;
+	int ret;
+
+	data.dword = *val;
+	if (wr)
+		ret = sim_driver->config_write (&sim_pci, len, offset, &data);
+	else
+		ret = sim_driver->config_read (&sim_pci, len, offset, &data);
+	if (ret != CORE_IO_RET_DONE)
+		return 0;
+	*val = len == 1 ? data.byte : len == 2 ? data.word : data.dword;
+	return 1;
+}
+
+void
+sim_timer_fire (void)
+{
+	if (sim_timer && sim_timer->set) {
+		sim_timer->set = false;
+		sim_timer->callback (sim_timer, sim_timer->data);
+	}
+}
+
+/* the vector of the guest, -1 if it is masked, or -2 if nothing is
+   registered for the VMM vector */
+int
+sim_intr (int vector)
+{
+	struct sim_vector *v;
+
+	vector -= SIM_VECTOR_BASE;
+	if (vector < 0 || vector >= SIM_MAX_VECTORS)
+		return -2;
+	v = &sim_vector[vector];
+	if (!v->callback)
+		return -2;
+	return v->callback (v->data, vector + SIM_VECTOR_BASE);
+}
+
+/* hooks, timers, vectors and storage devices still registered */
+int
+sim_registered (void)
+{
+	int i, n = 0;
+
+	for (i = 0; i < SIM_MAX_MMIO; i++)
+		n += !!sim_mmio[i].handler;
+	for (i = 0; i < SIM_MAX_VECTORS; i++)
+		n += !!sim_vector[i].callback;
+	return n + !!sim_timer + sim_storages;
+}
@@ -0,0 +1,2100 @@
+/*
+ * Copyright (c) 2007, 2008 University of Tsukuba
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the University of Tsukuba nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* userspace test of the NVMe shadowing driver in drivers/nvme/nvme.c
+   against a model of an NVMe controller.  the model has the
+   registers, the doorbells and the MSI-X table in BAR0, executes
+   admin and NVM commands from its queues in random order after
+   random delays, and raises MSI-X interrupts.  it fails the test if
+   it is given a queue or a data buffer in guest memory, a command
+   that could write sectors without encryption, or more queues than
+   the driver hooks.  the guest side is a driver that sets up the
+   controller, creates I/O queue pairs with and without interrupts,
+   and keeps many reads, writes and compares in flight with PRP and
+   SGL layouts that start at any dword and chain their lists.  data
+   read back must be what was written, the media must hold it
+   encrypted, and commands the shadow rejects must complete with the
+   expected status.  queue pairs are deleted with commands in flight
+   and the controller is reset from time to time.  completions must
+   be marked dirty for migration.  after the device is removed,
+   every page, mapping, hook and allocation of the driver must have
+   been released. */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef unsigned char u8;
+typedef unsigned short u16;
+typedef unsigned int u32;
+typedef unsigned long long u64;
+
+#include "../../drivers/nvme/nvme.h"
+
+#define PAGE		4096
+#define BAR		0xFE000000ULL
+#define BAR_LEN		0x4000
+#define NVME_VS		0x08
+#define NVME_CSTS	0x1C
+#define MSIX_OFF	0x3000
+#define MSIX_PBA	0x3800
+#define MSIX_NUM	16
+#define CFG_MSIX	0x40
+#define GUEST_PAGES	16384
+#define GUEST_SIZE	((u64)GUEST_PAGES * PAGE)
+#define VMM_BASE	0x100000000ULL
+#define VMM_PAGES	8192
+#define VMM_SIZE	((u64)VMM_PAGES * PAGE)
+#define MAX_MAPS	4096
+#define CTRL_MAXQ	32	/* queues of the controller */
+#define CTRL_MQES	255
+#define MAX_PENDING	4096
+#define PEND_DEAD	0xFFFF
+#define NS_NUM		4
+#define GUEST_VECTOR	0x40
+#define NQ		6	/* I/O queue pairs of the guest */
+#define ADMIN_QSIZE	32
+#define MAX_XFER	(32 * PAGE)	/* MDTS reported by the shadow */
+#define MAX_CMD_SEGS	80
+#define MAX_CMD_PAGES	160
+#define MAX_OUTSTANDING	400
+#define STUCK_STEPS	200000
+#define TIMER_STEPS	16
+#define DEFAULT_STEPS	100000
+
+#define SC_ABORTED_SQ	NVME_STATUS (0, 0x08)
+#define SC_LBA_RANGE	NVME_STATUS (0, 0x80)
+#define SC_INVALID_CQ	NVME_STATUS (1, 0x00)
+#define SC_INVALID_DEL	NVME_STATUS (1, 0x0C)
+#define SC_COMPARE	NVME_STATUS (2, 0x85)
+#define DNR		NVME_STATUS_DNR_BIT
+
+struct ns {
+	u64 nsze;
+	int lbads;
+	int extended;
+	u8 *disk;
+	u8 *truth;		/* what the guest wrote */
+	u8 *known;		/* truth is valid */
+	u8 *busy;		/* a command in flight uses the sector */
+};
+
+/* --- the controller --- */
+
+struct csq {
+	int active;
+	u64 base;
+	u32 size, head;
+	u16 cqid;
+};
+
+struct ccq {
+	int active;
+	u64 base;
+	u32 size, tail, head;
+	u16 phase, iv;
+	int ien;
+};
+
+struct pend {
+	u16 sqid;
+	int delay;
+	struct nvme_sqe sqe;
+};
+
+/* --- the guest --- */
+
+struct seg {
+	u64 addr;
+	u32 len;
+};
+
+struct gcmd {
+	int used;
+	int admin;
+	u8 opcode;
+	u32 nsid;
+	u64 lba;
+	u32 count;
+	u32 len;
+	u16 expect;
+	int abort_ok;
+	int locked;		/* the sectors are marked busy */
+	unsigned long long step;
+	u8 *data;
+	int nseg;
+	struct seg seg[MAX_CMD_SEGS];
+	int npages;
+	int pages[MAX_CMD_PAGES];
+	u16 status;
+	u32 dw0;
+	int done;
+};
+
+struct gcq;
+
+struct gsq {
+	int active;
+	u16 qid;
+	int page;
+	u64 phys;
+	u32 size, tail, head;
+	int unrung;
+	int outstanding;
+	struct gcq *cq;
+	struct gcmd *cmd;
+};
+
+struct gcq {
+	int active;
+	u16 qid;
+	int page;
+	u64 phys;
+	u32 size, head;
+	u16 phase;
+	int ien;
+	u16 iv;
+};
+
+void sim_attach (u64 bar, u32 barlen, char *vectors);
+void sim_remove (void);
+int sim_mmio_access (u64 gphys, int wr, void *buf, unsigned int len);
+int sim_config_access (unsigned int offset, int wr, u32 *val,
+		       unsigned int len);
+void sim_timer_fire (void);
+int sim_intr (int vector);
+int sim_registered (void);
+
+static u8 regs[BAR_LEN] __attribute__ ((aligned (8)));
+static u8 cfg[256];
+static u8 *guest_mem, *vmm_mem;
+static struct {
+	void *p;
+	unsigned int len;
+} maps[MAX_MAPS];
+static int nmaps;
+static int vmm_len[VMM_PAGES];	/* pages of the allocation at a page */
+static int vmm_used;
+static long allocs;
+static struct ns ns[NS_NUM + 1];
+
+static struct {
+	int ready;
+	struct csq sq[CTRL_MAXQ];
+	struct ccq cq[CTRL_MAXQ];
+	struct pend pend[MAX_PENDING];
+	int npend;
+	int irq[MSIX_NUM];
+} ctrl;
+
+static struct {
+	u8 used[GUEST_PAGES];
+	struct gsq sq[NQ + 1];
+	struct gcq cq[NQ + 1];
+	int nvec;
+	int intr[MSIX_NUM];
+	int outstanding;
+	u16 maxq;
+} guest;
+
+/* completion entries marked dirty and not consumed yet */
+static u8 *cqe_dirty;
+
+static unsigned long long now;
+static unsigned long long rnd_state = 0x2545F4914F6CDD1DULL;
+static int verbose;
+
+static struct {
+	unsigned long long reads, writes, compares, others, rejected;
+	unsigned long long aborted, resets, recreated, intrs, skipped;
+	unsigned long long dirty, dropped;
+	int vmm_peak;
+} stat;
+
+static void
+fail (char *format, ...)
+{
+	va_list ap;
+
+	va_start (ap, format);
+	fprintf (stderr, "nvmesim: step %llu: ", now);
+	vfprintf (stderr, format, ap);
+	fprintf (stderr, "\n");
+	va_end (ap);
+	exit (1);
+}
+
+static unsigned long long
+rnd (void)
+{
+	rnd_state ^= rnd_state >> 12;
+	rnd_state ^= rnd_state << 25;
+	rnd_state ^= rnd_state >> 27;
+	return rnd_state * 0x2545F4914F6CDD1DULL;
+}
+
+static u64
+mix (u64 x)
+{
+	x += 0x9E3779B97F4A7C15ULL;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
+
+static void
+fill (void *buf, unsigned int len)
+{
+	u8 *p = buf;
+
+	while (len-- > 0)
+		*p++ = rnd ();
+}
+
+static int
+min_int (int a, int b)
+{
+	return a < b ? a : b;
+}
+
+static u32
+get32 (void *p)
+{
+	u32 v;
+
+	memcpy (&v, p, sizeof v);
+	return v;
+}
+
+static void
+put32 (void *p, u32 v)
+{
+	memcpy (p, &v, sizeof v);
+}
+
+static u64
+get64 (void *p)
+{
+	u64 v;
+
+	memcpy (&v, p, sizeof v);
+	return v;
+}
+
+static void
+put64 (void *p, u64 v)
+{
+	memcpy (p, &v, sizeof v);
+}
+
+/* --- memory --- */
+
+static u8 *
+phys (u64 addr, u64 len)
+{
+	if (addr + len <= GUEST_SIZE && addr + len >= addr)
+		return guest_mem + addr;
+	if (addr >= VMM_BASE && addr + len <= VMM_BASE + VMM_SIZE)
+		return vmm_mem + (addr - VMM_BASE);
+	fail ("access to 0x%llx length %llu outside of memory", addr, len);
+	return NULL;
+}
+
+static int
+is_vmm (u64 addr, u64 len)
+{
+	return addr >= VMM_BASE && addr + len <= VMM_BASE + VMM_SIZE;
+}
+
+void *
+sim_map (u64 gphys, unsigned int len, int write)
+{
+	void *p;
+	int i;
+
+	if (gphys >= BAR && gphys + len <= BAR + BAR_LEN)
+		p = regs + (gphys - BAR);
+	else if (gphys + len <= GUEST_SIZE && gphys + len >= gphys)
+		p = guest_mem + gphys;
+	else
+		fail ("mapmem_gphys of 0x%llx length %u: not guest memory",
+		      gphys, len);
+	for (i = 0; i < MAX_MAPS; i++) {
+		if (!maps[i].p) {
+			maps[i].p = p;
+			maps[i].len = len;
+			nmaps++;
+			return p;
+		}
+	}
+	fail ("too many mappings");
+	return NULL;
+}
+
+void
+sim_unmap (void *virt, unsigned int len)
+{
+	int i;
+
+	for (i = 0; i < MAX_MAPS; i++) {
+		if (maps[i].p == virt && maps[i].len == len) {
+			maps[i].p = NULL;
+			nmaps--;
+			return;
+		}
+	}
+	fail ("unmapmem of %p length %u that is not mapped", virt, len);
+}
+
+/* VMM pages are filled with garbage */
+int
+sim_pages (int n, void **virt, u64 *physp)
+{
+	int i, j;
+
+	for (i = 0; i + n <= VMM_PAGES; i++) {
+		for (j = 0; j < n && !vmm_len[i + j]; j++);
+		if (j < n) {
+			i += j;
+			continue;
+		}
+		vmm_len[i] = n;
+		for (j = 1; j < n; j++)
+			vmm_len[i + j] = -1;
+		vmm_used += n;
+		if (stat.vmm_peak < vmm_used)
+			stat.vmm_peak = vmm_used;
+		*virt = vmm_mem + (u64)i * PAGE;
+		*physp = VMM_BASE + (u64)i * PAGE;
+		memset (*virt, 0xCC, n * PAGE);
+		return 0;
+	}
+	fail ("out of VMM pages");
+	return -1;
+}
+
+void
+sim_page_free (void *virt)
+{
+	long off = (u8 *)virt - vmm_mem;
+	int i, n;
+
+	if (off < 0 || off >= VMM_SIZE || off % PAGE ||
+	    vmm_len[off / PAGE] <= 0)
+		fail ("free_page of %p that is not allocated", virt);
+	i = off / PAGE;
+	n = vmm_len[i];
+	vmm_used -= n;
+	while (n-- > 0)
+		vmm_len[i++] = 0;
+}
+
+void *
+sim_alloc (unsigned int len)
+{
+	void *p;
+
+	p = malloc (len ? len : 1);
+	if (!p)
+		fail ("out of memory");
+	allocs++;
+	return p;
+}
+
+void
+sim_free (void *p)
+{
+	allocs--;
+	free (p);
+}
+
+int
+sim_printf (const char *format, ...)
+{
+	char buf[256];
+	va_list ap;
+
+	va_start (ap, format);
+	vsnprintf (buf, sizeof buf, format, ap);
+	va_end (ap);
+	if (verbose)
+		fputs (buf, stdout);
+	if (strstr (buf, "unknown completion"))
+		fail ("driver: %s", buf);
+	return strlen (buf);
+}
+
+void
+sim_panic (char *format, ...)
+{
+	va_list ap;
+
+	va_start (ap, format);
+	fprintf (stderr, "panic: ");
+	vfprintf (stderr, format, ap);
+	fprintf (stderr, "\n");
+	va_end (ap);
+	exit (1);
+}
+
+u32
+sim_config (unsigned int offset, unsigned int len)
+{
+	u32 v = 0;
+
+	if (offset + len > sizeof cfg)
+		fail ("config read at 0x%x", offset);
+	memcpy (&v, &cfg[offset], len);
+	return v;
+}
+
+/* the completion entries the driver writes are in a guest
+   completion queue */
+void
+sim_dirty (u64 gphys, unsigned int len)
+{
+	struct gcq *cq;
+	u64 i;
+
+	stat.dirty++;
+	for (i = 0; i <= NQ; i++) {
+		cq = &guest.cq[i];
+		if (cq->active && gphys >= cq->phys &&
+		    gphys + len <= cq->phys + cq->size * 16) {
+			for (i = gphys / 16; i * 16 < gphys + len; i++)
+				cqe_dirty[i] = 1;
+			return;
+		}
+	}
+	fail ("dirty mark of 0x%llx length %u outside of the guest"
+	      " completion queues", gphys, len);
+}
+
+/* the storage encryption of a namespace */
+void
+sim_cipher (int nsid, u64 lba, int sector_size, u8 *buf)
+{
+	u64 v, k = mix (nsid ^ mix (lba));
+	int i;
+
+	for (i = 0; i < sector_size; i += 8) {
+		memcpy (&v, buf + i, 8);
+		v ^= mix (k + i);
+		memcpy (buf + i, &v, 8);
+	}
+}
+
+/* --- the controller model --- */
+
+static u32
+reg32 (unsigned int off)
+{
+	return get32 (&regs[off]);
+}
+
+static u32 *
+db (int qid, int cq)
+{
+	return (u32 *)&regs[NVME_DOORBELL + (qid * 2 + cq) * 4];
+}
+
+static void
+ctrl_reset (void)
+{
+	memset (ctrl.sq, 0, sizeof ctrl.sq);
+	memset (ctrl.cq, 0, sizeof ctrl.cq);
+	memset (ctrl.irq, 0, sizeof ctrl.irq);
+	memset (db (0, 0), 0, CTRL_MAXQ * 8);
+	ctrl.npend = 0;
+	ctrl.ready = 0;
+	put32 (&regs[NVME_CSTS], 0);
+}
+
+static void
+ctrl_enable (void)
+{
+	u32 aqa = reg32 (NVME_AQA);
+	u64 asq = get64 (&regs[NVME_ASQ]), acq = get64 (&regs[NVME_ACQ]);
+	struct csq *sq = &ctrl.sq[0];
+	struct ccq *cq = &ctrl.cq[0];
+
+	sq->size = (aqa & NVME_AQA_ASQS_MASK) + 1;
+	cq->size = ((aqa >> NVME_AQA_ACQS_SHIFT) & NVME_AQA_ASQS_MASK) + 1;
+	if (!is_vmm (asq, sq->size * 64) || !is_vmm (acq, cq->size * 16))
+		fail ("admin queue in guest memory");
+	sq->active = 1;
+	sq->base = asq;
+	sq->head = 0;
+	sq->cqid = 0;
+	cq->active = 1;
+	cq->base = acq;
+	cq->tail = 0;
+	cq->head = 0;
+	cq->phase = 1;
+	cq->iv = 0;
+	cq->ien = 1;
+	ctrl.ready = 1;
+	put32 (&regs[NVME_CSTS], 1);
+}
+
+static int
+msix_enabled (void)
+{
+	return !!(sim_config (CFG_MSIX + 2, 2) & NVME_MSIX_CTRL_ENABLE_BIT);
+}
+
+/* returns 0 if the completion queue is full */
+static int
+ctrl_post (u16 sqid, u16 cid, u16 status, u32 dw0)
+{
+	struct ccq *cq = &ctrl.cq[ctrl.sq[sqid].cqid];
+	struct nvme_cqe e;
+
+	if ((cq->tail + 1) % cq->size == cq->head)
+		return 0;
+	e.dw0 = dw0;
+	e.dw1 = 0;
+	e.sqhd = ctrl.sq[sqid].head;
+	e.sqid = sqid;
+	e.cid = cid;
+	e.status = status | cq->phase;
+	memcpy (phys (cq->base + cq->tail * sizeof e, sizeof e), &e,
+		sizeof e);
+	if (++cq->tail == cq->size) {
+		cq->tail = 0;
+		cq->phase ^= 1;
+	}
+	if (cq->ien && msix_enabled ())
+		ctrl.irq[cq->iv] = 1;
+	return 1;
+}
+
+/* move data between buf and the memory described by PRPs */
+static void
+ctrl_prp (u64 prp1, u64 prp2, u32 len, u8 *buf, int to_mem, int vmm_only)
+{
+	u64 addr = prp1, list = prp2;
+	int first = 1;
+	u32 n;
+
+	for (;;) {
+		n = PAGE - addr % PAGE;
+		if (n > len)
+			n = len;
+		if (vmm_only && !is_vmm (addr, n))
+			fail ("data buffer in guest memory");
+		if (to_mem)
+			memcpy (phys (addr, n), buf, n);
+		else
+			memcpy (buf, phys (addr, n), n);
+		buf += n;
+		len -= n;
+		if (!len)
+			return;
+		if (first && len <= PAGE) {
+			addr = prp2;
+		} else {
+			/* the last entry of a list page points to the
+			   next list if more than one page remains */
+			if (list % PAGE == PAGE - 8 && len > PAGE)
+				list = get64 (phys (list, 8));
+			if (list % 8 || (vmm_only && !is_vmm (list, 8)))
+				fail ("PRP list at 0x%llx", list);
+			addr = get64 (phys (list, 8));
+			list += 8;
+		}
+		first = 0;
+		if (addr % PAGE)
+			fail ("PRP entry 0x%llx not page aligned", addr);
+	}
+}
+
+static void
+ctrl_identify (struct nvme_sqe *c, u16 *status)
+{
+	u8 buf[NVME_IDENTIFY_LEN];
+	struct ns *n;
+
+	memset (buf, 0, sizeof buf);
+	switch (c->cdw10 & 0xFF) {
+	case NVME_IDENTIFY_CNS_CTRL:
+		memcpy (&buf[24], "nvmesim model", 13);
+		buf[NVME_ID_CTRL_MDTS] = 0;
+		buf[NVME_ID_CTRL_OACS] = 0x08;
+		buf[NVME_ID_CTRL_OACS + 1] = NVME_ID_CTRL_OACS_DBBUF_BIT >> 8;
+		buf[NVME_ID_CTRL_ONCS] = NVME_ID_CTRL_ONCS_WRITE_ZEROES_BIT |
+			0x4 | 0x1;
+		buf[NVME_ID_CTRL_ONCS + 1] = NVME_ID_CTRL_ONCS_COPY_BIT >> 8;
+		put32 (&buf[516], NS_NUM);
+		break;
+	case NVME_IDENTIFY_CNS_NS:
+		if (!c->nsid || c->nsid > NS_NUM) {
+			*status = NVME_SC_INVALID_NS | DNR;
+			return;
+		}
+		n = &ns[c->nsid];
+		if (!n->nsze)
+			break;
+		put64 (&buf[0], n->nsze);
+		put64 (&buf[8], n->nsze);
+		put64 (&buf[16], n->nsze);
+		buf[NVME_ID_NS_FLBAS] = n->extended ?
+			NVME_ID_NS_FLBAS_EXTENDED_BIT : 0;
+		put32 (&buf[NVME_ID_NS_LBAF], n->lbads <<
+		       NVME_ID_NS_LBAF_LBADS_SHIFT | (n->extended ? 8 : 0));
+		break;
+	default:
+		*status = NVME_SC_INVALID_FIELD | DNR;
+		return;
+	}
+	ctrl_prp (c->dptr[0], c->dptr[1], sizeof buf, buf, 1, 0);
+}
+
+/* returns 0 if the command has to wait for room in a completion
+   queue */
+static int
+ctrl_admin (struct nvme_sqe *c, u16 *status, u32 *dw0)
+{
+	u16 qid = c->cdw10 & 0xFFFF, iv = c->cdw11 >> 16;
+	u32 qsize = (c->cdw10 >> 16) + 1, nsq, ncq;
+	struct pend *p;
+	int i;
+
+	switch (c->opcode) {
+	case NVME_ADMIN_CREATE_CQ:
+		if (!qid || qid >= CTRL_MAXQ || ctrl.cq[qid].active)
+			*status = NVME_SC_INVALID_QID | DNR;
+		else if (qsize < 2 || qsize > CTRL_MQES + 1)
+			*status = NVME_SC_INVALID_QSIZE | DNR;
+		else if (!(c->cdw11 & NVME_QUEUE_PC_BIT))
+			*status = NVME_SC_INVALID_FIELD | DNR;
+		else if (iv >= MSIX_NUM)
+			*status = NVME_SC_INVALID_IV | DNR;
+		else if (!is_vmm (c->dptr[0], qsize * 16))
+			fail ("I/O completion queue in guest memory");
+		else {
+			ctrl.cq[qid].active = 1;
+			ctrl.cq[qid].base = c->dptr[0];
+			ctrl.cq[qid].size = qsize;
+			ctrl.cq[qid].tail = 0;
+			ctrl.cq[qid].head = 0;
+			ctrl.cq[qid].phase = 1;
+			ctrl.cq[qid].iv = iv;
+			ctrl.cq[qid].ien = !!(c->cdw11 & NVME_QUEUE_IEN_BIT);
+		}
+		break;
+	case NVME_ADMIN_CREATE_SQ:
+		if (!qid || qid >= CTRL_MAXQ || ctrl.sq[qid].active)
+			*status = NVME_SC_INVALID_QID | DNR;
+		else if (!iv || iv >= CTRL_MAXQ || !ctrl.cq[iv].active)
+			*status = SC_INVALID_CQ | DNR;
+		else if (qsize < 2 || qsize > CTRL_MQES + 1)
+			*status = NVME_SC_INVALID_QSIZE | DNR;
+		else if (!(c->cdw11 & NVME_QUEUE_PC_BIT))
+			*status = NVME_SC_INVALID_FIELD | DNR;
+		else if (!is_vmm (c->dptr[0], qsize * 64))
+			fail ("I/O submission queue in guest memory");
+		else {
+			ctrl.sq[qid].active = 1;
+			ctrl.sq[qid].base = c->dptr[0];
+			ctrl.sq[qid].size = qsize;
+			ctrl.sq[qid].head = 0;
+			ctrl.sq[qid].cqid = iv;
+		}
+		break;
+	case NVME_ADMIN_DELETE_SQ:
+		if (!qid || qid >= CTRL_MAXQ || !ctrl.sq[qid].active) {
+			*status = NVME_SC_INVALID_QID | DNR;
+			break;
+		}
+		/* commands not executed yet are aborted first.  the
+		   entries are dropped by ctrl_step(). */
+		for (i = 0; i < ctrl.npend; i++) {
+			p = &ctrl.pend[i];
+			if (p->sqid != qid)
+				continue;
+			if (!ctrl_post (qid, p->sqe.cid, SC_ABORTED_SQ, 0))
+				return 0;
+			p->sqid = PEND_DEAD;
+		}
+		ctrl.sq[qid].active = 0;
+		*db (qid, 0) = 0;
+		break;
+	case NVME_ADMIN_DELETE_CQ:
+		if (!qid || qid >= CTRL_MAXQ || !ctrl.cq[qid].active) {
+			*status = NVME_SC_INVALID_QID | DNR;
+			break;
+		}
+		for (i = 1; i < CTRL_MAXQ; i++)
+			if (ctrl.sq[i].active && ctrl.sq[i].cqid == qid)
+				*status = SC_INVALID_DEL | DNR;
+		if (*status)
+			break;
+		ctrl.cq[qid].active = 0;
+		*db (qid, 1) = 0;
+		break;
+	case NVME_ADMIN_IDENTIFY:
+		ctrl_identify (c, status);
+		break;
+	case NVME_ADMIN_SET_FEATURES:
+		if ((c->cdw10 & 0xFF) != NVME_FEAT_NUM_QUEUES)
+			break;
+		nsq = c->cdw11 & 0xFFFF;
+		ncq = c->cdw11 >> 16;
+		if (nsq == 0xFFFF || ncq == 0xFFFF) {
+			*status = NVME_SC_INVALID_FIELD | DNR;
+			break;
+		}
+		/* the driver hooks the doorbells of NVME_MAX_QUEUES
+		   queues */
+		if (nsq > 62 || ncq > 62)
+			fail ("%u/%u queues requested from the controller",
+			      nsq + 1, ncq + 1);
+		if (nsq > CTRL_MAXQ - 2)
+			nsq = CTRL_MAXQ - 2;
+		if (ncq > CTRL_MAXQ - 2)
+			ncq = CTRL_MAXQ - 2;
+		*dw0 = nsq | ncq << 16;
+		break;
+	case NVME_ADMIN_GET_FEATURES:
+		break;
+	case NVME_ADMIN_DBBUF_CONFIG:
+		fail ("doorbell buffer config reached the controller");
+		break;
+	default:
+		*status = NVME_SC_INVALID_OPCODE | DNR;
+	}
+	return 1;
+}
+
+static void
+ctrl_io (struct nvme_sqe *c, u16 *status)
+{
+	struct ns *n;
+	u64 lba;
+	u32 count, len;
+	u8 *buf;
+
+	if (!c->nsid || c->nsid > NS_NUM || !ns[c->nsid].nsze) {
+		*status = NVME_SC_INVALID_NS | DNR;
+		return;
+	}
+	n = &ns[c->nsid];
+	switch (c->opcode) {
+	case NVME_CMD_READ:
+	case NVME_CMD_WRITE:
+	case NVME_CMD_COMPARE:
+		if (n->extended)
+			fail ("extended LBA namespace accessed");
+		if (c->flags & NVME_SQE_FLAGS_PSDT_MASK)
+			fail ("SGL given to the controller");
+		lba = c->cdw10 | (u64)c->cdw11 << 32;
+		count = (c->cdw12 & 0xFFFF) + 1;
+		if (lba >= n->nsze || count > n->nsze - lba) {
+			*status = SC_LBA_RANGE | DNR;
+			return;
+		}
+		len = count << n->lbads;
+		buf = n->disk + (lba << n->lbads);
+		if (c->opcode == NVME_CMD_COMPARE) {
+			buf = malloc (len);
+			ctrl_prp (c->dptr[0], c->dptr[1], len, buf, 0, 1);
+			if (memcmp (buf, n->disk + (lba << n->lbads), len))
+				*status = SC_COMPARE;
+			free (buf);
+		} else {
+			ctrl_prp (c->dptr[0], c->dptr[1], len, buf,
+				  c->opcode == NVME_CMD_READ, 1);
+		}
+		break;
+	case NVME_CMD_FLUSH:
+	case NVME_CMD_DSM:
+		break;
+	case NVME_CMD_WRITE_ZEROES:
+	case NVME_CMD_COPY:
+		fail ("opcode 0x%x reached the controller", c->opcode);
+		break;
+	default:
+		*status = NVME_SC_INVALID_OPCODE | DNR;
+	}
+}
+
+static void guest_intr (int vector);
+
+static void
+ctrl_step (void)
+{
+	struct pend *p;
+	struct csq *sq;
+	struct ccq *cq;
+	u32 tail, head, dw0;
+	u16 status;
+	u8 *entry;
+	int i, r;
+
+	if ((reg32 (NVME_CC) & NVME_CC_EN_BIT) && !ctrl.ready)
+		ctrl_enable ();
+	else if (!(reg32 (NVME_CC) & NVME_CC_EN_BIT) && ctrl.ready)
+		ctrl_reset ();
+	if (!ctrl.ready)
+		return;
+	for (i = 0; i < CTRL_MAXQ; i++) {
+		cq = &ctrl.cq[i];
+		if (!cq->active)
+			continue;
+		head = *db (i, 1);
+		if (head >= cq->size)
+			fail ("completion queue %d head %u", i, head);
+		cq->head = head;
+	}
+	for (i = 0; i < CTRL_MAXQ; i++) {
+		sq = &ctrl.sq[i];
+		if (!sq->active) {
+			/* reported as an invalid doorbell write by a
+			   real controller */
+			if (*db (i, 0))
+				fail ("doorbell of deleted submission queue"
+				      " %d written", i);
+			continue;
+		}
+		tail = *db (i, 0);
+		if (tail >= sq->size)
+			fail ("submission queue %d tail %u", i, tail);
+		while (sq->head != tail && ctrl.npend < MAX_PENDING) {
+			p = &ctrl.pend[ctrl.npend++];
+			p->sqid = i;
+			p->delay = rnd () % 4 ? rnd () % 8 : rnd () % 64;
+			memcpy (&p->sqe, phys (sq->base + sq->head * 64, 64),
+				64);
+			sq->head = (sq->head + 1) % sq->size;
+		}
+	}
+	for (i = 0; i < ctrl.npend; i++) {
+		p = &ctrl.pend[i];
+		if (p->sqid == PEND_DEAD) {
+			*p = ctrl.pend[--ctrl.npend];
+			i--;
+			continue;
+		}
+		if (p->delay > 0) {
+			p->delay--;
+			continue;
+		}
+		cq = &ctrl.cq[ctrl.sq[p->sqid].cqid];
+		if ((cq->tail + 1) % cq->size == cq->head)
+			continue;
+		status = 0;
+		dw0 = 0;
+		if (p->sqid) {
+			ctrl_io (&p->sqe, &status);
+		} else if (!ctrl_admin (&p->sqe, &status, &dw0)) {
+			p->delay = 1;
+			continue;
+		}
+		ctrl_post (p->sqid, p->sqe.cid, status, dw0);
+		*p = ctrl.pend[--ctrl.npend];
+		i--;
+	}
+	for (i = 0; i < MSIX_NUM; i++) {
+		if (!ctrl.irq[i])
+			continue;
+		entry = &regs[MSIX_OFF + i * NVME_MSIX_ENTRY_LEN];
+		if (get32 (entry + 12) & NVME_MSIX_MASK_BIT)
+			continue;
+		ctrl.irq[i] = 0;
+		r = sim_intr (get32 (entry + 8) & 0xFF);
+		if (r == -2)
+			fail ("MSI-X entry %d raised vector 0x%x of the guest",
+			      i, get32 (entry + 8) & 0xFF);
+		if (r >= 0)
+			guest_intr (r);
+	}
+}
+
+/* --- the guest driver --- */
+
+static int
+gpage_alloc (int n)
+{
+	int i, j;
+
+	for (i = 0; i + n <= GUEST_PAGES; i++) {
+		for (j = 0; j < n && !guest.used[i + j]; j++);
+		if (j < n) {
+			i += j;
+			continue;
+		}
+		memset (&guest.used[i], 1, n);
+		return i;
+	}
+	return -1;
+}
+
+/* a page at a random place, so that pages of a buffer are not
+   adjacent */
+static int
+gpage_random (void)
+{
+	int i, p;
+
+	for (i = 0; i < 64; i++) {
+		p = rnd () % GUEST_PAGES;
+		if (!guest.used[p]) {
+			guest.used[p] = 1;
+			return p;
+		}
+	}
+	return gpage_alloc (1);
+}
+
+static void
+gpage_free (int page, int n)
+{
+	while (n-- > 0) {
+		if (!guest.used[page])
+			fail ("guest page %d freed twice", page);
+		guest.used[page++] = 0;
+	}
+}
+
+static void
+gmmio (unsigned int off, int wr, void *buf, unsigned int len)
+{
+	if (sim_mmio_access (BAR + off, wr, buf, len))
+		return;
+	if (wr)
+		memcpy (&regs[off], buf, len);
+	else
+		memcpy (buf, &regs[off], len);
+}
+
+static u32
+gr32 (unsigned int off)
+{
+	u32 v;
+
+	gmmio (off, 0, &v, sizeof v);
+	return v;
+}
+
+static u64
+gr64 (unsigned int off)
+{
+	u64 v;
+
+	gmmio (off, 0, &v, sizeof v);
+	return v;
+}
+
+static void
+gw32 (unsigned int off, u32 v)
+{
+	gmmio (off, 1, &v, sizeof v);
+}
+
+static void
+gw64 (unsigned int off, u64 v)
+{
+	gmmio (off, 1, &v, sizeof v);
+}
+
+static u32
+gcfg_read (unsigned int off, unsigned int len)
+{
+	u32 v = 0;
+
+	if (!sim_config_access (off, 0, &v, len))
+		v = sim_config (off, len);
+	return v;
+}
+
+static void
+gcfg_write (unsigned int off, u32 v, unsigned int len)
+{
+	if (!sim_config_access (off, 1, &v, len))
+		memcpy (&cfg[off], &v, len);
+}
+
+static void
+guest_intr (int vector)
+{
+	int iv = vector - GUEST_VECTOR;
+
+	if (iv < 0 || iv >= guest.nvec)
+		fail ("interrupt with vector 0x%x", vector);
+	guest.intr[iv] = 1;
+	stat.intrs++;
+}
+
+static void
+gscatter (struct gcmd *cmd, u8 *buf)
+{
+	int i;
+
+	for (i = 0; i < cmd->nseg; i++) {
+		memcpy (phys (cmd->seg[i].addr, cmd->seg[i].len), buf,
+			cmd->seg[i].len);
+		buf += cmd->seg[i].len;
+	}
+}
+
+static void
+ggather (struct gcmd *cmd, u8 *buf)
+{
+	int i;
+
+	for (i = 0; i < cmd->nseg; i++) {
+		memcpy (buf, phys (cmd->seg[i].addr, cmd->seg[i].len),
+			cmd->seg[i].len);
+		buf += cmd->seg[i].len;
+	}
+}
+
+static void
+gcmd_release (struct gsq *sq, struct gcmd *cmd)
+{
+	struct ns *n = &ns[cmd->nsid <= NS_NUM ? cmd->nsid : 0];
+	u32 i;
+
+	if (cmd->locked)
+		for (i = 0; i < cmd->count; i++)
+			n->busy[cmd->lba + i] = 0;
+	for (i = 0; i < cmd->npages; i++)
+		gpage_free (cmd->pages[i], 1);
+	cmd->npages = 0;
+	if (cmd->data)
+		free (cmd->data);
+	cmd->data = NULL;
+	cmd->used = 0;
+	sq->outstanding--;
+	if (!cmd->admin)
+		guest.outstanding--;
+}
+
+static void
+gcmd_done (struct gsq *sq, struct gcmd *cmd, u16 status, u32 dw0)
+{
+	struct ns *n = &ns[cmd->nsid <= NS_NUM ? cmd->nsid : 0];
+	u32 ss, i;
+	u8 *buf;
+
+	if (cmd->admin) {
+		cmd->status = status;
+		cmd->dw0 = dw0;
+		cmd->done = 1;
+		gcmd_release (sq, cmd);
+		return;
+	}
+	if (status != cmd->expect &&
+	    !(cmd->abort_ok && status == SC_ABORTED_SQ))
+		fail ("opcode 0x%x nsid %u lba %llu count %u: status 0x%x,"
+		      " expected 0x%x", cmd->opcode, cmd->nsid, cmd->lba,
+		      cmd->count, status, cmd->expect);
+	if (status == SC_ABORTED_SQ) {
+		stat.aborted++;
+	} else if (status) {
+		stat.rejected++;
+	} else if (cmd->opcode == NVME_CMD_READ) {
+		ss = 1 << n->lbads;
+		buf = malloc (cmd->len);
+		ggather (cmd, buf);
+		for (i = 0; i < cmd->count; i++)
+			if (n->known[cmd->lba + i] &&
+			    memcmp (buf + i * ss, n->truth +
+				    (cmd->lba + i) * ss, ss))
+				fail ("nsid %u lba %llu read back wrong data",
+				      cmd->nsid, cmd->lba + i);
+		free (buf);
+		stat.reads++;
+	} else if (cmd->opcode == NVME_CMD_WRITE) {
+		ss = 1 << n->lbads;
+		memcpy (n->truth + cmd->lba * ss, cmd->data, cmd->len);
+		memset (n->known + cmd->lba, 1, cmd->count);
+		stat.writes++;
+	} else if (cmd->opcode == NVME_CMD_COMPARE) {
+		stat.compares++;
+	} else {
+		stat.others++;
+	}
+	gcmd_release (sq, cmd);
+}
+
+static void
+gcq_process (struct gcq *cq)
+{
+	volatile struct nvme_cqe *e;
+	struct nvme_cqe cqe;
+	struct gsq *sq;
+	int n = 0;
+
+	for (;;) {
+		e = (struct nvme_cqe *)phys (cq->phys + cq->head * sizeof cqe,
+					     sizeof cqe);
+		if ((e->status & NVME_CQE_PHASE_BIT) != cq->phase)
+			break;
+		memcpy (&cqe, (void *)e, sizeof cqe);
+		if (!cqe_dirty[cq->phys / 16 + cq->head])
+			fail ("completion entry %u of queue %u is not marked"
+			      " dirty", cq->head, cq->qid);
+		cqe_dirty[cq->phys / 16 + cq->head] = 0;
+		if (++cq->head == cq->size) {
+			cq->head = 0;
+			cq->phase ^= NVME_CQE_PHASE_BIT;
+		}
+		sq = cqe.sqid <= NQ ? &guest.sq[cqe.sqid] : NULL;
+		if (!sq || !sq->active || sq->cq != cq)
+			fail ("completion of queue %u in completion queue %u",
+			      cqe.sqid, cq->qid);
+		if (cqe.cid >= sq->size || !sq->cmd[cqe.cid].used)
+			fail ("completion of cid %u in queue %u that is not"
+			      " outstanding", cqe.cid, cqe.sqid);
+		if (cqe.sqhd >= sq->size)
+			fail ("queue %u head %u", cqe.sqid, cqe.sqhd);
+		sq->head = cqe.sqhd;
+		gcmd_done (sq, &sq->cmd[cqe.cid],
+			   cqe.status & NVME_CQE_STATUS_MASK, cqe.dw0);
+		n++;
+	}
+	if (n)
+		gw32 (NVME_DOORBELL + (cq->qid * 2 + 1) * 4, cq->head);
+}
+
+static void
+world_step (void)
+{
+	struct gcq *cq;
+	int i;
+
+	now++;
+	ctrl_step ();
+	if (!(now % TIMER_STEPS))
+		sim_timer_fire ();
+	for (i = 0; i <= NQ; i++) {
+		cq = &guest.cq[i];
+		if (!cq->active)
+			continue;
+		/* queues with interrupts are processed when the
+		   interrupt arrives */
+		if (cq->ien && msix_enabled () && !guest.intr[cq->iv])
+			continue;
+		gcq_process (cq);
+	}
+	memset (guest.intr, 0, sizeof guest.intr);
+}
+
+static void
+gring (struct gsq *sq)
+{
+	gw32 (NVME_DOORBELL + sq->qid * 2 * 4, sq->tail);
+	sq->unrung = 0;
+}
+
+static struct gcmd *
+gcmd_get (struct gsq *sq)
+{
+	struct gcmd *cmd;
+	u32 i;
+
+	if (sq->outstanding >= sq->size - 1)
+		return NULL;
+	for (i = 0; i < sq->size; i++) {
+		cmd = &sq->cmd[i];
+		if (!cmd->used) {
+			memset (cmd, 0, sizeof *cmd);
+			return cmd;
+		}
+	}
+	return NULL;
+}
+
+static void
+gsubmit (struct gsq *sq, struct gcmd *cmd, struct nvme_sqe *sqe)
+{
+	sqe->cid = cmd - sq->cmd;
+	memcpy (phys (sq->phys + sq->tail * sizeof *sqe, sizeof *sqe), sqe,
+		sizeof *sqe);
+	sq->tail = (sq->tail + 1) % sq->size;
+	sq->unrung++;
+	sq->outstanding++;
+	if (!cmd->admin)
+		guest.outstanding++;
+	cmd->used = 1;
+	cmd->step = now;
+}
+
+/* an admin command with the data pages of cmd, if any.  returns the
+   status. */
+static u16
+gadmin (struct nvme_sqe *sqe, struct gcmd *tmpl, u32 *dw0)
+{
+	struct gsq *sq = &guest.sq[0];
+	struct gcmd *cmd;
+	u16 status;
+	int i;
+
+	cmd = gcmd_get (sq);
+	if (!cmd)
+		fail ("admin queue full");
+	if (tmpl)
+		*cmd = *tmpl;
+	cmd->admin = 1;
+	cmd->done = 0;
+	gsubmit (sq, cmd, sqe);
+	gring (sq);
+	for (i = 0; !cmd->done; i++) {
+		if (i > STUCK_STEPS)
+			fail ("admin opcode 0x%x did not complete",
+			      sqe->opcode);
+		world_step ();
+	}
+	status = cmd->status;
+	if (dw0)
+		*dw0 = cmd->dw0;
+	return status;
+}
+
+static void
+gadmin_expect (struct nvme_sqe *sqe, u16 expect)
+{
+	u16 status;
+
+	status = gadmin (sqe, NULL, NULL);
+	if (status != expect)
+		fail ("admin opcode 0x%x cdw10 0x%x: status 0x%x, expected"
+		      " 0x%x", sqe->opcode, sqe->cdw10, status, expect);
+}
+
+static void
+gidentify (u32 cns, u32 nsid, u8 *buf)
+{
+	struct nvme_sqe sqe;
+	struct gcmd tmpl;
+	u32 off = rnd () % 2 ? 0 : 4 * (rnd () % (PAGE / 4));
+	int p0, p1;
+
+	memset (&tmpl, 0, sizeof tmpl);
+	p0 = gpage_random ();
+	p1 = gpage_random ();
+	tmpl.seg[0].addr = (u64)p0 * PAGE + off;
+	tmpl.seg[0].len = PAGE - off;
+	tmpl.seg[1].addr = (u64)p1 * PAGE;
+	tmpl.seg[1].len = off;
+	tmpl.nseg = off ? 2 : 1;
+	memset (&sqe, 0, sizeof sqe);
+	sqe.opcode = NVME_ADMIN_IDENTIFY;
+	sqe.nsid = nsid;
+	sqe.dptr[0] = tmpl.seg[0].addr;
+	sqe.dptr[1] = off ? tmpl.seg[1].addr : 0;
+	sqe.cdw10 = cns;
+	if (gadmin (&sqe, &tmpl, NULL))
+		fail ("identify cns %u nsid %u failed", cns, nsid);
+	ggather (&tmpl, buf);
+	gpage_free (p0, 1);
+	gpage_free (p1, 1);
+}
+
+static void
+gcreate_cq (int i, u32 size, int ien, u16 iv)
+{
+	struct gcq *cq = &guest.cq[i];
+	struct nvme_sqe sqe;
+	int pages = (size * 16 + PAGE - 1) / PAGE;
+
+	cq->page = gpage_alloc (pages);
+	if (cq->page < 0)
+		fail ("no guest memory for a queue");
+	cq->phys = (u64)cq->page * PAGE;
+	memset (phys (cq->phys, pages * PAGE), 0, pages * PAGE);
+	cq->qid = i;
+	cq->size = size;
+	cq->head = 0;
+	cq->phase = NVME_CQE_PHASE_BIT;
+	cq->ien = ien;
+	cq->iv = iv;
+	memset (&sqe, 0, sizeof sqe);
+	sqe.opcode = NVME_ADMIN_CREATE_CQ;
+	sqe.dptr[0] = cq->phys;
+	sqe.cdw10 = i | (size - 1) << 16;
+	sqe.cdw11 = NVME_QUEUE_PC_BIT | (ien ? NVME_QUEUE_IEN_BIT : 0) |
+		iv << 16;
+	gadmin_expect (&sqe, 0);
+	cq->active = 1;
+}
+
+static void
+gcreate_sq (int i, u32 size, int cqi)
+{
+	struct gsq *sq = &guest.sq[i];
+	struct nvme_sqe sqe;
+	int pages = (size * 64 + PAGE - 1) / PAGE;
+
+	sq->page = gpage_alloc (pages);
+	if (sq->page < 0)
+		fail ("no guest memory for a queue");
+	sq->phys = (u64)sq->page * PAGE;
+	sq->qid = i;
+	sq->size = size;
+	sq->tail = 0;
+	sq->head = 0;
+	sq->unrung = 0;
+	sq->outstanding = 0;
+	sq->cq = &guest.cq[cqi];
+	sq->cmd = calloc (size, sizeof *sq->cmd);
+	memset (&sqe, 0, sizeof sqe);
+	sqe.opcode = NVME_ADMIN_CREATE_SQ;
+	sqe.dptr[0] = sq->phys;
+	sqe.cdw10 = i | (size - 1) << 16;
+	sqe.cdw11 = NVME_QUEUE_PC_BIT | cqi << 16;
+	sq->active = 1;
+	gadmin_expect (&sqe, 0);
+}
+
+static void
+gfree_sq (struct gsq *sq)
+{
+	u32 i;
+
+	for (i = 0; i < sq->size; i++) {
+		if (!sq->cmd[i].used)
+			continue;
+		if (sq->cmd[i].opcode == NVME_CMD_WRITE &&
+		    !sq->cmd[i].expect)
+			/* the write may or may not have reached the
+			   media */
+			memset (ns[sq->cmd[i].nsid].known + sq->cmd[i].lba, 0,
+				sq->cmd[i].count);
+		gcmd_release (sq, &sq->cmd[i]);
+	}
+	gpage_free (sq->page, (sq->size * 64 + PAGE - 1) / PAGE);
+	free (sq->cmd);
+	sq->cmd = NULL;
+	sq->active = 0;
+}
+
+static void
+gfree_cq (struct gcq *cq)
+{
+	gpage_free (cq->page, (cq->size * 16 + PAGE - 1) / PAGE);
+	memset (cqe_dirty + cq->phys / 16, 0, cq->size);
+	cq->active = 0;
+}
+
+/* the commands in flight are aborted by the controller and their
+   completions are reaped before the queue goes away */
+static void
+gdelete_sq (int i)
+{
+	struct gsq *sq = &guest.sq[i];
+	struct nvme_sqe sqe;
+	u32 j;
+
+	if (sq->unrung)
+		gring (sq);
+	for (j = 0; j < sq->size; j++)
+		sq->cmd[j].abort_ok = 1;
+	memset (&sqe, 0, sizeof sqe);
+	sqe.opcode = NVME_ADMIN_DELETE_SQ;
+	sqe.cdw10 = i;
+	gadmin_expect (&sqe, 0);
+	gcq_process (sq->cq);
+	/* commands the controller has not fetched may be dropped
+	   without a completion */
+	stat.dropped += sq->outstanding;
+	gfree_sq (sq);
+}
+
+static void
+gdelete_cq (int i)
+{
+	struct nvme_sqe sqe;
+
+	memset (&sqe, 0, sizeof sqe);
+	sqe.opcode = NVME_ADMIN_DELETE_CQ;
+	sqe.cdw10 = i;
+	gadmin_expect (&sqe, 0);
+	gfree_cq (&guest.cq[i]);
+}
+
+static u32
+gqsize (void)
+{
+	return rnd () % 2 ? 2 + rnd () % 16 : 2 + rnd () % CTRL_MQES;
+}
+
+/* the last submission queue shares the completion queue of the one
+   before it */
+static void
+gcreate_pair (int i)
+{
+	if (i < NQ)
+		gcreate_cq (i, gqsize (), i % 3 != 0, i % guest.nvec);
+	gcreate_sq (i, gqsize (), i < NQ ? i : NQ - 1);
+}
+
+static void
+gdelete_pair (int i)
+{
+	if (i == NQ - 1)
+		gdelete_sq (NQ);
+	gdelete_sq (i);
+	gdelete_cq (i);
+	stat.recreated++;
+}
+
+static int
+gcmd_page (struct gcmd *cmd)
+{
+	int p;
+
+	if (cmd->npages >= MAX_CMD_PAGES)
+		fail ("too many pages for a command");
+	p = gpage_random ();
+	if (p >= 0)
+		cmd->pages[cmd->npages++] = p;
+	return p;
+}
+
+static void
+gcmd_seg (struct gcmd *cmd, u64 addr, u32 len)
+{
+	if (cmd->nseg >= MAX_CMD_SEGS)
+		fail ("too many segments for a command");
+	cmd->seg[cmd->nseg].addr = addr;
+	cmd->seg[cmd->nseg].len = len;
+	cmd->nseg++;
+}
+
+/* PRP1 at any dword, PRP lists at any qword and chained at the end
+   of a page */
+static int
+gprp (struct gcmd *cmd, struct nvme_sqe *sqe)
+{
+	u32 off = rnd () % 2 ? 0 : 4 * (rnd () % (PAGE / 4)), n, rem;
+	int np = (off + cmd->len + PAGE - 1) / PAGE, i, p;
+	u64 list;
+
+	for (i = 0, rem = cmd->len; i < np; i++, rem -= n) {
+		p = gcmd_page (cmd);
+		if (p < 0)
+			return -1;
+		n = i ? PAGE : PAGE - off;
+		if (n > rem)
+			n = rem;
+		gcmd_seg (cmd, (u64)p * PAGE + (i ? 0 : off), n);
+	}
+	sqe->dptr[0] = cmd->seg[0].addr;
+	sqe->dptr[1] = 0;
+	if (np == 2)
+		sqe->dptr[1] = cmd->seg[1].addr;
+	if (np <= 2)
+		return 0;
+	p = gcmd_page (cmd);
+	if (p < 0)
+		return -1;
+	list = (u64)p * PAGE + (rnd () % 2 ? 8 * (rnd () % (PAGE / 8)) : 0);
+	sqe->dptr[1] = list;
+	for (i = 1; i < np; ) {
+		if (list % PAGE == PAGE - 8 && np - i > 1) {
+			p = gcmd_page (cmd);
+			if (p < 0)
+				return -1;
+			put64 (phys (list, 8), (u64)p * PAGE);
+			list = (u64)p * PAGE;
+			continue;
+		}
+		put64 (phys (list, 8), cmd->seg[i++].addr);
+		list += 8;
+	}
+	return 0;
+}
+
+static void
+gsgl_desc (struct nvme_sgl *d, u64 addr, u32 len, int type)
+{
+	memset (d, 0, sizeof *d);
+	d->addr = addr;
+	d->len = len;
+	d->id = type << 4;
+}
+
+/* data blocks of any length within a page, sometimes empty, in
+   segments of up to 16 descriptors.  with many set, every block is
+   512 bytes in a page of its own. */
+static int
+gsgl (struct gcmd *cmd, struct nvme_sqe *sqe, int many)
+{
+	struct nvme_sgl desc[128], sgl1, *list;
+	u32 rem = cmd->len, b, o;
+	int nd = 0, chunk[128], nchunk = 0, i, j, k, bytes, p;
+	u64 addr[128];
+
+	while (rem) {
+		if (many)
+			b = 512;
+		else if (nd >= 24 || !(rnd () % 4))
+			b = PAGE;
+		else if (rnd () % 2)
+			b = 1 + rnd () % PAGE;
+		else
+			b = 512 * (1 + rnd () % 8);
+		if (b > rem)
+			b = rem;
+		p = gcmd_page (cmd);
+		if (p < 0)
+			return -1;
+		o = many ? 8 + rnd () % (PAGE - b - 8) : rnd () % (PAGE - b + 1);
+		gsgl_desc (&desc[nd++], (u64)p * PAGE + o, b,
+			   NVME_SGL_TYPE_DATA);
+		gcmd_seg (cmd, (u64)p * PAGE + o, b);
+		rem -= b;
+		if (!many && !(rnd () % 16))
+			gsgl_desc (&desc[nd++], 0, 0, NVME_SGL_TYPE_DATA);
+	}
+	sqe->flags |= 0x40;
+	if (nd == 1 && rnd () % 2) {
+		memcpy (sqe->dptr, &desc[0], sizeof desc[0]);
+		return 0;
+	}
+	for (i = 0; i < nd; i += chunk[nchunk++])
+		chunk[nchunk] = min_int (1 + rnd () % 16, nd - i);
+	/* place the lists from the last one so that each can point to
+	   the next */
+	for (k = nchunk - 1, i = nd; k >= 0; k--) {
+		i -= chunk[k];
+		bytes = (chunk[k] + (k < nchunk - 1)) * sizeof *list;
+		p = gcmd_page (cmd);
+		if (p < 0)
+			return -1;
+		addr[k] = (u64)p * PAGE +
+			16 * (rnd () % ((PAGE - bytes) / 16 + 1));
+		list = (struct nvme_sgl *)phys (addr[k], bytes);
+		for (j = 0; j < chunk[k]; j++)
+			list[j] = desc[i + j];
+		if (k < nchunk - 1)
+			list[j] = sgl1;
+		gsgl_desc (&sgl1, addr[k], bytes, k == nchunk - 1 ?
+			   NVME_SGL_TYPE_LAST_SEGMENT :
+			   NVME_SGL_TYPE_SEGMENT);
+	}
+	memcpy (sqe->dptr, &sgl1, sizeof sgl1);
+	return 0;
+}
+
+/* lock the sectors, or return -1 if a command in flight uses one */
+static int
+glock (struct gcmd *cmd)
+{
+	struct ns *n = &ns[cmd->nsid];
+	u32 i;
+
+	for (i = 0; i < cmd->count; i++)
+		if (n->busy[cmd->lba + i])
+			return -1;
+	memset (n->busy + cmd->lba, 1, cmd->count);
+	cmd->locked = 1;
+	return 0;
+}
+
+static void
+gio (struct gsq *sq)
+{
+	struct gcmd *cmd;
+	struct nvme_sqe sqe;
+	struct ns *n;
+	u32 r = rnd () % 100, ss, maxcount, i;
+	int data = 1, ret;
+
+	cmd = gcmd_get (sq);
+	if (!cmd)
+		return;
+	memset (&sqe, 0, sizeof sqe);
+	cmd->nsid = rnd () % 2 ? 1 : 2;
+	n = &ns[cmd->nsid];
+	ss = 1 << n->lbads;
+	maxcount = MAX_XFER / ss;
+	if (maxcount > n->nsze)
+		maxcount = n->nsze;
+	cmd->count = rnd () % 4 ? 1 + rnd () % 8 : 1 + rnd () % maxcount;
+	cmd->lba = rnd () % (n->nsze - cmd->count + 1);
+	if (r < 40) {
+		cmd->opcode = NVME_CMD_WRITE;
+	} else if (r < 80) {
+		cmd->opcode = NVME_CMD_READ;
+	} else if (r < 86) {
+		cmd->opcode = NVME_CMD_COMPARE;
+		for (i = 0; i < cmd->count; i++)
+			if (!n->known[cmd->lba + i])
+				cmd->opcode = NVME_CMD_READ;
+		if (cmd->opcode == NVME_CMD_COMPARE && !(rnd () % 3))
+			cmd->expect = SC_COMPARE;
+	} else if (r < 89) {
+		cmd->opcode = rnd () % 2 ? NVME_CMD_FLUSH : NVME_CMD_DSM;
+		data = 0;
+	} else if (r < 92) {
+		/* would write sectors without encryption */
+		cmd->opcode = rnd () % 2 ? NVME_CMD_WRITE_ZEROES :
+			NVME_CMD_COPY;
+		cmd->expect = NVME_SC_INVALID_OPCODE | DNR;
+		data = 0;
+	} else if (r < 94) {
+		/* more than MDTS */
+		cmd->opcode = NVME_CMD_WRITE;
+		cmd->nsid = 2;
+		cmd->count = MAX_XFER / PAGE + 1 + rnd () % 8;
+		cmd->lba = 0;
+		cmd->expect = NVME_SC_INVALID_FIELD | DNR;
+		data = 0;
+	} else if (r < 96) {
+		/* metadata interleaved with the data */
+		cmd->opcode = NVME_CMD_WRITE;
+		cmd->nsid = 3;
+		cmd->count = 1;
+		cmd->lba = 0;
+		cmd->expect = NVME_SC_INVALID_FORMAT | DNR;
+		data = 0;
+	} else if (r < 97) {
+		/* never identified */
+		cmd->opcode = NVME_CMD_WRITE;
+		cmd->nsid = NS_NUM + 1;
+		cmd->count = 1;
+		cmd->lba = 0;
+		cmd->expect = NVME_SC_NS_NOT_READY;
+		data = 0;
+	} else if (r < 98) {
+		/* more segments than a request holds */
+		cmd->opcode = NVME_CMD_READ;
+		cmd->nsid = 1;
+		cmd->count = 70;
+		cmd->lba = 0;
+		cmd->expect = NVME_SC_INVALID_FIELD | DNR;
+		n = &ns[1];
+	} else {
+		/* beyond the end of the namespace */
+		cmd->opcode = NVME_CMD_READ;
+		cmd->lba = n->nsze - cmd->count + 1 + rnd () % 8;
+		cmd->expect = SC_LBA_RANGE | DNR;
+	}
+	ss = cmd->nsid <= NS_NUM ? 1 << ns[cmd->nsid].lbads : 512;
+	cmd->len = cmd->count * ss;
+	if (!cmd->expect || cmd->expect == SC_COMPARE) {
+		if (glock (cmd)) {
+			stat.skipped++;
+			return;
+		}
+	}
+	sqe.opcode = cmd->opcode;
+	sqe.nsid = cmd->nsid;
+	sqe.cdw10 = cmd->lba;
+	sqe.cdw11 = cmd->lba >> 32;
+	sqe.cdw12 = cmd->count - 1;
+	if (!data) {
+		if (cmd->expect) {
+			/* rejected before the data pointer is used */
+			sqe.dptr[0] = (u64)(rnd () % GUEST_PAGES) * PAGE;
+		}
+		gsubmit (sq, cmd, &sqe);
+		return;
+	}
+	if (cmd->expect == (NVME_SC_INVALID_FIELD | DNR))
+		ret = gsgl (cmd, &sqe, 1);
+	else if (rnd () % 3)
+		ret = gprp (cmd, &sqe);
+	else
+		ret = gsgl (cmd, &sqe, 0);
+	if (ret < 0) {
+		stat.skipped++;
+		cmd->used = 1;
+		sq->outstanding++;
+		guest.outstanding++;
+		gcmd_release (sq, cmd);
+		return;
+	}
+	cmd->data = malloc (cmd->len);
+	if (cmd->opcode == NVME_CMD_WRITE) {
+		fill (cmd->data, cmd->len);
+	} else if (cmd->opcode == NVME_CMD_COMPARE) {
+		memcpy (cmd->data, n->truth + cmd->lba * ss, cmd->len);
+		if (cmd->expect)
+			cmd->data[rnd () % cmd->len] ^= 1 << rnd () % 8;
+	} else {
+		fill (cmd->data, cmd->len);
+	}
+	gscatter (cmd, cmd->data);
+	gsubmit (sq, cmd, &sqe);
+}
+
+/* --- setup --- */
+
+static void
+gwait_ready (int ready)
+{
+	int i;
+
+	for (i = 0; !(gr32 (NVME_CSTS) & 1) != !ready; i++) {
+		if (i > 1000)
+			fail ("CSTS.RDY did not become %d", ready);
+		world_step ();
+	}
+}
+
+static void
+gmsix (void)
+{
+	u32 ctrl, off;
+	int i;
+
+	ctrl = gcfg_read (CFG_MSIX + 2, 2);
+	guest.nvec = (ctrl & NVME_MSIX_CTRL_SIZE_MASK) + 1;
+	if (guest.nvec > MSIX_NUM)
+		fail ("%d MSI-X vectors advertised", guest.nvec);
+	for (i = 0; i < guest.nvec; i++) {
+		off = MSIX_OFF + i * NVME_MSIX_ENTRY_LEN;
+		gw32 (off, 0xFEE00000);
+		gw32 (off + 4, 0);
+		gw32 (off + 8, GUEST_VECTOR + i);
+		gw32 (off + 12, 0);
+		if (gr32 (off + 8) != GUEST_VECTOR + i)
+			fail ("MSI-X entry %d reads back 0x%x", i,
+			      gr32 (off + 8));
+		if ((get32 (&regs[off + 8]) & 0xFF) == GUEST_VECTOR + i)
+			fail ("MSI-X entry %d is not remapped", i);
+	}
+	gcfg_write (CFG_MSIX + 2, ctrl | NVME_MSIX_CTRL_ENABLE_BIT, 2);
+}
+
+static void
+ginit (void)
+{
+	u8 buf[NVME_IDENTIFY_LEN];
+	struct nvme_sqe sqe;
+	u32 aqa, dw0, lbaf, oncs;
+	u64 cap;
+	int i;
+
+	cap = gr64 (NVME_CAP);
+	if ((cap & NVME_CAP_MQES_MASK) != CTRL_MQES ||
+	    !(cap & NVME_CAP_CQR_BIT) ||
+	    (cap >> NVME_CAP_MPSMAX_SHIFT) & NVME_CAP_MPS_MASK ||
+	    cap & (NVME_CAP_CMBS_BIT | NVME_CAP_PMRS_BIT))
+		fail ("CAP 0x%llx", cap);
+	if (gr32 (NVME_CMBLOC) || !get32 (&regs[NVME_CMBLOC]))
+		fail ("controller memory buffer visible");
+	if (gr32 (NVME_CC) & NVME_CC_EN_BIT) {
+		gw32 (NVME_CC, 0);
+		gwait_ready (0);
+	}
+	memset (&guest.sq[0], 0, sizeof guest.sq[0]);
+	memset (&guest.cq[0], 0, sizeof guest.cq[0]);
+	guest.cq[0].page = gpage_alloc (1);
+	guest.cq[0].phys = (u64)guest.cq[0].page * PAGE;
+	memset (phys (guest.cq[0].phys, PAGE), 0, PAGE);
+	guest.cq[0].size = ADMIN_QSIZE;
+	guest.cq[0].phase = NVME_CQE_PHASE_BIT;
+	guest.cq[0].ien = 1;
+	guest.cq[0].active = 1;
+	guest.sq[0].page = gpage_alloc (1);
+	guest.sq[0].phys = (u64)guest.sq[0].page * PAGE;
+	guest.sq[0].size = ADMIN_QSIZE;
+	guest.sq[0].cq = &guest.cq[0];
+	guest.sq[0].cmd = calloc (ADMIN_QSIZE, sizeof *guest.sq[0].cmd);
+	guest.sq[0].active = 1;
+	aqa = (ADMIN_QSIZE - 1) | (ADMIN_QSIZE - 1) << NVME_AQA_ACQS_SHIFT;
+	gw32 (NVME_AQA, aqa);
+	gw64 (NVME_ASQ, guest.sq[0].phys);
+	gw32 (NVME_ACQ, guest.cq[0].phys);
+	gw32 (NVME_ACQ + 4, guest.cq[0].phys >> 32);
+	gw32 (NVME_CC, NVME_CC_EN_BIT | 6 << 16 | 4 << 20);
+	gwait_ready (1);
+	if (gr32 (NVME_AQA) != aqa || gr64 (NVME_ASQ) != guest.sq[0].phys ||
+	    gr64 (NVME_ACQ) != guest.cq[0].phys)
+		fail ("admin queue registers do not read back");
+	gmsix ();
+
+	gidentify (NVME_IDENTIFY_CNS_CTRL, 0, buf);
+	memcpy (&oncs, &buf[NVME_ID_CTRL_ONCS], 2);
+	if (buf[NVME_ID_CTRL_MDTS] != 5 ||
+	    buf[NVME_ID_CTRL_OACS + 1] & NVME_ID_CTRL_OACS_DBBUF_BIT >> 8 ||
+	    (oncs & 0xFFFF) != 0x5)
+		fail ("identify controller: MDTS %u OACS 0x%x ONCS 0x%x",
+		      buf[NVME_ID_CTRL_MDTS], get32 (&buf[NVME_ID_CTRL_OACS]) &
+		      0xFFFF, oncs & 0xFFFF);
+	for (i = 1; i <= NS_NUM; i++) {
+		gidentify (NVME_IDENTIFY_CNS_NS, i, buf);
+		lbaf = get32 (&buf[NVME_ID_NS_LBAF]);
+		if (get64 (&buf[0]) != ns[i].nsze ||
+		    (ns[i].nsze && (lbaf >> NVME_ID_NS_LBAF_LBADS_SHIFT & 0xFF)
+		     != ns[i].lbads))
+			fail ("identify namespace %d", i);
+	}
+	memset (&sqe, 0, sizeof sqe);
+	sqe.opcode = NVME_ADMIN_SET_FEATURES;
+	sqe.cdw10 = NVME_FEAT_NUM_QUEUES;
+	sqe.cdw11 = 0xFFFE | 0xFFFE << 16;
+	if (gadmin (&sqe, NULL, &dw0))
+		fail ("set features number of queues failed");
+	guest.maxq = min_int (dw0 & 0xFFFF, dw0 >> 16) + 1;
+	if (guest.maxq < NQ)
+		fail ("%u I/O queues", guest.maxq);
+
+	/* commands the shadow refuses */
+	memset (&sqe, 0, sizeof sqe);
+	sqe.opcode = NVME_ADMIN_DBBUF_CONFIG;
+	gadmin_expect (&sqe, NVME_SC_INVALID_OPCODE | DNR);
+	sqe.opcode = NVME_ADMIN_CREATE_CQ;
+	sqe.dptr[0] = (u64)(rnd () % GUEST_PAGES) * PAGE;
+	sqe.cdw10 = 1 | 15 << 16;
+	sqe.cdw11 = NVME_QUEUE_PC_BIT | NVME_QUEUE_IEN_BIT |
+		guest.nvec << 16;
+	gadmin_expect (&sqe, NVME_SC_INVALID_IV | DNR);
+	sqe.cdw10 = 70 | 15 << 16;
+	sqe.cdw11 = NVME_QUEUE_PC_BIT;
+	gadmin_expect (&sqe, NVME_SC_INVALID_QID | DNR);
+	sqe.cdw10 = 1 | 2047 << 16;
+	gadmin_expect (&sqe, NVME_SC_INVALID_QSIZE | DNR);
+	/* accepted by the shadow and refused by the controller */
+	sqe.cdw10 = 40 | 15 << 16;
+	gadmin_expect (&sqe, NVME_SC_INVALID_QID | DNR);
+	sqe.opcode = NVME_ADMIN_CREATE_SQ;
+	sqe.cdw11 = NVME_QUEUE_PC_BIT | 41 << 16;
+	gadmin_expect (&sqe, NVME_SC_INVALID_QID | DNR);
+
+	for (i = 1; i <= NQ; i++)
+		gcreate_pair (i);
+}
+
+/* the controller is reset with commands in flight */
+static void
+greset (void)
+{
+	int i;
+
+	gw32 (NVME_CC, 0);
+	gwait_ready (0);
+	for (i = NQ; i >= 0; i--) {
+		if (guest.sq[i].active)
+			gfree_sq (&guest.sq[i]);
+		if (guest.cq[i].active)
+			gfree_cq (&guest.cq[i]);
+	}
+	stat.resets++;
+}
+
+static void
+gcheck_stuck (void)
+{
+	struct gsq *sq;
+	u32 j;
+	int i;
+
+	for (i = 1; i <= NQ; i++) {
+		sq = &guest.sq[i];
+		if (!sq->active)
+			continue;
+		for (j = 0; j < sq->size; j++)
+			if (sq->cmd[j].used && now - sq->cmd[j].step >
+			    STUCK_STEPS)
+				fail ("queue %d cid %u opcode 0x%x did not"
+				      " complete", i, j, sq->cmd[j].opcode);
+	}
+}
+
+static void
+gring_all (void)
+{
+	int i;
+
+	for (i = 1; i <= NQ; i++)
+		if (guest.sq[i].active && guest.sq[i].unrung)
+			gring (&guest.sq[i]);
+}
+
+/* --- main --- */
+
+static void
+setup (void)
+{
+	static const struct {
+		u64 nsze;
+		int lbads, extended;
+	} conf[NS_NUM + 1] = {
+		{ 0, 0, 0 }, { 4096, 9, 0 }, { 512, 12, 0 }, { 1024, 9, 1 },
+		{ 0, 0, 0 },
+	};
+	u64 cap, len;
+	int i, j;
+
+	guest_mem = calloc (1, GUEST_SIZE);
+	vmm_mem = malloc (VMM_SIZE);
+	cqe_dirty = calloc (1, GUEST_SIZE / 16);
+	if (!guest_mem || !vmm_mem || !cqe_dirty)
+		fail ("out of memory");
+	for (i = 1; i <= NS_NUM; i++) {
+		ns[i].nsze = conf[i].nsze;
+		ns[i].lbads = conf[i].lbads;
+		ns[i].extended = conf[i].extended;
+		if (!ns[i].nsze)
+			continue;
+		len = ns[i].nsze << ns[i].lbads;
+		ns[i].disk = malloc (len);
+		ns[i].truth = malloc (len);
+		ns[i].known = malloc (ns[i].nsze);
+		ns[i].busy = calloc (1, ns[i].nsze);
+		fill (ns[i].disk, len);
+		memcpy (ns[i].truth, ns[i].disk, len);
+		for (j = 0; j < ns[i].nsze; j++)
+			sim_cipher (i, j, 1 << ns[i].lbads, ns[i].truth +
+				    ((u64)j << ns[i].lbads));
+		memset (ns[i].known, 1, ns[i].nsze);
+	}
+	cap = CTRL_MQES | NVME_CAP_CQR_BIT | 0x20ULL << 24 | 1ULL << 37 |
+		4ULL << NVME_CAP_MPSMAX_SHIFT | NVME_CAP_CMBS_BIT;
+	put64 (&regs[NVME_CAP], cap);
+	put32 (&regs[NVME_VS], 0x10400);
+	put32 (&regs[NVME_CMBLOC], 0x1002);
+	put32 (&regs[NVME_CMBSZ], 0x10014);
+	for (i = 0; i < MSIX_NUM; i++)
+		put32 (&regs[MSIX_OFF + i * NVME_MSIX_ENTRY_LEN + 12],
+		       NVME_MSIX_MASK_BIT);
+	cfg[0x34] = CFG_MSIX;
+	cfg[CFG_MSIX] = NVME_PCI_CAP_MSIX;
+	put32 (&cfg[CFG_MSIX], NVME_PCI_CAP_MSIX | (MSIX_NUM - 1) << 16);
+	put32 (&cfg[CFG_MSIX + 4], MSIX_OFF);
+	put32 (&cfg[CFG_MSIX + 8], MSIX_PBA);
+}
+
+static void
+verify_media (void)
+{
+	u8 buf[PAGE];
+	u32 ss;
+	u64 j;
+	int i;
+
+	for (i = 1; i <= NS_NUM; i++) {
+		ss = 1 << ns[i].lbads;
+		for (j = 0; j < ns[i].nsze; j++) {
+			if (!ns[i].known[j])
+				continue;
+			memcpy (buf, ns[i].truth + j * ss, ss);
+			sim_cipher (i, j, ss, buf);
+			if (memcmp (buf, ns[i].disk + j * ss, ss))
+				fail ("nsid %d lba %llu is not encrypted on"
+				      " the media", i, j);
+		}
+	}
+}
+
+int
+main (int argc, char **argv)
+{
+	char *vectors = NULL;
+	int c, i;
+	long steps;
+
+	steps = DEFAULT_STEPS;
+	while ((c = getopt (argc, argv, "n:s:vV:")) != -1) {
+		switch (c) {
+		case 'n':
+			steps = atol (optarg);
+			break;
+		case 's':
+			rnd_state = mix (strtoull (optarg, NULL, 0)) | 1;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'V':
+			vectors = optarg;
+			break;
+		default:
+			fprintf (stderr, "usage: nvmesim [-v] [-n steps]"
+				 " [-s seed] [-V vectors]\n");
+			return 1;
+		}
+	}
+	setup ();
+	sim_attach (BAR, BAR_LEN, vectors);
+	ginit ();
+	while (steps-- > 0) {
+		i = 1 + rnd () % NQ;
+		if (guest.sq[i].active && guest.outstanding < MAX_OUTSTANDING)
+			gio (&guest.sq[i]);
+		if (guest.sq[i].unrung &&
+		    (!(rnd () % 4) || guest.sq[i].unrung >= 8))
+			gring (&guest.sq[i]);
+		world_step ();
+		if (!(now % 64))
+			gring_all ();
+		if (!(now % 1024))
+			gcheck_stuck ();
+		if (!(rnd () % 5000)) {
+			/* with more commands than the shadow has tags */
+			i = 1 + rnd () % (NQ - 1);
+			for (c = 0; c < 200; c++)
+				gio (&guest.sq[i]);
+			gdelete_pair (i);
+			gcreate_pair (i);
+			if (i == NQ - 1)
+				gcreate_sq (NQ, gqsize (), NQ - 1);
+		}
+		if (!(rnd () % 100000)) {
+			greset ();
+			ginit ();
+		}
+	}
+	gring_all ();
+	for (i = 0; guest.outstanding; i++) {
+		if (i > STUCK_STEPS)
+			fail ("%d commands did not complete",
+			      guest.outstanding);
+		world_step ();
+	}
+	verify_media ();
+	greset ();
+	sim_remove ();
+	sim_timer_fire ();
+	if (sim_registered ())
+		fail ("%d hooks, timers, vectors or storage devices left",
+		      sim_registered ());
+	if (nmaps || vmm_used || allocs)
+		fail ("%d mappings, %d pages and %ld allocations left",
+		      nmaps, vmm_used, allocs);
+	printf ("%10s %10s %10s %10s %10s %10s %10s %10s %8s %8s %8s\n",
+		"reads", "writes", "compares", "other", "rejected",
+		"aborted", "dropped", "intrs", "resets", "recreate",
+		"vmm-peak");
+	printf ("%10llu %10llu %10llu %10llu %10llu %10llu %10llu %10llu"
+		" %8llu %8llu %8d\n", stat.reads, stat.writes, stat.compares,
+		stat.others, stat.rejected, stat.aborted, stat.dropped,
+		stat.intrs, stat.resets, stat.recreated, stat.vmm_peak);
+	printf ("nvmesim: ok\n");
+	return 0;
+}
@@ -0,0 +1,613 @@
+/*
+ * Copyright (c) 2007, 2008 University of Tsukuba
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the University of Tsukuba nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* an IKEv2 initiator and responder in one process.  the initiator
+   is an unmodified SE_SEC running SeSecIke2.c.  SeSec only
+   implements the initiator, so the responder is written here on
+   top of the same SeIke2 codec and SeSecIke2 key derivation; its
+   Child SAs live in a second SE_SEC so that ESP goes through the
+   real SeSecVirtualIpRecvCallback() and SeSecEspRecvCallback() on
+   both ends.  UDP messages are queued and delivered by pump(); ESP
+   and virtual IP packets are delivered at once. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sebench.h"
+
+#define QUEUE_SIZE	16
+#define PHASE2_LIFE	3600
+
+static struct {
+	struct peer *to;
+	SE_BUF *b;
+} queue[QUEUE_SIZE];
+static UINT queue_head, queue_tail;
+static UINT64 now = 1000;
+
+static UINT64
+client_tick (void *param)
+{
+	return now;
+}
+
+static void
+client_set_timer (SE_SEC_TIMER_CALLBACK *callback, void *callback_param,
+		  void *param)
+{
+	struct peer *p = param;
+
+	p->timer_cb = callback;
+	p->timer_param = callback_param;
+}
+
+static void
+client_add_timer (UINT interval, void *param)
+{
+}
+
+static void
+client_set_udp (SE_SEC_UDP_RECV_CALLBACK *callback, void *callback_param,
+		void *param)
+{
+	struct peer *p = param;
+
+	p->udp_cb = callback;
+	p->udp_param = callback_param;
+}
+
+static void
+client_set_esp (SE_SEC_ESP_RECV_CALLBACK *callback, void *callback_param,
+		void *param)
+{
+	struct peer *p = param;
+
+	p->esp_cb = callback;
+	p->esp_param = callback_param;
+}
+
+static void
+client_set_vip (SE_SEC_VIRTUAL_IP_RECV_CALLBACK *callback,
+		void *callback_param, void *param)
+{
+	struct peer *p = param;
+
+	p->vip_cb = callback;
+	p->vip_param = callback_param;
+}
+
+static void
+queue_push (struct peer *to, void *data, UINT size)
+{
+	if (queue_tail - queue_head == QUEUE_SIZE) {
+		fprintf (stderr, "loopback: UDP queue overflow\n");
+		exit (1);
+	}
+	queue[queue_tail % QUEUE_SIZE].to = to;
+	queue[queue_tail % QUEUE_SIZE].b = SeMemToBuf (data, size);
+	queue_tail++;
+}
+
+static void
+client_send_udp (SE_IKE_IP_ADDR *dest_addr, SE_IKE_IP_ADDR *src_addr,
+		 UINT dest_port, UINT src_port, void *data, UINT size,
+		 void *param)
+{
+	struct peer *p = param;
+
+	queue_push (p->other, data, size);
+}
+
+static void
+client_send_esp (SE_IKE_IP_ADDR *dest_addr, SE_IKE_IP_ADDR *src_addr,
+		 void *data, UINT size, void *param)
+{
+	struct peer *p = param;
+
+	p->other->esp_cb (dest_addr, src_addr, data, size,
+			  p->other->esp_param);
+}
+
+static void
+client_send_vip (void *data, UINT size, void *param)
+{
+	struct peer *p = param;
+
+	if (size <= sizeof p->vip_data)
+		memcpy (p->vip_data, data, size);
+	p->vip_size = size;
+	p->vip_count++;
+}
+
+static SE_SEC_CLIENT_FUNCTION_TABLE client_functions = {
+	.ClientGetTick = client_tick,
+	.ClientSetTimerCallback = client_set_timer,
+	.ClientAddTimer = client_add_timer,
+	.ClientSetRecvUdpCallback = client_set_udp,
+	.ClientSetRecvEspCallback = client_set_esp,
+	.ClientSetRecvVirtualIpCallback = client_set_vip,
+	.ClientSendUdp = client_send_udp,
+	.ClientSendEsp = client_send_esp,
+	.ClientSendVirtualIp = client_send_vip,
+};
+
+static void
+ipv4_addr (SE_IKE_IP_ADDR *a, UCHAR a0, UCHAR a1, UCHAR a2, UCHAR a3)
+{
+	SE_IPV4_ADDR v4;
+
+	v4.Value[0] = a0;
+	v4.Value[1] = a1;
+	v4.Value[2] = a2;
+	v4.Value[3] = a3;
+	SeIkeInitIPv4Address (a, &v4);
+}
+
+/* the responder side: messages leave with the responder keys */
+static void
+resp_send (struct loopback *l, UCHAR exchange_type, UINT msg_id,
+	   SE_LIST *payload_list, bool encrypted, SE_BUF **sent)
+{
+	SE_IKE_SA *sa = l->resp_sa;
+	SE_IKE2_CRYPTO_PARAM cparam;
+	SE_IKE_PACKET *packet;
+	SE_BUF *b;
+
+	packet = SeIkeNew (sa->InitiatorCookie, sa->ResponderCookie,
+			   exchange_type, encrypted, false, false, msg_id,
+			   payload_list);
+	packet->FlagResponse = true;
+	SeZero (&cparam, sizeof cparam);
+	cparam.DesKey = sa->Ike2KeySet.DesKeyR;
+	cparam.IntegKey = sa->Ike2KeySet.SK_ar;
+	b = SeIke2Build (packet, &cparam);
+	SeIkeFree (packet);
+	if (b == NULL)
+		return;
+	queue_push (&l->init, b->Buf, b->Size);
+	if (sent != NULL)
+		*sent = b;
+	else
+		SeFreeBuf (b);
+}
+
+static void
+resp_init (struct loopback *l, void *data, UINT size)
+{
+	SE_IKE_PACKET_PAYLOAD *sa_payload, *ke_payload, *nonce_payload;
+	SE_IKE2_PACKET_PROPOSAL *proposal;
+	SE_LIST *payload_list, *transform_list, *proposal_list;
+	UCHAR dh_key[SE_DH_KEY_SIZE];
+	USHORT encr_id, prf_id, integ_id, dh_id;
+	SE_IKE_PACKET *packet;
+	SE_IKE_SA *sa;
+
+	if (l->resp_sa != NULL)
+		return;
+	packet = SeIke2Parse (data, size, NULL);
+	if (packet == NULL)
+		return;
+	sa_payload = SeIkeGetPayload (packet->PayloadList, SE_IKE2_PAYLOAD_SA,
+				      0);
+	ke_payload = SeIkeGetPayload (packet->PayloadList,
+				      SE_IKE2_PAYLOAD_KEY_EXCHANGE, 0);
+	nonce_payload = SeIkeGetPayload (packet->PayloadList,
+					 SE_IKE2_PAYLOAD_NONCE, 0);
+	if (sa_payload == NULL || ke_payload == NULL || nonce_payload == NULL ||
+	    SE_LIST_NUM (sa_payload->Payload.Sa2.ProposalList) == 0)
+		goto exit;
+	proposal = SE_LIST_DATA (sa_payload->Payload.Sa2.ProposalList, 0);
+	if (!SeIke2GetTransformId (proposal, SE_IKE2_TRANSFORM_TYPE_ENCR,
+				   &encr_id) ||
+	    !SeIke2GetTransformId (proposal, SE_IKE2_TRANSFORM_TYPE_PRF,
+				   &prf_id) ||
+	    !SeIke2GetTransformId (proposal, SE_IKE2_TRANSFORM_TYPE_INTEG,
+				   &integ_id) ||
+	    !SeIke2GetTransformId (proposal, SE_IKE2_TRANSFORM_TYPE_DH,
+				   &dh_id) ||
+	    prf_id != SE_IKE2_PRF_HMAC_SHA1 ||
+	    integ_id != SE_IKE2_INTEG_HMAC_SHA1_96 ||
+	    dh_id != SE_IKE2_DH_1024_MODP ||
+	    ke_payload->Payload.KeyExchange2.DhGroup != dh_id)
+		goto exit;
+
+	sa = SeSecNewIkeSa (l->resp.s, l->resp.addr, l->init.addr,
+			    SE_SEC_IKE_UDP_PORT, SE_SEC_IKE_UDP_PORT,
+			    packet->InitiatorCookie);
+	SeDelete (l->resp.s->IkeSaList, sa);
+	sa->ResponderCookie = SeSecGenIkeSaInitCookie (l->resp.s);
+	SeInsert (l->resp.s->IkeSaList, sa);
+	sa->Ike2 = true;
+	sa->Dh = SeDhNewGroup2 ();
+	l->resp_sa = sa;
+	if (!SeDhCompute (sa->Dh, dh_key,
+			  ke_payload->Payload.KeyExchange2.Data->Buf,
+			  ke_payload->Payload.KeyExchange2.Data->Size))
+		goto exit;
+
+	/* the responder SA keeps the initiator's view of "my" and
+	   "your" nonce so that SeSecIke2CalcKeySet() and
+	   SeSecIke2InstallChildSa() derive the same keys on both
+	   sides */
+	sa->Ike2MyNonce = SeCloneBuf (nonce_payload->Payload.GeneralData.Data);
+	sa->Ike2YourNonce = SeRandBuf (SE_SHA1_HASH_SIZE);
+	sa->Ike2InitRequest = SeMemToBuf (data, size);
+
+	transform_list = SeNewList (NULL);
+	SeAdd (transform_list, SeIke2NewTransform
+	       (SE_IKE2_TRANSFORM_TYPE_ENCR, encr_id, NULL));
+	SeAdd (transform_list, SeIke2NewTransform
+	       (SE_IKE2_TRANSFORM_TYPE_PRF, prf_id, NULL));
+	SeAdd (transform_list, SeIke2NewTransform
+	       (SE_IKE2_TRANSFORM_TYPE_INTEG, integ_id, NULL));
+	SeAdd (transform_list, SeIke2NewTransform
+	       (SE_IKE2_TRANSFORM_TYPE_DH, dh_id, NULL));
+	proposal_list = SeNewList (NULL);
+	SeAdd (proposal_list, SeIke2NewProposal (1, SE_IKE_PROTOCOL_ID_IKE,
+						 NULL, 0, transform_list));
+	payload_list = SeNewList (NULL);
+	SeAdd (payload_list, SeIke2NewSaPayload (proposal_list));
+	SeAdd (payload_list, SeIke2NewKeyExchangePayload
+	       (dh_id, sa->Dh->MyPublicKey->Buf, sa->Dh->MyPublicKey->Size));
+	SeAdd (payload_list, SeIkeNewDataPayload
+	       (SE_IKE2_PAYLOAD_NONCE, sa->Ike2YourNonce->Buf,
+		sa->Ike2YourNonce->Size));
+	resp_send (l, SE_IKE2_EXCHANGE_TYPE_IKE_SA_INIT, packet->MessageId,
+		   payload_list, false, &sa->Ike2InitResponse);
+
+	SeSecIke2CalcKeySet (l->resp.s, sa, dh_key, sizeof dh_key);
+	sa->Phase = 1;
+	l->resp_next_msg_id = packet->MessageId + 1;
+exit:
+	SeIkeFree (packet);
+}
+
+static void
+resp_notice (struct loopback *l, SE_IKE_PACKET *packet, USHORT type)
+{
+	SE_LIST *payload_list;
+
+	payload_list = SeNewList (NULL);
+	SeAdd (payload_list, SeIke2NewNoticePayload (0, type, NULL, 0, NULL,
+						     0));
+	resp_send (l, packet->ExchangeType, packet->MessageId, payload_list,
+		   true, NULL);
+}
+
+static void
+resp_auth (struct loopback *l, SE_IKE_PACKET *packet)
+{
+	SE_IKE_PACKET_PAYLOAD *id_payload, *auth_payload, *sa_payload;
+	SE_IKE_PACKET_PAYLOAD *my_id_payload;
+	SE_IKE_SA *sa = l->resp_sa;
+	SE_LIST *payload_list;
+	SE_BUF *auth, *id_body;
+	UINT your_spi, myip_32;
+
+	id_payload = SeIkeGetPayload (packet->PayloadList,
+				      SE_IKE2_PAYLOAD_ID_I, 0);
+	auth_payload = SeIkeGetPayload (packet->PayloadList,
+					SE_IKE2_PAYLOAD_AUTH, 0);
+	sa_payload = SeIkeGetPayload (packet->PayloadList, SE_IKE2_PAYLOAD_SA,
+				      0);
+	if (id_payload == NULL || auth_payload == NULL || sa_payload == NULL) {
+		resp_notice (l, packet, SE_IKE2_NOTICE_NO_PROPOSAL_CHOSEN);
+		return;
+	}
+
+	/* the initiator signs its IKE_SA_INIT request and our nonce */
+	auth = SeSecIke2CalcAuth (l->resp.s, sa->Ike2InitRequest,
+				  sa->Ike2YourNonce, sa->Ike2KeySet.SK_pi,
+				  id_payload->BitArray);
+	if (auth_payload->Payload.Auth.Method !=
+	    SE_IKE2_AUTH_METHOD_PRESHAREDKEY ||
+	    !SeCmpEx (auth->Buf, auth->Size,
+		      auth_payload->Payload.Auth.Data->Buf,
+		      auth_payload->Payload.Auth.Data->Size)) {
+		SeFreeBuf (auth);
+		l->resp_auth_failed = true;
+		resp_notice (l, packet, SE_IKE2_NOTICE_AUTHENTICATION_FAILED);
+		return;
+	}
+	SeFreeBuf (auth);
+	if (!SeSecIke2GetChildSpi (l->resp.s, sa_payload, &your_spi)) {
+		resp_notice (l, packet, SE_IKE2_NOTICE_NO_PROPOSAL_CHOSEN);
+		return;
+	}
+
+	payload_list = SeNewList (NULL);
+	myip_32 = Se4IPToUINT (SeIkeGetIPv4Address (&l->resp.addr));
+	my_id_payload = SeIke2NewIdPayload (SE_IKE2_PAYLOAD_ID_R,
+					    SE_IKE_ID_IPV4_ADDR, &myip_32,
+					    sizeof myip_32);
+	SeAdd (payload_list, my_id_payload);
+	id_body = SeIkeBuildIdPayload (&my_id_payload->Payload.Id);
+	auth = SeSecIke2CalcAuth (l->resp.s, sa->Ike2InitResponse,
+				  sa->Ike2MyNonce, sa->Ike2KeySet.SK_pr,
+				  id_body);
+	SeAdd (payload_list, SeIke2NewAuthPayload
+	       (SE_IKE2_AUTH_METHOD_PRESHAREDKEY, auth->Buf, auth->Size));
+	SeFreeBuf (id_body);
+	SeFreeBuf (auth);
+	sa->MySpi = SeSecGenIPsecSASpi (l->resp.s);
+	sa->YourSpi = your_spi;
+	SeAdd (payload_list, SeSecIke2NewChildSaPayload (l->resp.s,
+							 sa->MySpi));
+	SeSecIke2AddTsPayloads (l->resp.s, payload_list);
+	resp_send (l, SE_IKE2_EXCHANGE_TYPE_IKE_AUTH, packet->MessageId,
+		   payload_list, true, NULL);
+
+	SeSecIke2InstallChildSa (l->resp.s, sa, sa->MySpi, your_spi,
+				 sa->Ike2MyNonce, sa->Ike2YourNonce, false,
+				 NULL);
+	sa->Established = true;
+	sa->Phase1EstablishedTick = now;
+}
+
+/* CREATE_CHILD_SA and INFORMATIONAL requests are answered by the
+   SeSecIke2 handlers for peer requests */
+static void
+resp_request (struct loopback *l, SE_IKE_PACKET *packet)
+{
+	SE_LIST *response;
+
+	response = SeNewList (NULL);
+	switch (packet->ExchangeType) {
+	case SE_IKE2_EXCHANGE_TYPE_INFORMATIONAL:
+		SeSecIke2ProcessPeerInfo (l->resp.s, l->resp_sa, packet,
+					  response);
+		break;
+	case SE_IKE2_EXCHANGE_TYPE_CREATE_CHILD_SA:
+		SeSecIke2ProcessPeerCreateChild (l->resp.s, l->resp_sa, packet,
+						 response);
+		break;
+	default:
+		SeAdd (response, SeIke2NewNoticePayload
+		       (0, SE_IKE2_NOTICE_NO_PROPOSAL_CHOSEN, NULL, 0, NULL,
+			0));
+		break;
+	}
+	resp_send (l, packet->ExchangeType, packet->MessageId, response, true,
+		   NULL);
+}
+
+static void
+resp_recv (struct loopback *l, void *data, UINT size)
+{
+	SE_IKE_PACKET *header, *packet;
+	SE_IKE2_CRYPTO_PARAM cparam;
+	SE_IKE_SA *sa;
+
+	header = SeIkeParseHeader (data, size, NULL);
+	if (header == NULL)
+		return;
+	sa = l->resp_sa;
+	if (header->ExchangeType == SE_IKE2_EXCHANGE_TYPE_IKE_SA_INIT) {
+		resp_init (l, data, size);
+	} else if (sa != NULL && sa->Phase >= 1 &&
+		   header->FlagResponse == false &&
+		   header->MessageId == l->resp_next_msg_id) {
+		SeZero (&cparam, sizeof cparam);
+		cparam.DesKey = sa->Ike2KeySet.DesKeyI;
+		cparam.IntegKey = sa->Ike2KeySet.SK_ai;
+		packet = SeIke2Parse (data, size, &cparam);
+		if (packet != NULL && packet->FlagEncrypted) {
+			if (packet->ExchangeType ==
+			    SE_IKE2_EXCHANGE_TYPE_IKE_AUTH)
+				resp_auth (l, packet);
+			else if (sa->Established)
+				resp_request (l, packet);
+			l->resp_next_msg_id++;
+		}
+		SeIkeFree (packet);
+	}
+	SeIkeFree (header);
+}
+
+static void
+pump (struct loopback *l)
+{
+	struct peer *to;
+	SE_BUF *b;
+
+	while (queue_head != queue_tail) {
+		to = queue[queue_head % QUEUE_SIZE].to;
+		b = queue[queue_head % QUEUE_SIZE].b;
+		queue_head++;
+		if (to == &l->resp)
+			resp_recv (l, b->Buf, b->Size);
+		else
+			to->udp_cb (&to->addr, &to->other->addr,
+				    SE_SEC_IKE_UDP_PORT, SE_SEC_IKE_UDP_PORT,
+				    b->Buf, b->Size, to->udp_param);
+		SeFreeBuf (b);
+	}
+}
+
+static void
+make_config (SE_SEC_CONFIG *c, struct peer *p, UINT phase1_mode,
+	     char *password, UCHAR virtual_ip)
+{
+	SeZero (c, sizeof *c);
+	c->MyIpAddress = p->addr;
+	c->VpnGatewayAddress = p->other->addr;
+	ipv4_addr (&c->MyVirtualIpAddress, 192, 168, 0, virtual_ip);
+	c->VpnAuthMethod = SE_SEC_AUTH_METHOD_PASSWORD;
+	SeStrCpy (c->VpnPassword, sizeof c->VpnPassword, password);
+	c->VpnPhase1Mode = phase1_mode;
+	c->VpnPhase1Crypto = SE_IKE_P1_CRYPTO_3DES_CBC;
+	c->VpnPhase1Hash = SE_IKE_P1_HASH_SHA1;
+	c->VpnPhase2Crypto = SE_IKE_TRANSFORM_ID_P2_ESP_3DES;
+	c->VpnPhase2Hash = SE_IKE_P2_HMAC_SHA1;
+	c->VpnPhase2LifeSeconds = PHASE2_LIFE;
+	c->VpnConnectTimeout = 30;
+}
+
+/* start the initiator and run the exchange to completion; true if
+   the initiator has an established IKE SA */
+bool
+loopback_connect (struct loopback *l, char *init_password,
+		  char *resp_password)
+{
+	SE_SEC_CONFIG config;
+	SE_IKE_SA *sa;
+
+	SeZero (l, sizeof *l);
+	ipv4_addr (&l->init.addr, 10, 0, 0, 1);
+	ipv4_addr (&l->resp.addr, 10, 0, 0, 2);
+	l->init.other = &l->resp;
+	l->resp.other = &l->init;
+
+	/* a phase 1 mode of 0 never starts a connection */
+	make_config (&config, &l->resp, 0, resp_password, 2);
+	l->resp.s = SeSecInit ((SE_VPN *)l, false, &config,
+			       &client_functions, &l->resp, false);
+	make_config (&config, &l->init, SE_IKE2_EXCHANGE_TYPE_IKE_SA_INIT,
+		     init_password, 1);
+	l->init.s = SeSecInit ((SE_VPN *)l, false, &config,
+			       &client_functions, &l->init, false);
+	pump (l);
+
+	if (SE_LIST_NUM (l->init.s->IkeSaList) != 1)
+		return false;
+	sa = SE_LIST_DATA (l->init.s->IkeSaList, 0);
+	return sa->Established;
+}
+
+/* let time pass on the initiator and deliver what it sends */
+void
+loopback_advance (struct loopback *l, UINT64 ms)
+{
+	now += ms;
+	l->init.timer_cb (now, l->init.timer_param);
+	pump (l);
+}
+
+void
+loopback_free (struct loopback *l)
+{
+	SeSecFree (l->init.s);
+	SeSecFree (l->resp.s);
+	while (queue_head != queue_tail)
+		SeFreeBuf (queue[queue_head++ % QUEUE_SIZE].b);
+}
+
+/* send size bytes from the virtual IP side of one peer and check
+   that the other peer hands the same bytes to its virtual IP
+   side */
+static bool
+esp_through (struct peer *from, UINT size)
+{
+	struct peer *to = from->other;
+	UCHAR data[1500];
+	UINT i;
+
+	for (i = 0; i < size; i++)
+		data[i] = (UCHAR)(i * 7 + size);
+	to->vip_size = 0;
+	from->vip_cb (data, size, from->vip_param);
+	return to->vip_size == size && memcmp (to->vip_data, data, size) == 0;
+}
+
+static bool
+esp_both_ways (struct loopback *l)
+{
+	static UINT sizes[] = { 1, 64, 575, 1400 };
+	UINT i;
+
+	for (i = 0; i < sizeof sizes / sizeof sizes[0]; i++)
+		if (!esp_through (&l->init, sizes[i]) ||
+		    !esp_through (&l->resp, sizes[i]))
+			return false;
+	return true;
+}
+
+/* the outgoing SA of one peer must be the incoming SA of the
+   other */
+static bool
+child_sa_paired (struct loopback *l)
+{
+	SE_IPSEC_SA *out_i, *out_r;
+
+	if (SE_LIST_NUM (l->init.s->IPsecSaList) != 2 ||
+	    SE_LIST_NUM (l->resp.s->IPsecSaList) != 2)
+		return false;
+	out_i = SeSecGetIPsecSa (l->init.s, true);
+	out_r = SeSecGetIPsecSa (l->resp.s, true);
+	return out_i != NULL && out_r != NULL &&
+		SeSecGetIPsecSaBySpi (l->resp.s, false, out_i->Spi) != NULL &&
+		SeSecGetIPsecSaBySpi (l->init.s, false, out_r->Spi) != NULL;
+}
+
+#define CHECK(cond, msg) do { \
+	if (!(cond)) { \
+		fprintf (stderr, "IKEv2 loopback: %s\n", msg); \
+		return -1; \
+	} \
+} while (0)
+
+int
+test_ike2 (void)
+{
+	struct loopback l;
+	SE_IKE_SA *sa;
+	UINT old_spi;
+
+	/* IKE_SA_INIT and IKE_AUTH with a matching pre-shared key */
+	CHECK (loopback_connect (&l, "secret", "secret"),
+	       "initiator not established");
+	CHECK (l.resp_sa->Established && !l.resp_auth_failed,
+	       "responder did not accept the initiator");
+	CHECK (child_sa_paired (&l), "Child SA SPIs do not pair up");
+	CHECK (esp_both_ways (&l), "ESP does not pass");
+
+	/* the initiator rekeys the Child SA at 85% of its lifetime and
+	   deletes the old one */
+	old_spi = SeSecGetIPsecSa (l.init.s, true)->Spi;
+	loopback_advance (&l, PHASE2_LIFE * 1000ULL * 90 / 100);
+	sa = SE_LIST_DATA (l.init.s->IkeSaList, 0);
+	CHECK (sa->Ike2Request == SE_SEC_IKE2_REQ_NONE,
+	       "rekey or delete left a request pending");
+	CHECK (SeSecGetIPsecSa (l.init.s, true)->Spi != old_spi,
+	       "Child SA not rekeyed");
+	CHECK (child_sa_paired (&l), "rekeyed Child SA SPIs do not pair up");
+	CHECK (esp_both_ways (&l), "ESP does not pass after rekey");
+	loopback_free (&l);
+
+	/* a different pre-shared key is rejected by the responder */
+	CHECK (!loopback_connect (&l, "secret", "wrong"),
+	       "established with a wrong key");
+	CHECK (l.resp_auth_failed, "responder accepted a wrong key");
+	CHECK (SE_LIST_NUM (l.init.s->IPsecSaList) == 0,
+	       "Child SA installed with a wrong key");
+	loopback_free (&l);
+
+	printf ("IKEv2 loopback: ok\n");
+	return 0;
+}
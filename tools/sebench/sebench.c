@@ -0,0 +1,288 @@
+/*
+ * Copyright (c) 2007, 2008 University of Tsukuba
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the University of Tsukuba nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* allocation counts of the Se VPN library on the ESP and IKE paths.
+   the library is built for the host with a system call table that
+   counts heap calls.  the IKE benchmark builds and parses the main
+   mode messages as SeSec does.  the ESP benchmark sends packets
+   between the two SE_SECs of loopback.c, which is first run as an
+   IKEv2 test. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sebench.h"
+
+#define ESP_PACKETS	100000
+#define IKE_ROUNDS	10000
+
+static unsigned long long nalloc, nrealloc, nfree;
+static bool verbose;
+
+static void *
+sys_alloc (UINT size)
+{
+	nalloc++;
+	return malloc (size);
+}
+
+static void *
+sys_realloc (void *addr, UINT size)
+{
+	nrealloc++;
+	return realloc (addr, size);
+}
+
+static void
+sys_free (void *addr)
+{
+	nfree++;
+	free (addr);
+}
+
+static UINT
+sys_cpuid (void)
+{
+	return 0;
+}
+
+static SE_HANDLE
+sys_newlock (void)
+{
+	return (SE_HANDLE)1;
+}
+
+static void
+sys_lock (SE_HANDLE h)
+{
+}
+
+static UINT
+sys_tick (void)
+{
+	return 0;
+}
+
+static void
+sys_log (char *type, char *message)
+{
+	if (verbose)
+		fprintf (stderr, "%s: %s\n", type, message);
+}
+
+static SE_SYSCALL_TABLE syscall_table = {
+	.SysMemoryAlloc = sys_alloc,
+	.SysMemoryReAlloc = sys_realloc,
+	.SysMemoryFree = sys_free,
+	.SysGetCurrentCpuId = sys_cpuid,
+	.SysNewLock = sys_newlock,
+	.SysLock = sys_lock,
+	.SysUnlock = sys_lock,
+	.SysFreeLock = sys_lock,
+	.SysGetTickCount = sys_tick,
+	.SysLog = sys_log,
+};
+
+static void
+report (char *name, unsigned long long n, unsigned long long a,
+	unsigned long long r, unsigned long long f)
+{
+	printf ("%-24s %8llu %10llu %10llu %10llu %8.3f\n", name, n, a, r, f,
+		(double)(a + r) / n);
+}
+
+/* ESP through SeSecVirtualIpRecvCallback() on one end and
+   SeSecEspRecvCallback() on the other, over the Child SA that the
+   loopback IKEv2 exchange set up */
+static void
+bench_esp (void)
+{
+	static UINT sizes[] = { 64, 576, 1400, 1500 };
+	static UCHAR packet[1500];
+	unsigned long long a, r, f, count;
+	struct loopback l;
+	struct peer *from;
+	UINT i, d;
+
+	if (!loopback_connect (&l, "secret", "secret")) {
+		fprintf (stderr, "ESP: no SA\n");
+		exit (1);
+	}
+	for (d = 0; d < 2; d++) {
+		from = d == 0 ? &l.init : &l.resp;
+		count = from->other->vip_count;
+		a = nalloc;
+		r = nrealloc;
+		f = nfree;
+		for (i = 0; i < ESP_PACKETS; i++)
+			from->vip_cb (packet,
+				      sizes[i % (sizeof sizes / sizeof sizes[0])],
+				      from->vip_param);
+		if (from->other->vip_count - count != ESP_PACKETS) {
+			fprintf (stderr, "ESP: packets lost\n");
+			exit (1);
+		}
+		report (d == 0 ? "ESP send+recv (to gw)" :
+			"ESP send+recv (from gw)", ESP_PACKETS, nalloc - a,
+			nrealloc - r, nfree - f);
+	}
+	loopback_free (&l);
+}
+
+/* main mode message 1: the SA proposal and a vendor ID */
+static SE_IKE_PACKET *
+ike_main1 (void)
+{
+	SE_LIST *payload_list, *value_list, *transform_list, *proposal_list;
+	SE_IKE_PACKET_PAYLOAD *transform, *proposal;
+
+	value_list = SeNewList (NULL);
+	SeAdd (value_list, SeIkeNewTransformValue
+	       (SE_IKE_TRANSFORM_VALUE_P1_CRYPTO, SE_IKE_P1_CRYPTO_3DES_CBC));
+	SeAdd (value_list, SeIkeNewTransformValue
+	       (SE_IKE_TRANSFORM_VALUE_P1_HASH, SE_IKE_P1_HASH_SHA1));
+	SeAdd (value_list, SeIkeNewTransformValue
+	       (SE_IKE_TRANSFORM_VALUE_P1_AUTH_METHOD,
+		SE_IKE_P1_AUTH_METHOD_PRESHAREDKEY));
+	SeAdd (value_list, SeIkeNewTransformValue
+	       (SE_IKE_TRANSFORM_VALUE_P1_DH_GROUP,
+		SE_IKE_P1_DH_GROUP_1024_MODP));
+	SeAdd (value_list, SeIkeNewTransformValue
+	       (SE_IKE_TRANSFORM_VALUE_P1_LIFE_TYPE,
+		SE_IKE_P1_LIFE_TYPE_SECONDS));
+	SeAdd (value_list, SeIkeNewTransformValue
+	       (SE_IKE_TRANSFORM_VALUE_P1_LIFE_VALUE, 86400));
+	transform = SeIkeNewTransformPayload (0, SE_IKE_TRANSFORM_ID_P1_KEY_IKE,
+					      value_list);
+	transform_list = SeNewList (NULL);
+	SeAdd (transform_list, transform);
+	proposal = SeIkeNewProposalPayload (0, SE_IKE_PROTOCOL_ID_IKE, NULL, 0,
+					    transform_list);
+	proposal_list = SeNewList (NULL);
+	SeAdd (proposal_list, proposal);
+	payload_list = SeNewList (NULL);
+	SeAdd (payload_list, SeIkeNewSaPayload (proposal_list));
+	SeAdd (payload_list, SeIkeNewDataPayload (SE_IKE_PAYLOAD_VENDOR_ID,
+						  SE_SEC_VENDOR_ID_STR,
+						  SeStrLen
+						  (SE_SEC_VENDOR_ID_STR)));
+	return SeIkeNew (0x1122334455667788ULL, 0, SE_IKE_EXCHANGE_TYPE_MAIN,
+			 false, false, false, 0, payload_list);
+}
+
+/* main mode message 3: the key exchange and a nonce */
+static SE_IKE_PACKET *
+ike_main3 (void)
+{
+	static UCHAR public_key[128], nonce[16];
+	SE_LIST *payload_list;
+
+	payload_list = SeNewList (NULL);
+	SeAdd (payload_list, SeIkeNewDataPayload (SE_IKE_PAYLOAD_KEY_EXCHANGE,
+						  public_key,
+						  sizeof public_key));
+	SeAdd (payload_list, SeIkeNewDataPayload (SE_IKE_PAYLOAD_RAND, nonce,
+						  sizeof nonce));
+	return SeIkeNew (0x1122334455667788ULL, 0x8877665544332211ULL,
+			 SE_IKE_EXCHANGE_TYPE_MAIN, false, false, false, 0,
+			 payload_list);
+}
+
+/* build a message and parse it again, as the two peers do */
+static void
+ike_round (SE_IKE_PACKET *(*make) (void))
+{
+	SE_IKE_PACKET *packet, *parsed;
+	SE_BUF *buf;
+
+	packet = make ();
+	buf = SeIkeBuild (packet, NULL);
+	parsed = SeIkeParse (buf->Buf, buf->Size, NULL);
+	if (parsed == NULL) {
+		fprintf (stderr, "IKE message does not parse\n");
+		exit (1);
+	}
+	SeIkeFree (parsed);
+	SeFreeBuf (buf);
+	SeIkeFree (packet);
+}
+
+static void
+bench_ike (void)
+{
+	unsigned long long a, r, f;
+	SE_MEMORY_POOL *pool;
+	UINT i;
+
+	a = nalloc;
+	r = nrealloc;
+	f = nfree;
+	ike_round (ike_main1);
+	ike_round (ike_main3);
+	report ("IKE main 1+3 (first)", 1, nalloc - a, nrealloc - r,
+		nfree - f);
+	a = nalloc;
+	r = nrealloc;
+	f = nfree;
+	for (i = 0; i < IKE_ROUNDS; i++) {
+		ike_round (ike_main1);
+		ike_round (ike_main3);
+	}
+	report ("IKE main 1+3 (pool)", IKE_ROUNDS, nalloc - a, nrealloc - r,
+		nfree - f);
+	/* the same without the SE_BUF/SE_LIST pool */
+	pool = rt->MemoryPool;
+	rt->MemoryPool = NULL;
+	a = nalloc;
+	r = nrealloc;
+	f = nfree;
+	for (i = 0; i < IKE_ROUNDS; i++) {
+		ike_round (ike_main1);
+		ike_round (ike_main3);
+	}
+	report ("IKE main 1+3 (no pool)", IKE_ROUNDS, nalloc - a,
+		nrealloc - r, nfree - f);
+	rt->MemoryPool = pool;
+}
+
+int
+main (int argc, char **argv)
+{
+	if (argc > 1 && strcmp (argv[1], "-v") == 0)
+		verbose = true;
+	VPN_IPsec_Init (&syscall_table, false);
+	if (test_ike2 ())
+		return 1;
+	printf ("%-24s %8s %10s %10s %10s %8s\n", "benchmark", "rounds",
+		"alloc", "realloc", "free", "heap/rnd");
+	bench_esp ();
+	bench_ike ();
+	VPN_IPsec_Free ();
+	return 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2007, 2008 University of Tsukuba
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the University of Tsukuba nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _SEBENCH_H
+#define _SEBENCH_H
+
+#define SE_INTERNAL
+#include <Se/Se.h>
+
+/* one end of the in-process link.  the SE_SEC callbacks are
+   recorded here when SeSecInit() registers them. */
+struct peer {
+	SE_SEC *s;
+	SE_IKE_IP_ADDR addr;
+	struct peer *other;
+	SE_SEC_TIMER_CALLBACK *timer_cb;
+	void *timer_param;
+	SE_SEC_UDP_RECV_CALLBACK *udp_cb;
+	void *udp_param;
+	SE_SEC_ESP_RECV_CALLBACK *esp_cb;
+	void *esp_param;
+	SE_SEC_VIRTUAL_IP_RECV_CALLBACK *vip_cb;
+	void *vip_param;
+	/* the last packet handed to the virtual IP side */
+	UCHAR vip_data[2048];
+	UINT vip_size;
+	unsigned long long vip_count;
+};
+
+/* an SeSec initiator connected to the test responder */
+struct loopback {
+	struct peer init, resp;
+	SE_IKE_SA *resp_sa;
+	UINT resp_next_msg_id;
+	bool resp_auth_failed;
+};
+
+bool loopback_connect (struct loopback *l, char *init_password,
+		       char *resp_password);
+void loopback_free (struct loopback *l);
+void loopback_advance (struct loopback *l, UINT64 ms);
+int test_ike2 (void);
+
+#endif
@@ -0,0 +1,467 @@
+/*
+ * Copyright (c) 2007, 2008 University of Tsukuba
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the University of Tsukuba nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* SeCrypto and SeVpn entry points for the host build of the Se
+   library.  SeCrypto.c needs the OpenSSL of the VMM, so the
+   primitives are replaced here by small keyed ones that two peers
+   can still disagree on: SHA-1 is real, DES is a keyed XOR in CBC
+   mode and DH works modulo a 64-bit prime.  they are not secure and
+   are only good for exercising the protocol code. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#define SE_INTERNAL
+#include <Se/Se.h>
+
+#define DH_PRIME	0xFFFFFFFFFFFFFFC5ULL	/* 2^64 - 59 */
+#define DH_G		2
+
+static UINT64 rand_state = 0x9E3779B97F4A7C15ULL;
+
+void
+SeInitCrypto (bool init_openssl)
+{
+}
+
+void
+SeFreeCrypto ()
+{
+}
+
+/* xorshift64*, deterministic so that runs are reproducible */
+void
+SeRand (void *buf, UINT size)
+{
+	UCHAR *p = buf;
+	UINT64 r = 0;
+	UINT i;
+
+	for (i = 0; i < size; i++) {
+		if (i % 8 == 0) {
+			rand_state ^= rand_state >> 12;
+			rand_state ^= rand_state << 25;
+			rand_state ^= rand_state >> 27;
+			r = rand_state * 0x2545F4914F6CDD1DULL;
+		}
+		p[i] = (UCHAR)(r >> (i % 8 * 8));
+	}
+}
+
+UINT64
+SeRand64 ()
+{
+	UINT64 ret;
+
+	SeRand (&ret, sizeof ret);
+	return ret;
+}
+
+UINT
+SeRand32 ()
+{
+	UINT ret;
+
+	SeRand (&ret, sizeof ret);
+	return ret;
+}
+
+static UINT
+rol32 (UINT x, int n)
+{
+	return (x << n) | (x >> (32 - n));
+}
+
+static void
+sha1_block (UINT *h, UCHAR *p)
+{
+	UINT w[80], a, b, c, d, e, f, k, t;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = (UINT)p[i * 4] << 24 | (UINT)p[i * 4 + 1] << 16 |
+			(UINT)p[i * 4 + 2] << 8 | p[i * 4 + 3];
+	for (; i < 80; i++)
+		w[i] = rol32 (w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+	a = h[0];
+	b = h[1];
+	c = h[2];
+	d = h[3];
+	e = h[4];
+	for (i = 0; i < 80; i++) {
+		if (i < 20) {
+			f = (b & c) | (~b & d);
+			k = 0x5A827999;
+		} else if (i < 40) {
+			f = b ^ c ^ d;
+			k = 0x6ED9EBA1;
+		} else if (i < 60) {
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8F1BBCDC;
+		} else {
+			f = b ^ c ^ d;
+			k = 0xCA62C1D6;
+		}
+		t = rol32 (a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = rol32 (b, 30);
+		b = a;
+		a = t;
+	}
+	h[0] += a;
+	h[1] += b;
+	h[2] += c;
+	h[3] += d;
+	h[4] += e;
+}
+
+void
+SeSha1 (void *dst, void *src, UINT size)
+{
+	UINT h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476,
+		      0xC3D2E1F0 };
+	UCHAR block[SE_SHA1_BLOCK_SIZE], *s = src, *d = dst;
+	UINT64 bits = (UINT64)size * 8;
+	UINT i, n;
+
+	for (i = 0; i + SE_SHA1_BLOCK_SIZE <= size; i += SE_SHA1_BLOCK_SIZE)
+		sha1_block (h, s + i);
+	n = size - i;
+	memset (block, 0, sizeof block);
+	memcpy (block, s + i, n);
+	block[n] = 0x80;
+	if (n >= SE_SHA1_BLOCK_SIZE - 8) {
+		sha1_block (h, block);
+		memset (block, 0, sizeof block);
+	}
+	for (i = 0; i < 8; i++)
+		block[SE_SHA1_BLOCK_SIZE - 1 - i] = (UCHAR)(bits >> (i * 8));
+	sha1_block (h, block);
+	for (i = 0; i < 5; i++) {
+		d[i * 4] = h[i] >> 24;
+		d[i * 4 + 1] = h[i] >> 16;
+		d[i * 4 + 2] = h[i] >> 8;
+		d[i * 4 + 3] = h[i];
+	}
+}
+
+/* the same construction as SeMacSha1() in SeCrypto.c */
+void
+SeMacSha1 (void *dst, void *key, UINT key_size, void *data, UINT data_size)
+{
+	UCHAR key_plus[SE_SHA1_BLOCK_SIZE], inner[SE_SHA1_HASH_SIZE];
+	UCHAR *buf;
+	UINT i;
+
+	memset (key_plus, 0, sizeof key_plus);
+	if (key_size <= SE_SHA1_BLOCK_SIZE)
+		memcpy (key_plus, key, key_size);
+	else
+		SeSha1 (key_plus, key, key_size);
+	buf = malloc (SE_SHA1_BLOCK_SIZE +
+		      (data_size > sizeof inner ? data_size : sizeof inner));
+	for (i = 0; i < SE_SHA1_BLOCK_SIZE; i++)
+		buf[i] = key_plus[i] ^ 0x36;
+	memcpy (buf + SE_SHA1_BLOCK_SIZE, data, data_size);
+	SeSha1 (inner, buf, SE_SHA1_BLOCK_SIZE + data_size);
+	for (i = 0; i < SE_SHA1_BLOCK_SIZE; i++)
+		buf[i] = key_plus[i] ^ 0x5c;
+	memcpy (buf + SE_SHA1_BLOCK_SIZE, inner, sizeof inner);
+	SeSha1 (dst, buf, SE_SHA1_BLOCK_SIZE + sizeof inner);
+	free (buf);
+}
+
+void
+SeMacSha196 (void *dst, void *key, void *data, UINT data_size)
+{
+	UCHAR tmp[SE_HMAC_SHA1_SIZE];
+
+	SeMacSha1 (tmp, key, SE_HMAC_SHA1_96_KEY_SIZE, data, data_size);
+	memcpy (dst, tmp, SE_HMAC_SHA1_96_HASH_SIZE);
+}
+
+static SE_DES_KEY_VALUE *
+des_new_key_value (void *value)
+{
+	SE_DES_KEY_VALUE *v;
+
+	v = SeZeroMalloc (sizeof *v);
+	memcpy (v->KeyValue, value, SE_DES_KEY_SIZE);
+	return v;
+}
+
+SE_DES_KEY *
+SeDes3NewKey (void *k1, void *k2, void *k3)
+{
+	SE_DES_KEY *k;
+
+	k = SeZeroMalloc (sizeof *k);
+	k->k1 = des_new_key_value (k1);
+	k->k2 = des_new_key_value (k2);
+	k->k3 = des_new_key_value (k3);
+	return k;
+}
+
+SE_DES_KEY *
+SeDesNewKey (void *k1)
+{
+	return SeDes3NewKey (k1, k1, k1);
+}
+
+void
+SeDes3FreeKey (SE_DES_KEY *k)
+{
+	if (k == NULL)
+		return;
+	SeFree (k->k1);
+	SeFree (k->k2);
+	SeFree (k->k3);
+	SeFree (k);
+}
+
+/* c[i] = p[i] ^ c[i - 1] ^ k; the IV is not updated, as in
+   SeCrypto.c */
+void
+SeDes3Encrypt (void *dest, void *src, UINT size, SE_DES_KEY *key,
+	       void *ivec)
+{
+	UCHAR *d = dest, *s = src, prev[SE_DES_BLOCK_SIZE];
+	UINT i;
+
+	memcpy (prev, ivec, sizeof prev);
+	for (i = 0; i < size; i++) {
+		d[i] = s[i] ^ prev[i % SE_DES_BLOCK_SIZE] ^
+			key->k1->KeyValue[i % SE_DES_KEY_SIZE] ^
+			key->k2->KeyValue[i % SE_DES_KEY_SIZE] ^
+			key->k3->KeyValue[i % SE_DES_KEY_SIZE];
+		prev[i % SE_DES_BLOCK_SIZE] = d[i];
+	}
+}
+
+void
+SeDes3Decrypt (void *dest, void *src, UINT size, SE_DES_KEY *key,
+	       void *ivec)
+{
+	UCHAR *d = dest, *s = src, prev[SE_DES_BLOCK_SIZE], c;
+	UINT i;
+
+	memcpy (prev, ivec, sizeof prev);
+	for (i = 0; i < size; i++) {
+		c = s[i];
+		d[i] = c ^ prev[i % SE_DES_BLOCK_SIZE] ^
+			key->k1->KeyValue[i % SE_DES_KEY_SIZE] ^
+			key->k2->KeyValue[i % SE_DES_KEY_SIZE] ^
+			key->k3->KeyValue[i % SE_DES_KEY_SIZE];
+		prev[i % SE_DES_BLOCK_SIZE] = c;
+	}
+}
+
+static UINT64
+dh_pow (UINT64 b, UINT64 e)
+{
+	unsigned __int128 r = 1, x = b % DH_PRIME;
+
+	while (e) {
+		if (e & 1)
+			r = r * x % DH_PRIME;
+		x = x * x % DH_PRIME;
+		e >>= 1;
+	}
+	return (UINT64)r;
+}
+
+/* a value is stored big-endian in the last 8 bytes of a group 2
+   sized buffer */
+static void
+dh_put (UCHAR *p, UINT64 v)
+{
+	int i;
+
+	memset (p, 0, SE_DH_KEY_SIZE);
+	for (i = 0; i < 8; i++)
+		p[SE_DH_KEY_SIZE - 1 - i] = (UCHAR)(v >> (i * 8));
+}
+
+static UINT64
+dh_get (UCHAR *p)
+{
+	UINT64 v = 0;
+	int i;
+
+	for (i = SE_DH_KEY_SIZE - 8; i < SE_DH_KEY_SIZE; i++)
+		v = v << 8 | p[i];
+	return v;
+}
+
+SE_DH *
+SeDhNewGroup2 ()
+{
+	UCHAR tmp[SE_DH_KEY_SIZE];
+	UINT64 x;
+	SE_DH *dh;
+
+	dh = SeZeroMalloc (sizeof *dh);
+	x = SeRand64 () % (DH_PRIME - 2) + 1;
+	dh_put (tmp, x);
+	dh->MyPrivateKey = SeMemToBuf (tmp, sizeof tmp);
+	dh_put (tmp, dh_pow (DH_G, x));
+	dh->MyPublicKey = SeMemToBuf (tmp, sizeof tmp);
+	dh->Size = SE_DH_KEY_SIZE;
+	return dh;
+}
+
+bool
+SeDhCompute (SE_DH *dh, void *dst_priv_key, void *src_pub_key,
+	     UINT key_size)
+{
+	UINT64 y;
+
+	if (dh == NULL || dst_priv_key == NULL || src_pub_key == NULL ||
+	    key_size != dh->Size)
+		return false;
+	y = dh_get (src_pub_key);
+	if (y <= 1 || y >= DH_PRIME)
+		return false;
+	dh_put (dst_priv_key, dh_pow (y, dh_get (dh->MyPrivateKey->Buf)));
+	return true;
+}
+
+void
+SeDhFree (SE_DH *dh)
+{
+	if (dh == NULL)
+		return;
+	SeFreeBuf (dh->MyPrivateKey);
+	SeFreeBuf (dh->MyPublicKey);
+	SeFreeBuf (dh->YourPublicKey);
+	SeFree (dh);
+}
+
+/* certificate authentication is not exercised on the host */
+SE_CERT *
+SeBufToCert (SE_BUF *b, bool text)
+{
+	return NULL;
+}
+
+SE_BUF *
+SeCertToBuf (SE_CERT *x, bool text)
+{
+	return NULL;
+}
+
+SE_CERT *
+SeLoadCert (char *filename)
+{
+	return NULL;
+}
+
+void
+SeFreeCert (SE_CERT *x)
+{
+}
+
+SE_KEY *
+SeGetKeyFromCert (SE_CERT *x)
+{
+	return NULL;
+}
+
+void
+SeFreeKey (SE_KEY *k)
+{
+}
+
+SE_BUF *
+SeGetCertSubjectName (SE_CERT *x)
+{
+	return NULL;
+}
+
+SE_BUF *
+SeGetCertIssuerName (SE_CERT *x)
+{
+	return NULL;
+}
+
+bool
+SeIsCertSignedByCert (SE_CERT *target_cert, SE_CERT *issuer_cert)
+{
+	return false;
+}
+
+bool
+SeRsaVerifyWithPadding (void *data, UINT data_size, void *sign,
+			UINT sign_size, SE_KEY *k)
+{
+	return false;
+}
+
+/* SeSec is driven directly; the VPN module is not built */
+SE_VPN *
+SeVpnInit (SE_HANDLE physical_nic_handle, SE_HANDLE virtual_nic_handle,
+	   char *config_name)
+{
+	return NULL;
+}
+
+void
+SeVpnFree (SE_VPN *v)
+{
+}
+
+void
+SeVpnSendEtherPacket (SE_VPN *v, SE_ETH *e, void *packet, UINT packet_size)
+{
+}
+
+UINT64
+SeVpnTick (SE_VPN *v)
+{
+	return 0;
+}
+
+bool
+SeVpnDoInterval (SE_VPN *v, UINT64 *var, UINT interval)
+{
+	return false;
+}
+
+unsigned long long
+chelp_div_64_32_64 (unsigned long long a, unsigned int b)
+{
+	return a / b;
+}
+
+unsigned int
+chelp_mod_64_32_32 (unsigned long long a, unsigned int b)
+{
+	return a % b;
+}
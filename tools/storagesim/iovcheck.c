@@ -0,0 +1,435 @@
+/*
+ * Copyright (c) 2007, 2008 University of Tsukuba
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the University of Tsukuba nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* userspace property test of storage_handle_sectors_iov() in
+   storage/lib/storage.c.  random requests over a device with
+   encrypted, plain and unconfigured ranges are run through the
+   scatter-gather path with random segment lists on both sides, and
+   the result must match storage_handle_sectors() on contiguous
+   buffers.  the segments are split at sector multiples, at page
+   boundaries with a dword-aligned first offset as in NVMe PRP
+   lists, and at arbitrary byte counts, with zero-length segments
+   mixed in, so sectors straddle segment boundaries.  each segment
+   is a separate allocation with guard bytes around it.  the bytes
+   beyond the request and the source segments must not change, and
+   a list shorter than the request must fail without touching the
+   destination. */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_SEGS	256
+#define GUARD		16
+#define GUARD_BYTE	0xA5
+#define PAGE		4096
+#define MAX_LBA		1100
+#define MAX_BYTES	(64 * 512)
+#define DEFAULT_STEPS	50000
+
+/* the same layout as struct storage_iovec */
+struct iov {
+	void *base;
+	unsigned int len;
+};
+
+struct list {
+	struct iov iov[MAX_SEGS];
+	int cnt;
+	unsigned long long total;
+};
+
+void sim_reset (void);
+void sim_boot_ranges (int n, unsigned long long *low,
+		      unsigned long long *high, int *plain);
+int sim_sectors (int write, unsigned long long lba, int count,
+		 int sector_size, unsigned char *src, unsigned char *dst);
+int sim_sectors_iov (int write, unsigned long long lba, int count,
+		     int sector_size, void *src, int srccnt, void *dst,
+		     int dstcnt);
+
+static unsigned long long range_low[] = { 64, 128, 256, 1024 };
+static unsigned long long range_high[] = { 127, 191, 1023, 1031 };
+static int range_plain[] = { 0, 1, 0, 0 };
+static unsigned long long rnd_state = 0x2545F4914F6CDD1DULL;
+
+static struct {
+	unsigned long long steps, straddle, inplace, shortlist, zero;
+	unsigned long long segs;
+} stat;
+
+static void
+fail (char *msg)
+{
+	fprintf (stderr, "iovcheck: %s\n", msg);
+	exit (1);
+}
+
+static unsigned long long
+rnd (void)
+{
+	rnd_state ^= rnd_state >> 12;
+	rnd_state ^= rnd_state << 25;
+	rnd_state ^= rnd_state >> 27;
+	return rnd_state * 0x2545F4914F6CDD1DULL;
+}
+
+void *
+sim_alloc (unsigned int len)
+{
+	void *p;
+
+	p = malloc (len);
+	if (!p)
+		fail ("out of memory");
+	return p;
+}
+
+void
+sim_free (void *p)
+{
+	free (p);
+}
+
+int
+sim_printf (const char *format, ...)
+{
+	return 0;
+}
+
+void
+sim_panic (char *format, ...)
+{
+	va_list ap;
+
+	va_start (ap, format);
+	fprintf (stderr, "panic: ");
+	vfprintf (stderr, format, ap);
+	fprintf (stderr, "\n");
+	va_end (ap);
+	exit (1);
+}
+
+int
+msgregister (char *name, void *func)
+{
+	return 1;
+}
+
+/* no re-encryption is configured, so the engine does no I/O */
+
+int
+storage_io_init (void)
+{
+	return 1;
+}
+
+int
+storage_io_get_num_devices (int id)
+{
+	return 1;
+}
+
+int
+storage_io_aread (int id, int devno, void *buf, int len, long long offset,
+		  void (*callback) (void *data, int len), void *data)
+{
+	fail ("storage_io_aread called");
+	return -1;
+}
+
+int
+storage_io_awrite (int id, int devno, void *buf, int len, long long offset,
+		   void (*callback) (void *data, int len), void *data)
+{
+	fail ("storage_io_awrite called");
+	return -1;
+}
+
+int
+storage_io_aflush (int id, int devno,
+		   void (*callback) (void *data, int len), void *data)
+{
+	fail ("storage_io_aflush called");
+	return -1;
+}
+
+/* --- segment lists --- */
+
+static unsigned int
+seg_len (int policy, int sector_size, int first)
+{
+	switch (policy) {
+	case 0:
+		return sector_size * (1 + rnd () % 4);
+	case 1:
+		return 1 + rnd () % (sector_size * 2);
+	case 2:
+		return first ? PAGE - 4 * (rnd () % (PAGE / 4)) : PAGE;
+	default:
+		if (!(rnd () % 8))
+			return 1 + rnd () % 16;
+		return seg_len (rnd () % 3, sector_size, first);
+	}
+}
+
+static void
+seg_add (struct list *l, unsigned int len)
+{
+	unsigned char *p;
+
+	if (l->cnt >= MAX_SEGS)
+		fail ("too many segments");
+	p = sim_alloc (len + 2 * GUARD);
+	memset (p, GUARD_BYTE, GUARD);
+	memset (p + GUARD + len, GUARD_BYTE, GUARD);
+	l->iov[l->cnt].base = p + GUARD;
+	l->iov[l->cnt].len = len;
+	l->cnt++;
+	l->total += len;
+}
+
+/* a list covering at least size bytes, or less than size if short
+   is set */
+static void
+list_make (struct list *l, unsigned long long size, int sector_size,
+	   int shortlist)
+{
+	int policy = rnd () % 4;
+	unsigned int len;
+
+	l->cnt = 0;
+	l->total = 0;
+	while (l->total < size) {
+		if (!(rnd () % 8))
+			seg_add (l, 0);
+		len = seg_len (policy, sector_size, !l->cnt);
+		if (l->cnt >= MAX_SEGS - 4 || len > size - l->total)
+			len = size - l->total;
+		seg_add (l, len);
+	}
+	if (shortlist) {
+		while (l->cnt > 0 && !l->iov[l->cnt - 1].len)
+			l->cnt--;
+		if (!l->cnt)
+			return;
+		len = 1 + rnd () % l->iov[l->cnt - 1].len;
+		l->iov[l->cnt - 1].len -= len;
+		l->total -= len;
+		memset ((unsigned char *)l->iov[l->cnt - 1].base +
+			l->iov[l->cnt - 1].len, GUARD_BYTE, GUARD);
+	} else if (rnd () % 2) {
+		/* slack beyond the request */
+		if (!(rnd () % 4))
+			seg_add (l, 0);
+		seg_add (l, 1 + rnd () % sector_size);
+	}
+	stat.segs += l->cnt;
+}
+
+static void
+list_free (struct list *l)
+{
+	int i;
+
+	for (i = 0; i < l->cnt; i++)
+		sim_free ((unsigned char *)l->iov[i].base - GUARD);
+}
+
+static void
+list_check_guards (struct list *l)
+{
+	unsigned char *p;
+	int i, j;
+
+	for (i = 0; i < l->cnt; i++) {
+		p = l->iov[i].base;
+		for (j = 0; j < GUARD; j++)
+			if (p[-1 - j] != GUARD_BYTE ||
+			    p[l->iov[i].len + j] != GUARD_BYTE)
+				fail ("write outside of a segment");
+	}
+}
+
+static void
+list_scatter (struct list *l, unsigned char *buf)
+{
+	int i;
+
+	for (i = 0; i < l->cnt; i++) {
+		memcpy (l->iov[i].base, buf, l->iov[i].len);
+		buf += l->iov[i].len;
+	}
+}
+
+static void
+list_gather (struct list *l, unsigned char *buf)
+{
+	int i;
+
+	for (i = 0; i < l->cnt; i++) {
+		memcpy (buf, l->iov[i].base, l->iov[i].len);
+		buf += l->iov[i].len;
+	}
+}
+
+/* a segment boundary inside the request that is not a multiple of
+   the sector size */
+static int
+list_straddles (struct list *l, unsigned long long size, int sector_size)
+{
+	unsigned long long off = 0;
+	int i;
+
+	for (i = 0; i < l->cnt && off < size; i++) {
+		if (off % sector_size)
+			return 1;
+		off += l->iov[i].len;
+	}
+	return 0;
+}
+
+static void
+fill (unsigned char *buf, unsigned long long len)
+{
+	while (len-- > 0)
+		*buf++ = rnd ();
+}
+
+/* --- the test --- */
+
+static void
+step (void)
+{
+	static unsigned char srcbuf[MAX_BYTES + PAGE * 2];
+	static unsigned char dstbuf[MAX_BYTES + PAGE * 2];
+	static unsigned char expect[MAX_BYTES], inplace[MAX_BYTES];
+	static unsigned char got[MAX_BYTES + PAGE * 2];
+	static struct list src, dst;
+	struct list *out;
+	unsigned long long lba, size;
+	int write, count, sector_size, shortlist, same, ret;
+
+	sector_size = rnd () % 4 ? 512 : 4096;
+	count = rnd () % 32 ? 1 + rnd () % (MAX_BYTES / sector_size) : 0;
+	size = (unsigned long long)count * sector_size;
+	lba = rnd () % MAX_LBA;
+	write = rnd () % 2;
+	shortlist = count && !(rnd () % 16) ? 1 + rnd () % 2 : 0;
+	same = !shortlist && !(rnd () % 4);
+
+	fill (srcbuf, sizeof srcbuf);
+	if (sim_sectors (write, lba, count, sector_size, srcbuf, expect))
+		fail ("storage_handle_sectors failed");
+	memcpy (inplace, srcbuf, size);
+	if (sim_sectors (write, lba, count, sector_size, inplace, inplace))
+		fail ("storage_handle_sectors failed in place");
+	if (memcmp (inplace, expect, size))
+		fail ("in place differs from separate buffers");
+
+	list_make (&src, size, sector_size, shortlist == 1);
+	list_scatter (&src, srcbuf);
+	if (same) {
+		out = &src;
+	} else {
+		list_make (&dst, size, sector_size, shortlist == 2);
+		fill (dstbuf, dst.total);
+		list_scatter (&dst, dstbuf);
+		out = &dst;
+	}
+	stat.steps++;
+	stat.inplace += same;
+	stat.shortlist += !!shortlist;
+	stat.zero += !count;
+	stat.straddle += list_straddles (&src, size, sector_size) ||
+		list_straddles (out, size, sector_size);
+
+	ret = sim_sectors_iov (write, lba, count, sector_size, src.iov,
+			       src.cnt, out->iov, out->cnt);
+	if (ret != (shortlist ? -1 : 0))
+		fail (shortlist ? "short list accepted" : "failed");
+	list_check_guards (&src);
+	list_gather (&src, got);
+	if (same) {
+		if (memcmp (got, expect, size) ||
+		    memcmp (got + size, srcbuf + size, src.total - size))
+			fail ("in place result differs");
+	} else {
+		if (memcmp (got, srcbuf, src.total))
+			fail ("source modified");
+		list_check_guards (&dst);
+		list_gather (&dst, got);
+		if (shortlist) {
+			if (memcmp (got, dstbuf, dst.total))
+				fail ("destination modified by a short list");
+		} else if (memcmp (got, expect, size) ||
+			   memcmp (got + size, dstbuf + size,
+				   dst.total - size)) {
+			fail ("result differs from the contiguous path");
+		}
+		list_free (&dst);
+	}
+	list_free (&src);
+}
+
+int
+main (int argc, char **argv)
+{
+	int c, steps;
+
+	steps = DEFAULT_STEPS;
+	while ((c = getopt (argc, argv, "n:s:")) != -1) {
+		switch (c) {
+		case 'n':
+			steps = atoi (optarg);
+			break;
+		case 's':
+			rnd_state = strtoull (optarg, NULL, 0) | 1;
+			break;
+		default:
+			fprintf (stderr, "usage: iovcheck [-n steps]"
+				 " [-s seed]\n");
+			return 1;
+		}
+	}
+	sim_reset ();
+	sim_boot_ranges (sizeof range_low / sizeof range_low[0], range_low,
+			 range_high, range_plain);
+	while (steps-- > 0)
+		step ();
+	printf ("%10s %10s %10s %10s %10s %10s\n", "steps", "segments",
+		"straddle", "in-place", "short", "empty");
+	printf ("%10llu %10llu %10llu %10llu %10llu %10llu\n", stat.steps,
+		stat.segs, stat.straddle, stat.inplace, stat.shortlist,
+		stat.zero);
+	printf ("iovcheck: ok\n");
+	return 0;
+}
@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) 2007, 2008 University of Tsukuba
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the University of Tsukuba nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* storage/lib built for the host.  the VMM headers are used as they
+   are; alloc(), free(), printf() and panic() are renamed on the
+   command line and supplied by storagesim.c together with the
+   storage_io functions.  AES-XTS needs OpenSSL, so a keyed XOR
+   cipher is registered in its place. */
+
+#include "../../storage/lib/storage.c"
+#include "../../storage/lib/crypto/crypto.c"
+#include "../../storage/lib/crypto/none.c"
+
+#define SIM_KEY_NEW	0
+#define SIM_KEY_OLD	1
+#define SIM_KEY(index, i) ((index) == SIM_KEY_NEW ? (i) : 0xA0 + (i))
+
+static struct config_data_storage simcfg;
+static struct storage_device *simdev;
+
+static u64
+sim_mix (u64 x)
+{
+	x += 0x9E3779B97F4A7C15ULL;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
+
+static void
+sim_crypt (void *dst, void *src, void *keyctx, lba_t lba, int sector_size)
+{
+	u64 *p = dst, *q = src, seed = *(u64 *)keyctx;
+	int i;
+
+	for (i = 0; i < sector_size / 8; i++)
+		p[i] = q[i] ^ sim_mix (seed ^ sim_mix (lba) ^ i);
+}
+
+static void *
+sim_setkey (const u8 *key, int bits)
+{
+	u64 *keyctx;
+	int i;
+
+	keyctx = alloc (sizeof *keyctx);
+	*keyctx = 0;
+	for (i = 0; i < bits / 8; i++)
+		*keyctx = sim_mix (*keyctx ^ key[i]);
+	return keyctx;
+}
+
+static struct crypto sim_crypto = {
+	.name =		"sim",
+	.block_size =	16,
+	.keyctx_size =	sizeof (u64),
+	.encrypt =	sim_crypt,
+	.decrypt =	sim_crypt,
+	.setkey =	sim_setkey,
+};
+
+void
+aes_xts_init (void)
+{
+	crypto_register (&sim_crypto);
+}
+
+/* forget the state of the previous boot.  its memory is released by
+   the caller. */
+void
+sim_reset (void)
+{
+	memset (rekey_conf, 0, sizeof rekey_conf);
+	rekey_io_id = 0;
+	rekey_now = 0;
+	crypto_list = NULL;
+	simdev = NULL;
+}
+
+/* one key entry for LBA low-high, moved from the old key (or from
+   plaintext) to the new key with the metadata at lba_meta */
+void
+sim_boot (u64 low, u64 high, u64 lba_meta, int plain)
+{
+	struct guid any = STORAGE_GUID_ANY;
+	struct storage_keys_conf *k = &simcfg.keys_conf[0];
+	int i;
+
+	memset (&simcfg, 0, sizeof simcfg);
+	for (i = 0; i < 32; i++) {
+		simcfg.keys[SIM_KEY_NEW][i] = SIM_KEY (SIM_KEY_NEW, i);
+		simcfg.keys[SIM_KEY_OLD][i] = SIM_KEY (SIM_KEY_OLD, i);
+	}
+	k->guid = any;
+	k->type = STORAGE_TYPE_ANY;
+	k->host_id = STORAGE_HOST_ID_ANY;
+	k->device_id = STORAGE_DEVICE_ID_ANY;
+	k->lba_low = low;
+	k->lba_high = high;
+	strcpy (k->crypto_name, "sim");
+	k->keyindex = SIM_KEY_NEW;
+	k->keybits = 256;
+	strcpy (k->old_crypto_name, plain ? "none" : "sim");
+	k->old_keyindex = SIM_KEY_OLD;
+	k->old_keybits = 256;
+	k->rekey_devno = 0;
+	k->lba_rekey = lba_meta;
+	storage_init (&simcfg);
+	simdev = storage_new (STORAGE_TYPE_AHCI, 0, 0, NULL, NULL);
+}
+
+int
+sim_guest (int write, u64 lba, int count, u8 *src, u8 *dst)
+{
+	struct storage_access access;
+
+	access.lba = lba;
+	access.count = count;
+	access.sector_size = REKEY_SECTOR_SIZE;
+	access.rw = write ? STORAGE_WRITE : STORAGE_READ;
+	return storage_handle_sectors (simdev, &access, src, dst);
+}
+
+void
+sim_poll (u64 now)
+{
+	storage_rekey_poll (now);
+}
+
+/* encrypt or decrypt one sector with the configured new or old key,
+   the way the disk is expected to hold it */
+void
+sim_cipher (void *buf, u64 lba, int new, int plain)
+{
+	u64 keyctx;
+	int i;
+
+	if (!new && plain)
+		return;
+	for (keyctx = 0, i = 0; i < 32; i++)
+		keyctx = sim_mix (keyctx ^ (u8)SIM_KEY (new ? SIM_KEY_NEW :
+							 SIM_KEY_OLD, i));
+	sim_crypt (buf, buf, &keyctx, lba, REKEY_SECTOR_SIZE);
+}
+
+/* the watermark, or 0 until the metadata has been read */
+u64
+sim_mark (void)
+{
+	struct storage_rekey *rekey = rekey_conf[0];
+
+	return rekey && rekey->loaded ? rekey->mark : 0;
+}
+
+int
+sim_done (void)
+{
+	struct storage_rekey *rekey = rekey_conf[0];
+
+	return rekey && rekey->state == REKEY_DONE;
+}
+
+/* key entries without re-encryption for LBA low[i]-high[i], which
+   must be ascending.  entries with plain set use the none cipher. */
+void
+sim_boot_ranges (int n, u64 *low, u64 *high, int *plain)
+{
+	struct guid any = STORAGE_GUID_ANY;
+	struct storage_keys_conf *k;
+	int i;
+
+	memset (&simcfg, 0, sizeof simcfg);
+	for (i = 0; i < 32; i++) {
+		simcfg.keys[SIM_KEY_NEW][i] = SIM_KEY (SIM_KEY_NEW, i);
+		simcfg.keys[SIM_KEY_OLD][i] = SIM_KEY (SIM_KEY_OLD, i);
+	}
+	for (i = 0; i < n && i < NUM_OF_STORAGE_KEYS_CONF; i++) {
+		k = &simcfg.keys_conf[i];
+		k->guid = any;
+		k->type = STORAGE_TYPE_ANY;
+		k->host_id = STORAGE_HOST_ID_ANY;
+		k->device_id = STORAGE_DEVICE_ID_ANY;
+		k->lba_low = low[i];
+		k->lba_high = high[i];
+		strcpy (k->crypto_name, plain[i] ? "none" : "sim");
+		k->keyindex = i % 2 ? SIM_KEY_OLD : SIM_KEY_NEW;
+		k->keybits = 256;
+	}
+	storage_init (&simcfg);
+	simdev = storage_new (STORAGE_TYPE_AHCI, 0, 0, NULL, NULL);
+}
+
+int
+sim_sectors (int write, u64 lba, int count, int sector_size, u8 *src,
+	     u8 *dst)
+{
+	struct storage_access access;
+
+	access.lba = lba;
+	access.count = count;
+	access.sector_size = sector_size;
+	access.rw = write ? STORAGE_WRITE : STORAGE_READ;
+	return storage_handle_sectors (simdev, &access, src, dst);
+}
+
+/* src and dst are arrays of struct storage_iovec */
+int
+sim_sectors_iov (int write, u64 lba, int count, int sector_size,
+		 void *src, int srccnt, void *dst, int dstcnt)
+{
+	struct storage_access access;
+
+	access.lba = lba;
+	access.count = count;
+	access.sector_size = sector_size;
+	access.rw = write ? STORAGE_WRITE : STORAGE_READ;
+	return storage_handle_sectors_iov (simdev, &access, src, srccnt,
+					   dst, dstcnt);
+}
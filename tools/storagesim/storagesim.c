@@ -0,0 +1,645 @@
+/*
+ * Copyright (c) 2007, 2008 University of Tsukuba
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the University of Tsukuba nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* userspace test of the storage re-encryption engine in
+   storage/lib/storage.c.  a fake host controller keeps the disk in a
+   file and has a volatile write cache.  the guest reads and writes
+   random sectors through storage_handle_sectors() while the engine
+   moves the key range to the new key, and the power is cut at random
+   points: the command in flight may or may not have reached the
+   drive, and any subset of the cached sectors reaches the media.
+   after every boot each sector must read back as the guest last
+   wrote it, and at the end the whole range must be encrypted with
+   the new key.
+
+   guest writes are write-through, as if the guest used FUA or
+   flushed after every write. */
+
+#include <fcntl.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SECTOR		512
+#define DISK_SECTORS	32768
+#define LBA_META	16	/* followed by a 128-sector journal */
+#define LBA_LOW		300
+#define LBA_HIGH	30000
+#define GUEST_LOW	(LBA_LOW - 16)
+#define GUEST_HIGH	(LBA_HIGH + 16)
+#define MAX_GUEST_IO	64
+#define MAX_PENDING	4
+#define DEFAULT_STEPS	50000
+#define CRASH_ODDS	1000	/* one in CRASH_ODDS steps */
+#define TICK_USEC	10000
+
+/* a storage_io command of the engine */
+struct request {
+	int op;			/* 0 read, 1 write, 2 flush */
+	int done;		/* executed on the drive */
+	unsigned char *buf;
+	int len;
+	long long offset;
+	void (*callback) (void *data, int len);
+	void *data;
+};
+
+struct block {
+	struct block *next, *prev;
+	unsigned int len;
+	unsigned int pad;
+};
+
+void sim_reset (void);
+void sim_boot (unsigned long long low, unsigned long long high,
+	       unsigned long long lba_meta, int plain);
+int sim_guest (int write, unsigned long long lba, int count,
+	       unsigned char *src, unsigned char *dst);
+void sim_poll (unsigned long long now);
+void sim_cipher (void *buf, unsigned long long lba, int new, int plain);
+unsigned long long sim_mark (void);
+int sim_done (void);
+
+static struct block blocks = { &blocks, &blocks, 0, 0 };
+static int disk_fd;
+static unsigned char cache[DISK_SECTORS][SECTOR];
+static unsigned char dirty[DISK_SECTORS];
+static unsigned char truth[DISK_SECTORS][SECTOR];
+static struct request pending[MAX_PENDING];
+static int npending;
+static unsigned long long now;
+static unsigned long long rnd_state = 0x2545F4914F6CDD1DULL;
+static int verbose;
+static int plain;
+
+static struct {
+	unsigned long long boots, crashes, guest_writes, guest_reads;
+	unsigned long long refused, reads, writes, flushes, busy_writes;
+} stat;
+
+static void
+fail (char *msg)
+{
+	fprintf (stderr, "storagesim: %s\n", msg);
+	exit (1);
+}
+
+static unsigned long long
+rnd (void)
+{
+	rnd_state ^= rnd_state >> 12;
+	rnd_state ^= rnd_state << 25;
+	rnd_state ^= rnd_state >> 27;
+	return rnd_state * 0x2545F4914F6CDD1DULL;
+}
+
+void *
+sim_alloc (unsigned int len)
+{
+	struct block *b;
+
+	b = malloc (sizeof *b + len);
+	if (!b)
+		fail ("out of memory");
+	b->len = len;
+	b->next = blocks.next;
+	b->prev = &blocks;
+	blocks.next->prev = b;
+	blocks.next = b;
+	return b + 1;
+}
+
+void
+sim_free (void *p)
+{
+	struct block *b;
+
+	b = (struct block *)p - 1;
+	b->prev->next = b->next;
+	b->next->prev = b->prev;
+	free (b);
+}
+
+int
+sim_printf (const char *format, ...)
+{
+	va_list ap;
+	int n;
+
+	if (!verbose)
+		return 0;
+	va_start (ap, format);
+	n = vprintf (format, ap);
+	va_end (ap);
+	return n;
+}
+
+void
+sim_panic (char *format, ...)
+{
+	va_list ap;
+
+	va_start (ap, format);
+	fprintf (stderr, "panic: ");
+	vfprintf (stderr, format, ap);
+	fprintf (stderr, "\n");
+	va_end (ap);
+	exit (1);
+}
+
+int
+msgregister (char *name, void *func)
+{
+	return 1;
+}
+
+/* --- the fake host controller --- */
+
+static void
+media_read (int lba, void *buf)
+{
+	if (pread (disk_fd, buf, SECTOR, (off_t)lba * SECTOR) != SECTOR)
+		fail ("disk file read");
+}
+
+static void
+media_write (int lba, void *buf)
+{
+	if (pwrite (disk_fd, buf, SECTOR, (off_t)lba * SECTOR) != SECTOR)
+		fail ("disk file write");
+}
+
+static void
+disk_read (int lba, void *buf)
+{
+	if (dirty[lba])
+		memcpy (buf, cache[lba], SECTOR);
+	else
+		media_read (lba, buf);
+}
+
+static void
+disk_write (int lba, void *buf, int fua)
+{
+	if (fua) {
+		media_write (lba, buf);
+		dirty[lba] = 0;
+	} else {
+		memcpy (cache[lba], buf, SECTOR);
+		dirty[lba] = 1;
+	}
+}
+
+static void
+disk_flush (void)
+{
+	int i;
+
+	for (i = 0; i < DISK_SECTORS; i++) {
+		if (dirty[i]) {
+			media_write (i, cache[i]);
+			dirty[i] = 0;
+		}
+	}
+}
+
+static void
+execute (struct request *r)
+{
+	int i, lba;
+
+	lba = r->offset / SECTOR;
+	switch (r->op) {
+	case 0:
+		for (i = 0; i < r->len / SECTOR; i++)
+			disk_read (lba + i, r->buf + i * SECTOR);
+		break;
+	case 1:
+		for (i = 0; i < r->len / SECTOR; i++)
+			disk_write (lba + i, r->buf + i * SECTOR, 0);
+		break;
+	case 2:
+		disk_flush ();
+		break;
+	}
+	r->done = 1;
+}
+
+/* the command runs on the drive either now or when it completes */
+static int
+submit (int op, void *buf, int len, long long offset,
+	void (*callback) (void *data, int len), void *data)
+{
+	struct request *r;
+
+	if (npending >= MAX_PENDING)
+		return -1;
+	if (len % SECTOR || offset % SECTOR || offset < 0 ||
+	    offset + len > (long long)DISK_SECTORS * SECTOR)
+		fail ("storage_io command out of the disk");
+	r = &pending[npending++];
+	r->op = op;
+	r->done = 0;
+	r->buf = buf;
+	r->len = len;
+	r->offset = offset;
+	r->callback = callback;
+	r->data = data;
+	if (rnd () & 1)
+		execute (r);
+	return 0;
+}
+
+static void
+complete (void)
+{
+	struct request r;
+
+	if (!npending)
+		return;
+	r = pending[0];
+	memmove (pending, pending + 1, --npending * sizeof *pending);
+	if (!r.done)
+		execute (&r);
+	r.callback (r.data, r.op == 2 ? 0 : r.len);
+}
+
+int
+storage_io_init (void)
+{
+	return 1;
+}
+
+int
+storage_io_get_num_devices (int id)
+{
+	return 1;
+}
+
+int
+storage_io_aread (int id, int devno, void *buf, int len, long long offset,
+		  void (*callback) (void *data, int len), void *data)
+{
+	if (id != 1 || devno != 0)
+		fail ("storage_io_aread: bad device");
+	stat.reads++;
+	return submit (0, buf, len, offset, callback, data);
+}
+
+int
+storage_io_awrite (int id, int devno, void *buf, int len, long long offset,
+		   void (*callback) (void *data, int len), void *data)
+{
+	long long lba;
+
+	if (id != 1 || devno != 0)
+		fail ("storage_io_awrite: bad device");
+	lba = offset / SECTOR;
+	if (lba >= LBA_LOW && lba <= LBA_HIGH)
+		stat.writes++;
+	return submit (1, buf, len, offset, callback, data);
+}
+
+int
+storage_io_aflush (int id, int devno,
+		   void (*callback) (void *data, int len), void *data)
+{
+	if (id != 1 || devno != 0)
+		fail ("storage_io_aflush: bad device");
+	stat.flushes++;
+	return submit (2, NULL, 0, 0, callback, data);
+}
+
+/* --- the guest --- */
+
+static unsigned long long last_guest_io;
+
+/* half of the guest I/O goes to the chunks around the watermark */
+static int
+guest_lba (void)
+{
+	unsigned long long mark;
+	int lba;
+
+	mark = sim_mark ();
+	if (mark && (rnd () & 1))
+		lba = mark - 2 * MAX_GUEST_IO + rnd () % (6 * MAX_GUEST_IO);
+	else
+		lba = GUEST_LOW + rnd () % (GUEST_HIGH - GUEST_LOW);
+	if (lba < GUEST_LOW)
+		lba = GUEST_LOW;
+	if (lba >= GUEST_HIGH)
+		lba = GUEST_HIGH - 1;
+	return lba;
+}
+
+static void
+guest_write (void)
+{
+	static unsigned char buf[2][MAX_GUEST_IO][SECTOR];
+	unsigned long long *p;
+	int i, j, lba, count;
+
+	lba = guest_lba ();
+	count = 1 + rnd () % (rnd () & 1 ? 4 : MAX_GUEST_IO);
+	if (lba + count > GUEST_HIGH)
+		count = GUEST_HIGH - lba;
+	for (i = 0; i < count; i++) {
+		p = (unsigned long long *)buf[0][i];
+		for (j = 0; j < SECTOR / 8; j++)
+			p[j] = rnd ();
+	}
+	stat.guest_writes++;
+	last_guest_io = now;
+	/* a failed write is not issued, like AHCI does */
+	if (sim_guest (1, lba, count, buf[0][0], buf[1][0])) {
+		stat.refused++;
+		return;
+	}
+	for (i = 0; i < count; i++) {
+		disk_write (lba + i, buf[1][i], 1);
+		memcpy (truth[lba + i], buf[0][i], SECTOR);
+	}
+}
+
+static int
+guest_read_at (int lba, int count)
+{
+	static unsigned char buf[2][MAX_GUEST_IO][SECTOR];
+	char msg[64];
+	int i;
+
+	for (i = 0; i < count; i++)
+		disk_read (lba + i, buf[0][i]);
+	if (sim_guest (0, lba, count, buf[0][0], buf[1][0])) {
+		stat.refused++;
+		return -1;
+	}
+	for (i = 0; i < count; i++) {
+		if (memcmp (buf[1][i], truth[lba + i], SECTOR)) {
+			snprintf (msg, sizeof msg, "LBA %d reads back wrong"
+				  " (watermark %llu)", lba + i, sim_mark ());
+			fail (msg);
+		}
+	}
+	return 0;
+}
+
+static void
+guest_read (void)
+{
+	int lba, count;
+
+	lba = guest_lba ();
+	count = 1 + rnd () % MAX_GUEST_IO;
+	if (lba + count > GUEST_HIGH)
+		count = GUEST_HIGH - lba;
+	guest_read_at (lba, count);
+	stat.guest_reads++;
+	last_guest_io = now;
+}
+
+static void
+guest_read_all (void)
+{
+	int lba;
+
+	for (lba = GUEST_LOW; lba < GUEST_HIGH; lba += MAX_GUEST_IO)
+		if (guest_read_at (lba, lba + MAX_GUEST_IO > GUEST_HIGH ?
+				   GUEST_HIGH - lba : MAX_GUEST_IO))
+			fail ("guest read refused after loading");
+}
+
+/* --- power --- */
+
+static void
+power_on (void)
+{
+	while (blocks.next != &blocks)
+		sim_free (blocks.next + 1);
+	sim_reset ();
+	sim_boot (LBA_LOW, LBA_HIGH, LBA_META, plain);
+	stat.boots++;
+}
+
+static void
+power_cut (void)
+{
+	int i;
+
+	/* the command in flight may have reached the drive */
+	if (npending && !pending[0].done && (rnd () & 1))
+		execute (&pending[0]);
+	npending = 0;
+	for (i = 0; i < DISK_SECTORS; i++) {
+		if (dirty[i] && (rnd () & 1))
+			media_write (i, cache[i]);
+		dirty[i] = 0;
+	}
+	stat.crashes++;
+}
+
+/* poll until the metadata has been read and the interrupted chunk,
+   if any, is recovered */
+static void
+wait_loaded (void)
+{
+	int i;
+
+	for (i = 0; i < 1000 && !sim_mark (); i++) {
+		now += TICK_USEC;
+		sim_poll (now);
+		while (npending)
+			complete ();
+	}
+	if (!sim_mark ())
+		fail ("the metadata is never loaded");
+}
+
+static void
+format (void)
+{
+	static unsigned char zero[SECTOR];
+	unsigned char buf[SECTOR];
+	unsigned long long *p;
+	int i, j;
+
+	for (i = 0; i < DISK_SECTORS; i++) {
+		p = (unsigned long long *)truth[i];
+		for (j = 0; j < SECTOR / 8; j++)
+			p[j] = rnd ();
+		memcpy (buf, truth[i], SECTOR);
+		if (i >= LBA_LOW && i <= LBA_HIGH)
+			sim_cipher (buf, i, 0, plain);
+		media_write (i, i == LBA_META ? zero : buf);
+		dirty[i] = 0;
+	}
+}
+
+static void
+verify_media (void)
+{
+	unsigned char buf[SECTOR];
+	char msg[64];
+	int i;
+
+	disk_flush ();
+	for (i = GUEST_LOW; i < GUEST_HIGH; i++) {
+		media_read (i, buf);
+		if (i >= LBA_LOW && i <= LBA_HIGH)
+			sim_cipher (buf, i, 1, plain);
+		if (memcmp (buf, truth[i], SECTOR)) {
+			snprintf (msg, sizeof msg, "LBA %d is not under the"
+				  " new key", i);
+			fail (msg);
+		}
+	}
+}
+
+static void
+run (int steps)
+{
+	unsigned long long busy_until;
+	int i, busy;
+
+	stat.boots = stat.crashes = stat.guest_writes = stat.guest_reads = 0;
+	stat.refused = stat.reads = stat.writes = stat.flushes = 0;
+	stat.busy_writes = 0;
+	format ();
+	power_on ();
+	busy = 1;
+	busy_until = 0;
+	for (i = 0; i < steps; i++) {
+		/* the guest alternates between busy and idle periods */
+		if (now >= busy_until) {
+			busy = !busy;
+			busy_until = now + (1 + rnd () % 20) * 100000;
+		}
+		if (rnd () % CRASH_ODDS == 0) {
+			power_cut ();
+			power_on ();
+			/* I/O before the metadata is read */
+			while (rnd () % 4)
+				rnd () & 1 ? guest_write () : guest_read ();
+			wait_loaded ();
+			guest_read_all ();
+			continue;
+		}
+		switch (rnd () % 8) {
+		case 0:
+		case 1:
+			if (busy)
+				guest_write ();
+			break;
+		case 2:
+		case 3:
+			if (busy)
+				guest_read ();
+			break;
+		case 4:
+		case 5:
+			if (npending) {
+				if (now - last_guest_io < 50000 &&
+				    pending[0].op == 1)
+					stat.busy_writes++;
+				complete ();
+			}
+			break;
+		default:
+			now += busy ? TICK_USEC / 4 : TICK_USEC;
+			sim_poll (now);
+			break;
+		}
+	}
+	/* let the engine finish without the guest */
+	for (i = 0; i < 1000000 && !sim_done (); i++) {
+		now += TICK_USEC;
+		sim_poll (now);
+		while (npending)
+			complete ();
+	}
+	if (!sim_done ())
+		fail ("the re-encryption does not complete");
+	guest_read_all ();
+	verify_media ();
+	printf ("%-10s %8llu %8llu %10llu %10llu %8llu %8llu %8llu %8llu\n",
+		plain ? "none->sim" : "sim->sim", stat.boots, stat.crashes,
+		stat.guest_writes, stat.guest_reads, stat.refused,
+		stat.writes, stat.flushes, stat.busy_writes);
+}
+
+int
+main (int argc, char **argv)
+{
+	char *path;
+	int c, steps;
+
+	steps = DEFAULT_STEPS;
+	path = NULL;
+	while ((c = getopt (argc, argv, "d:n:s:v")) != -1) {
+		switch (c) {
+		case 'd':
+			path = optarg;
+			break;
+		case 'n':
+			steps = atoi (optarg);
+			break;
+		case 's':
+			rnd_state = strtoull (optarg, NULL, 0) | 1;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			fprintf (stderr, "usage: storagesim [-v] [-d disk]"
+				 " [-n steps] [-s seed]\n");
+			return 1;
+		}
+	}
+	if (!path)
+		path = "storagesim.img";
+	disk_fd = open (path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (disk_fd < 0) {
+		perror (path);
+		return 1;
+	}
+	printf ("%-10s %8s %8s %10s %10s %8s %8s %8s %8s\n", "rekey",
+		"boots", "crashes", "g-writes", "g-reads", "refused",
+		"writes", "flushes", "busy-wr");
+	plain = 0;
+	run (steps);
+	plain = 1;
+	run (steps);
+	close (disk_fd);
+	printf ("storagesim: ok\n");
+	return 0;
+}
@@ -0,0 +1,504 @@
+/*
+ * Copyright (c) 2007, 2008 University of Tsukuba
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the University of Tsukuba nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* drivers/usb/usb_mscd.c and the hook dispatcher drivers/usb/usb_hook.c
+   built for the host.  the VMM headers are used as they are;
+   alloc(), free(), printf() and panic() are renamed on the command
+   line.  this file builds the device descriptors and the request
+   blocks the host controller drivers would pass to the hooks, and
+   implements the memory and storage functions on top of uassim.c. */
+
+#include "../../drivers/usb/usb_mscd.c"
+#include "../../drivers/usb/usb_hook.c"
+
+#define SIM_DEVADR	2
+#define SIM_EP_BOT_IN	0x81
+#define SIM_EP_BOT_OUT	0x02
+
+struct storage_device {
+	int lun;
+};
+
+void *sim_map (u64 gphys, uint len, int write);
+void sim_unmap (void *virt, uint len);
+void *sim_host_alloc (uint len);
+void sim_host_free (void *p);
+void sim_cipher (u64 lba, int sector_size, u8 *buf);
+int sim_storage_fail (void);
+
+static struct usb_host sim_host;
+static struct usb_operations sim_op;
+static struct usb_device sim_dev;
+static struct usb_config_descriptor sim_config;
+static struct usb_interface sim_iface;
+static struct usb_interface_descriptor sim_alt[2];
+static struct usb_endpoint_descriptor sim_ep_bot[3], sim_ep_uas[4];
+static u8 sim_cur_alt[1];
+static unsigned char sim_usage[4][4];
+static int sim_storages;
+
+/* --- memory --- */
+
+void *
+mapmem_gphys (u64 physaddr, uint len, int flags)
+{
+	return sim_map (physaddr, len, !!(flags & MAPMEM_WRITE));
+}
+
+void
+unmapmem (void *virt, uint len)
+{
+	sim_unmap (virt, len);
+}
+
+void *
+usb_new_dev_handle (struct usb_host *usbhc, struct usb_device *dev)
+{
+	struct usb_device_handle *handle;
+
+	handle = alloc (sizeof *handle);
+	memset (handle, 0, sizeof *handle);
+	return handle;
+}
+
+/* --- storage --- */
+
+struct storage_device *
+storage_new (int type, int host_id, int device_id, struct guid *guid,
+	     struct storage_extend *extend)
+{
+	struct storage_device *storage;
+
+	if (type != STORAGE_TYPE_USB)
+		panic ("storage_new: type %d", type);
+	storage = alloc (sizeof *storage);
+	storage->lun = sim_storages++;
+	return storage;
+}
+
+void
+storage_free (struct storage_device *storage)
+{
+	sim_storages--;
+	free (storage);
+}
+
+int
+storage_handle_sectors_iov (struct storage_device *storage,
+			    struct storage_access *access,
+			    struct storage_iovec *src, int srccnt,
+			    struct storage_iovec *dst, int dstcnt)
+{
+	u32 size = access->count * access->sector_size, n, off;
+	u8 *buf;
+	int i;
+
+	if (sim_storage_fail ())
+		return -1;
+	buf = alloc (size ? size : 1);
+	for (i = 0, off = 0; i < srccnt && off < size; i++, off += n) {
+		n = min (src[i].len, size - off);
+		memcpy (buf + off, src[i].base, n);
+	}
+	if (off < size)
+		panic ("storage_handle_sectors_iov: short source");
+	for (off = 0; off < size; off += access->sector_size)
+		sim_cipher (access->lba + off / access->sector_size,
+			    access->sector_size, buf + off);
+	for (i = 0, off = 0; i < dstcnt && off < size; i++, off += n) {
+		n = min (dst[i].len, size - off);
+		memcpy (dst[i].base, buf + off, n);
+	}
+	if (off < size)
+		panic ("storage_handle_sectors_iov: short destination");
+	free (buf);
+	return 0;
+}
+
+/* --- host controller --- */
+
+/* duplicate the buffers of a guest request block like
+   ehci_shadow_buffer() and uhci_shadow_buffer() */
+static int
+sim_shadow_buffer (struct usb_host *host, struct usb_request_block *gurb,
+		   u32 flag)
+{
+	struct usb_buffer_list *gub, *hub, **next;
+	void *p;
+
+	if (gurb->shadow->buffers)
+		panic ("sim_shadow_buffer: shadowed twice");
+	next = &gurb->shadow->buffers;
+	for (gub = gurb->buffers; gub; gub = gub->next) {
+		hub = sim_host_alloc (sizeof *hub);
+		memset (hub, 0, sizeof *hub);
+		hub->pid = gub->pid;
+		hub->offset = gub->offset;
+		hub->len = gub->len;
+		hub->vadr = (virt_t)sim_host_alloc (gub->len);
+		hub->padr = 0x80000000;
+		memset ((void *)hub->vadr, 0xA5, gub->len);
+		if (flag) {
+			p = mapmem_gphys (gub->padr, gub->len, 0);
+			memcpy ((void *)hub->vadr, p, gub->len);
+			unmapmem (p, gub->len);
+		}
+		*next = hub;
+		next = &hub->next;
+	}
+	return 0;
+}
+
+static void
+sim_free_buffers (struct usb_buffer_list *ub)
+{
+	struct usb_buffer_list *next;
+
+	for (; ub; ub = next) {
+		next = ub->next;
+		if (ub->vadr)
+			sim_host_free ((void *)ub->vadr);
+		sim_host_free (ub);
+	}
+}
+
+static struct usb_buffer_list *
+sim_buffers (int n, u64 *gphys, u32 *len, u8 pid)
+{
+	struct usb_buffer_list *list = NULL, **next = &list, *ub;
+	size_t offset = 0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		ub = sim_host_alloc (sizeof *ub);
+		memset (ub, 0, sizeof *ub);
+		ub->padr = gphys[i];
+		ub->len = len[i];
+		ub->offset = offset;
+		ub->pid = pid;
+		offset += len[i];
+		*next = ub;
+		next = &ub->next;
+	}
+	return list;
+}
+
+/* a control transfer that has completed.  the setup packet is in
+   the shadow and, if sgphys is not 0, in the guest buffer at sgphys.
+   the data stage is in the guest buffer at gphys. */
+static void
+sim_control (u8 *setup, u64 sgphys, u64 gphys, u32 len)
+{
+	struct usb_request_block gurb, hurb;
+	struct usb_endpoint_descriptor ep0;
+	struct usb_buffer_list *hub, **next;
+	u32 slen = 8;
+
+	memset (&gurb, 0, sizeof gurb);
+	memset (&hurb, 0, sizeof hurb);
+	memset (&ep0, 0, sizeof ep0);
+	next = &gurb.buffers;
+	if (sgphys) {
+		*next = sim_buffers (1, &sgphys, &slen, USB_PID_SETUP);
+		next = &(*next)->next;
+	}
+	if (len)
+		*next = sim_buffers (1, &gphys, &len, USB_PID_IN);
+	hub = sim_host_alloc (sizeof *hub);
+	memset (hub, 0, sizeof *hub);
+	hub->vadr = (virt_t)sim_host_alloc (8);
+	memcpy ((void *)hub->vadr, setup, 8);
+	hub->len = 8;
+	hub->pid = USB_PID_SETUP;
+	hurb.buffers = hub;
+	hurb.address = SIM_DEVADR;
+	hurb.endpoint = &ep0;
+	hurb.dev = &sim_dev;
+	hurb.host = &sim_host;
+	hurb.shadow = &gurb;
+	hurb.actlen = len;
+	gurb.shadow = &hurb;
+	usb_hook_process (&sim_host, &hurb, USB_HOOK_REPLY);
+	sim_free_buffers (hurb.buffers);
+	sim_free_buffers (gurb.buffers);
+}
+
+static void
+sim_endpoint (struct usb_endpoint_descriptor *ep, u8 adr,
+	      unsigned char *usage)
+{
+	memset (ep, 0, sizeof *ep);
+	ep->bLength = 7;
+	ep->bDescriptorType = 5;
+	ep->bEndpointAddress = adr;
+	ep->bmAttributes = USB_ENDPOINT_TYPE_BULK;
+	ep->wMaxPacketSize = 512;
+	if (usage) {
+		ep->extra = usage;
+		ep->extralen = 4;
+	}
+}
+
+/* --- called by uassim.c --- */
+
+void
+sim_init (void)
+{
+	memset (&sim_host, 0, sizeof sim_host);
+	spinlock_init (&sim_host.lock_hk);
+	sim_op.shadow_buffer = sim_shadow_buffer;
+	sim_host.op = &sim_op;
+	usbmsc_init_handle (&sim_host);
+}
+
+/* a device with Bulk-only at alternate setting 0 and UAS at 1.  the
+   UAS data pipes share the Bulk-only endpoints.  without Pipe Usage
+   descriptors the endpoints are in the order of the pipe IDs,
+   otherwise they are in a different order. */
+void
+sim_connect (int ehci, int usage)
+{
+	static const u8 order_usage[4] = { 0x81, 0x02, 0x83, 0x04 };
+	static const u8 order_plain[4] = { 0x04, 0x83, 0x81, 0x02 };
+	static const u8 pipe_id[4] = { USB_UAS_PIPE_ID_DATAIN,
+				       USB_UAS_PIPE_ID_DATAOUT,
+				       USB_UAS_PIPE_ID_STATUS,
+				       USB_UAS_PIPE_ID_CMD };
+	u8 setconf[8] = { 0x00, 0x09, 0x01 };
+	int i;
+
+	sim_host.type = ehci ? USB_HOST_TYPE_EHCI : USB_HOST_TYPE_UHCI;
+	memset (&sim_dev, 0, sizeof sim_dev);
+	memset (&sim_config, 0, sizeof sim_config);
+	memset (&sim_iface, 0, sizeof sim_iface);
+	memset (sim_alt, 0, sizeof sim_alt);
+	sim_dev.descriptor.idVendor = 0x174C;
+	sim_dev.descriptor.idProduct = 0x55AA;
+	sim_dev.devnum = SIM_DEVADR;
+	sim_dev.portno = 1;
+	sim_dev.host = &sim_host;
+	sim_dev.config = &sim_config;
+	sim_config.bNumInterfaces = 1;
+	sim_config.interface = &sim_iface;
+	sim_iface.altsetting = sim_alt;
+	sim_iface.num_altsetting = 2;
+	sim_iface.cur_altsettings = sim_cur_alt;
+	sim_cur_alt[0] = 0;
+
+	/* endpoint 0 comes first in the first interface descriptor */
+	sim_endpoint (&sim_ep_bot[0], 0, NULL);
+	sim_ep_bot[0].bmAttributes = 0;
+	sim_endpoint (&sim_ep_bot[1], SIM_EP_BOT_IN, NULL);
+	sim_endpoint (&sim_ep_bot[2], SIM_EP_BOT_OUT, NULL);
+	sim_alt[0].bNumEndpoints = 2;
+	sim_alt[0].bInterfaceClass = 0x08;
+	sim_alt[0].bInterfaceSubClass = 0x06;
+	sim_alt[0].bInterfaceProtocol = 0x50;
+	sim_alt[0].endpoint = sim_ep_bot;
+	for (i = 0; i < 4; i++) {
+		sim_usage[i][0] = 4;
+		sim_usage[i][1] = USB_DT_UAS_PIPE_USAGE;
+		sim_usage[i][2] = pipe_id[i];
+		sim_usage[i][3] = 0;
+		sim_endpoint (&sim_ep_uas[i], usage ? order_usage[i] :
+			      order_plain[i], usage ? sim_usage[i] : NULL);
+	}
+	sim_alt[1].bAlternateSetting = 1;
+	sim_alt[1].bNumEndpoints = 4;
+	sim_alt[1].bInterfaceClass = 0x08;
+	sim_alt[1].bInterfaceSubClass = 0x06;
+	sim_alt[1].bInterfaceProtocol = 0x62;
+	sim_alt[1].endpoint = sim_ep_uas;
+	sim_control (setconf, 0, 0, 0);
+	if (!sim_dev.handle)
+		panic ("the device is not handled");
+}
+
+/* GetMaxLun.  the guest buffer holds the reply. */
+void
+sim_get_max_lun (u64 gphys)
+{
+	u8 setup[8] = { 0xA1, 0xFE, 0, 0, 0, 0, 1, 0 };
+
+	sim_control (setup, 0, gphys, 1);
+}
+
+/* SetInterface of interface 0.  the guest buffer at gphys holds the
+   setup packet.  the USB device code records the setting before the
+   hooks of the driver run. */
+void
+sim_set_interface (int alt, u64 gphys)
+{
+	u8 setup[8] = { 0x01, 0x0B, alt, 0, 0, 0, 0, 0 };
+
+	sim_cur_alt[0] = alt;
+	sim_control (setup, gphys, 0, 0);
+}
+
+/* a bulk transfer of n guest buffers.  returns 1 if it goes to the
+   device or 0 if a hook discards it, and sets *halted if the guest
+   transfer descriptor was halted.  the device receives OUT data in
+   wire and sends actlen bytes of IN data from wire. */
+int
+sim_bulk (u8 ep, int n, u64 *gphys, u32 *len, u8 *wire, u32 actlen,
+	  int *halted)
+{
+	struct usb_request_block gurb, hurb;
+	struct usb_endpoint_descriptor epdesc;
+	struct urb_private_uhci uhci;
+	struct uhci_td_meta tdm;
+	struct uhci_td td;
+	struct urb_private_ehci ehci;
+	struct ehci_qtd_meta qtdm;
+	struct ehci_qtd qtd;
+	struct ehci_qh qh;
+	struct usb_buffer_list *ub;
+	bool in = !!(ep & USB_ENDPOINT_IN);
+	u32 off, c;
+	int ret;
+	void *p;
+
+	memset (&gurb, 0, sizeof gurb);
+	memset (&hurb, 0, sizeof hurb);
+	memset (&epdesc, 0, sizeof epdesc);
+	epdesc.bEndpointAddress = ep;
+	epdesc.bmAttributes = USB_ENDPOINT_TYPE_BULK;
+	gurb.buffers = sim_buffers (n, gphys, len, in ? USB_PID_IN :
+				    USB_PID_OUT);
+	if (sim_host.type == USB_HOST_TYPE_UHCI) {
+		memset (&uhci, 0, sizeof uhci);
+		memset (&tdm, 0, sizeof tdm);
+		memset (&td, 0, sizeof td);
+		td.status = UHCI_TD_STAT_AC;
+		td.token = in ? UHCI_TD_TOKEN_PID_IN : UHCI_TD_TOKEN_PID_OUT;
+		tdm.td = &td;
+		uhci.tdm_head = &tdm;
+		gurb.hcpriv = &uhci;
+	} else {
+		memset (&ehci, 0, sizeof ehci);
+		memset (&qtdm, 0, sizeof qtdm);
+		memset (&qtd, 0, sizeof qtd);
+		memset (&qh, 0, sizeof qh);
+		qtd.token = EHCI_QTD_STAT_AC | (in ? EHCI_QTD_PID_IN :
+						EHCI_QTD_PID_OUT);
+		qtdm.qtd = &qtd;
+		ehci.qtdm_head = &qtdm;
+		ehci.qh = &qh;
+		gurb.hcpriv = &ehci;
+	}
+	hurb.address = gurb.address = SIM_DEVADR;
+	hurb.endpoint = gurb.endpoint = &epdesc;
+	hurb.dev = gurb.dev = &sim_dev;
+	hurb.host = gurb.host = &sim_host;
+	hurb.shadow = &gurb;
+	gurb.shadow = &hurb;
+
+	ret = usb_hook_process (&sim_host, &hurb, USB_HOOK_REQUEST);
+	if (sim_host.type == USB_HOST_TYPE_UHCI)
+		*halted = !!(td.status & UHCI_TD_STAT_ST) &&
+			!(td.status & UHCI_TD_STAT_AC);
+	else
+		*halted = !!(qtd.token & EHCI_QTD_STAT_HL) &&
+			!(qtd.token & EHCI_QTD_STAT_AC) &&
+			(qh.qtd_ovlay.token & EHCI_QTD_STAT_HL);
+	if (ret == USB_HOOK_DISCARD)
+		goto out;
+	if (!hurb.buffers)
+		panic ("sim_bulk: endpoint %02x is not shadowed", ep);
+	off = 0;
+	if (!in) {
+		for (ub = hurb.buffers; ub; ub = ub->next, off += c) {
+			c = ub->len;
+			memcpy (wire + off, (void *)ub->vadr, c);
+		}
+		goto out;
+	}
+	for (ub = hurb.buffers; ub && off < actlen; ub = ub->next, off += c) {
+		c = min (ub->len, actlen - off);
+		memcpy ((void *)ub->vadr, wire + off, c);
+	}
+	hurb.actlen = gurb.actlen = actlen;
+	usb_hook_process (&sim_host, &hurb, USB_HOOK_REPLY);
+out:
+	sim_free_buffers (hurb.buffers);
+	sim_free_buffers (gurb.buffers);
+	return ret != USB_HOOK_DISCARD;
+}
+
+/* UAS commands tracked by the driver, or -1 without UAS */
+int
+sim_uas_cmds (void)
+{
+	struct usbmsc_device *mscdev;
+	int i, n;
+
+	mscdev = sim_dev.handle->private_data;
+	if (!mscdev->uas)
+		return -1;
+	for (i = n = 0; i < USBMSC_UAS_TAG_MAX; i++)
+		if (mscdev->uas->cmd[i].used)
+			n++;
+	return n;
+}
+
+/* like free_device() */
+void
+sim_disconnect (void)
+{
+	struct usb_hook *hook, *next;
+	int phase;
+
+	for (phase = 0; phase < USB_HOOK_NUM_PHASE; phase++) {
+		for (hook = sim_host.hook[phase]; hook; hook = next) {
+			next = hook->next;
+			if (hook->dev == &sim_dev)
+				usb_hook_unregister (&sim_host, phase + 1,
+						     hook);
+		}
+	}
+	if (sim_dev.handle && sim_dev.handle->remove)
+		sim_dev.handle->remove (&sim_dev);
+}
+
+/* returns the number of hooks and storage devices left */
+int
+sim_shutdown (void)
+{
+	struct usb_hook *hook;
+	int phase, n = sim_storages;
+
+	for (phase = 0; phase < USB_HOOK_NUM_PHASE; phase++) {
+		while ((hook = sim_host.hook[phase])) {
+			if (hook->dev)
+				n++;
+			usb_hook_unregister (&sim_host, phase + 1, hook);
+		}
+	}
+	return n;
+}
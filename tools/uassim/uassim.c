@@ -0,0 +1,1556 @@
+/*
+ * Copyright (c) 2007, 2008 University of Tsukuba
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the University of Tsukuba nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* userspace test of the USB Attached SCSI support of the mass-storage
+   shadow in drivers/usb/usb_mscd.c.  a trace of UAS and Bulk-only
+   transactions is replayed through the hooks of the driver as the
+   UHCI and EHCI shadows would call them, and a device on the other
+   end keeps the media.  the trace has one transaction per line:
+
+     connect [uhci|ehci] [nousage]   SetConfiguration of the device
+     maxlun N                        GetMaxLun reply
+     alt N                           SetInterface: 0 Bulk-only, 1 UAS
+     cmd TAG LUN CDB...              command IU
+     task TAG FUNCTION [TASKTAG [LUN]]  task management IU
+     status rr|wr TAG                READ READY or WRITE READY IU
+     status sense TAG STATUS [SENSE...]
+     status resp TAG CODE            response IU
+     status raw BYTES...             any other status pipe transfer
+     in BYTES... / out BYTES...      data of other commands
+     read N / write N                N sectors of the current data
+                                     phase from or to the media
+     cbw TAG LUN LENGTH in|out CDB...  Bulk-only command
+     csw TAG STATUS                  Bulk-only status
+     fail                            the storage handler fails once
+     expect pass|discard|halt|unchanged|status N|cmds N
+     disconnect
+
+   numbers are hexadecimal.  sector data written by the guest must
+   reach the media encrypted and read back as written, the status
+   the guest sees must report storage failures, and commands the
+   shadow cannot handle must be halted or discarded.  the guest
+   buffers are mapped read-only for the driver unless it asks for a
+   writable mapping.  without trace files, a random session of
+   tagged commands in flight is generated and replayed; -w saves it
+   as a trace.  the .uas traces in this directory are written by
+   hand. */
+
+#define _GNU_SOURCE
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+typedef unsigned char u8;
+typedef unsigned short u16;
+typedef unsigned int u32;
+typedef unsigned long long u64;
+
+#define PAGE		4096
+#define GUEST_SIZE	(4 << 20)
+#define GUEST_PAGES	(GUEST_SIZE / PAGE)
+#define MAX_MAPS	4096
+#define MAX_BUFS	2048
+#define MAX_WIRE	(128 << 10)
+#define MAX_LINE	1024
+#define NLUN		2
+#define TAG_MAX		64	/* commands the driver tracks */
+#define MAX_INFLIGHT	40
+#define STATUS_BUF	112
+
+#define EP_CMD		0x04
+#define EP_STATUS	0x83
+#define EP_DATAIN	0x81
+#define EP_DATAOUT	0x02
+
+#define IU_COMMAND	0x01
+#define IU_SENSE	0x03
+#define IU_RESPONSE	0x04
+#define IU_TASK_MGMT	0x05
+#define IU_READ_READY	0x06
+#define IU_WRITE_READY	0x07
+
+#define DIR_NONE	0
+#define DIR_IN		1
+#define DIR_OUT		2
+
+#define DEFAULT_STEPS	20000
+
+struct lun {
+	u32 ss;
+	u32 nblocks;
+	u8 *media;		/* as the device stores it */
+	u8 *truth;		/* as the guest wrote it */
+	u8 *known;
+};
+
+struct cmd {
+	int used;
+	u16 tag;
+	int lun;
+	u8 op;
+	int dir;
+	int tmf;		/* a task management function */
+	u16 task;		/* the task it manages */
+	u32 lba, count, done;
+	u32 length;		/* bytes of other data */
+	int failed;		/* the storage handler failed */
+	u32 seq;
+};
+
+/* the model of the device and of the driver state the guest can
+   observe */
+static struct {
+	int connected;
+	int alt;
+	struct cmd cmd[TAG_MAX];
+	struct cmd *datain, *dataout;
+	struct cmd bot;
+	u32 seq;
+} m;
+
+static struct lun lun[NLUN];
+static int fail_next, fail_used;
+
+static u8 *guest_rw, *guest_vmm;
+static u16 wcount[GUEST_PAGES];
+static struct {
+	void *virt;
+	u32 len;
+	int write;
+} maps[MAX_MAPS];
+static int nmaps;
+static long allocs, init_allocs;	/* init_allocs: the global hooks */
+
+/* the result of the last transaction */
+static struct {
+	int pass, halted, unchanged, status;
+} last;
+
+static const char *trace_name = "";
+static int trace_line;
+static FILE *save;
+static unsigned long long rnd_state = 0x2545F4914F6CDD1DULL;
+static int verbose;
+
+static struct {
+	unsigned long long lines, commands, reads, writes, sectors;
+	unsigned long long failures, halts, aborts, bot;
+} stat;
+
+void sim_init (void);
+void sim_connect (int ehci, int usage);
+void sim_get_max_lun (u64 gphys);
+void sim_set_interface (int alt, u64 gphys);
+int sim_bulk (u8 ep, int n, u64 *gphys, u32 *len, u8 *wire, u32 actlen,
+	      int *halted);
+int sim_uas_cmds (void);
+void sim_disconnect (void);
+int sim_shutdown (void);
+
+static void
+fail (char *format, ...)
+{
+	va_list ap;
+
+	va_start (ap, format);
+	fprintf (stderr, "uassim: %s:%d: ", trace_name, trace_line);
+	vfprintf (stderr, format, ap);
+	fprintf (stderr, "\n");
+	va_end (ap);
+	exit (1);
+}
+
+static unsigned long long
+rnd (void)
+{
+	rnd_state ^= rnd_state >> 12;
+	rnd_state ^= rnd_state << 25;
+	rnd_state ^= rnd_state >> 27;
+	return rnd_state * 0x2545F4914F6CDD1DULL;
+}
+
+static u64
+mix (u64 x)
+{
+	x += 0x9E3779B97F4A7C15ULL;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
+
+static void
+fill (u8 *p, u32 len)
+{
+	while (len-- > 0)
+		*p++ = rnd ();
+}
+
+static u32
+get_be32 (u8 *p)
+{
+	return p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static void
+put_be16 (u8 *p, u16 v)
+{
+	p[0] = v >> 8;
+	p[1] = v;
+}
+
+static void
+put_le32 (u8 *p, u32 v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+/* --- functions called by the driver --- */
+
+static void
+segv (int sig, siginfo_t *info, void *uc)
+{
+	u8 *p = info->si_addr;
+
+	if (p >= guest_vmm && p < guest_vmm + GUEST_SIZE)
+		fprintf (stderr, "uassim: %s:%d: guest memory at 0x%lx"
+			 " written through a read-only mapping\n",
+			 trace_name, trace_line, (long)(p - guest_vmm));
+	else
+		fprintf (stderr, "uassim: %s:%d: segmentation fault at %p\n",
+			 trace_name, trace_line, p);
+	_exit (1);
+}
+
+static void
+protect (u64 gphys, u32 len, int delta)
+{
+	u32 i, first = gphys / PAGE, last = (gphys + len - 1) / PAGE;
+
+	for (i = first; i <= last; i++) {
+		if (delta > 0 && !wcount[i]++)
+			mprotect (guest_vmm + (u64)i * PAGE, PAGE,
+				  PROT_READ | PROT_WRITE);
+		if (delta < 0 && !--wcount[i])
+			mprotect (guest_vmm + (u64)i * PAGE, PAGE, PROT_READ);
+	}
+}
+
+void *
+sim_map (u64 gphys, unsigned int len, int write)
+{
+	if (!len || gphys >= GUEST_SIZE || len > GUEST_SIZE - gphys)
+		fail ("mapping of 0x%llx length %u outside of guest memory",
+		      gphys, len);
+	if (nmaps == MAX_MAPS)
+		fail ("too many mappings");
+	maps[nmaps].virt = guest_vmm + gphys;
+	maps[nmaps].len = len;
+	maps[nmaps].write = write;
+	nmaps++;
+	if (write)
+		protect (gphys, len, 1);
+	return guest_vmm + gphys;
+}
+
+void
+sim_unmap (void *virt, unsigned int len)
+{
+	int i;
+
+	for (i = nmaps - 1; i >= 0; i--)
+		if (maps[i].virt == virt && maps[i].len == len)
+			break;
+	if (i < 0)
+		fail ("unmapmem of %p length %u that is not mapped", virt,
+		      len);
+	if (maps[i].write)
+		protect ((u8 *)virt - guest_vmm, len, -1);
+	maps[i] = maps[--nmaps];
+}
+
+void *
+sim_host_alloc (unsigned int len)
+{
+	void *p = malloc (len ? len : 1);
+
+	if (!p)
+		fail ("out of memory");
+	return p;
+}
+
+void
+sim_host_free (void *p)
+{
+	free (p);
+}
+
+void *
+sim_alloc (unsigned int len)
+{
+	allocs++;
+	return sim_host_alloc (len);
+}
+
+void
+sim_free (void *p)
+{
+	if (p) {
+		allocs--;
+		free (p);
+	}
+}
+
+int
+sim_printf (const char *format, ...)
+{
+	va_list ap;
+	int r = 0;
+
+	if (verbose) {
+		va_start (ap, format);
+		r = vprintf (format, ap);
+		va_end (ap);
+	}
+	return r;
+}
+
+void
+sim_panic (const char *format, ...)
+{
+	va_list ap;
+
+	va_start (ap, format);
+	fprintf (stderr, "uassim: %s:%d: panic: ", trace_name, trace_line);
+	vfprintf (stderr, format, ap);
+	fprintf (stderr, "\n");
+	va_end (ap);
+	exit (1);
+}
+
+/* the storage encryption */
+void
+sim_cipher (u64 lba, int sector_size, u8 *buf)
+{
+	u64 v, k = mix (lba);
+	int i;
+
+	for (i = 0; i < sector_size; i += 8) {
+		memcpy (&v, buf + i, 8);
+		v ^= mix (k + i);
+		memcpy (buf + i, &v, 8);
+	}
+}
+
+int
+sim_storage_fail (void)
+{
+	if (!fail_next)
+		return 0;
+	fail_next = 0;
+	fail_used = 1;
+	stat.failures++;
+	return 1;
+}
+
+/* --- guest buffers --- */
+
+static u64
+gbuf (u32 len)
+{
+	u64 gphys;
+
+	gphys = rnd () % (GUEST_SIZE - len - PAGE);
+	if (rnd () % 2)
+		gphys &= ~3ULL;
+	/* IUs, CBWs and CSWs split at a page boundary by EHCI */
+	if (len > 1 && len < PAGE && !(rnd () % 4))
+		gphys = (gphys & ~(u64)(PAGE - 1)) + PAGE -
+			(1 + rnd () % (len - 1));
+	memset (guest_rw + gphys, 0x5A, len);
+	return gphys;
+}
+
+/* split a guest buffer like the transfer descriptors of the host
+   controller: packets of 64 bytes for UHCI, pages for EHCI */
+static int
+gsplit (u64 gphys, u32 len, int ehci, u64 *gp, u32 *gl)
+{
+	u32 c;
+	int n;
+
+	for (n = 0; len > 0; n++, gphys += c, len -= c) {
+		if (n == MAX_BUFS)
+			fail ("transfer too long");
+		c = ehci ? PAGE - gphys % PAGE : 64;
+		if (c > len)
+			c = len;
+		gp[n] = gphys;
+		gl[n] = c;
+	}
+	return n;
+}
+
+static int ehci_host;
+
+/* a transfer between the guest buffer at gphys and the device.
+   buflen is the length of the guest buffer, len the length of the
+   data. */
+static int
+xfer (u8 ep, u64 gphys, u32 buflen, u8 *wire, u32 len)
+{
+	static u64 gp[MAX_BUFS];
+	static u32 gl[MAX_BUFS];
+	int n;
+
+	n = gsplit (gphys, buflen, ehci_host, gp, gl);
+	last.pass = sim_bulk (ep, n, gp, gl, wire, len, &last.halted);
+	if (last.halted)
+		stat.halts++;
+	return last.pass;
+}
+
+/* --- the model --- */
+
+static struct cmd *
+find_cmd (u16 tag)
+{
+	int i;
+
+	for (i = 0; i < TAG_MAX; i++)
+		if (m.cmd[i].used && m.cmd[i].tag == tag)
+			return &m.cmd[i];
+	return NULL;
+}
+
+static void
+put_cmd (struct cmd *c)
+{
+	if (m.datain == c)
+		m.datain = NULL;
+	if (m.dataout == c)
+		m.dataout = NULL;
+	c->used = 0;
+}
+
+/* like the driver, the oldest command is forgotten if a tag does
+   not fit */
+static struct cmd *
+get_cmd (u16 tag)
+{
+	struct cmd *c, *oldest;
+	int i;
+
+	c = find_cmd (tag);
+	if (c)
+		goto found;
+	oldest = &m.cmd[0];
+	for (i = 0; i < TAG_MAX; i++) {
+		if (!m.cmd[i].used) {
+			c = &m.cmd[i];
+			goto found;
+		}
+		if ((int)(m.cmd[i].seq - oldest->seq) < 0)
+			oldest = &m.cmd[i];
+	}
+	c = oldest;
+	put_cmd (c);
+found:
+	put_cmd (c);
+	memset (c, 0, sizeof *c);
+	c->used = 1;
+	c->tag = tag;
+	c->seq = m.seq++;
+	return c;
+}
+
+static int
+ncmds (void)
+{
+	int i, n;
+
+	for (i = n = 0; i < TAG_MAX; i++)
+		if (m.cmd[i].used)
+			n++;
+	return n;
+}
+
+static void
+parse_cdb (struct cmd *c, u8 *cdb)
+{
+	c->op = cdb[0];
+	c->dir = DIR_NONE;
+	switch (cdb[0]) {
+	case 0x28:		/* READ(10) */
+	case 0x2A:		/* WRITE(10) */
+		c->lba = get_be32 (&cdb[2]);
+		c->count = cdb[7] << 8 | cdb[8];
+		c->dir = cdb[0] == 0x28 ? DIR_IN : DIR_OUT;
+		break;
+	case 0xA8:		/* READ(12) */
+	case 0xAA:		/* WRITE(12) */
+		c->lba = get_be32 (&cdb[2]);
+		c->count = get_be32 (&cdb[6]);
+		c->dir = cdb[0] == 0xA8 ? DIR_IN : DIR_OUT;
+		break;
+	case 0x12:		/* INQUIRY */
+	case 0x25:		/* READ CAPACITY(10) */
+	case 0x5A:		/* MODE SENSE(10) */
+		c->dir = DIR_IN;
+		break;
+	case 0x55:		/* MODE SELECT(10) */
+		c->dir = DIR_OUT;
+		break;
+	}
+}
+
+static int
+security (u8 op)
+{
+	return op == 0xA2 || op == 0xB5;
+}
+
+/* --- transactions --- */
+
+static void
+do_connect (int ehci, int usage)
+{
+	if (m.connected)
+		fail ("connected twice");
+	memset (&m, 0, sizeof m);
+	ehci_host = ehci;
+	sim_connect (ehci, usage);
+	m.connected = 1;
+}
+
+static void
+do_maxlun (u8 n)
+{
+	u64 g = gbuf (1);
+
+	guest_rw[g] = n;
+	sim_get_max_lun (g);
+}
+
+static void
+do_alt (int alt)
+{
+	u8 setup[8] = { 0x01, 0x0B, alt, 0, 0, 0, 0, 0 };
+	u64 g = gbuf (sizeof setup);
+
+	/* the commands in flight are lost */
+	memset (m.cmd, 0, sizeof m.cmd);
+	m.datain = m.dataout = NULL;
+	memset (&m.bot, 0, sizeof m.bot);
+	m.alt = alt;
+	memcpy (guest_rw + g, setup, sizeof setup);
+	sim_set_interface (alt, g);
+}
+
+/* the guest sends an IU on the command pipe */
+static void
+send_iu (u8 *iu, u32 len)
+{
+	static u8 wire[MAX_WIRE];
+	u64 g = gbuf (len);
+
+	memcpy (guest_rw + g, iu, len);
+	if (xfer (EP_CMD, g, len, wire, 0) && memcmp (wire, iu, len))
+		fail ("the device received a different IU");
+}
+
+static void
+do_cmd (u16 tag, int lunno, u8 *cdb)
+{
+	struct cmd *c;
+	u8 iu[32];
+
+	memset (iu, 0, sizeof iu);
+	iu[0] = IU_COMMAND;
+	put_be16 (&iu[2], tag);
+	iu[9] = lunno;
+	memcpy (&iu[16], cdb, 16);
+	stat.commands++;
+	send_iu (iu, sizeof iu);
+	if (security (cdb[0])) {
+		if (last.pass || !last.halted)
+			fail ("security protocol command %02x not halted",
+			      cdb[0]);
+		return;
+	}
+	if (!last.pass)
+		fail ("command IU discarded");
+	c = get_cmd (tag);
+	c->lun = lunno < NLUN ? lunno : 0;
+	parse_cdb (c, cdb);
+}
+
+static void
+do_task (u16 tag, u8 function, u16 task, int lunno)
+{
+	struct cmd *c;
+	u8 iu[16];
+
+	memset (iu, 0, sizeof iu);
+	iu[0] = IU_TASK_MGMT;
+	put_be16 (&iu[2], tag);
+	iu[4] = function;
+	put_be16 (&iu[6], task);
+	iu[9] = lunno;
+	send_iu (iu, sizeof iu);
+	if (!last.pass)
+		fail ("task management IU discarded");
+	c = get_cmd (tag);
+	c->lun = lunno < NLUN ? lunno : 0;
+	c->tmf = function;
+	c->task = task;
+	stat.aborts++;
+}
+
+/* an IU on the status pipe.  returns the status the guest sees. */
+static int
+recv_status (u8 *iu, u32 len)
+{
+	u64 g = gbuf (STATUS_BUF);
+
+	xfer (EP_STATUS, g, STATUS_BUF, iu, len);
+	if (!last.pass)
+		fail ("status IU discarded");
+	if (memcmp (guest_rw + g, iu, len) &&
+	    (len < 16 || iu[0] != IU_SENSE ||
+	     memcmp (guest_rw + g, iu, 6) ||
+	     memcmp (guest_rw + g + 7, iu + 7, len - 7)))
+		fail ("the guest received a different IU");
+	return guest_rw[g + 6];
+}
+
+static void
+do_ready (int write, u16 tag)
+{
+	struct cmd *c = find_cmd (tag);
+	u8 iu[4] = { write ? IU_WRITE_READY : IU_READ_READY, 0 };
+
+	put_be16 (&iu[2], tag);
+	recv_status (iu, sizeof iu);
+	if (!c)
+		return;
+	if (write)
+		m.dataout = c;
+	else
+		m.datain = c;
+}
+
+static void
+do_sense (u16 tag, u8 status, u8 *sense, u32 senselen)
+{
+	struct cmd *c = find_cmd (tag);
+	u8 iu[16 + 256];
+	int expect;
+
+	memset (iu, 0, 16);
+	iu[0] = IU_SENSE;
+	put_be16 (&iu[2], tag);
+	iu[6] = status;
+	put_be16 (&iu[14], senselen);
+	memcpy (&iu[16], sense, senselen);
+	last.status = recv_status (iu, 16 + senselen);
+	expect = status;
+	if (c && c->failed && !status)
+		expect = 0x08;	/* BUSY */
+	if (last.status != expect)
+		fail ("tag %04x: status %02x, expected %02x", tag,
+		      last.status, expect);
+	if (c)
+		put_cmd (c);
+}
+
+static void
+do_response (u16 tag, u8 code)
+{
+	struct cmd *c = find_cmd (tag), *t;
+	int i;
+	u8 iu[8];
+
+	memset (iu, 0, sizeof iu);
+	iu[0] = IU_RESPONSE;
+	put_be16 (&iu[2], tag);
+	iu[7] = code;
+	recv_status (iu, sizeof iu);
+	if (!c)
+		return;
+	/* function complete or succeeded */
+	if (c->tmf && (code == 0x00 || code == 0x08)) {
+		if (c->tmf == 0x01) {
+			t = find_cmd (c->task);
+			if (t && !t->tmf)
+				put_cmd (t);
+		} else if (c->tmf == 0x02 || c->tmf == 0x04 ||
+			   c->tmf == 0x08 || c->tmf == 0x10) {
+			for (i = 0; i < TAG_MAX; i++)
+				if (m.cmd[i].used && !m.cmd[i].tmf &&
+				    (c->tmf == 0x10 ||
+				     m.cmd[i].lun == c->lun))
+					put_cmd (&m.cmd[i]);
+		}
+	}
+	put_cmd (c);
+}
+
+static void
+do_status_raw (u8 *iu, u32 len)
+{
+	recv_status (iu, len);
+}
+
+/* the command of the current data phase */
+static struct cmd *
+data_cmd (int write)
+{
+	if (m.alt == 0)
+		return m.bot.used ? &m.bot : NULL;
+	return write ? m.dataout : m.datain;
+}
+
+static u8
+data_ep (int write)
+{
+	return write ? EP_DATAOUT : EP_DATAIN;
+}
+
+/* data of a command other than READ and WRITE */
+static void
+do_data (int write, u8 *data, u32 len)
+{
+	static u8 wire[MAX_WIRE];
+	struct cmd *c = data_cmd (write);
+	u64 g = gbuf (len);
+	u32 i;
+
+	if (write) {
+		memcpy (guest_rw + g, data, len);
+		xfer (data_ep (1), g, len, wire, 0);
+		if (c && c->dir == DIR_OUT && c->op == 0x55) {
+			if (!last.pass || memcmp (wire, data, len))
+				fail ("parameter data not passed");
+		} else if (last.pass) {
+			fail ("OUT data passed without a command");
+		}
+		return;
+	}
+	xfer (data_ep (0), g, len, data, len);
+	last.unchanged = 1;
+	for (i = 0; i < len; i++)
+		if (guest_rw[g + i] != 0x5A)
+			last.unchanged = 0;
+	if (c && c->dir == DIR_IN && (c->op == 0x12 || c->op == 0x25 ||
+				      c->op == 0x5A)) {
+		if (memcmp (guest_rw + g, data, len))
+			fail ("the guest received different data");
+	}
+}
+
+/* sectors of the current READ or WRITE */
+static void
+do_sectors (int write, u32 n)
+{
+	static u8 wire[MAX_WIRE], plain[MAX_WIRE];
+	struct cmd *c = data_cmd (write);
+	struct lun *l;
+	u32 ss, len, i;
+	u64 g, lba;
+
+	if (!c || c->dir != (write ? DIR_OUT : DIR_IN) || c->op == 0x12 ||
+	    c->op == 0x25 || c->op == 0x5A || c->op == 0x55) {
+		/* data without a READ or WRITE: the guest buffer gets
+		   nothing, the device nothing */
+		ss = 512;
+		len = n * ss;
+		g = gbuf (len);
+		fill (wire, len);
+		xfer (data_ep (write), g, len, wire, len);
+		last.unchanged = 1;
+		for (i = 0; i < len; i++)
+			if (guest_rw[g + i] != 0x5A)
+				last.unchanged = 0;
+		if (write && last.pass)
+			fail ("OUT data passed without WRITE READY");
+		if (!write && !last.unchanged)
+			fail ("IN data copied without READ READY");
+		return;
+	}
+	l = &lun[c->lun];
+	ss = l->ss;
+	len = n * ss;
+	if (len > MAX_WIRE)
+		fail ("transfer too long");
+	if (c->done + n > c->count || c->lba + c->count > l->nblocks)
+		fail ("sectors beyond the command");
+	lba = c->lba + c->done;
+	g = gbuf (len);
+	fail_used = 0;
+	if (write) {
+		fill (plain, len);
+		memcpy (guest_rw + g, plain, len);
+		xfer (data_ep (1), g, len, wire, 0);
+		if (!last.pass)
+			fail ("WRITE data discarded");
+		memcpy (l->media + lba * ss, wire, len);
+		if (fail_used) {
+			c->failed = 1;
+			memset (l->known + lba, 0, n);
+		} else {
+			for (i = 0; i < n; i++)
+				sim_cipher (lba + i, ss, plain + i * ss);
+			if (memcmp (wire, plain, len))
+				fail ("lba %llu: the device received"
+				      " different data", lba);
+			for (i = 0; i < n; i++)
+				sim_cipher (lba + i, ss, plain + i * ss);
+			memcpy (l->truth + lba * ss, plain, len);
+			memset (l->known + lba, 1, n);
+		}
+		stat.writes++;
+	} else {
+		memcpy (wire, l->media + lba * ss, len);
+		xfer (data_ep (0), g, len, wire, len);
+		last.unchanged = 1;
+		for (i = 0; i < len; i++)
+			if (guest_rw[g + i] != 0x5A)
+				last.unchanged = 0;
+		if (fail_used) {
+			c->failed = 1;
+		} else {
+			for (i = 0; i < n; i++)
+				if (l->known[lba + i] &&
+				    memcmp (guest_rw + g + i * ss,
+					    l->truth + (lba + i) * ss, ss))
+					fail ("lba %llu: the guest read"
+					      " different data", lba + i);
+		}
+		stat.reads++;
+	}
+	stat.sectors += n;
+	c->done += n;
+}
+
+static void
+do_cbw (u32 tag, int lunno, u32 length, int in, u8 *cdb, int cdblen)
+{
+	static u8 wire[MAX_WIRE];
+	u8 cbw[31];
+	u64 g;
+
+	memset (cbw, 0, sizeof cbw);
+	memcpy (cbw, "USBC", 4);
+	put_le32 (&cbw[4], tag);
+	put_le32 (&cbw[8], length);
+	cbw[12] = in ? 0x80 : 0;
+	cbw[13] = lunno;
+	cbw[14] = cdblen;
+	memcpy (&cbw[15], cdb, 16);
+	g = gbuf (sizeof cbw);
+	memcpy (guest_rw + g, cbw, sizeof cbw);
+	stat.commands++;
+	stat.bot++;
+	xfer (EP_DATAOUT, g, sizeof cbw, wire, 0);
+	if (security (cdb[0])) {
+		if (last.pass || !last.halted)
+			fail ("security protocol command %02x not halted",
+			      cdb[0]);
+		return;
+	}
+	if (!last.pass || memcmp (wire, cbw, sizeof cbw))
+		fail ("CBW not passed");
+	memset (&m.bot, 0, sizeof m.bot);
+	m.bot.used = 1;
+	m.bot.tag = tag;
+	m.bot.lun = lunno < NLUN ? lunno : 0;
+	parse_cdb (&m.bot, cdb);
+}
+
+static void
+do_csw (u32 tag, u8 status)
+{
+	u8 csw[13];
+	u64 g = gbuf (sizeof csw);
+	int expect;
+
+	memset (csw, 0, sizeof csw);
+	memcpy (csw, "USBS", 4);
+	put_le32 (&csw[4], tag);
+	csw[12] = status;
+	xfer (EP_DATAIN, g, sizeof csw, csw, sizeof csw);
+	last.status = guest_rw[g + 12];
+	expect = status;
+	if (m.bot.used && m.bot.failed && !status)
+		expect = 0x01;	/* Command Failed */
+	if (last.status != expect)
+		fail ("CSW status %02x, expected %02x", last.status, expect);
+	memset (&m.bot, 0, sizeof m.bot);
+}
+
+static void
+do_disconnect (void)
+{
+	sim_disconnect ();
+	m.connected = 0;
+	if (nmaps || allocs != init_allocs)
+		fail ("%d mappings and %ld allocations left", nmaps,
+		      allocs - init_allocs);
+}
+
+static void
+do_expect (char *what, u32 n)
+{
+	int v;
+
+	if (!strcmp (what, "pass"))
+		v = last.pass;
+	else if (!strcmp (what, "discard"))
+		v = !last.pass;
+	else if (!strcmp (what, "halt"))
+		v = last.halted;
+	else if (!strcmp (what, "unchanged"))
+		v = last.unchanged;
+	else if (!strcmp (what, "status"))
+		v = last.status == n;
+	else if (!strcmp (what, "cmds"))
+		v = sim_uas_cmds () == n && ncmds () == n;
+	else
+		fail ("unknown expectation %s", what);
+	if (!v && !strcmp (what, "cmds"))
+		fail ("expectation cmds %x not met: the driver tracks %x,"
+		      " the model %x", n, sim_uas_cmds (), ncmds ());
+	if (!v)
+		fail ("expectation %s %x not met", what, n);
+}
+
+/* --- replay --- */
+
+static int
+hex_bytes (char **tok, int ntok, u8 *buf, int max)
+{
+	int i;
+
+	if (ntok > max)
+		fail ("too many bytes");
+	for (i = 0; i < ntok; i++)
+		buf[i] = strtoul (tok[i], NULL, 16);
+	return ntok;
+}
+
+static void
+replay_line (char *line)
+{
+	char *tok[MAX_LINE / 2], *p;
+	u8 bytes[MAX_LINE / 2], cdb[16];
+	int ntok, n;
+
+	trace_line++;
+	if (save)
+		fputs (line, save);
+	p = strchr (line, '#');
+	if (p)
+		*p = '\0';
+	ntok = 0;
+	for (p = strtok (line, " \t\r\n"); p; p = strtok (NULL, " \t\r\n"))
+		tok[ntok++] = p;
+	if (!ntok)
+		return;
+	stat.lines++;
+	if (strcmp (tok[0], "expect"))
+		memset (&last, 0, sizeof last);
+#define NUM(i)	((i) < ntok ? strtoul (tok[i], NULL, 16) : \
+		 (fail ("argument missing"), 0))
+	if (!strcmp (tok[0], "connect")) {
+		do_connect (ntok > 1 && !strcmp (tok[1], "ehci"),
+			    !(ntok > 2 && !strcmp (tok[2], "nousage")));
+		return;
+	}
+	if (!m.connected)
+		fail ("not connected");
+	if (!strcmp (tok[0], "maxlun")) {
+		do_maxlun (NUM (1));
+	} else if (!strcmp (tok[0], "alt")) {
+		do_alt (NUM (1));
+	} else if (!strcmp (tok[0], "cmd")) {
+		memset (cdb, 0, sizeof cdb);
+		hex_bytes (tok + 3, ntok - 3, cdb, 16);
+		do_cmd (NUM (1), NUM (2), cdb);
+	} else if (!strcmp (tok[0], "task")) {
+		do_task (NUM (1), NUM (2), ntok > 3 ? NUM (3) : 0,
+			 ntok > 4 ? NUM (4) : 0);
+	} else if (!strcmp (tok[0], "status") && ntok > 1) {
+		if (!strcmp (tok[1], "rr") || !strcmp (tok[1], "wr")) {
+			do_ready (tok[1][0] == 'w', NUM (2));
+		} else if (!strcmp (tok[1], "sense")) {
+			n = hex_bytes (tok + 4, ntok - 4, bytes, 252);
+			do_sense (NUM (2), NUM (3), bytes, n);
+		} else if (!strcmp (tok[1], "resp")) {
+			do_response (NUM (2), NUM (3));
+		} else if (!strcmp (tok[1], "raw")) {
+			n = hex_bytes (tok + 2, ntok - 2, bytes, STATUS_BUF);
+			do_status_raw (bytes, n);
+		} else {
+			fail ("unknown status %s", tok[1]);
+		}
+	} else if (!strcmp (tok[0], "in") || !strcmp (tok[0], "out")) {
+		n = hex_bytes (tok + 1, ntok - 1, bytes, sizeof bytes);
+		do_data (tok[0][0] == 'o', bytes, n);
+	} else if (!strcmp (tok[0], "read") || !strcmp (tok[0], "write")) {
+		do_sectors (tok[0][0] == 'w', NUM (1));
+	} else if (!strcmp (tok[0], "cbw")) {
+		memset (cdb, 0, sizeof cdb);
+		n = hex_bytes (tok + 5, ntok - 5, cdb, 16);
+		do_cbw (NUM (1), NUM (2), NUM (3), ntok > 4 &&
+			!strcmp (tok[4], "in"), cdb, n);
+	} else if (!strcmp (tok[0], "csw")) {
+		do_csw (NUM (1), NUM (2));
+	} else if (!strcmp (tok[0], "fail")) {
+		fail_next = 1;
+	} else if (!strcmp (tok[0], "expect")) {
+		do_expect (tok[1], ntok > 2 ? NUM (2) : 0);
+	} else if (!strcmp (tok[0], "disconnect")) {
+		do_disconnect ();
+	} else {
+		fail ("unknown transaction %s", tok[0]);
+	}
+#undef NUM
+}
+
+static void
+emit (char *format, ...)
+{
+	char line[MAX_LINE];
+	va_list ap;
+
+	va_start (ap, format);
+	vsnprintf (line, sizeof line - 1, format, ap);
+	va_end (ap);
+	strcat (line, "\n");
+	if (verbose)
+		fputs (line, stdout);
+	replay_line (line);
+}
+
+static void
+replay_file (const char *name)
+{
+	char line[MAX_LINE];
+	FILE *f;
+
+	f = fopen (name, "r");
+	if (!f) {
+		perror (name);
+		exit (1);
+	}
+	trace_name = name;
+	trace_line = 0;
+	while (fgets (line, sizeof line, f))
+		replay_line (line);
+	fclose (f);
+	if (m.connected)
+		do_disconnect ();
+}
+
+/* --- random sessions --- */
+
+/* the commands the generated device has in flight */
+struct gcmd {
+	u16 tag;
+	int lun;
+	int dir;
+	u8 op;
+	u32 lba, count, done;
+	int ready;
+};
+
+static struct gcmd gcmd[MAX_INFLIGHT];
+static int ngcmd;
+static struct gcmd *gin, *gout;
+
+static int
+gtag_used (u16 tag)
+{
+	int i;
+
+	for (i = 0; i < ngcmd; i++)
+		if (gcmd[i].tag == tag)
+			return 1;
+	return 0;
+}
+
+static u16
+gtag (void)
+{
+	u16 tag;
+
+	do
+		tag = 1 + rnd () % 0x1FF;
+	while (gtag_used (tag));
+	return tag;
+}
+
+static void
+gremove (struct gcmd *c)
+{
+	if (gin == c)
+		gin = NULL;
+	if (gout == c)
+		gout = NULL;
+	*c = gcmd[--ngcmd];
+	if (gin == &gcmd[ngcmd])
+		gin = c;
+	if (gout == &gcmd[ngcmd])
+		gout = c;
+}
+
+static struct gcmd *
+gnew (int lunno, int dir, u8 op)
+{
+	struct gcmd *c = &gcmd[ngcmd++];
+
+	memset (c, 0, sizeof *c);
+	c->tag = gtag ();
+	c->lun = lunno;
+	c->dir = dir;
+	c->op = op;
+	c->count = 1;
+	return c;
+}
+
+static void
+gcapacity (int lunno)
+{
+	struct gcmd *c = gnew (lunno, DIR_IN, 0x25);
+	struct lun *l = &lun[lunno];
+
+	emit ("cmd %x %x 25", c->tag, lunno);
+	emit ("status rr %x", c->tag);
+	emit ("in %02x %02x %02x %02x %02x %02x %02x %02x",
+	      (l->nblocks - 1) >> 24, ((l->nblocks - 1) >> 16) & 0xFF,
+	      ((l->nblocks - 1) >> 8) & 0xFF, (l->nblocks - 1) & 0xFF,
+	      l->ss >> 24, (l->ss >> 16) & 0xFF, (l->ss >> 8) & 0xFF,
+	      l->ss & 0xFF);
+	emit ("status sense %x 0", c->tag);
+	gremove (c);
+}
+
+static void
+grw (int write)
+{
+	struct gcmd *c;
+	struct lun *l;
+	u32 max;
+	int lunno = rnd () % NLUN;
+
+	l = &lun[lunno];
+	max = MAX_WIRE / l->ss;
+	if (max > 32)
+		max = 32;
+	c = gnew (lunno, write ? DIR_OUT : DIR_IN, 0);
+	c->count = 1 + rnd () % max;
+	/* a small area is read and written often */
+	if (rnd () % 2)
+		c->lba = rnd () % (64 - c->count);
+	else
+		c->lba = rnd () % (l->nblocks - c->count);
+	if (rnd () % 4) {
+		c->op = write ? 0x2A : 0x28;
+		emit ("cmd %x %x %02x 0 %x %x %x %x 0 %x %x 0", c->tag, lunno,
+		      c->op, c->lba >> 24, (c->lba >> 16) & 0xFF,
+		      (c->lba >> 8) & 0xFF, c->lba & 0xFF, c->count >> 8,
+		      c->count & 0xFF);
+	} else {
+		c->op = write ? 0xAA : 0xA8;
+		emit ("cmd %x %x %02x 0 %x %x %x %x 0 0 %x %x 0 0", c->tag,
+		      lunno, c->op, c->lba >> 24, (c->lba >> 16) & 0xFF,
+		      (c->lba >> 8) & 0xFF, c->lba & 0xFF, c->count >> 8,
+		      c->count & 0xFF);
+	}
+}
+
+static void
+ginquiry (void)
+{
+	struct gcmd *c = gnew (rnd () % NLUN, DIR_IN, 0x12);
+
+	emit ("cmd %x %x 12 0 0 0 24 0", c->tag, c->lun);
+}
+
+/* the device moves the data of a command in one direction */
+static void
+gdata (int write)
+{
+	struct gcmd **cur = write ? &gout : &gin, *c;
+	char line[MAX_LINE];
+	int i, n, len;
+	u32 k;
+
+	if (!*cur || (*cur)->done == (*cur)->count) {
+		for (i = n = 0; i < ngcmd; i++)
+			if (gcmd[i].dir == (write ? DIR_OUT : DIR_IN) &&
+			    !gcmd[i].ready)
+				n++;
+		if (!n)
+			return;
+		n = rnd () % n;
+		for (i = 0; ; i++)
+			if (gcmd[i].dir == (write ? DIR_OUT : DIR_IN) &&
+			    !gcmd[i].ready && !n--)
+				break;
+		c = *cur = &gcmd[i];
+		c->ready = 1;
+		emit ("status %s %x", write ? "wr" : "rr", c->tag);
+		return;
+	}
+	c = *cur;
+	if (c->op == 0x12) {
+		len = snprintf (line, sizeof line, "in");
+		for (i = 0; i < 36; i++)
+			len += snprintf (line + len, sizeof line - len,
+					 " %x", (int)(rnd () & 0xFF));
+		emit ("%s", line);
+		c->done = c->count;
+		return;
+	}
+	k = 1 + rnd () % (c->count - c->done);
+	if (!(rnd () % 40))
+		emit ("fail");
+	emit ("%s %x", write ? "write" : "read", k);
+	c->done += k;
+}
+
+/* the device completes a command */
+static void
+gcomplete (void)
+{
+	struct gcmd *c;
+	int i, n;
+
+	if (!ngcmd)
+		return;
+	if (!(rnd () % 30)) {
+		c = &gcmd[rnd () % ngcmd];
+		emit ("status sense %x 2 70 0 5 0 0 0 0 a 0 0 0 0 24 0",
+		      c->tag);
+		gremove (c);
+		return;
+	}
+	for (i = n = 0; i < ngcmd; i++)
+		if (gcmd[i].ready && gcmd[i].done == gcmd[i].count)
+			n++;
+	if (!n)
+		return;
+	n = rnd () % n;
+	for (i = 0; ; i++)
+		if (gcmd[i].ready && gcmd[i].done == gcmd[i].count && !n--)
+			break;
+	emit ("status sense %x 0", gcmd[i].tag);
+	gremove (&gcmd[i]);
+}
+
+/* the guest aborts a command or resets a logical unit */
+static void
+gabort (void)
+{
+	struct gcmd *c;
+	u16 tag;
+	int i, lunno;
+
+	if (!ngcmd)
+		return;
+	if (!(rnd () % 5)) {
+		lunno = rnd () % NLUN;
+		tag = gtag ();
+		emit ("task %x 8 0 %x", tag, lunno);
+		emit ("status resp %x 0", tag);
+		for (i = ngcmd - 1; i >= 0; i--)
+			if (gcmd[i].lun == lunno)
+				gremove (&gcmd[i]);
+		return;
+	}
+	c = &gcmd[rnd () % ngcmd];
+	/* the task management function takes a tag of its own */
+	tag = c->tag;
+	c->tag = gtag ();
+	emit ("task %x 1 %x", c->tag, tag);
+	emit ("status resp %x 0", c->tag);
+	gremove (c);
+}
+
+static void
+gsecurity (void)
+{
+	emit ("cmd %x 0 %s", gtag (), rnd () % 2 ? "a2 ef 0 1" : "b5 ef 0 1");
+}
+
+static void
+gdrain (void)
+{
+	while (ngcmd) {
+		if (gin)
+			gdata (0);
+		else if (gout)
+			gdata (1);
+		else if (rnd () % 2)
+			gdata (rnd () % 2);
+		gcomplete ();
+	}
+}
+
+/* a few commands on the Bulk-only interface */
+static void
+gbot (void)
+{
+	struct lun *l;
+	u32 tag, lba, count, done, k;
+	int i, lunno, write;
+
+	if (rnd () % 2)
+		gdrain ();
+	ngcmd = 0;
+	gin = gout = NULL;
+	emit ("alt 0");
+	if (!(rnd () % 4)) {
+		emit ("alt 1");
+		return;
+	}
+	for (i = 0; i < 4; i++) {
+		lunno = rnd () % NLUN;
+		l = &lun[lunno];
+		write = rnd () % 2;
+		count = 1 + rnd () % (MAX_WIRE / l->ss > 16 ? 16 :
+				      MAX_WIRE / l->ss);
+		lba = rnd () % (64 - count);
+		tag = rnd ();
+		emit ("cbw %x %x %x %s %02x 0 %x %x %x %x 0 %x %x 0",
+		      tag, lunno, count * l->ss,
+		      write ? "out" : "in", write ? 0x2A : 0x28, lba >> 24,
+		      (lba >> 16) & 0xFF, (lba >> 8) & 0xFF, lba & 0xFF,
+		      count >> 8, count & 0xFF);
+		for (done = 0; done < count; done += k) {
+			k = 1 + rnd () % (count - done);
+			if (!(rnd () % 40))
+				emit ("fail");
+			emit ("%s %x", write ? "write" : "read", k);
+		}
+		emit ("csw %x 0", tag);
+	}
+	if (!(rnd () % 8))
+		emit ("cbw 1 %x 0 out a2 ef 0 1", (int)(rnd () % NLUN));
+	emit ("alt 1");
+}
+
+static void
+gsession_start (void)
+{
+	int i;
+
+	ngcmd = 0;
+	gin = gout = NULL;
+	emit ("connect %s%s", rnd () % 2 ? "ehci" : "uhci",
+	      rnd () % 4 ? "" : " nousage");
+	emit ("maxlun %x", NLUN - 1);
+	emit ("alt 1");
+	for (i = 0; i < NLUN; i++)
+		gcapacity (i);
+}
+
+static void
+generate (unsigned long steps)
+{
+	unsigned long i;
+	int r;
+
+	trace_name = "random";
+	gsession_start ();
+	for (i = 0; i < steps; i++) {
+		r = rnd () % 1000;
+		if (r < 200) {
+			if (ngcmd < MAX_INFLIGHT)
+				grw (rnd () % 2);
+		} else if (r < 220) {
+			if (ngcmd < MAX_INFLIGHT)
+				ginquiry ();
+		} else if (r < 480) {
+			gdata (0);
+		} else if (r < 740) {
+			gdata (1);
+		} else if (r < 960) {
+			gcomplete ();
+		} else if (r < 985) {
+			gabort ();
+		} else if (r < 990) {
+			gsecurity ();
+		} else if (r < 996) {
+			gbot ();
+		} else if (r < 997) {
+			/* SetInterface resets the interface */
+			ngcmd = 0;
+			gin = gout = NULL;
+			emit ("alt 1");
+		} else if (r < 999) {
+			emit ("expect cmds %x", ncmds ());
+		} else {
+			gdrain ();
+			emit ("disconnect");
+			gsession_start ();
+		}
+	}
+	gdrain ();
+	emit ("expect cmds 0");
+	emit ("disconnect");
+}
+
+/* every sector the guest wrote is on the media encrypted */
+static void
+check_media (void)
+{
+	u8 buf[4096];
+	u32 i, n;
+	int j;
+
+	for (j = 0; j < NLUN; j++) {
+		for (i = n = 0; i < lun[j].nblocks; i++) {
+			if (!lun[j].known[i])
+				continue;
+			memcpy (buf, lun[j].truth + i * lun[j].ss, lun[j].ss);
+			sim_cipher (i, lun[j].ss, buf);
+			if (memcmp (buf, lun[j].media + i * lun[j].ss,
+				    lun[j].ss))
+				fail ("lun %d lba %u not encrypted", j, i);
+			n++;
+		}
+		if (verbose)
+			printf ("lun %d: %u sectors written\n", j, n);
+	}
+}
+
+static void
+usage (void)
+{
+	fprintf (stderr, "usage: uassim [-v] [-s seed] [-n steps]"
+		 " [-w trace] [trace ...]\n");
+	exit (2);
+}
+
+int
+main (int argc, char **argv)
+{
+	unsigned long steps = DEFAULT_STEPS;
+	struct sigaction sa;
+	char *savename = NULL;
+	int c, fd, i, left;
+
+	while ((c = getopt (argc, argv, "n:s:vw:")) != -1) {
+		switch (c) {
+		case 'n':
+			steps = strtoul (optarg, NULL, 0);
+			break;
+		case 's':
+			rnd_state = mix (strtoull (optarg, NULL, 0)) | 1;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'w':
+			savename = optarg;
+			break;
+		default:
+			usage ();
+		}
+	}
+	if (savename) {
+		save = fopen (savename, "w");
+		if (!save) {
+			perror (savename);
+			return 1;
+		}
+	}
+	fd = memfd_create ("guest", 0);
+	if (fd < 0 || ftruncate (fd, GUEST_SIZE) < 0) {
+		perror ("memfd");
+		return 1;
+	}
+	guest_rw = mmap (NULL, GUEST_SIZE, PROT_READ | PROT_WRITE,
+			 MAP_SHARED, fd, 0);
+	guest_vmm = mmap (NULL, GUEST_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+	if (guest_rw == MAP_FAILED || guest_vmm == MAP_FAILED) {
+		perror ("mmap");
+		return 1;
+	}
+	memset (&sa, 0, sizeof sa);
+	sa.sa_sigaction = segv;
+	sa.sa_flags = SA_SIGINFO;
+	sigaction (SIGSEGV, &sa, NULL);
+	lun[0].ss = 512;
+	lun[0].nblocks = 4096;
+	lun[1].ss = 4096;
+	lun[1].nblocks = 1024;
+	for (i = 0; i < NLUN; i++) {
+		lun[i].media = malloc ((size_t)lun[i].ss * lun[i].nblocks);
+		lun[i].truth = malloc ((size_t)lun[i].ss * lun[i].nblocks);
+		lun[i].known = calloc (lun[i].nblocks, 1);
+		if (!lun[i].media || !lun[i].truth || !lun[i].known) {
+			perror ("malloc");
+			return 1;
+		}
+		fill (lun[i].media, lun[i].ss * lun[i].nblocks);
+	}
+	sim_init ();
+	init_allocs = allocs;
+	if (optind < argc)
+		for (i = optind; i < argc; i++)
+			replay_file (argv[i]);
+	else
+		generate (steps);
+	if (save)
+		fclose (save);
+	check_media ();
+	left = sim_shutdown ();
+	if (left)
+		fail ("%d storages or hooks left", left);
+	if (allocs || nmaps)
+		fail ("%ld allocations and %d mappings left", allocs, nmaps);
+	printf ("uassim: %llu transactions, %llu commands, %llu reads,"
+		" %llu writes, %llu sectors, %llu storage failures,"
+		" %llu halts, %llu aborts, %llu Bulk-only\n",
+		stat.lines, stat.commands, stat.reads, stat.writes,
+		stat.sectors, stat.failures, stat.halts, stat.aborts,
+		stat.bot);
+	printf ("uassim: ok\n");
+	return 0;
+}
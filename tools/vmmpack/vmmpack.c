@@ -0,0 +1,541 @@
+/*
+ * Copyright (c) 2007, 2008 University of Tsukuba
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the University of Tsukuba nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pack bitvisor.elf for the UEFI loader (see core/vmmpack.h).  the
+   packed image is decompressed again and compared with the input
+   before it is written */
+
+#include <elf.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define VMMPACK_MAGIC		"BVMMPACK"
+#define VMMPACK_VERSION		2
+#define VMMPACK_OFFSET		0x10000
+#define VMMPACK_BLOCKSIZE	0x10000
+#define LZ4_MINMATCH		4
+#define LZ4_LASTLITERALS	5
+#define LZ4_MFLIMIT		12
+#define LZ4_MAXOFFSET		65535
+#define HASH_BITS		16
+
+struct vmmpack_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t offset;
+	uint64_t size;
+	uint64_t packed_size;
+	unsigned char sha256[32];
+} __attribute__ ((packed));
+
+struct vmmpack_block {
+	uint32_t csize;
+	uint32_t usize;
+} __attribute__ ((packed));
+
+static const uint32_t sha256_k[64] = {
+	0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5,
+	0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+	0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3,
+	0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+	0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC,
+	0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+	0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7,
+	0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+	0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13,
+	0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+	0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3,
+	0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+	0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5,
+	0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+	0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208,
+	0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2,
+};
+
+static uint32_t hashtab[1 << HASH_BITS];
+
+#define ROR32(x, n) ((x) >> (n) | (x) << (32 - (n)))
+
+static void
+sha256_blocks (uint32_t *state, const unsigned char *data, uint64_t n)
+{
+	uint32_t w[64], a, b, c, d, e, f, g, h, s0, s1, t1, t2;
+	int i;
+
+	for (; n; n--, data += 64) {
+		for (i = 0; i < 16; i++)
+			w[i] = (uint32_t)data[i * 4] << 24 |
+				(uint32_t)data[i * 4 + 1] << 16 |
+				(uint32_t)data[i * 4 + 2] << 8 | data[i * 4 + 3];
+		for (; i < 64; i++) {
+			s0 = ROR32 (w[i - 15], 7) ^ ROR32 (w[i - 15], 18) ^
+				(w[i - 15] >> 3);
+			s1 = ROR32 (w[i - 2], 17) ^ ROR32 (w[i - 2], 19) ^
+				(w[i - 2] >> 10);
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+		a = state[0]; b = state[1]; c = state[2]; d = state[3];
+		e = state[4]; f = state[5]; g = state[6]; h = state[7];
+		for (i = 0; i < 64; i++) {
+			t1 = h + (ROR32 (e, 6) ^ ROR32 (e, 11) ^ ROR32 (e, 25)) +
+				((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+			t2 = (ROR32 (a, 2) ^ ROR32 (a, 13) ^ ROR32 (a, 22)) +
+				((a & b) ^ (a & c) ^ (b & c));
+			h = g; g = f; f = e; e = d + t1;
+			d = c; c = b; b = a; a = t1 + t2;
+		}
+		state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+		state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+	}
+}
+
+static void
+sha256 (const unsigned char *data, uint64_t len, unsigned char *digest)
+{
+	uint32_t state[8] = {
+		0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+		0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19,
+	};
+	unsigned char buf[128];
+	uint64_t n = len / 64, bits = len * 8;
+	uint32_t rest = len % 64;
+	int i, nb;
+
+	sha256_blocks (state, data, n);
+	nb = rest < 56 ? 1 : 2;
+	memset (buf, 0, sizeof buf);
+	memcpy (buf, data + n * 64, rest);
+	buf[rest] = 0x80;
+	for (i = 0; i < 8; i++)
+		buf[nb * 64 - 1 - i] = bits >> (i * 8);
+	sha256_blocks (state, buf, nb);
+	for (i = 0; i < 32; i++)
+		digest[i] = state[i / 4] >> (24 - i % 4 * 8);
+}
+
+/* digest of an image with the header at hoff, like vmmpack_verify()
+   computes it: the sha256 field is cleared while hashing */
+static void
+image_sha256 (unsigned char *image, size_t hoff, uint64_t len,
+	      unsigned char *digest)
+{
+	struct vmmpack_header *h;
+	unsigned char save[32];
+
+	h = (struct vmmpack_header *)(image + hoff);
+	memcpy (save, h->sha256, sizeof save);
+	memset (h->sha256, 0, sizeof h->sha256);
+	sha256 (image, len, digest);
+	memcpy (h->sha256, save, sizeof save);
+}
+
+static unsigned char *
+lz4_length (unsigned char *op, size_t len)
+{
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = len;
+	return op;
+}
+
+static unsigned char *
+lz4_sequence (unsigned char *op, const unsigned char *lit, size_t litlen,
+	      size_t off, size_t matchlen)
+{
+	unsigned char *token = op++;
+
+	*token = (litlen < 15 ? litlen : 15) << 4;
+	if (litlen >= 15)
+		op = lz4_length (op, litlen - 15);
+	memcpy (op, lit, litlen);
+	op += litlen;
+	if (!matchlen)
+		return op;
+	*op++ = off;
+	*op++ = off >> 8;
+	matchlen -= LZ4_MINMATCH;
+	*token |= matchlen < 15 ? matchlen : 15;
+	if (matchlen >= 15)
+		op = lz4_length (op, matchlen - 15);
+	return op;
+}
+
+static uint32_t
+read32 (const unsigned char *p)
+{
+	uint32_t v;
+
+	memcpy (&v, p, sizeof v);
+	return v;
+}
+
+/* greedy LZ4 block compression of base[start, end).  matches may
+   refer to bytes before start.  returns the compressed size */
+static size_t
+lz4_compress (const unsigned char *base, size_t start, size_t end,
+	      unsigned char *out)
+{
+	unsigned char *op = out;
+	size_t ip = start, anchor = start, ref, len;
+	uint32_t seq, h;
+
+	while (ip + LZ4_MFLIMIT <= end) {
+		seq = read32 (base + ip);
+		h = (seq * 2654435761U) >> (32 - HASH_BITS);
+		ref = hashtab[h];
+		hashtab[h] = ip + 1;
+		if (!ref-- || ip - ref > LZ4_MAXOFFSET ||
+		    read32 (base + ref) != seq) {
+			ip++;
+			continue;
+		}
+		len = LZ4_MINMATCH;
+		while (ip + len < end - LZ4_LASTLITERALS &&
+		       base[ref + len] == base[ip + len])
+			len++;
+		op = lz4_sequence (op, base + anchor, ip - anchor, ip - ref,
+				   len);
+		ip += len;
+		anchor = ip;
+	}
+	return lz4_sequence (op, base + anchor, end - anchor, 0, 0) - out;
+}
+
+static int
+lz4_decompress (const unsigned char *src, size_t srclen, unsigned char *base,
+		size_t dst, size_t dstend)
+{
+	const unsigned char *srcend = src + srclen;
+	size_t len, off;
+	unsigned char token, b;
+
+	while (src < srcend) {
+		token = *src++;
+		len = token >> 4;
+		if (len == 15)
+			do {
+				if (src >= srcend)
+					return -1;
+				b = *src++;
+				len += b;
+			} while (b == 255);
+		if (len > (size_t)(srcend - src) || len > dstend - dst)
+			return -1;
+		memcpy (base + dst, src, len);
+		src += len;
+		dst += len;
+		if (src == srcend)
+			break;
+		if (srcend - src < 2)
+			return -1;
+		off = src[0] | src[1] << 8;
+		src += 2;
+		if (!off || off > dst)
+			return -1;
+		len = token & 15;
+		if (len == 15)
+			do {
+				if (src >= srcend)
+					return -1;
+				b = *src++;
+				len += b;
+			} while (b == 255);
+		len += LZ4_MINMATCH;
+		if (len > dstend - dst)
+			return -1;
+		if (off >= 8)
+			for (; len >= 8; len -= 8, dst += 8)
+				memcpy (base + dst, base + dst - off, 8);
+		for (; len > 0; len--, dst++)
+			base[dst] = base[dst - off];
+	}
+	return dst == dstend ? 0 : -1;
+}
+
+static double
+now (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static unsigned char *
+read_file (char *name, size_t *len)
+{
+	unsigned char *buf;
+	FILE *fp;
+	long n;
+
+	fp = fopen (name, "rb");
+	if (!fp || fseek (fp, 0, SEEK_END) || (n = ftell (fp)) < 0 ||
+	    fseek (fp, 0, SEEK_SET)) {
+		perror (name);
+		exit (1);
+	}
+	buf = malloc (n + 1);
+	if (!buf || fread (buf, 1, n, fp) != n) {
+		fprintf (stderr, "%s: read error\n", name);
+		exit (1);
+	}
+	fclose (fp);
+	*len = n;
+	return buf;
+}
+
+static void
+write_file (char *name, unsigned char *buf, size_t len)
+{
+	FILE *fp;
+
+	fp = fopen (name, "wb");
+	if (!fp || fwrite (buf, 1, len, fp) != len || fclose (fp)) {
+		perror (name);
+		exit (1);
+	}
+}
+
+/* file offset of a symbol in the first PT_LOAD segment */
+static int
+elf_symbol (unsigned char *elf, size_t len, char *name, uint64_t *off)
+{
+	Elf64_Ehdr *eh = (Elf64_Ehdr *)elf;
+	Elf64_Shdr *sh;
+	Elf64_Phdr *ph;
+	Elf64_Sym *sym;
+	char *str;
+	int i, j, n;
+
+	if (len < sizeof *eh || memcmp (eh->e_ident, ELFMAG, SELFMAG) ||
+	    eh->e_ident[EI_CLASS] != ELFCLASS64 ||
+	    eh->e_shoff + (uint64_t)eh->e_shnum * sizeof *sh > len ||
+	    eh->e_phoff + (uint64_t)eh->e_phnum * sizeof *ph > len)
+		return -1;
+	ph = (Elf64_Phdr *)(elf + eh->e_phoff);
+	for (i = 0; i < eh->e_phnum && ph[i].p_type != PT_LOAD; i++);
+	if (i == eh->e_phnum)
+		return -1;
+	sh = (Elf64_Shdr *)(elf + eh->e_shoff);
+	for (j = 0; j < eh->e_shnum; j++) {
+		if (sh[j].sh_type != SHT_SYMTAB || sh[j].sh_link >= eh->e_shnum)
+			continue;
+		sym = (Elf64_Sym *)(elf + sh[j].sh_offset);
+		str = (char *)elf + sh[sh[j].sh_link].sh_offset;
+		n = sh[j].sh_size / sizeof *sym;
+		while (n-- > 0) {
+			if (sym[n].st_name >= sh[sh[j].sh_link].sh_size ||
+			    strcmp (str + sym[n].st_name, name))
+				continue;
+			*off = sym[n].st_value - ph[i].p_vaddr + ph[i].p_offset;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static int
+unpack (char *inname, char *outname)
+{
+	struct vmmpack_header h;
+	struct vmmpack_block blk;
+	unsigned char *in, *out, digest[32];
+	size_t len, hoff, pos, dst;
+
+	in = read_file (inname, &len);
+	for (hoff = 0; hoff + sizeof h <= VMMPACK_OFFSET && hoff + sizeof h
+		     <= len; hoff++)
+		if (!memcmp (in + hoff, VMMPACK_MAGIC, sizeof h.magic) &&
+		    in[hoff + sizeof h.magic] == VMMPACK_VERSION)
+			break;
+	if (hoff + sizeof h > VMMPACK_OFFSET || hoff + sizeof h > len) {
+		fprintf (stderr, "%s: not a packed image\n", inname);
+		return 1;
+	}
+	memcpy (&h, in + hoff, sizeof h);
+	if (h.version != VMMPACK_VERSION || h.offset != VMMPACK_OFFSET ||
+	    h.offset > len ||
+	    h.packed_size > len - h.offset) {
+		fprintf (stderr, "%s: bad header\n", inname);
+		return 1;
+	}
+	out = malloc (h.offset + h.size);
+	if (!out) {
+		fprintf (stderr, "out of memory\n");
+		return 1;
+	}
+	memcpy (out, in, h.offset);
+	pos = h.offset;
+	dst = h.offset;
+	while (dst < h.offset + h.size) {
+		if (len - pos < sizeof blk)
+			goto corrupt;
+		memcpy (&blk, in + pos, sizeof blk);
+		pos += sizeof blk;
+		if (blk.csize > len - pos ||
+		    blk.usize > h.offset + h.size - dst ||
+		    lz4_decompress (in + pos, blk.csize, out, dst,
+				    dst + blk.usize))
+			goto corrupt;
+		pos += blk.csize;
+		dst += blk.usize;
+	}
+	image_sha256 (out, hoff, h.offset + h.size, digest);
+	if (memcmp (digest, h.sha256, sizeof digest)) {
+		fprintf (stderr, "%s: digest mismatch\n", inname);
+		return 1;
+	}
+	memset (out + hoff, 0, sizeof h);
+	write_file (outname, out, h.offset + h.size);
+	return 0;
+corrupt:
+	fprintf (stderr, "%s: corrupted at offset 0x%zX\n", inname, pos);
+	return 1;
+}
+
+static int
+pack (char *inname, char *outname)
+{
+	struct vmmpack_header h;
+	struct vmmpack_block blk;
+	unsigned char *elf, *out, *check, *op, digest[32];
+	uint64_t hoff, head, dataend;
+	size_t len, pos, n, outlen;
+	double t;
+
+	elf = read_file (inname, &len);
+	if (elf_symbol (elf, len, "vmmpack_header", &hoff) ||
+	    elf_symbol (elf, len, "head", &head) ||
+	    elf_symbol (elf, len, "dataend", &dataend)) {
+		fprintf (stderr, "%s: symbols not found\n", inname);
+		return 1;
+	}
+	if (head != 0 || dataend > len || dataend <= VMMPACK_OFFSET ||
+	    hoff + sizeof h > VMMPACK_OFFSET) {
+		fprintf (stderr, "%s: unexpected layout\n", inname);
+		return 1;
+	}
+	memset (&h, 0, sizeof h);
+	memcpy (h.magic, VMMPACK_MAGIC, sizeof h.magic);
+	h.version = VMMPACK_VERSION;
+	h.offset = VMMPACK_OFFSET;
+	h.size = dataend - VMMPACK_OFFSET;
+	n = (h.size + VMMPACK_BLOCKSIZE - 1) / VMMPACK_BLOCKSIZE;
+	out = malloc (h.offset + h.size + n * (sizeof blk + 16 +
+					       VMMPACK_BLOCKSIZE / 255));
+	if (!out) {
+		fprintf (stderr, "out of memory\n");
+		return 1;
+	}
+	t = now ();
+	op = out + h.offset;
+	for (pos = h.offset; pos < dataend; pos += blk.usize) {
+		blk.usize = dataend - pos < VMMPACK_BLOCKSIZE ?
+			dataend - pos : VMMPACK_BLOCKSIZE;
+		blk.csize = lz4_compress (elf, pos, pos + blk.usize,
+					  op + sizeof blk);
+		memcpy (op, &blk, sizeof blk);
+		op += sizeof blk + blk.csize;
+	}
+	outlen = op - out;
+	h.packed_size = outlen - h.offset;
+	memcpy (elf + hoff, &h, sizeof h);
+	sha256 (elf, dataend, h.sha256);
+	memcpy (out, elf, h.offset);
+	memcpy (out + hoff, &h, sizeof h);
+	printf ("compress %.1f ms\n", now () - t);
+
+	/* round trip */
+	write_file (outname, out, outlen);
+	t = now ();
+	check = malloc (dataend);
+	if (!check) {
+		fprintf (stderr, "out of memory\n");
+		return 1;
+	}
+	memcpy (check, out, h.offset);
+	for (pos = h.offset, op = out + h.offset; pos < dataend;
+	     pos += blk.usize, op += sizeof blk + blk.csize) {
+		memcpy (&blk, op, sizeof blk);
+		if (lz4_decompress (op + sizeof blk, blk.csize, check, pos,
+				    pos + blk.usize)) {
+			fprintf (stderr, "round trip: decode error at 0x%zX\n",
+				 pos);
+			goto err;
+		}
+	}
+	printf ("decompress %.1f ms\n", now () - t);
+	t = now ();
+	image_sha256 (check, hoff, dataend, digest);
+	printf ("sha256 %.1f ms\n", now () - t);
+	if (memcmp (check + h.offset, elf + h.offset, h.size) ||
+	    memcmp (digest, h.sha256, sizeof digest)) {
+		fprintf (stderr, "round trip: mismatch\n");
+		goto err;
+	}
+	printf ("%s: image %zu bytes, packed %zu bytes (%.1f%%)\n", outname,
+		(size_t)dataend, outlen, outlen * 100.0 / dataend);
+	return 0;
+err:
+	unlink (outname);
+	return 1;
+}
+
+static void
+usage (char *name)
+{
+	fprintf (stderr, "usage: %s bitvisor.elf bitvisor.pak\n"
+		 "       %s -d bitvisor.pak image\n", name, name);
+	exit (2);
+}
+
+int
+main (int argc, char **argv)
+{
+	int c, dflag = 0;
+
+	while ((c = getopt (argc, argv, "d")) != -1) {
+		switch (c) {
+		case 'd':
+			dflag = 1;
+			break;
+		default:
+			usage (argv[0]);
+		}
+	}
+	if (argc - optind != 2)
+		usage (argv[0]);
+	if (dflag)
+		return unpack (argv[optind], argv[optind + 1]);
+	return pack (argv[optind], argv[optind + 1]);
+}
@@ -32,6 +32,7 @@
 #include <core/cpu.h>
 #include <core/iccard.h>
 #include <core/process.h>
+#include <core/random.h>
 #include <core/time.h>
 #include <core/timer.h>
 #include <net/netapi.h>
@@ -56,7 +57,8 @@ struct vpndata {
 
 #ifdef VPN_PD
 static struct mempool *mp;
-static int vpnkernel_desc, desc;
+static int vpnkernel_desc;
+static struct msgcache vpn_msg = MSGCACHE_INITIALIZER ("vpn");
 static void *handle[NUM_OF_HANDLE];
 static spinlock_t handle_lock;	/* new only */
 static SE_HANDLE vpn_timer_handle;
@@ -64,10 +66,11 @@ static SE_HANDLE vpn_timer_handle;
 static void
 callsub (int c, struct msgbuf *buf, int bufcnt)
 {
-	int r;
+	int d, r;
 
 	for (;;) {
-		r = msgsendbuf (desc, c, buf, bufcnt);
+		d = msgcache_open (&vpn_msg);
+		r = d >= 0 ? msgsendbuf (d, c, buf, bufcnt) : -1;
 		if (r == 0)
 			break;
 		panic ("vpn msgsendbuf failed (%d)", c);
@@ -423,6 +426,17 @@ vpnkernel_msghandler (int m, int c, struct msgbuf *buf, int bufcnt)
 		arg->retval = vpn_GetTickCount ();
 		arg->cpu = get_cpu_id ();
 		return 0;
+	} else if (c == VPNKERNEL_MSG_GETRANDOM) {
+		struct vpnkernel_msg_getrandom *arg;
+
+		if (bufcnt != 2)
+			return -1;
+		if (buf[0].len != sizeof *arg)
+			return -1;
+		arg = buf[0].base;
+		vpn_GetRandom (buf[1].base, buf[1].len);
+		arg->cpu = get_cpu_id ();
+		return 0;
 	} else {
 		return -1;
 	}
@@ -446,6 +460,12 @@ vpn_GetTickCount (void)
 	return (UINT)q[0];
 }
 
+void
+vpn_GetRandom (void *buf, UINT size)
+{
+	random_bytes (buf, size);
+}
+
 SE_HANDLE
 vpn_NewTimer (SE_SYS_CALLBACK_TIMER *callback, void *param)
 {
@@ -579,7 +599,7 @@ vpn_premap_recvbuf (void *handle, void *buf, unsigned int len)
 	struct msgbuf mbuf;
 
 	setmsgbuf (&mbuf, buf, len, 0);
-	return msgpremapbuf (desc, &mbuf);
+	return msgpremapbuf (msgcache_open (&vpn_msg), &mbuf);
 #endif /* VPN_PD */
 	return 0;
 }
@@ -653,6 +673,7 @@ static void
 vpn_kernel_init (void)
 {
 	void vpn_user_init (struct config_data_vpn *vpn, char *seed, int len);
+	char *seed;
 
 #ifdef VPN_PD
 	int i;
@@ -665,11 +686,13 @@ vpn_kernel_init (void)
 	if (vpnkernel_desc < 0)
 		panic ("register vpnkernel");
 #endif /* VPN_PD */
-	vpn_user_init (&config.vpn, config.vmm.randomSeed,
-		       sizeof config.vmm.randomSeed);
+	seed = alloc (sizeof config.vmm.randomSeed);
+	random_bytes (seed, sizeof config.vmm.randomSeed);
+	vpn_user_init (&config.vpn, seed, sizeof config.vmm.randomSeed);
+	memset (seed, 0, sizeof config.vmm.randomSeed);
+	free (seed);
 #ifdef VPN_PD
-	desc = msgopen ("vpn");
-	if (desc < 0)
+	if (msgcache_open (&vpn_msg) < 0)
 		panic ("open vpn");
 #endif
 	net_register ("vpn", &vpn_func, NULL);
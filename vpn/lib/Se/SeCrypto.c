@@ -1750,6 +1750,12 @@ void SeRand(void *buf, UINT size)
 		return;
 	}
 
+	// VMM の CPU ごとの乱数生成器を優先して使用する
+	if (SeSysGetRandom(buf, size))
+	{
+		return;
+	}
+
 	RAND_bytes(buf, size);
 }
 UINT64 SeRand64()
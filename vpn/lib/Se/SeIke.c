@@ -106,6 +106,10 @@ UINT SeIkeStrToPhase1Mode(char *name)
 	{
 		return SE_IKE_EXCHANGE_TYPE_AGGRESSIVE;
 	}
+	else if (SeStrCmp(name, "IKEv2") == 0)
+	{
+		return SE_IKE2_EXCHANGE_TYPE_IKE_SA_INIT;
+	}
 	else
 	{
 		return 0;
@@ -603,6 +607,49 @@ SE_BUF *SeIkeBuildPayload(SE_IKE_PACKET_PAYLOAD *p)
 	case SE_IKE_PAYLOAD_VENDOR_ID:			// ベンダ ID ペイロード
 		b = SeIkeBuildDataPayload(&p->Payload.GeneralData);
 		break;
+
+	case SE_IKE2_PAYLOAD_SA:				// IKEv2 SA ペイロード
+		b = SeIke2BuildSaPayload(&p->Payload.Sa2);
+		break;
+
+	case SE_IKE2_PAYLOAD_KEY_EXCHANGE:		// IKEv2 鍵交換ペイロード
+		b = SeIke2BuildKeyExchangePayload(&p->Payload.KeyExchange2);
+		break;
+
+	case SE_IKE2_PAYLOAD_ID_I:				// IKEv2 ID ペイロード
+	case SE_IKE2_PAYLOAD_ID_R:
+		b = SeIkeBuildIdPayload(&p->Payload.Id);
+		break;
+
+	case SE_IKE2_PAYLOAD_CERT:				// IKEv2 証明書ペイロード
+		b = SeIkeBuildCertPayload(&p->Payload.Cert);
+		break;
+
+	case SE_IKE2_PAYLOAD_CERT_REQUEST:		// IKEv2 証明書要求ペイロード
+		b = SeIkeBuildCertRequestPayload(&p->Payload.CertRequest);
+		break;
+
+	case SE_IKE2_PAYLOAD_AUTH:				// IKEv2 認証ペイロード
+		b = SeIke2BuildAuthPayload(&p->Payload.Auth);
+		break;
+
+	case SE_IKE2_PAYLOAD_NOTICE:			// IKEv2 通知ペイロード
+		b = SeIke2BuildNoticePayload(&p->Payload.Notice);
+		break;
+
+	case SE_IKE2_PAYLOAD_DELETE:			// IKEv2 削除ペイロード
+		b = SeIke2BuildDeletePayload(&p->Payload.Delete);
+		break;
+
+	case SE_IKE2_PAYLOAD_TS_I:				// IKEv2 トラフィックセレクタペイロード
+	case SE_IKE2_PAYLOAD_TS_R:
+		b = SeIke2BuildTsPayload(&p->Payload.Ts);
+		break;
+
+	case SE_IKE2_PAYLOAD_NONCE:				// IKEv2 Nonce ペイロード
+	case SE_IKE2_PAYLOAD_VENDOR_ID:			// IKEv2 ベンダ ID ペイロード
+		b = SeIkeBuildDataPayload(&p->Payload.GeneralData);
+		break;
 	}
 
 	if (b != NULL)
@@ -970,6 +1017,49 @@ SE_IKE_PACKET_PAYLOAD *SeIkeParsePayload(UINT payload_type, SE_BUF *b)
 	case SE_IKE_PAYLOAD_VENDOR_ID:			// ベンダ ID ペイロード
 		ok = SeIkeParseDataPayload(&p->Payload.GeneralData, b);
 		break;
+
+	case SE_IKE2_PAYLOAD_SA:				// IKEv2 SA ペイロード
+		ok = SeIke2ParseSaPayload(&p->Payload.Sa2, b);
+		break;
+
+	case SE_IKE2_PAYLOAD_KEY_EXCHANGE:		// IKEv2 鍵交換ペイロード
+		ok = SeIke2ParseKeyExchangePayload(&p->Payload.KeyExchange2, b);
+		break;
+
+	case SE_IKE2_PAYLOAD_ID_I:				// IKEv2 ID ペイロード
+	case SE_IKE2_PAYLOAD_ID_R:
+		ok = SeIkeParseIdPayload(&p->Payload.Id, b);
+		break;
+
+	case SE_IKE2_PAYLOAD_CERT:				// IKEv2 証明書ペイロード
+		ok = SeIkeParseCertPayload(&p->Payload.Cert, b);
+		break;
+
+	case SE_IKE2_PAYLOAD_CERT_REQUEST:		// IKEv2 証明書要求ペイロード
+		ok = SeIkeParseCertRequestPayload(&p->Payload.CertRequest, b);
+		break;
+
+	case SE_IKE2_PAYLOAD_AUTH:				// IKEv2 認証ペイロード
+		ok = SeIke2ParseAuthPayload(&p->Payload.Auth, b);
+		break;
+
+	case SE_IKE2_PAYLOAD_NOTICE:			// IKEv2 通知ペイロード
+		ok = SeIke2ParseNoticePayload(&p->Payload.Notice, b);
+		break;
+
+	case SE_IKE2_PAYLOAD_DELETE:			// IKEv2 削除ペイロード
+		ok = SeIke2ParseDeletePayload(&p->Payload.Delete, b);
+		break;
+
+	case SE_IKE2_PAYLOAD_TS_I:				// IKEv2 トラフィックセレクタペイロード
+	case SE_IKE2_PAYLOAD_TS_R:
+		ok = SeIke2ParseTsPayload(&p->Payload.Ts, b);
+		break;
+
+	case SE_IKE2_PAYLOAD_NONCE:				// IKEv2 Nonce ペイロード
+	case SE_IKE2_PAYLOAD_VENDOR_ID:			// IKEv2 ベンダ ID ペイロード
+		ok = SeIkeParseDataPayload(&p->Payload.GeneralData, b);
+		break;
 	}
 
 	if (ok == false)
@@ -1593,6 +1683,49 @@ void SeIkeFreePayload(SE_IKE_PACKET_PAYLOAD *p)
 	case SE_IKE_PAYLOAD_VENDOR_ID:			// ベンダ ID ペイロード
 		SeIkeFreeDataPayload(&p->Payload.GeneralData);
 		break;
+
+	case SE_IKE2_PAYLOAD_SA:				// IKEv2 SA ペイロード
+		SeIke2FreeSaPayload(&p->Payload.Sa2);
+		break;
+
+	case SE_IKE2_PAYLOAD_KEY_EXCHANGE:		// IKEv2 鍵交換ペイロード
+		SeIke2FreeKeyExchangePayload(&p->Payload.KeyExchange2);
+		break;
+
+	case SE_IKE2_PAYLOAD_ID_I:				// IKEv2 ID ペイロード
+	case SE_IKE2_PAYLOAD_ID_R:
+		SeIkeFreeIdPayload(&p->Payload.Id);
+		break;
+
+	case SE_IKE2_PAYLOAD_CERT:				// IKEv2 証明書ペイロード
+		SeIkeFreeCertPayload(&p->Payload.Cert);
+		break;
+
+	case SE_IKE2_PAYLOAD_CERT_REQUEST:		// IKEv2 証明書要求ペイロード
+		SeIkeFreeCertRequestPayload(&p->Payload.CertRequest);
+		break;
+
+	case SE_IKE2_PAYLOAD_AUTH:				// IKEv2 認証ペイロード
+		SeIke2FreeAuthPayload(&p->Payload.Auth);
+		break;
+
+	case SE_IKE2_PAYLOAD_NOTICE:			// IKEv2 通知ペイロード
+		SeIkeFreeNoticePayload(&p->Payload.Notice);
+		break;
+
+	case SE_IKE2_PAYLOAD_DELETE:			// IKEv2 削除ペイロード
+		SeIkeFreeDeletePayload(&p->Payload.Delete);
+		break;
+
+	case SE_IKE2_PAYLOAD_TS_I:				// IKEv2 トラフィックセレクタペイロード
+	case SE_IKE2_PAYLOAD_TS_R:
+		SeIke2FreeTsPayload(&p->Payload.Ts);
+		break;
+
+	case SE_IKE2_PAYLOAD_NONCE:				// IKEv2 Nonce ペイロード
+	case SE_IKE2_PAYLOAD_VENDOR_ID:			// IKEv2 ベンダ ID ペイロード
+		SeIkeFreeDataPayload(&p->Payload.GeneralData);
+		break;
 	}
 
 	if (p->BitArray != NULL)
@@ -1668,7 +1801,8 @@ LABEL_ERROR:
 		total += payload_size;
 
 		// ペイロード本体を解析
-		if (SE_IKE_IS_SUPPORTED_PAYLOAD_TYPE(payload_type))
+		if (SE_IKE_IS_SUPPORTED_PAYLOAD_TYPE(payload_type) ||
+			SE_IKE2_IS_SUPPORTED_PAYLOAD_TYPE(payload_type))
 		{
 			// 対応しているペイロードタイプ
 			pay = SeIkeParsePayload(payload_type, payload_data);
@@ -1816,6 +1950,8 @@ SE_IKE_PACKET *SeIkeParseEx(void *data, UINT size, SE_IKE_CRYPTO_PARAM *cparam,
 		p->FlagEncrypted = (h->Flag & SE_IKE_HEADER_FLAG_ENCRYPTED) ? true : false;
 		p->FlagCommit = (h->Flag & SE_IKE_HEADER_FLAG_COMMIT) ? true : false;
 		p->FlagAuthOnly = (h->Flag & SE_IKE_HEADER_FLAG_AUTH_ONLY) ? true : false;
+		p->FlagInitiator = (h->Flag & SE_IKE2_HEADER_FLAG_INITIATOR) ? true : false;
+		p->FlagResponse = (h->Flag & SE_IKE2_HEADER_FLAG_RESPONSE) ? true : false;
 		p->MessageId = SeEndian32(h->MessageId);
 
 		if (b->Size < SeEndian32(h->MessageSize) ||
@@ -2054,3 +2190,1104 @@ SE_IKE_PACKET *SeIkeNew(UINT64 init_cookie, UINT64 resp_cookie, UCHAR exchange_t
 }
 
 
+
+// IKEv2 SA ペイロードの作成
+SE_IKE_PACKET_PAYLOAD *SeIke2NewSaPayload(SE_LIST *proposal_list)
+{
+	SE_IKE_PACKET_PAYLOAD *p;
+	// 引数チェック
+	if (proposal_list == NULL)
+	{
+		return NULL;
+	}
+
+	p = SeIkeNewPayload(SE_IKE2_PAYLOAD_SA);
+	p->Payload.Sa2.ProposalList = proposal_list;
+
+	return p;
+}
+
+// IKEv2 プロポーザルの作成
+SE_IKE2_PACKET_PROPOSAL *SeIke2NewProposal(UCHAR number, UCHAR protocol_id, void *spi, UINT spi_size, SE_LIST *transform_list)
+{
+	SE_IKE2_PACKET_PROPOSAL *p;
+	// 引数チェック
+	if (transform_list == NULL || (spi == NULL && spi_size != 0))
+	{
+		return NULL;
+	}
+
+	p = SeZeroMalloc(sizeof(SE_IKE2_PACKET_PROPOSAL));
+	p->Number = number;
+	p->ProtocolId = protocol_id;
+	p->Spi = SeMemToBuf(spi, spi_size);
+	p->TransformList = transform_list;
+
+	return p;
+}
+
+// IKEv2 トランスフォームの作成
+SE_IKE2_PACKET_TRANSFORM *SeIke2NewTransform(UCHAR type, USHORT transform_id, SE_LIST *value_list)
+{
+	SE_IKE2_PACKET_TRANSFORM *t;
+
+	t = SeZeroMalloc(sizeof(SE_IKE2_PACKET_TRANSFORM));
+	t->Type = type;
+	t->TransformId = transform_id;
+	t->ValueList = (value_list != NULL ? value_list : SeNewList(NULL));
+
+	return t;
+}
+
+// IKEv2 プロポーザルから指定した種類のトランスフォーム ID を取得
+bool SeIke2GetTransformId(SE_IKE2_PACKET_PROPOSAL *p, UCHAR type, USHORT *transform_id)
+{
+	UINT i;
+	// 引数チェック
+	if (p == NULL || transform_id == NULL)
+	{
+		return false;
+	}
+
+	for (i = 0;i < SE_LIST_NUM(p->TransformList);i++)
+	{
+		SE_IKE2_PACKET_TRANSFORM *t = SE_LIST_DATA(p->TransformList, i);
+
+		if (t->Type == type)
+		{
+			*transform_id = t->TransformId;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// IKEv2 トランスフォームの解放
+void SeIke2FreeTransform(SE_IKE2_PACKET_TRANSFORM *t)
+{
+	// 引数チェック
+	if (t == NULL)
+	{
+		return;
+	}
+
+	if (t->ValueList != NULL)
+	{
+		SeIkeFreeTransformValueList(t->ValueList);
+	}
+
+	SeFree(t);
+}
+
+// IKEv2 プロポーザルの解放
+void SeIke2FreeProposal(SE_IKE2_PACKET_PROPOSAL *p)
+{
+	UINT i;
+	// 引数チェック
+	if (p == NULL)
+	{
+		return;
+	}
+
+	if (p->TransformList != NULL)
+	{
+		for (i = 0;i < SE_LIST_NUM(p->TransformList);i++)
+		{
+			SeIke2FreeTransform(SE_LIST_DATA(p->TransformList, i));
+		}
+
+		SeFreeList(p->TransformList);
+	}
+
+	SeFreeBuf(p->Spi);
+
+	SeFree(p);
+}
+
+// IKEv2 SA ペイロードの構築
+SE_BUF *SeIke2BuildSaPayload(SE_IKE2_PACKET_SA_PAYLOAD *t)
+{
+	SE_BUF *ret;
+	UINT i, j;
+	// 引数チェック
+	if (t == NULL)
+	{
+		return NULL;
+	}
+
+	ret = SeNewBuf();
+
+	for (i = 0;i < SE_LIST_NUM(t->ProposalList);i++)
+	{
+		SE_IKE2_PACKET_PROPOSAL *p = SE_LIST_DATA(t->ProposalList, i);
+		SE_IKE_COMMON_HEADER ch;
+		SE_IKE_PROPOSAL_HEADER ph;
+		SE_BUF *pb;
+
+		// プロポーザル本体 (トランスフォームリストを含む)
+		SeZero(&ph, sizeof(ph));
+		ph.Number = p->Number;
+		ph.ProtocolId = p->ProtocolId;
+		ph.SpiSize = p->Spi->Size;
+		ph.NumTransforms = SE_LIST_NUM(p->TransformList);
+
+		pb = SeNewBuf();
+		SeWriteBuf(pb, &ph, sizeof(ph));
+		SeWriteBufBuf(pb, p->Spi);
+
+		for (j = 0;j < SE_LIST_NUM(p->TransformList);j++)
+		{
+			SE_IKE2_PACKET_TRANSFORM *tr = SE_LIST_DATA(p->TransformList, j);
+			SE_IKE2_TRANSFORM_HEADER th;
+			SE_BUF *vb;
+
+			vb = SeIkeBuildTransformValueList(tr->ValueList);
+
+			// 最後のトランスフォームでない場合は 3, 最後の場合は 0
+			SeZero(&ch, sizeof(ch));
+			ch.NextPayload = (j < (SE_LIST_NUM(p->TransformList) - 1)) ? SE_IKE_PAYLOAD_TRANSFORM : SE_IKE_PAYLOAD_NONE;
+			ch.PayloadSize = SeEndian16((USHORT)(sizeof(ch) + sizeof(th) + vb->Size));
+
+			SeZero(&th, sizeof(th));
+			th.Type = tr->Type;
+			th.TransformId = SeEndian16(tr->TransformId);
+
+			SeWriteBuf(pb, &ch, sizeof(ch));
+			SeWriteBuf(pb, &th, sizeof(th));
+			SeWriteBufBuf(pb, vb);
+
+			SeFreeBuf(vb);
+		}
+
+		// 最後のプロポーザルでない場合は 2, 最後の場合は 0
+		SeZero(&ch, sizeof(ch));
+		ch.NextPayload = (i < (SE_LIST_NUM(t->ProposalList) - 1)) ? SE_IKE_PAYLOAD_PROPOSAL : SE_IKE_PAYLOAD_NONE;
+		ch.PayloadSize = SeEndian16((USHORT)(sizeof(ch) + pb->Size));
+
+		SeWriteBuf(ret, &ch, sizeof(ch));
+		SeWriteBufBuf(ret, pb);
+
+		SeFreeBuf(pb);
+	}
+
+	return ret;
+}
+
+// IKEv2 SA ペイロードのパース
+bool SeIke2ParseSaPayload(SE_IKE2_PACKET_SA_PAYLOAD *t, SE_BUF *b)
+{
+	bool ok = true;
+	// 引数チェック
+	if (t == NULL || b == NULL)
+	{
+		return false;
+	}
+
+	t->ProposalList = SeNewList(NULL);
+
+	while (b->Current < b->Size)
+	{
+		SE_IKE_COMMON_HEADER ch;
+		SE_IKE_PROPOSAL_HEADER ph;
+		SE_IKE2_PACKET_PROPOSAL *p;
+		SE_BUF *pb;
+		UINT size;
+		UINT i;
+
+		// プロポーザルの読み込み
+		if (SeReadBuf(b, &ch, sizeof(ch)) != sizeof(ch))
+		{
+			ok = false;
+			break;
+		}
+
+		size = SeEndian16(ch.PayloadSize);
+		if (size < (sizeof(ch) + sizeof(ph)))
+		{
+			ok = false;
+			break;
+		}
+
+		pb = SeReadBufFromBuf(b, size - sizeof(ch));
+		if (pb == NULL)
+		{
+			ok = false;
+			break;
+		}
+
+		SeReadBuf(pb, &ph, sizeof(ph));
+
+		p = SeZeroMalloc(sizeof(SE_IKE2_PACKET_PROPOSAL));
+		p->Number = ph.Number;
+		p->ProtocolId = ph.ProtocolId;
+		p->TransformList = SeNewList(NULL);
+		p->Spi = SeReadBufFromBuf(pb, ph.SpiSize);
+		SeAdd(t->ProposalList, p);
+
+		if (p->Spi == NULL)
+		{
+			SeFreeBuf(pb);
+			ok = false;
+			break;
+		}
+
+		// トランスフォームの読み込み
+		for (i = 0;i < ph.NumTransforms;i++)
+		{
+			SE_IKE2_TRANSFORM_HEADER th;
+			SE_IKE2_PACKET_TRANSFORM *tr;
+			SE_BUF *tb;
+
+			if (SeReadBuf(pb, &ch, sizeof(ch)) != sizeof(ch))
+			{
+				ok = false;
+				break;
+			}
+
+			size = SeEndian16(ch.PayloadSize);
+			if (size < (sizeof(ch) + sizeof(th)))
+			{
+				ok = false;
+				break;
+			}
+
+			tb = SeReadBufFromBuf(pb, size - sizeof(ch));
+			if (tb == NULL)
+			{
+				ok = false;
+				break;
+			}
+
+			SeReadBuf(tb, &th, sizeof(th));
+
+			tr = SeZeroMalloc(sizeof(SE_IKE2_PACKET_TRANSFORM));
+			tr->Type = th.Type;
+			tr->TransformId = SeEndian16(th.TransformId);
+			tr->ValueList = SeIkeParseTransformValueList(tb);
+			SeAdd(p->TransformList, tr);
+
+			SeFreeBuf(tb);
+
+			if (tr->ValueList == NULL)
+			{
+				ok = false;
+				break;
+			}
+		}
+
+		SeFreeBuf(pb);
+
+		if (ok == false)
+		{
+			break;
+		}
+	}
+
+	if (ok == false)
+	{
+		SeError("IKEv2: Broken SA Payload");
+		SeIke2FreeSaPayload(t);
+	}
+
+	return ok;
+}
+
+// IKEv2 SA ペイロードの解放
+void SeIke2FreeSaPayload(SE_IKE2_PACKET_SA_PAYLOAD *t)
+{
+	UINT i;
+	// 引数チェック
+	if (t == NULL)
+	{
+		return;
+	}
+
+	if (t->ProposalList != NULL)
+	{
+		for (i = 0;i < SE_LIST_NUM(t->ProposalList);i++)
+		{
+			SeIke2FreeProposal(SE_LIST_DATA(t->ProposalList, i));
+		}
+
+		SeFreeList(t->ProposalList);
+		t->ProposalList = NULL;
+	}
+}
+
+// IKEv2 鍵交換ペイロードの作成
+SE_IKE_PACKET_PAYLOAD *SeIke2NewKeyExchangePayload(USHORT dh_group, void *data, UINT size)
+{
+	SE_IKE_PACKET_PAYLOAD *p;
+	// 引数チェック
+	if (data == NULL)
+	{
+		return NULL;
+	}
+
+	p = SeIkeNewPayload(SE_IKE2_PAYLOAD_KEY_EXCHANGE);
+	p->Payload.KeyExchange2.DhGroup = dh_group;
+	p->Payload.KeyExchange2.Data = SeMemToBuf(data, size);
+
+	return p;
+}
+
+// IKEv2 鍵交換ペイロードの構築
+SE_BUF *SeIke2BuildKeyExchangePayload(SE_IKE2_PACKET_KE_PAYLOAD *t)
+{
+	SE_IKE2_KE_HEADER h;
+	SE_BUF *ret;
+	// 引数チェック
+	if (t == NULL)
+	{
+		return NULL;
+	}
+
+	SeZero(&h, sizeof(h));
+	h.DhGroup = SeEndian16(t->DhGroup);
+
+	ret = SeNewBuf();
+	SeWriteBuf(ret, &h, sizeof(h));
+	SeWriteBufBuf(ret, t->Data);
+
+	return ret;
+}
+
+// IKEv2 鍵交換ペイロードのパース
+bool SeIke2ParseKeyExchangePayload(SE_IKE2_PACKET_KE_PAYLOAD *t, SE_BUF *b)
+{
+	SE_IKE2_KE_HEADER h;
+	// 引数チェック
+	if (t == NULL || b == NULL)
+	{
+		return false;
+	}
+
+	if (SeReadBuf(b, &h, sizeof(h)) != sizeof(h))
+	{
+		return false;
+	}
+
+	t->DhGroup = SeEndian16(h.DhGroup);
+	t->Data = SeReadRemainBuf(b);
+	if (t->Data == NULL)
+	{
+		return false;
+	}
+
+	return true;
+}
+
+// IKEv2 鍵交換ペイロードの解放
+void SeIke2FreeKeyExchangePayload(SE_IKE2_PACKET_KE_PAYLOAD *t)
+{
+	// 引数チェック
+	if (t == NULL)
+	{
+		return;
+	}
+
+	SeFreeBuf(t->Data);
+	t->Data = NULL;
+}
+
+// IKEv2 ID ペイロードの作成
+// (ID ペイロード本体の形式は IKEv1 と互換なので IKEv1 のものを使用する)
+SE_IKE_PACKET_PAYLOAD *SeIke2NewIdPayload(UCHAR payload_type, UCHAR id_type, void *id_data, UINT id_size)
+{
+	SE_IKE_PACKET_PAYLOAD *p;
+
+	p = SeIkeNewIdPayload(id_type, 0, 0, id_data, id_size);
+	if (p == NULL)
+	{
+		return NULL;
+	}
+
+	p->PayloadType = payload_type;
+
+	return p;
+}
+
+// IKEv2 認証ペイロードの作成
+SE_IKE_PACKET_PAYLOAD *SeIke2NewAuthPayload(UCHAR method, void *data, UINT size)
+{
+	SE_IKE_PACKET_PAYLOAD *p;
+	// 引数チェック
+	if (data == NULL)
+	{
+		return NULL;
+	}
+
+	p = SeIkeNewPayload(SE_IKE2_PAYLOAD_AUTH);
+	p->Payload.Auth.Method = method;
+	p->Payload.Auth.Data = SeMemToBuf(data, size);
+
+	return p;
+}
+
+// IKEv2 認証ペイロードの構築
+SE_BUF *SeIke2BuildAuthPayload(SE_IKE2_PACKET_AUTH_PAYLOAD *t)
+{
+	SE_IKE2_AUTH_HEADER h;
+	SE_BUF *ret;
+	// 引数チェック
+	if (t == NULL)
+	{
+		return NULL;
+	}
+
+	SeZero(&h, sizeof(h));
+	h.Method = t->Method;
+
+	ret = SeNewBuf();
+	SeWriteBuf(ret, &h, sizeof(h));
+	SeWriteBufBuf(ret, t->Data);
+
+	return ret;
+}
+
+// IKEv2 認証ペイロードのパース
+bool SeIke2ParseAuthPayload(SE_IKE2_PACKET_AUTH_PAYLOAD *t, SE_BUF *b)
+{
+	SE_IKE2_AUTH_HEADER h;
+	// 引数チェック
+	if (t == NULL || b == NULL)
+	{
+		return false;
+	}
+
+	if (SeReadBuf(b, &h, sizeof(h)) != sizeof(h))
+	{
+		return false;
+	}
+
+	t->Method = h.Method;
+	t->Data = SeReadRemainBuf(b);
+	if (t->Data == NULL)
+	{
+		return false;
+	}
+
+	return true;
+}
+
+// IKEv2 認証ペイロードの解放
+void SeIke2FreeAuthPayload(SE_IKE2_PACKET_AUTH_PAYLOAD *t)
+{
+	// 引数チェック
+	if (t == NULL)
+	{
+		return;
+	}
+
+	SeFreeBuf(t->Data);
+	t->Data = NULL;
+}
+
+// IKEv2 通知ペイロードの作成
+SE_IKE_PACKET_PAYLOAD *SeIke2NewNoticePayload(UCHAR protocol_id, USHORT message_type,
+											  void *spi, UINT spi_size,
+											  void *message, UINT message_size)
+{
+	SE_IKE_PACKET_PAYLOAD *p;
+
+	p = SeIkeNewNoticePayload(protocol_id, message_type, spi, spi_size, message, message_size);
+	if (p == NULL)
+	{
+		return NULL;
+	}
+
+	p->PayloadType = SE_IKE2_PAYLOAD_NOTICE;
+
+	return p;
+}
+
+// IKEv2 通知ペイロードの構築
+SE_BUF *SeIke2BuildNoticePayload(SE_IKE_PACKET_NOTICE_PAYLOAD *t)
+{
+	SE_IKE2_NOTICE_HEADER h;
+	SE_BUF *ret;
+	// 引数チェック
+	if (t == NULL)
+	{
+		return NULL;
+	}
+
+	SeZero(&h, sizeof(h));
+	h.ProtocolId = t->ProtocolId;
+	h.SpiSize = t->Spi->Size;
+	h.MessageType = SeEndian16(t->MessageType);
+
+	ret = SeNewBuf();
+	SeWriteBuf(ret, &h, sizeof(h));
+	SeWriteBufBuf(ret, t->Spi);
+	SeWriteBufBuf(ret, t->MessageData);
+
+	return ret;
+}
+
+// IKEv2 通知ペイロードのパース (IKEv1 と異なり DOI が無い)
+bool SeIke2ParseNoticePayload(SE_IKE_PACKET_NOTICE_PAYLOAD *t, SE_BUF *b)
+{
+	SE_IKE2_NOTICE_HEADER h;
+	// 引数チェック
+	if (t == NULL || b == NULL)
+	{
+		return false;
+	}
+
+	if (SeReadBuf(b, &h, sizeof(h)) != sizeof(h))
+	{
+		return false;
+	}
+
+	t->MessageType = SeEndian16(h.MessageType);
+	t->ProtocolId = h.ProtocolId;
+	t->Spi = SeReadBufFromBuf(b, h.SpiSize);
+	if (t->Spi == NULL)
+	{
+		return false;
+	}
+	t->MessageData = SeReadRemainBuf(b);
+
+	return true;
+}
+
+// IKEv2 削除ペイロードの作成
+SE_IKE_PACKET_PAYLOAD *SeIke2NewDeletePayload(UCHAR protocol_id, SE_LIST *spi_list)
+{
+	SE_IKE_PACKET_PAYLOAD *p;
+
+	p = SeIkeNewDeletePayload(protocol_id, spi_list);
+	if (p == NULL)
+	{
+		return NULL;
+	}
+
+	p->PayloadType = SE_IKE2_PAYLOAD_DELETE;
+
+	return p;
+}
+
+// IKEv2 削除ペイロードの構築
+SE_BUF *SeIke2BuildDeletePayload(SE_IKE_PACKET_DELETE_PAYLOAD *t)
+{
+	SE_IKE2_DELETE_HEADER h;
+	SE_BUF *ret;
+	UINT i;
+	// 引数チェック
+	if (t == NULL)
+	{
+		return NULL;
+	}
+
+	SeZero(&h, sizeof(h));
+	h.ProtocolId = t->ProtocolId;
+	h.NumSpis = SeEndian16(SE_LIST_NUM(t->SpiList));
+
+	// IKE SA の削除の場合は SPI を含めない
+	if (t->ProtocolId != SE_IKE_PROTOCOL_ID_IKE && SE_LIST_NUM(t->SpiList) >= 1)
+	{
+		SE_BUF *b = SE_LIST_DATA(t->SpiList, 0);
+
+		h.SpiSize = b->Size;
+	}
+	else
+	{
+		h.NumSpis = 0;
+	}
+
+	ret = SeNewBuf();
+	SeWriteBuf(ret, &h, sizeof(h));
+
+	if (h.SpiSize != 0)
+	{
+		for (i = 0;i < SE_LIST_NUM(t->SpiList);i++)
+		{
+			SE_BUF *b = SE_LIST_DATA(t->SpiList, i);
+
+			SeWriteBuf(ret, b->Buf, b->Size);
+		}
+	}
+
+	return ret;
+}
+
+// IKEv2 削除ペイロードのパース (IKEv1 と異なり DOI が無い)
+bool SeIke2ParseDeletePayload(SE_IKE_PACKET_DELETE_PAYLOAD *t, SE_BUF *b)
+{
+	SE_IKE2_DELETE_HEADER h;
+	UINT num_spi;
+	UINT i;
+	// 引数チェック
+	if (t == NULL || b == NULL)
+	{
+		return false;
+	}
+
+	if (SeReadBuf(b, &h, sizeof(h)) != sizeof(h))
+	{
+		return false;
+	}
+
+	t->ProtocolId = h.ProtocolId;
+	t->SpiList = SeNewList(NULL);
+	num_spi = SeEndian16(h.NumSpis);
+
+	for (i = 0;i < num_spi;i++)
+	{
+		SE_BUF *spi = SeReadBufFromBuf(b, h.SpiSize);
+
+		if (spi == NULL)
+		{
+			SeIkeFreeDeletePayload(t);
+			return false;
+		}
+
+		SeAdd(t->SpiList, spi);
+	}
+
+	return true;
+}
+
+// IKEv2 トラフィックセレクタの作成
+SE_IKE2_PACKET_TS *SeIke2NewTs(UCHAR type, UCHAR ip_protocol, USHORT start_port, USHORT end_port,
+							   void *start_address, void *end_address, UINT address_size)
+{
+	SE_IKE2_PACKET_TS *ts;
+	// 引数チェック
+	if (start_address == NULL || end_address == NULL)
+	{
+		return NULL;
+	}
+
+	ts = SeZeroMalloc(sizeof(SE_IKE2_PACKET_TS));
+	ts->Type = type;
+	ts->IpProtocol = ip_protocol;
+	ts->StartPort = start_port;
+	ts->EndPort = end_port;
+	ts->StartAddress = SeMemToBuf(start_address, address_size);
+	ts->EndAddress = SeMemToBuf(end_address, address_size);
+
+	return ts;
+}
+
+// IKEv2 トラフィックセレクタの解放
+void SeIke2FreeTs(SE_IKE2_PACKET_TS *ts)
+{
+	// 引数チェック
+	if (ts == NULL)
+	{
+		return;
+	}
+
+	SeFreeBuf(ts->StartAddress);
+	SeFreeBuf(ts->EndAddress);
+
+	SeFree(ts);
+}
+
+// IKEv2 トラフィックセレクタペイロードの作成
+SE_IKE_PACKET_PAYLOAD *SeIke2NewTsPayload(UCHAR payload_type, SE_LIST *ts_list)
+{
+	SE_IKE_PACKET_PAYLOAD *p;
+	// 引数チェック
+	if (ts_list == NULL)
+	{
+		return NULL;
+	}
+
+	p = SeIkeNewPayload(payload_type);
+	p->Payload.Ts.TsList = ts_list;
+
+	return p;
+}
+
+// IKEv2 トラフィックセレクタペイロードの構築
+SE_BUF *SeIke2BuildTsPayload(SE_IKE2_PACKET_TS_PAYLOAD *t)
+{
+	SE_IKE2_TS_HEADER h;
+	SE_BUF *ret;
+	UINT i;
+	// 引数チェック
+	if (t == NULL)
+	{
+		return NULL;
+	}
+
+	SeZero(&h, sizeof(h));
+	h.NumTs = SE_LIST_NUM(t->TsList);
+
+	ret = SeNewBuf();
+	SeWriteBuf(ret, &h, sizeof(h));
+
+	for (i = 0;i < SE_LIST_NUM(t->TsList);i++)
+	{
+		SE_IKE2_PACKET_TS *ts = SE_LIST_DATA(t->TsList, i);
+		SE_IKE2_TS_SELECTOR_HEADER sh;
+
+		SeZero(&sh, sizeof(sh));
+		sh.TsType = ts->Type;
+		sh.IpProtocol = ts->IpProtocol;
+		sh.SelectorSize = SeEndian16((USHORT)(sizeof(sh) + ts->StartAddress->Size + ts->EndAddress->Size));
+		sh.StartPort = SeEndian16(ts->StartPort);
+		sh.EndPort = SeEndian16(ts->EndPort);
+
+		SeWriteBuf(ret, &sh, sizeof(sh));
+		SeWriteBufBuf(ret, ts->StartAddress);
+		SeWriteBufBuf(ret, ts->EndAddress);
+	}
+
+	return ret;
+}
+
+// IKEv2 トラフィックセレクタペイロードのパース
+bool SeIke2ParseTsPayload(SE_IKE2_PACKET_TS_PAYLOAD *t, SE_BUF *b)
+{
+	SE_IKE2_TS_HEADER h;
+	UINT i;
+	// 引数チェック
+	if (t == NULL || b == NULL)
+	{
+		return false;
+	}
+
+	if (SeReadBuf(b, &h, sizeof(h)) != sizeof(h))
+	{
+		return false;
+	}
+
+	t->TsList = SeNewList(NULL);
+
+	for (i = 0;i < h.NumTs;i++)
+	{
+		SE_IKE2_TS_SELECTOR_HEADER sh;
+		SE_IKE2_PACKET_TS *ts;
+		UINT size;
+
+		if (SeReadBuf(b, &sh, sizeof(sh)) != sizeof(sh))
+		{
+			SeIke2FreeTsPayload(t);
+			return false;
+		}
+
+		size = SeEndian16(sh.SelectorSize);
+		if (size < sizeof(sh) || ((size - sizeof(sh)) % 2) != 0)
+		{
+			SeIke2FreeTsPayload(t);
+			return false;
+		}
+
+		ts = SeZeroMalloc(sizeof(SE_IKE2_PACKET_TS));
+		ts->Type = sh.TsType;
+		ts->IpProtocol = sh.IpProtocol;
+		ts->StartPort = SeEndian16(sh.StartPort);
+		ts->EndPort = SeEndian16(sh.EndPort);
+		ts->StartAddress = SeReadBufFromBuf(b, (size - sizeof(sh)) / 2);
+		ts->EndAddress = SeReadBufFromBuf(b, (size - sizeof(sh)) / 2);
+		SeAdd(t->TsList, ts);
+
+		if (ts->StartAddress == NULL || ts->EndAddress == NULL)
+		{
+			SeIke2FreeTsPayload(t);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// IKEv2 トラフィックセレクタペイロードの解放
+void SeIke2FreeTsPayload(SE_IKE2_PACKET_TS_PAYLOAD *t)
+{
+	UINT i;
+	// 引数チェック
+	if (t == NULL)
+	{
+		return;
+	}
+
+	if (t->TsList != NULL)
+	{
+		for (i = 0;i < SE_LIST_NUM(t->TsList);i++)
+		{
+			SeIke2FreeTs(SE_LIST_DATA(t->TsList, i));
+		}
+
+		SeFreeList(t->TsList);
+		t->TsList = NULL;
+	}
+}
+
+// 指定したメッセージタイプの IKEv2 通知ペイロードを取得
+SE_IKE_PACKET_PAYLOAD *SeIke2GetNotice(SE_LIST *o, USHORT message_type)
+{
+	UINT i;
+	// 引数チェック
+	if (o == NULL)
+	{
+		return NULL;
+	}
+
+	for (i = 0;i < SE_LIST_NUM(o);i++)
+	{
+		SE_IKE_PACKET_PAYLOAD *p = SE_LIST_DATA(o, i);
+
+		if (p->PayloadType == SE_IKE2_PAYLOAD_NOTICE &&
+			p->Payload.Notice.MessageType == message_type)
+		{
+			return p;
+		}
+	}
+
+	return NULL;
+}
+
+// IKEv2 エラー通知の取得 (エラーが無い場合は 0)
+USHORT SeIke2GetErrorNotice(SE_LIST *o)
+{
+	UINT i;
+	// 引数チェック
+	if (o == NULL)
+	{
+		return 0;
+	}
+
+	for (i = 0;i < SE_LIST_NUM(o);i++)
+	{
+		SE_IKE_PACKET_PAYLOAD *p = SE_LIST_DATA(o, i);
+
+		if (p->PayloadType == SE_IKE2_PAYLOAD_NOTICE &&
+			p->Payload.Notice.MessageType != 0 &&
+			p->Payload.Notice.MessageType <= SE_IKE2_NOTICE_ERROR_MAX)
+		{
+			return p->Payload.Notice.MessageType;
+		}
+	}
+
+	return 0;
+}
+
+// IKEv2 パケットの構築
+// 暗号化する場合はペイロード全体を暗号化ペイロード (SK) に格納し,
+// パケット全体に対する完全性検査値を付加する
+SE_BUF *SeIke2Build(SE_IKE_PACKET *p, SE_IKE2_CRYPTO_PARAM *cparam)
+{
+	SE_IKE_HEADER h;
+	SE_BUF *msg_buf;
+	SE_BUF *ret;
+	// 引数チェック
+	if (p == NULL)
+	{
+		return NULL;
+	}
+
+	if (p->FlagEncrypted && (cparam == NULL || cparam->DesKey == NULL || cparam->IntegKey == NULL))
+	{
+		return NULL;
+	}
+
+	SeZero(&h, sizeof(h));
+	h.InitiatorCookie = p->InitiatorCookie;
+	h.ResponderCookie = p->ResponderCookie;
+	h.NextPayload = SeIkeGetFirstPayloadType(p->PayloadList);
+	h.Version = SE_IKE2_VERSION;
+	h.ExchangeType = p->ExchangeType;
+	h.Flag = (p->FlagInitiator ? SE_IKE2_HEADER_FLAG_INITIATOR : 0) |
+		(p->FlagResponse ? SE_IKE2_HEADER_FLAG_RESPONSE : 0);
+	h.MessageId = SeEndian32(p->MessageId);
+
+	msg_buf = SeIkeBuildPayloadList(p->PayloadList);
+
+	if (p->DecryptedPayload != NULL)
+	{
+		SeFreeBuf(p->DecryptedPayload);
+	}
+
+	p->DecryptedPayload = SeCloneBuf(msg_buf);
+
+	ret = SeNewBuf();
+
+	if (p->FlagEncrypted == false)
+	{
+		h.MessageSize = SeEndian32(msg_buf->Size + sizeof(h));
+
+		SeWriteBuf(ret, &h, sizeof(h));
+		SeWriteBufBuf(ret, msg_buf);
+	}
+	else
+	{
+		SE_IKE_COMMON_HEADER ch;
+		UCHAR iv[SE_DES_IV_SIZE];
+		UCHAR icv[SE_HMAC_SHA1_96_HASH_SIZE];
+		UINT plain_size;
+		UCHAR *plain, *cipher;
+
+		// パディング長バイトを含めてブロックサイズに揃える
+		plain_size = msg_buf->Size + sizeof(UCHAR);
+		if ((plain_size % SE_DES_BLOCK_SIZE) != 0)
+		{
+			plain_size = ((plain_size / SE_DES_BLOCK_SIZE) + 1) * SE_DES_BLOCK_SIZE;
+		}
+
+		plain = SeZeroMalloc(plain_size);
+		cipher = SeMalloc(plain_size);
+		SeCopy(plain, msg_buf->Buf, msg_buf->Size);
+		plain[plain_size - 1] = (UCHAR)(plain_size - msg_buf->Size - 1);
+
+		// 暗号化
+		SeRand(iv, sizeof(iv));
+		SeDes3Encrypt(cipher, plain, plain_size, cparam->DesKey, iv);
+
+		SeZero(&ch, sizeof(ch));
+		ch.NextPayload = h.NextPayload;
+		ch.PayloadSize = SeEndian16((USHORT)(sizeof(ch) + sizeof(iv) + plain_size + sizeof(icv)));
+
+		h.NextPayload = SE_IKE2_PAYLOAD_ENCRYPTED;
+		h.MessageSize = SeEndian32(sizeof(h) + sizeof(ch) + sizeof(iv) + plain_size + sizeof(icv));
+
+		SeWriteBuf(ret, &h, sizeof(h));
+		SeWriteBuf(ret, &ch, sizeof(ch));
+		SeWriteBuf(ret, iv, sizeof(iv));
+		SeWriteBuf(ret, cipher, plain_size);
+
+		// 完全性検査値の付加
+		SeMacSha196(icv, cparam->IntegKey->Buf, ret->Buf, ret->Size);
+		SeWriteBuf(ret, icv, sizeof(icv));
+
+		SeFree(plain);
+		SeFree(cipher);
+	}
+
+	SeFreeBuf(msg_buf);
+
+	SeSeekBuf(ret, 0, 0);
+
+	return ret;
+}
+
+// IKEv2 パケットの解析
+SE_IKE_PACKET *SeIke2Parse(void *data, UINT size, SE_IKE2_CRYPTO_PARAM *cparam)
+{
+	SE_IKE_HEADER *h;
+	SE_IKE_PACKET *p;
+	UCHAR *payload_data;
+	UINT payload_size;
+	// 引数チェック
+	if (data == NULL)
+	{
+		return NULL;
+	}
+
+	if (size < sizeof(SE_IKE_HEADER))
+	{
+		SeError("IKEv2: Invalid Packet Size");
+		return NULL;
+	}
+
+	h = (SE_IKE_HEADER *)data;
+
+	if ((h->Version & 0xf0) != SE_IKE2_VERSION)
+	{
+		SeError("IKEv2: Invalid Version: 0x%x", h->Version);
+		return NULL;
+	}
+
+	if (size < SeEndian32(h->MessageSize) || SeEndian32(h->MessageSize) < sizeof(SE_IKE_HEADER))
+	{
+		SeError("IKEv2: Invalid Packet Size");
+		return NULL;
+	}
+
+	p = SeZeroMalloc(sizeof(SE_IKE_PACKET));
+	p->InitiatorCookie = h->InitiatorCookie;
+	p->ResponderCookie = h->ResponderCookie;
+	p->ExchangeType = h->ExchangeType;
+	p->FlagInitiator = (h->Flag & SE_IKE2_HEADER_FLAG_INITIATOR) ? true : false;
+	p->FlagResponse = (h->Flag & SE_IKE2_HEADER_FLAG_RESPONSE) ? true : false;
+	p->MessageId = SeEndian32(h->MessageId);
+
+	payload_data = ((UCHAR *)data) + sizeof(SE_IKE_HEADER);
+	payload_size = SeEndian32(h->MessageSize) - sizeof(SE_IKE_HEADER);
+
+	if (h->NextPayload != SE_IKE2_PAYLOAD_ENCRYPTED)
+	{
+		// 平文のパケット
+		p->PayloadList = SeIkeParsePayloadList(payload_data, payload_size, h->NextPayload);
+		p->DecryptedPayload = SeMemToBuf(payload_data, payload_size);
+	}
+	else
+	{
+		SE_IKE_COMMON_HEADER *ch = (SE_IKE_COMMON_HEADER *)payload_data;
+		UCHAR icv[SE_HMAC_SHA1_96_HASH_SIZE];
+		UCHAR *iv, *cipher, *plain;
+		UINT sk_size, cipher_size, pad_size;
+
+		if (cparam == NULL || cparam->DesKey == NULL || cparam->IntegKey == NULL)
+		{
+			SeIkeFree(p);
+			return NULL;
+		}
+
+		// 暗号化ペイロードは最後のペイロードでなければならない
+		if (payload_size < sizeof(SE_IKE_COMMON_HEADER) ||
+			SeEndian16(ch->PayloadSize) != payload_size)
+		{
+			SeError("IKEv2: Broken Encrypted Payload");
+			SeIkeFree(p);
+			return NULL;
+		}
+
+		sk_size = payload_size - sizeof(SE_IKE_COMMON_HEADER);
+		if (sk_size < (SE_DES_IV_SIZE + SE_DES_BLOCK_SIZE + SE_HMAC_SHA1_96_HASH_SIZE) ||
+			((sk_size - SE_DES_IV_SIZE - SE_HMAC_SHA1_96_HASH_SIZE) % SE_DES_BLOCK_SIZE) != 0)
+		{
+			SeError("IKEv2: Broken Encrypted Payload");
+			SeIkeFree(p);
+			return NULL;
+		}
+
+		// 完全性検査値の検査
+		SeMacSha196(icv, cparam->IntegKey->Buf, data,
+			SeEndian32(h->MessageSize) - SE_HMAC_SHA1_96_HASH_SIZE);
+		if (SeCmp(icv, ((UCHAR *)data) + SeEndian32(h->MessageSize) - SE_HMAC_SHA1_96_HASH_SIZE,
+			SE_HMAC_SHA1_96_HASH_SIZE) != 0)
+		{
+			SeError("IKEv2: Integrity Check Failed");
+			SeIkeFree(p);
+			return NULL;
+		}
+
+		// 解読
+		iv = payload_data + sizeof(SE_IKE_COMMON_HEADER);
+		cipher = iv + SE_DES_IV_SIZE;
+		cipher_size = sk_size - SE_DES_IV_SIZE - SE_HMAC_SHA1_96_HASH_SIZE;
+
+		plain = SeMalloc(cipher_size);
+		SeDes3Decrypt(plain, cipher, cipher_size, cparam->DesKey, iv);
+
+		pad_size = plain[cipher_size - 1];
+		if ((pad_size + sizeof(UCHAR)) > cipher_size)
+		{
+			SeError("IKEv2: Decrypt Failed");
+			SeFree(plain);
+			SeIkeFree(p);
+			return NULL;
+		}
+
+		p->FlagEncrypted = true;
+		p->DecryptedPayload = SeMemToBuf(plain, cipher_size - pad_size - sizeof(UCHAR));
+		p->PayloadList = SeIkeParsePayloadList(p->DecryptedPayload->Buf,
+			p->DecryptedPayload->Size, ch->NextPayload);
+
+		SeFree(plain);
+	}
+
+	if (p->PayloadList == NULL)
+	{
+		SeIkeFree(p);
+		return NULL;
+	}
+
+	return p;
+}
@@ -248,6 +248,135 @@ struct SE_IKE_DELETE_HEADER
 } SE_STRUCT_PACKED;
 
 
+
+//
+// IKEv2 (RFC 4306 / RFC 7296)
+//
+
+// IKEv2 バージョン
+#define SE_IKE2_VERSION					0x20	// 2.0
+
+// IKEv2 ペイロード種類
+#define SE_IKE2_PAYLOAD_SA				33		// SA ペイロード
+#define SE_IKE2_PAYLOAD_KEY_EXCHANGE	34		// 鍵交換ペイロード
+#define SE_IKE2_PAYLOAD_ID_I			35		// ID ペイロード (イニシエータ)
+#define SE_IKE2_PAYLOAD_ID_R			36		// ID ペイロード (レスポンダ)
+#define SE_IKE2_PAYLOAD_CERT			37		// 証明書ペイロード
+#define SE_IKE2_PAYLOAD_CERT_REQUEST	38		// 証明書要求ペイロード
+#define SE_IKE2_PAYLOAD_AUTH			39		// 認証ペイロード
+#define SE_IKE2_PAYLOAD_NONCE			40		// Nonce ペイロード
+#define SE_IKE2_PAYLOAD_NOTICE			41		// 通知ペイロード
+#define SE_IKE2_PAYLOAD_DELETE			42		// 削除ペイロード
+#define SE_IKE2_PAYLOAD_VENDOR_ID		43		// ベンダ ID ペイロード
+#define SE_IKE2_PAYLOAD_TS_I			44		// トラフィックセレクタ (イニシエータ)
+#define SE_IKE2_PAYLOAD_TS_R			45		// トラフィックセレクタ (レスポンダ)
+#define SE_IKE2_PAYLOAD_ENCRYPTED		46		// 暗号化ペイロード
+
+// サポートされている IKEv2 ペイロード種類かどうか確認するマクロ
+// (暗号化ペイロードは SeIke2Parse() で別途処理する)
+#define SE_IKE2_IS_SUPPORTED_PAYLOAD_TYPE(i) (((i) >= SE_IKE2_PAYLOAD_SA) && ((i) <= SE_IKE2_PAYLOAD_TS_R))
+
+// IKEv2 交換種類
+#define SE_IKE2_EXCHANGE_TYPE_IKE_SA_INIT		34	// IKE_SA_INIT
+#define SE_IKE2_EXCHANGE_TYPE_IKE_AUTH			35	// IKE_AUTH
+#define SE_IKE2_EXCHANGE_TYPE_CREATE_CHILD_SA	36	// CREATE_CHILD_SA
+#define SE_IKE2_EXCHANGE_TYPE_INFORMATIONAL		37	// INFORMATIONAL
+
+// IKEv2 の交換種類かどうか確認するマクロ
+#define SE_IKE2_IS_EXCHANGE_TYPE(i) (((i) >= SE_IKE2_EXCHANGE_TYPE_IKE_SA_INIT) && ((i) <= SE_IKE2_EXCHANGE_TYPE_INFORMATIONAL))
+
+// IKEv2 ヘッダフラグ
+#define SE_IKE2_HEADER_FLAG_INITIATOR	0x08	// オリジナルのイニシエータ
+#define SE_IKE2_HEADER_FLAG_RESPONSE	0x20	// 応答
+
+// IKEv2 トランスフォームヘッダ
+struct SE_IKE2_TRANSFORM_HEADER
+{
+	UCHAR Type;									// トランスフォーム種類
+	UCHAR Reserved;								// 予約
+	USHORT TransformId;							// トランスフォーム ID
+} SE_STRUCT_PACKED;
+
+// IKEv2 トランスフォーム種類
+#define SE_IKE2_TRANSFORM_TYPE_ENCR		1		// 暗号化アルゴリズム
+#define SE_IKE2_TRANSFORM_TYPE_PRF		2		// 疑似乱数関数
+#define SE_IKE2_TRANSFORM_TYPE_INTEG	3		// 完全性アルゴリズム
+#define SE_IKE2_TRANSFORM_TYPE_DH		4		// DH グループ番号
+#define SE_IKE2_TRANSFORM_TYPE_ESN		5		// 拡張シーケンス番号
+
+// IKEv2 トランスフォーム ID
+#define SE_IKE2_ENCR_DES				2		// DES-CBC
+#define SE_IKE2_ENCR_3DES				3		// 3DES-CBC
+#define SE_IKE2_PRF_HMAC_SHA1			2		// HMAC-SHA-1
+#define SE_IKE2_INTEG_HMAC_SHA1_96		2		// HMAC-SHA-1-96
+#define SE_IKE2_DH_1024_MODP			2		// 1024 bit MODP
+#define SE_IKE2_ESN_NONE				0		// 拡張シーケンス番号を使用しない
+
+// IKEv2 鍵交換ペイロードヘッダ
+struct SE_IKE2_KE_HEADER
+{
+	USHORT DhGroup;								// DH グループ番号
+	USHORT Reserved;							// 予約
+} SE_STRUCT_PACKED;
+
+// IKEv2 認証ペイロードヘッダ
+struct SE_IKE2_AUTH_HEADER
+{
+	UCHAR Method;								// 認証方法
+	UCHAR Reserved[3];							// 予約
+} SE_STRUCT_PACKED;
+
+// IKEv2 認証方法
+#define SE_IKE2_AUTH_METHOD_PRESHAREDKEY	2	// 事前共有鍵
+
+// IKEv2 通知ペイロードヘッダ
+struct SE_IKE2_NOTICE_HEADER
+{
+	UCHAR ProtocolId;							// プロトコル ID
+	UCHAR SpiSize;								// SPI サイズ
+	USHORT MessageType;							// メッセージタイプ
+} SE_STRUCT_PACKED;
+
+// IKEv2 通知メッセージタイプ
+#define SE_IKE2_NOTICE_NO_PROPOSAL_CHOSEN		14		// 受け入れ可能なプロポーザルが無い
+#define SE_IKE2_NOTICE_INVALID_KE_PAYLOAD		17		// 鍵交換ペイロードが不正
+#define SE_IKE2_NOTICE_AUTHENTICATION_FAILED	24		// 認証失敗
+#define SE_IKE2_NOTICE_TS_UNACCEPTABLE			38		// トラフィックセレクタが受け入れられない
+#define SE_IKE2_NOTICE_CHILD_SA_NOT_FOUND		44		// 対象の Child SA が存在しない
+#define SE_IKE2_NOTICE_TEMPORARY_FAILURE		43		// 一時的な失敗
+#define SE_IKE2_NOTICE_ERROR_MAX				16383	// これ以下はエラー通知
+#define SE_IKE2_NOTICE_COOKIE					16390	// クッキー
+#define SE_IKE2_NOTICE_REKEY_SA					16393	// Child SA の鍵更新
+
+// IKEv2 削除ペイロードヘッダ
+struct SE_IKE2_DELETE_HEADER
+{
+	UCHAR ProtocolId;							// プロトコル ID
+	UCHAR SpiSize;								// SPI サイズ
+	USHORT NumSpis;								// SPI 数
+} SE_STRUCT_PACKED;
+
+// IKEv2 トラフィックセレクタペイロードヘッダ
+struct SE_IKE2_TS_HEADER
+{
+	UCHAR NumTs;								// トラフィックセレクタ数
+	UCHAR Reserved[3];							// 予約
+} SE_STRUCT_PACKED;
+
+// IKEv2 トラフィックセレクタヘッダ
+struct SE_IKE2_TS_SELECTOR_HEADER
+{
+	UCHAR TsType;								// 種類
+	UCHAR IpProtocol;							// IP プロトコル番号
+	USHORT SelectorSize;						// セレクタ全体の長さ
+	USHORT StartPort;							// 開始ポート
+	USHORT EndPort;								// 終了ポート
+} SE_STRUCT_PACKED;
+
+// IKEv2 トラフィックセレクタの種類
+#define SE_IKE2_TS_IPV4_ADDR_RANGE		7		// IPv4 アドレス範囲
+#define SE_IKE2_TS_IPV6_ADDR_RANGE		8		// IPv6 アドレス範囲
+
 #ifdef	SE_WIN32
 #pragma pack(pop)
 #endif	// SE_WIN32
@@ -335,6 +464,58 @@ struct SE_IKE_PACKET_DELETE_PAYLOAD
 	SE_LIST *SpiList;							// SPI リスト
 };
 
+// IKEv2 パケットトランスフォーム
+struct SE_IKE2_PACKET_TRANSFORM
+{
+	UCHAR Type;									// トランスフォーム種類
+	USHORT TransformId;							// トランスフォーム ID
+	SE_LIST *ValueList;							// 属性リスト
+};
+
+// IKEv2 パケットプロポーザル
+struct SE_IKE2_PACKET_PROPOSAL
+{
+	UCHAR Number;								// 番号
+	UCHAR ProtocolId;							// プロトコル ID
+	SE_BUF *Spi;								// SPI データ
+	SE_LIST *TransformList;						// トランスフォームリスト
+};
+
+// IKEv2 パケット SA ペイロード
+struct SE_IKE2_PACKET_SA_PAYLOAD
+{
+	SE_LIST *ProposalList;						// プロポーザルリスト
+};
+
+// IKEv2 パケット鍵交換ペイロード
+struct SE_IKE2_PACKET_KE_PAYLOAD
+{
+	USHORT DhGroup;								// DH グループ番号
+	SE_BUF *Data;								// 公開鍵
+};
+
+// IKEv2 パケット認証ペイロード
+struct SE_IKE2_PACKET_AUTH_PAYLOAD
+{
+	UCHAR Method;								// 認証方法
+	SE_BUF *Data;								// 認証データ
+};
+
+// IKEv2 パケットトラフィックセレクタ
+struct SE_IKE2_PACKET_TS
+{
+	UCHAR Type;									// 種類
+	UCHAR IpProtocol;							// IP プロトコル番号
+	USHORT StartPort, EndPort;					// ポート範囲
+	SE_BUF *StartAddress, *EndAddress;			// アドレス範囲
+};
+
+// IKEv2 パケットトラフィックセレクタペイロード
+struct SE_IKE2_PACKET_TS_PAYLOAD
+{
+	SE_LIST *TsList;							// トラフィックセレクタリスト
+};
+
 // IKE パケットペイロード
 struct SE_IKE_PACKET_PAYLOAD
 {
@@ -358,6 +539,10 @@ struct SE_IKE_PACKET_PAYLOAD
 		SE_IKE_PACKET_DELETE_PAYLOAD Delete;	// 削除ペイロード
 		SE_IKE_PACKET_DATA_PAYLOAD VendorId;	// ベンダ ID ペイロード
 		SE_IKE_PACKET_DATA_PAYLOAD GeneralData;	// 汎用データペイロード
+		SE_IKE2_PACKET_SA_PAYLOAD Sa2;			// IKEv2 SA ペイロード
+		SE_IKE2_PACKET_KE_PAYLOAD KeyExchange2;	// IKEv2 鍵交換ペイロード
+		SE_IKE2_PACKET_AUTH_PAYLOAD Auth;		// IKEv2 認証ペイロード
+		SE_IKE2_PACKET_TS_PAYLOAD Ts;			// IKEv2 トラフィックセレクタペイロード
 	} Payload;
 };
 
@@ -370,6 +555,8 @@ struct SE_IKE_PACKET
 	bool FlagEncrypted;							// 暗号化フラグ
 	bool FlagCommit;							// コミットフラグ
 	bool FlagAuthOnly;							// 認証のみフラグ
+	bool FlagInitiator;							// イニシエータフラグ (IKEv2)
+	bool FlagResponse;							// 応答フラグ (IKEv2)
 	UINT MessageId;								// メッセージ ID
 	SE_LIST *PayloadList;						// ペイロードリスト
 	SE_BUF *DecryptedPayload;					// 解読されたペイロード
@@ -383,6 +570,13 @@ struct SE_IKE_CRYPTO_PARAM
 	UCHAR NextIv[SE_DES_IV_SIZE];				// 次に使用すべき IV
 };
 
+// IKEv2 暗号化パラメータ
+struct SE_IKE2_CRYPTO_PARAM
+{
+	SE_DES_KEY *DesKey;							// DES 鍵
+	SE_BUF *IntegKey;							// 完全性検査用鍵
+};
+
 // IP アドレス
 struct SE_IKE_IP_ADDR
 {
@@ -474,6 +668,45 @@ SE_IPV6_ADDR SeIkeGetIPv6Address(SE_IKE_IP_ADDR *a);
 void SeIkeIpAddressToStr(char *str, SE_IKE_IP_ADDR *a);
 bool SeIkeIsZeroIP(SE_IKE_IP_ADDR *a);
 
+SE_BUF *SeIke2Build(SE_IKE_PACKET *p, SE_IKE2_CRYPTO_PARAM *cparam);
+SE_IKE_PACKET *SeIke2Parse(void *data, UINT size, SE_IKE2_CRYPTO_PARAM *cparam);
+bool SeIke2ParseSaPayload(SE_IKE2_PACKET_SA_PAYLOAD *t, SE_BUF *b);
+void SeIke2FreeSaPayload(SE_IKE2_PACKET_SA_PAYLOAD *t);
+SE_BUF *SeIke2BuildSaPayload(SE_IKE2_PACKET_SA_PAYLOAD *t);
+void SeIke2FreeProposal(SE_IKE2_PACKET_PROPOSAL *p);
+void SeIke2FreeTransform(SE_IKE2_PACKET_TRANSFORM *t);
+bool SeIke2ParseKeyExchangePayload(SE_IKE2_PACKET_KE_PAYLOAD *t, SE_BUF *b);
+void SeIke2FreeKeyExchangePayload(SE_IKE2_PACKET_KE_PAYLOAD *t);
+SE_BUF *SeIke2BuildKeyExchangePayload(SE_IKE2_PACKET_KE_PAYLOAD *t);
+bool SeIke2ParseAuthPayload(SE_IKE2_PACKET_AUTH_PAYLOAD *t, SE_BUF *b);
+void SeIke2FreeAuthPayload(SE_IKE2_PACKET_AUTH_PAYLOAD *t);
+SE_BUF *SeIke2BuildAuthPayload(SE_IKE2_PACKET_AUTH_PAYLOAD *t);
+bool SeIke2ParseNoticePayload(SE_IKE_PACKET_NOTICE_PAYLOAD *t, SE_BUF *b);
+SE_BUF *SeIke2BuildNoticePayload(SE_IKE_PACKET_NOTICE_PAYLOAD *t);
+bool SeIke2ParseDeletePayload(SE_IKE_PACKET_DELETE_PAYLOAD *t, SE_BUF *b);
+SE_BUF *SeIke2BuildDeletePayload(SE_IKE_PACKET_DELETE_PAYLOAD *t);
+bool SeIke2ParseTsPayload(SE_IKE2_PACKET_TS_PAYLOAD *t, SE_BUF *b);
+void SeIke2FreeTsPayload(SE_IKE2_PACKET_TS_PAYLOAD *t);
+SE_BUF *SeIke2BuildTsPayload(SE_IKE2_PACKET_TS_PAYLOAD *t);
+void SeIke2FreeTs(SE_IKE2_PACKET_TS *ts);
+
+SE_IKE_PACKET_PAYLOAD *SeIke2NewSaPayload(SE_LIST *proposal_list);
+SE_IKE2_PACKET_PROPOSAL *SeIke2NewProposal(UCHAR number, UCHAR protocol_id, void *spi, UINT spi_size, SE_LIST *transform_list);
+SE_IKE2_PACKET_TRANSFORM *SeIke2NewTransform(UCHAR type, USHORT transform_id, SE_LIST *value_list);
+bool SeIke2GetTransformId(SE_IKE2_PACKET_PROPOSAL *p, UCHAR type, USHORT *transform_id);
+SE_IKE_PACKET_PAYLOAD *SeIke2NewKeyExchangePayload(USHORT dh_group, void *data, UINT size);
+SE_IKE_PACKET_PAYLOAD *SeIke2NewIdPayload(UCHAR payload_type, UCHAR id_type, void *id_data, UINT id_size);
+SE_IKE_PACKET_PAYLOAD *SeIke2NewAuthPayload(UCHAR method, void *data, UINT size);
+SE_IKE_PACKET_PAYLOAD *SeIke2NewNoticePayload(UCHAR protocol_id, USHORT message_type,
+											  void *spi, UINT spi_size,
+											  void *message, UINT message_size);
+SE_IKE_PACKET_PAYLOAD *SeIke2NewDeletePayload(UCHAR protocol_id, SE_LIST *spi_list);
+SE_IKE_PACKET_PAYLOAD *SeIke2NewTsPayload(UCHAR payload_type, SE_LIST *ts_list);
+SE_IKE2_PACKET_TS *SeIke2NewTs(UCHAR type, UCHAR ip_protocol, USHORT start_port, USHORT end_port,
+							   void *start_address, void *end_address, UINT address_size);
+SE_IKE_PACKET_PAYLOAD *SeIke2GetNotice(SE_LIST *o, USHORT message_type);
+USHORT SeIke2GetErrorNotice(SE_LIST *o);
+
 UINT SeIkeStrToPhase1Mode(char *name);
 UCHAR SeIkeStrToPhase1CryptId(char *name);
 UCHAR SeIkeStrToPhase1HashId(char *name);
@@ -68,6 +68,9 @@ void VPN_IPsec_Client_Stop(SE_HANDLE client_handle)
 // IPsec モジュール全体の初期化
 void SeIntInit(bool init_openssl)
 {
+	// メモリプール
+	SeInitMemory();
+
 	// カーネル系
 	SeInitKernel();
 
@@ -83,6 +86,9 @@ void SeIntFree()
 
 	// カーネル系
 	SeFreeKernel();
+
+	// メモリプール
+	SeFreeMemory();
 }
 
 // IPsec モジュールの初期化 (エクスポート関数)
@@ -392,6 +398,25 @@ void SeSysLog(char *type, char *message)
 	rt->SysCall->SysLog(type, message);
 }
 
+// システムコール: 乱数の取得
+bool SeSysGetRandom(void *buf, UINT size)
+{
+	// 引数チェック
+	if (buf == NULL || size == 0)
+	{
+		return false;
+	}
+
+	if (rt->SysCall->SysGetRandom == NULL)
+	{
+		return false;
+	}
+
+	rt->SysCall->SysGetRandom(buf, size);
+
+	return true;
+}
+
 // RSA 署名の実施
 SE_BUF *SeRsaSign(char *key_name, void *data, UINT data_size)
 {
@@ -72,6 +72,8 @@ struct SE_SYSCALL_TABLE
 	bool (*SysRsaSign)(char *key_name, void *data, UINT data_size, void *sign, UINT *sign_buf_size);
 	// ログの出力
 	void (*SysLog)(char *type, char *message);
+	// 乱数の取得 (NULL の場合は OpenSSL の乱数を使用する)
+	void (*SysGetRandom)(void *buf, UINT size);
 };
 
 // NIC 情報
@@ -95,6 +97,7 @@ struct SE_ROOT
 	UINT LastTick;										// 前回の Tick 値
 	UINT TickRoundCounter;								// Tick 値の周回カウンタ
 	UINT64 StartTick64;									// システムが開始したときの Tick64 の値
+	SE_MEMORY_POOL *MemoryPool;							// バッファ・リストのプール
 };
 
 #ifdef	SE_INTERNAL
@@ -131,6 +134,7 @@ bool SeSysLoadData(char *name, void **data, UINT *data_size);
 void SeSysFreeData(void *data);
 bool SeSysRsaSign(char *key_name, void *data, UINT data_size, void *sign, UINT *sign_buf_size);
 void SeSysLog(char *type, char *message);
+bool SeSysGetRandom(void *buf, UINT size);
 
 // その他関数プロトタイプ
 SE_BUF *SeRsaSign(char *key_name, void *data, UINT data_size);
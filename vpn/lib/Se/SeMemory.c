@@ -1097,6 +1097,28 @@ void SeFreeList(SE_LIST *o)
 		return;
 	}
 
+	// 拡張されていないリストはプールに返却する
+	if (o->num_reserved == SE_INIT_NUM_RESERVED && rt != NULL && rt->MemoryPool != NULL)
+	{
+		SE_MEMORY_POOL *pool = rt->MemoryPool;
+		bool returned = false;
+
+		SeLock(pool->Lock);
+		{
+			if (pool->NumFreeList < SE_LIST_POOL_MAX)
+			{
+				pool->FreeList[pool->NumFreeList++] = o;
+				returned = true;
+			}
+		}
+		SeUnlock(pool->Lock);
+
+		if (returned)
+		{
+			return;
+		}
+	}
+
 	SeFree(o->p);
 	SeFree(o);
 }
@@ -1104,13 +1126,31 @@ void SeFreeList(SE_LIST *o)
 // リストの作成
 SE_LIST *SeNewList(SE_CALLBACK_COMPARE *cmp)
 {
-	SE_LIST *o;
+	SE_LIST *o = NULL;
 
-	o = SeZeroMalloc(sizeof(SE_LIST));
+	// プールから取得する
+	if (rt != NULL && rt->MemoryPool != NULL)
+	{
+		SE_MEMORY_POOL *pool = rt->MemoryPool;
+
+		SeLock(pool->Lock);
+		{
+			if (pool->NumFreeList != 0)
+			{
+				o = pool->FreeList[--pool->NumFreeList];
+			}
+		}
+		SeUnlock(pool->Lock);
+	}
+
+	if (o == NULL)
+	{
+		o = SeZeroMalloc(sizeof(SE_LIST));
+		o->num_reserved = SE_INIT_NUM_RESERVED;
+		o->p = SeMalloc(sizeof(void *) * o->num_reserved);
+	}
 
 	o->num_item = 0;
-	o->num_reserved = SE_INIT_NUM_RESERVED;
-	o->p = SeMalloc(sizeof(void *) * o->num_reserved);
 	o->cmp = cmp;
 	o->sorted = true;
 
@@ -1569,6 +1609,12 @@ void SeFreeBuf(SE_BUF *b)
 		return;
 	}
 
+	// プールに返却できる場合は返却する
+	if (SeReturnBufToPool(b))
+	{
+		return;
+	}
+
 	// メモリ解放
 	SeFree(b->Buf);
 	SeFree(b);
@@ -1738,7 +1784,7 @@ SE_BUF *SeMemToBuf(void *data, UINT size)
 		return NULL;
 	}
 
-	b = SeNewBuf();
+	b = SeNewBufEx(size);
 	SeWriteBuf(b, data, size);
 	SeSeekBuf(b, 0, 0);
 
@@ -1762,19 +1808,303 @@ SE_BUF *SeRandBuf(UINT size)
 
 // バッファの作成
 SE_BUF *SeNewBuf()
+{
+	return SeNewBufEx(SE_INIT_BUF_SIZE);
+}
+
+// 指定したサイズ以上の領域を持つバッファの作成
+SE_BUF *SeNewBufEx(UINT size)
 {
 	SE_BUF *b;
+	UINT c;
+
+	c = SeGetBufPoolClass(size);
+	if (c < SE_BUF_POOL_NUM_CLASSES)
+	{
+		// プールから取得する
+		b = SeGetBufFromPool(c);
+		if (b != NULL)
+		{
+			return b;
+		}
+
+		size = SeGetBufPoolClassSize(c);
+	}
 
 	// メモリ確保
 	b = SeMalloc(sizeof(SE_BUF));
-	b->Buf = SeMalloc(SE_INIT_BUF_SIZE);
+	b->Buf = SeMalloc(size);
 	b->Size = 0;
 	b->Current = 0;
-	b->SizeReserved = SE_INIT_BUF_SIZE;
+	b->SizeReserved = size;
+
+	return b;
+}
+
+// サイズクラスの取得 (該当するクラスが無い場合は SE_BUF_POOL_NUM_CLASSES)
+UINT SeGetBufPoolClass(UINT size)
+{
+	if (size <= SE_BUF_POOL_SIZE_SMALL)
+	{
+		return 0;
+	}
+	if (size <= SE_BUF_POOL_SIZE_MEDIUM)
+	{
+		return 1;
+	}
+	if (size <= SE_BUF_POOL_SIZE_LARGE)
+	{
+		return 2;
+	}
+
+	return SE_BUF_POOL_NUM_CLASSES;
+}
+
+// サイズクラスのバッファサイズの取得
+UINT SeGetBufPoolClassSize(UINT c)
+{
+	switch (c)
+	{
+	case 0:
+		return SE_BUF_POOL_SIZE_SMALL;
+
+	case 1:
+		return SE_BUF_POOL_SIZE_MEDIUM;
+
+	case 2:
+		return SE_BUF_POOL_SIZE_LARGE;
+	}
+
+	return 0;
+}
+
+// サイズクラスで保持する空きバッファの最大数の取得
+UINT SeGetBufPoolClassMax(UINT c)
+{
+	switch (c)
+	{
+	case 0:
+		return SE_BUF_POOL_MAX_SMALL;
+
+	case 1:
+		return SE_BUF_POOL_MAX_MEDIUM;
+
+	case 2:
+		return SE_BUF_POOL_MAX_LARGE;
+	}
+
+	return 0;
+}
+
+// プールからバッファを取得
+SE_BUF *SeGetBufFromPool(UINT c)
+{
+	SE_MEMORY_POOL *pool;
+	SE_BUF *b = NULL;
+
+	if (rt == NULL || rt->MemoryPool == NULL)
+	{
+		return NULL;
+	}
+	pool = rt->MemoryPool;
+
+	SeLock(pool->Lock);
+	{
+		if (pool->NumFreeBuf[c] != 0)
+		{
+			b = pool->FreeBuf[c][--pool->NumFreeBuf[c]];
+		}
+	}
+	SeUnlock(pool->Lock);
+
+	if (b != NULL)
+	{
+		b->Size = 0;
+		b->Current = 0;
+	}
 
 	return b;
 }
 
+// バッファをプールに返却
+bool SeReturnBufToPool(SE_BUF *b)
+{
+	SE_MEMORY_POOL *pool;
+	UINT c;
+	bool ret = false;
+
+	if (rt == NULL || rt->MemoryPool == NULL)
+	{
+		return false;
+	}
+	pool = rt->MemoryPool;
+
+	// 拡張されたバッファや外部から与えられたバッファは返却しない
+	c = SeGetBufPoolClass(b->SizeReserved);
+	if (c >= SE_BUF_POOL_NUM_CLASSES || SeGetBufPoolClassSize(c) != b->SizeReserved)
+	{
+		return false;
+	}
+
+	SeLock(pool->Lock);
+	{
+		if (pool->NumFreeBuf[c] < SeGetBufPoolClassMax(c))
+		{
+			pool->FreeBuf[c][pool->NumFreeBuf[c]++] = b;
+			ret = true;
+		}
+	}
+	SeUnlock(pool->Lock);
+
+	return ret;
+}
+
+// メモリプールの初期化
+void SeInitMemory()
+{
+	rt->MemoryPool = SeZeroMalloc(sizeof(SE_MEMORY_POOL));
+	rt->MemoryPool->Lock = SeNewLock();
+}
+
+// メモリプールの解放
+void SeFreeMemory()
+{
+	SE_MEMORY_POOL *pool = rt->MemoryPool;
+	UINT i, j;
+	// 引数チェック
+	if (pool == NULL)
+	{
+		return;
+	}
+
+	// 以後はプールを使用しない
+	rt->MemoryPool = NULL;
+
+	for (i = 0;i < SE_BUF_POOL_NUM_CLASSES;i++)
+	{
+		for (j = 0;j < pool->NumFreeBuf[i];j++)
+		{
+			SE_BUF *b = pool->FreeBuf[i][j];
+
+			SeFree(b->Buf);
+			SeFree(b);
+		}
+	}
+
+	for (i = 0;i < pool->NumFreeList;i++)
+	{
+		SE_LIST *o = pool->FreeList[i];
+
+		SeFree(o->p);
+		SeFree(o);
+	}
+
+	SeDeleteLock(pool->Lock);
+	SeFree(pool);
+}
+
+// アリーナのチャンクの作成
+SE_ARENA_CHUNK *SeNewArenaChunk(UINT size)
+{
+	SE_ARENA_CHUNK *c = SeMalloc(sizeof(SE_ARENA_CHUNK) + size);
+
+	c->Next = NULL;
+	c->Size = size;
+	c->Used = 0;
+	c->Reserved = 0;
+
+	return c;
+}
+
+// アリーナの作成
+SE_ARENA *SeNewArena(UINT chunk_size)
+{
+	SE_ARENA *a = SeZeroMalloc(sizeof(SE_ARENA));
+
+	a->ChunkSize = SE_ROUND_ARENA_SIZE(MAX(chunk_size, SE_ARENA_ALIGN));
+	a->Chunks = SeNewArenaChunk(a->ChunkSize);
+	a->TotalSize = a->ChunkSize;
+
+	return a;
+}
+
+// アリーナの解放
+void SeFreeArena(SE_ARENA *a)
+{
+	SE_ARENA_CHUNK *c, *next;
+	// 引数チェック
+	if (a == NULL)
+	{
+		return;
+	}
+
+	for (c = a->Chunks;c != NULL;c = next)
+	{
+		next = c->Next;
+		SeFree(c);
+	}
+
+	SeFree(a);
+}
+
+// アリーナからメモリを確保 (個別には解放しない)
+void *SeArenaAlloc(SE_ARENA *a, UINT size)
+{
+	SE_ARENA_CHUNK *c;
+	void *ret;
+	// 引数チェック
+	if (a == NULL)
+	{
+		return NULL;
+	}
+
+	size = SE_ROUND_ARENA_SIZE(MAX(size, 1));
+
+	c = a->Chunks;
+	if ((c->Size - c->Used) < size)
+	{
+		// 新しいチャンクを追加する
+		UINT chunk_size = MAX(a->ChunkSize, size);
+
+		c = SeNewArenaChunk(chunk_size);
+		c->Next = a->Chunks;
+		a->Chunks = c;
+		a->TotalSize += chunk_size;
+	}
+
+	ret = ((UCHAR *)(c + 1)) + c->Used;
+	c->Used += size;
+
+	return ret;
+}
+
+// アリーナ内のすべての確保済み領域を一括して解放
+void SeResetArena(SE_ARENA *a)
+{
+	SE_ARENA_CHUNK *c, *next;
+	// 引数チェック
+	if (a == NULL)
+	{
+		return;
+	}
+
+	if (a->Chunks->Next == NULL)
+	{
+		a->Chunks->Used = 0;
+		return;
+	}
+
+	// 複数のチャンクを使用した場合は合計サイズの単一チャンクにまとめ、
+	// 次回以降はチャンクの追加が発生しないようにする
+	for (c = a->Chunks;c != NULL;c = next)
+	{
+		next = c->Next;
+		SeFree(c);
+	}
+
+	a->Chunks = SeNewArenaChunk(a->TotalSize);
+}
+
 // 64 bit エンディアン変換
 UINT64 SeEndian64(UINT64 value)
 {
@@ -46,6 +46,19 @@
 #define	SE_FIFO_REALLOC_MEM_SIZE	(65536 * 10)	// 絶妙な値
 #define	SE_INIT_NUM_RESERVED		32
 
+// バッファプールのサイズクラス
+#define	SE_BUF_POOL_SIZE_SMALL		256				// IKE ペイロード・鍵など
+#define	SE_BUF_POOL_SIZE_MEDIUM		2048			// MTU サイズのパケット・IKE メッセージ
+#define	SE_BUF_POOL_SIZE_LARGE		SE_INIT_BUF_SIZE	// SeNewBuf() の既定サイズ
+#define	SE_BUF_POOL_NUM_CLASSES		3
+#define	SE_BUF_POOL_MAX_SMALL		64				// 各クラスで保持する空きバッファの最大数
+#define	SE_BUF_POOL_MAX_MEDIUM		32
+#define	SE_BUF_POOL_MAX_LARGE		8
+#define	SE_LIST_POOL_MAX			64				// 保持する空きリストの最大数
+
+// アリーナ
+#define	SE_ARENA_ALIGN				8
+
 // バッファ
 struct SE_BUF
 {
@@ -55,6 +68,33 @@ struct SE_BUF
 	UINT Current;
 };
 
+// メモリプール
+struct SE_MEMORY_POOL
+{
+	SE_LOCK *Lock;											// ロック
+	SE_BUF *FreeBuf[SE_BUF_POOL_NUM_CLASSES][SE_BUF_POOL_MAX_SMALL];	// 空きバッファ
+	UINT NumFreeBuf[SE_BUF_POOL_NUM_CLASSES];				// 空きバッファ数
+	SE_LIST *FreeList[SE_LIST_POOL_MAX];					// 空きリスト
+	UINT NumFreeList;										// 空きリスト数
+};
+
+// アリーナのチャンク
+struct SE_ARENA_CHUNK
+{
+	SE_ARENA_CHUNK *Next;									// 次のチャンク
+	UINT Size;												// データ領域のサイズ
+	UINT Used;												// 使用済みサイズ
+	UINT Reserved;											// データ領域の整列用
+};
+
+// アリーナ (一括して解放できる一時メモリ領域)
+struct SE_ARENA
+{
+	UINT ChunkSize;											// チャンクの既定サイズ
+	SE_ARENA_CHUNK *Chunks;									// チャンクリスト (先頭が最新)
+	UINT TotalSize;											// 全チャンクのデータ領域の合計
+};
+
 // FIFO
 struct SE_FIFO
 {
@@ -88,6 +128,7 @@ struct SE_STACK
 // マクロ
 #define	SE_LIST_DATA(o, i)		(((o) != NULL) ? ((o)->p[(i)]) : NULL)
 #define	SE_LIST_NUM(o)			(((o) != NULL) ? (o)->num_item : 0)
+#define	SE_ROUND_ARENA_SIZE(s)	(((s) + (SE_ARENA_ALIGN - 1)) & ~(SE_ARENA_ALIGN - 1))
 
 #if	0
 #define SE_GETARG(ret, start, index)		\
@@ -129,7 +170,22 @@ SE_BUF *SeB64Decode(char *source);
 char SeB64CodeToChar(BYTE c);
 char SeB64CharToCode(char c);
 
+void SeInitMemory();
+void SeFreeMemory();
+UINT SeGetBufPoolClass(UINT size);
+UINT SeGetBufPoolClassSize(UINT c);
+UINT SeGetBufPoolClassMax(UINT c);
+SE_BUF *SeGetBufFromPool(UINT c);
+bool SeReturnBufToPool(SE_BUF *b);
+
+SE_ARENA_CHUNK *SeNewArenaChunk(UINT size);
+SE_ARENA *SeNewArena(UINT chunk_size);
+void SeFreeArena(SE_ARENA *a);
+void *SeArenaAlloc(SE_ARENA *a, UINT size);
+void SeResetArena(SE_ARENA *a);
+
 SE_BUF *SeNewBuf();
+SE_BUF *SeNewBufEx(UINT size);
 SE_BUF *SeMemToBuf(void *data, UINT size);
 SE_BUF *SeRandBuf(UINT size);
 SE_BUF *SeCloneBuf(SE_BUF *b);
@@ -1071,11 +1071,24 @@ void SeSecFreeIPsecSa(SE_SEC *s, SE_IPSEC_SA *sa)
 		return;
 	}
 
-	SeSecSendIPsecSaDeleteMsg(s, sa, sa->IkeSa);
+	if (sa->IkeSa->Ike2 == false)
+	{
+		SeSecSendIPsecSaDeleteMsg(s, sa, sa->IkeSa);
 
-	sa->IkeSa->DeleteNow = true;
+		sa->IkeSa->DeleteNow = true;
+	}
+	else if (sa->Replaced == false)
+	{
+		// IKEv2 では鍵更新済みの古い SA の削除で再接続しない
+		sa->IkeSa->DeleteNow = true;
+	}
 	s->StatusChanged = true;
 
+	if (sa->Pair != NULL)
+	{
+		sa->Pair->Pair = NULL;
+	}
+
 	SeFreeBuf(sa->EncryptionKey);
 	SeFreeBuf(sa->HashKey);
 	SeDes3FreeKey(sa->DesKey);
@@ -2219,6 +2232,10 @@ bool SeSecStartVpnConnect(SE_SEC *s)
 	{
 		return SeSecSendAggr(s);
 	}
+	else if (s->Config.VpnPhase1Mode == SE_IKE2_EXCHANGE_TYPE_IKE_SA_INIT)
+	{
+		return SeSecIke2SendInit(s);
+	}
 	return false;
 }
 
@@ -2283,7 +2300,16 @@ void SeSecProcessMain(SE_SEC *s)
 				{
 					SeSecSendIkeSaMsgPhase2(s, sa);
 				}
+
+				if (sa->Ike2)
+				{
+					// IKEv2 の再送および Child SA の鍵更新
+					SeSecIke2ProcessMain(s, sa);
+				}
 			}
+
+			// IKEv2 の IKE SA の再認証
+			SeSecIke2CheckReauth(s);
 		}
 	}
 	while (s->StatusChanged);
@@ -2598,11 +2624,23 @@ void SeSecUdpRecvCallback(SE_IKE_IP_ADDR *dest_addr, SE_IKE_IP_ADDR *src_addr, U
 			sa = NULL;
 		}
 	}
+	else if (SE_IKE2_IS_EXCHANGE_TYPE(packet_header->ExchangeType))
+	{
+		// IKEv2 パケット
+		sa = SeSecIke2SearchIkeSa(s, src_addr, dest_addr, src_port, dest_port, packet_header);
+	}
 
 	if (sa != NULL)
 	{
 		// IKE SA メッセージ処理
-		SeSecProcessIkeSaMsg(s, sa, packet_header, data, size);
+		if (sa->Ike2)
+		{
+			SeSecIke2ProcessIkeSaMsg(s, sa, packet_header, data, size);
+		}
+		else
+		{
+			SeSecProcessIkeSaMsg(s, sa, packet_header, data, size);
+		}
 	}
 
 	SeIkeFree(packet_header);
@@ -2621,7 +2659,13 @@ void SeSecEspRecvCallback(SE_IKE_IP_ADDR *dest_addr, SE_IKE_IP_ADDR *src_addr, v
 	}
 
 	config = &s->Config;
-	sa = SeSecGetIPsecSa(s, false);
+
+	// 鍵更新中は新旧の SA で受信するため SPI で検索する
+	if (size < sizeof(UINT))
+	{
+		return;
+	}
+	sa = SeSecGetIPsecSaBySpi(s, false, *((UINT *)data));
 	if (sa == NULL)
 	{
 		return;
@@ -2669,7 +2713,7 @@ void SeSecEspRecvCallback(SE_IKE_IP_ADDR *dest_addr, SE_IKE_IP_ADDR *src_addr, v
 					if (SeCmp(hash, hash2, SE_HMAC_SHA1_96_HASH_SIZE) == 0)
 					{
 						// データ本体の解読
-						UCHAR *payload_data = SeMalloc(data_block_size);
+						UCHAR *payload_data = SeArenaAlloc(s->EspRecvArena, data_block_size);
 
 						UINT payload_size;
 
@@ -2698,7 +2742,7 @@ void SeSecEspRecvCallback(SE_IKE_IP_ADDR *dest_addr, SE_IKE_IP_ADDR *src_addr, v
 							}
 						}
 
-						SeFree(payload_data);
+						SeResetArena(s->EspRecvArena);
 					}
 				}
 			}
@@ -2752,7 +2796,7 @@ void SeSecVirtualIpRecvCallback(void *data, UINT size, void *param)
 		esp_size = sizeof(UINT) + sizeof(UINT) + enc_iv_size + data_block_size + hash_size;
 
 		// ESP パケットを構築する
-		esp = SeMalloc(esp_size);
+		esp = SeArenaAlloc(s->EspSendArena, esp_size);
 
 		// SPI
 		SeCopy(esp, &sa->Spi, sizeof(UINT));
@@ -2806,7 +2850,7 @@ void SeSecVirtualIpRecvCallback(void *data, UINT size, void *param)
 		SeCopy(sa->NextIv, esp + sizeof(UINT) + sizeof(UINT) + enc_iv_size
 			+ data_block_size - enc_block_size, enc_block_size);
 
-		SeFree(esp);
+		SeResetArena(s->EspSendArena);
 
 		sa->TransferBytes += size;
 
@@ -2844,6 +2888,29 @@ SE_IPSEC_SA *SeSecGetIPsecSa(SE_SEC *s, bool outgoing)
 	return NULL;
 }
 
+// SPI をキーとして使用可能な IPsec SA の取得
+SE_IPSEC_SA *SeSecGetIPsecSaBySpi(SE_SEC *s, bool outgoing, UINT spi)
+{
+	UINT i;
+	// 引数チェック
+	if (s == NULL)
+	{
+		return NULL;
+	}
+
+	for (i = 0;i < SE_LIST_NUM(s->IPsecSaList);i++)
+	{
+		SE_IPSEC_SA *sa = SE_LIST_DATA(s->IPsecSaList, i);
+
+		if (sa->Outgoing == outgoing && sa->Spi == spi)
+		{
+			return sa;
+		}
+	}
+
+	return NULL;
+}
+
 // 初期化メイン
 void SeSecInitMain(SE_SEC *s)
 {
@@ -2967,7 +3034,12 @@ void SeSecFreeIkeSa(SE_SEC *s, SE_IKE_SA *sa)
 		SeFreeList(o);
 	}
 
-	if (sa->Phase >= 1)
+	if (sa->Ike2)
+	{
+		// IKEv2 固有データの解放 (削除要求の送信を含む)
+		SeSecIke2FreeIkeSa(s, sa);
+	}
+	else if (sa->Phase >= 1)
 	{
 		SeSecSendIkeSaDeleteMsg(s, sa);
 	}
@@ -3416,6 +3488,8 @@ SE_SEC *SeSecInit(SE_VPN *vpn, bool ipv6, SE_SEC_CONFIG *config, SE_SEC_CLIENT_F
 	s->Config = *config;
 	s->IPv6 = ipv6;
 	s->SendStrictIdV6 = send_strict_id;
+	s->EspRecvArena = SeNewArena(SE_SEC_PACKET_ARENA_SIZE);
+	s->EspSendArena = SeNewArena(SE_SEC_PACKET_ARENA_SIZE);
 
 	SeSecSetTimerCallback(s, SeSecTimerCallback);
 	SeSecSetRecvUdpCallback(s, SeSecUdpRecvCallback);
@@ -3442,6 +3516,9 @@ void SeSecFree(SE_SEC *s)
 	// 解放メイン
 	SeSecFreeMain(s);
 
+	SeFreeArena(s->EspRecvArena);
+	SeFreeArena(s->EspSendArena);
+
 	SeFree(s);
 }
 
@@ -65,6 +65,27 @@
 // 定期的ポーリング間隔
 #define SE_SEC_POLLING_INTERVAL					500
 
+// ESP パケット処理用一時領域の初期サイズ (MTU + ESP ヘッダ・IV・認証データ)
+#define SE_SEC_PACKET_ARENA_SIZE				2048
+
+// IKEv2 要求の再送
+#define SE_SEC_IKE2_RETRANSMIT_INTERVAL			2000	// 再送間隔 (ミリ秒)
+#define SE_SEC_IKE2_RETRANSMIT_MAX				5		// 最大再送回数
+
+// IKEv2 の鍵更新を開始する時期 (有効期限に対する割合 %)
+#define SE_SEC_IKE2_REKEY_PERCENT				85
+
+// IKEv2 の鍵更新に失敗した場合に再試行するまでの間隔 (ミリ秒)
+#define SE_SEC_IKE2_REKEY_RETRY_INTERVAL		10000
+
+// IKEv2 応答待ちの要求の種類
+#define SE_SEC_IKE2_REQ_NONE					0		// なし
+#define SE_SEC_IKE2_REQ_SA_INIT					1		// IKE_SA_INIT
+#define SE_SEC_IKE2_REQ_AUTH					2		// IKE_AUTH
+#define SE_SEC_IKE2_REQ_REKEY_CHILD				3		// Child SA の鍵更新
+#define SE_SEC_IKE2_REQ_DELETE_CHILD			4		// 古い Child SA の削除
+#define SE_SEC_IKE2_REQ_DELETE_IKE				5		// IKE SA の削除 (応答を待たない)
+
 
 //
 // データ構造
@@ -131,6 +152,16 @@ struct SE_IKE_P1_KEYSET
 	SE_BUF *SKEYID_e;									// IKE SA 暗号化用鍵
 };
 
+// IKEv2 鍵セット
+struct SE_IKE2_KEYSET
+{
+	SE_BUF *SK_d;										// Child SA 用鍵
+	SE_BUF *SK_ai, *SK_ar;								// 完全性検査用鍵 (イニシエータ, レスポンダ)
+	SE_BUF *SK_ei, *SK_er;								// 暗号化用鍵 (イニシエータ, レスポンダ)
+	SE_BUF *SK_pi, *SK_pr;								// 認証用鍵 (イニシエータ, レスポンダ)
+	SE_DES_KEY *DesKeyI, *DesKeyR;						// DES 鍵 (イニシエータ, レスポンダ)
+};
+
 // IKE SA
 struct SE_IKE_SA
 {
@@ -166,6 +197,26 @@ struct SE_IKE_SA
 	bool DeleteNow;										// 削除フラグ
 	SE_CERT *MyCert;									// 自分の証明書
 	SE_CERT *CaCert;									// CA の証明書
+
+	// IKEv2
+	bool Ike2;											// IKEv2 の SA かどうか
+	SE_IKE2_KEYSET Ike2KeySet;							// IKEv2 鍵セット
+	SE_BUF *Ike2MyNonce, *Ike2YourNonce;				// IKE_SA_INIT での自分と相手の Nonce
+	SE_BUF *Ike2InitRequest;							// 送信した IKE_SA_INIT 要求 (AUTH 計算用)
+	SE_BUF *Ike2InitResponse;							// 受信した IKE_SA_INIT 応答 (AUTH 計算用)
+	SE_BUF *Ike2Cookie;									// レスポンダから要求されたクッキー
+	UINT Ike2NextMessageId;								// 次に送信する要求のメッセージ ID
+	UINT Ike2PeerMessageId;								// 次に受信する相手からの要求のメッセージ ID
+	UINT Ike2Request;									// 応答待ちの要求の種類
+	SE_BUF *Ike2LastRequest;							// 応答待ちの要求 (再送用)
+	SE_BUF *Ike2LastResponse;							// 最後に送信した応答 (再送用)
+	UINT64 Ike2RetransmitTick;							// 次に再送する時刻
+	UINT Ike2RetransmitCount;							// 再送回数
+	UINT Ike2RekeyMySpi;								// 鍵更新中の新しい自分の SPI
+	UINT Ike2RekeyOldSpi;								// 鍵更新 / 削除中の古い自分の SPI
+	SE_BUF *Ike2RekeyMyNonce;							// 鍵更新中の自分の Nonce
+	UINT64 Ike2RekeyRetryTick;							// 鍵更新を再試行する時刻
+	bool Ike2Deleting;									// IKE SA の削除を通知済み (解放時に削除要求を送らない)
 };
 
 // IPsec SA
@@ -182,6 +233,8 @@ struct SE_IPSEC_SA
 	SE_BUF *EncryptionKey;								// 暗号化鍵
 	SE_BUF *HashKey;									// ハッシュ鍵
 	SE_DES_KEY *DesKey;									// DES 鍵
+	SE_IPSEC_SA *Pair;									// 反対方向の IPsec SA
+	bool Replaced;										// 鍵更新により新しい SA に置き換えられた
 };
 
 // IPsec 処理構造体
@@ -199,6 +252,8 @@ struct SE_SEC
 	UINT64 PoolingVar;									// ポーリング用変数
 	bool StatusChanged;									// 状態変化
 	bool SendStrictIdV6;								// IPv6 において厳密に ID を送信する
+	SE_ARENA *EspRecvArena;								// ESP 受信処理用の一時領域
+	SE_ARENA *EspSendArena;								// ESP 送信処理用の一時領域
 };
 
 // 関数プロトタイプ
@@ -289,6 +344,43 @@ void SeSecFreeIPsecSa(SE_SEC *s, SE_IPSEC_SA *sa);
 UINT64 SeSecLifeSeconds64bit(UINT value);
 
 SE_IPSEC_SA *SeSecGetIPsecSa(SE_SEC *s, bool outgoing);
+SE_IPSEC_SA *SeSecGetIPsecSaBySpi(SE_SEC *s, bool outgoing, UINT spi);
+
+bool SeSecIke2SendInit(SE_SEC *s);
+void SeSecIke2SendInitRequest(SE_SEC *s, SE_IKE_SA *sa);
+void SeSecIke2RecvInit(SE_SEC *s, SE_IKE_SA *sa, void *data, UINT size);
+void SeSecIke2SendAuth(SE_SEC *s, SE_IKE_SA *sa);
+void SeSecIke2RecvAuth(SE_SEC *s, SE_IKE_SA *sa, void *data, UINT size);
+void SeSecIke2SendRekeyChild(SE_SEC *s, SE_IKE_SA *sa, SE_IPSEC_SA *old_sa);
+void SeSecIke2RecvRekeyChild(SE_SEC *s, SE_IKE_SA *sa, void *data, UINT size);
+void SeSecIke2SendDeleteChild(SE_SEC *s, SE_IKE_SA *sa, UINT spi);
+void SeSecIke2RecvDeleteChild(SE_SEC *s, SE_IKE_SA *sa, void *data, UINT size);
+void SeSecIke2SendDeleteIke(SE_SEC *s, SE_IKE_SA *sa);
+void SeSecIke2ProcessRequest(SE_SEC *s, SE_IKE_SA *sa, void *data, UINT size);
+void SeSecIke2ProcessPeerInfo(SE_SEC *s, SE_IKE_SA *sa, SE_IKE_PACKET *packet, SE_LIST *response);
+void SeSecIke2ProcessPeerCreateChild(SE_SEC *s, SE_IKE_SA *sa, SE_IKE_PACKET *packet, SE_LIST *response);
+void SeSecIke2ProcessIkeSaMsg(SE_SEC *s, SE_IKE_SA *sa, SE_IKE_PACKET *packet_header, void *data, UINT size);
+void SeSecIke2ProcessMain(SE_SEC *s, SE_IKE_SA *sa);
+void SeSecIke2CheckReauth(SE_SEC *s);
+SE_IKE_SA *SeSecIke2SearchIkeSa(SE_SEC *s, SE_IKE_IP_ADDR *src_addr, SE_IKE_IP_ADDR *dest_addr,
+								UINT src_port, UINT dest_port, SE_IKE_PACKET *packet_header);
+void SeSecIke2SendRequest(SE_SEC *s, SE_IKE_SA *sa, UINT request, UCHAR exchange_type, SE_LIST *payload_list);
+void SeSecIke2ClearRequest(SE_IKE_SA *sa);
+void SeSecIke2SendResponse(SE_SEC *s, SE_IKE_SA *sa, UCHAR exchange_type, UINT msg_id, SE_LIST *payload_list);
+SE_IKE_PACKET *SeSecIke2ParseEncrypted(SE_IKE_SA *sa, void *data, UINT size);
+SE_BUF *SeSecIke2PrfPlus(SE_BUF *key, void *seed, UINT seed_size, UINT request_size);
+SE_DES_KEY *SeSecIke2NewDesKey(SE_SEC *s, SE_BUF *key);
+void SeSecIke2CalcKeySet(SE_SEC *s, SE_IKE_SA *sa, void *dh_key, UINT dh_key_size);
+void SeSecIke2FreeKeySet(SE_IKE2_KEYSET *set);
+SE_BUF *SeSecIke2CalcAuth(SE_SEC *s, SE_BUF *message, SE_BUF *nonce, SE_BUF *sk_p, SE_BUF *id_body);
+SE_IKE_PACKET_PAYLOAD *SeSecIke2NewChildSaPayload(SE_SEC *s, UINT spi);
+bool SeSecIke2GetChildSpi(SE_SEC *s, SE_IKE_PACKET_PAYLOAD *sa_payload, UINT *spi);
+void SeSecIke2AddTsPayloads(SE_SEC *s, SE_LIST *payload_list);
+void SeSecIke2InstallChildSa(SE_SEC *s, SE_IKE_SA *sa, UINT my_spi, UINT your_spi,
+							 SE_BUF *nonce_i, SE_BUF *nonce_r, bool initiator, SE_IPSEC_SA *old_sa);
+SE_IPSEC_SA *SeSecIke2GetCurrentChildSa(SE_SEC *s, SE_IKE_SA *sa);
+bool SeSecIke2IsRekeyTime(SE_SEC *s, UINT64 established_tick, UINT64 transfer_bytes, UINT life_seconds, UINT life_kilobytes);
+void SeSecIke2FreeIkeSa(SE_SEC *s, SE_IKE_SA *sa);
 
 #endif	// SESEC_H
 
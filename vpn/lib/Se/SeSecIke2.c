@@ -0,0 +1,1571 @@
+/*
+ * Copyright (c) 2007, 2008 University of Tsukuba
+ * Copyright (C) 2007, 2008 
+ *      National Institute of Information and Communications Technology
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the University of Tsukuba nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Secure VM Project
+// VPN Client Module (IPsec Driver) Source Code
+// 
+// Developed by Daiyuu Nobori (dnobori@cs.tsukuba.ac.jp)
+
+// SeSecIke2.c
+// 概要: IKEv2 処理
+
+#define SE_INTERNAL
+#include <Se/Se.h>
+
+// IKEv2 による VPN 接続の開始
+bool SeSecIke2SendInit(SE_SEC *s)
+{
+	SE_IKE_SA *sa;
+	SE_SEC_CONFIG *config;
+	char tmp1[MAX_SIZE], tmp2[MAX_SIZE];
+	UINT vpn_connect_timeout_interval;
+	// 引数チェック
+	if (s == NULL)
+	{
+		return false;
+	}
+
+	config = &s->Config;
+
+	if (config->VpnAuthMethod != SE_SEC_AUTH_METHOD_PASSWORD)
+	{
+		SeError("IKE: IKEv2: VpnAuthMethod is not Password");
+		return false;
+	}
+
+	if (s->SendStrictIdV6 && s->IPv6)
+	{
+		if (SeIkeIsZeroIP(&config->MyVirtualIpAddress))
+		{
+			// 自分の使用すべき仮想 IP アドレスが指定されていない
+			return false;
+		}
+	}
+
+	SeIkeIpAddressToStr(tmp1, &s->Config.VpnGatewayAddress);
+	SeIkeIpAddressToStr(tmp2, &s->Config.MyIpAddress);
+	SeInfo("IKE: VPN Connect Start (IKEv2): %s -> %s", tmp2, tmp1);
+
+	// IKE SA の作成
+	sa = SeSecNewIkeSa(s, s->Config.MyIpAddress, s->Config.VpnGatewayAddress,
+		SE_SEC_IKE_UDP_PORT, SE_SEC_IKE_UDP_PORT, SeSecGenIkeSaInitCookie(s));
+	sa->Ike2 = true;
+
+	SeInfo("IKE: SA #%u Created", sa->Id);
+
+	SeBinToStr(tmp1, sizeof(tmp1), &sa->InitiatorCookie, sizeof(sa->InitiatorCookie));
+	SeInfo("IKE: SA #%u: Initiator SPI: 0x%s", sa->Id, tmp1);
+
+	// DH 作成
+	sa->Dh = SeDhNewGroup2();
+
+	// Nonce 生成
+	sa->Ike2MyNonce = SeRandBuf(SE_SHA1_HASH_SIZE);
+
+	// 事前共有鍵
+	sa->Phase1Password = SeIkeStrToPassword(config->VpnPassword);
+
+	vpn_connect_timeout_interval = s->Config.VpnConnectTimeout * 1000;
+	sa->ConnectTimeoutTick = SeSecTick(s) + (UINT64)(vpn_connect_timeout_interval);
+
+	SeSecAddTimer(s, vpn_connect_timeout_interval);
+
+	// IKE_SA_INIT 要求の送信
+	SeSecIke2SendInitRequest(s, sa);
+
+	return true;
+}
+
+// IKE_SA_INIT 要求の送信
+void SeSecIke2SendInitRequest(SE_SEC *s, SE_IKE_SA *sa)
+{
+	SE_SEC_CONFIG *config;
+	SE_LIST *payload_list;
+	SE_LIST *transform_list;
+	SE_LIST *proposal_list;
+	// 引数チェック
+	if (s == NULL || sa == NULL)
+	{
+		return;
+	}
+
+	config = &s->Config;
+
+	payload_list = SeNewList(NULL);
+
+	// レスポンダからクッキーを要求されている場合は先頭に付加する
+	if (sa->Ike2Cookie != NULL)
+	{
+		SeAdd(payload_list, SeIke2NewNoticePayload(0, SE_IKE2_NOTICE_COOKIE, NULL, 0,
+			sa->Ike2Cookie->Buf, sa->Ike2Cookie->Size));
+	}
+
+	// トランスフォームリストの作成
+	transform_list = SeNewList(NULL);
+	SeAdd(transform_list, SeIke2NewTransform(SE_IKE2_TRANSFORM_TYPE_ENCR,
+		(config->VpnPhase1Crypto == SE_IKE_P1_CRYPTO_DES_CBC ? SE_IKE2_ENCR_DES : SE_IKE2_ENCR_3DES), NULL));
+	SeAdd(transform_list, SeIke2NewTransform(SE_IKE2_TRANSFORM_TYPE_PRF, SE_IKE2_PRF_HMAC_SHA1, NULL));
+	SeAdd(transform_list, SeIke2NewTransform(SE_IKE2_TRANSFORM_TYPE_INTEG, SE_IKE2_INTEG_HMAC_SHA1_96, NULL));
+	SeAdd(transform_list, SeIke2NewTransform(SE_IKE2_TRANSFORM_TYPE_DH, SE_IKE2_DH_1024_MODP, NULL));
+
+	// プロポーザルリストの作成
+	proposal_list = SeNewList(NULL);
+	SeAdd(proposal_list, SeIke2NewProposal(1, SE_IKE_PROTOCOL_ID_IKE, NULL, 0, transform_list));
+
+	// SA ペイロードの追加
+	SeAdd(payload_list, SeIke2NewSaPayload(proposal_list));
+
+	// 鍵交換ペイロードの追加
+	SeAdd(payload_list, SeIke2NewKeyExchangePayload(SE_IKE2_DH_1024_MODP,
+		sa->Dh->MyPublicKey->Buf, sa->Dh->MyPublicKey->Size));
+
+	// Nonce ペイロードの追加
+	SeAdd(payload_list, SeIkeNewDataPayload(SE_IKE2_PAYLOAD_NONCE,
+		sa->Ike2MyNonce->Buf, sa->Ike2MyNonce->Size));
+
+	// ベンダ ID ペイロードの追加
+	SeAdd(payload_list, SeIkeNewDataPayload(SE_IKE2_PAYLOAD_VENDOR_ID,
+		SE_SEC_VENDOR_ID_STR, SeStrLen(SE_SEC_VENDOR_ID_STR)));
+
+	// IKE_SA_INIT は常にメッセージ ID 0
+	sa->Ike2NextMessageId = 0;
+	SeSecIke2SendRequest(s, sa, SE_SEC_IKE2_REQ_SA_INIT, SE_IKE2_EXCHANGE_TYPE_IKE_SA_INIT, payload_list);
+
+	// AUTH 計算のために送信したメッセージを保存しておく
+	if (sa->Ike2InitRequest != NULL)
+	{
+		SeFreeBuf(sa->Ike2InitRequest);
+	}
+	sa->Ike2InitRequest = SeCloneBuf(sa->Ike2LastRequest);
+
+	sa->Status = 1;
+}
+
+// IKE_SA_INIT 応答受信処理
+void SeSecIke2RecvInit(SE_SEC *s, SE_IKE_SA *sa, void *data, UINT size)
+{
+	SE_SEC_CONFIG *config;
+	SE_IKE_PACKET *packet;
+	SE_IKE_PACKET_PAYLOAD *cookie_payload, *sa_payload, *ke_payload, *nonce_payload;
+	SE_IKE2_PACKET_PROPOSAL *proposal = NULL;
+	USHORT error_type, encr_id = 0;
+	UCHAR dh_key[SE_DH_KEY_SIZE];
+	// 引数チェック
+	if (s == NULL || sa == NULL || data == NULL)
+	{
+		return;
+	}
+
+	config = &s->Config;
+
+	packet = SeIke2Parse(data, size, NULL);
+	if (packet == NULL)
+	{
+		return;
+	}
+
+	// クッキーを要求された場合はクッキーを付加して再送する
+	cookie_payload = SeIke2GetNotice(packet->PayloadList, SE_IKE2_NOTICE_COOKIE);
+	if (cookie_payload != NULL)
+	{
+		SeInfo("IKE: SA #%u: Cookie Requested", sa->Id);
+
+		if (sa->Ike2Cookie != NULL)
+		{
+			SeFreeBuf(sa->Ike2Cookie);
+		}
+		sa->Ike2Cookie = SeCloneBuf(cookie_payload->Payload.Notice.MessageData);
+
+		SeSecIke2SendInitRequest(s, sa);
+		goto exit;
+	}
+
+	error_type = SeIke2GetErrorNotice(packet->PayloadList);
+	if (error_type != 0)
+	{
+		// 接続タイムアウトまで再試行しない
+		SeError("IKE: SA #%u: IKE_SA_INIT Rejected (Notify %u)", sa->Id, error_type);
+		SeSecIke2ClearRequest(sa);
+		goto exit;
+	}
+
+	sa_payload = SeIkeGetPayload(packet->PayloadList, SE_IKE2_PAYLOAD_SA, 0);
+	ke_payload = SeIkeGetPayload(packet->PayloadList, SE_IKE2_PAYLOAD_KEY_EXCHANGE, 0);
+	nonce_payload = SeIkeGetPayload(packet->PayloadList, SE_IKE2_PAYLOAD_NONCE, 0);
+
+	if (sa_payload != NULL && SE_LIST_NUM(sa_payload->Payload.Sa2.ProposalList) >= 1)
+	{
+		proposal = SE_LIST_DATA(sa_payload->Payload.Sa2.ProposalList, 0);
+	}
+
+	if (proposal == NULL || ke_payload == NULL || nonce_payload == NULL ||
+		packet->ResponderCookie == 0)
+	{
+		SeError("IKE: SA #%u: Invalid Response Payload", sa->Id);
+		goto exit;
+	}
+
+	// 選択されたプロポーザルの検査
+	if (SeIke2GetTransformId(proposal, SE_IKE2_TRANSFORM_TYPE_ENCR, &encr_id) == false ||
+		encr_id != (config->VpnPhase1Crypto == SE_IKE_P1_CRYPTO_DES_CBC ? SE_IKE2_ENCR_DES : SE_IKE2_ENCR_3DES) ||
+		ke_payload->Payload.KeyExchange2.DhGroup != SE_IKE2_DH_1024_MODP ||
+		ke_payload->Payload.KeyExchange2.Data->Size != SE_DH_KEY_SIZE)
+	{
+		SeError("IKE: SA #%u: Invalid Proposal Chosen", sa->Id);
+		goto exit;
+	}
+
+	// DH 鍵の計算
+	if (SeDhCompute(sa->Dh, dh_key, ke_payload->Payload.KeyExchange2.Data->Buf,
+		ke_payload->Payload.KeyExchange2.Data->Size) == false)
+	{
+		SeError("IKE: SA #%u: DH Compute Failed", sa->Id);
+		goto exit;
+	}
+
+	SeSecIke2ClearRequest(sa);
+
+	// レスポンダ SPI の設定 (リストのソート順を保つため入れ直す)
+	SeDelete(s->IkeSaList, sa);
+	sa->ResponderCookie = packet->ResponderCookie;
+	SeInsert(s->IkeSaList, sa);
+
+	sa->Ike2YourNonce = SeCloneBuf(nonce_payload->Payload.GeneralData.Data);
+	sa->Ike2InitResponse = SeMemToBuf(data, size);
+	sa->TransferBytes += packet->DecryptedPayload->Size;
+
+	// 鍵セットの計算
+	SeSecIke2CalcKeySet(s, sa, dh_key, sizeof(dh_key));
+
+	sa->Phase = 1;
+	sa->Status = 2;
+	sa->Ike2PeerMessageId = 0;
+
+	SeInfo("IKE: SA #%u: IKE_SA_INIT Completed", sa->Id);
+
+	// IKE_AUTH 要求の送信
+	SeSecIke2SendAuth(s, sa);
+
+exit:
+	SeIkeFree(packet);
+}
+
+// IKE_AUTH 要求の送信
+void SeSecIke2SendAuth(SE_SEC *s, SE_IKE_SA *sa)
+{
+	SE_SEC_CONFIG *config;
+	SE_LIST *payload_list;
+	SE_IKE_PACKET_PAYLOAD *id_payload;
+	SE_BUF *id_body, *auth;
+	char tmp1[MAX_SIZE];
+	// 引数チェック
+	if (s == NULL || sa == NULL)
+	{
+		return;
+	}
+
+	config = &s->Config;
+
+	payload_list = SeNewList(NULL);
+
+	// ID ペイロードの作成
+	if (SeStrLen(config->VpnIdString) != 0)
+	{
+		id_payload = SeIke2NewIdPayload(SE_IKE2_PAYLOAD_ID_I, SE_IKE_ID_USER_FQDN,
+			config->VpnIdString, SeStrLen(config->VpnIdString));
+	}
+	else if (s->IPv6 == false)
+	{
+		UINT myip_32 = Se4IPToUINT(SeIkeGetIPv4Address(&config->MyIpAddress));
+
+		id_payload = SeIke2NewIdPayload(SE_IKE2_PAYLOAD_ID_I, SE_IKE_ID_IPV4_ADDR,
+			&myip_32, sizeof(myip_32));
+	}
+	else
+	{
+		id_payload = SeIke2NewIdPayload(SE_IKE2_PAYLOAD_ID_I, SE_IKE_ID_IPV6_ADDR,
+			&config->MyIpAddress.Address.Ipv6, sizeof(SE_IPV6_ADDR));
+	}
+	SeAdd(payload_list, id_payload);
+
+	// 認証ペイロードの作成
+	id_body = SeIkeBuildIdPayload(&id_payload->Payload.Id);
+	auth = SeSecIke2CalcAuth(s, sa->Ike2InitRequest, sa->Ike2YourNonce,
+		sa->Ike2KeySet.SK_pi, id_body);
+	SeAdd(payload_list, SeIke2NewAuthPayload(SE_IKE2_AUTH_METHOD_PRESHAREDKEY, auth->Buf, auth->Size));
+	SeFreeBuf(id_body);
+	SeFreeBuf(auth);
+
+	// SA ペイロードの作成
+	sa->MySpi = SeSecGenIPsecSASpi(s);
+	SeAdd(payload_list, SeSecIke2NewChildSaPayload(s, sa->MySpi));
+
+	SeBinToStr(tmp1, sizeof(tmp1), &sa->MySpi, sizeof(sa->MySpi));
+	SeInfo("IKE: SA #%u: Initiator ESP SPI: 0x%s", sa->Id, tmp1);
+
+	// トラフィックセレクタペイロードの作成
+	SeSecIke2AddTsPayloads(s, payload_list);
+
+	SeSecIke2SendRequest(s, sa, SE_SEC_IKE2_REQ_AUTH, SE_IKE2_EXCHANGE_TYPE_IKE_AUTH, payload_list);
+
+	sa->Status = 3;
+}
+
+// IKE_AUTH 応答受信処理
+void SeSecIke2RecvAuth(SE_SEC *s, SE_IKE_SA *sa, void *data, UINT size)
+{
+	SE_IKE_PACKET *packet;
+	SE_IKE_PACKET_PAYLOAD *id_payload, *auth_payload, *sa_payload;
+	SE_BUF *auth;
+	USHORT error_type;
+	UINT your_spi;
+	UINT i;
+	char tmp1[MAX_SIZE];
+	// 引数チェック
+	if (s == NULL || sa == NULL || data == NULL)
+	{
+		return;
+	}
+
+	packet = SeSecIke2ParseEncrypted(sa, data, size);
+	if (packet == NULL)
+	{
+		return;
+	}
+
+	error_type = SeIke2GetErrorNotice(packet->PayloadList);
+	if (error_type != 0)
+	{
+		// 接続タイムアウトまで再試行しない
+		if (error_type == SE_IKE2_NOTICE_AUTHENTICATION_FAILED)
+		{
+			SeError("IKE: SA #%u: Authentication Failed", sa->Id);
+		}
+		else
+		{
+			SeError("IKE: SA #%u: IKE_AUTH Rejected (Notify %u)", sa->Id, error_type);
+		}
+		SeSecIke2ClearRequest(sa);
+		goto exit;
+	}
+
+	id_payload = SeIkeGetPayload(packet->PayloadList, SE_IKE2_PAYLOAD_ID_R, 0);
+	auth_payload = SeIkeGetPayload(packet->PayloadList, SE_IKE2_PAYLOAD_AUTH, 0);
+	sa_payload = SeIkeGetPayload(packet->PayloadList, SE_IKE2_PAYLOAD_SA, 0);
+
+	if (id_payload == NULL || auth_payload == NULL || sa_payload == NULL)
+	{
+		SeError("IKE: SA #%u: Invalid Response Payload", sa->Id);
+		goto exit;
+	}
+
+	// レスポンダの認証データを検査
+	if (auth_payload->Payload.Auth.Method != SE_IKE2_AUTH_METHOD_PRESHAREDKEY)
+	{
+		SeError("IKE: SA #%u: Unsupported Responder Auth Method: %u", sa->Id,
+			auth_payload->Payload.Auth.Method);
+		goto exit;
+	}
+
+	auth = SeSecIke2CalcAuth(s, sa->Ike2InitResponse, sa->Ike2MyNonce,
+		sa->Ike2KeySet.SK_pr, id_payload->BitArray);
+	if (SeCmpEx(auth->Buf, auth->Size, auth_payload->Payload.Auth.Data->Buf,
+		auth_payload->Payload.Auth.Data->Size) == false)
+	{
+		SeFreeBuf(auth);
+		SeError("IKE: SA #%u: Invalid Responder Auth", sa->Id);
+		goto exit;
+	}
+	SeFreeBuf(auth);
+
+	// ゲートウェイから取得した SPI 値をチェック
+	if (SeSecIke2GetChildSpi(s, sa_payload, &your_spi) == false)
+	{
+		SeError("IKE: SA #%u: Invalid SPI Value", sa->Id);
+		goto exit;
+	}
+
+	SeSecIke2ClearRequest(sa);
+
+	sa->YourSpi = your_spi;
+	SeBinToStr(tmp1, sizeof(tmp1), &your_spi, sizeof(your_spi));
+	SeInfo("IKE: SA #%u: Responder ESP SPI: 0x%s", sa->Id, tmp1);
+
+	sa->TransferBytes += packet->DecryptedPayload->Size;
+
+	// IPsec SA の確立
+	SeSecIke2InstallChildSa(s, sa, sa->MySpi, sa->YourSpi,
+		sa->Ike2MyNonce, sa->Ike2YourNonce, true, NULL);
+
+	// VPN 接続の確立完了
+	SeInfo("IKE: SA #%u: VPN Connection Established", sa->Id);
+	sa->Established = true;
+	sa->Phase1EstablishedTick = SeSecTick(s);
+	sa->LastCommTick = SeSecTick(s);
+
+	// 再認証の場合は古い IKE SA を削除する (新しい IPsec SA は既に使用可能)
+	for (i = 0;i < SE_LIST_NUM(s->IkeSaList);i++)
+	{
+		SE_IKE_SA *sa2 = SE_LIST_DATA(s->IkeSaList, i);
+
+		if (sa2 != sa && sa2->DeleteNow == false)
+		{
+			SeInfo("IKE: SA #%u: Superseded by SA #%u", sa2->Id, sa->Id);
+			sa2->DeleteNow = true;
+			s->StatusChanged = true;
+		}
+	}
+
+exit:
+	SeIkeFree(packet);
+}
+
+// Child SA の鍵更新要求の送信
+void SeSecIke2SendRekeyChild(SE_SEC *s, SE_IKE_SA *sa, SE_IPSEC_SA *old_sa)
+{
+	SE_LIST *payload_list;
+	UINT old_spi;
+	char tmp1[MAX_SIZE];
+	// 引数チェック
+	if (s == NULL || sa == NULL || old_sa == NULL || old_sa->Pair == NULL)
+	{
+		return;
+	}
+
+	// 鍵更新対象は自分の受信側 SPI で示す
+	old_spi = (old_sa->Outgoing ? old_sa->Pair->Spi : old_sa->Spi);
+
+	sa->Ike2RekeyOldSpi = old_spi;
+	sa->Ike2RekeyMySpi = SeSecGenIPsecSASpi(s);
+	if (sa->Ike2RekeyMyNonce != NULL)
+	{
+		SeFreeBuf(sa->Ike2RekeyMyNonce);
+	}
+	sa->Ike2RekeyMyNonce = SeRandBuf(SE_SHA1_HASH_SIZE);
+
+	SeBinToStr(tmp1, sizeof(tmp1), &sa->Ike2RekeyMySpi, sizeof(sa->Ike2RekeyMySpi));
+	SeInfo("IKE: SA #%u: Child SA Rekey Started (New Initiator ESP SPI: 0x%s)", sa->Id, tmp1);
+
+	payload_list = SeNewList(NULL);
+
+	SeAdd(payload_list, SeIke2NewNoticePayload(SE_IKE_PROTOCOL_ID_IPSEC_ESP, SE_IKE2_NOTICE_REKEY_SA,
+		&old_spi, sizeof(old_spi), NULL, 0));
+	SeAdd(payload_list, SeSecIke2NewChildSaPayload(s, sa->Ike2RekeyMySpi));
+	SeAdd(payload_list, SeIkeNewDataPayload(SE_IKE2_PAYLOAD_NONCE,
+		sa->Ike2RekeyMyNonce->Buf, sa->Ike2RekeyMyNonce->Size));
+	SeSecIke2AddTsPayloads(s, payload_list);
+
+	SeSecIke2SendRequest(s, sa, SE_SEC_IKE2_REQ_REKEY_CHILD, SE_IKE2_EXCHANGE_TYPE_CREATE_CHILD_SA, payload_list);
+}
+
+// Child SA の鍵更新応答受信処理
+void SeSecIke2RecvRekeyChild(SE_SEC *s, SE_IKE_SA *sa, void *data, UINT size)
+{
+	SE_IKE_PACKET *packet;
+	SE_IKE_PACKET_PAYLOAD *sa_payload, *nonce_payload;
+	SE_IPSEC_SA *old_sa;
+	USHORT error_type;
+	UINT your_spi;
+	// 引数チェック
+	if (s == NULL || sa == NULL || data == NULL)
+	{
+		return;
+	}
+
+	packet = SeSecIke2ParseEncrypted(sa, data, size);
+	if (packet == NULL)
+	{
+		return;
+	}
+
+	sa->TransferBytes += packet->DecryptedPayload->Size;
+
+	SeSecIke2ClearRequest(sa);
+
+	sa_payload = SeIkeGetPayload(packet->PayloadList, SE_IKE2_PAYLOAD_SA, 0);
+	nonce_payload = SeIkeGetPayload(packet->PayloadList, SE_IKE2_PAYLOAD_NONCE, 0);
+	error_type = SeIke2GetErrorNotice(packet->PayloadList);
+
+	if (error_type != 0 || sa_payload == NULL || nonce_payload == NULL ||
+		SeSecIke2GetChildSpi(s, sa_payload, &your_spi) == false)
+	{
+		// 古い SA はそのまま使用し, しばらく後に再試行する
+		SeError("IKE: SA #%u: Child SA Rekey Failed (Notify %u)", sa->Id, error_type);
+		sa->Ike2RekeyRetryTick = SeSecTick(s) + (UINT64)SE_SEC_IKE2_REKEY_RETRY_INTERVAL;
+		SeSecAddTimer(s, SE_SEC_IKE2_REKEY_RETRY_INTERVAL);
+		goto exit;
+	}
+
+	old_sa = SeSecGetIPsecSaBySpi(s, false, sa->Ike2RekeyOldSpi);
+	if (old_sa != NULL && old_sa->IkeSa != sa)
+	{
+		old_sa = NULL;
+	}
+
+	// 新しい IPsec SA を確立してから古い IPsec SA を削除する
+	SeSecIke2InstallChildSa(s, sa, sa->Ike2RekeyMySpi, your_spi,
+		sa->Ike2RekeyMyNonce, nonce_payload->Payload.GeneralData.Data, true, old_sa);
+
+	SeInfo("IKE: SA #%u: Child SA Rekey Completed", sa->Id);
+
+	if (old_sa != NULL)
+	{
+		SeSecIke2SendDeleteChild(s, sa, sa->Ike2RekeyOldSpi);
+	}
+
+exit:
+	if (sa->Ike2RekeyMyNonce != NULL)
+	{
+		SeFreeBuf(sa->Ike2RekeyMyNonce);
+		sa->Ike2RekeyMyNonce = NULL;
+	}
+
+	SeIkeFree(packet);
+}
+
+// 古い Child SA の削除要求の送信
+void SeSecIke2SendDeleteChild(SE_SEC *s, SE_IKE_SA *sa, UINT spi)
+{
+	SE_LIST *payload_list;
+	SE_LIST *spi_list;
+	// 引数チェック
+	if (s == NULL || sa == NULL)
+	{
+		return;
+	}
+
+	sa->Ike2RekeyOldSpi = spi;
+
+	spi_list = SeNewList(NULL);
+	SeAdd(spi_list, SeMemToBuf(&spi, sizeof(UINT)));
+
+	payload_list = SeNewList(NULL);
+	SeAdd(payload_list, SeIke2NewDeletePayload(SE_IKE_PROTOCOL_ID_IPSEC_ESP, spi_list));
+
+	SeSecIke2SendRequest(s, sa, SE_SEC_IKE2_REQ_DELETE_CHILD, SE_IKE2_EXCHANGE_TYPE_INFORMATIONAL, payload_list);
+}
+
+// 古い Child SA の削除応答受信処理
+void SeSecIke2RecvDeleteChild(SE_SEC *s, SE_IKE_SA *sa, void *data, UINT size)
+{
+	SE_IKE_PACKET *packet;
+	SE_IPSEC_SA *old_sa;
+	// 引数チェック
+	if (s == NULL || sa == NULL || data == NULL)
+	{
+		return;
+	}
+
+	packet = SeSecIke2ParseEncrypted(sa, data, size);
+	if (packet == NULL)
+	{
+		return;
+	}
+
+	sa->TransferBytes += packet->DecryptedPayload->Size;
+
+	SeSecIke2ClearRequest(sa);
+
+	old_sa = SeSecGetIPsecSaBySpi(s, false, sa->Ike2RekeyOldSpi);
+	if (old_sa != NULL && old_sa->IkeSa == sa)
+	{
+		if (old_sa->Pair != NULL)
+		{
+			SeSecFreeIPsecSa(s, old_sa->Pair);
+		}
+		SeSecFreeIPsecSa(s, old_sa);
+
+		SeInfo("IKE: SA #%u: Old Child SA Deleted", sa->Id);
+	}
+
+	SeIkeFree(packet);
+}
+
+// IKE SA の削除要求の送信 (応答は待たない)
+void SeSecIke2SendDeleteIke(SE_SEC *s, SE_IKE_SA *sa)
+{
+	SE_LIST *payload_list;
+	// 引数チェック
+	if (s == NULL || sa == NULL)
+	{
+		return;
+	}
+
+	if (sa->Phase < 1 || sa->Ike2Deleting)
+	{
+		return;
+	}
+
+	sa->Ike2Deleting = true;
+
+	payload_list = SeNewList(NULL);
+	SeAdd(payload_list, SeIke2NewDeletePayload(SE_IKE_PROTOCOL_ID_IKE, SeNewList(NULL)));
+
+	SeSecIke2SendRequest(s, sa, SE_SEC_IKE2_REQ_DELETE_IKE, SE_IKE2_EXCHANGE_TYPE_INFORMATIONAL, payload_list);
+}
+
+// 相手からの要求の処理
+void SeSecIke2ProcessRequest(SE_SEC *s, SE_IKE_SA *sa, void *data, UINT size)
+{
+	SE_IKE_PACKET *packet;
+	SE_LIST *response;
+	// 引数チェック
+	if (s == NULL || sa == NULL || data == NULL)
+	{
+		return;
+	}
+
+	packet = SeSecIke2ParseEncrypted(sa, data, size);
+	if (packet == NULL)
+	{
+		return;
+	}
+
+	if (sa->Ike2PeerMessageId != 0 && packet->MessageId == (sa->Ike2PeerMessageId - 1))
+	{
+		// 再送された要求には前回の応答を再送する
+		if (sa->Ike2LastResponse != NULL)
+		{
+			SeSecSendUdp(s, &sa->DestAddr, &sa->SrcAddr, sa->DestPort, sa->SrcPort,
+				sa->Ike2LastResponse->Buf, sa->Ike2LastResponse->Size);
+		}
+	}
+	else if (packet->MessageId == sa->Ike2PeerMessageId)
+	{
+		sa->TransferBytes += packet->DecryptedPayload->Size;
+		sa->LastCommTick = SeSecTick(s);
+
+		response = SeNewList(NULL);
+
+		switch (packet->ExchangeType)
+		{
+		case SE_IKE2_EXCHANGE_TYPE_INFORMATIONAL:
+			// 情報交換 (削除, 生存確認)
+			SeSecIke2ProcessPeerInfo(s, sa, packet, response);
+			break;
+
+		case SE_IKE2_EXCHANGE_TYPE_CREATE_CHILD_SA:
+			// 相手からの鍵更新
+			SeSecIke2ProcessPeerCreateChild(s, sa, packet, response);
+			break;
+
+		default:
+			SeAdd(response, SeIke2NewNoticePayload(0, SE_IKE2_NOTICE_NO_PROPOSAL_CHOSEN, NULL, 0, NULL, 0));
+			break;
+		}
+
+		SeSecIke2SendResponse(s, sa, packet->ExchangeType, packet->MessageId, response);
+
+		sa->Ike2PeerMessageId++;
+	}
+
+	SeIkeFree(packet);
+}
+
+// 相手からの情報交換要求の処理
+void SeSecIke2ProcessPeerInfo(SE_SEC *s, SE_IKE_SA *sa, SE_IKE_PACKET *packet, SE_LIST *response)
+{
+	UINT i, j;
+	// 引数チェック
+	if (s == NULL || sa == NULL || packet == NULL || response == NULL)
+	{
+		return;
+	}
+
+	for (i = 0;i < SeIkeGetPayloadNum(packet->PayloadList, SE_IKE2_PAYLOAD_DELETE);i++)
+	{
+		SE_IKE_PACKET_PAYLOAD *p = SeIkeGetPayload(packet->PayloadList, SE_IKE2_PAYLOAD_DELETE, i);
+		SE_IKE_PACKET_DELETE_PAYLOAD *del = &p->Payload.Delete;
+
+		if (del->ProtocolId == SE_IKE_PROTOCOL_ID_IKE)
+		{
+			// IKE SA の削除
+			SeInfo("IKE: SA #%u: Deleted by Peer", sa->Id);
+			sa->Ike2Deleting = true;
+			sa->DeleteNow = true;
+			s->StatusChanged = true;
+		}
+		else if (del->ProtocolId == SE_IKE_PROTOCOL_ID_IPSEC_ESP)
+		{
+			// Child SA の削除 (相手の受信側 SPI = 自分の送信側 SPI)
+			SE_LIST *spi_list = SeNewList(NULL);
+
+			for (j = 0;j < SE_LIST_NUM(del->SpiList);j++)
+			{
+				SE_BUF *b = SE_LIST_DATA(del->SpiList, j);
+				SE_IPSEC_SA *out_sa;
+
+				if (b->Size != sizeof(UINT))
+				{
+					continue;
+				}
+
+				out_sa = SeSecGetIPsecSaBySpi(s, true, *((UINT *)b->Buf));
+				if (out_sa == NULL || out_sa->IkeSa != sa)
+				{
+					continue;
+				}
+
+				SeInfo("IKE: SA #%u: Child SA Deleted by Peer", sa->Id);
+
+				if (out_sa->Pair != NULL)
+				{
+					SeAdd(spi_list, SeMemToBuf(&out_sa->Pair->Spi, sizeof(UINT)));
+					SeSecFreeIPsecSa(s, out_sa->Pair);
+				}
+				SeSecFreeIPsecSa(s, out_sa);
+			}
+
+			if (SE_LIST_NUM(spi_list) != 0)
+			{
+				SeAdd(response, SeIke2NewDeletePayload(SE_IKE_PROTOCOL_ID_IPSEC_ESP, spi_list));
+			}
+			else
+			{
+				SeFreeList(spi_list);
+			}
+		}
+	}
+}
+
+// 相手からの Child SA 作成要求の処理 (鍵更新のみ受け付ける)
+void SeSecIke2ProcessPeerCreateChild(SE_SEC *s, SE_IKE_SA *sa, SE_IKE_PACKET *packet, SE_LIST *response)
+{
+	SE_IKE_PACKET_PAYLOAD *rekey_payload, *sa_payload, *nonce_payload;
+	SE_IPSEC_SA *old_sa = NULL;
+	SE_BUF *my_nonce;
+	UINT your_spi, my_spi;
+	// 引数チェック
+	if (s == NULL || sa == NULL || packet == NULL || response == NULL)
+	{
+		return;
+	}
+
+	if (sa->Ike2Request == SE_SEC_IKE2_REQ_REKEY_CHILD)
+	{
+		// 自分の鍵更新と衝突した場合は相手に再試行させる
+		SeAdd(response, SeIke2NewNoticePayload(0, SE_IKE2_NOTICE_TEMPORARY_FAILURE, NULL, 0, NULL, 0));
+		return;
+	}
+
+	rekey_payload = SeIke2GetNotice(packet->PayloadList, SE_IKE2_NOTICE_REKEY_SA);
+	sa_payload = SeIkeGetPayload(packet->PayloadList, SE_IKE2_PAYLOAD_SA, 0);
+	nonce_payload = SeIkeGetPayload(packet->PayloadList, SE_IKE2_PAYLOAD_NONCE, 0);
+
+	if (rekey_payload == NULL || sa_payload == NULL || nonce_payload == NULL ||
+		SeIkeGetPayload(packet->PayloadList, SE_IKE2_PAYLOAD_KEY_EXCHANGE, 0) != NULL ||
+		SeSecIke2GetChildSpi(s, sa_payload, &your_spi) == false)
+	{
+		// IKE SA の鍵更新, PFS および新規 Child SA には対応しない
+		SeAdd(response, SeIke2NewNoticePayload(0, SE_IKE2_NOTICE_NO_PROPOSAL_CHOSEN, NULL, 0, NULL, 0));
+		return;
+	}
+
+	if (rekey_payload->Payload.Notice.Spi->Size == sizeof(UINT))
+	{
+		old_sa = SeSecGetIPsecSaBySpi(s, true, *((UINT *)rekey_payload->Payload.Notice.Spi->Buf));
+	}
+	if (old_sa == NULL || old_sa->IkeSa != sa)
+	{
+		SeAdd(response, SeIke2NewNoticePayload(SE_IKE_PROTOCOL_ID_IPSEC_ESP, SE_IKE2_NOTICE_CHILD_SA_NOT_FOUND,
+			rekey_payload->Payload.Notice.Spi->Buf, rekey_payload->Payload.Notice.Spi->Size, NULL, 0));
+		return;
+	}
+
+	my_spi = SeSecGenIPsecSASpi(s);
+	my_nonce = SeRandBuf(SE_SHA1_HASH_SIZE);
+
+	// 相手がイニシエータとなる鍵更新
+	SeSecIke2InstallChildSa(s, sa, my_spi, your_spi,
+		nonce_payload->Payload.GeneralData.Data, my_nonce, false, old_sa);
+
+	SeInfo("IKE: SA #%u: Child SA Rekeyed by Peer", sa->Id);
+
+	SeAdd(response, SeSecIke2NewChildSaPayload(s, my_spi));
+	SeAdd(response, SeIkeNewDataPayload(SE_IKE2_PAYLOAD_NONCE, my_nonce->Buf, my_nonce->Size));
+	SeSecIke2AddTsPayloads(s, response);
+
+	SeFreeBuf(my_nonce);
+}
+
+// IKEv2 の IKE SA メッセージ処理
+void SeSecIke2ProcessIkeSaMsg(SE_SEC *s, SE_IKE_SA *sa, SE_IKE_PACKET *packet_header, void *data, UINT size)
+{
+	// 引数チェック
+	if (s == NULL || sa == NULL || packet_header == NULL || data == NULL)
+	{
+		return;
+	}
+
+	if (packet_header->FlagInitiator)
+	{
+		// 自分は常にオリジナルのイニシエータである
+		return;
+	}
+
+	if (packet_header->FlagResponse)
+	{
+		// 自分が送信した要求に対する応答
+		if (sa->Ike2Request == SE_SEC_IKE2_REQ_NONE ||
+			packet_header->MessageId != (sa->Ike2NextMessageId - 1))
+		{
+			return;
+		}
+
+		switch (sa->Ike2Request)
+		{
+		case SE_SEC_IKE2_REQ_SA_INIT:
+			if (packet_header->ExchangeType == SE_IKE2_EXCHANGE_TYPE_IKE_SA_INIT)
+			{
+				SeSecIke2RecvInit(s, sa, data, size);
+			}
+			break;
+
+		case SE_SEC_IKE2_REQ_AUTH:
+			if (packet_header->ExchangeType == SE_IKE2_EXCHANGE_TYPE_IKE_AUTH)
+			{
+				SeSecIke2RecvAuth(s, sa, data, size);
+			}
+			break;
+
+		case SE_SEC_IKE2_REQ_REKEY_CHILD:
+			if (packet_header->ExchangeType == SE_IKE2_EXCHANGE_TYPE_CREATE_CHILD_SA)
+			{
+				SeSecIke2RecvRekeyChild(s, sa, data, size);
+			}
+			break;
+
+		case SE_SEC_IKE2_REQ_DELETE_CHILD:
+			if (packet_header->ExchangeType == SE_IKE2_EXCHANGE_TYPE_INFORMATIONAL)
+			{
+				SeSecIke2RecvDeleteChild(s, sa, data, size);
+			}
+			break;
+		}
+	}
+	else
+	{
+		// 相手からの要求
+		if (sa->Established)
+		{
+			SeSecIke2ProcessRequest(s, sa, data, size);
+		}
+	}
+}
+
+// IKEv2 の IKE SA ごとの定期処理 (再送, Child SA の鍵更新)
+void SeSecIke2ProcessMain(SE_SEC *s, SE_IKE_SA *sa)
+{
+	UINT64 now;
+	SE_IPSEC_SA *child;
+	SE_SEC_CONFIG *config;
+	// 引数チェック
+	if (s == NULL || sa == NULL)
+	{
+		return;
+	}
+
+	if (sa->Ike2 == false || sa->DeleteNow)
+	{
+		return;
+	}
+
+	config = &s->Config;
+	now = SeSecTick(s);
+
+	if (sa->Ike2Request != SE_SEC_IKE2_REQ_NONE)
+	{
+		// 応答待ちの要求の再送
+		if (sa->Ike2RetransmitTick <= now)
+		{
+			if (sa->Ike2RetransmitCount >= SE_SEC_IKE2_RETRANSMIT_MAX)
+			{
+				SeError("IKE: SA #%u: No Response from Peer", sa->Id);
+				SeSecIke2ClearRequest(sa);
+
+				if (sa->Established)
+				{
+					// 相手は応答しないので削除要求も送らない
+					sa->Ike2Deleting = true;
+					sa->DeleteNow = true;
+					s->StatusChanged = true;
+				}
+			}
+			else
+			{
+				sa->Ike2RetransmitCount++;
+				sa->Ike2RetransmitTick = now + (UINT64)SE_SEC_IKE2_RETRANSMIT_INTERVAL;
+				SeSecAddTimer(s, SE_SEC_IKE2_RETRANSMIT_INTERVAL);
+
+				SeSecSendUdp(s, &sa->DestAddr, &sa->SrcAddr, sa->DestPort, sa->SrcPort,
+					sa->Ike2LastRequest->Buf, sa->Ike2LastRequest->Size);
+			}
+		}
+
+		return;
+	}
+
+	if (sa->Established == false || sa->Ike2RekeyRetryTick > now)
+	{
+		return;
+	}
+
+	// 有効期限が近づいた Child SA の鍵更新
+	child = SeSecIke2GetCurrentChildSa(s, sa);
+	if (child != NULL && child->Pair != NULL)
+	{
+		if (SeSecIke2IsRekeyTime(s, child->EstablishedTick, child->TransferBytes,
+			config->VpnPhase2LifeSeconds, config->VpnPhase2LifeKilobytes) ||
+			SeSecIke2IsRekeyTime(s, child->Pair->EstablishedTick, child->Pair->TransferBytes,
+			config->VpnPhase2LifeSeconds, config->VpnPhase2LifeKilobytes))
+		{
+			SeSecIke2SendRekeyChild(s, sa, child);
+		}
+	}
+}
+
+// 有効期限が近づいた IKEv2 の IKE SA の再認証
+void SeSecIke2CheckReauth(SE_SEC *s)
+{
+	UINT i;
+	SE_SEC_CONFIG *config;
+	SE_IKE_SA *target = NULL;
+	// 引数チェック
+	if (s == NULL)
+	{
+		return;
+	}
+
+	config = &s->Config;
+
+	for (i = 0;i < SE_LIST_NUM(s->IkeSaList);i++)
+	{
+		SE_IKE_SA *sa = SE_LIST_DATA(s->IkeSaList, i);
+
+		if (sa->DeleteNow)
+		{
+			continue;
+		}
+
+		if (sa->Established == false)
+		{
+			// 接続処理中の SA がある
+			return;
+		}
+
+		if (sa->Ike2 && SeSecIke2IsRekeyTime(s, sa->Phase1EstablishedTick, sa->TransferBytes,
+			config->VpnPhase1LifeSeconds, config->VpnPhase1LifeKilobytes))
+		{
+			target = sa;
+		}
+	}
+
+	if (target != NULL)
+	{
+		// 新しい IKE SA が確立するまで古い IKE SA と IPsec SA を使用し続ける
+		SeInfo("IKE: SA #%u: Reauthentication Started", target->Id);
+
+		SeSecIke2SendInit(s);
+	}
+}
+
+// IKEv2 の応答を受信する IKE SA の検索
+SE_IKE_SA *SeSecIke2SearchIkeSa(SE_SEC *s, SE_IKE_IP_ADDR *src_addr, SE_IKE_IP_ADDR *dest_addr,
+								UINT src_port, UINT dest_port, SE_IKE_PACKET *packet_header)
+{
+	UINT i;
+	// 引数チェック
+	if (s == NULL || src_addr == NULL || dest_addr == NULL || packet_header == NULL)
+	{
+		return NULL;
+	}
+
+	for (i = 0;i < SE_LIST_NUM(s->IkeSaList);i++)
+	{
+		SE_IKE_SA *sa = SE_LIST_DATA(s->IkeSaList, i);
+
+		if (sa->Ike2 &&
+			sa->InitiatorCookie == packet_header->InitiatorCookie &&
+			(sa->ResponderCookie == packet_header->ResponderCookie ||
+			(sa->Phase == 0 && packet_header->ExchangeType == SE_IKE2_EXCHANGE_TYPE_IKE_SA_INIT)) &&
+			sa->DestPort == src_port &&
+			sa->SrcPort == dest_port &&
+			SeCmp(&sa->DestAddr, src_addr, sizeof(SE_IKE_IP_ADDR)) == 0 &&
+			SeCmp(&sa->SrcAddr, dest_addr, sizeof(SE_IKE_IP_ADDR)) == 0)
+		{
+			return sa;
+		}
+	}
+
+	return NULL;
+}
+
+// 要求の送信 (応答を受信するまで再送する)
+void SeSecIke2SendRequest(SE_SEC *s, SE_IKE_SA *sa, UINT request, UCHAR exchange_type, SE_LIST *payload_list)
+{
+	SE_IKE_PACKET *packet;
+	SE_IKE2_CRYPTO_PARAM cparam;
+	SE_BUF *packet_buf;
+	// 引数チェック
+	if (s == NULL || sa == NULL || payload_list == NULL)
+	{
+		return;
+	}
+
+	packet = SeIkeNew(sa->InitiatorCookie, sa->ResponderCookie, exchange_type,
+		(request != SE_SEC_IKE2_REQ_SA_INIT), false, false, sa->Ike2NextMessageId++,
+		payload_list);
+	packet->FlagInitiator = true;
+
+	SeZero(&cparam, sizeof(cparam));
+	cparam.DesKey = sa->Ike2KeySet.DesKeyI;
+	cparam.IntegKey = sa->Ike2KeySet.SK_ai;
+
+	packet_buf = SeIke2Build(packet, &cparam);
+	if (packet_buf == NULL)
+	{
+		SeIkeFree(packet);
+		return;
+	}
+
+	sa->TransferBytes += packet->DecryptedPayload->Size;
+
+	if (sa->Ike2LastRequest != NULL)
+	{
+		SeFreeBuf(sa->Ike2LastRequest);
+	}
+	sa->Ike2LastRequest = packet_buf;
+	sa->Ike2Request = request;
+	sa->Ike2RetransmitCount = 0;
+	sa->Ike2RetransmitTick = SeSecTick(s) + (UINT64)SE_SEC_IKE2_RETRANSMIT_INTERVAL;
+	SeSecAddTimer(s, SE_SEC_IKE2_RETRANSMIT_INTERVAL);
+
+	// 送信
+	SeSecSendUdp(s, &sa->DestAddr, &sa->SrcAddr, sa->DestPort, sa->SrcPort, packet_buf->Buf, packet_buf->Size);
+
+	SeIkeFree(packet);
+}
+
+// 応答待ちの要求の消去
+void SeSecIke2ClearRequest(SE_IKE_SA *sa)
+{
+	// 引数チェック
+	if (sa == NULL)
+	{
+		return;
+	}
+
+	if (sa->Ike2LastRequest != NULL)
+	{
+		SeFreeBuf(sa->Ike2LastRequest);
+		sa->Ike2LastRequest = NULL;
+	}
+
+	sa->Ike2Request = SE_SEC_IKE2_REQ_NONE;
+	sa->Ike2RetransmitCount = 0;
+}
+
+// 応答の送信
+void SeSecIke2SendResponse(SE_SEC *s, SE_IKE_SA *sa, UCHAR exchange_type, UINT msg_id, SE_LIST *payload_list)
+{
+	SE_IKE_PACKET *packet;
+	SE_IKE2_CRYPTO_PARAM cparam;
+	SE_BUF *packet_buf;
+	// 引数チェック
+	if (s == NULL || sa == NULL || payload_list == NULL)
+	{
+		return;
+	}
+
+	packet = SeIkeNew(sa->InitiatorCookie, sa->ResponderCookie, exchange_type,
+		true, false, false, msg_id, payload_list);
+	packet->FlagInitiator = true;
+	packet->FlagResponse = true;
+
+	SeZero(&cparam, sizeof(cparam));
+	cparam.DesKey = sa->Ike2KeySet.DesKeyI;
+	cparam.IntegKey = sa->Ike2KeySet.SK_ai;
+
+	packet_buf = SeIke2Build(packet, &cparam);
+	if (packet_buf == NULL)
+	{
+		SeIkeFree(packet);
+		return;
+	}
+
+	sa->TransferBytes += packet->DecryptedPayload->Size;
+
+	// 相手が要求を再送してきた場合に備えて保存しておく
+	if (sa->Ike2LastResponse != NULL)
+	{
+		SeFreeBuf(sa->Ike2LastResponse);
+	}
+	sa->Ike2LastResponse = packet_buf;
+
+	// 送信
+	SeSecSendUdp(s, &sa->DestAddr, &sa->SrcAddr, sa->DestPort, sa->SrcPort, packet_buf->Buf, packet_buf->Size);
+
+	SeIkeFree(packet);
+}
+
+// レスポンダから受信した暗号化メッセージの解析
+SE_IKE_PACKET *SeSecIke2ParseEncrypted(SE_IKE_SA *sa, void *data, UINT size)
+{
+	SE_IKE2_CRYPTO_PARAM cparam;
+	SE_IKE_PACKET *packet;
+	// 引数チェック
+	if (sa == NULL || data == NULL || sa->Phase < 1)
+	{
+		return NULL;
+	}
+
+	SeZero(&cparam, sizeof(cparam));
+	cparam.DesKey = sa->Ike2KeySet.DesKeyR;
+	cparam.IntegKey = sa->Ike2KeySet.SK_ar;
+
+	packet = SeIke2Parse(data, size, &cparam);
+	if (packet != NULL && packet->FlagEncrypted == false)
+	{
+		// IKE_SA_INIT 以降は暗号化されていなければならない
+		SeIkeFree(packet);
+		packet = NULL;
+	}
+
+	return packet;
+}
+
+// prf+ の計算
+// T1 = prf(K, S | 0x01), Tn = prf(K, Tn-1 | S | n)
+SE_BUF *SeSecIke2PrfPlus(SE_BUF *key, void *seed, UINT seed_size, UINT request_size)
+{
+	UCHAR t[SE_SHA1_HASH_SIZE];
+	UCHAR n;
+	SE_BUF *b, *tmp, *ret;
+	// 引数チェック
+	if (key == NULL || seed == NULL)
+	{
+		return NULL;
+	}
+
+	b = SeNewBuf();
+
+	for (n = 1;b->Size < request_size;n++)
+	{
+		tmp = SeNewBuf();
+		if (n >= 2)
+		{
+			SeWriteBuf(tmp, t, sizeof(t));
+		}
+		SeWriteBuf(tmp, seed, seed_size);
+		SeWriteBuf(tmp, &n, sizeof(n));
+
+		SeMacSha1(t, key->Buf, key->Size, tmp->Buf, tmp->Size);
+		SeWriteBuf(b, t, sizeof(t));
+
+		SeFreeBuf(tmp);
+	}
+
+	ret = SeMemToBuf(b->Buf, request_size);
+
+	SeFreeBuf(b);
+
+	return ret;
+}
+
+// IKEv2 の暗号化鍵の作成
+SE_DES_KEY *SeSecIke2NewDesKey(SE_SEC *s, SE_BUF *key)
+{
+	// 引数チェック
+	if (s == NULL || key == NULL)
+	{
+		return NULL;
+	}
+
+	if (s->Config.VpnPhase1Crypto == SE_IKE_P1_CRYPTO_DES_CBC)
+	{
+		return SeDesNewKey(key->Buf);
+	}
+	else
+	{
+		return SeDes3NewKey(((UCHAR *)key->Buf) + SE_DES_KEY_SIZE * 0,
+			((UCHAR *)key->Buf) + SE_DES_KEY_SIZE * 1,
+			((UCHAR *)key->Buf) + SE_DES_KEY_SIZE * 2);
+	}
+}
+
+// IKEv2 鍵セットの計算
+// SKEYSEED = prf(Ni | Nr, g^ir)
+// {SK_d | SK_ai | SK_ar | SK_ei | SK_er | SK_pi | SK_pr} = prf+(SKEYSEED, Ni | Nr | SPIi | SPIr)
+void SeSecIke2CalcKeySet(SE_SEC *s, SE_IKE_SA *sa, void *dh_key, UINT dh_key_size)
+{
+	SE_IKE2_KEYSET *set;
+	UCHAR skeyseed[SE_SHA1_HASH_SIZE];
+	SE_BUF *nonce, *seed, *keymat, *skeyseed_buf;
+	UINT enc_key_size;
+	// 引数チェック
+	if (s == NULL || sa == NULL || dh_key == NULL)
+	{
+		return;
+	}
+
+	set = &sa->Ike2KeySet;
+	SeSecIke2FreeKeySet(set);
+
+	enc_key_size = (s->Config.VpnPhase1Crypto == SE_IKE_P1_CRYPTO_DES_CBC ?
+		SE_DES_KEY_SIZE : SE_DES_KEY_SIZE * 3);
+
+	nonce = SeNewBuf();
+	SeWriteBufBuf(nonce, sa->Ike2MyNonce);
+	SeWriteBufBuf(nonce, sa->Ike2YourNonce);
+
+	SeMacSha1(skeyseed, nonce->Buf, nonce->Size, dh_key, dh_key_size);
+	skeyseed_buf = SeMemToBuf(skeyseed, sizeof(skeyseed));
+
+	seed = SeCloneBuf(nonce);
+	SeWriteBuf(seed, &sa->InitiatorCookie, sizeof(UINT64));
+	SeWriteBuf(seed, &sa->ResponderCookie, sizeof(UINT64));
+
+	keymat = SeSecIke2PrfPlus(skeyseed_buf, seed->Buf, seed->Size,
+		SE_SHA1_HASH_SIZE * 5 + enc_key_size * 2);
+
+	SeSeekBuf(keymat, 0, 0);
+	set->SK_d = SeReadBufFromBuf(keymat, SE_SHA1_HASH_SIZE);
+	set->SK_ai = SeReadBufFromBuf(keymat, SE_HMAC_SHA1_96_KEY_SIZE);
+	set->SK_ar = SeReadBufFromBuf(keymat, SE_HMAC_SHA1_96_KEY_SIZE);
+	set->SK_ei = SeReadBufFromBuf(keymat, enc_key_size);
+	set->SK_er = SeReadBufFromBuf(keymat, enc_key_size);
+	set->SK_pi = SeReadBufFromBuf(keymat, SE_SHA1_HASH_SIZE);
+	set->SK_pr = SeReadBufFromBuf(keymat, SE_SHA1_HASH_SIZE);
+
+	set->DesKeyI = SeSecIke2NewDesKey(s, set->SK_ei);
+	set->DesKeyR = SeSecIke2NewDesKey(s, set->SK_er);
+
+	SeFreeBuf(keymat);
+	SeFreeBuf(seed);
+	SeFreeBuf(skeyseed_buf);
+	SeFreeBuf(nonce);
+}
+
+// IKEv2 鍵セットの解放
+void SeSecIke2FreeKeySet(SE_IKE2_KEYSET *set)
+{
+	// 引数チェック
+	if (set == NULL)
+	{
+		return;
+	}
+
+	SeFreeBuf(set->SK_d);
+	SeFreeBuf(set->SK_ai);
+	SeFreeBuf(set->SK_ar);
+	SeFreeBuf(set->SK_ei);
+	SeFreeBuf(set->SK_er);
+	SeFreeBuf(set->SK_pi);
+	SeFreeBuf(set->SK_pr);
+
+	if (set->DesKeyI != NULL)
+	{
+		SeDes3FreeKey(set->DesKeyI);
+	}
+
+	if (set->DesKeyR != NULL)
+	{
+		SeDes3FreeKey(set->DesKeyR);
+	}
+
+	SeZero(set, sizeof(SE_IKE2_KEYSET));
+}
+
+// 事前共有鍵による AUTH の計算
+// AUTH = prf(prf(Shared Secret, "Key Pad for IKEv2"), <message> | Nonce | prf(SK_p, ID))
+SE_BUF *SeSecIke2CalcAuth(SE_SEC *s, SE_BUF *message, SE_BUF *nonce, SE_BUF *sk_p, SE_BUF *id_body)
+{
+	static char key_pad[] = "Key Pad for IKEv2";
+	UCHAR psk_key[SE_SHA1_HASH_SIZE];
+	UCHAR id_hash[SE_SHA1_HASH_SIZE];
+	UCHAR auth[SE_SHA1_HASH_SIZE];
+	SE_BUF *password, *b;
+	// 引数チェック
+	if (s == NULL || message == NULL || nonce == NULL || sk_p == NULL || id_body == NULL)
+	{
+		return NULL;
+	}
+
+	password = SeIkeStrToPassword(s->Config.VpnPassword);
+	SeMacSha1(psk_key, password->Buf, password->Size, key_pad, SeStrLen(key_pad));
+	SeFreeBuf(password);
+
+	SeMacSha1(id_hash, sk_p->Buf, sk_p->Size, id_body->Buf, id_body->Size);
+
+	b = SeNewBuf();
+	SeWriteBufBuf(b, message);
+	SeWriteBufBuf(b, nonce);
+	SeWriteBuf(b, id_hash, sizeof(id_hash));
+
+	SeMacSha1(auth, psk_key, sizeof(psk_key), b->Buf, b->Size);
+
+	SeFreeBuf(b);
+
+	return SeMemToBuf(auth, sizeof(auth));
+}
+
+// Child SA 用 SA ペイロードの作成
+SE_IKE_PACKET_PAYLOAD *SeSecIke2NewChildSaPayload(SE_SEC *s, UINT spi)
+{
+	SE_LIST *transform_list;
+	SE_LIST *proposal_list;
+	// 引数チェック
+	if (s == NULL)
+	{
+		return NULL;
+	}
+
+	transform_list = SeNewList(NULL);
+	SeAdd(transform_list, SeIke2NewTransform(SE_IKE2_TRANSFORM_TYPE_ENCR, s->Config.VpnPhase2Crypto, NULL));
+	SeAdd(transform_list, SeIke2NewTransform(SE_IKE2_TRANSFORM_TYPE_INTEG, SE_IKE2_INTEG_HMAC_SHA1_96, NULL));
+	SeAdd(transform_list, SeIke2NewTransform(SE_IKE2_TRANSFORM_TYPE_ESN, SE_IKE2_ESN_NONE, NULL));
+
+	proposal_list = SeNewList(NULL);
+	SeAdd(proposal_list, SeIke2NewProposal(1, SE_IKE_PROTOCOL_ID_IPSEC_ESP, &spi, sizeof(spi), transform_list));
+
+	return SeIke2NewSaPayload(proposal_list);
+}
+
+// Child SA 用 SA ペイロードから相手の SPI を取得
+bool SeSecIke2GetChildSpi(SE_SEC *s, SE_IKE_PACKET_PAYLOAD *sa_payload, UINT *spi)
+{
+	SE_IKE2_PACKET_PROPOSAL *proposal;
+	USHORT encr_id = 0;
+	// 引数チェック
+	if (s == NULL || sa_payload == NULL || spi == NULL)
+	{
+		return false;
+	}
+
+	if (SE_LIST_NUM(sa_payload->Payload.Sa2.ProposalList) == 0)
+	{
+		return false;
+	}
+
+	proposal = SE_LIST_DATA(sa_payload->Payload.Sa2.ProposalList, 0);
+
+	if (proposal->ProtocolId != SE_IKE_PROTOCOL_ID_IPSEC_ESP ||
+		proposal->Spi->Size != sizeof(UINT))
+	{
+		return false;
+	}
+
+	if (SeIke2GetTransformId(proposal, SE_IKE2_TRANSFORM_TYPE_ENCR, &encr_id) == false ||
+		encr_id != s->Config.VpnPhase2Crypto)
+	{
+		return false;
+	}
+
+	*spi = *((UINT *)proposal->Spi->Buf);
+
+	return true;
+}
+
+// トラフィックセレクタペイロードの追加
+// TSi は自分の仮想 IP アドレス, TSr は制限しない
+void SeSecIke2AddTsPayloads(SE_SEC *s, SE_LIST *payload_list)
+{
+	SE_LIST *tsi_list, *tsr_list;
+	UCHAR zero[sizeof(SE_IPV6_ADDR)];
+	UCHAR full[sizeof(SE_IPV6_ADDR)];
+	UINT i;
+	// 引数チェック
+	if (s == NULL || payload_list == NULL)
+	{
+		return;
+	}
+
+	SeZero(zero, sizeof(zero));
+	for (i = 0;i < sizeof(full);i++)
+	{
+		full[i] = 0xff;
+	}
+
+	tsi_list = SeNewList(NULL);
+	tsr_list = SeNewList(NULL);
+
+	if (s->IPv6 == false)
+	{
+		UINT myip_32 = Se4IPToUINT(SeIkeGetIPv4Address(&s->Config.MyVirtualIpAddress));
+
+		SeAdd(tsi_list, SeIke2NewTs(SE_IKE2_TS_IPV4_ADDR_RANGE, 0, 0, 65535,
+			&myip_32, &myip_32, sizeof(myip_32)));
+		SeAdd(tsr_list, SeIke2NewTs(SE_IKE2_TS_IPV4_ADDR_RANGE, 0, 0, 65535,
+			zero, full, sizeof(SE_IPV4_ADDR)));
+	}
+	else
+	{
+		SeAdd(tsi_list, SeIke2NewTs(SE_IKE2_TS_IPV6_ADDR_RANGE, 0, 0, 65535,
+			&s->Config.MyVirtualIpAddress.Address.Ipv6,
+			&s->Config.MyVirtualIpAddress.Address.Ipv6, sizeof(SE_IPV6_ADDR)));
+		SeAdd(tsr_list, SeIke2NewTs(SE_IKE2_TS_IPV6_ADDR_RANGE, 0, 0, 65535,
+			zero, full, sizeof(SE_IPV6_ADDR)));
+	}
+
+	SeAdd(payload_list, SeIke2NewTsPayload(SE_IKE2_PAYLOAD_TS_I, tsi_list));
+	SeAdd(payload_list, SeIke2NewTsPayload(SE_IKE2_PAYLOAD_TS_R, tsr_list));
+}
+
+// Child SA (送受信の IPsec SA の組) の確立
+// KEYMAT = prf+(SK_d, Ni | Nr) の前半がイニシエータからレスポンダへの鍵となる
+void SeSecIke2InstallChildSa(SE_SEC *s, SE_IKE_SA *sa, UINT my_spi, UINT your_spi,
+							 SE_BUF *nonce_i, SE_BUF *nonce_r, bool initiator, SE_IPSEC_SA *old_sa)
+{
+	SE_BUF *seed, *keymat, *key_i, *key_r;
+	SE_IPSEC_SA *ipsec_sa_in, *ipsec_sa_out;
+	UINT key_size;
+	// 引数チェック
+	if (s == NULL || sa == NULL || nonce_i == NULL || nonce_r == NULL)
+	{
+		return;
+	}
+
+	key_size = SeIkePhase2CryptIdToKeySize(s->Config.VpnPhase2Crypto) + SE_HMAC_SHA1_96_KEY_SIZE;
+
+	seed = SeNewBuf();
+	SeWriteBufBuf(seed, nonce_i);
+	SeWriteBufBuf(seed, nonce_r);
+
+	keymat = SeSecIke2PrfPlus(sa->Ike2KeySet.SK_d, seed->Buf, seed->Size, key_size * 2);
+
+	key_i = SeMemToBuf(keymat->Buf, key_size);
+	key_r = SeMemToBuf(((UCHAR *)keymat->Buf) + key_size, key_size);
+
+	ipsec_sa_in = SeSecNewIPsecSa(s, sa, false, my_spi,
+		sa->SrcAddr, sa->DestAddr, (initiator ? key_r : key_i));
+	ipsec_sa_out = SeSecNewIPsecSa(s, sa, true, your_spi,
+		sa->SrcAddr, sa->DestAddr, (initiator ? key_i : key_r));
+
+	ipsec_sa_in->Pair = ipsec_sa_out;
+	ipsec_sa_out->Pair = ipsec_sa_in;
+
+	// 古い SA は削除されるまで受信にのみ使用する
+	if (old_sa != NULL)
+	{
+		old_sa->Replaced = true;
+		if (old_sa->Pair != NULL)
+		{
+			old_sa->Pair->Replaced = true;
+		}
+	}
+
+	s->StatusChanged = true;
+
+	SeFreeBuf(key_i);
+	SeFreeBuf(key_r);
+	SeFreeBuf(keymat);
+	SeFreeBuf(seed);
+}
+
+// 現在使用中の Child SA (送信側) の取得
+SE_IPSEC_SA *SeSecIke2GetCurrentChildSa(SE_SEC *s, SE_IKE_SA *sa)
+{
+	UINT i;
+	// 引数チェック
+	if (s == NULL || sa == NULL)
+	{
+		return NULL;
+	}
+
+	for (i = 0;i < SE_LIST_NUM(s->IPsecSaList);i++)
+	{
+		UINT j = SE_LIST_NUM(s->IPsecSaList) - i - 1;
+		SE_IPSEC_SA *ipsec_sa = SE_LIST_DATA(s->IPsecSaList, j);
+
+		if (ipsec_sa->IkeSa == sa && ipsec_sa->Outgoing && ipsec_sa->Replaced == false)
+		{
+			return ipsec_sa;
+		}
+	}
+
+	return NULL;
+}
+
+// 鍵更新の時期かどうか (有効期限の SE_SEC_IKE2_REKEY_PERCENT % に到達)
+bool SeSecIke2IsRekeyTime(SE_SEC *s, UINT64 established_tick, UINT64 transfer_bytes, UINT life_seconds, UINT life_kilobytes)
+{
+	// 引数チェック
+	if (s == NULL)
+	{
+		return false;
+	}
+
+	if (life_kilobytes != 0)
+	{
+		UINT64 value = (UINT64)life_kilobytes * 1024ULL * SE_SEC_IKE2_REKEY_PERCENT / 100ULL;
+
+		if (transfer_bytes >= value)
+		{
+			return true;
+		}
+	}
+
+	if (life_seconds != 0 && established_tick != 0)
+	{
+		UINT64 value = (UINT64)life_seconds * 1000ULL * SE_SEC_IKE2_REKEY_PERCENT / 100ULL +
+			established_tick;
+
+		if (value <= SeSecTick(s))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// IKEv2 の IKE SA 固有データの解放
+void SeSecIke2FreeIkeSa(SE_SEC *s, SE_IKE_SA *sa)
+{
+	// 引数チェック
+	if (s == NULL || sa == NULL)
+	{
+		return;
+	}
+
+	SeSecIke2SendDeleteIke(s, sa);
+
+	SeSecIke2ClearRequest(sa);
+	SeSecIke2FreeKeySet(&sa->Ike2KeySet);
+
+	SeFreeBuf(sa->Ike2MyNonce);
+	SeFreeBuf(sa->Ike2YourNonce);
+	SeFreeBuf(sa->Ike2InitRequest);
+	SeFreeBuf(sa->Ike2InitResponse);
+	SeFreeBuf(sa->Ike2Cookie);
+	SeFreeBuf(sa->Ike2LastResponse);
+	SeFreeBuf(sa->Ike2RekeyMyNonce);
+}
@@ -198,6 +198,9 @@ typedef struct SE_FIFO SE_FIFO;
 typedef struct SE_LIST SE_LIST;
 typedef struct SE_QUEUE SE_QUEUE;
 typedef struct SE_STACK SE_STACK;
+typedef struct SE_MEMORY_POOL SE_MEMORY_POOL;
+typedef struct SE_ARENA_CHUNK SE_ARENA_CHUNK;
+typedef struct SE_ARENA SE_ARENA;
 
 // SeStr.h
 typedef struct SE_TOKEN_LIST SE_TOKEN_LIST;
@@ -296,6 +299,21 @@ typedef struct SE_IKE_PACKET_DELETE_PAYLOAD SE_IKE_PACKET_DELETE_PAYLOAD;
 typedef struct SE_IKE_CRYPTO_PARAM SE_IKE_CRYPTO_PARAM;
 typedef struct SE_IKE_IP_ADDR SE_IKE_IP_ADDR;
 typedef struct SE_IKE_P1_KEYSET SE_IKE_P1_KEYSET;
+typedef struct SE_IKE2_TRANSFORM_HEADER SE_IKE2_TRANSFORM_HEADER;
+typedef struct SE_IKE2_KE_HEADER SE_IKE2_KE_HEADER;
+typedef struct SE_IKE2_AUTH_HEADER SE_IKE2_AUTH_HEADER;
+typedef struct SE_IKE2_NOTICE_HEADER SE_IKE2_NOTICE_HEADER;
+typedef struct SE_IKE2_DELETE_HEADER SE_IKE2_DELETE_HEADER;
+typedef struct SE_IKE2_TS_HEADER SE_IKE2_TS_HEADER;
+typedef struct SE_IKE2_TS_SELECTOR_HEADER SE_IKE2_TS_SELECTOR_HEADER;
+typedef struct SE_IKE2_PACKET_TRANSFORM SE_IKE2_PACKET_TRANSFORM;
+typedef struct SE_IKE2_PACKET_PROPOSAL SE_IKE2_PACKET_PROPOSAL;
+typedef struct SE_IKE2_PACKET_SA_PAYLOAD SE_IKE2_PACKET_SA_PAYLOAD;
+typedef struct SE_IKE2_PACKET_KE_PAYLOAD SE_IKE2_PACKET_KE_PAYLOAD;
+typedef struct SE_IKE2_PACKET_AUTH_PAYLOAD SE_IKE2_PACKET_AUTH_PAYLOAD;
+typedef struct SE_IKE2_PACKET_TS SE_IKE2_PACKET_TS;
+typedef struct SE_IKE2_PACKET_TS_PAYLOAD SE_IKE2_PACKET_TS_PAYLOAD;
+typedef struct SE_IKE2_CRYPTO_PARAM SE_IKE2_CRYPTO_PARAM;
 
 
 // SeSec.h
@@ -304,6 +322,7 @@ typedef struct SE_SEC_CLIENT_FUNCTION_TABLE SE_SEC_CLIENT_FUNCTION_TABLE;
 typedef struct SE_SEC_CONFIG SE_SEC_CONFIG;
 typedef struct SE_IKE_SA SE_IKE_SA;
 typedef struct SE_IPSEC_SA SE_IPSEC_SA;
+typedef struct SE_IKE2_KEYSET SE_IKE2_KEYSET;
 typedef void (SE_SEC_TIMER_CALLBACK)(UINT64 tick, void *param);
 typedef void (SE_SEC_UDP_RECV_CALLBACK)(SE_IKE_IP_ADDR *dest_addr, SE_IKE_IP_ADDR *src_addr, UINT dest_port, UINT src_port, void *data, UINT size, void *param);
 typedef void (SE_SEC_ESP_RECV_CALLBACK)(SE_IKE_IP_ADDR *dest_addr, SE_IKE_IP_ADDR *src_addr, void *data, UINT size, void *param);
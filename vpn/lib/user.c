@@ -390,6 +390,7 @@ static struct SE_SYSCALL_TABLE vpnsys = {
 	.SysFreeData = FreeData,
 	.SysRsaSign = RsaSign,
 	.SysLog = Log,
+	.SysGetRandom = vpn_GetRandom,
 };
 
 static void
@@ -454,6 +455,18 @@ msg_vpn_GetTickCount (void)
 	return arg.retval;
 }
 
+void
+msg_vpn_GetRandom (void *data, UINT size)
+{
+	struct vpnkernel_msg_getrandom arg;
+	struct msgbuf buf[2];
+
+	setmsgbuf (&buf[0], &arg, sizeof arg, 1);
+	setmsgbuf (&buf[1], data, size, 1);
+	callsub (VPNKERNEL_MSG_GETRANDOM, buf, 2);
+	set_cpu_id (arg.cpu);
+}
+
 void
 msg_vpn_GetPhysicalNicInfo (SE_HANDLE nic_handle, SE_NICINFO *info)
 {
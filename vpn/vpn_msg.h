@@ -37,6 +37,7 @@ enum {
 	VPNKERNEL_MSG_SETVIRTUALNICRECVCALLBACK,
 	VPNKERNEL_MSG_SET_TIMER,
 	VPNKERNEL_MSG_GETTICKCOUNT,
+	VPNKERNEL_MSG_GETRANDOM,
 };
 
 enum {
@@ -98,6 +99,10 @@ struct vpnkernel_msg_gettickcount {
 	UINT cpu;
 };
 
+struct vpnkernel_msg_getrandom {
+	UINT cpu;
+};
+
 struct vpn_msg_start {
 	int handle;
 	UINT cpu;
@@ -125,6 +130,7 @@ struct vpn_msg_timer {
 
 UINT vpn_GetCurrentCpuId (void);
 UINT vpn_GetTickCount (void);
+void vpn_GetRandom (void *buf, UINT size);
 SE_HANDLE vpn_NewTimer (SE_SYS_CALLBACK_TIMER *callback, void *param);
 void vpn_SetTimer (SE_HANDLE timer_handle, UINT interval);
 void vpn_FreeTimer (SE_HANDLE timer_handle);